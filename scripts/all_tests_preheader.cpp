@@ -6,6 +6,8 @@
 #include <random>
 #include <chrono>
 #include <deque>
+#include <unordered_map>
+#include <unordered_set>
 
 using namespace tomsolver;
 
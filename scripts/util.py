@@ -47,6 +47,9 @@ class MyClass:
 
         self.contents = []
 
+        # 当前所处的#if嵌套层数。条件编译块内的#include <>和#define原样保留在正文中，不提取到文件开头
+        conditionDepth = 0
+
         for line in lines_orig:
             stripedLine = line.strip()
 
@@ -54,6 +57,15 @@ class MyClass:
             if stripedLine == "#pragma once":
                 continue
 
+            if re.match(r"#\s*if", stripedLine):
+                conditionDepth += 1
+            elif re.match(r"#\s*endif", stripedLine):
+                conditionDepth -= 1
+
+            if conditionDepth > 0 and re.match(r"#\s*(include\s+<|define)", stripedLine):
+                self.contents.append(line.rstrip())
+                continue
+
             innerDep = re.match(r"#include\s+\"([a-z_./\\]+)\"", stripedLine)
             if innerDep is not None:
                 basename = innerDep.group(1)
@@ -3,117 +3,59 @@
 #define _USE_MATH_DEFINES
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <cctype>
+#include <cerrno>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <exception>
 #include <forward_list>
+#include <fstream>
 #include <functional>
+#include <iomanip>
 #include <iostream>
 #include <iterator>
 #include <limits>
+#include <list>
 #include <map>
 #include <math.h>
 #include <memory>
+#include <mutex>
+#include <numeric>
 #include <queue>
+#include <random>
 #include <regex>
 #include <set>
 #include <sstream>
 #include <stack>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <valarray>
 #include <vector>
 
 namespace tomsolver {
 
-constexpr double PI = M_PI;
-
-template <typename T>
-inline T radians(T &&t) noexcept {
-    return std::forward<T>(t) / 180.0 * PI;
-}
-
-template <typename T>
-inline T degrees(T &&t) noexcept {
-    return std::forward<T>(t) * 180.0 / PI;
-}
-
-enum class MathOperator {
-    MATH_NULL,
-    // 一元
-    MATH_POSITIVE,
-    MATH_NEGATIVE,
-
-    // 函数
-    MATH_SIN,
-    MATH_COS,
-    MATH_TAN,
-    MATH_ARCSIN,
-    MATH_ARCCOS,
-    MATH_ARCTAN,
-    MATH_SQRT,
-    MATH_LOG,
-    MATH_LOG2,
-    MATH_LOG10,
-    MATH_EXP,
-
-    // 二元
-    MATH_ADD,
-    MATH_SUB,
-    MATH_MULTIPLY,
-    MATH_DIVIDE,
-    MATH_POWER,
-    MATH_AND,
-    MATH_OR,
-    MATH_MOD,
-
-    MATH_LEFT_PARENTHESIS,
-    MATH_RIGHT_PARENTHESIS
-};
-
-/**
- * 操作符转std::string
- */
-inline std::string MathOperatorToStr(MathOperator op);
-
-/**
- * 取得操作数的数量。
- */
-inline int GetOperatorNum(MathOperator op) noexcept;
-
-/**
-* 返回运算符的优先级
-
-*/
-inline int Rank(MathOperator op) noexcept;
-
-/**
- * 返回运算符结合性
- */
-inline bool IsLeft2Right(MathOperator eOperator) noexcept;
-
-/**
- * 返回是否满足交换律
- */
-inline bool InAssociativeLaws(MathOperator eOperator) noexcept;
-
-/**
- * 返回是否是函数
- */
-inline bool IsFunction(MathOperator op) noexcept;
+namespace internal {
 
 /**
- * 是整数 且 为偶数
- * FIXME: 超出long long范围的处理
+ * 把[0, n)切分为若干块，交给最多Config::Get().threadNum个线程并行执行func(begin, end)。
+ * 每个线程执行完一块后再领取下一块。线程数为1或者n不超过1时，直接在当前线程执行。
+ * 如果func抛出异常，等所有线程结束后在当前线程重新抛出第一个异常。
  */
-inline bool IsIntAndEven(double n) noexcept;
+inline void ParallelFor(int n, const std::function<void(int, int)> &func);
 
-inline double Calc(MathOperator op, double v1, double v2);
+} // namespace internal
 
 } // namespace tomsolver
 /*
@@ -303,6 +245,101 @@ inline double Dot(const Vec &a, const Vec &b) noexcept;
 
 namespace tomsolver {
 
+/**
+ * 只读地映射整个文件。在unix与macOS上使用mmap，数据直接来自页缓存，不复制；其他平台上读入内存。
+ * 析构时解除映射。不可复制。
+ */
+class MappedFile {
+public:
+    /**
+     * @exception runtime_error 无法打开或者映射文件
+     */
+    explicit MappedFile(const std::string &filename);
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile();
+
+    /**
+     * 文件内容。空文件时为nullptr。
+     */
+    const char *Data() const noexcept;
+
+    std::size_t Size() const noexcept;
+
+private:
+    const char *data = nullptr;
+    std::size_t size = 0;
+    std::string buffer; // 不支持mmap的平台上保存文件内容
+};
+
+} // namespace tomsolver
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace tomsolver {
+
+inline MappedFile::MappedFile(const std::string &filename) {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("can not open file: " + filename);
+    }
+    std::shared_ptr<void> closeFile(nullptr, [fd](...) {
+        close(fd);
+    });
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        throw std::runtime_error("can not stat file: " + filename);
+    }
+    size = static_cast<std::size_t>(st.st_size);
+    if (size == 0) {
+        return;
+    }
+
+    auto addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error("can not map file: " + filename);
+    }
+    data = static_cast<const char *>(addr);
+#else
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("can not open file: " + filename);
+    }
+    buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    size = buffer.size();
+    data = size ? buffer.data() : nullptr;
+#endif
+}
+
+inline MappedFile::~MappedFile() {
+#if defined(__unix__) || defined(__APPLE__)
+    if (data) {
+        munmap(const_cast<char *>(data), size);
+    }
+#endif
+}
+
+inline const char *MappedFile::Data() const noexcept {
+    return data;
+}
+
+inline std::size_t MappedFile::Size() const noexcept {
+    return size;
+}
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
 /**
  * 求解线性方程组Ax = b。传入矩阵A，向量b，返回向量x。
  * @exception MathError 奇异矩阵
@@ -312,6 +349,76 @@ namespace tomsolver {
  */
 inline Vec SolveLinear(Mat A, Vec b);
 
+/**
+ * 混合精度求解线性方程组Ax = b：以float做LU分解，再以double迭代改进（iterative refinement）。
+ * 分解的开销与访存量约为double的一半，A的条件数不太大时结果与SolveLinear()同样精确。
+ * A不是方阵、float分解失败（主元过小或超出float的范围），或者改进过程停滞（残差不再下降）时，退回SolveLinear()。
+ * @exception MathError 同SolveLinear()
+ */
+inline Vec SolveLinearMixedPrecision(const Mat &A, const Vec &b);
+
+namespace internal {
+
+/**
+ * 以标量类型T对n阶方阵A做列主元LU分解。A按行优先存放，结果原地写回：
+ * 严格下三角部分为L（对角线为1，不存储），上三角部分为U。perm记录行交换，第i行分解前是原来的第perm[i]行。
+ * 主元的绝对值不大于tiny时返回false，此时A的内容无意义。
+ */
+template <typename T>
+inline bool LuDecompose(int n, T *A, int *perm, T tiny) noexcept {
+    for (int i = 0; i < n; ++i) {
+        perm[i] = i;
+    }
+    for (int k = 0; k < n; ++k) {
+        int p = k;
+        for (int i = k + 1; i < n; ++i) {
+            if (std::abs(A[i * n + k]) > std::abs(A[p * n + k])) {
+                p = i;
+            }
+        }
+        if (!(std::abs(A[p * n + k]) > tiny)) {
+            return false;
+        }
+        if (p != k) {
+            std::swap_ranges(A + p * n, A + p * n + n, A + k * n);
+            std::swap(perm[p], perm[k]);
+        }
+        for (int i = k + 1; i < n; ++i) {
+            auto ratio = A[i * n + k] / A[k * n + k];
+            A[i * n + k] = ratio;
+            for (int j = k + 1; j < n; ++j) {
+                A[i * n + j] -= ratio * A[k * n + j];
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * 用LuDecompose()的结果求解Ax = b。b原地替换为x。
+ * LU与b的标量类型可以不同，例如用float的分解求解double的方程。
+ */
+template <typename T, typename U>
+inline void LuSolve(int n, const T *LU, const int *perm, U *b) {
+    std::vector<U> y(b, b + n);
+    for (int i = 0; i < n; ++i) {
+        auto sum = y[perm[i]];
+        for (int j = 0; j < i; ++j) {
+            sum -= static_cast<U>(LU[i * n + j]) * b[j];
+        }
+        b[i] = sum;
+    }
+    for (int i = n - 1; i >= 0; --i) {
+        auto sum = b[i];
+        for (int j = i + 1; j < n; ++j) {
+            sum -= static_cast<U>(LU[i * n + j]) * b[j];
+        }
+        b[i] = sum / static_cast<U>(LU[i * n + i]);
+    }
+}
+
+} // namespace internal
+
 } // namespace tomsolver
 
 namespace tomsolver {
@@ -430,7 +537,13 @@ namespace tomsolver {
 
 enum class LogLevel { OFF, FATAL, ERROR, WARN, INFO, DEBUG, TRACE, ALL };
 
-enum class NonlinearMethod { NEWTON_RAPHSON, LM };
+enum class NonlinearMethod { NEWTON_RAPHSON, LM, HOMOTOPY };
+
+enum class LineSearchMethod { ARMIJO, STRONG_WOLFE, NON_MONOTONE };
+
+enum class SamplingMethod { LATIN_HYPERCUBE, SOBOL };
+
+enum class ScalarType { FLOAT, DOUBLE, LONG_DOUBLE };
 
 struct Config {
     /**
@@ -452,11 +565,84 @@ struct Config {
      */
     NonlinearMethod nonlinearMethod = NonlinearMethod::NEWTON_RAPHSON;
 
+    /**
+     * 同伦延拓法（HOMOTOPY）的初始步长、最小步长与最大步长，以参数t∈[0, 1]计。默认为0.1、1e-6、0.25。
+     */
+    double homotopyInitialStep = 0.1;
+    double homotopyMinStep = 1.0e-6;
+    double homotopyMaxStep = 0.25;
+
+    /**
+     * LM方法使用的一维搜索策略，见line_search.h。默认为ARMIJO。
+     * ARMIJO：回溯搜索，每个试探点只计算方程组；
+     * STRONG_WOLFE：满足强Wolfe条件，每个试探点还要计算雅可比矩阵，步长更好，适合病态的方程组；
+     * NON_MONOTONE：Grippo-Lampariello-Lucidi非单调回溯搜索，允许残差暂时上升。
+     */
+    LineSearchMethod lineSearchMethod = LineSearchMethod::ARMIJO;
+
+    /**
+     * NON_MONOTONE一维搜索参与比较的历史记录数量。默认为10。
+     */
+    int nonMonotoneMemory = 10;
+
+    /**
+     * 一维搜索每次最多尝试的步长数量。默认为50。
+     */
+    int maxLineSearchSteps = 50;
+
+    /**
+     * Newton-Raphson方法迭代时使用的标量类型。默认为DOUBLE。
+     * FLOAT：先以float迭代，直到残差不再下降，再以double迭代至收敛。float的求值与线性求解更快，适合做粗略的预求解；
+     * LONG_DOUBLE：先以long double迭代，直到残差不再下降，再以double迭代至收敛。适合病态的方程组。
+     */
+    ScalarType nonlinearScalarType = ScalarType::DOUBLE;
+
+    /**
+     * Newton-Raphson方法求解每一步的线性方程组时，是否使用SolveLinearMixedPrecision()：
+     * 以float分解雅可比矩阵，再以double迭代改进，改进停滞时自动退回SolveLinear()。适合规模较大的稠密方程组。默认为false。
+     */
+    bool mixedPrecisionLinearSolve = false;
+
+    /**
+     * 非线性方程求解时，缓存最近求值过的点的个数。线搜索在同一个点上重复计算F(x)、J(x)时直接使用缓存的结果。
+     * 为0时不使用缓存。默认为4。
+     */
+    std::size_t evaluationCacheSize = 4;
+
     /**
      * 非线性方程求解时，当没有为VarsTable传初值时，设定的初值
      */
     double initialValue = 1.0;
 
+    /**
+     * SolveMultiStart()生成初值的方法。默认为LATIN_HYPERCUBE。
+     * LATIN_HYPERCUBE：拉丁超立方采样，随机数种子为multiStartSeed；
+     * SOBOL：Sobol低差异序列，结果确定，最多支持21个变量。
+     */
+    SamplingMethod multiStartSampling = SamplingMethod::LATIN_HYPERCUBE;
+
+    /**
+     * SolveMultiStart()的起点数量。默认为64。
+     */
+    int multiStartCount = 64;
+
+    /**
+     * SolveMultiStart()使用LATIN_HYPERCUBE时的随机数种子。默认为0。
+     */
+    unsigned multiStartSeed = 0;
+
+    /**
+     * SolveMultiStart()判断两个根相同的相对容差：各分量之差都不超过rootTolerance * max(1, |x|)。默认为1e-6。
+     */
+    double rootTolerance = 1.0e-6;
+
+    /**
+     * SolveSweep()的初始步长、最小步长与最大步长，以参数区间的长度|end - begin|为单位。默认为0.05、1e-6、0.1。
+     */
+    double sweepInitialStep = 0.05;
+    double sweepMinStep = 1.0e-6;
+    double sweepMaxStep = 0.1;
+
     /**
      * 是否允许不定方程存在。
      * 例如，当等式数量大于未知数数量时，方程组成为不定方程；
@@ -464,6 +650,49 @@ struct Config {
      */
     bool allowIndeterminateEquation = false;
 
+    /**
+     * 求导结果缓存（DiffCache）最多保存的节点总数。为0时不使用缓存。默认为0。
+     */
+    std::size_t diffCacheCapacity = 0;
+
+    /**
+     * 可并行的计算（例如Jacobian）使用的线程数。为0时使用std::thread::hardware_concurrency()。默认为1，即不开启并行。
+     */
+    int threadNum = 1;
+
+    /**
+     * CompiledSymMat编译前，是否先用Optimize()对每个元素做等式饱和优化。
+     * 优化本身开销较大，适合编译一次、求值很多次的场合。默认为false。
+     */
+    bool optimizeBeforeCompile = false;
+
+    /**
+     * 非线性方程求解时，是否把方程组与雅可比矩阵编译为本地代码（NativeModel）再求值。
+     * 首次编译需要调用系统编译器，耗时较长，结果按模型缓存在磁盘上；仅支持POSIX平台。
+     * 编译失败时退回CompiledSymMat。默认为false。
+     */
+    bool nativeCompile = false;
+
+    /**
+     * NativeModel使用的编译器命令。默认为"c++"。
+     */
+    std::string nativeCompiler = "c++";
+
+    /**
+     * NativeModel存放共享库的目录。为空时使用环境变量TMPDIR，TMPDIR也为空时使用/tmp。
+     */
+    std::string nativeCacheDir;
+
+    /**
+     * Prepare()的磁盘缓存（PreparedCache）所在的目录，不存在时自动创建。为空时不使用缓存。默认为空。
+     */
+    std::string preparedCacheDir;
+
+    /**
+     * PreparedCache目录内缓存文件的总字节数上限，超过时按LRU策略删除最久未使用的文件。为0时不限制。默认为256MB。
+     */
+    std::size_t preparedCacheMaxBytes = 256 * 1024 * 1024;
+
     void Reset() noexcept;
 
     static Config &Get();
@@ -697,2146 +926,7573 @@ inline std::ostream &operator<<(std::ostream &out, const VarsTable &table) noexc
 
 namespace tomsolver {
 
-enum class NodeType { NUMBER, OPERATOR, VARIABLE };
-
-// 前置声明
 namespace internal {
-struct NodeImpl;
-}
-class SymMat;
 
-/**
- * 表达式节点。
- */
-using Node = std::unique_ptr<internal::NodeImpl>;
+inline void ParallelFor(int n, const std::function<void(int, int)> &func) {
+    auto threadNum = Config::Get().threadNum;
+    if (threadNum <= 0) {
+        threadNum = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    threadNum = std::max(1, std::min(threadNum, n));
 
-namespace internal {
+    if (threadNum == 1) {
+        if (n > 0) {
+            func(0, n);
+        }
+        return;
+    }
 
-/**
- * 单个节点的实现。通常应该以std::unique_ptr包裹。
- */
-struct NodeImpl {
+    // 每个线程平均领取4块，兼顾负载均衡与调度开销
+    auto chunkSize = std::max(1, n / (threadNum * 4));
+    std::atomic<int> next{0};
 
-    NodeImpl(NodeType type, MathOperator op, double value, std::string varname) noexcept
-        : type(type), op(op), value(value), varname(varname), parent(nullptr) {}
+    std::exception_ptr exception;
+    std::mutex mutex;
 
-    NodeImpl(const NodeImpl &rhs) noexcept;
-    NodeImpl &operator=(const NodeImpl &rhs) noexcept;
+    auto worker = [&] {
+        try {
+            for (auto begin = next.fetch_add(chunkSize); begin < n; begin = next.fetch_add(chunkSize)) {
+                func(begin, std::min(n, begin + chunkSize));
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!exception) {
+                exception = std::current_exception();
+            }
+            // 让其他线程尽快结束
+            next = n;
+        }
+    };
 
-    NodeImpl(NodeImpl &&rhs) noexcept;
-    NodeImpl &operator=(NodeImpl &&rhs) noexcept;
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadNum; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
 
-    ~NodeImpl();
+    for (auto &t : threads) {
+        t.join();
+    }
 
-    bool Equal(const Node &rhs) const noexcept;
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
 
-    /**
-     * 把整个节点以中序遍历的顺序输出为字符串。
-     * 例如：
-     *      Node n = (Var("a") + Num(1)) * Var("b");
-     *   则
-     *      n->ToString() == "(a+1.000000)*b"
-     */
-    std::string ToString() const noexcept;
-
-    /**
-     * 计算出整个表达式的数值。不改变自身。
-     * @exception runtime_error 如果有变量存在，则无法计算
-     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
-     */
-    double Vpa() const;
-
-    /**
-     * 计算出整个表达式的数值。不改变自身。
-     * @exception runtime_error 如果有变量存在，则无法计算
-     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
-     */
-    NodeImpl &Calc();
-
-    /**
-     * 返回表达式内出现的所有变量名。
-     */
-    std::set<std::string> GetAllVarNames() const noexcept;
-
-    /**
-     * 检查整个节点数的parent指针是否正确。
-     */
-    void CheckParent() const noexcept;
-
-private:
-    NodeType type = NodeType::NUMBER;
-    MathOperator op = MathOperator::MATH_NULL;
-    double value;
-    std::string varname;
-    NodeImpl *parent = nullptr;
-    Node left, right;
-    NodeImpl() = default;
-
-    /**
-     * 本节点如果是OPERATOR，检查操作数数量和left, right指针是否匹配。
-     */
-    void CheckOperatorNum() const noexcept;
-
-    /**
-     * 节点转string。仅限本节点，不含子节点。
-     */
-    std::string NodeToStr() const noexcept;
-
-    void ToStringRecursively(std::stringstream &output) const noexcept;
-
-    void ToStringNonRecursively(std::stringstream &output) const noexcept;
-
-    /**
-     * 计算表达式数值。递归实现。
-     * @exception runtime_error 如果有变量存在，则无法计算
-     * @exception MathError 不符合定义域, 除0等情况。
-     */
-    double VpaRecursively() const;
+} // namespace internal
 
-    /**
-     * 计算表达式数值。非递归实现。
-     * 性能弱于递归实现。但不会导致栈溢出。
-     * 根据benchmark，生成一组含4000个随机四则运算节点的表达式，生成1000次，Release下测试耗时3000ms。递归实现耗时2500ms。
-     * 粗略计算，即 1333 ops/ms。
-     * @exception runtime_error 如果有变量存在，则无法计算
-     * @exception MathError 不符合定义域, 除0等情况。
-     */
-    double VpaNonRecursively() const;
+} // namespace tomsolver
 
-    /**
-     * 释放整个节点树，除了自己。
-     * 实际是二叉树的非递归后序遍历。
-     */
-    void Release() noexcept;
+namespace tomsolver {
 
-    friend Node Operator(MathOperator op, Node left, Node right) noexcept;
+constexpr double PI = M_PI;
 
-    friend Node CloneRecursively(const Node &rhs) noexcept;
-    friend Node CloneNonRecursively(const Node &rhs) noexcept;
+template <typename T>
+inline T radians(T &&t) noexcept {
+    return std::forward<T>(t) / 180.0 * PI;
+}
 
-    friend void CopyOrMoveTo(NodeImpl *parent, Node &child, Node &&n1) noexcept;
-    friend void CopyOrMoveTo(NodeImpl *parent, Node &child, const Node &n1) noexcept;
+template <typename T>
+inline T degrees(T &&t) noexcept {
+    return std::forward<T>(t) * 180.0 / PI;
+}
 
-    friend std::ostream &operator<<(std::ostream &out, const Node &n) noexcept;
+enum class MathOperator : std::uint8_t {
+    MATH_NULL,
+    // 一元
+    MATH_POSITIVE,
+    MATH_NEGATIVE,
 
-    template <typename T>
-    friend Node UnaryOperator(MathOperator op, T &&n) noexcept;
+    // 函数
+    MATH_SIN,
+    MATH_COS,
+    MATH_TAN,
+    MATH_ARCSIN,
+    MATH_ARCCOS,
+    MATH_ARCTAN,
+    MATH_SQRT,
+    MATH_LOG,
+    MATH_LOG2,
+    MATH_LOG10,
+    MATH_EXP,
 
-    template <typename T1, typename T2>
-    friend Node BinaryOperator(MathOperator op, T1 &&n1, T2 &&n2) noexcept;
+    // 二元
+    MATH_ADD,
+    MATH_SUB,
+    MATH_MULTIPLY,
+    MATH_DIVIDE,
+    MATH_POWER,
+    MATH_AND,
+    MATH_OR,
+    MATH_MOD,
 
-    friend class tomsolver::SymMat;
-    friend class SimplifyFunctions;
-    friend class DiffFunctions;
-    friend class SubsFunctions;
-    friend class ParseFunctions;
+    MATH_LEFT_PARENTHESIS,
+    MATH_RIGHT_PARENTHESIS
 };
 
-inline Node CloneRecursively(const Node &rhs) noexcept;
-
-inline Node CloneNonRecursively(const Node &rhs) noexcept;
-
 /**
- * 对于一个节点n和另一个节点n1，把n1移动到作为n的子节点。
- * 用法：CopyOrMoveTo(n->parent, n->left, std::forward<T>(n1));
+ * 操作符转std::string
  */
-inline void CopyOrMoveTo(NodeImpl *parent, Node &child, Node &&n1) noexcept;
+inline std::string MathOperatorToStr(MathOperator op);
 
 /**
- * 对于一个节点n和另一个节点n1，把n1整个拷贝一份，把拷贝的副本设为n的子节点。
- * 用法：CopyOrMoveTo(n->parent, n->left, std::forward<T>(n1));
+ * 取得操作数的数量。
  */
-inline void CopyOrMoveTo(NodeImpl *parent, Node &child, const Node &n1) noexcept;
+inline int GetOperatorNum(MathOperator op) noexcept;
 
 /**
- * 重载std::ostream的<<操作符以输出一个Node节点。
- */
-inline std::ostream &operator<<(std::ostream &out, const Node &n) noexcept;
-
-template <typename T>
-inline Node UnaryOperator(MathOperator op, T &&n) noexcept {
-    auto ret = std::make_unique<NodeImpl>(NodeType::OPERATOR, op, 0, "");
-    CopyOrMoveTo(ret.get(), ret->left, std::forward<T>(n));
-    return ret;
-}
+* 返回运算符的优先级
 
-template <typename T1, typename T2>
-inline Node BinaryOperator(MathOperator op, T1 &&n1, T2 &&n2) noexcept {
-    auto ret = std::make_unique<NodeImpl>(NodeType::OPERATOR, op, 0, "");
-    CopyOrMoveTo(ret.get(), ret->left, std::forward<T1>(n1));
-    CopyOrMoveTo(ret.get(), ret->right, std::forward<T2>(n2));
-    return ret;
-}
+*/
+inline int Rank(MathOperator op) noexcept;
 
 /**
- * 新建一个运算符节点。
+ * 返回运算符结合性
  */
-inline Node Operator(MathOperator op, Node left = nullptr, Node right = nullptr) noexcept;
-
-} // namespace internal
-
-inline Node Clone(const Node &rhs) noexcept;
+inline bool IsLeft2Right(MathOperator eOperator) noexcept;
 
 /**
- * 对节点进行移动。等同于std::move。
+ * 返回是否满足交换律
  */
-inline Node Move(Node &rhs) noexcept;
+inline bool InAssociativeLaws(MathOperator eOperator) noexcept;
 
 /**
- * 新建一个数值节点。
+ * 返回是否是函数
  */
-inline Node Num(double num) noexcept;
+inline bool IsFunction(MathOperator op) noexcept;
 
 /**
- * 新建一个函数节点。
+ * 是整数 且 为偶数
+ * FIXME: 超出long long范围的处理
  */
-inline Node Op(MathOperator op);
+inline bool IsIntAndEven(double n) noexcept;
 
-/**
- * 返回变量名是否有效。（只支持英文数字或者下划线，第一个字符必须是英文或者下划线）
- */
-inline bool VarNameIsLegal(const std::string &varname) noexcept;
+inline double Calc(MathOperator op, double v1, double v2);
+
+namespace internal {
 
 /**
- * 新建一个变量节点。
- * @exception runtime_error 名字不合法
+ * 抛出表示op(v1, v2)出现浮点数无效值的MathError。
  */
-inline Node Var(std::string varname);
+[[noreturn]] void ThrowInvalidValue(MathOperator op, double v1, double v2);
 
-template <typename...>
-struct SfinaeNodeImpl : std::false_type {};
+} // namespace internal
 
-template <>
-struct SfinaeNodeImpl<Node> : std::true_type {};
+/**
+ * 以标量类型T（float、double、long double）计算op(v1, v2)，一元运算时忽略v2。
+ * 数学函数调用std::中T对应的重载，计算全程保持T的精度。Calc()即CalcAs<double>()。
+ * @exception MathError Config::Get().throwOnInvalidValue为true时，出现浮点数无效值(inf, -inf, nan)
+ */
+template <typename T>
+inline T CalcAs(MathOperator op, T v1, T v2) {
+    T ret = std::numeric_limits<T>::quiet_NaN();
+    switch (op) {
+    case MathOperator::MATH_SIN:
+        ret = std::sin(v1);
+        break;
+    case MathOperator::MATH_COS:
+        ret = std::cos(v1);
+        break;
+    case MathOperator::MATH_TAN:
+        ret = std::tan(v1);
+        break;
+    case MathOperator::MATH_ARCSIN:
+        ret = std::asin(v1);
+        break;
+    case MathOperator::MATH_ARCCOS:
+        ret = std::acos(v1);
+        break;
+    case MathOperator::MATH_ARCTAN:
+        ret = std::atan(v1);
+        break;
+    case MathOperator::MATH_SQRT:
+        ret = std::sqrt(v1);
+        break;
+    case MathOperator::MATH_LOG:
+        ret = std::log(v1);
+        break;
+    case MathOperator::MATH_LOG2:
+        ret = std::log2(v1);
+        break;
+    case MathOperator::MATH_LOG10:
+        ret = std::log10(v1);
+        break;
+    case MathOperator::MATH_EXP:
+        ret = std::exp(v1);
+        break;
+    case MathOperator::MATH_POSITIVE:
+        ret = v1;
+        break;
+    case MathOperator::MATH_NEGATIVE:
+        ret = -v1;
+        break;
 
-template <>
-struct SfinaeNodeImpl<Node, Node> : std::true_type {};
+    case MathOperator::MATH_MOD: //%
+        ret = static_cast<T>(static_cast<int>(v1) % static_cast<int>(v2));
+        break;
+    case MathOperator::MATH_AND: //&
+        ret = static_cast<T>(static_cast<int>(v1) & static_cast<int>(v2));
+        break;
+    case MathOperator::MATH_OR: //|
+        ret = static_cast<T>(static_cast<int>(v1) | static_cast<int>(v2));
+        break;
 
-template <typename... T>
-using SfinaeNode = std::enable_if_t<SfinaeNodeImpl<std::decay_t<T>...>::value, Node>;
+    case MathOperator::MATH_POWER: //^
+        ret = std::pow(v1, v2);
+        break;
 
-template <typename T1, typename T2>
-inline SfinaeNode<T1, T2> operator+(T1 &&n1, T2 &&n2) noexcept {
-    return internal::BinaryOperator(MathOperator::MATH_ADD, std::forward<T1>(n1), std::forward<T2>(n2));
-}
-
-template <typename T>
-inline SfinaeNode<T> &operator+=(Node &n1, T &&n2) noexcept {
-    n1 = internal::BinaryOperator(MathOperator::MATH_ADD, std::move(n1), std::forward<T>(n2));
-    return n1;
-}
+    case MathOperator::MATH_ADD:
+        ret = v1 + v2;
+        break;
+    case MathOperator::MATH_SUB:
+        ret = v1 - v2;
+        break;
+    case MathOperator::MATH_MULTIPLY:
+        ret = v1 * v2;
+        break;
+    case MathOperator::MATH_DIVIDE:
+        ret = v1 / v2;
+        break;
+    default:
+        assert(0 && "[Calc] bug.");
+        break;
+    }
 
-template <typename T1, typename T2>
-inline SfinaeNode<T1, T2> operator-(T1 &&n1, T2 &&n2) noexcept {
-    return internal::BinaryOperator(MathOperator::MATH_SUB, std::forward<T1>(n1), std::forward<T2>(n2));
-}
+    if (Config::Get().throwOnInvalidValue && !std::isfinite(ret)) {
+        internal::ThrowInvalidValue(op, static_cast<double>(v1), static_cast<double>(v2));
+    }
 
-template <typename T>
-inline SfinaeNode<T> operator-(T &&n1) noexcept {
-    return internal::UnaryOperator(MathOperator::MATH_NEGATIVE, std::forward<T>(n1));
+    return ret;
 }
 
-template <typename T>
-inline SfinaeNode<T> operator+(T &&n1) noexcept {
-    return internal::UnaryOperator(MathOperator::MATH_POSITIVE, std::forward<T>(n1));
-}
+} // namespace tomsolver
 
-template <typename T>
-inline SfinaeNode<T> &operator-=(Node &n1, T &&n2) noexcept {
-    n1 = internal::BinaryOperator(MathOperator::MATH_SUB, std::move(n1), std::forward<T>(n2));
-    return n1;
-}
+namespace tomsolver {
 
-template <typename T1, typename T2>
-inline SfinaeNode<T1, T2> operator*(T1 &&n1, T2 &&n2) noexcept {
-    return internal::BinaryOperator(MathOperator::MATH_MULTIPLY, std::forward<T1>(n1), std::forward<T2>(n2));
+inline std::string MathOperatorToStr(MathOperator op) {
+    switch (op) {
+    case MathOperator::MATH_NULL:
+        assert(0);
+        return "";
+    // 一元
+    case MathOperator::MATH_POSITIVE:
+        return "+";
+    case MathOperator::MATH_NEGATIVE:
+        return "-";
+    // 函数
+    case MathOperator::MATH_SIN:
+        return "sin";
+    case MathOperator::MATH_COS:
+        return "cos";
+    case MathOperator::MATH_TAN:
+        return "tan";
+    case MathOperator::MATH_ARCSIN:
+        return "asin";
+    case MathOperator::MATH_ARCCOS:
+        return "acos";
+    case MathOperator::MATH_ARCTAN:
+        return "atan";
+    case MathOperator::MATH_SQRT:
+        return "sqrt";
+    case MathOperator::MATH_LOG:
+        return "log";
+    case MathOperator::MATH_LOG2:
+        return "log2";
+    case MathOperator::MATH_LOG10:
+        return "log10";
+    case MathOperator::MATH_EXP:
+        return "exp";
+    // 二元
+    case MathOperator::MATH_ADD:
+        return "+";
+    case MathOperator::MATH_SUB:
+        return "-";
+    case MathOperator::MATH_MULTIPLY:
+        return "*";
+    case MathOperator::MATH_DIVIDE:
+        return "/";
+    case MathOperator::MATH_POWER:
+        return "^";
+    case MathOperator::MATH_AND:
+        return "&";
+    case MathOperator::MATH_OR:
+        return "|";
+    case MathOperator::MATH_MOD:
+        return "%";
+    case MathOperator::MATH_LEFT_PARENTHESIS:
+        return "(";
+    case MathOperator::MATH_RIGHT_PARENTHESIS:
+        return ")";
+    }
+    assert(0);
+    return "err";
 }
 
-template <typename T>
-inline SfinaeNode<T> &operator*=(Node &n1, T &&n2) noexcept {
-    n1 = internal::BinaryOperator(MathOperator::MATH_MULTIPLY, std::move(n1), std::forward<T>(n2));
-    return n1;
-}
+inline int GetOperatorNum(MathOperator op) noexcept {
+    switch (op) {
+    case MathOperator::MATH_POSITIVE: // 正负号
+    case MathOperator::MATH_NEGATIVE:
 
-template <typename T1, typename T2>
-inline SfinaeNode<T1, T2> operator/(T1 &&n1, T2 &&n2) noexcept {
-    return internal::BinaryOperator(MathOperator::MATH_DIVIDE, std::forward<T1>(n1), std::forward<T2>(n2));
-}
+    case MathOperator::MATH_SIN:
+    case MathOperator::MATH_COS:
+    case MathOperator::MATH_TAN:
+    case MathOperator::MATH_ARCSIN:
+    case MathOperator::MATH_ARCCOS:
+    case MathOperator::MATH_ARCTAN:
+    case MathOperator::MATH_SQRT:
+    case MathOperator::MATH_LOG:
+    case MathOperator::MATH_LOG2:
+    case MathOperator::MATH_LOG10:
+    case MathOperator::MATH_EXP:
+        return 1;
 
-template <typename T>
-inline SfinaeNode<T> &operator/=(Node &n1, T &&n2) noexcept {
-    n1 = internal::BinaryOperator(MathOperator::MATH_DIVIDE, std::move(n1), std::forward<T>(n2));
-    return n1;
-}
+    case MathOperator::MATH_ADD:
+    case MathOperator::MATH_SUB:
+    case MathOperator::MATH_MULTIPLY:
+    case MathOperator::MATH_DIVIDE:
+    case MathOperator::MATH_POWER: //^
+    case MathOperator::MATH_AND:   //&
+    case MathOperator::MATH_OR:    //|
+    case MathOperator::MATH_MOD:   //%
+        return 2;
 
-template <typename T1, typename T2>
-inline SfinaeNode<T1, T2> operator^(T1 &&n1, T2 &&n2) noexcept {
-    return internal::BinaryOperator(MathOperator::MATH_POWER, std::forward<T1>(n1), std::forward<T2>(n2));
+    case MathOperator::MATH_LEFT_PARENTHESIS:
+    case MathOperator::MATH_RIGHT_PARENTHESIS:
+        assert(0);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    assert(0);
+    return 0;
 }
 
-template <typename T>
-inline SfinaeNode<T> &operator^=(Node &n1, T &&n2) noexcept {
-    n1 = internal::BinaryOperator(MathOperator::MATH_POWER, std::move(n1), std::forward<T>(n2));
-    return n1;
-}
+inline int Rank(MathOperator op) noexcept {
+    switch (op) {
+    case MathOperator::MATH_SIN:
+    case MathOperator::MATH_COS:
+    case MathOperator::MATH_TAN:
+    case MathOperator::MATH_ARCSIN:
+    case MathOperator::MATH_ARCCOS:
+    case MathOperator::MATH_ARCTAN:
+    case MathOperator::MATH_SQRT:
+    case MathOperator::MATH_LOG:
+    case MathOperator::MATH_LOG2:
+    case MathOperator::MATH_LOG10:
+    case MathOperator::MATH_EXP:
+        return 15;
 
-} // namespace tomsolver
+    case MathOperator::MATH_POSITIVE: // 除了函数，所有运算符均可将正负号挤出
+    case MathOperator::MATH_NEGATIVE:
+        return 14;
 
-namespace tomsolver {
+    case MathOperator::MATH_MOD: //%
+        return 13;
 
-namespace internal {
+    case MathOperator::MATH_AND: //&
+    case MathOperator::MATH_OR:  //|
+        return 12;
 
-inline NodeImpl::NodeImpl(const NodeImpl &rhs) noexcept {
-    *this = rhs;
-}
+    case MathOperator::MATH_POWER: //^
+        return 11;
 
-inline NodeImpl &NodeImpl::operator=(const NodeImpl &rhs) noexcept {
-    type = rhs.type;
-    op = rhs.op;
-    value = rhs.value;
-    varname = rhs.varname;
-    parent = rhs.parent;
-    if (rhs.left) {
-        left = Clone(rhs.left);
-        left->parent = this;
-    } else {
-        left = nullptr;
-    }
-    if (rhs.right) {
-        right = Clone(rhs.right);
-        right->parent = this;
-    } else {
-        right = nullptr;
-    }
-    return *this;
-}
+    case MathOperator::MATH_MULTIPLY:
+    case MathOperator::MATH_DIVIDE:
+        return 10;
 
-inline NodeImpl::NodeImpl(NodeImpl &&rhs) noexcept {
-    *this = std::move(rhs);
-}
+    case MathOperator::MATH_ADD:
+    case MathOperator::MATH_SUB:
+        return 5;
 
-inline NodeImpl &NodeImpl::operator=(NodeImpl &&rhs) noexcept {
-    type = std::exchange(rhs.type, {});
-    op = std::exchange(rhs.op, {});
-    value = std::exchange(rhs.value, {});
-    varname = std::exchange(rhs.varname, {});
-    parent = std::exchange(rhs.parent, {});
-    left = std::exchange(rhs.left, {});
-    if (left) {
-        left->parent = this;
-    }
-    right = std::exchange(rhs.right, {});
-    if (right) {
-        right->parent = this;
+    case MathOperator::MATH_LEFT_PARENTHESIS: // 左右括号优先级小是为了不被其余任何运算符挤出
+    case MathOperator::MATH_RIGHT_PARENTHESIS:
+        return 0;
+    default:
+        assert(0);
+        break;
     }
-
-    return *this;
+    assert(0);
+    return 0;
 }
 
-inline NodeImpl::~NodeImpl() {
-    Release();
-}
+inline bool IsLeft2Right(MathOperator eOperator) noexcept {
+    switch (eOperator) {
+    case MathOperator::MATH_MOD: //%
+    case MathOperator::MATH_AND: //&
+    case MathOperator::MATH_OR:  //|
+    case MathOperator::MATH_MULTIPLY:
+    case MathOperator::MATH_DIVIDE:
+    case MathOperator::MATH_ADD:
+    case MathOperator::MATH_SUB:
+        return true;
 
-// 前序遍历。非递归实现。
-inline bool NodeImpl::Equal(const Node &other) const noexcept {
-    if (this == other.get()) {
+    case MathOperator::MATH_POSITIVE: // 正负号为右结合
+    case MathOperator::MATH_NEGATIVE:
+    case MathOperator::MATH_POWER: //^
+        return false;
+
+    // 函数和括号不计结合性
+    case MathOperator::MATH_SIN:
+    case MathOperator::MATH_COS:
+    case MathOperator::MATH_TAN:
+    case MathOperator::MATH_ARCSIN:
+    case MathOperator::MATH_ARCCOS:
+    case MathOperator::MATH_ARCTAN:
+    case MathOperator::MATH_SQRT:
+    case MathOperator::MATH_LOG:
+    case MathOperator::MATH_LOG2:
+    case MathOperator::MATH_LOG10:
+    case MathOperator::MATH_EXP:
+
+    case MathOperator::MATH_LEFT_PARENTHESIS:
+    case MathOperator::MATH_RIGHT_PARENTHESIS:
         return true;
+    default:
+        assert(0);
     }
+    return false;
+}
 
-    std::stack<std::tuple<const NodeImpl &, const NodeImpl &>> stk;
+inline bool InAssociativeLaws(MathOperator eOperator) noexcept {
+    switch (eOperator) {
 
-    auto tie = [](const NodeImpl &node) {
-        return std::tie(node.type, node.op, node.value, node.varname);
-    };
+    case MathOperator::MATH_POSITIVE: // 正负号
+    case MathOperator::MATH_NEGATIVE:
 
-    auto IsSame = [&tie](const NodeImpl &lhs, const NodeImpl &rhs) {
-        return tie(lhs) == tie(rhs);
-    };
+    case MathOperator::MATH_SQRT:
+    case MathOperator::MATH_SIN:
+    case MathOperator::MATH_COS:
+    case MathOperator::MATH_TAN:
+    case MathOperator::MATH_ARCSIN:
+    case MathOperator::MATH_ARCCOS:
+    case MathOperator::MATH_ARCTAN:
+    case MathOperator::MATH_LOG:
+    case MathOperator::MATH_LOG2:
+    case MathOperator::MATH_LOG10:
+    case MathOperator::MATH_EXP:
 
-    auto CheckChildren = [&stk](const Node &lhs, const Node &rhs) {
-        // ╔═════╦═════╦════════╦═════════╗
-        // ║ lhs ║ rhs ║ return ║ emplace ║
-        // ╠═════╬═════╬════════╬═════════╣
-        // ║ T   ║ T   ║ T      ║ T       ║
-        // ╟─────╫─────╫────────╫─────────╢
-        // ║ T   ║ F   ║ F      ║ F       ║
-        // ╟─────╫─────╫────────╫─────────╢
-        // ║ F   ║ T   ║ F      ║ F       ║
-        // ╟─────╫─────╫────────╫─────────╢
-        // ║ F   ║ F   ║ T      ║ F       ║
-        // ╚═════╩═════╩════════╩═════════╝
-        if (!lhs ^ !rhs) {
-            return false;
-        }
+    case MathOperator::MATH_MOD:   //%
+    case MathOperator::MATH_AND:   //&
+    case MathOperator::MATH_OR:    //|
+    case MathOperator::MATH_POWER: //^
+    case MathOperator::MATH_DIVIDE:
+    case MathOperator::MATH_SUB:
 
-        if (lhs && rhs) {
-            stk.emplace(*lhs, *rhs);
-        }
+    case MathOperator::MATH_LEFT_PARENTHESIS:
+    case MathOperator::MATH_RIGHT_PARENTHESIS:
+        return false;
 
+    case MathOperator::MATH_ADD:
+    case MathOperator::MATH_MULTIPLY:
         return true;
-    };
+    default:
+        assert(0);
+        break;
+    }
+    assert(0);
+    return false;
+}
 
-    auto CheckNode = [&IsSame, &CheckChildren](const NodeImpl &lhs, const NodeImpl &rhs) {
-        return IsSame(lhs, rhs) && CheckChildren(lhs.left, rhs.left) && CheckChildren(lhs.right, rhs.right);
-    };
+inline bool IsFunction(MathOperator op) noexcept {
+    switch (op) {
+    case MathOperator::MATH_SIN:
+    case MathOperator::MATH_COS:
+    case MathOperator::MATH_TAN:
+    case MathOperator::MATH_ARCSIN:
+    case MathOperator::MATH_ARCCOS:
+    case MathOperator::MATH_ARCTAN:
+    case MathOperator::MATH_SQRT:
+    case MathOperator::MATH_LOG:
+    case MathOperator::MATH_LOG2:
+    case MathOperator::MATH_LOG10:
+    case MathOperator::MATH_EXP:
+        return true;
 
-    if (!CheckNode(*this, *other)) {
+    case MathOperator::MATH_POSITIVE:
+    case MathOperator::MATH_NEGATIVE:
+    case MathOperator::MATH_MOD:   //%
+    case MathOperator::MATH_AND:   //&
+    case MathOperator::MATH_OR:    //|
+    case MathOperator::MATH_POWER: //^
+    case MathOperator::MATH_MULTIPLY:
+    case MathOperator::MATH_DIVIDE:
+    case MathOperator::MATH_ADD:
+    case MathOperator::MATH_SUB:
+    case MathOperator::MATH_LEFT_PARENTHESIS:
+    case MathOperator::MATH_RIGHT_PARENTHESIS:
         return false;
+    default:
+        assert(0);
+        break;
     }
+    assert(0);
+    return false;
+}
 
-    while (!stk.empty()) {
-        const auto &lhs = std::get<0>(stk.top());
-        const auto &rhs = std::get<1>(stk.top());
-        stk.pop();
+inline double Calc(MathOperator op, double v1, double v2) {
+    return CalcAs<double>(op, v1, v2);
+}
 
-        // 检查
-        if (!CheckNode(lhs, rhs)) {
-            return false;
-        }
-    }
+namespace internal {
 
-    return true;
+inline void ThrowInvalidValue(MathOperator op, double v1, double v2) {
+    std::stringstream info;
+    info << "expression: \"";
+    switch (GetOperatorNum(op)) {
+    case 1:
+        info << MathOperatorToStr(op) << " " << ToString(v1);
+        break;
+    case 2:
+        info << ToString(v1) << " " << MathOperatorToStr(op) << " " << ToString(v2);
+        break;
+    default:
+        assert(0);
+    }
+    info << "\"";
+    throw MathError(ErrorType::ERROR_INVALID_NUMBER, info.str());
 }
 
-inline std::string NodeImpl::ToString() const noexcept {
-    std::stringstream ss;
-    ToStringNonRecursively(ss);
-    return ss.str();
-}
+} // namespace internal
 
-inline double NodeImpl::Vpa() const {
-    return VpaNonRecursively();
-}
+} // namespace tomsolver
 
-inline NodeImpl &NodeImpl::Calc() {
-    auto d = Vpa();
-    *this = {};
-    value = d;
+namespace tomsolver {
 
-    return *this;
+inline Mat::Mat(int rows, int cols, double initValue) noexcept : rows(rows), cols(cols), data(initValue, rows * cols) {
+    assert(rows > 0);
+    assert(cols > 0);
 }
 
-// 前序遍历。非递归实现。
-inline void NodeImpl::CheckParent() const noexcept {
-    std::stack<std::reference_wrapper<const NodeImpl>> stk;
+inline Mat::Mat(std::initializer_list<std::initializer_list<double>> init) noexcept {
+    rows = static_cast<int>(init.size());
+    assert(rows > 0);
+    cols = static_cast<int>(std::max(init, [](auto lhs, auto rhs) {
+                                return lhs.size() < rhs.size();
+                            }).size());
+    assert(cols > 0);
+    data.resize(rows * cols);
 
-    auto EmplaceNode = [&stk](const Node &node) {
-        if (node) {
-            stk.emplace(*node);
-        }
-    };
-    auto TryEmplaceChildren = [&EmplaceNode](const NodeImpl &node) {
-        node.CheckOperatorNum();
-        EmplaceNode(node.left);
-        EmplaceNode(node.right);
-    };
+    auto i = 0;
+    for (auto values : init) {
+        Row(i++) = values;
+    }
+}
 
-    TryEmplaceChildren(*this);
+inline Mat::Mat(int rows, int cols, std::valarray<double> data) noexcept
+    : rows(rows), cols(cols), data(std::move(data)) {}
 
-    while (!stk.empty()) {
-        const auto &f = stk.top().get();
-        stk.pop();
+inline std::slice_array<double> Mat::Row(int i, int offset) {
+    return data[std::slice(cols * i + offset, cols - offset, 1)];
+}
 
-#ifndef NDEBUG
-        // 检查
-        assert(f.parent);
-        bool isLeftChild = f.parent->left.get() == &f;
-        bool isRightChild = f.parent->right.get() == &f;
-        assert(isLeftChild || isRightChild);
-#endif
+inline std::slice_array<double> Mat::Col(int j, int offset) {
+    return data[std::slice(j + offset * cols, rows - offset, cols)];
+}
 
-        TryEmplaceChildren(f);
-    }
+inline auto Mat::Row(int i, int offset) const -> decltype(std::declval<const std::valarray<double>>()[(std::slice{})]) {
+    return data[std::slice(cols * i + offset, cols - offset, 1)];
 }
 
-inline void NodeImpl::CheckOperatorNum() const noexcept {
-    if (type != NodeType::OPERATOR) {
-        return;
-    }
+inline auto Mat::Col(int j, int offset) const -> decltype(std::declval<const std::valarray<double>>()[(std::slice{})]) {
+    return data[std::slice(j + offset * cols, rows - offset, cols)];
+}
 
-    switch (GetOperatorNum(op)) {
-    case 1:
-        assert(!right);
-        break;
-    case 2:
-        assert(right);
-        break;
-    default:
-        assert(0);
-        break;
-    }
+inline const double &Mat::Value(int i, int j) const {
+    return data[i * cols + j];
+}
 
-    assert(left);
+inline double &Mat::Value(int i, int j) {
+    return data[i * cols + j];
 }
 
-inline std::string NodeImpl::NodeToStr() const noexcept {
-    switch (type) {
-    case NodeType::NUMBER:
-        return tomsolver::ToString(value);
-    case NodeType::VARIABLE:
-        return varname;
-    case NodeType::OPERATOR:
-        return MathOperatorToStr(op);
-    }
-    assert(0 && "unexpected NodeType. maybe this is a bug.");
-    return "";
+inline bool Mat::operator==(double m) const noexcept {
+    return std::all_of(std::begin(data), std::end(data), [m](auto val) {
+        return std::abs(val - m) < Config::Get().epsilon;
+    });
 }
 
-// 中序遍历。递归实现。
-inline void NodeImpl::ToStringRecursively(std::stringstream &output) const noexcept {
-    switch (type) {
-    case NodeType::NUMBER:
-        // 如果当前节点是数值且小于0，且前面是-运算符，那么加括号
-        if (value < 0 && parent && parent->right.get() == this && parent->op == MathOperator::MATH_SUB) {
-            output << "(" << NodeToStr() << ")";
-        } else {
-            output << NodeToStr();
-        }
-        return;
-    case NodeType::VARIABLE:
-        output << NodeToStr();
-        return;
-    case NodeType::OPERATOR:
-        // pass
-        break;
-    }
+inline bool Mat::operator==(const Mat &b) const noexcept {
+    assert(rows == b.rows);
+    assert(cols == b.cols);
+    return std::all_of(std::begin(data), std::end(data), [iter = std::begin(b.data)](auto val) mutable {
+        return std::abs(val - *iter++) < Config::Get().epsilon;
+    });
+}
 
-    auto hasParenthesis = false;
-    auto operatorNum = GetOperatorNum(op);
-    if (operatorNum == 1) // 一元运算符：函数和取负
-    {
-        if (op == MathOperator::MATH_POSITIVE || op == MathOperator::MATH_NEGATIVE) {
-            output << "(" << NodeToStr();
-        } else {
-            output << NodeToStr() << "(";
-        }
-        hasParenthesis = true;
-    } else {
-        // 非一元运算符才输出，即一元运算符的输出顺序已改变
-        if (type == NodeType::OPERATOR && parent) { // 本级为运算符
-            if ((GetOperatorNum(parent->op) == 2 && // 父运算符存在，为二元，
-                 (Rank(parent->op) > Rank(op)       // 父级优先级高于本级->加括号
+// be negative
+inline Mat Mat::operator-() noexcept {
+    return {rows, cols, -data};
+}
 
-                  || ( // 两级优先级相等
-                         Rank(parent->op) == Rank(op) &&
-                         (
-                             // 本级为父级的右子树 且父级不满足结合律->加括号
-                             (InAssociativeLaws(parent->op) == false && this == parent->right.get()) ||
-                             // 两级都是右结合
-                             (InAssociativeLaws(parent->op) == false && IsLeft2Right(op) == false)))))
+inline Mat Mat::operator+(const Mat &b) const noexcept {
+    assert(rows == b.rows);
+    assert(cols == b.cols);
+    return {rows, cols, data + b.data};
+}
 
-                //||
+inline Mat &Mat::operator+=(const Mat &b) noexcept {
+    assert(rows == b.rows);
+    assert(cols == b.cols);
+    data += b.data;
+    return *this;
+}
 
-                ////父运算符存在，为除号，且本级为分子，则添加括号
-                //(now->parent->eOperator == MATH_DIVIDE && now == now->parent->right)
-            ) {
-                output << "(";
-                hasParenthesis = true;
-            }
-        }
-    }
+inline Mat Mat::operator-(const Mat &b) const noexcept {
+    assert(rows == b.rows);
+    assert(cols == b.cols);
+    return {rows, cols, data - b.data};
+}
 
-    if (left) // 左遍历
-    {
-        left->ToStringRecursively(output);
-    }
+inline Mat Mat::operator*(double m) const noexcept {
+    return {rows, cols, data * m};
+}
 
-    if (operatorNum != 1) // 非一元运算符才输出，即一元运算符的输出顺序已改变
-    {
-        output << NodeToStr();
+inline Mat Mat::operator*(const Mat &b) const noexcept {
+    assert(cols == b.rows);
+    Mat ans(rows, b.cols);
+    for (auto i = 0; i < rows; ++i) {
+        for (auto j = 0; j < b.cols; ++j) {
+            ans.Value(i, j) = (Row(i) * b.Col(j)).sum();
+        }
     }
+    return ans;
+}
 
-    if (right) // 右遍历
-    {
-        right->ToStringRecursively(output);
-    }
+inline int Mat::Rows() const noexcept {
+    return rows;
+}
 
-    // 回到本级时补齐右括号，包住前面的东西
-    if (hasParenthesis) {
-        output << ")";
+inline int Mat::Cols() const noexcept {
+    return cols;
+}
+
+inline Vec Mat::ToVec() const {
+    assert(rows > 0);
+    if (cols != 1) {
+        throw std::runtime_error("Mat::ToVec fail. rows is not one");
     }
+    Vec v(rows);
+    v.cols = 1;
+    v.data = data;
+    return v;
 }
 
-// 中序遍历。非递归实现。
-inline void NodeImpl::ToStringNonRecursively(std::stringstream &output) const noexcept {
-    std::stack<std::reference_wrapper<const NodeImpl>> stk;
+inline Mat &Mat::SwapRow(int i, int j) noexcept {
+    if (i == j) {
+        return *this;
+    }
+    assert(i >= 0);
+    assert(i < rows);
+    assert(j >= 0);
+    assert(j < rows);
 
-    NodeImpl rightParenthesis(NodeType::OPERATOR, MathOperator::MATH_RIGHT_PARENTHESIS, 0, "");
+    std::valarray<double> temp = Row(i);
+    Row(i) = Row(j);
+    Row(j) = temp;
 
-    auto AddLeftLine = [&stk, &output, &rightParenthesis](const NodeImpl *cur) {
-        while (cur) {
-            if (cur->type != NodeType::OPERATOR) {
-                stk.emplace(*cur);
-                cur = cur->left.get();
-                continue;
-            }
+    return *this;
+}
 
-            // 一元运算符的特殊处理：
-            //      例如sin: 直接输出 "sin(" ，并且把一个右括号入栈。让退栈时这个右括号能包裹住现在的子树。
-            //      如果是+/-: 直接输出 "+"/"-"，如果+/-的操作数是operator，那么处理方式和sin这类一样；
-            //                                  如果+/-的操作数是number/variable，那么不加括号。
-            if (GetOperatorNum(cur->op) == 1) {
-                if ((cur->op == MathOperator::MATH_POSITIVE || cur->op == MathOperator::MATH_NEGATIVE) &&
-                    (cur->left->type != NodeType::OPERATOR)) {
-                    output << cur->NodeToStr();
-                    cur = cur->left.get();
-                    continue;
-                }
-                output << cur->NodeToStr() << "(";
+inline Mat &Mat::SwapCol(int i, int j) noexcept {
+    if (i == j) {
+        return *this;
+    }
+    assert(i >= 0);
+    assert(i < cols);
+    assert(j >= 0);
+    assert(j < cols);
 
-                // not push this op
+    std::valarray<double> t = Col(i);
+    Col(i) = Col(j);
+    Col(j) = t;
 
-                // push ')'
-                stk.emplace(rightParenthesis);
+    return *this;
+}
 
-                cur = cur->left.get();
-                continue;
-            }
+inline std::string Mat::ToString() const noexcept {
+    if (data.size() == 0) {
+        return "[]";
+    }
 
-            // 二元运算符的特殊处理：
-            if (cur->parent) {
-                if ((GetOperatorNum(cur->parent->op) == 2 && // 父运算符存在，为二元，
-                     (Rank(cur->parent->op) > Rank(cur->op)  // 父级优先级高于本级->加括号
+    std::stringstream ss;
+    ss << "[";
 
-                      || ( // 两级优先级相等
-                             Rank(cur->parent->op) == Rank(cur->op) &&
-                             (
-                                 // 本级为父级的右子树 且父级不满足结合律->加括号
-                                 (InAssociativeLaws(cur->parent->op) == false && cur == cur->parent->right.get()) ||
-                                 // 两级都是右结合
-                                 (InAssociativeLaws(cur->parent->op) == false && IsLeft2Right(cur->op) == false)))))
+    size_t i = 0;
+    for (auto val : data) {
+        ss << (i == 0 ? "" : " ") << tomsolver::ToString(val);
+        i++;
+        ss << (i % cols == 0 ? (i == data.size() ? "]" : "\n") : ", ");
+    }
 
-                    //||
+    return ss.str();
+}
 
-                    ////父运算符存在，为除号，且本级为分子，则添加括号
-                    //(now->parent->eOperator == MATH_DIVIDE && now == now->parent->right)
-                ) {
-                    output << "(";
+inline void Mat::Resize(int newRows, int newCols) noexcept {
+    assert(newRows > 0 && newCols > 0);
+    auto temp = std::move(data);
+    data.resize(newRows * newCols);
+    auto minRows = std::min<size_t>(rows, newRows);
+    auto minCols = std::min<size_t>(cols, newCols);
+    data[std::gslice(0, {minRows, minCols}, {static_cast<size_t>(newCols), 1})] =
+        temp[std::gslice(0, {minRows, minCols}, {static_cast<size_t>(cols), 1})];
+    rows = newRows;
+    cols = newCols;
+}
 
-                    // push ')'
-                    stk.emplace(rightParenthesis);
+inline Mat &Mat::Zero() noexcept {
+    data = 0;
+    return *this;
+}
 
-                    stk.emplace(*cur);
-                    cur = cur->left.get();
-                    continue;
-                }
-            }
+inline Mat &Mat::Ones() noexcept {
+    assert(rows == cols);
+    Zero();
+    data[std::slice(0, rows, cols + 1)] = 1;
+    return *this;
+}
 
-            stk.emplace(*cur);
-            cur = cur->left.get();
-        }
-    };
+inline double Mat::Norm2() const noexcept {
+    return (data * data).sum();
+}
 
-    AddLeftLine(this);
+inline double Mat::NormInfinity() const noexcept {
+    return std::abs(data).max();
+}
 
-    while (!stk.empty()) {
-        const auto &cur = stk.top().get();
-        stk.pop();
+inline double Mat::NormNegInfinity() const noexcept {
+    return std::abs(data).min();
+}
 
-        // output
+inline double Mat::Min() const noexcept {
+    return data.min();
+}
 
-        // 负数的特殊处理
-        // 如果当前节点是数值且小于0，且前面是-运算符，那么加括号
-        if (cur.type == NodeType::NUMBER && cur.value < 0 && cur.parent && cur.parent->right.get() == &cur &&
-            cur.parent->op == MathOperator::MATH_SUB) {
-            output << "(" << cur.NodeToStr() << ")";
-        } else {
-            output << cur.NodeToStr();
-        }
+inline void Mat::SetValue(double value) noexcept {
+    data = value;
+}
 
-        if (cur.right) {
-            AddLeftLine(cur.right.get());
-            continue;
+inline bool Mat::PositiveDetermine() const noexcept {
+    assert(rows == cols);
+    for (int i = 1; i <= rows; ++i) {
+        if (Det(*this, i) <= 0) {
+            return false;
         }
     }
+    return true;
 }
 
-// 后序遍历。递归实现。
-inline double NodeImpl::VpaRecursively() const {
-
-    auto vpa = [](const Node &node) {
-        return node ? node->Vpa() : 0;
-    };
-
-    switch (type) {
-    case NodeType::NUMBER:
-        return value;
+inline Mat Mat::Transpose() const noexcept {
+    Mat ans(cols, rows);
+    for (auto i = 0; i < cols; i++) {
+        ans.Row(i) = Col(i);
+    }
+    return ans;
+}
 
-    case NodeType::VARIABLE:
-        throw std::runtime_error("has variable. can not calculate to be a number");
+inline Mat Mat::Inverse() const {
+    assert(rows == cols);
+    int n = rows;
+    double det = Det(*this, n); // Determinant, 역행렬을 시킬 행렬의 행렬식을 구함
 
-    case NodeType::OPERATOR:
-        assert((GetOperatorNum(op) == 1 && left && right == nullptr) || (GetOperatorNum(op) == 2 && left && right));
-        return tomsolver::Calc(op, vpa(left), vpa(right));
+    if (std::abs(det) <= Config::Get().epsilon) // 0일때는 예외처리 (역행렬을 구할 수 없기 때문.)
+    {
+        throw MathError(ErrorType::ERROR_SINGULAR_MATRIX);
     }
 
-    throw std::runtime_error("unsupported node type");
-}
+    Mat adj(n, n); // 딸림행렬 선언
 
-// 后序遍历。非递归实现。
-inline double NodeImpl::VpaNonRecursively() const {
+    Adjoint(*this, adj); // 딸림행렬 초기화
 
-    std::stack<std::reference_wrapper<const NodeImpl>> stk;
-    std::forward_list<std::reference_wrapper<const NodeImpl>> revertedPostOrder;
+    return {n, n, adj.data / det};
+}
 
-    // ==== Part I ====
+inline Mat operator*(double k, const Mat &mat) noexcept {
+    Mat ans(mat);
+    ans.data *= k;
+    return ans;
+}
 
-    // 借助一个栈，得到反向的后序遍历序列，结果保存在revertedPostOrder
-    stk.emplace(*this);
+inline Mat EachDivide(const Mat &a, const Mat &b) noexcept {
+    assert(a.rows == b.rows);
+    assert(a.cols == b.cols);
+    return {a.rows, b.cols, b.data / b.data};
+}
 
-    while (!stk.empty()) {
-        const auto &node = stk.top().get();
-        stk.pop();
+inline bool IsZero(const Mat &mat) noexcept {
+    return std::all_of(std::begin(mat.data), std::end(mat.data), [](auto val) {
+        return std::abs(val) <= Config::Get().epsilon;
+    });
+}
 
-        if (node.left) {
-            stk.emplace(*node.left);
-        }
+inline bool AllIsLessThan(const Mat &v1, const Mat &v2) noexcept {
+    assert(v1.rows == v2.rows && v1.cols == v2.cols);
+    return std::all_of(std::begin(v1.data), std::end(v1.data), [iter = std::begin(v2.data)](auto val) mutable {
+        return val < *iter++;
+    });
+}
 
-        if (node.right) {
-            stk.emplace(*node.right);
-        }
+inline int GetMaxAbsRowIndex(const Mat &A, int rowStart, int rowEnd, int col) noexcept {
+    std::valarray<double> temp = std::abs<double>(A.Col(col)[std::slice(rowStart, rowEnd - rowStart + 1, 1)]);
+    auto ret = std::distance(std::begin(temp), std::find(std::begin(temp), std::end(temp), temp.max())) + rowStart;
+    return static_cast<int>(ret);
+}
 
-        revertedPostOrder.emplace_front(node);
+inline void Adjoint(const Mat &A, Mat &adj) noexcept // 딸림행렬, 수반행렬
+{
+    if (A.rows == 1) // 예외처리
+    {
+        adj.Value(0, 0) = 1;
+        return;
     }
 
-    // ==== Part II ====
-    // revertedPostOrder的反向序列是一组逆波兰表达式，根据这组逆波兰表达式可以计算出表达式的值
-    // calcStk是用来计算值的临时栈，计算完成后calcStk的size应该为1
-    std::stack<double> calcStk;
-    // for (auto it = revertedPostOrder.rbegin(); it != revertedPostOrder.rend(); ++it) {
-    for (const auto &nodeWrapper : revertedPostOrder) {
-        const auto &node = nodeWrapper.get();
-        switch (node.type) {
-        case NodeType::NUMBER:
-            calcStk.emplace(node.value);
-            break;
+    Mat cofactor(A.rows - 1, A.cols - 1);
 
-        case NodeType::OPERATOR: {
-            auto r = std::numeric_limits<double>::quiet_NaN();
+    for (int i = 0; i < A.rows; i++) {
+        for (int j = 0; j < A.cols; j++) {
+            GetCofactor(A, cofactor, i, j, A.rows); // 여인수 구하기, 단 i, j값으로 되기에 temp는 항상 바뀐다.
 
-            switch (GetOperatorNum(node.op)) {
-            case 1:
-                break;
-            case 2:
-                r = calcStk.top();
-                calcStk.pop();
-                break;
-            default:
-                assert(0 && "[VpaNonRecursively] unsupported operator num");
-                break;
-            }
+            auto det = (Det(cofactor, A.rows - 1));
 
-            auto &l = calcStk.top();
-            l = tomsolver::Calc(node.op, l, r);
-            break;
-        }
+            if ((i + j) % 2 != 0) {
+                det = -det; // +, -, + 형식으로 되는데, 0,0 좌표면 +, 0,1좌표면 -, 이렇게 된다.
+            }
 
-        default:
-            throw std::runtime_error("wrong");
-            break;
+            adj.Value(j, i) = det; // n - 1 X n - 1 은, 언제나 각 여인수 행렬 은
+                                   // 여인수를 따오는 행렬의 크기 - 1 이기 때문이다.
         }
     }
-
-    assert(calcStk.size() == 1);
-
-    return calcStk.top();
 }
 
-// 后序遍历。因为要在左右儿子都没有的情况下删除节点。
-inline void NodeImpl::Release() noexcept {
-    std::stack<Node> stk;
+inline void GetCofactor(const Mat &A, Mat &cofactor, int p, int q,
+                        int n) noexcept // 여인수를 구해다주는 함수!
+{
+    /*
+         ┌───┄┄┄┄┄┄┄┄┬───┬┄┄┄┄┄┄┄┄───┐   size of region A = p * q
+    0 -> │           │   │           │                  B = p * (n - 1 - q)
+         ┆           ┆   ┆           ┆                  C = (n - 1 - p) * q
+         ┆     A     ┆   ┆     B     ┆                  D = (n - 1 - p) * (n - 1 - q)
+         ┆           ┆   ┆           ┆
+         ┆           ┆   ┆           ┆    left top of region
+         ├───┄┄┄┄┄┄┄┄┼───┼┄┄┄┄┄┄┄┄───┤   ╔════════╤════════════════╤══════════╗
+    p ─> │           │   │           │   ║ region │ origin matrix  │ cofactor ║
+         ├───┄┄┄┄┄┄┄┄┼───┼┄┄┄┄┄┄┄┄───┤   ╠════════╪════════════════╪══════════╣
+         ┆           ┆   ┆           ┆   ║ A      │ (0, 0)         │ (0, 0)   ║
+         ┆           ┆   ┆           ┆   ╟────────┼────────────────┼──────────╢
+         ┆     C     ┆   ┆     D     ┆   ║ B      │ (0, q + 1)     │ (0, q)   ║
+         ┆           ┆   ┆           ┆   ╟────────┼────────────────┼──────────╢
+         │           │   │           │   ║ C      │ (p + 1, 0)     │ (p, 0)   ║
+    n ─> └───┄┄┄┄┄┄┄┄┴───┴┄┄┄┄┄┄┄┄───┘   ╟────────┼────────────────┼──────────╢
+          ^            ^            ^    ║ D      │ (p + 1, q + 1) │ (p, q)   ║
+          0            q            n    ╚════════╧════════════════╧══════════╝
+    */
 
-    auto emplaceNode = [&stk](Node node) {
-        if (node) {
-            stk.emplace(std::move(node));
-        }
+    auto newIndex = [n = n - 1](int p, int q) -> size_t {
+        return p * n + q;
     };
+    auto index = [n = A.cols](int p, int q) -> size_t {
+        return p * n + q;
+    };
+    auto makeValarray = [](int p, int q) {
+        return std::valarray<size_t>{static_cast<size_t>(p), static_cast<size_t>(q)};
+    };
+    auto newStride = makeValarray(n - 1, 1);
+    auto stride = makeValarray(A.cols, 1);
 
-    auto emplaceChildren = [&emplaceNode](NodeImpl &node) {
-        emplaceNode(std::move(node.left));
-        emplaceNode(std::move(node.right));
+    std::tuple<std::valarray<size_t>, size_t, size_t> config[] = {
+        {makeValarray(p, q), newIndex(0, 0), index(0, 0)},
+        {makeValarray(p, n - 1 - q), newIndex(0, q), index(0, q + 1)},
+        {makeValarray(n - 1 - p, q), newIndex(p, 0), index(p + 1, 0)},
+        {makeValarray(n - 1 - p, n - 1 - q), newIndex(p, q), index(p + 1, q + 1)},
     };
 
-    emplaceChildren(*this);
+    for (const auto &conf : config) {
+        const auto &size = std::get<0>(conf);
+        const auto &newStart = std::get<1>(conf);
+        const auto &start = std::get<2>(conf);
+        if (newStart < cofactor.data.size()) {
+            cofactor.data[std::gslice(newStart, size, newStride)] = A.data[std::gslice(start, size, stride)];
+        }
+    }
+}
 
-    while (!stk.empty()) {
-        auto node = std::move(stk.top());
-        stk.pop();
+inline double Det(const Mat &A, int n) noexcept {
+    if (n == 0) {
+        return 0;
+    }
 
-        emplaceChildren(*node);
+    if (n == 1) {
+        return A.Value(0, 0);
+    }
 
-        assert(!node->left && !node->right);
+    if (n == 2) // 계산 압축
+    {
+        return A.Value(0, 0) * A.Value(1, 1) - A.Value(1, 0) * A.Value(0, 1);
+    }
 
-        // 这里如果把node填入vector，最后翻转。得到的序列就是后序遍历。
+    Mat cofactor(n - 1, n - 1); // n X n 행렬의 여인수를 담을 임시 행렬
 
-        // 这里node会被自动释放。
-    }
-}
+    double D = 0; // D = 한 행렬의 Determinant값
 
-inline Node CloneRecursively(const Node &src) noexcept {
-    auto ret = std::make_unique<NodeImpl>(src->type, src->op, src->value, src->varname);
-    auto Copy = [ret = ret.get()](Node &tgt, const Node &src) {
-        if (src) {
-            tgt = Clone(src);
-            tgt->parent = ret;
-        }
-    };
+    int sign = 1; // sign = +, -, +, -.... 형태로 지속되는 결과값에 영향을 주는 정수
 
-    Copy(ret->left, src->left);
-    Copy(ret->right, src->right);
+    for (int f = 0; f < n; f++) {
+        GetCofactor(A, cofactor, 0, f, n); // 0으로 고정시킨 이유는, 수학 공식 상 Determinant (행렬식)은 n개의 열 중
+        // 아무거나 잡아도 결과값은 모두 일치하기 때문
+        auto det = Det(cofactor, n - 1);
+        auto v = A.Value(0, f);
+        D += sign * v * det; // 재귀 형식으로 돌아간다. f는 n X n 중 정수 n을 향해 간다.
 
-    return ret;
+        sign = -sign; // +, -, +, -... 형식으로 되기 때문에 반대로 만들어준다.
+    }
+
+    return D; // 마지막엔 n X n 행렬의 Determinant를 리턴해준다.
 }
 
-// 前序遍历。非递归实现。
-inline Node CloneNonRecursively(const Node &node) noexcept {
-    std::stack<std::tuple<const NodeImpl &, NodeImpl &, Node &>> stk;
+inline Vec::Vec(int rows, double initValue) noexcept : Mat(rows, 1, initValue) {}
 
-    auto MakeNode = [](const NodeImpl &src, NodeImpl *parent = nullptr) {
-        auto node = std::make_unique<NodeImpl>(src.type, src.op, src.value, src.varname);
-        node->parent = parent;
-        return node;
-    };
+inline Vec::Vec(std::initializer_list<double> init) noexcept : Vec(std::valarray<double>{init}) {}
 
-    auto EmplaceNode = [&stk](const Node &src, NodeImpl &parent, Node &tgt) {
-        if (src) {
-            stk.emplace(*src, parent, tgt);
-        }
-    };
+inline Vec::Vec(std::valarray<double> init) noexcept : Vec(static_cast<int>(init.size())) {
+    data = std::move(init);
+}
 
-    auto EmplaceChildren = [&EmplaceNode](const NodeImpl &src, Node &tgt) {
-        EmplaceNode(src.left, *tgt, tgt->left);
-        EmplaceNode(src.right, *tgt, tgt->right);
-    };
+inline Mat &Vec::AsMat() noexcept {
+    return *this;
+}
 
-    auto ret = MakeNode(*node);
-    EmplaceChildren(*node, ret);
+inline void Vec::Resize(int newRows) noexcept {
+    assert(newRows > 0);
+    Mat::Resize(newRows, 1);
+}
 
-    while (!stk.empty()) {
-        const auto &src = std::get<0>(stk.top());
-        auto &parent = std::get<1>(stk.top());
-        auto &tgt = std::get<2>(stk.top());
-        stk.pop();
+inline double &Vec::operator[](std::size_t i) noexcept {
+    return data[i];
+}
 
-        tgt = MakeNode(src, &parent);
-        EmplaceChildren(src, tgt);
-    }
+inline double Vec::operator[](std::size_t i) const noexcept {
+    return data[i];
+}
 
-    return ret;
+inline Vec Vec::operator+(const Vec &b) const noexcept {
+    assert(rows == b.rows);
+    assert(cols == 1 && b.cols == 1);
+    return {data + b.data};
 }
 
-inline void CopyOrMoveTo(NodeImpl *parent, Node &child, Node &&n1) noexcept {
-    n1->parent = parent;
-    child = std::move(n1);
+inline Vec Vec::operator-() noexcept {
+    return {-data};
 }
 
-inline void CopyOrMoveTo(NodeImpl *parent, Node &child, const Node &n1) noexcept {
-    auto n1Clone = std::make_unique<NodeImpl>(*n1);
-    n1Clone->parent = parent;
-    child = std::move(n1Clone);
+inline Vec Vec::operator-(const Vec &b) const noexcept {
+    assert(rows == b.rows);
+    return {data - b.data};
 }
 
-inline std::ostream &operator<<(std::ostream &out, const Node &n) noexcept {
-    out << n->ToString();
-    return out;
+inline Vec Vec::operator*(double m) const noexcept {
+    return {data * m};
 }
 
-inline Node Operator(MathOperator op, Node left, Node right) noexcept {
-    auto ret = std::make_unique<internal::NodeImpl>(NodeType::OPERATOR, op, 0, "");
+inline Vec Vec::operator*(const Vec &b) const noexcept {
+    assert(rows == b.rows);
+    return {data * b.data};
+}
 
-    auto SetChild = [ret = ret.get()](Node &tgt, Node src) {
-        if (src) {
-            src->parent = ret;
-            tgt = std::move(src);
-        }
-    };
+inline Vec Vec::operator/(const Vec &b) const noexcept {
+    assert(rows == b.rows);
+    return {data / b.data};
+}
 
-    SetChild(ret->left, std::move(left));
-    SetChild(ret->right, std::move(right));
+inline bool Vec::operator<(const Vec &b) noexcept {
+    assert(rows == b.rows);
+    return std::all_of(std::begin(data), std::end(data), [iter = std::begin(b.data)](auto val) mutable {
+        return val < *iter++;
+    });
+}
 
-    return ret;
+inline Vec operator*(double k, const Vec &v) {
+    return {v.data * k};
 }
 
-// 前序遍历。非递归实现。
-inline std::set<std::string> NodeImpl::GetAllVarNames() const noexcept {
-    std::set<std::string> ret;
+inline double Dot(const Vec &a, const Vec &b) noexcept {
+    assert(a.rows == b.rows);
+    return (a.data * b.data).sum();
+}
 
-    std::stack<std::reference_wrapper<const NodeImpl>> stk;
+inline std::ostream &operator<<(std::ostream &out, const Mat &mat) noexcept {
+    return out << mat.ToString();
+}
 
-    auto EmplaceNode = [&stk](const Node &node) {
-        if (node) {
-            stk.emplace(*node);
+} // namespace tomsolver
+
+namespace tomsolver {
+
+namespace {
+template <typename T>
+inline const T &asConst(T &a) {
+    return a;
+}
+} // namespace
+
+inline Vec SolveLinear(Mat A, Vec b) {
+    int rows = A.Rows(); // 行数
+    int cols = rows;     // 列数=未知数个数
+
+    int RankA = rows, RankAb = rows; // 初始值
+
+    assert(rows == b.Rows()); // A行数不等于b行数
+
+    Vec ret(rows);
+
+    if (rows > 0) {
+        cols = A.Cols();
+    }
+    if (cols != rows) // 不是方阵
+    {
+        if (rows > cols) {
+            // 过定义方程组
+            throw MathError(ErrorType::ERROR_OVER_DETERMINED_EQUATIONS);
+        } else {
+            // 不定方程组
+            ret.Resize(cols);
         }
-    };
+    }
 
-    auto EmplaceChild = [&ret, &EmplaceNode](const NodeImpl &node) {
-        if (node.type == NodeType::VARIABLE) {
-            ret.emplace(node.varname);
+    std::vector<int> TrueRowNumber(cols);
+
+    // 列主元消元法
+    for (auto y = 0, x = 0; y < rows && x < cols; y++, x++) {
+        // if (A[i].size() != rows)
+
+        // 从当前行(y)到最后一行(rows-1)中，找出x列最大的一行与y行交换
+        int maxAbsRowIndex = GetMaxAbsRowIndex(A, y, rows - 1, x);
+        A.SwapRow(y, maxAbsRowIndex);
+        b.SwapRow(y, maxAbsRowIndex);
+
+        while (std::abs(A.Value(y, x)) < Config::Get().epsilon) // 如果当前值为0  x一直递增到非0
+        {
+            x++;
+            if (x == cols) {
+                break;
+            }
+
+            // 交换本行与最大行
+            maxAbsRowIndex = GetMaxAbsRowIndex(A, y, rows - 1, x);
+            A.SwapRow(y, maxAbsRowIndex);
+            b.SwapRow(y, maxAbsRowIndex);
         }
-        EmplaceNode(node.left);
-        EmplaceNode(node.right);
-    };
 
-    EmplaceChild(*this);
+        if (x != cols && x > y) {
+            TrueRowNumber[y] = x; // 补齐方程时 当前行应换到x行
+        }
 
-    while (!stk.empty()) {
-        const auto &node = stk.top().get();
-        stk.pop();
-        EmplaceChild(node);
-    }
+        if (x == cols) // 本行全为0
+        {
+            RankA = y;
+            if (std::abs(b[y]) < Config::Get().epsilon) {
+                RankAb = y;
+            }
 
-    return ret;
-}
+            if (RankA != RankAb) {
+                // 奇异，且系数矩阵及增广矩阵秩不相等->无解
+                throw MathError(ErrorType::ERROR_SINGULAR_MATRIX);
+            } else {
+                // 跳出for，得到特解
+                break;
+            }
+        }
 
-} // namespace internal
+        // 主对角线化为1
+        auto ratioY = A.Value(y, x);
+        // y行第j个->第cols个
+        std::valarray<double> rowY = asConst(A).Row(y, x) / ratioY;
+        A.Row(y, x) = rowY;
+        b[y] /= ratioY;
 
-inline Node Clone(const Node &rhs) noexcept {
-    return internal::CloneNonRecursively(rhs);
-}
+        // 每行化为0
+        for (auto row = y + 1; row < rows; row++) // 下1行->最后1行
+        {
+            auto ratioRow = A.Value(row, x);
+            if (std::abs(ratioRow) >= Config::Get().epsilon) {
+                A.Row(row, x) -= rowY * ratioRow;
+                b[row] -= b[y] * ratioRow;
+            }
+        }
+    }
 
-inline Node Move(Node &rhs) noexcept {
-    return std::move(rhs);
-}
+    bool bIndeterminateEquation = false; // 设置此变量是因为后面rows将=cols，标记以判断是否为不定方程组
 
-inline Node Num(double num) noexcept {
-    return std::make_unique<internal::NodeImpl>(NodeType::NUMBER, MathOperator::MATH_NULL, num, "");
-}
+    // 若为不定方程组，空缺行全填0继续运算
+    if (rows != cols) {
+        A.Resize(cols, cols);
+        b.Resize(cols);
+        rows = cols;
+        bIndeterminateEquation = true;
 
-inline Node Op(MathOperator op) {
-    if (op == MathOperator::MATH_NULL) {
-        throw std::runtime_error("Illegal MathOperator: MATH_NULL");
+        // 调整顺序
+        for (int i = rows - 1; i >= 0; i--) {
+            if (TrueRowNumber[i] != 0) {
+                A.SwapRow(i, TrueRowNumber[i]);
+                b.SwapRow(i, TrueRowNumber[i]);
+            }
+        }
     }
-    return std::make_unique<internal::NodeImpl>(NodeType::OPERATOR, op, 0, "");
-}
 
-inline bool VarNameIsLegal(const std::string &varname) noexcept {
-    return std::regex_match(varname.begin(), varname.end(), std::regex{R"((?=\w)\D\w*)"});
-}
+    // 后置换得到x
+    for (int i = rows - 1; i >= 0; i--) // 最后1行->第1行
+    {
+        auto vec = asConst(A).Row(i, i + 1) * asConst(ret).Col(0, i + 1);
+        ret[i] = b[i] - (vec.size() ? vec.sum() : 0);
+    }
 
-inline Node Var(std::string varname) {
-    if (!VarNameIsLegal(varname)) {
-        throw std::runtime_error("Illegal varname: " + varname);
+    if (RankA < cols && RankA == RankAb) {
+        if (bIndeterminateEquation) {
+            if (!Config::Get().allowIndeterminateEquation) {
+                throw MathError(ErrorType::ERROR_INDETERMINATE_EQUATION,
+                                "A = " + A.ToString() + "\nb = " + b.ToString());
+            }
+        } else {
+            throw MathError(ErrorType::ERROR_INFINITY_SOLUTIONS);
+        }
     }
-    return std::make_unique<internal::NodeImpl>(NodeType::VARIABLE, MathOperator::MATH_NULL, 0, std::move(varname));
+
+    return ret;
 }
 
-} // namespace tomsolver
+inline Vec SolveLinearMixedPrecision(const Mat &A, const Vec &b) {
+    int n = A.Rows();
+    assert(n == b.Rows());
+    if (A.Cols() != n) {
+        return SolveLinear(A, b);
+    }
 
-namespace tomsolver {
+    // float的LU分解
+    std::vector<float> LU(n * n);
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            LU[i * n + j] = static_cast<float>(A.Value(i, j));
+        }
+    }
+    std::vector<int> perm(n);
+    if (!std::all_of(LU.begin(), LU.end(),
+                     [](float v) {
+                         return std::isfinite(v);
+                     }) ||
+        !internal::LuDecompose(n, LU.data(), perm.data(), static_cast<float>(Config::Get().epsilon))) {
+        return SolveLinear(A, b);
+    }
 
-inline std::string MathOperatorToStr(MathOperator op) {
-    switch (op) {
-    case MathOperator::MATH_NULL:
-        assert(0);
-        return "";
-    // 一元
-    case MathOperator::MATH_POSITIVE:
-        return "+";
-    case MathOperator::MATH_NEGATIVE:
-        return "-";
-    // 函数
-    case MathOperator::MATH_SIN:
-        return "sin";
-    case MathOperator::MATH_COS:
-        return "cos";
-    case MathOperator::MATH_TAN:
-        return "tan";
-    case MathOperator::MATH_ARCSIN:
-        return "asin";
-    case MathOperator::MATH_ARCCOS:
-        return "acos";
-    case MathOperator::MATH_ARCTAN:
-        return "atan";
-    case MathOperator::MATH_SQRT:
-        return "sqrt";
-    case MathOperator::MATH_LOG:
-        return "log";
-    case MathOperator::MATH_LOG2:
-        return "log2";
-    case MathOperator::MATH_LOG10:
-        return "log10";
-    case MathOperator::MATH_EXP:
-        return "exp";
-    // 二元
-    case MathOperator::MATH_ADD:
-        return "+";
-    case MathOperator::MATH_SUB:
-        return "-";
-    case MathOperator::MATH_MULTIPLY:
-        return "*";
-    case MathOperator::MATH_DIVIDE:
-        return "/";
-    case MathOperator::MATH_POWER:
-        return "^";
-    case MathOperator::MATH_AND:
-        return "&";
-    case MathOperator::MATH_OR:
-        return "|";
-    case MathOperator::MATH_MOD:
-        return "%";
-    case MathOperator::MATH_LEFT_PARENTHESIS:
-        return "(";
-    case MathOperator::MATH_RIGHT_PARENTHESIS:
-        return ")";
+    // 以double迭代改进：r = b - Ax，解LU*d = r，x += d。
+    // 收敛条件与LAPACK的dsgesv一致：|r| <= |x|*|A|*eps*sqrt(n)，均为无穷范数
+    double normA = 0;
+    for (int i = 0; i < n; ++i) {
+        double sum = 0;
+        for (int j = 0; j < n; ++j) {
+            sum += std::abs(A.Value(i, j));
+        }
+        normA = std::max(normA, sum);
     }
-    assert(0);
-    return "err";
-}
+    auto threshold = normA * std::numeric_limits<double>::epsilon() * std::sqrt(static_cast<double>(n));
 
-inline int GetOperatorNum(MathOperator op) noexcept {
-    switch (op) {
-    case MathOperator::MATH_POSITIVE: // 正负号
-    case MathOperator::MATH_NEGATIVE:
+    constexpr int maxRefinements = 30;
+    std::vector<double> x(n), r(n);
+    for (int i = 0; i < n; ++i) {
+        x[i] = b[i];
+    }
+    internal::LuSolve(n, LU.data(), perm.data(), x.data());
+    auto prevNormR = std::numeric_limits<double>::infinity();
+    for (int it = 0; it < maxRefinements; ++it) {
+        double normR = 0, normX = 0;
+        for (int i = 0; i < n; ++i) {
+            double sum = b[i];
+            for (int j = 0; j < n; ++j) {
+                sum -= A.Value(i, j) * x[j];
+            }
+            r[i] = sum;
+            normR = std::max(normR, std::abs(sum));
+            normX = std::max(normX, std::abs(x[i]));
+        }
 
-    case MathOperator::MATH_SIN:
-    case MathOperator::MATH_COS:
-    case MathOperator::MATH_TAN:
-    case MathOperator::MATH_ARCSIN:
-    case MathOperator::MATH_ARCCOS:
-    case MathOperator::MATH_ARCTAN:
-    case MathOperator::MATH_SQRT:
-    case MathOperator::MATH_LOG:
-    case MathOperator::MATH_LOG2:
-    case MathOperator::MATH_LOG10:
-    case MathOperator::MATH_EXP:
-        return 1;
+        if (normR <= normX * threshold) {
+            Vec ret(n);
+            for (int i = 0; i < n; ++i) {
+                ret[i] = x[i];
+            }
+            return ret;
+        }
 
-    case MathOperator::MATH_ADD:
-    case MathOperator::MATH_SUB:
-    case MathOperator::MATH_MULTIPLY:
-    case MathOperator::MATH_DIVIDE:
-    case MathOperator::MATH_POWER: //^
-    case MathOperator::MATH_AND:   //&
-    case MathOperator::MATH_OR:    //|
-    case MathOperator::MATH_MOD:   //%
-        return 2;
+        // 残差不再下降：A的条件数对于float过大，改进不会收敛
+        if (!(normR < prevNormR)) {
+            break;
+        }
+        prevNormR = normR;
 
-    case MathOperator::MATH_LEFT_PARENTHESIS:
-    case MathOperator::MATH_RIGHT_PARENTHESIS:
-        assert(0);
-        break;
-    default:
-        assert(0);
-        break;
+        internal::LuSolve(n, LU.data(), perm.data(), r.data());
+        for (int i = 0; i < n; ++i) {
+            x[i] += r[i];
+        }
     }
-    assert(0);
-    return 0;
+
+    return SolveLinear(A, b);
 }
 
-inline int Rank(MathOperator op) noexcept {
-    switch (op) {
-    case MathOperator::MATH_SIN:
-    case MathOperator::MATH_COS:
-    case MathOperator::MATH_TAN:
-    case MathOperator::MATH_ARCSIN:
-    case MathOperator::MATH_ARCCOS:
-    case MathOperator::MATH_ARCTAN:
-    case MathOperator::MATH_SQRT:
-    case MathOperator::MATH_LOG:
-    case MathOperator::MATH_LOG2:
-    case MathOperator::MATH_LOG10:
-    case MathOperator::MATH_EXP:
-        return 15;
+} // namespace tomsolver
 
-    case MathOperator::MATH_POSITIVE: // 除了函数，所有运算符均可将正负号挤出
-    case MathOperator::MATH_NEGATIVE:
-        return 14;
+namespace tomsolver {
 
-    case MathOperator::MATH_MOD: //%
-        return 13;
+/**
+ * 一维搜索的目标：方程组F: R^n -> R^m及其雅可比矩阵。
+ * 一维搜索沿方向d最小化价值函数 phi(alpha) = 0.5 * ||F(x + alpha * d)||^2。
+ * 所有缓冲区都由调用者提供，实现不应在求值时分配内存。
+ */
+class LineSearchProblem {
+public:
+    virtual ~LineSearchProblem() = default;
 
-    case MathOperator::MATH_AND: //&
-    case MathOperator::MATH_OR:  //|
-        return 12;
+    /**
+     * 方程数量m。
+     */
+    virtual int Rows() const noexcept = 0;
 
-    case MathOperator::MATH_POWER: //^
-        return 11;
+    /**
+     * 未知量数量n。
+     */
+    virtual int Cols() const noexcept = 0;
 
-    case MathOperator::MATH_MULTIPLY:
-    case MathOperator::MATH_DIVIDE:
-        return 10;
+    /**
+     * 计算F(x)，写入f。x的长度为Cols()，f的长度为Rows()。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    virtual void Residual(const double *x, double *f) = 0;
 
-    case MathOperator::MATH_ADD:
-    case MathOperator::MATH_SUB:
-        return 5;
+    /**
+     * 计算雅可比矩阵，按行优先的顺序写入J，J的长度为Rows()*Cols()。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    virtual void Jacobian(const double *x, double *J) = 0;
+};
 
-    case MathOperator::MATH_LEFT_PARENTHESIS: // 左右括号优先级小是为了不被其余任何运算符挤出
-    case MathOperator::MATH_RIGHT_PARENTHESIS:
-        return 0;
-    default:
-        assert(0);
-        break;
-    }
-    assert(0);
-    return 0;
-}
+/**
+ * 一维搜索的工作区。第一次使用时按问题的规模分配，之后重复使用同一个工作区不再分配内存。
+ */
+struct LineSearchWorkspace {
+    std::vector<double> x; // 试探点
+    std::vector<double> f; // 试探点的F
+    std::vector<double> J; // 试探点的雅可比矩阵
+};
 
-inline bool IsLeft2Right(MathOperator eOperator) noexcept {
-    switch (eOperator) {
-    case MathOperator::MATH_MOD: //%
-    case MathOperator::MATH_AND: //&
-    case MathOperator::MATH_OR:  //|
-    case MathOperator::MATH_MULTIPLY:
-    case MathOperator::MATH_DIVIDE:
-    case MathOperator::MATH_ADD:
-    case MathOperator::MATH_SUB:
-        return true;
+/**
+ * 一维搜索策略。通过MakeLineSearch()按Config::Get().lineSearchMethod创建。
+ */
+class LineSearch {
+public:
+    virtual ~LineSearch() = default;
 
-    case MathOperator::MATH_POSITIVE: // 正负号为右结合
-    case MathOperator::MATH_NEGATIVE:
-    case MathOperator::MATH_POWER: //^
-        return false;
+    /**
+     * 从x出发沿方向d搜索步长alpha。x与d的长度为problem.Cols()。
+     * phi0为0.5 * ||F(x)||^2，dphi0为phi'(0) = (J(x)^T F(x))·d，由调用者传入，不再重复求值。
+     * d不是下降方向（dphi0 >= 0）时，只要求价值函数严格下降。
+     * 返回满足条件的步长；尝试Config::Get().maxLineSearchSteps次仍找不到时返回0，由调用者决定如何处理（例如增大阻尼）。
+     * 求值时出现浮点数无效值的试探点视为不满足条件。
+     */
+    virtual double Search(LineSearchProblem &problem, const double *x, const double *d, double phi0, double dphi0,
+                          LineSearchWorkspace &ws) = 0;
 
-    // 函数和括号不计结合性
-    case MathOperator::MATH_SIN:
-    case MathOperator::MATH_COS:
-    case MathOperator::MATH_TAN:
-    case MathOperator::MATH_ARCSIN:
-    case MathOperator::MATH_ARCCOS:
-    case MathOperator::MATH_ARCTAN:
-    case MathOperator::MATH_SQRT:
-    case MathOperator::MATH_LOG:
-    case MathOperator::MATH_LOG2:
-    case MathOperator::MATH_LOG10:
-    case MathOperator::MATH_EXP:
+    /**
+     * 开始新的求解时调用，清除保存的历史（例如非单调搜索的价值函数记录）。
+     */
+    virtual void Reset() noexcept {}
+};
 
-    case MathOperator::MATH_LEFT_PARENTHESIS:
-    case MathOperator::MATH_RIGHT_PARENTHESIS:
-        return true;
-    default:
-        assert(0);
-    }
-    return false;
-}
+/**
+ * 回溯Armijo搜索：alpha从1开始按比例缩小，直到 phi(alpha) <= phi(0) + c1 * alpha * phi'(0)。
+ */
+class ArmijoLineSearch : public LineSearch {
+public:
+    double c1 = 1.0e-4;
+    double shrink = 0.5; // 每次回溯alpha缩小的比例，取值范围(0, 1)
 
-inline bool InAssociativeLaws(MathOperator eOperator) noexcept {
-    switch (eOperator) {
+    double Search(LineSearchProblem &problem, const double *x, const double *d, double phi0, double dphi0,
+                  LineSearchWorkspace &ws) override;
+};
 
-    case MathOperator::MATH_POSITIVE: // 正负号
-    case MathOperator::MATH_NEGATIVE:
+/**
+ * 强Wolfe条件搜索（Nocedal & Wright算法3.5、3.6）：
+ *      phi(alpha) <= phi(0) + c1 * alpha * phi'(0)，且 |phi'(alpha)| <= c2 * |phi'(0)|。
+ * alpha从1开始，需要时外推，再在区间内以二次插值缩小。每个试探点都要计算雅可比矩阵，
+ * 但得到的步长更接近一维极小点，适合病态、迭代次数多的方程组。
+ */
+class StrongWolfeLineSearch : public LineSearch {
+public:
+    double c1 = 1.0e-4;
+    double c2 = 0.9;
+    double maxAlpha = 16; // 外推的上限
 
-    case MathOperator::MATH_SQRT:
-    case MathOperator::MATH_SIN:
-    case MathOperator::MATH_COS:
-    case MathOperator::MATH_TAN:
-    case MathOperator::MATH_ARCSIN:
-    case MathOperator::MATH_ARCCOS:
-    case MathOperator::MATH_ARCTAN:
-    case MathOperator::MATH_LOG:
-    case MathOperator::MATH_LOG2:
-    case MathOperator::MATH_LOG10:
-    case MathOperator::MATH_EXP:
+    double Search(LineSearchProblem &problem, const double *x, const double *d, double phi0, double dphi0,
+                  LineSearchWorkspace &ws) override;
+};
 
-    case MathOperator::MATH_MOD:   //%
-    case MathOperator::MATH_AND:   //&
-    case MathOperator::MATH_OR:    //|
-    case MathOperator::MATH_POWER: //^
-    case MathOperator::MATH_DIVIDE:
-    case MathOperator::MATH_SUB:
+/**
+ * 非单调回溯搜索（Grippo-Lampariello-Lucidi）：与最近memory次搜索起点的价值函数的最大值比较，
+ *      phi(alpha) <= max(phi_k, phi_k-1, ..., phi_k-memory+1) + c1 * alpha * phi'(0)。
+ * 允许价值函数暂时上升，可以穿过狭长的弯曲谷底，避免步长被压得过小。
+ */
+class NonMonotoneLineSearch : public LineSearch {
+public:
+    double c1 = 1.0e-4;
+    double shrink = 0.5;
 
-    case MathOperator::MATH_LEFT_PARENTHESIS:
-    case MathOperator::MATH_RIGHT_PARENTHESIS:
-        return false;
+    /**
+     * @param memory 参与比较的历史记录数量，至少为1。为1时即ArmijoLineSearch。
+     */
+    explicit NonMonotoneLineSearch(int memory = 10);
 
-    case MathOperator::MATH_ADD:
-    case MathOperator::MATH_MULTIPLY:
-        return true;
-    default:
-        assert(0);
-        break;
-    }
-    assert(0);
-    return false;
-}
+    double Search(LineSearchProblem &problem, const double *x, const double *d, double phi0, double dphi0,
+                  LineSearchWorkspace &ws) override;
 
-inline bool IsFunction(MathOperator op) noexcept {
-    switch (op) {
-    case MathOperator::MATH_SIN:
-    case MathOperator::MATH_COS:
-    case MathOperator::MATH_TAN:
-    case MathOperator::MATH_ARCSIN:
-    case MathOperator::MATH_ARCCOS:
-    case MathOperator::MATH_ARCTAN:
-    case MathOperator::MATH_SQRT:
-    case MathOperator::MATH_LOG:
-    case MathOperator::MATH_LOG2:
-    case MathOperator::MATH_LOG10:
-    case MathOperator::MATH_EXP:
-        return true;
+    void Reset() noexcept override;
 
-    case MathOperator::MATH_POSITIVE:
-    case MathOperator::MATH_NEGATIVE:
-    case MathOperator::MATH_MOD:   //%
-    case MathOperator::MATH_AND:   //&
-    case MathOperator::MATH_OR:    //|
-    case MathOperator::MATH_POWER: //^
-    case MathOperator::MATH_MULTIPLY:
-    case MathOperator::MATH_DIVIDE:
-    case MathOperator::MATH_ADD:
-    case MathOperator::MATH_SUB:
-    case MathOperator::MATH_LEFT_PARENTHESIS:
-    case MathOperator::MATH_RIGHT_PARENTHESIS:
-        return false;
-    default:
-        assert(0);
-        break;
+private:
+    std::vector<double> history; // 环形缓冲区
+    std::size_t count = 0;       // 已经记录的数量
+};
+
+/**
+ * 按method创建一维搜索策略。NON_MONOTONE使用Config::Get().nonMonotoneMemory。
+ */
+inline std::unique_ptr<LineSearch> MakeLineSearch(LineSearchMethod method);
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+namespace internal {
+
+inline void PrepareLineSearchWorkspace(LineSearchProblem &problem, LineSearchWorkspace &ws) {
+    auto m = static_cast<std::size_t>(problem.Rows());
+    auto n = static_cast<std::size_t>(problem.Cols());
+    ws.x.resize(n);
+    ws.f.resize(m);
+    ws.J.resize(m * n);
+}
+
+/**
+ * 计算phi(alpha)，试探点及其F保存在ws.x、ws.f中。出现浮点数无效值时返回inf。
+ */
+inline double LineSearchPhi(LineSearchProblem &problem, const double *x, const double *d, double alpha,
+                     LineSearchWorkspace &ws) {
+    for (std::size_t i = 0; i < ws.x.size(); ++i) {
+        ws.x[i] = x[i] + alpha * d[i];
     }
-    assert(0);
-    return false;
+    try {
+        problem.Residual(ws.x.data(), ws.f.data());
+    } catch (const MathError &) {
+        return std::numeric_limits<double>::infinity();
+    }
+    double sum = 0;
+    for (auto v : ws.f) {
+        sum += v * v;
+    }
+    return 0.5 * sum;
 }
 
-inline double Calc(MathOperator op, double v1, double v2) {
-    double ret = std::numeric_limits<double>::quiet_NaN();
+/**
+ * 计算ws.x处的phi'(alpha) = F^T (J d)，不需要额外的缓冲区。须先调用LineSearchPhi()。出现浮点数无效值时返回nan。
+ */
+inline double LineSearchDphi(LineSearchProblem &problem, const double *d, LineSearchWorkspace &ws) {
+    try {
+        problem.Jacobian(ws.x.data(), ws.J.data());
+    } catch (const MathError &) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    auto n = ws.x.size();
+    double ret = 0;
+    for (std::size_t i = 0; i < ws.f.size(); ++i) {
+        double Jd = 0;
+        for (std::size_t j = 0; j < n; ++j) {
+            Jd += ws.J[i * n + j] * d[j];
+        }
+        ret += ws.f[i] * Jd;
+    }
+    return ret;
+}
+
+/**
+ * 回溯搜索。d是下降方向时要求 phi(alpha) <= reference + c1 * alpha * phi'(0)，否则只要求 phi(alpha) < phi(0)。
+ */
+inline double Backtrack(LineSearchProblem &problem, const double *x, const double *d, double phi0, double reference,
+                 double dphi0, double c1, double shrink, LineSearchWorkspace &ws) {
+    double alpha = 1;
+    for (int step = 0; step < Config::Get().maxLineSearchSteps; ++step) {
+        auto phi = LineSearchPhi(problem, x, d, alpha, ws);
+        if (dphi0 < 0 ? phi <= reference + c1 * alpha * dphi0 : phi < phi0) {
+            return alpha;
+        }
+        alpha *= shrink;
+    }
+    return 0;
+}
+
+} // namespace internal
+
+inline double ArmijoLineSearch::Search(LineSearchProblem &problem, const double *x, const double *d, double phi0,
+                                double dphi0, LineSearchWorkspace &ws) {
+    internal::PrepareLineSearchWorkspace(problem, ws);
+    return internal::Backtrack(problem, x, d, phi0, phi0, dphi0, c1, shrink, ws);
+}
+
+inline double StrongWolfeLineSearch::Search(LineSearchProblem &problem, const double *x, const double *d, double phi0,
+                                     double dphi0, LineSearchWorkspace &ws) {
+    internal::PrepareLineSearchWorkspace(problem, ws);
+    if (!(dphi0 < 0)) {
+        return internal::Backtrack(problem, x, d, phi0, phi0, dphi0, c1, 0.5, ws);
+    }
+
+    auto maxSteps = Config::Get().maxLineSearchSteps;
+    int steps = 0;
+    auto sufficientDecrease = [&](double alpha, double phi) {
+        return phi <= phi0 + c1 * alpha * dphi0;
+    };
+    auto curvature = [&](double dphi) {
+        return std::abs(dphi) <= -c2 * dphi0;
+    };
+
+    // 区间[lo, hi]（lo可能大于hi）内包含满足强Wolfe条件的步长，且lo满足充分下降条件
+    auto zoom = [&](double lo, double phiLo, double dphiLo, double hi, double phiHi) {
+        while (steps++ < maxSteps) {
+            // 二次插值：过(lo, phiLo)、(hi, phiHi)，在lo处的导数为dphiLo。结果太靠近端点时取中点
+            double w = hi - lo;
+            double denom = 2 * (phiHi - phiLo - dphiLo * w);
+            double alpha = denom > 0 ? lo - dphiLo * w * w / denom : lo + w / 2;
+            if (!(alpha >= std::min(lo, hi) + 0.1 * std::abs(w) && alpha <= std::max(lo, hi) - 0.1 * std::abs(w))) {
+                alpha = lo + w / 2;
+            }
+
+            auto phi = internal::LineSearchPhi(problem, x, d, alpha, ws);
+            if (!sufficientDecrease(alpha, phi) || phi >= phiLo) {
+                hi = alpha;
+                phiHi = phi;
+                continue;
+            }
+            auto dphi = internal::LineSearchDphi(problem, d, ws);
+            if (std::isnan(dphi) || curvature(dphi)) {
+                return alpha;
+            }
+            if (dphi * (hi - lo) >= 0) {
+                hi = lo;
+                phiHi = phiLo;
+            }
+            lo = alpha;
+            phiLo = phi;
+            dphiLo = dphi;
+        }
+        // 次数用尽时退而接受满足充分下降条件的lo。lo为0表示失败
+        return lo;
+    };
+
+    double alphaPrev = 0, phiPrev = phi0, dphiPrev = dphi0;
+    double alpha = 1;
+    while (steps++ < maxSteps) {
+        auto phi = internal::LineSearchPhi(problem, x, d, alpha, ws);
+        if (!sufficientDecrease(alpha, phi) || (alphaPrev > 0 && phi >= phiPrev)) {
+            return zoom(alphaPrev, phiPrev, dphiPrev, alpha, phi);
+        }
+        auto dphi = internal::LineSearchDphi(problem, d, ws);
+        if (std::isnan(dphi) || curvature(dphi)) {
+            return alpha;
+        }
+        if (dphi >= 0) {
+            return zoom(alpha, phi, dphi, alphaPrev, phiPrev);
+        }
+        if (alpha >= maxAlpha) {
+            return alpha;
+        }
+        alphaPrev = alpha;
+        phiPrev = phi;
+        dphiPrev = dphi;
+        alpha = std::min(2 * alpha, maxAlpha);
+    }
+    return alphaPrev;
+}
+
+inline NonMonotoneLineSearch::NonMonotoneLineSearch(int memory) : history(static_cast<std::size_t>(std::max(memory, 1))) {}
+
+inline double NonMonotoneLineSearch::Search(LineSearchProblem &problem, const double *x, const double *d, double phi0,
+                                     double dphi0, LineSearchWorkspace &ws) {
+    internal::PrepareLineSearchWorkspace(problem, ws);
+    history[count % history.size()] = phi0;
+    ++count;
+    auto end = history.begin() + static_cast<std::ptrdiff_t>(std::min(count, history.size()));
+    auto reference = *std::max_element(history.begin(), end);
+    return internal::Backtrack(problem, x, d, phi0, reference, dphi0, c1, shrink, ws);
+}
+
+inline void NonMonotoneLineSearch::Reset() noexcept {
+    count = 0;
+}
+
+inline std::unique_ptr<LineSearch> MakeLineSearch(LineSearchMethod method) {
+    switch (method) {
+    case LineSearchMethod::ARMIJO:
+        return std::make_unique<ArmijoLineSearch>();
+    case LineSearchMethod::STRONG_WOLFE:
+        return std::make_unique<StrongWolfeLineSearch>();
+    case LineSearchMethod::NON_MONOTONE:
+        return std::make_unique<NonMonotoneLineSearch>(Config::Get().nonMonotoneMemory);
+    }
+    throw std::runtime_error("invalid LineSearchMethod value: " + std::to_string(static_cast<int>(method)));
+}
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+/**
+ * 批量计算一元运算：y[i] = op(x[i])，i∈[0, n)。y可以与x是同一个数组。
+ * MATH_SIN、MATH_COS、MATH_TAN、MATH_LOG、MATH_LOG2、MATH_LOG10、MATH_EXP使用可向量化的多项式实现，
+ * 运行时根据CPU特性选择AVX2+FMA版本（每次计算4个）或者通用版本（逐个计算），两者的误差上界相同：
+ *      exp: 1 ULP   log: 1 ULP   log2, log10: 2 ULP
+ *      sin, cos: 1 ULP（|x| <= 1e5）   tan: 3 ULP（|x| <= 1e5）
+ * 超出快速路径的输入（exp的|x| > 708，log的非正数与非正规数，sin、cos、tan的|x| > 1e5，以及inf、nan等）逐个交给std::的同名函数。
+ * 其余运算符逐个调用std::的同名函数。
+ * 与tomsolver::Calc不同，这里不检查浮点数无效值，定义域以外的输入按std::函数的约定返回nan或者inf。
+ */
+inline void BatchCalc(MathOperator op, const double *x, double *y, std::size_t n) noexcept;
+
+/**
+ * 批量同时计算sin与cos：s[i] = sin(x[i])，c[i] = cos(x[i])。s或者c可以与x是同一个数组。
+ * 误差上界与BatchCalc相同，两者共用一次区间约简。
+ */
+inline void BatchSinCos(const double *x, double *s, double *c, std::size_t n) noexcept;
+
+/**
+ * 返回BatchCalc当前使用的实现："avx2"或者"generic"。
+ */
+inline const char *BatchCalcKernel() noexcept;
+
+namespace internal {
+
+/**
+ * 强制使用通用版本的BatchCalc、BatchSinCos。用于测试两种实现的一致性。
+ */
+inline void BatchCalcGeneric(MathOperator op, const double *x, double *y, std::size_t n) noexcept;
+
+inline void BatchSinCosGeneric(const double *x, double *s, double *c, std::size_t n) noexcept;
+
+} // namespace internal
+
+} // namespace tomsolver
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
+namespace tomsolver {
+
+namespace {
+
+// 加上1.5*2^52之后，低位就是四舍五入得到的整数
+constexpr double BATCH_SHIFTER = 6755399441055744.0;
+
+constexpr double BATCH_LOG2E = 1.4426950408889634;
+constexpr double BATCH_LN2_HI = 6.93147180369123816490e-01; // ln2的高32位，与不超过2^20的整数相乘没有舍入误差
+constexpr double BATCH_LN2_LO = 1.90821492927058770002e-10;
+constexpr double BATCH_INV_LN2 = 1.4426950408889634;
+constexpr double BATCH_INV_LN10 = 0.43429448190325182765;
+constexpr double BATCH_SQRT2 = 1.4142135623730951;
+
+constexpr double BATCH_TWO_OVER_PI = 0.63661977236758134308;
+constexpr double BATCH_PIO2_1 = 1.57079632673412561417e+00; // pi/2的前33位
+constexpr double BATCH_PIO2_2 = 6.07710050630396597660e-11; // pi/2的第二个33位
+constexpr double BATCH_PIO2_3 = 2.02226624871116645580e-21; // pi/2的第三个33位
+constexpr double BATCH_PIO2_3T = 8.47842766036889956997e-32; // pi/2的剩余部分
+
+// 快速路径的输入范围
+constexpr double BATCH_EXP_MAX = 708.0;
+constexpr double BATCH_TRIG_MAX = 1.0e5;
+
+// exp: e^r = 1 + (r + r^2*E(r))，E(r) = 1/2! + r/3! + ... + r^11/13!，|r| <= ln2/2
+constexpr double BATCH_EXP_C[] = {
+    1.0 / 6227020800.0, 1.0 / 479001600.0, 1.0 / 39916800.0, 1.0 / 3628800.0,
+    1.0 / 362880.0,     1.0 / 40320.0,     1.0 / 5040.0,     1.0 / 720.0,
+    1.0 / 120.0,        1.0 / 24.0,        1.0 / 6.0,        1.0 / 2.0,
+};
+
+// log: log(1+f) = 2s + s*R，s = f/(2+f)，R = sum(2/(2k+1) * s^2k)，|s| <= 0.172
+constexpr double BATCH_LOG_C[] = {
+    2.0 / 23.0, 2.0 / 21.0, 2.0 / 19.0, 2.0 / 17.0, 2.0 / 15.0, 2.0 / 13.0,
+    2.0 / 11.0, 2.0 / 9.0,  2.0 / 7.0,  2.0 / 5.0,  2.0 / 3.0,
+};
+
+// sin: r + r^3*S(r^2)，|r| <= pi/4
+constexpr double BATCH_SIN_C[] = {
+    -1.0 / 121645100408832000.0, 1.0 / 355687428096000.0, -1.0 / 1307674368000.0,
+    1.0 / 6227020800.0,          -1.0 / 39916800.0,       1.0 / 362880.0,
+    -1.0 / 5040.0,               1.0 / 120.0,             -1.0 / 6.0,
+};
+
+// cos: 1 - r^2/2 + r^4*C(r^2)，|r| <= pi/4
+constexpr double BATCH_COS_C[] = {
+    -1.0 / 6402373705728000.0, 1.0 / 20922789888000.0, -1.0 / 87178291200.0, 1.0 / 479001600.0,
+    -1.0 / 3628800.0,          1.0 / 40320.0,          -1.0 / 720.0,         1.0 / 24.0,
+};
+
+inline std::uint64_t BatchAsBits(double value) noexcept {
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline double BatchFromBits(std::uint64_t bits) noexcept {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+template <std::size_t N>
+inline double BatchHorner(const double (&c)[N], double x) noexcept {
+    double p = c[0];
+    for (std::size_t i = 1; i < N; ++i) {
+        p = p * x + c[i];
+    }
+    return p;
+}
+
+// 逐个计算，也是快速路径以外的输入的后备实现
+inline double BatchStdCalc(MathOperator op, double v) noexcept {
     switch (op) {
+    case MathOperator::MATH_POSITIVE:
+        return v;
+    case MathOperator::MATH_NEGATIVE:
+        return -v;
     case MathOperator::MATH_SIN:
-        ret = std::sin(v1);
-        break;
+        return std::sin(v);
     case MathOperator::MATH_COS:
-        ret = std::cos(v1);
-        break;
+        return std::cos(v);
     case MathOperator::MATH_TAN:
-        ret = std::tan(v1);
-        break;
+        return std::tan(v);
     case MathOperator::MATH_ARCSIN:
-        ret = std::asin(v1);
-        break;
+        return std::asin(v);
     case MathOperator::MATH_ARCCOS:
-        ret = std::acos(v1);
-        break;
+        return std::acos(v);
     case MathOperator::MATH_ARCTAN:
-        ret = std::atan(v1);
-        break;
+        return std::atan(v);
     case MathOperator::MATH_SQRT:
-        ret = std::sqrt(v1);
-        break;
+        return std::sqrt(v);
     case MathOperator::MATH_LOG:
-        ret = std::log(v1);
-        break;
+        return std::log(v);
     case MathOperator::MATH_LOG2:
-        ret = std::log2(v1);
-        break;
+        return std::log2(v);
     case MathOperator::MATH_LOG10:
-        ret = std::log10(v1);
-        break;
+        return std::log10(v);
     case MathOperator::MATH_EXP:
-        ret = std::exp(v1);
-        break;
-    case MathOperator::MATH_POSITIVE:
-        ret = v1;
-        break;
-    case MathOperator::MATH_NEGATIVE:
-        ret = -v1;
-        break;
+        return std::exp(v);
+    default:
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+}
 
-    case MathOperator::MATH_MOD: //%
-        ret = (int)v1 % (int)v2;
-        break;
-    case MathOperator::MATH_AND: //&
-        ret = (int)v1 & (int)v2;
-        break;
-    case MathOperator::MATH_OR: //|
-        ret = (int)v1 | (int)v2;
-        break;
+inline bool BatchInRange(MathOperator op, double v) noexcept {
+    switch (op) {
+    case MathOperator::MATH_SIN:
+    case MathOperator::MATH_COS:
+    case MathOperator::MATH_TAN:
+        return std::abs(v) <= BATCH_TRIG_MAX;
+    case MathOperator::MATH_LOG:
+    case MathOperator::MATH_LOG2:
+    case MathOperator::MATH_LOG10:
+        return v >= std::numeric_limits<double>::min() && v <= std::numeric_limits<double>::max();
+    case MathOperator::MATH_EXP:
+        return std::abs(v) <= BATCH_EXP_MAX;
+    default:
+        return false;
+    }
+}
 
-    case MathOperator::MATH_POWER: //^
-        ret = std::pow(v1, v2);
-        break;
+// 以下为通用版本，要求输入在快速路径的范围内
 
-    case MathOperator::MATH_ADD:
-        ret = v1 + v2;
-        break;
-    case MathOperator::MATH_SUB:
-        ret = v1 - v2;
-        break;
-    case MathOperator::MATH_MULTIPLY:
-        ret = v1 * v2;
+inline double BatchExp(double x) noexcept {
+    auto t = x * BATCH_LOG2E + BATCH_SHIFTER;
+    auto n = t - BATCH_SHIFTER;
+    auto r = (x - n * BATCH_LN2_HI) - n * BATCH_LN2_LO;
+    auto k = static_cast<std::int64_t>(BatchAsBits(t) - BatchAsBits(BATCH_SHIFTER));
+    auto scale = BatchFromBits(static_cast<std::uint64_t>(k + 1023) << 52);
+    return (1 + (r + (r * r) * BatchHorner(BATCH_EXP_C, r))) * scale;
+}
+
+// x = 2^k * (1+f)，1+f∈[sqrt(2)/2, sqrt(2))。log(1+f) = f - hfsq + sR
+inline void BatchLogReduce(double x, double &k, double &f, double &hfsq, double &sR) noexcept {
+    auto bits = BatchAsBits(x);
+    auto e = static_cast<std::int64_t>(bits >> 52) - 1023;
+    auto m = BatchFromBits((bits & 0x000fffffffffffffull) | 0x3ff0000000000000ull);
+    if (m > BATCH_SQRT2) {
+        m *= 0.5;
+        ++e;
+    }
+    k = static_cast<double>(e);
+    f = m - 1;
+    auto s = f / (2 + f);
+    auto z = s * s;
+    hfsq = 0.5 * f * f;
+    sR = s * (hfsq + z * BatchHorner(BATCH_LOG_C, z));
+}
+
+inline double BatchLog(double x) noexcept {
+    double k, f, hfsq, sR;
+    BatchLogReduce(x, k, f, hfsq, sR);
+    return k * BATCH_LN2_HI - ((hfsq - (sR + k * BATCH_LN2_LO)) - f);
+}
+
+inline double BatchLog2(double x) noexcept {
+    double k, f, hfsq, sR;
+    BatchLogReduce(x, k, f, hfsq, sR);
+    return k + (f - (hfsq - sR)) * BATCH_INV_LN2;
+}
+
+// sin(x)与cos(x)。x = n*pi/2 + r，r以r + rlo两个数表示，x接近pi/2的整数倍时也不损失精度
+inline void BatchSinCosKernel(double x, double &s, double &c) noexcept {
+    auto t = x * BATCH_TWO_OVER_PI + BATCH_SHIFTER;
+    auto n = t - BATCH_SHIFTER;
+    auto q = BatchAsBits(t) - BatchAsBits(BATCH_SHIFTER);
+
+    // a、p2都没有舍入误差，a - p2的舍入误差由TwoSum求出
+    auto a = x - n * BATCH_PIO2_1;
+    auto p2 = n * BATCH_PIO2_2;
+    auto b = a - p2;
+    auto bb = b - a;
+    auto err = (a - (b - bb)) - (p2 + bb);
+    auto lo = (err - n * BATCH_PIO2_3) - n * BATCH_PIO2_3T;
+    auto r = b + lo;
+    auto rlo = (b - r) + lo;
+
+    // sin(r + rlo) = sin(r) + rlo*cos(r)，cos(r + rlo) = cos(r) - rlo*sin(r)
+    auto z = r * r;
+    auto hz = 0.5 * z;
+    auto sinR = r + (r * z * BatchHorner(BATCH_SIN_C, z) + rlo * (1 - hz));
+    auto w = 1 - hz;
+    auto cosR = w + (((1 - w) - hz) + (z * z * BatchHorner(BATCH_COS_C, z) - r * rlo));
+
+    // 按象限换成±sin(r)或±cos(r)
+    s = (q & 1) ? cosR : sinR;
+    c = (q & 1) ? sinR : cosR;
+    s = (q & 2) ? -s : s;
+    c = ((q + 1) & 2) ? -c : c;
+}
+
+inline double BatchKernel(MathOperator op, double v) noexcept {
+    double s, c;
+    switch (op) {
+    case MathOperator::MATH_SIN:
+        BatchSinCosKernel(v, s, c);
+        return s;
+    case MathOperator::MATH_COS:
+        BatchSinCosKernel(v, s, c);
+        return c;
+    case MathOperator::MATH_TAN:
+        BatchSinCosKernel(v, s, c);
+        return s / c;
+    case MathOperator::MATH_LOG:
+        return BatchLog(v);
+    case MathOperator::MATH_LOG2:
+        return BatchLog2(v);
+    case MathOperator::MATH_LOG10:
+        return BatchLog(v) * BATCH_INV_LN10;
+    case MathOperator::MATH_EXP:
+        return BatchExp(v);
+    default:
+        return BatchStdCalc(op, v);
+    }
+}
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+
+// 以下为AVX2+FMA版本，算法与通用版本一致，每次计算4个
+
+inline bool BatchHasAvx2() noexcept {
+    static const bool ret = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }();
+    return ret;
+}
+
+template <std::size_t N>
+__attribute__((target("avx2,fma"), always_inline)) inline __m256d BatchHorner4(const double (&c)[N],
+                                                                              __m256d x) noexcept {
+    auto p = _mm256_set1_pd(c[0]);
+    for (std::size_t i = 1; i < N; ++i) {
+        p = _mm256_fmadd_pd(p, x, _mm256_set1_pd(c[i]));
+    }
+    return p;
+}
+
+__attribute__((target("avx2,fma"))) __m256d BatchExp4(__m256d x) noexcept {
+    auto shifter = _mm256_set1_pd(BATCH_SHIFTER);
+    auto t = _mm256_fmadd_pd(x, _mm256_set1_pd(BATCH_LOG2E), shifter);
+    auto n = _mm256_sub_pd(t, shifter);
+    auto r = _mm256_fnmadd_pd(n, _mm256_set1_pd(BATCH_LN2_HI), x);
+    r = _mm256_fnmadd_pd(n, _mm256_set1_pd(BATCH_LN2_LO), r);
+    auto k = _mm256_sub_epi64(_mm256_castpd_si256(t), _mm256_castpd_si256(shifter));
+    auto scale = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(k, _mm256_set1_epi64x(1023)), 52));
+    auto p = _mm256_fmadd_pd(_mm256_mul_pd(r, r), BatchHorner4(BATCH_EXP_C, r), r);
+    return _mm256_mul_pd(_mm256_add_pd(_mm256_set1_pd(1), p), scale);
+}
+
+__attribute__((target("avx2,fma"))) void BatchLogReduce4(__m256d x, __m256d &k, __m256d &f, __m256d &hfsq,
+                                                         __m256d &sR) noexcept {
+    auto bits = _mm256_castpd_si256(x);
+    auto e = _mm256_sub_epi64(_mm256_srli_epi64(bits, 52), _mm256_set1_epi64x(1023));
+    auto m = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi64x(0x000fffffffffffffll)),
+                                                 _mm256_set1_epi64x(0x3ff0000000000000ll)));
+    auto big = _mm256_cmp_pd(m, _mm256_set1_pd(BATCH_SQRT2), _CMP_GT_OQ);
+    m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), big);
+    e = _mm256_sub_epi64(e, _mm256_castpd_si256(big)); // big的每一位都是1，即-1
+
+    // 小整数转double：拼到1.5*2^52的低位上，再减去1.5*2^52
+    auto shifter = _mm256_set1_pd(BATCH_SHIFTER);
+    k = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(e, _mm256_castpd_si256(shifter))), shifter);
+
+    auto one = _mm256_set1_pd(1);
+    f = _mm256_sub_pd(m, one);
+    auto s = _mm256_div_pd(f, _mm256_add_pd(_mm256_set1_pd(2), f));
+    auto z = _mm256_mul_pd(s, s);
+    hfsq = _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(0.5), f), f);
+    sR = _mm256_mul_pd(s, _mm256_fmadd_pd(z, BatchHorner4(BATCH_LOG_C, z), hfsq));
+}
+
+__attribute__((target("avx2,fma"))) __m256d BatchLog4(__m256d x) noexcept {
+    __m256d k, f, hfsq, sR;
+    BatchLogReduce4(x, k, f, hfsq, sR);
+    auto lo = _mm256_fmadd_pd(k, _mm256_set1_pd(BATCH_LN2_LO), sR);
+    return _mm256_sub_pd(_mm256_mul_pd(k, _mm256_set1_pd(BATCH_LN2_HI)), _mm256_sub_pd(_mm256_sub_pd(hfsq, lo), f));
+}
+
+__attribute__((target("avx2,fma"))) __m256d BatchLog2_4(__m256d x) noexcept {
+    __m256d k, f, hfsq, sR;
+    BatchLogReduce4(x, k, f, hfsq, sR);
+    return _mm256_fmadd_pd(_mm256_sub_pd(f, _mm256_sub_pd(hfsq, sR)), _mm256_set1_pd(BATCH_INV_LN2), k);
+}
+
+__attribute__((target("avx2,fma"))) void BatchSinCos4(__m256d x, __m256d &s, __m256d &c) noexcept {
+    auto shifter = _mm256_set1_pd(BATCH_SHIFTER);
+    auto t = _mm256_fmadd_pd(x, _mm256_set1_pd(BATCH_TWO_OVER_PI), shifter);
+    auto n = _mm256_sub_pd(t, shifter);
+    auto q = _mm256_sub_epi64(_mm256_castpd_si256(t), _mm256_castpd_si256(shifter));
+
+    auto a = _mm256_fnmadd_pd(n, _mm256_set1_pd(BATCH_PIO2_1), x);
+    auto p2 = _mm256_mul_pd(n, _mm256_set1_pd(BATCH_PIO2_2));
+    auto b = _mm256_sub_pd(a, p2);
+    auto bb = _mm256_sub_pd(b, a);
+    auto err = _mm256_sub_pd(_mm256_sub_pd(a, _mm256_sub_pd(b, bb)), _mm256_add_pd(p2, bb));
+    auto lo = _mm256_fnmadd_pd(n, _mm256_set1_pd(BATCH_PIO2_3), err);
+    lo = _mm256_fnmadd_pd(n, _mm256_set1_pd(BATCH_PIO2_3T), lo);
+    auto r = _mm256_add_pd(b, lo);
+    auto rlo = _mm256_add_pd(_mm256_sub_pd(b, r), lo);
+
+    auto one = _mm256_set1_pd(1);
+    auto z = _mm256_mul_pd(r, r);
+    auto hz = _mm256_mul_pd(_mm256_set1_pd(0.5), z);
+    auto w = _mm256_sub_pd(one, hz);
+    auto sinR = _mm256_add_pd(r, _mm256_fmadd_pd(_mm256_mul_pd(r, z), BatchHorner4(BATCH_SIN_C, z),
+                                                 _mm256_mul_pd(rlo, w)));
+    auto cosR = _mm256_add_pd(
+        w, _mm256_add_pd(_mm256_sub_pd(_mm256_sub_pd(one, w), hz),
+                         _mm256_fnmadd_pd(r, rlo, _mm256_mul_pd(_mm256_mul_pd(z, z), BatchHorner4(BATCH_COS_C, z)))));
+
+    // 按象限换成±sin(r)或±cos(r)，符号位直接异或
+    auto swap = _mm256_castsi256_pd(
+        _mm256_cmpeq_epi64(_mm256_and_si256(q, _mm256_set1_epi64x(1)), _mm256_set1_epi64x(1)));
+    auto signS = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_and_si256(q, _mm256_set1_epi64x(2)), 62));
+    auto signC = _mm256_castsi256_pd(
+        _mm256_slli_epi64(_mm256_and_si256(_mm256_add_epi64(q, _mm256_set1_epi64x(1)), _mm256_set1_epi64x(2)), 62));
+    s = _mm256_xor_pd(_mm256_blendv_pd(sinR, cosR, swap), signS);
+    c = _mm256_xor_pd(_mm256_blendv_pd(cosR, sinR, swap), signC);
+}
+
+__attribute__((target("avx2,fma"))) __m256d BatchKernel4(MathOperator op, __m256d v) noexcept {
+    __m256d s, c;
+    switch (op) {
+    case MathOperator::MATH_SIN:
+        BatchSinCos4(v, s, c);
+        return s;
+    case MathOperator::MATH_COS:
+        BatchSinCos4(v, s, c);
+        return c;
+    case MathOperator::MATH_TAN:
+        BatchSinCos4(v, s, c);
+        return _mm256_div_pd(s, c);
+    case MathOperator::MATH_LOG:
+        return BatchLog4(v);
+    case MathOperator::MATH_LOG2:
+        return BatchLog2_4(v);
+    case MathOperator::MATH_LOG10:
+        return _mm256_mul_pd(BatchLog4(v), _mm256_set1_pd(BATCH_INV_LN10));
+    default:
+        return BatchExp4(v);
+    }
+}
+
+// 4个输入是否都在快速路径的范围内
+__attribute__((target("avx2,fma"))) bool BatchInRange4(MathOperator op, __m256d v) noexcept {
+    auto abs = _mm256_andnot_pd(_mm256_set1_pd(-0.0), v);
+    __m256d ok;
+    switch (op) {
+    case MathOperator::MATH_LOG:
+    case MathOperator::MATH_LOG2:
+    case MathOperator::MATH_LOG10:
+        ok = _mm256_and_pd(_mm256_cmp_pd(v, _mm256_set1_pd(std::numeric_limits<double>::min()), _CMP_GE_OQ),
+                           _mm256_cmp_pd(v, _mm256_set1_pd(std::numeric_limits<double>::max()), _CMP_LE_OQ));
         break;
-    case MathOperator::MATH_DIVIDE:
-        ret = v1 / v2;
+    case MathOperator::MATH_EXP:
+        ok = _mm256_cmp_pd(abs, _mm256_set1_pd(BATCH_EXP_MAX), _CMP_LE_OQ);
         break;
     default:
-        assert(0 && "[Calc] bug.");
+        ok = _mm256_cmp_pd(abs, _mm256_set1_pd(BATCH_TRIG_MAX), _CMP_LE_OQ);
         break;
     }
+    return _mm256_movemask_pd(ok) == 0xf;
+}
+
+// y可以与x是同一个数组：每次先读入4个再写回
+__attribute__((target("avx2,fma"))) void BatchCalcAvx2(MathOperator op, const double *x, double *y,
+                                                       std::size_t n) noexcept {
+    alignas(32) double in[4], out[4];
+    for (std::size_t i = 0; i < n; i += 4) {
+        auto m = std::min<std::size_t>(4, n - i);
+        if (m == 4) {
+            auto v = _mm256_loadu_pd(x + i);
+            if (BatchInRange4(op, v)) {
+                _mm256_storeu_pd(y + i, BatchKernel4(op, v));
+                continue;
+            }
+        }
+
+        // 末尾不足4个（补0），或者有超出范围的输入
+        std::fill(in, in + 4, 0.0);
+        std::copy(x + i, x + i + m, in);
+        _mm256_store_pd(out, BatchKernel4(op, _mm256_load_pd(in)));
+        for (std::size_t j = 0; j < m; ++j) {
+            if (!BatchInRange(op, in[j])) {
+                out[j] = BatchStdCalc(op, in[j]);
+            }
+        }
+        std::copy(out, out + m, y + i);
+    }
+}
+
+__attribute__((target("avx2,fma"))) void BatchSinCosAvx2(const double *x, double *s, double *c,
+                                                         std::size_t n) noexcept {
+    alignas(32) double in[4], outS[4], outC[4];
+    for (std::size_t i = 0; i < n; i += 4) {
+        auto m = std::min<std::size_t>(4, n - i);
+        std::fill(in, in + 4, 0.0);
+        std::copy(x + i, x + i + m, in);
+        __m256d vs, vc;
+        BatchSinCos4(_mm256_load_pd(in), vs, vc);
+        _mm256_store_pd(outS, vs);
+        _mm256_store_pd(outC, vc);
+        for (std::size_t j = 0; j < m; ++j) {
+            if (!(std::abs(in[j]) <= BATCH_TRIG_MAX)) {
+                outS[j] = std::sin(in[j]);
+                outC[j] = std::cos(in[j]);
+            }
+        }
+        std::copy(outS, outS + m, s + i);
+        std::copy(outC, outC + m, c + i);
+    }
+}
+
+#else
+
+inline bool BatchHasAvx2() noexcept {
+    return false;
+}
+
+inline void BatchCalcAvx2(MathOperator op, const double *x, double *y, std::size_t n) noexcept {
+    internal::BatchCalcGeneric(op, x, y, n);
+}
+
+inline void BatchSinCosAvx2(const double *x, double *s, double *c, std::size_t n) noexcept {
+    internal::BatchSinCosGeneric(x, s, c, n);
+}
+
+#endif
+
+inline bool IsBatchKernelOperator(MathOperator op) noexcept {
+    return op >= MathOperator::MATH_SIN && op <= MathOperator::MATH_EXP && op != MathOperator::MATH_ARCSIN &&
+           op != MathOperator::MATH_ARCCOS && op != MathOperator::MATH_ARCTAN && op != MathOperator::MATH_SQRT;
+}
+
+} // namespace
+
+inline void BatchCalc(MathOperator op, const double *x, double *y, std::size_t n) noexcept {
+    if (IsBatchKernelOperator(op) && BatchHasAvx2()) {
+        BatchCalcAvx2(op, x, y, n);
+    } else {
+        internal::BatchCalcGeneric(op, x, y, n);
+    }
+}
+
+inline void BatchSinCos(const double *x, double *s, double *c, std::size_t n) noexcept {
+    if (BatchHasAvx2()) {
+        BatchSinCosAvx2(x, s, c, n);
+    } else {
+        internal::BatchSinCosGeneric(x, s, c, n);
+    }
+}
+
+inline const char *BatchCalcKernel() noexcept {
+    return BatchHasAvx2() ? "avx2" : "generic";
+}
+
+namespace internal {
+
+inline void BatchCalcGeneric(MathOperator op, const double *x, double *y, std::size_t n) noexcept {
+    if (!IsBatchKernelOperator(op)) {
+        for (std::size_t i = 0; i < n; ++i) {
+            y[i] = BatchStdCalc(op, x[i]);
+        }
+        return;
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        auto v = x[i];
+        y[i] = BatchInRange(op, v) ? BatchKernel(op, v) : BatchStdCalc(op, v);
+    }
+}
+
+inline void BatchSinCosGeneric(const double *x, double *s, double *c, std::size_t n) noexcept {
+    for (std::size_t i = 0; i < n; ++i) {
+        auto v = x[i];
+        if (std::abs(v) <= BATCH_TRIG_MAX) {
+            BatchSinCosKernel(v, s[i], c[i]);
+        } else {
+            // 先算好两个结果再写入，s、c可能与x是同一个数组
+            auto sinV = std::sin(v);
+            auto cosV = std::cos(v);
+            s[i] = sinV;
+            c[i] = cosV;
+        }
+    }
+}
+
+} // namespace internal
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+enum class NodeType : std::uint8_t { NUMBER, OPERATOR, VARIABLE };
+
+// 前置声明
+namespace internal {
+struct NodeImpl;
+}
+class SymMat;
+class FlatNode;
+class CompiledSymMat;
+class VarsTable;
+
+/**
+ * 表达式节点。
+ */
+using Node = std::unique_ptr<internal::NodeImpl>;
+
+namespace internal {
+
+/**
+ * 单个节点的实现。通常应该以std::unique_ptr包裹。
+ */
+struct NodeImpl {
+
+    NodeImpl(NodeType type, MathOperator op, double value, std::string varname) noexcept
+        : type(type), op(op), value(value), varname(varname), parent(nullptr) {}
+
+    NodeImpl(const NodeImpl &rhs) noexcept;
+    NodeImpl &operator=(const NodeImpl &rhs) noexcept;
+
+    NodeImpl(NodeImpl &&rhs) noexcept;
+    NodeImpl &operator=(NodeImpl &&rhs) noexcept;
+
+    ~NodeImpl();
+
+    bool Equal(const Node &rhs) const noexcept;
+
+    /**
+     * 把整个节点以中序遍历的顺序输出为字符串。
+     * 例如：
+     *      Node n = (Var("a") + Num(1)) * Var("b");
+     *   则
+     *      n->ToString() == "(a+1.000000)*b"
+     */
+    std::string ToString() const noexcept;
+
+    /**
+     * 计算出整个表达式的数值。不改变自身。
+     * @exception runtime_error 如果有变量存在，则无法计算
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    double Vpa() const;
+
+    /**
+     * 以varsTable中的值代入变量，计算出整个表达式的数值。非递归实现。
+     * 不改变自身，也不复制表达式树，因此多个线程可以同时对同一个表达式求值。
+     * @exception out_of_range 如果varsTable中没有某个变量
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    double Vpa(const VarsTable &varsTable) const;
+
+    /**
+     * 计算出整个表达式的数值。不改变自身。
+     * @exception runtime_error 如果有变量存在，则无法计算
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    NodeImpl &Calc();
+
+    /**
+     * 返回表达式内出现的所有变量名。
+     */
+    std::set<std::string> GetAllVarNames() const noexcept;
+
+    /**
+     * 计算表达式的结构哈希值。结构完全一致（Equal为true）的表达式哈希值相同。
+     * 结果与FlatNode::Hash()一致，且不依赖平台与进程，可以持久化保存。
+     */
+    std::uint64_t Hash() const noexcept;
+
+    /**
+     * 检查整个节点数的parent指针是否正确。
+     */
+    void CheckParent() const noexcept;
+
+private:
+    NodeType type = NodeType::NUMBER;
+    MathOperator op = MathOperator::MATH_NULL;
+    double value;
+    std::string varname;
+    NodeImpl *parent = nullptr;
+    Node left, right;
+    NodeImpl() = default;
+
+    /**
+     * 本节点如果是OPERATOR，检查操作数数量和left, right指针是否匹配。
+     */
+    void CheckOperatorNum() const noexcept;
+
+    /**
+     * 节点转string。仅限本节点，不含子节点。
+     */
+    std::string NodeToStr() const noexcept;
+
+    void ToStringRecursively(std::stringstream &output) const noexcept;
+
+    void ToStringNonRecursively(std::stringstream &output) const noexcept;
+
+    /**
+     * 计算表达式数值。递归实现。
+     * @exception runtime_error 如果有变量存在，则无法计算
+     * @exception MathError 不符合定义域, 除0等情况。
+     */
+    double VpaRecursively() const;
+
+    /**
+     * 计算表达式数值。非递归实现。
+     * 性能弱于递归实现。但不会导致栈溢出。
+     * 根据benchmark，生成一组含4000个随机四则运算节点的表达式，生成1000次，Release下测试耗时3000ms。递归实现耗时2500ms。
+     * 粗略计算，即 1333 ops/ms。
+     * @exception runtime_error 如果有变量存在，则无法计算
+     * @exception MathError 不符合定义域, 除0等情况。
+     */
+    double VpaNonRecursively() const;
+
+    /**
+     * 释放整个节点树，除了自己。
+     * 实际是二叉树的非递归后序遍历。
+     */
+    void Release() noexcept;
+
+    friend Node Operator(MathOperator op, Node left, Node right) noexcept;
+
+    friend Node CloneRecursively(const Node &rhs) noexcept;
+    friend Node CloneNonRecursively(const Node &rhs) noexcept;
+
+    friend void CopyOrMoveTo(NodeImpl *parent, Node &child, Node &&n1) noexcept;
+    friend void CopyOrMoveTo(NodeImpl *parent, Node &child, const Node &n1) noexcept;
+
+    friend std::ostream &operator<<(std::ostream &out, const Node &n) noexcept;
+
+    template <typename T>
+    friend Node UnaryOperator(MathOperator op, T &&n) noexcept;
+
+    template <typename T1, typename T2>
+    friend Node BinaryOperator(MathOperator op, T1 &&n1, T2 &&n2) noexcept;
+
+    friend class tomsolver::SymMat;
+    friend class tomsolver::FlatNode;
+    friend class tomsolver::CompiledSymMat;
+    friend class SimplifyFunctions;
+    friend class EGraph;
+    friend class DiffFunctions;
+    friend class SubsFunctions;
+    friend class ParseFunctions;
+};
+
+inline Node CloneRecursively(const Node &rhs) noexcept;
+
+inline Node CloneNonRecursively(const Node &rhs) noexcept;
+
+/**
+ * 对于一个节点n和另一个节点n1，把n1移动到作为n的子节点。
+ * 用法：CopyOrMoveTo(n->parent, n->left, std::forward<T>(n1));
+ */
+inline void CopyOrMoveTo(NodeImpl *parent, Node &child, Node &&n1) noexcept;
+
+/**
+ * 对于一个节点n和另一个节点n1，把n1整个拷贝一份，把拷贝的副本设为n的子节点。
+ * 用法：CopyOrMoveTo(n->parent, n->left, std::forward<T>(n1));
+ */
+inline void CopyOrMoveTo(NodeImpl *parent, Node &child, const Node &n1) noexcept;
+
+/**
+ * 重载std::ostream的<<操作符以输出一个Node节点。
+ */
+inline std::ostream &operator<<(std::ostream &out, const Node &n) noexcept;
+
+template <typename T>
+inline Node UnaryOperator(MathOperator op, T &&n) noexcept {
+    auto ret = std::make_unique<NodeImpl>(NodeType::OPERATOR, op, 0, "");
+    CopyOrMoveTo(ret.get(), ret->left, std::forward<T>(n));
+    return ret;
+}
+
+template <typename T1, typename T2>
+inline Node BinaryOperator(MathOperator op, T1 &&n1, T2 &&n2) noexcept {
+    auto ret = std::make_unique<NodeImpl>(NodeType::OPERATOR, op, 0, "");
+    CopyOrMoveTo(ret.get(), ret->left, std::forward<T1>(n1));
+    CopyOrMoveTo(ret.get(), ret->right, std::forward<T2>(n2));
+    return ret;
+}
+
+/**
+ * 新建一个运算符节点。
+ */
+inline Node Operator(MathOperator op, Node left = nullptr, Node right = nullptr) noexcept;
+
+/**
+ * 把value混入哈希值seed。
+ */
+inline std::uint64_t HashCombine(std::uint64_t seed, std::uint64_t value) noexcept;
+
+/**
+ * 单个节点的哈希值。仅限本节点，不含子节点。
+ */
+inline std::uint64_t HashSingleNode(NodeType type, MathOperator op, double value, const std::string &varname) noexcept;
+
+} // namespace internal
+
+/**
+ * 以表达式的结构计算哈希值的仿函数。配合NodeEqual可以把Node作为哈希容器的键，例如：
+ *      std::unordered_map<Node, int, NodeHash, NodeEqual> m;
+ */
+struct NodeHash {
+    std::size_t operator()(const Node &node) const noexcept;
+};
+
+/**
+ * 判断两个表达式结构是否完全一致的仿函数。
+ */
+struct NodeEqual {
+    bool operator()(const Node &lhs, const Node &rhs) const noexcept;
+};
+
+inline Node Clone(const Node &rhs) noexcept;
+
+/**
+ * 对节点进行移动。等同于std::move。
+ */
+inline Node Move(Node &rhs) noexcept;
+
+/**
+ * 新建一个数值节点。
+ */
+inline Node Num(double num) noexcept;
+
+/**
+ * 新建一个函数节点。
+ */
+inline Node Op(MathOperator op);
+
+/**
+ * 返回变量名是否有效。（只支持英文数字或者下划线，第一个字符必须是英文或者下划线）
+ */
+inline bool VarNameIsLegal(const std::string &varname) noexcept;
+
+/**
+ * 新建一个变量节点。
+ * @exception runtime_error 名字不合法
+ */
+inline Node Var(std::string varname);
+
+template <typename...>
+struct SfinaeNodeImpl : std::false_type {};
+
+template <>
+struct SfinaeNodeImpl<Node> : std::true_type {};
+
+template <>
+struct SfinaeNodeImpl<Node, Node> : std::true_type {};
+
+template <typename... T>
+using SfinaeNode = std::enable_if_t<SfinaeNodeImpl<std::decay_t<T>...>::value, Node>;
+
+template <typename T1, typename T2>
+inline SfinaeNode<T1, T2> operator+(T1 &&n1, T2 &&n2) noexcept {
+    return internal::BinaryOperator(MathOperator::MATH_ADD, std::forward<T1>(n1), std::forward<T2>(n2));
+}
+
+template <typename T>
+inline SfinaeNode<T> &operator+=(Node &n1, T &&n2) noexcept {
+    n1 = internal::BinaryOperator(MathOperator::MATH_ADD, std::move(n1), std::forward<T>(n2));
+    return n1;
+}
+
+template <typename T1, typename T2>
+inline SfinaeNode<T1, T2> operator-(T1 &&n1, T2 &&n2) noexcept {
+    return internal::BinaryOperator(MathOperator::MATH_SUB, std::forward<T1>(n1), std::forward<T2>(n2));
+}
+
+template <typename T>
+inline SfinaeNode<T> operator-(T &&n1) noexcept {
+    return internal::UnaryOperator(MathOperator::MATH_NEGATIVE, std::forward<T>(n1));
+}
+
+template <typename T>
+inline SfinaeNode<T> operator+(T &&n1) noexcept {
+    return internal::UnaryOperator(MathOperator::MATH_POSITIVE, std::forward<T>(n1));
+}
+
+template <typename T>
+inline SfinaeNode<T> &operator-=(Node &n1, T &&n2) noexcept {
+    n1 = internal::BinaryOperator(MathOperator::MATH_SUB, std::move(n1), std::forward<T>(n2));
+    return n1;
+}
+
+template <typename T1, typename T2>
+inline SfinaeNode<T1, T2> operator*(T1 &&n1, T2 &&n2) noexcept {
+    return internal::BinaryOperator(MathOperator::MATH_MULTIPLY, std::forward<T1>(n1), std::forward<T2>(n2));
+}
+
+template <typename T>
+inline SfinaeNode<T> &operator*=(Node &n1, T &&n2) noexcept {
+    n1 = internal::BinaryOperator(MathOperator::MATH_MULTIPLY, std::move(n1), std::forward<T>(n2));
+    return n1;
+}
+
+template <typename T1, typename T2>
+inline SfinaeNode<T1, T2> operator/(T1 &&n1, T2 &&n2) noexcept {
+    return internal::BinaryOperator(MathOperator::MATH_DIVIDE, std::forward<T1>(n1), std::forward<T2>(n2));
+}
+
+template <typename T>
+inline SfinaeNode<T> &operator/=(Node &n1, T &&n2) noexcept {
+    n1 = internal::BinaryOperator(MathOperator::MATH_DIVIDE, std::move(n1), std::forward<T>(n2));
+    return n1;
+}
+
+template <typename T1, typename T2>
+inline SfinaeNode<T1, T2> operator^(T1 &&n1, T2 &&n2) noexcept {
+    return internal::BinaryOperator(MathOperator::MATH_POWER, std::forward<T1>(n1), std::forward<T2>(n2));
+}
+
+template <typename T>
+inline SfinaeNode<T> &operator^=(Node &n1, T &&n2) noexcept {
+    n1 = internal::BinaryOperator(MathOperator::MATH_POWER, std::move(n1), std::forward<T>(n2));
+    return n1;
+}
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+namespace internal {
+
+inline NodeImpl::NodeImpl(const NodeImpl &rhs) noexcept {
+    *this = rhs;
+}
+
+inline NodeImpl &NodeImpl::operator=(const NodeImpl &rhs) noexcept {
+    type = rhs.type;
+    op = rhs.op;
+    value = rhs.value;
+    varname = rhs.varname;
+    parent = rhs.parent;
+    if (rhs.left) {
+        left = Clone(rhs.left);
+        left->parent = this;
+    } else {
+        left = nullptr;
+    }
+    if (rhs.right) {
+        right = Clone(rhs.right);
+        right->parent = this;
+    } else {
+        right = nullptr;
+    }
+    return *this;
+}
+
+inline NodeImpl::NodeImpl(NodeImpl &&rhs) noexcept {
+    *this = std::move(rhs);
+}
+
+inline NodeImpl &NodeImpl::operator=(NodeImpl &&rhs) noexcept {
+    type = std::exchange(rhs.type, {});
+    op = std::exchange(rhs.op, {});
+    value = std::exchange(rhs.value, {});
+    varname = std::exchange(rhs.varname, {});
+    parent = std::exchange(rhs.parent, {});
+    left = std::exchange(rhs.left, {});
+    if (left) {
+        left->parent = this;
+    }
+    right = std::exchange(rhs.right, {});
+    if (right) {
+        right->parent = this;
+    }
+
+    return *this;
+}
+
+inline NodeImpl::~NodeImpl() {
+    Release();
+}
+
+// 前序遍历。非递归实现。
+inline bool NodeImpl::Equal(const Node &other) const noexcept {
+    if (this == other.get()) {
+        return true;
+    }
+
+    std::stack<std::tuple<const NodeImpl &, const NodeImpl &>> stk;
+
+    auto tie = [](const NodeImpl &node) {
+        return std::tie(node.type, node.op, node.value, node.varname);
+    };
+
+    auto IsSame = [&tie](const NodeImpl &lhs, const NodeImpl &rhs) {
+        return tie(lhs) == tie(rhs);
+    };
+
+    auto CheckChildren = [&stk](const Node &lhs, const Node &rhs) {
+        // ╔═════╦═════╦════════╦═════════╗
+        // ║ lhs ║ rhs ║ return ║ emplace ║
+        // ╠═════╬═════╬════════╬═════════╣
+        // ║ T   ║ T   ║ T      ║ T       ║
+        // ╟─────╫─────╫────────╫─────────╢
+        // ║ T   ║ F   ║ F      ║ F       ║
+        // ╟─────╫─────╫────────╫─────────╢
+        // ║ F   ║ T   ║ F      ║ F       ║
+        // ╟─────╫─────╫────────╫─────────╢
+        // ║ F   ║ F   ║ T      ║ F       ║
+        // ╚═════╩═════╩════════╩═════════╝
+        if (!lhs ^ !rhs) {
+            return false;
+        }
+
+        if (lhs && rhs) {
+            stk.emplace(*lhs, *rhs);
+        }
+
+        return true;
+    };
+
+    auto CheckNode = [&IsSame, &CheckChildren](const NodeImpl &lhs, const NodeImpl &rhs) {
+        return IsSame(lhs, rhs) && CheckChildren(lhs.left, rhs.left) && CheckChildren(lhs.right, rhs.right);
+    };
+
+    if (!CheckNode(*this, *other)) {
+        return false;
+    }
+
+    while (!stk.empty()) {
+        const auto &lhs = std::get<0>(stk.top());
+        const auto &rhs = std::get<1>(stk.top());
+        stk.pop();
+
+        // 检查
+        if (!CheckNode(lhs, rhs)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+inline std::string NodeImpl::ToString() const noexcept {
+    std::stringstream ss;
+    ToStringNonRecursively(ss);
+    return ss.str();
+}
+
+inline double NodeImpl::Vpa() const {
+    return VpaNonRecursively();
+}
+
+// 后序遍历。非递归实现。
+inline double NodeImpl::Vpa(const VarsTable &varsTable) const {
+    // 第二项表示该节点的子节点是否已经入栈
+    std::vector<std::pair<const NodeImpl *, bool>> stk;
+    std::vector<double> calcStk;
+
+    stk.emplace_back(this, false);
+    while (!stk.empty()) {
+        auto &top = stk.back();
+        const auto &node = *top.first;
+
+        if (node.type == NodeType::OPERATOR && !top.second) {
+            top.second = true;
+            if (node.right) {
+                stk.emplace_back(node.right.get(), false);
+            }
+            stk.emplace_back(node.left.get(), false);
+            continue;
+        }
+        stk.pop_back();
+
+        switch (node.type) {
+        case NodeType::NUMBER:
+            calcStk.emplace_back(node.value);
+            break;
+
+        case NodeType::VARIABLE:
+            calcStk.emplace_back(varsTable[node.varname]);
+            break;
+
+        case NodeType::OPERATOR: {
+            auto r = std::numeric_limits<double>::quiet_NaN();
+            if (GetOperatorNum(node.op) == 2) {
+                r = calcStk.back();
+                calcStk.pop_back();
+            }
+            auto &l = calcStk.back();
+            l = tomsolver::Calc(node.op, l, r);
+            break;
+        }
+        }
+    }
+
+    assert(calcStk.size() == 1);
+    return calcStk.back();
+}
+
+inline NodeImpl &NodeImpl::Calc() {
+    auto d = Vpa();
+    *this = {};
+    value = d;
+
+    return *this;
+}
+
+// 前序遍历。非递归实现。
+inline void NodeImpl::CheckParent() const noexcept {
+    std::stack<std::reference_wrapper<const NodeImpl>> stk;
+
+    auto EmplaceNode = [&stk](const Node &node) {
+        if (node) {
+            stk.emplace(*node);
+        }
+    };
+    auto TryEmplaceChildren = [&EmplaceNode](const NodeImpl &node) {
+        node.CheckOperatorNum();
+        EmplaceNode(node.left);
+        EmplaceNode(node.right);
+    };
+
+    TryEmplaceChildren(*this);
+
+    while (!stk.empty()) {
+        const auto &f = stk.top().get();
+        stk.pop();
+
+#ifndef NDEBUG
+        // 检查
+        assert(f.parent);
+        bool isLeftChild = f.parent->left.get() == &f;
+        bool isRightChild = f.parent->right.get() == &f;
+        assert(isLeftChild || isRightChild);
+#endif
+
+        TryEmplaceChildren(f);
+    }
+}
+
+inline void NodeImpl::CheckOperatorNum() const noexcept {
+    if (type != NodeType::OPERATOR) {
+        return;
+    }
+
+    switch (GetOperatorNum(op)) {
+    case 1:
+        assert(!right);
+        break;
+    case 2:
+        assert(right);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+
+    assert(left);
+}
+
+inline std::string NodeImpl::NodeToStr() const noexcept {
+    switch (type) {
+    case NodeType::NUMBER:
+        return tomsolver::ToString(value);
+    case NodeType::VARIABLE:
+        return varname;
+    case NodeType::OPERATOR:
+        return MathOperatorToStr(op);
+    }
+    assert(0 && "unexpected NodeType. maybe this is a bug.");
+    return "";
+}
+
+// 中序遍历。递归实现。
+inline void NodeImpl::ToStringRecursively(std::stringstream &output) const noexcept {
+    switch (type) {
+    case NodeType::NUMBER:
+        // 如果当前节点是数值且小于0，且前面是-运算符，那么加括号
+        if (value < 0 && parent && parent->right.get() == this && parent->op == MathOperator::MATH_SUB) {
+            output << "(" << NodeToStr() << ")";
+        } else {
+            output << NodeToStr();
+        }
+        return;
+    case NodeType::VARIABLE:
+        output << NodeToStr();
+        return;
+    case NodeType::OPERATOR:
+        // pass
+        break;
+    }
+
+    auto hasParenthesis = false;
+    auto operatorNum = GetOperatorNum(op);
+    if (operatorNum == 1) // 一元运算符：函数和取负
+    {
+        if (op == MathOperator::MATH_POSITIVE || op == MathOperator::MATH_NEGATIVE) {
+            output << "(" << NodeToStr();
+        } else {
+            output << NodeToStr() << "(";
+        }
+        hasParenthesis = true;
+    } else {
+        // 非一元运算符才输出，即一元运算符的输出顺序已改变
+        if (type == NodeType::OPERATOR && parent) { // 本级为运算符
+            if ((GetOperatorNum(parent->op) == 2 && // 父运算符存在，为二元，
+                 (Rank(parent->op) > Rank(op)       // 父级优先级高于本级->加括号
+
+                  || ( // 两级优先级相等
+                         Rank(parent->op) == Rank(op) &&
+                         (
+                             // 本级为父级的右子树 且父级不满足结合律->加括号
+                             (InAssociativeLaws(parent->op) == false && this == parent->right.get()) ||
+                             // 两级都是右结合
+                             (InAssociativeLaws(parent->op) == false && IsLeft2Right(op) == false)))))
+
+                //||
+
+                ////父运算符存在，为除号，且本级为分子，则添加括号
+                //(now->parent->eOperator == MATH_DIVIDE && now == now->parent->right)
+            ) {
+                output << "(";
+                hasParenthesis = true;
+            }
+        }
+    }
+
+    if (left) // 左遍历
+    {
+        left->ToStringRecursively(output);
+    }
+
+    if (operatorNum != 1) // 非一元运算符才输出，即一元运算符的输出顺序已改变
+    {
+        output << NodeToStr();
+    }
+
+    if (right) // 右遍历
+    {
+        right->ToStringRecursively(output);
+    }
+
+    // 回到本级时补齐右括号，包住前面的东西
+    if (hasParenthesis) {
+        output << ")";
+    }
+}
+
+// 中序遍历。非递归实现。
+inline void NodeImpl::ToStringNonRecursively(std::stringstream &output) const noexcept {
+    std::stack<std::reference_wrapper<const NodeImpl>> stk;
+
+    NodeImpl rightParenthesis(NodeType::OPERATOR, MathOperator::MATH_RIGHT_PARENTHESIS, 0, "");
+
+    auto AddLeftLine = [&stk, &output, &rightParenthesis](const NodeImpl *cur) {
+        while (cur) {
+            if (cur->type != NodeType::OPERATOR) {
+                stk.emplace(*cur);
+                cur = cur->left.get();
+                continue;
+            }
+
+            // 一元运算符的特殊处理：
+            //      例如sin: 直接输出 "sin(" ，并且把一个右括号入栈。让退栈时这个右括号能包裹住现在的子树。
+            //      如果是+/-: 直接输出 "+"/"-"，如果+/-的操作数是operator，那么处理方式和sin这类一样；
+            //                                  如果+/-的操作数是number/variable，那么不加括号。
+            if (GetOperatorNum(cur->op) == 1) {
+                if ((cur->op == MathOperator::MATH_POSITIVE || cur->op == MathOperator::MATH_NEGATIVE) &&
+                    (cur->left->type != NodeType::OPERATOR)) {
+                    output << cur->NodeToStr();
+                    cur = cur->left.get();
+                    continue;
+                }
+                output << cur->NodeToStr() << "(";
+
+                // not push this op
+
+                // push ')'
+                stk.emplace(rightParenthesis);
+
+                cur = cur->left.get();
+                continue;
+            }
+
+            // 二元运算符的特殊处理：
+            if (cur->parent) {
+                if ((GetOperatorNum(cur->parent->op) == 2 && // 父运算符存在，为二元，
+                     (Rank(cur->parent->op) > Rank(cur->op)  // 父级优先级高于本级->加括号
+
+                      || ( // 两级优先级相等
+                             Rank(cur->parent->op) == Rank(cur->op) &&
+                             (
+                                 // 本级为父级的右子树 且父级不满足结合律->加括号
+                                 (InAssociativeLaws(cur->parent->op) == false && cur == cur->parent->right.get()) ||
+                                 // 两级都是右结合
+                                 (InAssociativeLaws(cur->parent->op) == false && IsLeft2Right(cur->op) == false)))))
+
+                    //||
+
+                    ////父运算符存在，为除号，且本级为分子，则添加括号
+                    //(now->parent->eOperator == MATH_DIVIDE && now == now->parent->right)
+                ) {
+                    output << "(";
+
+                    // push ')'
+                    stk.emplace(rightParenthesis);
+
+                    stk.emplace(*cur);
+                    cur = cur->left.get();
+                    continue;
+                }
+            }
+
+            stk.emplace(*cur);
+            cur = cur->left.get();
+        }
+    };
+
+    AddLeftLine(this);
+
+    while (!stk.empty()) {
+        const auto &cur = stk.top().get();
+        stk.pop();
+
+        // output
+
+        // 负数的特殊处理
+        // 如果当前节点是数值且小于0，且前面是-运算符，那么加括号
+        if (cur.type == NodeType::NUMBER && cur.value < 0 && cur.parent && cur.parent->right.get() == &cur &&
+            cur.parent->op == MathOperator::MATH_SUB) {
+            output << "(" << cur.NodeToStr() << ")";
+        } else {
+            output << cur.NodeToStr();
+        }
+
+        if (cur.right) {
+            AddLeftLine(cur.right.get());
+            continue;
+        }
+    }
+}
+
+// 后序遍历。递归实现。
+inline double NodeImpl::VpaRecursively() const {
+
+    auto vpa = [](const Node &node) {
+        return node ? node->Vpa() : 0;
+    };
+
+    switch (type) {
+    case NodeType::NUMBER:
+        return value;
+
+    case NodeType::VARIABLE:
+        throw std::runtime_error("has variable. can not calculate to be a number");
+
+    case NodeType::OPERATOR:
+        assert((GetOperatorNum(op) == 1 && left && right == nullptr) || (GetOperatorNum(op) == 2 && left && right));
+        return tomsolver::Calc(op, vpa(left), vpa(right));
+    }
+
+    throw std::runtime_error("unsupported node type");
+}
+
+// 后序遍历。非递归实现。
+inline double NodeImpl::VpaNonRecursively() const {
+
+    std::stack<std::reference_wrapper<const NodeImpl>> stk;
+    std::forward_list<std::reference_wrapper<const NodeImpl>> revertedPostOrder;
+
+    // ==== Part I ====
+
+    // 借助一个栈，得到反向的后序遍历序列，结果保存在revertedPostOrder
+    stk.emplace(*this);
+
+    while (!stk.empty()) {
+        const auto &node = stk.top().get();
+        stk.pop();
+
+        if (node.left) {
+            stk.emplace(*node.left);
+        }
+
+        if (node.right) {
+            stk.emplace(*node.right);
+        }
+
+        revertedPostOrder.emplace_front(node);
+    }
+
+    // ==== Part II ====
+    // revertedPostOrder的反向序列是一组逆波兰表达式，根据这组逆波兰表达式可以计算出表达式的值
+    // calcStk是用来计算值的临时栈，计算完成后calcStk的size应该为1
+    std::stack<double> calcStk;
+    // for (auto it = revertedPostOrder.rbegin(); it != revertedPostOrder.rend(); ++it) {
+    for (const auto &nodeWrapper : revertedPostOrder) {
+        const auto &node = nodeWrapper.get();
+        switch (node.type) {
+        case NodeType::NUMBER:
+            calcStk.emplace(node.value);
+            break;
+
+        case NodeType::OPERATOR: {
+            auto r = std::numeric_limits<double>::quiet_NaN();
+
+            switch (GetOperatorNum(node.op)) {
+            case 1:
+                break;
+            case 2:
+                r = calcStk.top();
+                calcStk.pop();
+                break;
+            default:
+                assert(0 && "[VpaNonRecursively] unsupported operator num");
+                break;
+            }
+
+            auto &l = calcStk.top();
+            l = tomsolver::Calc(node.op, l, r);
+            break;
+        }
+
+        default:
+            throw std::runtime_error("wrong");
+            break;
+        }
+    }
+
+    assert(calcStk.size() == 1);
+
+    return calcStk.top();
+}
+
+// 后序遍历。因为要在左右儿子都没有的情况下删除节点。
+inline void NodeImpl::Release() noexcept {
+    std::stack<Node> stk;
+
+    auto emplaceNode = [&stk](Node node) {
+        if (node) {
+            stk.emplace(std::move(node));
+        }
+    };
+
+    auto emplaceChildren = [&emplaceNode](NodeImpl &node) {
+        emplaceNode(std::move(node.left));
+        emplaceNode(std::move(node.right));
+    };
+
+    emplaceChildren(*this);
+
+    while (!stk.empty()) {
+        auto node = std::move(stk.top());
+        stk.pop();
+
+        emplaceChildren(*node);
+
+        assert(!node->left && !node->right);
+
+        // 这里如果把node填入vector，最后翻转。得到的序列就是后序遍历。
+
+        // 这里node会被自动释放。
+    }
+}
+
+inline Node CloneRecursively(const Node &src) noexcept {
+    auto ret = std::make_unique<NodeImpl>(src->type, src->op, src->value, src->varname);
+    auto Copy = [ret = ret.get()](Node &tgt, const Node &src) {
+        if (src) {
+            tgt = Clone(src);
+            tgt->parent = ret;
+        }
+    };
+
+    Copy(ret->left, src->left);
+    Copy(ret->right, src->right);
+
+    return ret;
+}
+
+// 前序遍历。非递归实现。
+inline Node CloneNonRecursively(const Node &node) noexcept {
+    std::stack<std::tuple<const NodeImpl &, NodeImpl &, Node &>> stk;
+
+    auto MakeNode = [](const NodeImpl &src, NodeImpl *parent = nullptr) {
+        auto node = std::make_unique<NodeImpl>(src.type, src.op, src.value, src.varname);
+        node->parent = parent;
+        return node;
+    };
+
+    auto EmplaceNode = [&stk](const Node &src, NodeImpl &parent, Node &tgt) {
+        if (src) {
+            stk.emplace(*src, parent, tgt);
+        }
+    };
+
+    auto EmplaceChildren = [&EmplaceNode](const NodeImpl &src, Node &tgt) {
+        EmplaceNode(src.left, *tgt, tgt->left);
+        EmplaceNode(src.right, *tgt, tgt->right);
+    };
+
+    auto ret = MakeNode(*node);
+    EmplaceChildren(*node, ret);
+
+    while (!stk.empty()) {
+        const auto &src = std::get<0>(stk.top());
+        auto &parent = std::get<1>(stk.top());
+        auto &tgt = std::get<2>(stk.top());
+        stk.pop();
+
+        tgt = MakeNode(src, &parent);
+        EmplaceChildren(src, tgt);
+    }
+
+    return ret;
+}
+
+inline void CopyOrMoveTo(NodeImpl *parent, Node &child, Node &&n1) noexcept {
+    n1->parent = parent;
+    child = std::move(n1);
+}
+
+inline void CopyOrMoveTo(NodeImpl *parent, Node &child, const Node &n1) noexcept {
+    auto n1Clone = std::make_unique<NodeImpl>(*n1);
+    n1Clone->parent = parent;
+    child = std::move(n1Clone);
+}
+
+inline std::ostream &operator<<(std::ostream &out, const Node &n) noexcept {
+    out << n->ToString();
+    return out;
+}
+
+inline Node Operator(MathOperator op, Node left, Node right) noexcept {
+    auto ret = std::make_unique<internal::NodeImpl>(NodeType::OPERATOR, op, 0, "");
+
+    auto SetChild = [ret = ret.get()](Node &tgt, Node src) {
+        if (src) {
+            src->parent = ret;
+            tgt = std::move(src);
+        }
+    };
+
+    SetChild(ret->left, std::move(left));
+    SetChild(ret->right, std::move(right));
+
+    return ret;
+}
+
+// 前序遍历。非递归实现。
+inline std::set<std::string> NodeImpl::GetAllVarNames() const noexcept {
+    std::set<std::string> ret;
+
+    std::stack<std::reference_wrapper<const NodeImpl>> stk;
+
+    auto EmplaceNode = [&stk](const Node &node) {
+        if (node) {
+            stk.emplace(*node);
+        }
+    };
+
+    auto EmplaceChild = [&ret, &EmplaceNode](const NodeImpl &node) {
+        if (node.type == NodeType::VARIABLE) {
+            ret.emplace(node.varname);
+        }
+        EmplaceNode(node.left);
+        EmplaceNode(node.right);
+    };
+
+    EmplaceChild(*this);
+
+    while (!stk.empty()) {
+        const auto &node = stk.top().get();
+        stk.pop();
+        EmplaceChild(node);
+    }
+
+    return ret;
+}
+
+// 反向后序遍历（先右后左的前序遍历）。非递归实现。
+inline std::uint64_t NodeImpl::Hash() const noexcept {
+    std::uint64_t seed = 0;
+
+    std::stack<std::reference_wrapper<const NodeImpl>> stk;
+    stk.emplace(*this);
+
+    while (!stk.empty()) {
+        const auto &node = stk.top().get();
+        stk.pop();
+
+        seed = HashCombine(seed, HashSingleNode(node.type, node.op, node.value, node.varname));
+
+        if (node.left) {
+            stk.emplace(*node.left);
+        }
+        if (node.right) {
+            stk.emplace(*node.right);
+        }
+    }
+
+    return seed;
+}
+
+inline std::uint64_t HashCombine(std::uint64_t seed, std::uint64_t value) noexcept {
+    // boost::hash_combine的64位版本
+    return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
+
+inline std::uint64_t HashSingleNode(NodeType type, MathOperator op, double value, const std::string &varname) noexcept {
+    auto seed = HashCombine(static_cast<std::uint64_t>(type), static_cast<std::uint64_t>(op));
+    switch (type) {
+    case NodeType::NUMBER: {
+        // Equal()认为0.0 == -0.0，这里要保持一致
+        value = value == 0.0 ? 0.0 : value;
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return HashCombine(seed, bits);
+    }
+    case NodeType::VARIABLE: {
+        // FNV-1a
+        std::uint64_t hash = 14695981039346656037ull;
+        for (auto c : varname) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+        return HashCombine(seed, hash);
+    }
+    case NodeType::OPERATOR:
+        return seed;
+    }
+    assert(0 && "unexpected NodeType. maybe this is a bug.");
+    return seed;
+}
+
+} // namespace internal
+
+inline std::size_t NodeHash::operator()(const Node &node) const noexcept {
+    return static_cast<std::size_t>(node->Hash());
+}
+
+inline bool NodeEqual::operator()(const Node &lhs, const Node &rhs) const noexcept {
+    return lhs->Equal(rhs);
+}
+
+inline Node Clone(const Node &rhs) noexcept {
+    return internal::CloneNonRecursively(rhs);
+}
+
+inline Node Move(Node &rhs) noexcept {
+    return std::move(rhs);
+}
+
+inline Node Num(double num) noexcept {
+    return std::make_unique<internal::NodeImpl>(NodeType::NUMBER, MathOperator::MATH_NULL, num, "");
+}
+
+inline Node Op(MathOperator op) {
+    if (op == MathOperator::MATH_NULL) {
+        throw std::runtime_error("Illegal MathOperator: MATH_NULL");
+    }
+    return std::make_unique<internal::NodeImpl>(NodeType::OPERATOR, op, 0, "");
+}
+
+inline bool VarNameIsLegal(const std::string &varname) noexcept {
+    return std::regex_match(varname.begin(), varname.end(), std::regex{R"((?=\w)\D\w*)"});
+}
+
+inline Node Var(std::string varname) {
+    if (!VarNameIsLegal(varname)) {
+        throw std::runtime_error("Illegal varname: " + varname);
+    }
+    return std::make_unique<internal::NodeImpl>(NodeType::VARIABLE, MathOperator::MATH_NULL, 0, std::move(varname));
+}
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+template <typename T>
+inline Node sin(T &&n) noexcept {
+    return internal::UnaryOperator(MathOperator::MATH_SIN, std::forward<T>(n));
+}
+
+template <typename T>
+inline Node cos(T &&n) noexcept {
+    return internal::UnaryOperator(MathOperator::MATH_COS, std::forward<T>(n));
+}
+
+template <typename T>
+inline Node tan(T &&n) noexcept {
+    return internal::UnaryOperator(MathOperator::MATH_TAN, std::forward<T>(n));
+}
+
+template <typename T>
+inline Node asin(T &&n) noexcept {
+    return internal::UnaryOperator(MathOperator::MATH_ARCSIN, std::forward<T>(n));
+}
+
+template <typename T>
+inline Node acos(T &&n) noexcept {
+    return internal::UnaryOperator(MathOperator::MATH_ARCCOS, std::forward<T>(n));
+}
+
+template <typename T>
+inline Node atan(T &&n) noexcept {
+    return internal::UnaryOperator(MathOperator::MATH_ARCTAN, std::forward<T>(n));
+}
+
+template <typename T>
+inline Node sqrt(T &&n) noexcept {
+    return internal::UnaryOperator(MathOperator::MATH_SQRT, std::forward<T>(n));
+}
+
+template <typename T>
+inline Node log(T &&n) noexcept {
+    return internal::UnaryOperator(MathOperator::MATH_LOG, std::forward<T>(n));
+}
+
+template <typename T>
+inline Node log2(T &&n) noexcept {
+    return internal::UnaryOperator(MathOperator::MATH_LOG2, std::forward<T>(n));
+}
+
+template <typename T>
+inline Node log10(T &&n) noexcept {
+    return internal::UnaryOperator(MathOperator::MATH_LOG10, std::forward<T>(n));
+}
+
+template <typename T>
+inline Node exp(T &&n) noexcept {
+    return internal::UnaryOperator(MathOperator::MATH_EXP, std::forward<T>(n));
+}
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+namespace internal {
+class FlatNodeBuilder;
+} // namespace internal
+
+/**
+ * 扁平化的只读表达式。
+ * 所有节点按后序遍历的顺序连续存放在一个数组内，子节点以32位下标引用，数值与变量编号共用一个union。
+ * 相比以std::unique_ptr串起来的Node，内存占用约为其1/4，遍历时也只需要线性扫描数组。
+ * 构造完成后不可修改。
+ */
+class FlatNode {
+public:
+    /**
+     * 单个节点。
+     * 由于是后序排列，运算符的最后一个操作数（二元运算符的右操作数、一元运算符的唯一操作数）总是紧挨在它的前面。
+     */
+    struct Item {
+        NodeType type;
+        MathOperator op;
+        std::uint32_t left; // 运算符的第一个操作数的下标
+        union {
+            double value;        // 数值节点的值
+            std::uint32_t varId; // 变量节点的变量编号，即varnames的下标
+        };
+    };
+
+    static_assert(sizeof(Item) == 16, "FlatNode::Item should be compact");
+
+    /**
+     * 由Node构造。非递归实现。
+     */
+    explicit FlatNode(const Node &node) noexcept;
+
+    /**
+     * 还原为Node。
+     */
+    Node ToNode() const noexcept;
+
+    /**
+     * 节点数量。
+     */
+    std::size_t Size() const noexcept;
+
+    /**
+     * 按后序排列的所有节点。
+     */
+    const std::vector<Item> &Items() const noexcept;
+
+    /**
+     * 变量名，下标即Item::varId。
+     */
+    const std::vector<std::string> &VarNames() const noexcept;
+
+    /**
+     * 返回两个表达式是否完全一致。
+     * 哈希值不同时直接返回false，不需要逐个节点比较。
+     */
+    bool Equal(const FlatNode &rhs) const noexcept;
+
+    bool operator==(const FlatNode &rhs) const noexcept;
+
+    bool operator!=(const FlatNode &rhs) const noexcept;
+
+    /**
+     * 返回结构哈希值。构造时计算好，与Node的Hash()结果一致。
+     */
+    std::uint64_t Hash() const noexcept;
+
+    /**
+     * 把整个表达式以中序遍历的顺序输出为字符串。结果与Node的ToString()一致。
+     */
+    std::string ToString() const noexcept;
+
+    /**
+     * 计算出整个表达式的数值。
+     * @exception runtime_error 如果有变量存在，则无法计算
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    double Vpa() const;
+
+    /**
+     * 返回表达式内出现的所有变量名。
+     */
+    std::set<std::string> GetAllVarNames() const noexcept;
+
+private:
+    std::vector<Item> items;
+    std::vector<std::string> varnames; // 按在后序序列中首次出现的顺序编号
+    std::uint64_t hash = 0;
+
+    FlatNode() noexcept = default;
+
+    /**
+     * 由items计算hash。
+     */
+    void ComputeHash() noexcept;
+
+    /**
+     * 节点转string。仅限本节点，不含子节点。
+     */
+    std::string ItemToStr(const Item &item) const noexcept;
+
+    friend class internal::FlatNodeBuilder;
+};
+
+namespace internal {
+
+/**
+ * 按后序逐个追加节点，直接构造出FlatNode，不经过Node。供解析器使用。
+ * 每个追加函数返回新节点的下标，作为之后运算符的操作数。调用者需保证追加顺序是合法的后序序列：
+ * 二元运算符的右操作数、一元运算符的操作数必须是紧挨着它前面追加的节点。
+ */
+class FlatNodeBuilder {
+public:
+    using Handle = std::uint32_t;
+
+    Handle Number(double value) noexcept;
+
+    Handle Variable(const char *name, std::size_t len) noexcept;
+
+    Handle Unary(MathOperator op, Handle operand) noexcept;
+
+    Handle Binary(MathOperator op, Handle left, Handle right) noexcept;
+
+    /**
+     * 结束构造。root必须是最后追加的节点。
+     */
+    FlatNode Finish(Handle root) noexcept;
+
+private:
+    FlatNode flat;
+    std::unordered_map<std::string, std::uint32_t> varIds;
+
+    Handle Append(const FlatNode::Item &item) noexcept;
+};
+
+} // namespace internal
+
+} // namespace tomsolver
+
+namespace std {
+
+template <>
+struct hash<tomsolver::FlatNode> {
+    std::size_t operator()(const tomsolver::FlatNode &node) const noexcept {
+        return static_cast<std::size_t>(node.Hash());
+    }
+};
+
+} // namespace std
+
+namespace tomsolver {
+
+// 后序遍历。非递归实现。
+inline FlatNode::FlatNode(const Node &node) noexcept {
+    // 借助一个栈，得到反向的后序遍历序列
+    std::vector<const internal::NodeImpl *> revertedPostOrder;
+    std::stack<const internal::NodeImpl *> stk;
+    stk.emplace(node.get());
+    while (!stk.empty()) {
+        auto cur = stk.top();
+        stk.pop();
+        revertedPostOrder.emplace_back(cur);
+        if (cur->left) {
+            stk.emplace(cur->left.get());
+        }
+        if (cur->right) {
+            stk.emplace(cur->right.get());
+        }
+    }
+
+    // 正向逐个填入items，operands是尚未被父节点认领的节点下标
+    std::map<std::string, std::uint32_t> varIds;
+    std::vector<std::uint32_t> operands;
+    items.reserve(revertedPostOrder.size());
+    for (auto it = revertedPostOrder.rbegin(); it != revertedPostOrder.rend(); ++it) {
+        auto &cur = **it;
+        Item item{cur.type, cur.op, 0, {0}};
+        switch (cur.type) {
+        case NodeType::NUMBER:
+            item.value = cur.value;
+            break;
+        case NodeType::VARIABLE: {
+            auto ret = varIds.emplace(cur.varname, static_cast<std::uint32_t>(varnames.size()));
+            if (ret.second) {
+                varnames.emplace_back(cur.varname);
+            }
+            item.varId = ret.first->second;
+            break;
+        }
+        case NodeType::OPERATOR:
+            if (GetOperatorNum(cur.op) == 2) {
+                operands.pop_back();
+            }
+            item.left = operands.back();
+            operands.pop_back();
+            break;
+        }
+        operands.emplace_back(static_cast<std::uint32_t>(items.size()));
+        items.emplace_back(item);
+    }
+    assert(operands.size() == 1);
+
+    ComputeHash();
+}
+
+inline void FlatNode::ComputeHash() noexcept {
+    const std::string emptyName;
+    hash = 0;
+
+    // 反向扫描，与NodeImpl::Hash()的遍历顺序一致
+    for (auto it = items.rbegin(); it != items.rend(); ++it) {
+        auto &item = *it;
+        auto value = item.type == NodeType::NUMBER ? item.value : 0.0;
+        auto &varname = item.type == NodeType::VARIABLE ? varnames[item.varId] : emptyName;
+        hash = internal::HashCombine(hash, internal::HashSingleNode(item.type, item.op, value, varname));
+    }
+}
+
+inline Node FlatNode::ToNode() const noexcept {
+    std::stack<Node> stk;
+    auto popNode = [&stk] {
+        auto node = std::move(stk.top());
+        stk.pop();
+        return node;
+    };
+
+    for (auto &item : items) {
+        switch (item.type) {
+        case NodeType::NUMBER:
+            stk.emplace(Num(item.value));
+            break;
+        case NodeType::VARIABLE:
+            stk.emplace(std::make_unique<internal::NodeImpl>(NodeType::VARIABLE, MathOperator::MATH_NULL, 0,
+                                                             varnames[item.varId]));
+            break;
+        case NodeType::OPERATOR:
+            if (GetOperatorNum(item.op) == 2) {
+                auto right = popNode();
+                auto left = popNode();
+                stk.emplace(internal::Operator(item.op, std::move(left), std::move(right)));
+            } else {
+                stk.emplace(internal::Operator(item.op, popNode()));
+            }
+            break;
+        }
+    }
+
+    assert(stk.size() == 1);
+    return popNode();
+}
+
+inline std::size_t FlatNode::Size() const noexcept {
+    return items.size();
+}
+
+inline const std::vector<FlatNode::Item> &FlatNode::Items() const noexcept {
+    return items;
+}
+
+inline const std::vector<std::string> &FlatNode::VarNames() const noexcept {
+    return varnames;
+}
+
+inline bool FlatNode::Equal(const FlatNode &rhs) const noexcept {
+    if (this == &rhs) {
+        return true;
+    }
+
+    if (hash != rhs.hash || items.size() != rhs.items.size() || varnames != rhs.varnames) {
+        return false;
+    }
+
+    // 后序序列相同，树的形状和内容就相同
+    return std::equal(items.begin(), items.end(), rhs.items.begin(), [](const Item &lhs, const Item &rhs) {
+        if (lhs.type != rhs.type) {
+            return false;
+        }
+        switch (lhs.type) {
+        case NodeType::NUMBER:
+            return lhs.value == rhs.value;
+        case NodeType::VARIABLE:
+            return lhs.varId == rhs.varId;
+        case NodeType::OPERATOR:
+            return lhs.op == rhs.op && lhs.left == rhs.left;
+        }
+        return false;
+    });
+}
+
+inline bool FlatNode::operator==(const FlatNode &rhs) const noexcept {
+    return Equal(rhs);
+}
+
+inline bool FlatNode::operator!=(const FlatNode &rhs) const noexcept {
+    return !Equal(rhs);
+}
+
+inline std::uint64_t FlatNode::Hash() const noexcept {
+    return hash;
+}
+
+inline std::string FlatNode::ItemToStr(const Item &item) const noexcept {
+    switch (item.type) {
+    case NodeType::NUMBER:
+        return tomsolver::ToString(item.value);
+    case NodeType::VARIABLE:
+        return varnames[item.varId];
+    case NodeType::OPERATOR:
+        return MathOperatorToStr(item.op);
+    }
+    assert(0 && "unexpected NodeType. maybe this is a bug.");
+    return "";
+}
+
+// 中序遍历。非递归实现。逻辑与NodeImpl::ToStringNonRecursively一致。
+inline std::string FlatNode::ToString() const noexcept {
+    constexpr auto npos = std::numeric_limits<std::uint32_t>::max();
+
+    // 先线性扫描一遍，记下每个节点的父节点
+    std::vector<std::uint32_t> parents(items.size(), npos);
+    for (std::uint32_t i = 0; i < items.size(); ++i) {
+        if (items[i].type == NodeType::OPERATOR) {
+            parents[items[i].left] = i;
+            if (GetOperatorNum(items[i].op) == 2) {
+                parents[i - 1] = i;
+            }
+        }
+    }
+
+    auto isOperator = [this](std::uint32_t i) {
+        return i != npos && items[i].type == NodeType::OPERATOR;
+    };
+    auto isRightChild = [this, &parents](std::uint32_t i) {
+        auto parent = parents[i];
+        return parent != npos && GetOperatorNum(items[parent].op) == 2 && parent - 1 == i;
+    };
+
+    std::stringstream output;
+
+    // npos代表右括号
+    std::stack<std::uint32_t> stk;
+
+    auto AddLeftLine = [&](std::uint32_t cur) {
+        while (cur != npos) {
+            auto &item = items[cur];
+            if (item.type != NodeType::OPERATOR) {
+                stk.emplace(cur);
+                break;
+            }
+
+            // 一元运算符的特殊处理，见NodeImpl::ToStringNonRecursively
+            if (GetOperatorNum(item.op) == 1) {
+                if ((item.op == MathOperator::MATH_POSITIVE || item.op == MathOperator::MATH_NEGATIVE) &&
+                    !isOperator(item.left)) {
+                    output << ItemToStr(item);
+                    cur = item.left;
+                    continue;
+                }
+                output << ItemToStr(item) << "(";
+                stk.emplace(npos);
+                cur = item.left;
+                continue;
+            }
+
+            // 二元运算符的特殊处理：
+            auto parent = parents[cur];
+            if (parent != npos) {
+                auto parentOp = items[parent].op;
+                if (GetOperatorNum(parentOp) == 2 && // 父运算符存在，为二元，
+                    (Rank(parentOp) > Rank(item.op)  // 父级优先级高于本级->加括号
+                     || (                            // 两级优先级相等
+                            Rank(parentOp) == Rank(item.op) &&
+                            (
+                                // 本级为父级的右子树 且父级不满足结合律->加括号
+                                (InAssociativeLaws(parentOp) == false && isRightChild(cur)) ||
+                                // 两级都是右结合
+                                (InAssociativeLaws(parentOp) == false && IsLeft2Right(item.op) == false))))) {
+                    output << "(";
+                    stk.emplace(npos);
+                }
+            }
+
+            stk.emplace(cur);
+            cur = item.left;
+        }
+    };
+
+    AddLeftLine(static_cast<std::uint32_t>(items.size() - 1));
+
+    while (!stk.empty()) {
+        auto cur = stk.top();
+        stk.pop();
+
+        if (cur == npos) {
+            output << ")";
+            continue;
+        }
+
+        auto &item = items[cur];
+
+        // 负数的特殊处理
+        // 如果当前节点是数值且小于0，且前面是-运算符，那么加括号
+        if (item.type == NodeType::NUMBER && item.value < 0 && isRightChild(cur) &&
+            items[parents[cur]].op == MathOperator::MATH_SUB) {
+            output << "(" << ItemToStr(item) << ")";
+        } else {
+            output << ItemToStr(item);
+        }
+
+        if (item.type == NodeType::OPERATOR && GetOperatorNum(item.op) == 2) {
+            AddLeftLine(cur - 1);
+        }
+    }
+
+    return output.str();
+}
+
+// 后序遍历。items本身就是逆波兰表达式，顺序扫描即可计算出表达式的值。
+inline double FlatNode::Vpa() const {
+    std::vector<double> calcStk;
+    calcStk.reserve(items.size());
+    for (auto &item : items) {
+        switch (item.type) {
+        case NodeType::NUMBER:
+            calcStk.emplace_back(item.value);
+            break;
+
+        case NodeType::VARIABLE:
+            throw std::runtime_error("has variable. can not calculate to be a number");
+
+        case NodeType::OPERATOR: {
+            auto r = std::numeric_limits<double>::quiet_NaN();
+            if (GetOperatorNum(item.op) == 2) {
+                r = calcStk.back();
+                calcStk.pop_back();
+            }
+            auto &l = calcStk.back();
+            l = tomsolver::Calc(item.op, l, r);
+            break;
+        }
+        }
+    }
+
+    assert(calcStk.size() == 1);
+    return calcStk.back();
+}
+
+inline std::set<std::string> FlatNode::GetAllVarNames() const noexcept {
+    return {varnames.begin(), varnames.end()};
+}
+
+namespace internal {
+
+inline FlatNodeBuilder::Handle FlatNodeBuilder::Append(const FlatNode::Item &item) noexcept {
+    flat.items.emplace_back(item);
+    return static_cast<Handle>(flat.items.size() - 1);
+}
+
+inline FlatNodeBuilder::Handle FlatNodeBuilder::Number(double value) noexcept {
+    FlatNode::Item item{NodeType::NUMBER, MathOperator::MATH_NULL, 0, {0}};
+    item.value = value;
+    return Append(item);
+}
+
+inline FlatNodeBuilder::Handle FlatNodeBuilder::Variable(const char *name, std::size_t len) noexcept {
+    auto ret = varIds.emplace(std::string(name, len), static_cast<std::uint32_t>(flat.varnames.size()));
+    if (ret.second) {
+        flat.varnames.emplace_back(ret.first->first);
+    }
+    FlatNode::Item item{NodeType::VARIABLE, MathOperator::MATH_NULL, 0, {0}};
+    item.varId = ret.first->second;
+    return Append(item);
+}
+
+inline FlatNodeBuilder::Handle FlatNodeBuilder::Unary(MathOperator op, Handle operand) noexcept {
+    assert(GetOperatorNum(op) == 1 && operand + 1 == flat.items.size());
+    return Append({NodeType::OPERATOR, op, operand, {0}});
+}
+
+inline FlatNodeBuilder::Handle FlatNodeBuilder::Binary(MathOperator op, Handle left, Handle right) noexcept {
+    assert(GetOperatorNum(op) == 2 && left < right && right + 1 == flat.items.size());
+    (void)right;
+    return Append({NodeType::OPERATOR, op, left, {0}});
+}
+
+inline FlatNode FlatNodeBuilder::Finish(Handle root) noexcept {
+    assert(root + 1 == flat.items.size());
+    (void)root;
+    flat.ComputeHash();
+    varIds.clear();
+    return std::move(flat);
+}
+
+} // namespace internal
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+/**
+ * 以等式饱和（equality saturation）的方式优化表达式，返回求值代价最低的等价表达式。不改变node。
+ * 先用Simplify规范化，再把表达式放入e-graph，反复应用以下重写规则，直到不再产生新的等价关系，
+ * 或者达到maxIterations轮、e-graph的节点数超过maxNodes（每处理完一个节点检查一次）：
+ *   1. 加法、乘法交换律与结合律，乘除结合(x*y)/z=x*(y/z)、x/(y*z)=(x/y)/z，常数折叠，x+0、x*1、x*0、x-x等单位元；
+ *   2. 三角恒等式：sin(x)^2+cos(x)^2=1，sin(x)/cos(x)=tan(x)；
+ *   3. 提取公因式：a*b+a*c=a*(b+c)，a*b-a*c=a*(b-c)；
+ *   4. exp、log相消：log(exp(x))=x，exp(log(x))=x，exp(a)*exp(b)=exp(a+b)；
+ *   5. 幂的合并与展开：x*x=x^2，x^a*x^b=x^(a+b)，x^n=x^(n-1)*x，x^0.5=sqrt(x)。
+ *      与Simplify一样，x^a*x^b只在a、b都是整数，并且都不是负数或者a+b仍为负数时合并，不扩大定义域。
+ * 最后按OperatorCost()给出的代价提取总代价最低的表达式。
+ * 注意：exp(log(x))=x等规则会扩大定义域，原本因定义域抛出异常的表达式优化后可能可以正常求值。
+ */
+inline Node Optimize(const Node &node, int maxIterations = 8, std::size_t maxNodes = 10000) noexcept;
+
+/**
+ * Optimize使用的代价模型：单个运算符的求值代价。数值和变量的代价为0。
+ * 以加减乘为1，除法、开方稍高，乘方、三角函数、指数对数远高于四则运算。
+ */
+inline double OperatorCost(MathOperator op) noexcept;
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+/**
+ * node对varname求导。在node包含多个变量时，是对varname求偏导。
+ * 如果Config::Get().diffCacheCapacity大于0，会先从DiffCache中查找结果。
+ * @exception runtime_error 如果表达式内包含AND(&) OR(|) MOD(%)这类不能求导的运算符，则抛出异常
+ */
+inline Node Diff(const Node &node, const std::string &varname, int i = 1);
+
+/**
+ * node对varname求导。在node包含多个变量时，是对varname求偏导。
+ * 如果Config::Get().diffCacheCapacity大于0，会先从DiffCache中查找结果。
+ * @exception runtime_error 如果表达式内包含AND(&) OR(|) MOD(%)这类不能求导的运算符，则抛出异常
+ */
+inline Node Diff(Node &&node, const std::string &varname, int i = 1);
+
+/**
+ * 求导结果的缓存。以(表达式结构, 变量名, 求导阶数)为键，保存化简后的求导结果。
+ * 保存的节点总数超过Config::Get().diffCacheCapacity时，按LRU策略淘汰最久未使用的条目。
+ * 线程安全。
+ */
+class DiffCache {
+public:
+    static DiffCache &Get();
+
+    /**
+     * 查找node对varname求i阶导数的结果。找到时返回true，并把结果保存到result。
+     */
+    bool Find(const FlatNode &node, const std::string &varname, int i, Node &result);
+
+    /**
+     * 保存node对varname求i阶导数的结果。
+     */
+    void Insert(FlatNode node, const std::string &varname, int i, const Node &result);
+
+    void Clear() noexcept;
+
+    /**
+     * 条目数量。
+     */
+    std::size_t Size() const noexcept;
+
+    /**
+     * 命中次数。
+     */
+    std::size_t Hits() const noexcept;
+
+    /**
+     * 未命中次数。
+     */
+    std::size_t Misses() const noexcept;
+
+private:
+    struct Entry {
+        FlatNode node;
+        std::string varname;
+        int i;
+        FlatNode result;
+    };
+
+    std::list<Entry> entries; // 越靠前越新
+    std::unordered_multimap<std::uint64_t, std::list<Entry>::iterator> index;
+    std::size_t nodeCount = 0;
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    mutable std::mutex mutex;
+
+    DiffCache() = default;
+
+    static std::uint64_t MakeKey(const FlatNode &node, const std::string &varname, int i) noexcept;
+
+    void Erase(std::list<Entry>::iterator it) noexcept;
+};
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+class SymVec;
+class SymMat {
+public:
+    /**
+     *
+     */
+    SymMat(int rows, int cols) noexcept;
+
+    /**
+     * 使用初始化列表构造。注意列表内的对象将被强行移动至Vec内部。
+     */
+    SymMat(std::initializer_list<std::initializer_list<Node>> init) noexcept;
+
+    /**
+     * 从数值矩阵构造符号矩阵
+     */
+    SymMat(const Mat &rhs) noexcept;
+
+    SymMat Clone() const noexcept;
+
+    bool Empty() const noexcept;
+
+    int Rows() const noexcept;
+
+    int Cols() const noexcept;
+
+    /**
+     * 输出Vec。如果列数不为1，抛出异常。
+     * @exception runtime_error 列数不为1
+     */
+    SymVec ToSymVec() const;
+
+    /**
+     * 逐个元素转换为符号向量（列向量）。
+     */
+    SymVec ToSymVecOneByOne() const noexcept;
+
+    /**
+     * 得到数值矩阵。前提条件是矩阵内的元素均为数值节点，否则抛出异常。
+     * @exception runtime_error 存在非数值节点
+     */
+    Mat ToMat() const;
+
+    /**
+     * 把矩阵的内的元素均计算为数值节点。
+     * @exception runtime_error 如果有变量存在，则无法计算
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    SymMat &Calc();
+
+    /**
+     * 以varsTable中的值代入变量，计算出每个元素的数值。
+     * 不改变自身，也不需要先Clone()，可以在多个线程中对同一个矩阵求值。
+     * @exception out_of_range 如果varsTable中没有某个变量
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    Mat Vpa(const VarsTable &varsTable) const;
+
+    /**
+     * 把矩阵内的变量替换为数值。
+     * 替换表只构造一次。已经是数值节点的元素（例如Jacobian中结构性为0的元素）直接跳过。
+     */
+    SymMat &Subs(const std::map<std::string, double> &varValues) noexcept;
+
+    /**
+     * 把矩阵内的变量替换为数值。
+     * 替换表只构造一次。已经是数值节点的元素（例如Jacobian中结构性为0的元素）直接跳过。
+     */
+    SymMat &Subs(const VarsTable &varsTable) noexcept;
+
+    /**
+     * 返回符号矩阵内出现的所有变量名。
+     */
+    std::set<std::string> GetAllVarNames() const noexcept;
+
+    /**
+     * 返回结构哈希值。由行数、列数以及每个元素的Hash()计算得到。
+     */
+    std::uint64_t Hash() const noexcept;
+
+    /**
+     * 如果rhs和自己的维数不匹配会触发assert。
+     */
+    SymMat operator-(const SymMat &rhs) const noexcept;
+
+    /**
+     *
+     * @exception MathError 维数不匹配
+     */
+    SymMat operator*(const SymMat &rhs) const;
+
+    /**
+     * 返回是否相等。
+     * 目前只能判断表达式树完全一致的情况。
+     * TODO 改为可以判断等价表达式
+     */
+    bool operator==(const SymMat &rhs) const noexcept;
+
+    Node &Value(int i, int j) noexcept;
+    const Node &Value(int i, int j) const noexcept;
+
+    std::string ToString() const noexcept;
+
+protected:
+    int rows, cols;
+    std::unique_ptr<std::valarray<Node>> data;
+
+    friend SymMat Jacobian(const SymMat &equations, const std::vector<std::string> &vars);
+
+private:
+    SymMat &SubsInner(const std::map<std::string, Node> &dict) noexcept;
+};
+
+class SymVec : public SymMat {
+public:
+    /**
+     *
+     */
+    SymVec(int rows) noexcept;
+
+    /**
+     * 使用初始化列表构造。注意列表内的对象将被强行移动至Vec内部。
+     */
+    SymVec(std::initializer_list<Node> init) noexcept;
+
+    /**
+     * 如果rhs和自己的维数不匹配会触发assert。
+     */
+    SymVec operator-(const SymVec &rhs) const noexcept;
+
+    Node &operator[](std::size_t index) noexcept;
+
+    const Node &operator[](std::size_t index) const noexcept;
+};
+
+/**
+ * 计算equations对vars的雅可比矩阵。
+ * 按行并行计算，线程数由Config::Get().threadNum指定。
+ * @exception runtime_error 方程组中有不能求导的运算（例如%、&、|）
+ */
+inline SymMat Jacobian(const SymMat &equations, const std::vector<std::string> &vars);
+
+inline std::ostream &operator<<(std::ostream &out, const SymMat &symMat) noexcept;
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+/**
+ * 用newNode节点替换oldVar指定的变量。
+ */
+inline Node Subs(const Node &node, const std::string &oldVar, const Node &newNode) noexcept;
+
+/**
+ * 用newNode节点替换oldVar指定的变量。
+ */
+inline Node Subs(Node &&node, const std::string &oldVar, const Node &newNode) noexcept;
+
+/**
+ * 用newNodes节点替换oldVars指定的变量。
+ */
+inline Node Subs(const Node &node, const std::vector<std::string> &oldVars, const SymVec &newNodes) noexcept;
+
+/**
+ * 用newNodes节点替换oldVars指定的变量。
+ */
+inline Node Subs(Node &&node, const std::vector<std::string> &oldVars, const SymVec &newNodes) noexcept;
+
+/**
+ * 用newNodes节点替换oldVars指定的变量。
+ */
+inline Node Subs(const Node &node, const std::map<std::string, Node> &dict) noexcept;
+
+/**
+ * 用newNodes节点替换oldVars指定的变量。
+ */
+inline Node Subs(Node &&node, const std::map<std::string, Node> &dict) noexcept;
+
+/**
+ * 用newNodes节点替换oldVars指定的变量。
+ */
+inline Node Subs(const Node &node, const std::map<std::string, double> &varValues) noexcept;
+
+/**
+ * 用newNodes节点替换oldVars指定的变量。
+ */
+inline Node Subs(Node &&node, const std::map<std::string, double> &varValues) noexcept;
+
+/**
+ * 用newNodes节点替换oldVars指定的变量。
+ */
+inline Node Subs(const Node &node, const VarsTable &varsTable) noexcept;
+
+/**
+ * 用newNodes节点替换oldVars指定的变量。
+ */
+inline Node Subs(Node &&node, const VarsTable &varsTable) noexcept;
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+namespace internal {
+
+class SubsFunctions {
+public:
+    // 前序遍历。非递归实现。
+    static Node SubsInner(Node node, const std::map<std::string, Node> &dict) noexcept {
+
+        std::stack<std::reference_wrapper<NodeImpl>> stk;
+
+        auto Replace = [&dict](Node &cur) {
+            if (cur->type != NodeType::VARIABLE) {
+                return false;
+            }
+
+            auto itor = dict.find(cur->varname);
+            if (itor == dict.end()) {
+                return false;
+            }
+
+            auto parent = cur->parent;
+            cur = Clone(itor->second);
+            cur->parent = parent;
+
+            return true;
+        };
+
+        if (!Replace(node)) {
+            auto TryReplace = [&stk, &Replace](Node &cur) {
+                if (cur && !Replace(cur)) {
+                    stk.emplace(*cur);
+                }
+            };
+
+            TryReplace(node->right);
+            TryReplace(node->left);
+
+            while (!stk.empty()) {
+                auto &f = stk.top().get();
+                stk.pop();
+                TryReplace(f.right);
+                TryReplace(f.left);
+            }
+        }
+
+#ifndef NDEBUG
+        node->CheckParent();
+#endif
+        return node;
+    }
+};
+
+} // namespace internal
+
+inline Node Subs(const Node &node, const std::string &oldVar, const Node &newNode) noexcept {
+    return Subs(Clone(node), oldVar, newNode);
+}
+
+inline Node Subs(Node &&node, const std::string &oldVar, const Node &newNode) noexcept {
+    std::map<std::string, Node> dict;
+    dict.insert({oldVar, Clone(newNode)});
+    return internal::SubsFunctions::SubsInner(Move(node), dict);
+}
+
+inline Node Subs(const Node &node, const std::vector<std::string> &oldVars, const SymVec &newNodes) noexcept {
+    return Subs(Clone(node), oldVars, newNodes);
+}
+
+inline Node Subs(Node &&node, const std::vector<std::string> &oldVars, const SymVec &newNodes) noexcept {
+    assert(static_cast<int>(oldVars.size()) == newNodes.Rows());
+    std::map<std::string, Node> dict;
+    for (size_t i = 0; i < oldVars.size(); ++i) {
+        dict.insert({oldVars[i], Clone(newNodes[i])});
+    }
+    return internal::SubsFunctions::SubsInner(Move(node), dict);
+}
+
+inline Node Subs(const Node &node, const std::map<std::string, Node> &dict) noexcept {
+    return Subs(Clone(node), dict);
+}
+
+inline Node Subs(Node &&node, const std::map<std::string, Node> &dict) noexcept {
+    return internal::SubsFunctions::SubsInner(Move(node), dict);
+}
+
+inline Node Subs(const Node &node, const std::map<std::string, double> &varValues) noexcept {
+    return Subs(Clone(node), varValues);
+}
+
+inline Node Subs(Node &&node, const std::map<std::string, double> &varValues) noexcept {
+    std::map<std::string, Node> dict;
+    for (auto &item : varValues) {
+        dict.insert({item.first, Num(item.second)});
+    }
+    return internal::SubsFunctions::SubsInner(Move(node), dict);
+}
+
+inline Node Subs(const Node &node, const VarsTable &varsTable) noexcept {
+    return Subs(Clone(node), varsTable);
+}
+
+inline Node Subs(Node &&node, const VarsTable &varsTable) noexcept {
+    std::map<std::string, Node> dict;
+    for (auto &item : varsTable) {
+        dict.insert({item.first, Num(item.second)});
+    }
+    return internal::SubsFunctions::SubsInner(Move(node), dict);
+}
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+/**
+ * 化简表达式。非递归实现。
+ * 除了计算出纯数值的子表达式外，还会把加减链、乘除链整理为规范形式：
+ *   1. 展开嵌套的加减、乘除，例如 (a+b)-(c-d) 视为 a+b-c+d；
+ *   2. 合并数值系数与常数项，合并同类项与同底数幂，例如 2*x*3*x -> 6*x^2，x+2*x -> 3*x；
+ *   3. 对各项、各因子排序，因此 x*y 与 y*x 化简后结构一致；
+ *   4. 去掉0、1等单位元，例如 x^0 -> 1，0-x -> -x。
+ * 不会展开乘法分配律。化简不扩大定义域：非整数次幂不与其他幂合并，例如 x^0.5*x^0.5 保持不变；
+ * 正、负整数次幂只有合并后仍为负数次幂时才合并，例如 x/x、x*y/x、x^2/x 保持不变，x/x^3 -> 1/x^2。
+ */
+inline void Simplify(Node &node) noexcept;
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+namespace internal {
+
+class SimplifyFunctions {
+public:
+    struct SimplifyNode {
+        NodeImpl &node;
+        bool isLeftChild;
+
+        SimplifyNode(NodeImpl &node) : node(node), isLeftChild(!node.parent || node.parent->left.get() == &node) {}
+    };
+
+    // 对单节点n进行化简。
+    static void SimplifySingleNode(std::unique_ptr<NodeImpl> &n) noexcept {
+        auto parent = n->parent;
+        switch (GetOperatorNum(n->op)) {
+        // 对于1元运算符，且儿子是数字的，直接计算出来
+        case 1:
+            if (n->left->type == NodeType::NUMBER) {
+                n->type = NodeType::NUMBER;
+                n->value = tomsolver::Calc(n->op, n->left->value, 0);
+                n->op = MathOperator::MATH_NULL;
+                n->left = nullptr;
+            }
+            break;
+
+        // 对于2元运算符
+        case 2:
+            // 儿子是数字的，直接计算出来
+            if (n->left->type == NodeType::NUMBER && n->right->type == NodeType::NUMBER) {
+                n->type = NodeType::NUMBER;
+                n->value = tomsolver::Calc(n->op, n->left->value, n->right->value);
+                n->op = MathOperator::MATH_NULL;
+                n->left = nullptr;
+                n->right = nullptr;
+                return;
+            }
+
+            assert(n->left && n->right);
+            bool lChildIs0 = n->left->type == NodeType::NUMBER && n->left->value == 0.0;
+            bool rChildIs0 = n->right->type == NodeType::NUMBER && n->right->value == 0.0;
+            bool lChildIs1 = n->left->type == NodeType::NUMBER && n->left->value == 1.0;
+            bool rChildIs1 = n->right->type == NodeType::NUMBER && n->right->value == 1.0;
+
+            // 任何数乘或被乘0、被0除、0的除0外的任何次方，等于0
+            if ((n->op == MathOperator::MATH_MULTIPLY && (lChildIs0 || rChildIs0)) ||
+                (n->op == MathOperator::MATH_DIVIDE && lChildIs0) || (n->op == MathOperator::MATH_POWER && lChildIs0)) {
+                n = Num(0);
+                n->parent = parent;
+                return;
+            }
+
+            // 任何数加或被加0、被减0、乘或被乘1、被1除、开1次方，等于自身
+            if ((n->op == MathOperator::MATH_ADD && (lChildIs0 || rChildIs0)) ||
+                (n->op == MathOperator::MATH_SUB && rChildIs0) ||
+                (n->op == MathOperator::MATH_MULTIPLY && (lChildIs1 || rChildIs1)) ||
+                (n->op == MathOperator::MATH_DIVIDE && rChildIs1) || (n->op == MathOperator::MATH_POWER && rChildIs1)) {
+
+                if (lChildIs1 || lChildIs0) {
+                    n->left = nullptr;
+                    n = Move(n->right);
+                    n->parent = parent;
+                } else if (rChildIs1 || rChildIs0) {
+                    n->right = nullptr;
+                    n = Move(n->left);
+                    n->parent = parent;
+                }
+                return;
+            }
+        }
+    }
+
+    // 幂次为数值的因子：base^exponent
+    struct Factor {
+        Node base;
+        double exponent;
+        std::uint64_t hash; // base的哈希值，用于排序和合并
+    };
+
+    // 和式中的一项：coef*factors[0]*factors[1]*...
+    struct Term {
+        double coef = 1;
+        std::vector<Factor> factors;
+    };
+
+    static bool IsSumOperator(MathOperator op) noexcept {
+        return op == MathOperator::MATH_ADD || op == MathOperator::MATH_SUB || op == MathOperator::MATH_POSITIVE ||
+               op == MathOperator::MATH_NEGATIVE;
+    }
+
+    static bool IsProductOperator(MathOperator op) noexcept {
+        return op == MathOperator::MATH_MULTIPLY || op == MathOperator::MATH_DIVIDE;
+    }
+
+    // 因子的排列顺序：变量在前（按变量名），运算符在后（按运算符、哈希值），同底数幂次高的在前
+    static bool FactorLess(const Factor &lhs, const Factor &rhs) noexcept {
+        auto rank = [](NodeType type) {
+            return type == NodeType::VARIABLE ? 0 : (type == NodeType::OPERATOR ? 1 : 2);
+        };
+        auto &l = *lhs.base;
+        auto &r = *rhs.base;
+        if (l.type != r.type) {
+            return rank(l.type) < rank(r.type);
+        }
+        if (l.type == NodeType::VARIABLE && l.varname != r.varname) {
+            return l.varname < r.varname;
+        }
+        if (l.type == NodeType::OPERATOR && l.op != r.op) {
+            return l.op < r.op;
+        }
+        if (lhs.hash != rhs.hash) {
+            return lhs.hash < rhs.hash;
+        }
+        return lhs.exponent > rhs.exponent;
+    }
+
+    static bool IsInteger(double value) noexcept {
+        return std::trunc(value) == value;
+    }
+
+    static bool SameBase(const Factor &lhs, const Factor &rhs) noexcept {
+        return lhs.hash == rhs.hash && lhs.base->Equal(rhs.base);
+    }
+
+    // 项的排列顺序：按因子逐个比较
+    static bool TermLess(const Term &lhs, const Term &rhs) noexcept {
+        return std::lexicographical_compare(lhs.factors.begin(), lhs.factors.end(), rhs.factors.begin(),
+                                            rhs.factors.end(), FactorLess);
+    }
+
+    // 两项除系数外是否相同
+    static bool SameFactors(const Term &lhs, const Term &rhs) noexcept {
+        return std::equal(lhs.factors.begin(), lhs.factors.end(), rhs.factors.begin(), rhs.factors.end(),
+                          [](const Factor &l, const Factor &r) {
+                              return l.exponent == r.exponent && SameBase(l, r);
+                          });
+    }
+
+    // 把积node展开到term中：数值乘入系数，其余的因子排序后合并同底数幂。
+    // 遇到乘、除、正负号时继续向下展开，因此node内部的乘除链不必事先化简。非递归实现。
+    static void CollectFactors(Node node, Term &term) noexcept {
+        std::stack<std::pair<Node, double>> stk;
+        stk.emplace(std::move(node), 1.0);
+        while (!stk.empty()) {
+            auto cur = std::move(stk.top().first);
+            auto exponent = stk.top().second;
+            stk.pop();
+
+            if (cur->type == NodeType::NUMBER && (exponent > 0 || cur->value != 0.0)) {
+                term.coef = exponent > 0 ? term.coef * cur->value : term.coef / cur->value;
+                continue;
+            }
+
+            if (cur->type == NodeType::OPERATOR) {
+                switch (cur->op) {
+                case MathOperator::MATH_MULTIPLY:
+                    stk.emplace(Move(cur->left), exponent);
+                    stk.emplace(Move(cur->right), exponent);
+                    continue;
+                case MathOperator::MATH_DIVIDE:
+                    stk.emplace(Move(cur->left), exponent);
+                    stk.emplace(Move(cur->right), -exponent);
+                    continue;
+                case MathOperator::MATH_NEGATIVE:
+                    term.coef = -term.coef;
+                    stk.emplace(Move(cur->left), exponent);
+                    continue;
+                case MathOperator::MATH_POSITIVE:
+                    stk.emplace(Move(cur->left), exponent);
+                    continue;
+                case MathOperator::MATH_POWER:
+                    if (cur->right->type == NodeType::NUMBER) {
+                        exponent *= cur->right->value;
+                        cur = Move(cur->left);
+                    }
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            cur->parent = nullptr;
+            auto hash = cur->Hash();
+            term.factors.emplace_back(Factor{std::move(cur), exponent, hash});
+        }
+
+        // 合并同底数的整数次幂，去掉0次幂。合并不能扩大定义域：
+        // 非整数次幂在底数小于0时无定义，不参与合并，例如x^0.5*x^0.5不能化为x；
+        // 负整数次幂在底数为0时无定义，正、负次幂合并后仍为负数次幂时才合并，例如x/x、x^2/x保持不变，x/x^3化为1/x^2
+        auto &factors = term.factors;
+        std::sort(factors.begin(), factors.end(), FactorLess);
+        std::vector<Factor> merged;
+        for (auto first = factors.begin(); first != factors.end();) {
+            // 同底数的因子排在一起
+            auto last = std::find_if(first, factors.end(), [&first](const Factor &factor) {
+                return !SameBase(*first, factor);
+            });
+            Factor *positive = nullptr;
+            Factor *negative = nullptr;
+            for (auto it = first; it != last; ++it) {
+                if (!IsInteger(it->exponent)) {
+                    merged.emplace_back(std::move(*it));
+                    continue;
+                }
+                auto &target = it->exponent > 0 ? positive : negative;
+                if (target) {
+                    target->exponent += it->exponent;
+                } else {
+                    target = &*it;
+                }
+            }
+            if (positive && negative && positive->exponent + negative->exponent < 0) {
+                negative->exponent += positive->exponent;
+                positive = nullptr;
+            }
+            for (auto factor : {positive, negative}) {
+                if (factor) {
+                    merged.emplace_back(std::move(*factor));
+                }
+            }
+            first = last;
+        }
+        std::sort(merged.begin(), merged.end(), FactorLess);
+        merged.erase(std::remove_if(merged.begin(), merged.end(),
+                                    [](const Factor &factor) {
+                                        return factor.exponent == 0;
+                                    }),
+                     merged.end());
+        factors = std::move(merged);
+    }
+
+    // 由系数和因子重新构造出积：coef*正次幂的因子/负次幂的因子。
+    static Node BuildProduct(double coef, std::vector<Factor> &factors) noexcept {
+        if (coef == 0) {
+            return Num(0);
+        }
+
+        auto multiply = [](Node &acc, Node node) {
+            acc = acc ? Operator(MathOperator::MATH_MULTIPLY, Move(acc), std::move(node)) : std::move(node);
+        };
+
+        Node numerator = std::abs(coef) == 1 ? nullptr : Num(std::abs(coef));
+        Node denominator;
+        for (auto &factor : factors) {
+            auto exponent = std::abs(factor.exponent);
+            auto node = exponent == 1 ? Move(factor.base)
+                                      : Operator(MathOperator::MATH_POWER, Move(factor.base), Num(exponent));
+            multiply(factor.exponent > 0 ? numerator : denominator, std::move(node));
+        }
+
+        if (!numerator) {
+            numerator = Num(1);
+        }
+        if (coef < 0) {
+            numerator = numerator->type == NodeType::NUMBER ? Num(-numerator->value)
+                                                            : Operator(MathOperator::MATH_NEGATIVE, Move(numerator));
+        }
+        return denominator ? Operator(MathOperator::MATH_DIVIDE, Move(numerator), Move(denominator)) : Move(numerator);
+    }
+
+    // 把乘除链化简为规范形式。
+    static Node CanonicalProduct(Node node) noexcept {
+        Term term;
+        CollectFactors(std::move(node), term);
+        return BuildProduct(term.coef, term.factors);
+    }
+
+    // 把加减链化简为规范形式：常数在前，其余各项排序后合并同类项。非递归实现。
+    static Node CanonicalSum(Node node) noexcept {
+        double constant = 0;
+        std::vector<Term> terms;
+
+        std::stack<std::pair<Node, double>> stk;
+        stk.emplace(std::move(node), 1.0);
+        while (!stk.empty()) {
+            auto cur = std::move(stk.top().first);
+            auto sign = stk.top().second;
+            stk.pop();
+
+            if (cur->type == NodeType::NUMBER) {
+                constant += sign * cur->value;
+                continue;
+            }
+
+            if (cur->type == NodeType::OPERATOR && IsSumOperator(cur->op)) {
+                switch (cur->op) {
+                case MathOperator::MATH_ADD:
+                    stk.emplace(Move(cur->right), sign);
+                    stk.emplace(Move(cur->left), sign);
+                    break;
+                case MathOperator::MATH_SUB:
+                    stk.emplace(Move(cur->right), -sign);
+                    stk.emplace(Move(cur->left), sign);
+                    break;
+                case MathOperator::MATH_NEGATIVE:
+                    stk.emplace(Move(cur->left), -sign);
+                    break;
+                default:
+                    stk.emplace(Move(cur->left), sign);
+                    break;
+                }
+                continue;
+            }
+
+            Term term;
+            CollectFactors(std::move(cur), term);
+            term.coef *= sign;
+            if (term.factors.empty()) {
+                constant += term.coef;
+            } else {
+                terms.emplace_back(std::move(term));
+            }
+        }
+
+        // 合并同类项
+        std::stable_sort(terms.begin(), terms.end(), TermLess);
+        std::vector<Term> merged;
+        for (auto &term : terms) {
+            if (!merged.empty() && SameFactors(merged.back(), term)) {
+                merged.back().coef += term.coef;
+            } else {
+                merged.emplace_back(std::move(term));
+            }
+        }
+
+        merged.erase(std::remove_if(merged.begin(), merged.end(),
+                                    [](const Term &term) {
+                                        return term.coef == 0;
+                                    }),
+                     merged.end());
+
+        // 没有常数项时，把第一个正项提到最前面，避免以负号开头，例如 -a+b -> b-a
+        if (constant == 0) {
+            auto firstPositive = std::find_if(merged.begin(), merged.end(), [](const Term &term) {
+                return term.coef > 0;
+            });
+            if (firstPositive != merged.end()) {
+                std::rotate(merged.begin(), firstPositive, firstPositive + 1);
+            }
+        }
+
+        Node ret = constant == 0 ? nullptr : Num(constant);
+        for (auto &term : merged) {
+            if (!ret) {
+                ret = BuildProduct(term.coef, term.factors);
+            } else if (term.coef > 0) {
+                ret = Operator(MathOperator::MATH_ADD, Move(ret), BuildProduct(term.coef, term.factors));
+            } else {
+                ret = Operator(MathOperator::MATH_SUB, Move(ret), BuildProduct(-term.coef, term.factors));
+            }
+        }
+        return ret ? Move(ret) : Num(0);
+    }
+
+    // 对单个乘方节点进行化简。
+    static void SimplifyPower(Node &n) noexcept {
+        SimplifySingleNode(n);
+        if (n->type != NodeType::OPERATOR || n->op != MathOperator::MATH_POWER) {
+            return;
+        }
+
+        auto parent = n->parent;
+        auto &base = n->left;
+        auto &exponent = n->right;
+
+        // 任何数的0次方、1的任何次方，等于1
+        if ((exponent->type == NodeType::NUMBER && exponent->value == 0.0) ||
+            (base->type == NodeType::NUMBER && base->value == 1.0)) {
+            n = Num(1);
+            n->parent = parent;
+            return;
+        }
+
+        // (x^a)^b = x^(a*b)，a、b都为整数时成立。a不是整数时x^a在x < 0处无定义，例如(x^0.5)^2不能化为x
+        if (exponent->type == NodeType::NUMBER && IsInteger(exponent->value) && base->type == NodeType::OPERATOR &&
+            base->op == MathOperator::MATH_POWER && base->right->type == NodeType::NUMBER &&
+            IsInteger(base->right->value)) {
+            auto value = base->right->value * exponent->value;
+            n = Operator(MathOperator::MATH_POWER, Move(base->left), Num(value));
+            n->parent = parent;
+            SimplifySingleNode(n);
+        }
+    }
+
+    // 对单节点n进行规范化化简。n的子节点都已经化简过。
+    // 加减链、乘除链只在链的顶端整体处理一次，链的中间节点跳过。
+    static void SimplifyNodeCanonically(Node &n) noexcept {
+        // 纯数值的子表达式按原有的运算顺序直接计算，避免重新结合带来的舍入误差
+        if (n->left->type == NodeType::NUMBER && (!n->right || n->right->type == NodeType::NUMBER)) {
+            SimplifySingleNode(n);
+            return;
+        }
+
+        auto parent = n->parent;
+        if (IsSumOperator(n->op)) {
+            if (parent && IsSumOperator(parent->op)) {
+                return;
+            }
+            n = CanonicalSum(Move(n));
+        } else if (IsProductOperator(n->op)) {
+            if (parent && IsProductOperator(parent->op)) {
+                return;
+            }
+            n = CanonicalProduct(Move(n));
+        } else if (n->op == MathOperator::MATH_POWER) {
+            SimplifyPower(n);
+        } else {
+            SimplifySingleNode(n);
+        }
+        n->parent = parent;
+    }
+
+    // 后序遍历。非递归实现。
+    static void SimplifyWholeNode(Node &node) {
+
+        // 借助一个栈，得到反向的后序遍历序列，结果保存在revertedPostOrder。除了root节点，root节点不保存在revertedPostOrder里，最后单独化简。
+        std::stack<SimplifyNode> stk;
+        std::deque<SimplifyNode> revertedPostOrder;
+
+        auto popNode = [&stk] {
+            auto node = std::move(stk.top());
+            stk.pop();
+            return node;
+        };
+
+        // ==== Part I ====
+
+        if (node->type != NodeType::OPERATOR) {
+            return;
+        }
+
+        stk.push(SimplifyNode(*node.get()));
+
+        while (!stk.empty()) {
+            auto f = popNode();
+
+            if (f.node.left && f.node.left->type == NodeType::OPERATOR) {
+                stk.push(SimplifyNode(*f.node.left.get()));
+            }
+
+            if (f.node.right && f.node.right->type == NodeType::OPERATOR) {
+                stk.push(SimplifyNode(*f.node.right.get()));
+            }
+
+            revertedPostOrder.emplace_back(std::move(f));
+        }
+
+        // pop掉root，root最后单独处理
+        revertedPostOrder.pop_front();
+
+        // ==== Part II ====
+        std::for_each(revertedPostOrder.rbegin(), revertedPostOrder.rend(), [](SimplifyNode &snode) {
+            SimplifyNodeCanonically(snode.isLeftChild ? snode.node.parent->left : snode.node.parent->right);
+        });
+
+        SimplifyFunctions::SimplifyNodeCanonically(node);
+    }
+};
+
+} // namespace internal
+
+inline void Simplify(Node &node) noexcept {
+    internal::SimplifyFunctions::SimplifyWholeNode(node);
+    return;
+}
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+/**
+ * 预处理好的方程组：方程、变量，以及方程对这些变量的雅可比矩阵。
+ * 可以序列化后保存（见serialize.h），之后直接求解，不必再求导。
+ */
+struct PreparedSystem {
+    SymVec equations;
+    std::vector<std::string> vars;
+    SymMat jacobian; // equations对vars的雅可比矩阵
+};
+
+/**
+ * 一次求解的统计信息。
+ */
+struct SolveStats {
+    int iterations = 0;                  // 迭代次数
+    std::size_t residualEvaluations = 0; // 实际计算方程组F(x)的次数
+    std::size_t jacobianEvaluations = 0; // 实际计算雅可比矩阵J(x)的次数
+    std::size_t cacheHits = 0;           // 求值缓存命中的次数，见Config::evaluationCacheSize
+    std::size_t cacheMisses = 0;         // 求值缓存未命中的次数
+};
+
+/**
+ * 本线程最近一次调用SolveByNewtonRaphson()、SolveByLM()、SolveByHomotopy()（包括通过Solve()调用）的统计信息。求解失败抛出异常时也会更新。
+ */
+inline const SolveStats &LastSolveStats() noexcept;
+
+/**
+ * 预处理方程组：复制equations，并计算对vars的雅可比矩阵。
+ * Config::Get().preparedCacheDir不为空时，先从PreparedCache中查找，未命中时把结果写入缓存。
+ * @exception runtime_error 方程组中有不能求导的运算（例如%、&、|）
+ */
+inline PreparedSystem Prepare(const SymVec &equations, const std::vector<std::string> &vars);
+
+/**
+ * 预处理方程组。变量名通过分析equations得到，按字典序排列。
+ * @exception runtime_error 方程组中有不能求导的运算（例如%、&、|）
+ */
+inline PreparedSystem Prepare(const SymVec &equations);
+
+/**
+ * Armijo方法一维搜索，寻找alpha。
+ * 每个试探点都会构造新的Vec，求解器内部使用line_search.h中不分配内存的LineSearch。
+ */
+inline double Armijo(const Vec &x, const Vec &d, const std::function<Vec(Vec)> &f, const std::function<Mat(Vec)> &df);
+
+/**
+ * 割线法 进行一维搜索，寻找alpha
+ */
+inline double FindAlpha(const Vec &x, const Vec &d, const std::function<Vec(Vec)> &f, double uncert = 1.0e-5);
+
+/**
+ * 解非线性方程组equations。
+ * 初值及变量名通过varsTable传入。
+ * @exception runtime_error 迭代次数超出限制
+ */
+inline VarsTable SolveByNewtonRaphson(const VarsTable &varsTable, const SymVec &equations);
+
+/**
+ * 解预处理好的方程组system，不再求导。
+ * 初值通过varsTable传入，varsTable的变量必须与system.vars一致。
+ * @exception runtime_error 迭代次数超出限制，或者变量不一致
+ */
+inline VarsTable SolveByNewtonRaphson(const VarsTable &varsTable, const PreparedSystem &system);
+
+/**
+ * 解非线性方程组equations。
+ * 初值及变量名通过varsTable传入。
+ * @exception runtime_error 迭代次数超出限制
+ */
+inline VarsTable SolveByLM(const VarsTable &varsTable, const SymVec &equations);
+
+/**
+ * 解预处理好的方程组system，不再求导。
+ * 初值通过varsTable传入，varsTable的变量必须与system.vars一致。
+ * @exception runtime_error 迭代次数超出限制，或者变量不一致
+ */
+inline VarsTable SolveByLM(const VarsTable &varsTable, const PreparedSystem &system);
+
+/**
+ * 以同伦延拓法解非线性方程组equations，方程数量必须等于未知量数量。
+ * 从容易求解的G(x) = x - x0（x0为varsTable给出的初值）出发，跟踪 H(x, t) = t*F(x) + (1-t)*G(x) = 0 的解曲线，
+ * t从0到1：每一步先沿切线预测，再以Newton法校正，按校正的收敛情况自适应地调整步长，
+ * 最后在t = 1处以Newton-Raphson迭代至Config::Get().epsilon。
+ * 比SolveByNewtonRaphson()、SolveByLM()更不依赖初值，适合刚性、Newton法容易发散的方程组，代价是更多的求值次数。
+ * 步长由Config::Get().homotopyInitialStep、homotopyMinStep、homotopyMaxStep控制。
+ * @exception runtime_error 方程数量与未知量数量不等，步数超出Config::Get().maxIterations，步长小于homotopyMinStep
+ * @exception MathError 预测时雅可比矩阵奇异（路径上出现转向点）
+ */
+inline VarsTable SolveByHomotopy(const VarsTable &varsTable, const SymVec &equations);
+
+/**
+ * 以同伦延拓法解预处理好的方程组system，不再求导。
+ * 初值通过varsTable传入，varsTable的变量必须与system.vars一致。
+ * @exception runtime_error 同上，或者变量不一致
+ */
+inline VarsTable SolveByHomotopy(const VarsTable &varsTable, const PreparedSystem &system);
+
+/**
+ * 解非线性方程组equations。
+ * 初值及变量名通过varsTable传入。
+ * @exception runtime_error 迭代次数超出限制
+ */
+inline VarsTable Solve(const VarsTable &varsTable, const SymVec &equations);
+
+/**
+ * 解预处理好的方程组system，不再求导。
+ * 初值通过varsTable传入，varsTable的变量必须与system.vars一致。
+ * @exception runtime_error 迭代次数超出限制，或者变量不一致
+ */
+inline VarsTable Solve(const VarsTable &varsTable, const PreparedSystem &system);
+
+/**
+ * 解预处理好的方程组system，不再求导。初值通过Config::Get()得到。
+ * @exception runtime_error 迭代次数超出限制
+ */
+inline VarsTable Solve(const PreparedSystem &system);
+
+/**
+ * 解非线性方程组equations。
+ * 变量名通过分析equations得到。初值通过Config::Get()得到。
+ * @exception runtime_error 迭代次数超出限制
+ */
+inline VarsTable Solve(const SymVec &equations);
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+/**
+ * 编译为本地代码的方程组模型。
+ * 构造时用GenerateFunction()生成方程组与雅可比矩阵的C++源码，调用系统编译器（Config::Get().nativeCompiler）
+ * 编译为共享库，再用dlopen加载，求值时直接调用函数指针。
+ * 共享库以源码与编译命令的哈希值命名，存放在Config::Get().nativeCacheDir中，相同的模型只编译一次，之后的进程直接加载。
+ * 仅支持POSIX平台。构造完成后不可修改，求值函数可以在多个线程中同时调用。
+ */
+class NativeModel {
+public:
+    /**
+     * 编译方程组equations，变量按vars的顺序传入。
+     * @exception runtime_error 平台不支持，equations中出现了vars以外的变量，编译失败或者加载失败
+     */
+    NativeModel(const SymVec &equations, const std::vector<std::string> &vars);
+
+    /**
+     * 同上，使用已经求好的雅可比矩阵jaEqs，不再重复求导。
+     */
+    NativeModel(const SymVec &equations, const SymMat &jaEqs, const std::vector<std::string> &vars);
+
+    /**
+     * 当前平台是否支持编译为本地代码。
+     */
+    static bool IsSupported() noexcept;
+
+    /**
+     * 方程数量。
+     */
+    int Rows() const noexcept;
+
+    const std::vector<std::string> &Vars() const noexcept;
+
+    /**
+     * 共享库的路径。
+     */
+    const std::string &Path() const noexcept;
+
+    /**
+     * 计算方程组的值，写入f，f的长度至少为Rows()。不检查浮点数无效值。
+     */
+    void EvalResidual(const double *x, double *f) const noexcept;
+
+    /**
+     * 计算雅可比矩阵，按行优先的顺序写入J，J的长度至少为Rows()*Vars().size()。不检查浮点数无效值。
+     */
+    void EvalJacobian(const double *x, double *J) const noexcept;
+
+    /**
+     * 计算方程组的值，返回Rows()行1列的矩阵。
+     * @exception MathError Config::Get().throwOnInvalidValue为true时，结果中出现浮点数无效值(inf, -inf, nan)
+     */
+    Mat EvalResidual(const Vec &x) const;
+
+    /**
+     * 计算雅可比矩阵。
+     * @exception MathError Config::Get().throwOnInvalidValue为true时，结果中出现浮点数无效值(inf, -inf, nan)
+     */
+    Mat EvalJacobian(const Vec &x) const;
+
+private:
+    using Function = void (*)(const double *x, double *out);
+
+    int rows;
+    std::vector<std::string> vars;
+    std::string path;
+    std::shared_ptr<void> handle; // dlopen返回的句柄，最后一个副本析构时dlclose
+    Function residual = nullptr;
+    Function jacobian = nullptr;
+};
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+/**
+ * 多起点求解的结果。
+ */
+struct MultiStartResult {
+    std::vector<VarsTable> roots; // 去重后的根，按找到它的起点的序号排列
+    int starts = 0;               // 实际求解的起点数量（提前结束时小于起点总数）
+    int converged = 0;            // 收敛的起点数量
+};
+
+/**
+ * 多起点求解预处理好的方程组system。
+ * 在lower、upper给出的区间内按Config::Get().multiStartSampling生成Config::Get().multiStartCount个初值，
+ * 以最多Config::Get().threadNum个线程分别求解（方法与Solve()相同），不收敛或者出现异常的起点直接跳过。
+ * 各分量之差都不超过Config::Get().rootTolerance * max(1, |x|)的根视为同一个根。
+ * maxRoots大于0时，找到maxRoots个不同的根后不再开始新的起点；多线程时已经开始的起点仍会完成，结果可能多于maxRoots个。
+ * @param lower 每个变量的下界，变量的顺序必须与system.vars一致
+ * @param upper 每个变量的上界，变量的顺序必须与system.vars一致
+ * @exception runtime_error 变量不一致，下界大于上界，或者SOBOL序列的维数超出支持的范围
+ */
+inline MultiStartResult SolveMultiStart(const PreparedSystem &system, const VarsTable &lower, const VarsTable &upper,
+                                 int maxRoots = 0);
+
+/**
+ * 多起点求解方程组equations，变量及其顺序由lower给出。先以Prepare()预处理，其余同上。
+ */
+inline MultiStartResult SolveMultiStart(const SymVec &equations, const VarsTable &lower, const VarsTable &upper,
+                                 int maxRoots = 0);
+
+namespace internal {
+
+/**
+ * 在单位超立方体[0, 1)^dim中生成n个拉丁超立方采样点，返回n行dim列的矩阵。
+ * 每一列的n个值恰好分别落在n个等分区间内。
+ */
+inline Mat LatinHypercube(int n, int dim, std::uint32_t seed);
+
+/**
+ * Sobol低差异序列（Joe-Kuo方向数）的前n个点，第一个点为原点。返回n行dim列的矩阵，dim最大为SobolMaxDim。
+ * @exception runtime_error dim超出范围
+ */
+inline Mat SobolSequence(int n, int dim);
+
+constexpr int SobolMaxDim = 21;
+
+} // namespace internal
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+namespace internal {
+
+/**
+ * Sobol序列一个维度的本原多项式与初始方向数，来自Joe & Kuo的new-joe-kuo-6.21201。
+ * s为多项式的次数，a为中间项的系数（按位），m为s个初始方向数。
+ */
+struct SobolDirection {
+    int s;
+    std::uint32_t a;
+    std::uint32_t m[7];
+};
+
+// 第一维是van der Corput序列，不需要方向数，从第二维开始
+const SobolDirection SobolDirections[SobolMaxDim - 1] = {
+    {1, 0, {1}},
+    {2, 1, {1, 3}},
+    {3, 1, {1, 3, 1}},
+    {3, 2, {1, 1, 1}},
+    {4, 1, {1, 1, 3, 3}},
+    {4, 4, {1, 3, 5, 13}},
+    {5, 2, {1, 1, 5, 5, 17}},
+    {5, 4, {1, 1, 5, 5, 5}},
+    {5, 7, {1, 1, 7, 11, 19}},
+    {5, 11, {1, 1, 5, 1, 1}},
+    {5, 13, {1, 1, 1, 3, 11}},
+    {5, 14, {1, 3, 5, 5, 31}},
+    {6, 1, {1, 3, 3, 9, 7, 49}},
+    {6, 13, {1, 1, 1, 15, 21, 21}},
+    {6, 16, {1, 3, 1, 13, 27, 49}},
+    {6, 19, {1, 1, 1, 15, 7, 5}},
+    {6, 22, {1, 3, 1, 15, 13, 25}},
+    {6, 25, {1, 1, 5, 5, 19, 61}},
+    {7, 1, {1, 3, 7, 11, 23, 15, 103}},
+    {7, 4, {1, 3, 7, 13, 13, 15, 69}},
+};
+
+inline Mat LatinHypercube(int n, int dim, std::uint32_t seed) {
+    std::mt19937 engine(seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::vector<int> perm(n);
+    Mat ret(n, dim);
+    for (int j = 0; j < dim; ++j) {
+        std::iota(perm.begin(), perm.end(), 0);
+        std::shuffle(perm.begin(), perm.end(), engine);
+        for (int i = 0; i < n; ++i) {
+            // 防止舍入后等于1
+            ret.Value(i, j) = std::min((perm[i] + uniform(engine)) / n, std::nextafter(1.0, 0.0));
+        }
+    }
+    return ret;
+}
+
+inline Mat SobolSequence(int n, int dim) {
+    if (dim > SobolMaxDim) {
+        throw std::runtime_error("SobolSequence: at most " + std::to_string(SobolMaxDim) + " dimensions, got " +
+                                 std::to_string(dim));
+    }
+
+    // 每一维32个方向数，V[k]的最高位对应2^-(k+1)
+    std::vector<std::uint32_t> V(static_cast<std::size_t>(dim) * 32);
+    for (int j = 0; j < dim; ++j) {
+        auto v = V.begin() + j * 32;
+        if (j == 0) {
+            for (int k = 0; k < 32; ++k) {
+                v[k] = 1u << (31 - k);
+            }
+            continue;
+        }
+        auto &dir = SobolDirections[j - 1];
+        for (int k = 0; k < 32; ++k) {
+            if (k < dir.s) {
+                v[k] = dir.m[k] << (31 - k);
+                continue;
+            }
+            v[k] = v[k - dir.s] ^ (v[k - dir.s] >> dir.s);
+            for (int i = 1; i < dir.s; ++i) {
+                if ((dir.a >> (dir.s - 1 - i)) & 1) {
+                    v[k] ^= v[k - i];
+                }
+            }
+        }
+    }
+
+    // Gray码顺序：第i个点由第i-1个点异或上i-1最低的0位对应的方向数得到
+    Mat ret(n, dim);
+    std::vector<std::uint32_t> x(dim, 0);
+    for (int i = 0; i < n; ++i) {
+        if (i > 0) {
+            int c = 0;
+            for (auto value = static_cast<std::uint32_t>(i - 1); value & 1; value >>= 1) {
+                ++c;
+            }
+            for (int j = 0; j < dim; ++j) {
+                x[j] ^= V[j * 32 + c];
+            }
+        }
+        for (int j = 0; j < dim; ++j) {
+            ret.Value(i, j) = std::ldexp(static_cast<double>(x[j]), -32);
+        }
+    }
+    return ret;
+}
+
+} // namespace internal
+
+inline MultiStartResult SolveMultiStart(const PreparedSystem &system, const VarsTable &lower, const VarsTable &upper,
+                                 int maxRoots) {
+    if (lower.Vars() != system.vars || upper.Vars() != system.vars) {
+        throw std::runtime_error("SolveMultiStart: the variables of bounds do not match the prepared system");
+    }
+    int dim = lower.VarNums();
+    for (int j = 0; j < dim; ++j) {
+        if (!(lower.Values()[j] <= upper.Values()[j])) {
+            throw std::runtime_error("SolveMultiStart: lower bound of " + system.vars[j] +
+                                     " is greater than upper bound");
+        }
+    }
+
+    auto &config = Config::Get();
+    int count = std::max(config.multiStartCount, 1);
+    Mat samples = config.multiStartSampling == SamplingMethod::SOBOL
+                      ? internal::SobolSequence(count, dim)
+                      : internal::LatinHypercube(count, dim, config.multiStartSeed);
+    auto tolerance = config.rootTolerance;
+
+    struct Root {
+        int start; // 最早找到它的起点的序号
+        VarsTable table;
+    };
+    std::vector<Root> roots;
+    int starts = 0, converged = 0;
+    std::mutex mutex;
+    std::atomic<bool> stop{false};
+
+    auto sameRoot = [dim, tolerance](const Vec &a, const Vec &b) {
+        for (int j = 0; j < dim; ++j) {
+            if (!(std::abs(a[j] - b[j]) <= tolerance * std::max(1.0, std::abs(b[j])))) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    internal::ParallelFor(count, [&](int begin, int end) {
+        for (int i = begin; i < end && !stop; ++i) {
+            Vec x(dim);
+            for (int j = 0; j < dim; ++j) {
+                auto lo = lower.Values()[j], hi = upper.Values()[j];
+                x[j] = lo + samples.Value(i, j) * (hi - lo);
+            }
+            VarsTable init(system.vars, 0);
+            init.SetValues(x);
+
+            bool ok = true;
+            VarsTable table = init;
+            try {
+                table = Solve(init, system);
+            } catch (const std::exception &) {
+                // 不收敛、雅可比矩阵奇异或者出现无效值，跳过这个起点
+                ok = false;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            ++starts;
+            if (!ok) {
+                continue;
+            }
+            ++converged;
+            auto it = std::find_if(roots.begin(), roots.end(), [&](const Root &root) {
+                return sameRoot(table.Values(), root.table.Values());
+            });
+            if (it == roots.end()) {
+                roots.push_back({i, std::move(table)});
+            } else if (i < it->start) {
+                it->start = i;
+                it->table = std::move(table);
+            }
+            if (maxRoots > 0 && static_cast<int>(roots.size()) >= maxRoots) {
+                stop = true;
+            }
+        }
+    });
+
+    std::sort(roots.begin(), roots.end(), [](const Root &a, const Root &b) {
+        return a.start < b.start;
+    });
+    MultiStartResult result;
+    for (auto &root : roots) {
+        result.roots.emplace_back(std::move(root.table));
+    }
+    result.starts = starts;
+    result.converged = converged;
+    return result;
+}
+
+inline MultiStartResult SolveMultiStart(const SymVec &equations, const VarsTable &lower, const VarsTable &upper,
+                                 int maxRoots) {
+    return SolveMultiStart(Prepare(equations, lower.Vars()), lower, upper, maxRoots);
+}
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+namespace internal {
+
+class EGraph {
+public:
+    using Id = std::uint32_t;
+
+    /**
+     * e-graph中的节点。运算符节点的子节点是e-class的编号，而不是具体的节点。
+     */
+    struct ENode {
+        NodeType type;
+        MathOperator op;
+        double value;
+        std::uint32_t varId;
+        Id children[2];
+    };
+
+    struct ENodeHash {
+        std::size_t operator()(const ENode &n) const noexcept {
+            auto value = n.value == 0.0 ? 0.0 : n.value;
+            std::uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            auto seed = HashCombine(static_cast<std::uint64_t>(n.type), static_cast<std::uint64_t>(n.op));
+            seed = HashCombine(seed, bits);
+            seed = HashCombine(seed, n.varId);
+            seed = HashCombine(seed, n.children[0]);
+            return static_cast<std::size_t>(HashCombine(seed, n.children[1]));
+        }
+    };
+
+    struct ENodeEqual {
+        bool operator()(const ENode &lhs, const ENode &rhs) const noexcept {
+            return lhs.type == rhs.type && lhs.op == rhs.op && lhs.value == rhs.value && lhs.varId == rhs.varId &&
+                   lhs.children[0] == rhs.children[0] && lhs.children[1] == rhs.children[1];
+        }
+    };
+
+    /**
+     * 把整个表达式加入e-graph，返回根节点所在的e-class。后序遍历。非递归实现。
+     */
+    Id AddNode(const Node &node) noexcept {
+        std::vector<const NodeImpl *> revertedPostOrder;
+        std::stack<const NodeImpl *> stk;
+        stk.emplace(node.get());
+        while (!stk.empty()) {
+            auto cur = stk.top();
+            stk.pop();
+            revertedPostOrder.emplace_back(cur);
+            if (cur->left) {
+                stk.emplace(cur->left.get());
+            }
+            if (cur->right) {
+                stk.emplace(cur->right.get());
+            }
+        }
+
+        std::vector<Id> ids;
+        for (auto it = revertedPostOrder.rbegin(); it != revertedPostOrder.rend(); ++it) {
+            auto &cur = **it;
+            switch (cur.type) {
+            case NodeType::NUMBER:
+                ids.emplace_back(AddNumber(cur.value));
+                break;
+            case NodeType::VARIABLE: {
+                auto ret = varIds.emplace(cur.varname, static_cast<std::uint32_t>(varnames.size()));
+                if (ret.second) {
+                    varnames.emplace_back(cur.varname);
+                }
+                ids.emplace_back(Add({NodeType::VARIABLE, MathOperator::MATH_NULL, 0, ret.first->second, {0, 0}}));
+                break;
+            }
+            case NodeType::OPERATOR:
+                if (GetOperatorNum(cur.op) == 2) {
+                    auto right = ids.back();
+                    ids.pop_back();
+                    ids.back() = AddOperator(cur.op, ids.back(), right);
+                } else {
+                    ids.back() = AddOperator(cur.op, ids.back());
+                }
+                break;
+            }
+        }
+        assert(ids.size() == 1);
+        return ids.back();
+    }
+
+    /**
+     * 每轮对所有e-class应用一遍重写规则，然后重建。返回是否产生了新的节点或等价关系。
+     * 每处理完一个节点检查一次节点总数，超过maxNodes时不再处理本轮剩下的节点。
+     */
+    bool ApplyRules(std::size_t maxNodes) noexcept {
+        changed = false;
+        auto count = static_cast<Id>(classes.size());
+        for (Id id = 0; id < count && NodeCount() <= maxNodes; ++id) {
+            if (Find(id) != id) {
+                continue;
+            }
+            // Add()可能使classes扩容，这里必须复制一份
+            auto nodes = classes[id];
+            for (auto &n : nodes) {
+                if (NodeCount() > maxNodes) {
+                    break;
+                }
+                ApplyRules(id, n);
+            }
+        }
+        Rebuild();
+        return changed;
+    }
+
+    /**
+     * e-graph中的节点总数。
+     */
+    std::size_t NodeCount() const noexcept {
+        return memo.size();
+    }
+
+    /**
+     * 按OperatorCost()提取root所在e-class中总代价最低的表达式。非递归实现。
+     */
+    Node Extract(Id root) noexcept {
+        root = Find(root);
+
+        // 反复松弛，直到每个e-class的最低代价不再变化
+        std::vector<double> costs(classes.size(), std::numeric_limits<double>::infinity());
+        std::vector<ENode> best(classes.size());
+        for (bool updated = true; updated;) {
+            updated = false;
+            for (Id id = 0; id < classes.size(); ++id) {
+                for (auto &n : classes[id]) {
+                    auto cost = NodeCost(n, costs);
+                    if (cost < costs[id]) {
+                        costs[id] = cost;
+                        best[id] = n;
+                        updated = true;
+                    }
+                }
+            }
+        }
+
+        // 运算符的代价严格大于其子节点，因此best不会成环
+        std::stack<std::pair<Id, bool>> stk;
+        std::stack<Node> results;
+        auto popNode = [&results] {
+            auto node = std::move(results.top());
+            results.pop();
+            return node;
+        };
+        stk.emplace(root, false);
+        while (!stk.empty()) {
+            auto id = stk.top().first;
+            auto visited = stk.top().second;
+            stk.pop();
+
+            auto &n = best[id];
+            switch (n.type) {
+            case NodeType::NUMBER:
+                results.emplace(Num(n.value));
+                break;
+            case NodeType::VARIABLE:
+                results.emplace(
+                    std::make_unique<NodeImpl>(NodeType::VARIABLE, MathOperator::MATH_NULL, 0, varnames[n.varId]));
+                break;
+            case NodeType::OPERATOR:
+                if (!visited) {
+                    stk.emplace(id, true);
+                    if (GetOperatorNum(n.op) == 2) {
+                        stk.emplace(Find(n.children[1]), false);
+                    }
+                    stk.emplace(Find(n.children[0]), false);
+                } else if (GetOperatorNum(n.op) == 2) {
+                    auto right = popNode();
+                    auto left = popNode();
+                    results.emplace(Operator(n.op, std::move(left), std::move(right)));
+                } else {
+                    results.emplace(Operator(n.op, popNode()));
+                }
+                break;
+            }
+        }
+        assert(results.size() == 1);
+        return popNode();
+    }
+
+private:
+    std::vector<Id> parents;                // 并查集
+    std::vector<std::vector<ENode>> classes; // 只有代表元的位置保存节点
+    std::vector<bool> hasConstant;           // e-class是否等于某个常数
+    std::vector<double> constants;
+    std::unordered_map<ENode, Id, ENodeHash, ENodeEqual> memo;
+    std::vector<std::string> varnames;
+    std::map<std::string, std::uint32_t> varIds;
+    bool changed = false;
+
+    Id Find(Id id) noexcept {
+        while (parents[id] != id) {
+            parents[id] = parents[parents[id]];
+            id = parents[id];
+        }
+        return id;
+    }
+
+    ENode Canonicalize(ENode n) noexcept {
+        if (n.type == NodeType::OPERATOR) {
+            n.children[0] = Find(n.children[0]);
+            if (GetOperatorNum(n.op) == 2) {
+                n.children[1] = Find(n.children[1]);
+            }
+        }
+        return n;
+    }
+
+    Id Add(ENode n) noexcept {
+        n = Canonicalize(n);
+        auto itor = memo.find(n);
+        if (itor != memo.end()) {
+            return Find(itor->second);
+        }
+
+        auto id = static_cast<Id>(classes.size());
+        parents.emplace_back(id);
+        classes.emplace_back(std::vector<ENode>{n});
+        hasConstant.emplace_back(n.type == NodeType::NUMBER);
+        constants.emplace_back(n.value);
+        memo.emplace(n, id);
+        changed = true;
+        return id;
+    }
+
+    Id AddNumber(double value) noexcept {
+        return Add({NodeType::NUMBER, MathOperator::MATH_NULL, value, 0, {0, 0}});
+    }
+
+    Id AddOperator(MathOperator op, Id left, Id right = 0) noexcept {
+        return Add({NodeType::OPERATOR, op, 0, 0, {left, right}});
+    }
+
+    void Union(Id a, Id b) noexcept {
+        a = Find(a);
+        b = Find(b);
+        if (a == b) {
+            return;
+        }
+        if (classes[a].size() < classes[b].size()) {
+            std::swap(a, b);
+        }
+        parents[b] = a;
+        classes[a].insert(classes[a].end(), classes[b].begin(), classes[b].end());
+        classes[b].clear();
+        classes[b].shrink_to_fit();
+        if (!hasConstant[a] && hasConstant[b]) {
+            hasConstant[a] = true;
+            constants[a] = constants[b];
+        }
+        changed = true;
+    }
+
+    // 合并后，原本不同的节点可能变得相同，需要重新建立哈希表并合并对应的e-class，直到不再变化
+    void Rebuild() noexcept {
+        for (bool merged = true; merged;) {
+            memo.clear();
+            std::vector<std::pair<Id, Id>> pending;
+            for (Id id = 0; id < classes.size(); ++id) {
+                if (Find(id) != id) {
+                    continue;
+                }
+                for (auto &n : classes[id]) {
+                    n = Canonicalize(n);
+                    auto ret = memo.emplace(n, id);
+                    if (!ret.second && ret.first->second != id) {
+                        pending.emplace_back(ret.first->second, id);
+                    }
+                }
+            }
+            for (auto &pr : pending) {
+                Union(pr.first, pr.second);
+            }
+            merged = !pending.empty();
+        }
+
+        // 去掉e-class内重复的节点
+        for (Id id = 0; id < classes.size(); ++id) {
+            auto &nodes = classes[id];
+            std::vector<ENode> unique;
+            for (auto &n : nodes) {
+                auto c = Canonicalize(n);
+                if (std::none_of(unique.begin(), unique.end(), [&c](const ENode &u) {
+                        return ENodeEqual()(u, c);
+                    })) {
+                    unique.emplace_back(c);
+                }
+            }
+            nodes = std::move(unique);
+        }
+    }
+
+    bool IsConstant(Id id, double value) noexcept {
+        id = Find(id);
+        return hasConstant[id] && constants[id] == value;
+    }
+
+    // 对e-class id中所有运算符为op的节点调用f
+    template <typename F>
+    void ForEach(Id id, MathOperator op, F &&f) noexcept {
+        auto nodes = classes[Find(id)];
+        for (auto &n : nodes) {
+            if (n.type == NodeType::OPERATOR && n.op == op) {
+                f(n);
+            }
+        }
+    }
+
+    // 对节点n应用所有重写规则，n属于e-class id
+    void ApplyRules(Id id, const ENode &n) noexcept {
+        if (n.type != NodeType::OPERATOR) {
+            return;
+        }
+
+        auto a = Find(n.children[0]);
+        auto b = GetOperatorNum(n.op) == 2 ? Find(n.children[1]) : a;
+
+        // 常数折叠
+        if (hasConstant[a] && hasConstant[b]) {
+            try {
+                auto value = tomsolver::Calc(n.op, constants[a], constants[b]);
+                if (std::isfinite(value)) {
+                    Union(id, AddNumber(value));
+                }
+            } catch (const MathError &) {
+            }
+        }
+
+        switch (n.op) {
+        case MathOperator::MATH_ADD:
+            Union(id, AddOperator(MathOperator::MATH_ADD, b, a));
+            // (x+y)+z = x+(y+z)
+            ForEach(a, MathOperator::MATH_ADD, [&](const ENode &sum) {
+                auto yz = AddOperator(MathOperator::MATH_ADD, sum.children[1], b);
+                Union(id, AddOperator(MathOperator::MATH_ADD, sum.children[0], yz));
+            });
+            if (IsConstant(b, 0)) {
+                Union(id, a);
+            }
+            // a*b+a*c = a*(b+c)
+            ForEach(a, MathOperator::MATH_MULTIPLY, [&](const ENode &m1) {
+                ForEach(b, MathOperator::MATH_MULTIPLY, [&](const ENode &m2) {
+                    if (Find(m1.children[0]) == Find(m2.children[0])) {
+                        auto sum = AddOperator(MathOperator::MATH_ADD, m1.children[1], m2.children[1]);
+                        Union(id, AddOperator(MathOperator::MATH_MULTIPLY, m1.children[0], sum));
+                    }
+                });
+            });
+            // sin(x)^2+cos(x)^2 = 1
+            ForEach(a, MathOperator::MATH_POWER, [&](const ENode &p1) {
+                ForEach(b, MathOperator::MATH_POWER, [&](const ENode &p2) {
+                    if (!IsConstant(p1.children[1], 2) || !IsConstant(p2.children[1], 2)) {
+                        return;
+                    }
+                    ForEach(p1.children[0], MathOperator::MATH_SIN, [&](const ENode &s) {
+                        ForEach(p2.children[0], MathOperator::MATH_COS, [&](const ENode &c) {
+                            if (Find(s.children[0]) == Find(c.children[0])) {
+                                Union(id, AddNumber(1));
+                            }
+                        });
+                    });
+                });
+            });
+            break;
+
+        case MathOperator::MATH_SUB:
+            if (a == b) {
+                Union(id, AddNumber(0));
+            }
+            if (IsConstant(b, 0)) {
+                Union(id, a);
+            }
+            // a*b-a*c = a*(b-c)
+            ForEach(a, MathOperator::MATH_MULTIPLY, [&](const ENode &m1) {
+                ForEach(b, MathOperator::MATH_MULTIPLY, [&](const ENode &m2) {
+                    if (Find(m1.children[0]) == Find(m2.children[0])) {
+                        auto difference = AddOperator(MathOperator::MATH_SUB, m1.children[1], m2.children[1]);
+                        Union(id, AddOperator(MathOperator::MATH_MULTIPLY, m1.children[0], difference));
+                    }
+                });
+            });
+            break;
+
+        case MathOperator::MATH_MULTIPLY:
+            Union(id, AddOperator(MathOperator::MATH_MULTIPLY, b, a));
+            // (x*y)*z = x*(y*z)
+            ForEach(a, MathOperator::MATH_MULTIPLY, [&](const ENode &product) {
+                auto yz = AddOperator(MathOperator::MATH_MULTIPLY, product.children[1], b);
+                Union(id, AddOperator(MathOperator::MATH_MULTIPLY, product.children[0], yz));
+            });
+            if (IsConstant(b, 1)) {
+                Union(id, a);
+            }
+            if (IsConstant(b, 0)) {
+                Union(id, AddNumber(0));
+            }
+            // x*x = x^2
+            if (a == b) {
+                Union(id, AddOperator(MathOperator::MATH_POWER, a, AddNumber(2)));
+            }
+            // x^p*x = x^(p+1)，x^p*x^q = x^(p+q)，只合并不扩大定义域的整数次幂，见CanMergeExponents()
+            ForEach(a, MathOperator::MATH_POWER, [&](const ENode &p1) {
+                auto base = Find(p1.children[0]);
+                auto e1 = Find(p1.children[1]);
+                if (!hasConstant[e1]) {
+                    return;
+                }
+                if (base == b && CanMergeExponents(constants[e1], 1)) {
+                    Union(id, AddOperator(MathOperator::MATH_POWER, base, AddNumber(constants[e1] + 1)));
+                }
+                ForEach(b, MathOperator::MATH_POWER, [&](const ENode &p2) {
+                    auto e2 = Find(p2.children[1]);
+                    if (Find(p2.children[0]) == base && hasConstant[e2] &&
+                        CanMergeExponents(constants[e1], constants[e2])) {
+                        Union(id, AddOperator(MathOperator::MATH_POWER, base, AddNumber(constants[e1] + constants[e2])));
+                    }
+                });
+            });
+            // exp(a)*exp(b) = exp(a+b)
+            ForEach(a, MathOperator::MATH_EXP, [&](const ENode &e1) {
+                ForEach(b, MathOperator::MATH_EXP, [&](const ENode &e2) {
+                    auto sum = AddOperator(MathOperator::MATH_ADD, e1.children[0], e2.children[0]);
+                    Union(id, AddOperator(MathOperator::MATH_EXP, sum));
+                });
+            });
+            break;
+
+        case MathOperator::MATH_DIVIDE:
+            if (IsConstant(b, 1)) {
+                Union(id, a);
+            }
+            // Simplify的规范形式是(n1*n2*...)/(d1*d2*...)，拆开乘除链，使分子、分母中的因子可以两两配对
+            // (x*y)/z = x*(y/z)
+            ForEach(a, MathOperator::MATH_MULTIPLY, [&](const ENode &product) {
+                auto quotient = AddOperator(MathOperator::MATH_DIVIDE, product.children[1], b);
+                Union(id, AddOperator(MathOperator::MATH_MULTIPLY, product.children[0], quotient));
+            });
+            // x/(y*z) = (x/y)/z
+            ForEach(b, MathOperator::MATH_MULTIPLY, [&](const ENode &product) {
+                auto quotient = AddOperator(MathOperator::MATH_DIVIDE, a, product.children[0]);
+                Union(id, AddOperator(MathOperator::MATH_DIVIDE, quotient, product.children[1]));
+            });
+            // sin(x)/cos(x) = tan(x)
+            ForEach(a, MathOperator::MATH_SIN, [&](const ENode &s) {
+                ForEach(b, MathOperator::MATH_COS, [&](const ENode &c) {
+                    if (Find(s.children[0]) == Find(c.children[0])) {
+                        Union(id, AddOperator(MathOperator::MATH_TAN, s.children[0]));
+                    }
+                });
+            });
+            break;
+
+        case MathOperator::MATH_POWER: {
+            if (!hasConstant[b]) {
+                break;
+            }
+            auto exponent = constants[b];
+            if (exponent == 1) {
+                Union(id, a);
+            } else if (exponent == 0) {
+                Union(id, AddNumber(1));
+            } else if (exponent == 0.5) {
+                Union(id, AddOperator(MathOperator::MATH_SQRT, a));
+            } else if (exponent >= 2 && exponent <= 4 && std::trunc(exponent) == exponent) {
+                // x^n = x^(n-1)*x，由代价模型决定是否展开为乘法
+                Union(id, AddOperator(MathOperator::MATH_MULTIPLY, AddOperator(MathOperator::MATH_POWER, a,
+                                                                               AddNumber(exponent - 1)),
+                                      a));
+            }
+            break;
+        }
+
+        case MathOperator::MATH_LOG:
+            ForEach(a, MathOperator::MATH_EXP, [&](const ENode &e) {
+                Union(id, e.children[0]);
+            });
+            break;
+
+        case MathOperator::MATH_EXP:
+            ForEach(a, MathOperator::MATH_LOG, [&](const ENode &l) {
+                Union(id, l.children[0]);
+            });
+            break;
+
+        case MathOperator::MATH_NEGATIVE:
+            ForEach(a, MathOperator::MATH_NEGATIVE, [&](const ENode &neg) {
+                Union(id, neg.children[0]);
+            });
+            break;
+
+        case MathOperator::MATH_POSITIVE:
+            Union(id, a);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    // x^p*x^q = x^(p+q)是否不扩大定义域：p、q都是整数（非整数次幂在x < 0时无定义），
+    // 并且都不是负数，或者合并后仍为负数（负数次幂在x = 0时无定义）。与Simplify合并同底数幂的规则一致
+    static bool CanMergeExponents(double p, double q) noexcept {
+        auto isInteger = [](double value) {
+            return std::trunc(value) == value;
+        };
+        return isInteger(p) && isInteger(q) && ((p >= 0 && q >= 0) || p + q < 0);
+    }
+
+    static double NodeCost(const ENode &n, const std::vector<double> &costs) noexcept {
+        if (n.type != NodeType::OPERATOR) {
+            return 0;
+        }
+        auto cost = OperatorCost(n.op) + costs[n.children[0]];
+        if (GetOperatorNum(n.op) == 2) {
+            cost += costs[n.children[1]];
+        }
+        return cost;
+    }
+};
+
+} // namespace internal
+
+inline Node Optimize(const Node &node, int maxIterations, std::size_t maxNodes) noexcept {
+    Node simplified = Clone(node);
+    Simplify(simplified);
+
+    internal::EGraph egraph;
+    auto root = egraph.AddNode(simplified);
+    for (int i = 0; i < maxIterations && egraph.NodeCount() <= maxNodes; ++i) {
+        if (!egraph.ApplyRules(maxNodes)) {
+            break;
+        }
+    }
+    return egraph.Extract(root);
+}
+
+inline double OperatorCost(MathOperator op) noexcept {
+    switch (op) {
+    case MathOperator::MATH_POSITIVE:
+    case MathOperator::MATH_NEGATIVE:
+    case MathOperator::MATH_ADD:
+    case MathOperator::MATH_SUB:
+    case MathOperator::MATH_MULTIPLY:
+        return 1;
+    case MathOperator::MATH_DIVIDE:
+        return 4;
+    case MathOperator::MATH_SQRT:
+        return 8;
+    case MathOperator::MATH_POWER:
+        return 30;
+    default:
+        return 20;
+    }
+}
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+namespace internal {
+
+class DiffFunctions {
+public:
+    struct DiffNode {
+        NodeImpl &node;
+        const bool isLeftChild;
+
+        DiffNode(NodeImpl &node) : node(node), isLeftChild(node.parent && node.parent->left.get() == &node) {}
+    };
+
+    static void DiffOnce(Node &root, const std::string &varname) {
+        std::queue<DiffNode> q;
+
+        if (root->type == NodeType::OPERATOR) {
+            DiffOnceOperator(root, q);
+        } else {
+            q.emplace(*root);
+        }
+
+        while (!q.empty()) {
+            auto &node = q.front().node;
+            auto isLeftChild = q.front().isLeftChild;
+            q.pop();
+
+            switch (node.type) {
+            case NodeType::VARIABLE:
+                node.type = NodeType::NUMBER;
+                node.value = node.varname == varname ? 1 : 0;
+                node.varname = "";
+                break;
+
+            case NodeType::NUMBER:
+                node.value = 0;
+                break;
+
+            case NodeType::OPERATOR: {
+                auto &child = isLeftChild ? node.parent->left : node.parent->right;
+                DiffOnceOperator(child, q);
+                break;
+            }
+            default:
+                assert(0 && "inner bug");
+            }
+        }
+    }
+
+    static void DiffOnceOperator(Node &node, std::queue<DiffNode> &q) {
+        auto parent = node->parent;
+
+        // 调用前提：node是1元操作符
+        // 如果node的成员是数字，那么整个node变为数字节点，value=0，且返回true
+        // 例如： sin(1)' = 0
+        auto CullNumberMember = [&node]() -> bool {
+            assert(GetOperatorNum(node->op) == 1);
+            assert(node->left);
+            if (node->left->type == NodeType::NUMBER) {
+                node->left = nullptr;
+                node->type = NodeType::NUMBER;
+                node->op = MathOperator::MATH_NULL;
+                node->value = 0.0;
+                return true;
+            }
+            return false;
+        };
+
+        // 调用前提：node是2元操作符
+        // 如果node的成员是数字，那么整个node变为数字节点，value=0，且返回true
+        // 例如： (2*3)' = 0
+        auto CullNumberMemberBinary = [&node]() -> bool {
+            assert(GetOperatorNum(node->op) == 2);
+            assert(node->left && node->right);
+            if (node->left->type == NodeType::NUMBER && node->right->type == NodeType::NUMBER) {
+                node->left = nullptr;
+                node->right = nullptr;
+                node->type = NodeType::NUMBER;
+                node->op = MathOperator::MATH_NULL;
+                node->value = 0.0;
+                return true;
+            }
+            return false;
+        };
+
+        switch (node->op) {
+        case MathOperator::MATH_NULL: {
+            assert(0 && "inner bug");
+            break;
+        }
+        case MathOperator::MATH_POSITIVE:
+        case MathOperator::MATH_NEGATIVE: {
+            q.emplace(*node->left);
+            return;
+        }
+
+        // 函数
+        case MathOperator::MATH_SIN: {
+            if (CullNumberMember()) {
+                return;
+            }
+
+            // sin(u)' = cos(u) * u'
+            node->op = MathOperator::MATH_COS;
+            auto u2 = Clone(node->left);
+            q.emplace(*u2);
+            node = Move(node) * Move(u2);
+            node->parent = parent;
+            break;
+        }
+        case MathOperator::MATH_COS: {
+            if (CullNumberMember()) {
+                return;
+            }
+
+            // cos(u)' = -sin(u) * u'
+            node->op = MathOperator::MATH_SIN;
+            auto u2 = Clone(node->left);
+            q.emplace(*u2);
+            node = -Move(node) * Move(u2);
+            node->parent = parent;
+            break;
+        }
+        case MathOperator::MATH_TAN: {
+            if (CullNumberMember()) {
+                return;
+            }
+
+            // tan'u = 1/(cos(u)^2) * u'
+            node->op = MathOperator::MATH_COS;
+            auto &u = node->left;
+            auto u2 = Clone(u);
+            q.emplace(*u2);
+            node = Num(1) / (Move(node) ^ Num(2)) * Move(u2);
+            node->parent = parent;
+            return;
+        }
+        case MathOperator::MATH_ARCSIN: {
+            if (CullNumberMember()) {
+                return;
+            }
+
+            // asin'u = 1/sqrt(1-u^2) * u'
+            auto &u = node->left;
+            auto u2 = Clone(u);
+            q.emplace(*u2);
+            node = (Num(1) / sqrt(Num(1) - (Move(u) ^ Num(2)))) * Move(u2);
+            node->parent = parent;
+            return;
+        }
+        case MathOperator::MATH_ARCCOS: {
+            if (CullNumberMember()) {
+                return;
+            }
+
+            // acos'u = -1/sqrt(1-u^2) * u'
+            auto &u = node->left;
+            auto u2 = Clone(u);
+            q.emplace(*u2);
+            node = (Num(-1) / sqrt(Num(1) - (Move(u) ^ Num(2)))) * Move(u2);
+            node->parent = parent;
+            return;
+        }
+        case MathOperator::MATH_ARCTAN: {
+            if (CullNumberMember()) {
+                return;
+            }
+
+            // atan'u = 1/(1+u^2) * u'
+            auto &u = node->left;
+            auto u2 = Clone(u);
+            q.emplace(*u2);
+            node = (Num(1) / (Num(1) + (Move(u) ^ Num(2)))) * Move(u2);
+            node->parent = parent;
+            return;
+        }
+        case MathOperator::MATH_SQRT: {
+            if (CullNumberMember()) {
+                return;
+            }
+
+            // sqrt(u)' = 1/(2*sqrt(u)) * u'
+            auto &u = node->left;
+            auto u2 = Clone(u);
+            q.emplace(*u2);
+            node = Num(1) / (Num(2) * Move(node)) * Move(u2);
+            node->parent = parent;
+            return;
+        }
+        case MathOperator::MATH_LOG: {
+            if (CullNumberMember()) {
+                return;
+            }
+
+            // ln(u)' = 1/u * u'
+            auto &u = node->left;
+            auto u2 = Clone(u);
+            q.emplace(*u2);
+            node = (Num(1) / Move(u)) * Move(u2);
+            node->parent = parent;
+            return;
+        }
+        case MathOperator::MATH_LOG2: {
+            if (CullNumberMember()) {
+                return;
+            }
+
+            // loga(u)' = 1/(u * ln(a)) * u'
+            auto a = 2.0;
+            auto &u = node->left;
+            auto u2 = Clone(u);
+            q.emplace(*u2);
+            node = (Num(1) / (Move(u) * Num(std::log(a)))) * Move(u2);
+            node->parent = parent;
+            return;
+        }
+        case MathOperator::MATH_LOG10: {
+            if (CullNumberMember()) {
+                return;
+            }
+
+            // loga(u)' = 1/(u * ln(a)) * u'
+            auto a = 10.0;
+            auto &u = node->left;
+            auto u2 = Clone(u);
+            q.emplace(*u2);
+            node = (Num(1) / (Move(u) * Num(std::log(a)))) * Move(u2);
+            node->parent = parent;
+            return;
+        }
+        case MathOperator::MATH_EXP: {
+            if (CullNumberMember()) {
+                return;
+            }
+
+            // e^x=e^x
+            if (node->left->type == NodeType::VARIABLE)
+                return;
+
+            // (e^u)' = e^u * u'
+            auto u2 = Clone(node->left);
+            q.emplace(*u2);
+            node = Move(node) * Move(u2);
+            node->parent = parent;
+            break;
+        }
+
+        // 二元
+        case MathOperator::MATH_ADD:
+        case MathOperator::MATH_SUB:
+            if (CullNumberMemberBinary()) {
+                return;
+            }
+            // (u + v)' = u' + v'
+            if (node->left) {
+                q.emplace(*node->left);
+            }
+            if (node->right) {
+                q.emplace(*node->right);
+            }
+            return;
+        case MathOperator::MATH_MULTIPLY: {
+            // 两个操作数中有一个是数字
+            if (node->left->type == NodeType::NUMBER) {
+                q.emplace(*node->right);
+                return;
+            }
+            if (node->right->type == NodeType::NUMBER) {
+                q.emplace(*node->left);
+                return;
+            }
+
+            if (CullNumberMemberBinary()) {
+                return;
+            }
+
+            // (u*v)' = u' * v + u * v'
+            auto &u = node->left;
+            auto &v = node->right;
+            q.emplace(*u);
+            auto u2 = Clone(u);
+            auto v2 = Clone(v);
+            q.emplace(*v2);
+            node = Move(node) + Move(u2) * Move(v2);
+            node->parent = parent;
+            return;
+        }
+        case MathOperator::MATH_DIVIDE: {
+            // auto leftIsNumber = node->left->type == NodeType::NUMBER;
+            auto rightIsNumber = node->right->type == NodeType::NUMBER;
+
+            // f(x)/number = f'(x)/number
+            if (rightIsNumber) {
+                q.emplace(*node->left);
+                return;
+            }
+
+            if (CullNumberMemberBinary()) {
+                return;
+            }
+
+            // (u/v)' = (u'v - uv')/(v^2)
+            auto &u = node->left;
+            auto &v = node->right;
+            auto u2 = Clone(u);
+            auto v2 = Clone(v);
+            auto v3 = Clone(v);
+            q.emplace(*u);
+            q.emplace(*v2);
+            node = (Move(u) * Move(v) - Move(u2) * Move(v2)) / (Move(v3) ^ Num(2));
+            node->parent = parent;
+            return;
+        }
+        case MathOperator::MATH_POWER: {
+            // 如果两个操作数都是数字
+            if (CullNumberMemberBinary()) {
+                return;
+            }
+
+            auto lChildIsNumber = node->left->type == NodeType::NUMBER;
+            auto rChildIsNumber = node->right->type == NodeType::NUMBER;
+
+            // (u^a)' = a*u^(a-1) * u'
+            if (rChildIsNumber) {
+                auto &a = node->right;
+                auto aValue = a->value;
+                auto &u = node->left;
+                auto u2 = Clone(u);
+                q.emplace(*u2);
+                node = std::move(a) * (std::move(u) ^ Num(aValue - 1)) * std::move(u2);
+                node->parent = parent;
+                return;
+            }
+
+            // (a^x)' = a^x * ln(a)  when a>0 and a!=1
+            if (lChildIsNumber) {
+                auto &a = node->left;
+                auto aValue = a->value;
+                auto &u = node->right;
+                auto u2 = Clone(u);
+                q.emplace(*u2);
+                node = (std::move(a) ^ std::move(u)) * log(Num(aValue)) * std::move(u2);
+                node->parent = parent;
+                return;
+            }
+
+            // (u^v)' = ( e^(v*ln(u)) )' = e^(v*ln(u)) * (v*ln(u))' = u^v * (v*ln(u))'
+            // 左右都不是数字
+            auto &u = node->left;
+            auto &v = node->right;
+            auto vln_u = Clone(v) * log(Clone(u));
+            q.emplace(*vln_u);
+            node = Move(node) * std::move(vln_u);
+            node->parent = parent;
+            return;
+        }
+
+        case MathOperator::MATH_AND: {
+            throw std::runtime_error("can not apply diff for AND(&) operator");
+            return;
+        }
+        case MathOperator::MATH_OR: {
+            throw std::runtime_error("can not apply diff for OR(|) operator");
+            return;
+        }
+        case MathOperator::MATH_MOD: {
+            throw std::runtime_error("can not apply diff for MOD(%) operator");
+            return;
+        }
+        case MathOperator::MATH_LEFT_PARENTHESIS:
+        case MathOperator::MATH_RIGHT_PARENTHESIS:
+            assert(0 && "inner bug");
+            return;
+        default:
+            assert(0 && "inner bug");
+            return;
+        }
+    }
+};
+
+} // namespace internal
+
+namespace {
+
+inline Node DiffWithoutCache(Node &&node, const std::string &varname, int i) {
+    assert(i > 0);
+    auto n = std::move(node);
+    while (i--) {
+        internal::DiffFunctions::DiffOnce(n, varname);
+    }
+#ifndef NDEBUG
+    auto s = n->ToString();
+    n->CheckParent();
+#endif
+    Simplify(n);
+#ifndef NDEBUG
+    n->CheckParent();
+#endif
+    return n;
+}
 
-    if (Config::Get().throwOnInvalidValue == false) {
+template <typename F>
+inline Node DiffWithCache(const Node &node, const std::string &varname, int i, F &&getNode) {
+    FlatNode flat(node);
+    Node ret;
+    if (DiffCache::Get().Find(flat, varname, i, ret)) {
         return ret;
     }
 
-    bool isInvalid = (ret == std::numeric_limits<double>::infinity()) ||
-                     (ret == -std::numeric_limits<double>::infinity()) || (ret != ret);
-    if (isInvalid) {
-        // std::string info;
-        std::stringstream info;
-        info << "expression: \"";
-        switch (GetOperatorNum(op)) {
-        case 1:
-            info << MathOperatorToStr(op) << " " << ToString(v1);
-            break;
-        case 2:
-            info << ToString(v1) << " " << MathOperatorToStr(op) << " " << ToString(v2);
-            break;
-        default:
-            assert(0);
-        }
-        info << "\"";
-        throw MathError(ErrorType::ERROR_INVALID_NUMBER, info.str());
-    }
-
+    ret = DiffWithoutCache(getNode(), varname, i);
+    DiffCache::Get().Insert(std::move(flat), varname, i, ret);
     return ret;
 }
 
-} // namespace tomsolver
-
-namespace tomsolver {
-
-inline Mat::Mat(int rows, int cols, double initValue) noexcept : rows(rows), cols(cols), data(initValue, rows * cols) {
-    assert(rows > 0);
-    assert(cols > 0);
-}
-
-inline Mat::Mat(std::initializer_list<std::initializer_list<double>> init) noexcept {
-    rows = static_cast<int>(init.size());
-    assert(rows > 0);
-    cols = static_cast<int>(std::max(init, [](auto lhs, auto rhs) {
-                                return lhs.size() < rhs.size();
-                            }).size());
-    assert(cols > 0);
-    data.resize(rows * cols);
+} // namespace
 
-    auto i = 0;
-    for (auto values : init) {
-        Row(i++) = values;
+inline Node Diff(const Node &node, const std::string &varname, int i) {
+    if (Config::Get().diffCacheCapacity > 0) {
+        return DiffWithCache(node, varname, i, [&node] {
+            return Clone(node);
+        });
     }
+    return DiffWithoutCache(Clone(node), varname, i);
 }
 
-inline Mat::Mat(int rows, int cols, std::valarray<double> data) noexcept
-    : rows(rows), cols(cols), data(std::move(data)) {}
-
-inline std::slice_array<double> Mat::Row(int i, int offset) {
-    return data[std::slice(cols * i + offset, cols - offset, 1)];
+inline Node Diff(Node &&node, const std::string &varname, int i) {
+    if (Config::Get().diffCacheCapacity > 0) {
+        return DiffWithCache(node, varname, i, [&node] {
+            return Move(node);
+        });
+    }
+    return DiffWithoutCache(std::move(node), varname, i);
 }
 
-inline std::slice_array<double> Mat::Col(int j, int offset) {
-    return data[std::slice(j + offset * cols, rows - offset, cols)];
+inline DiffCache &DiffCache::Get() {
+    static DiffCache cache;
+    return cache;
 }
 
-inline auto Mat::Row(int i, int offset) const -> decltype(std::declval<const std::valarray<double>>()[(std::slice{})]) {
-    return data[std::slice(cols * i + offset, cols - offset, 1)];
+inline bool DiffCache::Find(const FlatNode &node, const std::string &varname, int i, Node &result) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto range = index.equal_range(MakeKey(node, varname, i));
+    for (auto it = range.first; it != range.second; ++it) {
+        auto &entry = *it->second;
+        if (entry.i == i && entry.varname == varname && entry.node == node) {
+            // 移到最前面
+            entries.splice(entries.begin(), entries, it->second);
+            result = entry.result.ToNode();
+            ++hits;
+            return true;
+        }
+    }
+    ++misses;
+    return false;
 }
 
-inline auto Mat::Col(int j, int offset) const -> decltype(std::declval<const std::valarray<double>>()[(std::slice{})]) {
-    return data[std::slice(j + offset * cols, rows - offset, cols)];
-}
+inline void DiffCache::Insert(FlatNode node, const std::string &varname, int i, const Node &result) {
+    auto capacity = Config::Get().diffCacheCapacity;
+    FlatNode flatResult(result);
+    auto count = node.Size() + flatResult.Size();
+    if (count > capacity) {
+        return;
+    }
 
-inline const double &Mat::Value(int i, int j) const {
-    return data[i * cols + j];
-}
+    std::lock_guard<std::mutex> lock(mutex);
 
-inline double &Mat::Value(int i, int j) {
-    return data[i * cols + j];
-}
+    auto key = MakeKey(node, varname, i);
+    auto range = index.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        auto &entry = *it->second;
+        if (entry.i == i && entry.varname == varname && entry.node == node) {
+            // 其他线程已经插入过了
+            return;
+        }
+    }
 
-inline bool Mat::operator==(double m) const noexcept {
-    return std::all_of(std::begin(data), std::end(data), [m](auto val) {
-        return std::abs(val - m) < Config::Get().epsilon;
-    });
-}
+    while (!entries.empty() && nodeCount + count > capacity) {
+        Erase(std::prev(entries.end()));
+    }
 
-inline bool Mat::operator==(const Mat &b) const noexcept {
-    assert(rows == b.rows);
-    assert(cols == b.cols);
-    return std::all_of(std::begin(data), std::end(data), [iter = std::begin(b.data)](auto val) mutable {
-        return std::abs(val - *iter++) < Config::Get().epsilon;
-    });
+    entries.push_front({std::move(node), varname, i, std::move(flatResult)});
+    index.emplace(key, entries.begin());
+    nodeCount += count;
 }
 
-// be negative
-inline Mat Mat::operator-() noexcept {
-    return {rows, cols, -data};
+inline void DiffCache::Clear() noexcept {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    index.clear();
+    nodeCount = 0;
+    hits = 0;
+    misses = 0;
 }
 
-inline Mat Mat::operator+(const Mat &b) const noexcept {
-    assert(rows == b.rows);
-    assert(cols == b.cols);
-    return {rows, cols, data + b.data};
+inline std::size_t DiffCache::Size() const noexcept {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
 }
 
-inline Mat &Mat::operator+=(const Mat &b) noexcept {
-    assert(rows == b.rows);
-    assert(cols == b.cols);
-    data += b.data;
-    return *this;
+inline std::size_t DiffCache::Hits() const noexcept {
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
 }
 
-inline Mat Mat::operator-(const Mat &b) const noexcept {
-    assert(rows == b.rows);
-    assert(cols == b.cols);
-    return {rows, cols, data - b.data};
+inline std::size_t DiffCache::Misses() const noexcept {
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
 }
 
-inline Mat Mat::operator*(double m) const noexcept {
-    return {rows, cols, data * m};
+inline std::uint64_t DiffCache::MakeKey(const FlatNode &node, const std::string &varname, int i) noexcept {
+    auto seed = internal::HashCombine(node.Hash(), static_cast<std::uint64_t>(i));
+    auto varnameHash = internal::HashSingleNode(NodeType::VARIABLE, MathOperator::MATH_NULL, 0, varname);
+    return internal::HashCombine(seed, varnameHash);
 }
 
-inline Mat Mat::operator*(const Mat &b) const noexcept {
-    assert(cols == b.rows);
-    Mat ans(rows, b.cols);
-    for (auto i = 0; i < rows; ++i) {
-        for (auto j = 0; j < b.cols; ++j) {
-            ans.Value(i, j) = (Row(i) * b.Col(j)).sum();
+inline void DiffCache::Erase(std::list<Entry>::iterator it) noexcept {
+    auto range = index.equal_range(MakeKey(it->node, it->varname, it->i));
+    for (auto indexIt = range.first; indexIt != range.second; ++indexIt) {
+        if (indexIt->second == it) {
+            index.erase(indexIt);
+            break;
         }
     }
-    return ans;
+    nodeCount -= it->node.Size() + it->result.Size();
+    entries.erase(it);
 }
 
-inline int Mat::Rows() const noexcept {
-    return rows;
-}
+} // namespace tomsolver
 
-inline int Mat::Cols() const noexcept {
-    return cols;
-}
+namespace tomsolver {
 
-inline Vec Mat::ToVec() const {
-    assert(rows > 0);
-    if (cols != 1) {
-        throw std::runtime_error("Mat::ToVec fail. rows is not one");
-    }
-    Vec v(rows);
-    v.cols = 1;
-    v.data = data;
-    return v;
-}
+/**
+ * 参数扫描得到的解曲线上的一个点。
+ */
+struct SweepPoint {
+    double parameter;   // 参数的值
+    VarsTable solution; // 该参数下的解
+    int iterations;     // 从预测值出发的Newton校正次数，起点为冷启动的迭代次数
+    bool turningPoint;  // 在上一个点与此点之间雅可比矩阵的行列式变号，或者曲线在此点之后折回
+};
 
-inline Mat &Mat::SwapRow(int i, int j) noexcept {
-    if (i == j) {
-        return *this;
-    }
-    assert(i >= 0);
-    assert(i < rows);
-    assert(j >= 0);
-    assert(j < rows);
+/**
+ * 参数扫描的结果。
+ */
+struct SweepResult {
+    std::vector<SweepPoint> points; // 解曲线，按参数从begin到end的顺序排列，第一个点的参数为begin
+    bool completed = false;         // 是否到达了end。遇到转向点（折点）时停在折点附近
+};
 
-    std::valarray<double> temp = Row(i);
-    Row(i) = Row(j);
-    Row(j) = temp;
+/**
+ * 以自然参数延拓法沿参数parameter从begin扫描到end，依次求解方程组system。
+ * system.vars必须是varsTable的变量再加上parameter（放在最后），即system.jacobian的最后一列为对参数的偏导数。
+ * 先以varsTable为初值在begin处求解，之后每一步以上一个解沿切线dx/dp = -Jx^(-1) * Jp外推的值为初值做Newton校正，
+ * 校正很快收敛时加大步长，不收敛时减半步长。步长见Config::Get().sweepInitialStep等，以|end - begin|为单位。
+ * 步长小于Config::Get().sweepMinStep仍不收敛，或者雅可比矩阵奇异时，认为到达了转向点，在此结束扫描。
+ * @exception runtime_error 变量不一致，方程数量与未知量数量不同，或者在begin处求解失败
+ */
+inline SweepResult SolveSweep(const PreparedSystem &system, const std::string &parameter, double begin, double end,
+                       const VarsTable &varsTable);
 
-    return *this;
-}
+/**
+ * 扫描方程组equations。先以Prepare()预处理（变量为varsTable的变量再加上parameter），其余同上。
+ */
+inline SweepResult SolveSweep(const SymVec &equations, const std::string &parameter, double begin, double end,
+                       const VarsTable &varsTable);
 
-inline Mat &Mat::SwapCol(int i, int j) noexcept {
-    if (i == j) {
-        return *this;
-    }
-    assert(i >= 0);
-    assert(i < cols);
-    assert(j >= 0);
-    assert(j < cols);
+} // namespace tomsolver
 
-    std::valarray<double> t = Col(i);
-    Col(i) = Col(j);
-    Col(j) = t;
+namespace tomsolver {
 
-    return *this;
-}
+/**
+ * 编译后的符号矩阵。
+ * 所有元素按后序遍历的顺序编译为一段连续的逆波兰指令流，变量在编译时绑定为vars中的下标。
+ * 构造完成后不可修改，所有求值函数都是const的，不修改任何共享状态。
+ * 因此多个线程可以同时对同一个CompiledSymMat求值，只需要各自持有一个Workspace，不必再为每个线程Clone一份SymMat。
+ */
+class CompiledSymMat {
+public:
+    /**
+     * 指令的类型。除了与Node一一对应的指令外，编译时还会做以下强度削减：
+     *   x^2 -> SQUARE，x^n（n为绝对值不超过64的整数）-> POWI，以连乘代替std::pow；
+     *   x^-1 -> RECIPROCAL，x^0.5 -> sqrt(x)；
+     *   同一个元素内参数相同的sin(u)与cos(u) -> SINCOS + LOAD，只计算一次u，并同时得到两个结果。
+     */
+    enum class OpCode : std::uint8_t {
+        NUMBER,     // 压入value
+        VARIABLE,   // 压入x[index]
+        UNARY,      // 栈顶 = op(栈顶)
+        BINARY,     // 弹出右操作数，栈顶 = op(栈顶, 右操作数)
+        SQUARE,     // 栈顶 = 栈顶*栈顶
+        POWI,       // 栈顶 = 栈顶^value，value为整数
+        RECIPROCAL, // 栈顶 = 1/栈顶
+        SINCOS,     // 同时计算栈顶的sin与cos，op指定的结果留在栈顶，另一个存入slots[index]
+        LOAD,       // 压入slots[index]
+    };
 
-inline std::string Mat::ToString() const noexcept {
-    if (data.size() == 0) {
-        return "[]";
-    }
+    /**
+     * 单条指令。
+     */
+    struct Instruction {
+        OpCode code;
+        MathOperator op;
+        std::uint32_t index; // 变量在vars中的下标，或者slots的下标
+        double value;        // 数值，或者POWI的指数
+    };
+
+    /**
+     * 求值时使用的临时空间。每个线程各自持有一个，可以在多次求值之间复用，避免重复分配内存。
+     * T为求值使用的标量类型。
+     */
+    template <typename T>
+    class BasicWorkspace {
+    private:
+        std::vector<T> stk;
+        std::vector<T> slots;
+        std::vector<T> batch; // EvalBatch的求值栈与slots，每一项是一组点的值
+
+        friend class CompiledSymMat;
+    };
+
+    using Workspace = BasicWorkspace<double>;
+
+    /**
+     * 编译符号矩阵mat，并把变量绑定为vars中的下标。非递归实现。
+     * Config::Get().optimizeBeforeCompile为true时，先对每个元素调用Optimize()。
+     * @exception runtime_error mat中出现了vars以外的变量
+     */
+    CompiledSymMat(const SymMat &mat, const std::vector<std::string> &vars);
+
+    int Rows() const noexcept;
+
+    int Cols() const noexcept;
+
+    /**
+     * 编译时绑定的变量名。求值时传入的数值按此顺序排列。
+     */
+    const std::vector<std::string> &Vars() const noexcept;
+
+    /**
+     * 指令总数。
+     */
+    std::size_t Size() const noexcept;
+
+    /**
+     * 所有元素的指令流。
+     */
+    const std::vector<Instruction> &Code() const noexcept;
+
+    /**
+     * 第i个元素（行优先）的指令为Code()中的[Offsets()[i], Offsets()[i+1])。
+     */
+    const std::vector<std::uint32_t> &Offsets() const noexcept;
+
+    /**
+     * 求值。x按Vars()的顺序存放变量的值，结果按行优先的顺序写入out，out的长度至少为Rows()*Cols()。
+     * 不修改自身，可以在多个线程中以各自的ws同时调用。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    void Eval(const double *x, double *out, Workspace &ws) const;
+
+    /**
+     * 以标量类型T（float、double、long double）求值，中间结果全程保持T的精度。表达式中的数值保存为double，求值时转换为T。
+     * 其余同Eval()。Eval(x, out, ws)即EvalAs<double>(x, out, ws)。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    template <typename T>
+    void EvalAs(const T *x, T *out, BasicWorkspace<T> &ws) const;
+
+    /**
+     * 求值。x的长度必须等于Vars().size()。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    Mat Eval(const Vec &x, Workspace &ws) const;
+
+    /**
+     * 求值。每次调用都会新建一个Workspace。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    Mat Eval(const Vec &x) const;
+
+    /**
+     * 对n个点批量求值。x按变量存放，第j个变量在第p个点的值为x[j*n+p]；结果按元素存放，第i个元素（行优先）在第p个点的值写入out[i*n+p]。
+     * 每条指令一次处理一组点，超越函数使用BatchCalc()的向量化实现，因此结果与Eval()可能有若干ULP的差别。
+     * 只检查每个元素的最终结果：出现浮点数无效值时，对该点重新调用Eval()，由Eval()决定是否抛出异常。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    void EvalBatch(const double *x, std::size_t n, double *out, Workspace &ws) const;
+
+    /**
+     * 批量求值。points为Vars().size()行n列的矩阵，每一列是一个点。
+     * 返回Rows()*Cols()行n列的矩阵，第i行是第i个元素（行优先）在每个点的值。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    Mat EvalBatch(const Mat &points, Workspace &ws) const;
+
+    /**
+     * 批量求值。每次调用都会新建一个Workspace。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    Mat EvalBatch(const Mat &points) const;
+
+private:
+    int rows, cols;
+    std::vector<std::string> vars;
+    std::vector<Instruction> code;
+    std::vector<std::uint32_t> offsets; // 第i个元素的指令为code[offsets[i], offsets[i+1])
+    std::size_t maxDepth = 0;           // 求值栈的最大深度
+    std::size_t slotNum = 0;            // SINCOS暂存结果所需的空间
+
+    /**
+     * 编译单个元素，指令追加到code末尾。
+     */
+    void CompileElement(const internal::NodeImpl &root, const std::map<std::string, std::uint32_t> &varIds);
+};
+
+namespace internal {
+class CompiledExpressionBuilder;
+} // namespace internal
+
+/**
+ * 编译后的单个表达式，由ParseCompiled()直接从字符串生成，不经过Node。适合只需要求值的场合。
+ * 生成指令时做常量折叠（只由数值组成的子表达式直接算出结果）以及与CompiledSymMat相同的乘方强度削减。
+ * 变量按在表达式中首次出现的顺序编号。
+ * 求值栈的大小固定：最大深度不超过StackSize时，栈直接开在调用者的栈帧上，求值过程不分配内存。
+ * 构造完成后不可修改，多个线程可以同时求值。
+ */
+class CompiledExpression {
+public:
+    static constexpr std::size_t StackSize = 32;
+
+    /**
+     * 变量名。求值时传入的数值按此顺序排列。
+     */
+    const std::vector<std::string> &Vars() const noexcept;
+
+    /**
+     * 指令总数。
+     */
+    std::size_t Size() const noexcept;
+
+    const std::vector<CompiledSymMat::Instruction> &Code() const noexcept;
+
+    /**
+     * 求值。x按Vars()的顺序存放变量的值。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    double Eval(const double *x) const;
+
+    /**
+     * 求值。x的长度必须等于Vars().size()。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    double Eval(const Vec &x) const;
 
-    std::stringstream ss;
-    ss << "[";
+private:
+    std::vector<std::string> vars;
+    std::vector<CompiledSymMat::Instruction> code;
+    std::size_t maxDepth = 0;
 
-    size_t i = 0;
-    for (auto val : data) {
-        ss << (i == 0 ? "" : " ") << tomsolver::ToString(val);
-        i++;
-        ss << (i % cols == 0 ? (i == data.size() ? "]" : "\n") : ", ");
-    }
+    friend class internal::CompiledExpressionBuilder;
+};
 
-    return ss.str();
-}
+namespace internal {
 
-inline void Mat::Resize(int newRows, int newCols) noexcept {
-    assert(newRows > 0 && newCols > 0);
-    auto temp = std::move(data);
-    data.resize(newRows * newCols);
-    auto minRows = std::min<size_t>(rows, newRows);
-    auto minCols = std::min<size_t>(cols, newCols);
-    data[std::gslice(0, {minRows, minCols}, {static_cast<size_t>(newCols), 1})] =
-        temp[std::gslice(0, {minRows, minCols}, {static_cast<size_t>(cols), 1})];
-    rows = newRows;
-    cols = newCols;
-}
+/**
+ * 按后序逐个追加节点，生成CompiledExpression的指令。供解析器使用，接口与FlatNodeBuilder相同。
+ * 每个Handle是子表达式第一条指令的下标。
+ */
+class CompiledExpressionBuilder {
+public:
+    using Handle = std::uint32_t;
 
-inline Mat &Mat::Zero() noexcept {
-    data = 0;
-    return *this;
-}
+    Handle Number(double value) noexcept;
 
-inline Mat &Mat::Ones() noexcept {
-    assert(rows == cols);
-    Zero();
-    data[std::slice(0, rows, cols + 1)] = 1;
-    return *this;
-}
+    Handle Variable(const char *name, std::size_t len) noexcept;
 
-inline double Mat::Norm2() const noexcept {
-    return (data * data).sum();
-}
+    Handle Unary(MathOperator op, Handle operand) noexcept;
 
-inline double Mat::NormInfinity() const noexcept {
-    return std::abs(data).max();
-}
+    Handle Binary(MathOperator op, Handle left, Handle right) noexcept;
 
-inline double Mat::NormNegInfinity() const noexcept {
-    return std::abs(data).min();
-}
+    CompiledExpression Finish(Handle root) noexcept;
 
-inline double Mat::Min() const noexcept {
-    return data.min();
-}
+private:
+    CompiledExpression expr;
+    std::unordered_map<std::string, std::uint32_t> varIds;
 
-inline void Mat::SetValue(double value) noexcept {
-    data = value;
-}
+    /**
+     * 子表达式是否只有一条NUMBER指令。h必须是最后一个子表达式。
+     */
+    bool IsNumber(Handle h) const noexcept;
+};
 
-inline bool Mat::PositiveDetermine() const noexcept {
-    assert(rows == cols);
-    for (int i = 1; i <= rows; ++i) {
-        if (Det(*this, i) <= 0) {
-            return false;
+/**
+ * 以平方求幂的方式计算base^exponent，只用到乘法（负指数时多一次除法）。
+ */
+template <typename T>
+inline T IntegerPower(T base, int exponent) noexcept {
+    T ret = 1;
+    for (auto n = std::abs(exponent); n; n >>= 1) {
+        if (n & 1) {
+            ret *= base;
         }
+        base *= base;
     }
-    return true;
+    return exponent < 0 ? 1 / ret : ret;
 }
 
-inline Mat Mat::Transpose() const noexcept {
-    Mat ans(cols, rows);
-    for (auto i = 0; i < cols; i++) {
-        ans.Row(i) = Col(i);
+/**
+ * 逆波兰指令流[inst, end)的解释器，返回指令流的结果。CompiledSymMat与CompiledExpression共用。
+ * stk至少要容纳指令流的最大栈深度，slots至少要容纳SINCOS用到的下标。
+ * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+ */
+template <typename T>
+inline T Interpret(const CompiledSymMat::Instruction *inst, const CompiledSymMat::Instruction *end, const T *x, T *stk,
+            T *slots) {
+    using OpCode = CompiledSymMat::OpCode;
+    constexpr auto nan = std::numeric_limits<T>::quiet_NaN();
+
+    // 削减后的指令不经过CalcAs。结果不是有限值时，再交给CalcAs按原运算计算一次，
+    // 以保持与Node::Vpa()相同的无效值处理（抛出MathError或者原样返回）
+    // top指向栈顶的下一个位置
+    auto top = stk;
+    for (; inst != end; ++inst) {
+        switch (inst->code) {
+        case OpCode::NUMBER:
+            *top++ = static_cast<T>(inst->value);
+            break;
+        case OpCode::VARIABLE:
+            *top++ = x[inst->index];
+            break;
+        case OpCode::UNARY:
+            top[-1] = CalcAs<T>(inst->op, top[-1], nan);
+            break;
+        case OpCode::BINARY:
+            --top;
+            top[-1] = CalcAs<T>(inst->op, top[-1], top[0]);
+            break;
+        case OpCode::SQUARE: {
+            auto v = top[-1];
+            auto r = v * v;
+            top[-1] = std::isfinite(r) ? r : CalcAs<T>(MathOperator::MATH_POWER, v, 2);
+            break;
+        }
+        case OpCode::POWI: {
+            auto v = top[-1];
+            auto r = IntegerPower(v, static_cast<int>(inst->value));
+            top[-1] = std::isfinite(r) ? r : CalcAs<T>(MathOperator::MATH_POWER, v, static_cast<T>(inst->value));
+            break;
+        }
+        case OpCode::RECIPROCAL: {
+            auto v = top[-1];
+            auto r = 1 / v;
+            top[-1] = std::isfinite(r) ? r : CalcAs<T>(MathOperator::MATH_DIVIDE, 1, v);
+            break;
+        }
+        case OpCode::SINCOS: {
+            auto v = top[-1];
+            if (!std::isfinite(v)) {
+                v = CalcAs<T>(inst->op, v, nan);
+            }
+            // 参数相同的sin与cos相邻计算，编译器可以合并为一次sincos调用
+            auto s = std::sin(v);
+            auto c = std::cos(v);
+            top[-1] = inst->op == MathOperator::MATH_SIN ? s : c;
+            slots[inst->index] = inst->op == MathOperator::MATH_SIN ? c : s;
+            break;
+        }
+        case OpCode::LOAD:
+            *top++ = slots[inst->index];
+            break;
+        }
     }
-    return ans;
+    assert(top == stk + 1);
+    return stk[0];
 }
 
-inline Mat Mat::Inverse() const {
-    assert(rows == cols);
-    int n = rows;
-    double det = Det(*this, n); // Determinant, 역행렬을 시킬 행렬의 행렬식을 구함
+} // namespace internal
 
-    if (std::abs(det) <= Config::Get().epsilon) // 0일때는 예외처리 (역행렬을 구할 수 없기 때문.)
-    {
-        throw MathError(ErrorType::ERROR_SINGULAR_MATRIX);
+template <typename T>
+inline void CompiledSymMat::EvalAs(const T *x, T *out, BasicWorkspace<T> &ws) const {
+    if (ws.stk.size() < maxDepth) {
+        ws.stk.resize(maxDepth);
+    }
+    if (ws.slots.size() < slotNum) {
+        ws.slots.resize(slotNum);
     }
 
-    Mat adj(n, n); // 딸림행렬 선언
-
-    Adjoint(*this, adj); // 딸림행렬 초기화
-
-    return {n, n, adj.data / det};
-}
-
-inline Mat operator*(double k, const Mat &mat) noexcept {
-    Mat ans(mat);
-    ans.data *= k;
-    return ans;
+    auto begin = code.data();
+    for (std::size_t i = 0; i + 1 < offsets.size(); ++i) {
+        out[i] = internal::Interpret(begin + offsets[i], begin + offsets[i + 1], x, ws.stk.data(), ws.slots.data());
+    }
 }
 
-inline Mat EachDivide(const Mat &a, const Mat &b) noexcept {
-    assert(a.rows == b.rows);
-    assert(a.cols == b.cols);
-    return {a.rows, b.cols, b.data / b.data};
-}
+} // namespace tomsolver
 
-inline bool IsZero(const Mat &mat) noexcept {
-    return std::all_of(std::begin(mat.data), std::end(mat.data), [](auto val) {
-        return std::abs(val) <= Config::Get().epsilon;
-    });
-}
+namespace tomsolver {
 
-inline bool AllIsLessThan(const Mat &v1, const Mat &v2) noexcept {
-    assert(v1.rows == v2.rows && v1.cols == v2.cols);
-    return std::all_of(std::begin(v1.data), std::end(v1.data), [iter = std::begin(v2.data)](auto val) mutable {
-        return val < *iter++;
-    });
-}
+namespace {
 
-inline int GetMaxAbsRowIndex(const Mat &A, int rowStart, int rowEnd, int col) noexcept {
-    std::valarray<double> temp = std::abs<double>(A.Col(col)[std::slice(rowStart, rowEnd - rowStart + 1, 1)]);
-    auto ret = std::distance(std::begin(temp), std::find(std::begin(temp), std::end(temp), temp.max())) + rowStart;
-    return static_cast<int>(ret);
+// 乘方x^exponent是否可以改写为乘除或者开方
+inline bool CanReducePower(double exponent) noexcept {
+    return exponent == 0.5 || (std::trunc(exponent) == exponent && std::abs(exponent) <= 64);
 }
 
-inline void Adjoint(const Mat &A, Mat &adj) noexcept // 딸림행렬, 수반행렬
-{
-    if (A.rows == 1) // 예외처리
-    {
-        adj.Value(0, 0) = 1;
-        return;
+// 常量折叠：计算结果不是有限值时不折叠，留到求值时再按Config处理无效值
+inline bool FoldConstant(MathOperator op, double v1, double v2, double &result) noexcept {
+    try {
+        result = Calc(op, v1, v2);
+    } catch (const MathError &) {
+        return false;
     }
+    return std::isfinite(result);
+}
 
-    Mat cofactor(A.rows - 1, A.cols - 1);
-
-    for (int i = 0; i < A.rows; i++) {
-        for (int j = 0; j < A.cols; j++) {
-            GetCofactor(A, cofactor, i, j, A.rows); // 여인수 구하기, 단 i, j값으로 되기에 temp는 항상 바뀐다.
+} // namespace
 
-            auto det = (Det(cofactor, A.rows - 1));
+inline CompiledSymMat::CompiledSymMat(const SymMat &mat, const std::vector<std::string> &vars)
+    : rows(mat.Rows()), cols(mat.Cols()), vars(vars) {
+    std::map<std::string, std::uint32_t> varIds;
+    for (std::uint32_t i = 0; i < vars.size(); ++i) {
+        varIds.emplace(vars[i], i);
+    }
 
-            if ((i + j) % 2 != 0) {
-                det = -det; // +, -, + 형식으로 되는데, 0,0 좌표면 +, 0,1좌표면 -, 이렇게 된다.
+    offsets.reserve(rows * cols + 1);
+    offsets.emplace_back(0);
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < cols; ++j) {
+            if (Config::Get().optimizeBeforeCompile) {
+                CompileElement(*Optimize(mat.Value(i, j)), varIds);
+            } else {
+                CompileElement(*mat.Value(i, j), varIds);
             }
-
-            adj.Value(j, i) = det; // n - 1 X n - 1 은, 언제나 각 여인수 행렬 은
-                                   // 여인수를 따오는 행렬의 크기 - 1 이기 때문이다.
+            offsets.emplace_back(static_cast<std::uint32_t>(code.size()));
         }
     }
 }
 
-inline void GetCofactor(const Mat &A, Mat &cofactor, int p, int q,
-                        int n) noexcept // 여인수를 구해다주는 함수!
-{
-    /*
-         ┌───┄┄┄┄┄┄┄┄┬───┬┄┄┄┄┄┄┄┄───┐   size of region A = p * q
-    0 -> │           │   │           │                  B = p * (n - 1 - q)
-         ┆           ┆   ┆           ┆                  C = (n - 1 - p) * q
-         ┆     A     ┆   ┆     B     ┆                  D = (n - 1 - p) * (n - 1 - q)
-         ┆           ┆   ┆           ┆
-         ┆           ┆   ┆           ┆    left top of region
-         ├───┄┄┄┄┄┄┄┄┼───┼┄┄┄┄┄┄┄┄───┤   ╔════════╤════════════════╤══════════╗
-    p ─> │           │   │           │   ║ region │ origin matrix  │ cofactor ║
-         ├───┄┄┄┄┄┄┄┄┼───┼┄┄┄┄┄┄┄┄───┤   ╠════════╪════════════════╪══════════╣
-         ┆           ┆   ┆           ┆   ║ A      │ (0, 0)         │ (0, 0)   ║
-         ┆           ┆   ┆           ┆   ╟────────┼────────────────┼──────────╢
-         ┆     C     ┆   ┆     D     ┆   ║ B      │ (0, q + 1)     │ (0, q)   ║
-         ┆           ┆   ┆           ┆   ╟────────┼────────────────┼──────────╢
-         │           │   │           │   ║ C      │ (p + 1, 0)     │ (p, 0)   ║
-    n ─> └───┄┄┄┄┄┄┄┄┴───┴┄┄┄┄┄┄┄┄───┘   ╟────────┼────────────────┼──────────╢
-          ^            ^            ^    ║ D      │ (p + 1, q + 1) │ (p, q)   ║
-          0            q            n    ╚════════╧════════════════╧══════════╝
-    */
+// 后序遍历。非递归实现。
+inline void CompiledSymMat::CompileElement(const internal::NodeImpl &root,
+                                    const std::map<std::string, std::uint32_t> &varIds) {
+    // ==== Part I ====
+    // 借助一个栈，得到后序遍历序列items
+    std::vector<const internal::NodeImpl *> items;
+    std::stack<const internal::NodeImpl *> stk;
+    stk.emplace(&root);
+    while (!stk.empty()) {
+        auto cur = stk.top();
+        stk.pop();
+        items.emplace_back(cur);
+        if (cur->left) {
+            stk.emplace(cur->left.get());
+        }
+        if (cur->right) {
+            stk.emplace(cur->right.get());
+        }
+    }
+    std::reverse(items.begin(), items.end());
+
+    // 记下每个节点的左子节点、子树的起始位置和子树的哈希值。右子节点总是紧挨在父节点前面
+    auto n = items.size();
+    std::vector<std::size_t> lefts(n), firsts(n);
+    std::vector<std::uint64_t> hashes(n);
+    std::vector<std::size_t> operands;
+    for (std::size_t i = 0; i < n; ++i) {
+        auto &cur = *items[i];
+        auto hash = internal::HashSingleNode(cur.type, cur.op, cur.value, cur.varname);
+        firsts[i] = i;
+        if (cur.type == NodeType::OPERATOR) {
+            if (GetOperatorNum(cur.op) == 2) {
+                hash = internal::HashCombine(hash, hashes[operands.back()]);
+                operands.pop_back();
+            }
+            lefts[i] = operands.back();
+            operands.pop_back();
+            hash = internal::HashCombine(hash, hashes[lefts[i]]);
+            firsts[i] = firsts[lefts[i]];
+        }
+        hashes[i] = hash;
+        operands.emplace_back(i);
+    }
 
-    auto newIndex = [n = n - 1](int p, int q) -> size_t {
-        return p * n + q;
-    };
-    auto index = [n = A.cols](int p, int q) -> size_t {
-        return p * n + q;
-    };
-    auto makeValarray = [](int p, int q) {
-        return std::valarray<size_t>{static_cast<size_t>(p), static_cast<size_t>(q)};
+    // ==== Part II ====
+    // 强度削减。skipMarks是差分数组，累加后大于0的节点不生成指令
+    std::vector<int> skipMarks(n + 1, 0);
+    auto skip = [&skipMarks](std::size_t begin, std::size_t end) {
+        skipMarks[begin] += 1;
+        skipMarks[end] -= 1;
     };
-    auto newStride = makeValarray(n - 1, 1);
-    auto stride = makeValarray(A.cols, 1);
 
-    std::tuple<std::valarray<size_t>, size_t, size_t> config[] = {
-        {makeValarray(p, q), newIndex(0, 0), index(0, 0)},
-        {makeValarray(p, n - 1 - q), newIndex(0, q), index(0, q + 1)},
-        {makeValarray(n - 1 - p, q), newIndex(p, 0), index(p + 1, 0)},
-        {makeValarray(n - 1 - p, n - 1 - q), newIndex(p, q), index(p + 1, q + 1)},
-    };
+    // 把参数相同的sin、cos配对：先出现的一个用SINCOS同时算出两个结果，后出现的一个直接LOAD，不再计算参数
+    std::vector<std::uint32_t> storeSlots(n, 0), loadSlots(n, 0);
+    std::vector<bool> isStore(n, false), isLoad(n, false);
+    std::unordered_multimap<std::uint64_t, std::size_t> pending; // 尚未配对的sin、cos，以参数的哈希值为键
+    std::uint32_t slots = 0;
+    for (std::size_t j = 0; j < n; ++j) {
+        auto &cur = *items[j];
+        if (cur.type != NodeType::OPERATOR || (cur.op != MathOperator::MATH_SIN && cur.op != MathOperator::MATH_COS)) {
+            continue;
+        }
 
-    for (const auto &conf : config) {
-        const auto &size = std::get<0>(conf);
-        const auto &newStart = std::get<1>(conf);
-        const auto &start = std::get<2>(conf);
-        if (newStart < cofactor.data.size()) {
-            cofactor.data[std::gslice(newStart, size, newStride)] = A.data[std::gslice(start, size, stride)];
+        auto partner = cur.op == MathOperator::MATH_SIN ? MathOperator::MATH_COS : MathOperator::MATH_SIN;
+        auto range = pending.equal_range(hashes[lefts[j]]);
+        auto itor = std::find_if(range.first, range.second, [&](const std::pair<const std::uint64_t, std::size_t> &pr) {
+            return items[pr.second]->op == partner && items[pr.second]->left->Equal(cur.left);
+        });
+        if (itor == range.second) {
+            pending.emplace(hashes[lefts[j]], j);
+            continue;
         }
-    }
-}
 
-inline double Det(const Mat &A, int n) noexcept {
-    if (n == 0) {
-        return 0;
-    }
+        auto i = itor->second;
+        pending.erase(itor);
+        isStore[i] = isLoad[j] = true;
+        storeSlots[i] = loadSlots[j] = slots++;
 
-    if (n == 1) {
-        return A.Value(0, 0);
+        // j的参数不再计算，其中尚未配对的sin、cos也不能再参与配对
+        skip(firsts[j], j);
+        for (auto p = pending.begin(); p != pending.end();) {
+            p = p->second >= firsts[j] && p->second < j ? pending.erase(p) : std::next(p);
+        }
     }
-
-    if (n == 2) // 계산 압축
-    {
-        return A.Value(0, 0) * A.Value(1, 1) - A.Value(1, 0) * A.Value(0, 1);
+    slotNum = std::max<std::size_t>(slotNum, slots);
+
+    // 指数为数值的乘方，指数本身不再压栈
+    for (std::size_t i = 0; i < n; ++i) {
+        auto &cur = *items[i];
+        if (cur.type == NodeType::OPERATOR && cur.op == MathOperator::MATH_POWER &&
+            items[i - 1]->type == NodeType::NUMBER && CanReducePower(items[i - 1]->value)) {
+            skip(i - 1, i);
+        }
     }
 
-    Mat cofactor(n - 1, n - 1); // n X n 행렬의 여인수를 담을 임시 행렬
-
-    double D = 0; // D = 한 행렬의 Determinant값
-
-    int sign = 1; // sign = +, -, +, -.... 형태로 지속되는 결과값에 영향을 주는 정수
-
-    for (int f = 0; f < n; f++) {
-        GetCofactor(A, cofactor, 0, f, n); // 0으로 고정시킨 이유는, 수학 공식 상 Determinant (행렬식)은 n개의 열 중
-        // 아무거나 잡아도 결과값은 모두 일치하기 때문
-        auto det = Det(cofactor, n - 1);
-        auto v = A.Value(0, f);
-        D += sign * v * det; // 재귀 형식으로 돌아간다. f는 n X n 중 정수 n을 향해 간다.
+    // ==== Part III ====
+    // 生成指令，同时统计求值栈的深度
+    int skipping = 0;
+    std::size_t depth = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        skipping += skipMarks[i];
+        if (skipping > 0) {
+            continue;
+        }
 
-        sign = -sign; // +, -, +, -... 형식으로 되기 때문에 반대로 만들어준다.
+        auto &cur = *items[i];
+        Instruction inst{OpCode::NUMBER, cur.op, 0, 0};
+        switch (cur.type) {
+        case NodeType::NUMBER:
+            inst.value = cur.value;
+            ++depth;
+            break;
+        case NodeType::VARIABLE: {
+            auto itor = varIds.find(cur.varname);
+            if (itor == varIds.end()) {
+                throw std::runtime_error("CompiledSymMat: unbound variable: " + cur.varname);
+            }
+            inst.code = OpCode::VARIABLE;
+            inst.index = itor->second;
+            ++depth;
+            break;
+        }
+        case NodeType::OPERATOR:
+            if (isLoad[i]) {
+                inst.code = OpCode::LOAD;
+                inst.index = loadSlots[i];
+                ++depth;
+            } else if (isStore[i]) {
+                inst.code = OpCode::SINCOS;
+                inst.index = storeSlots[i];
+            } else if (cur.op == MathOperator::MATH_POWER && items[i - 1]->type == NodeType::NUMBER &&
+                       CanReducePower(items[i - 1]->value)) {
+                auto exponent = items[i - 1]->value;
+                if (exponent == 2) {
+                    inst.code = OpCode::SQUARE;
+                } else if (exponent == -1) {
+                    inst.code = OpCode::RECIPROCAL;
+                } else if (exponent == 0.5) {
+                    inst.code = OpCode::UNARY;
+                    inst.op = MathOperator::MATH_SQRT;
+                } else {
+                    inst.code = OpCode::POWI;
+                    inst.value = exponent;
+                }
+            } else if (GetOperatorNum(cur.op) == 2) {
+                inst.code = OpCode::BINARY;
+                --depth;
+            } else {
+                inst.code = OpCode::UNARY;
+            }
+            break;
+        }
+        maxDepth = std::max(maxDepth, depth);
+        code.emplace_back(inst);
     }
+    assert(depth == 1);
+}
 
-    return D; // 마지막엔 n X n 행렬의 Determinant를 리턴해준다.
+inline int CompiledSymMat::Rows() const noexcept {
+    return rows;
 }
 
-inline Vec::Vec(int rows, double initValue) noexcept : Mat(rows, 1, initValue) {}
+inline int CompiledSymMat::Cols() const noexcept {
+    return cols;
+}
 
-inline Vec::Vec(std::initializer_list<double> init) noexcept : Vec(std::valarray<double>{init}) {}
+inline const std::vector<std::string> &CompiledSymMat::Vars() const noexcept {
+    return vars;
+}
 
-inline Vec::Vec(std::valarray<double> init) noexcept : Vec(static_cast<int>(init.size())) {
-    data = std::move(init);
+inline std::size_t CompiledSymMat::Size() const noexcept {
+    return code.size();
 }
 
-inline Mat &Vec::AsMat() noexcept {
-    return *this;
+inline const std::vector<CompiledSymMat::Instruction> &CompiledSymMat::Code() const noexcept {
+    return code;
 }
 
-inline void Vec::Resize(int newRows) noexcept {
-    assert(newRows > 0);
-    Mat::Resize(newRows, 1);
+inline const std::vector<std::uint32_t> &CompiledSymMat::Offsets() const noexcept {
+    return offsets;
 }
 
-inline double &Vec::operator[](std::size_t i) noexcept {
-    return data[i];
+inline void CompiledSymMat::Eval(const double *x, double *out, Workspace &ws) const {
+    EvalAs<double>(x, out, ws);
 }
 
-inline double Vec::operator[](std::size_t i) const noexcept {
-    return data[i];
+inline Mat CompiledSymMat::Eval(const Vec &x, Workspace &ws) const {
+    assert(x.Rows() == static_cast<int>(vars.size()));
+    Mat ret(rows, cols);
+    Eval(vars.empty() ? nullptr : &x.Value(0, 0), &ret.Value(0, 0), ws);
+    return ret;
 }
 
-inline Vec Vec::operator+(const Vec &b) const noexcept {
-    assert(rows == b.rows);
-    assert(cols == 1 && b.cols == 1);
-    return {data + b.data};
+inline Mat CompiledSymMat::Eval(const Vec &x) const {
+    Workspace ws;
+    return Eval(x, ws);
+}
+
+inline void CompiledSymMat::EvalBatch(const double *x, std::size_t n, double *out, Workspace &ws) const {
+    // 每次处理block个点，求值栈的每一层是连续的block个值。第0层空着不用，栈顶的下一层总是有效的位置
+    constexpr std::size_t block = 256;
+    ws.batch.resize((maxDepth + 1 + slotNum) * block);
+    auto stk = ws.batch.data() + block;
+    auto slots = stk + maxDepth * block;
+
+    std::vector<double> point(vars.size()), result(offsets.size() - 1);
+    auto begin = code.data();
+    for (std::size_t p0 = 0; p0 < n; p0 += block) {
+        auto m = std::min(block, n - p0);
+        for (std::size_t i = 0; i + 1 < offsets.size(); ++i) {
+            // top指向栈顶的下一层
+            auto top = stk;
+            for (auto inst = begin + offsets[i], end = begin + offsets[i + 1]; inst != end; ++inst) {
+                auto v = top - block; // 栈顶
+                switch (inst->code) {
+                case OpCode::NUMBER:
+                    std::fill(top, top + m, inst->value);
+                    top += block;
+                    break;
+                case OpCode::VARIABLE:
+                    std::copy(x + inst->index * n + p0, x + inst->index * n + p0 + m, top);
+                    top += block;
+                    break;
+                case OpCode::UNARY:
+                    BatchCalc(inst->op, v, v, m);
+                    break;
+                case OpCode::BINARY: {
+                    top -= block;
+                    auto l = top - block, r = top;
+                    switch (inst->op) {
+                    case MathOperator::MATH_ADD:
+                        for (std::size_t k = 0; k < m; ++k) {
+                            l[k] += r[k];
+                        }
+                        break;
+                    case MathOperator::MATH_SUB:
+                        for (std::size_t k = 0; k < m; ++k) {
+                            l[k] -= r[k];
+                        }
+                        break;
+                    case MathOperator::MATH_MULTIPLY:
+                        for (std::size_t k = 0; k < m; ++k) {
+                            l[k] *= r[k];
+                        }
+                        break;
+                    case MathOperator::MATH_DIVIDE:
+                        for (std::size_t k = 0; k < m; ++k) {
+                            l[k] /= r[k];
+                        }
+                        break;
+                    case MathOperator::MATH_POWER:
+                        for (std::size_t k = 0; k < m; ++k) {
+                            l[k] = std::pow(l[k], r[k]);
+                        }
+                        break;
+                    default:
+                        for (std::size_t k = 0; k < m; ++k) {
+                            l[k] = tomsolver::Calc(inst->op, l[k], r[k]);
+                        }
+                        break;
+                    }
+                    break;
+                }
+                case OpCode::SQUARE:
+                    for (std::size_t k = 0; k < m; ++k) {
+                        v[k] *= v[k];
+                    }
+                    break;
+                case OpCode::POWI:
+                    for (std::size_t k = 0; k < m; ++k) {
+                        v[k] = internal::IntegerPower(v[k], static_cast<int>(inst->value));
+                    }
+                    break;
+                case OpCode::RECIPROCAL:
+                    for (std::size_t k = 0; k < m; ++k) {
+                        v[k] = 1 / v[k];
+                    }
+                    break;
+                case OpCode::SINCOS: {
+                    auto slot = slots + inst->index * block;
+                    if (inst->op == MathOperator::MATH_SIN) {
+                        BatchSinCos(v, v, slot, m);
+                    } else {
+                        BatchSinCos(v, slot, v, m);
+                    }
+                    break;
+                }
+                case OpCode::LOAD: {
+                    auto slot = slots + inst->index * block;
+                    std::copy(slot, slot + m, top);
+                    top += block;
+                    break;
+                }
+                }
+            }
+            assert(top == stk + block);
+            std::copy(stk, stk + m, out + i * n + p0);
+        }
+
+        if (!Config::Get().throwOnInvalidValue) {
+            continue;
+        }
+
+        // 出现无效值的点交给Eval()，与逐点求值的行为保持一致
+        for (std::size_t p = p0; p < p0 + m; ++p) {
+            bool valid = true;
+            for (std::size_t i = 0; i < result.size(); ++i) {
+                valid = valid && std::isfinite(out[i * n + p]);
+            }
+            if (valid) {
+                continue;
+            }
+            for (std::size_t j = 0; j < vars.size(); ++j) {
+                point[j] = x[j * n + p];
+            }
+            Eval(point.data(), result.data(), ws);
+            for (std::size_t i = 0; i < result.size(); ++i) {
+                out[i * n + p] = result[i];
+            }
+        }
+    }
 }
 
-inline Vec Vec::operator-() noexcept {
-    return {-data};
+inline Mat CompiledSymMat::EvalBatch(const Mat &points, Workspace &ws) const {
+    assert(points.Rows() == static_cast<int>(vars.size()));
+    auto n = static_cast<std::size_t>(points.Cols());
+    Mat ret(rows * cols, points.Cols());
+    EvalBatch(vars.empty() ? nullptr : &points.Value(0, 0), n, &ret.Value(0, 0), ws);
+    return ret;
 }
 
-inline Vec Vec::operator-(const Vec &b) const noexcept {
-    assert(rows == b.rows);
-    return {data - b.data};
+inline Mat CompiledSymMat::EvalBatch(const Mat &points) const {
+    Workspace ws;
+    return EvalBatch(points, ws);
 }
 
-inline Vec Vec::operator*(double m) const noexcept {
-    return {data * m};
+inline const std::vector<std::string> &CompiledExpression::Vars() const noexcept {
+    return vars;
 }
 
-inline Vec Vec::operator*(const Vec &b) const noexcept {
-    assert(rows == b.rows);
-    return {data * b.data};
+inline std::size_t CompiledExpression::Size() const noexcept {
+    return code.size();
 }
 
-inline Vec Vec::operator/(const Vec &b) const noexcept {
-    assert(rows == b.rows);
-    return {data / b.data};
+inline const std::vector<CompiledSymMat::Instruction> &CompiledExpression::Code() const noexcept {
+    return code;
 }
 
-inline bool Vec::operator<(const Vec &b) noexcept {
-    assert(rows == b.rows);
-    return std::all_of(std::begin(data), std::end(data), [iter = std::begin(b.data)](auto val) mutable {
-        return val < *iter++;
-    });
+inline double CompiledExpression::Eval(const double *x) const {
+    if (maxDepth <= StackSize) {
+        double stk[StackSize];
+        return internal::Interpret(code.data(), code.data() + code.size(), x, stk, static_cast<double *>(nullptr));
+    }
+    std::vector<double> stk(maxDepth);
+    return internal::Interpret(code.data(), code.data() + code.size(), x, stk.data(), static_cast<double *>(nullptr));
 }
 
-inline Vec operator*(double k, const Vec &v) {
-    return {v.data * k};
+inline double CompiledExpression::Eval(const Vec &x) const {
+    assert(static_cast<std::size_t>(x.Rows()) == vars.size());
+    return Eval(vars.empty() ? nullptr : &x.Value(0, 0));
 }
 
-inline double Dot(const Vec &a, const Vec &b) noexcept {
-    assert(a.rows == b.rows);
-    return (a.data * b.data).sum();
+namespace internal {
+
+inline bool CompiledExpressionBuilder::IsNumber(Handle h) const noexcept {
+    return h + 1 == expr.code.size() && expr.code.back().code == CompiledSymMat::OpCode::NUMBER;
 }
 
-inline std::ostream &operator<<(std::ostream &out, const Mat &mat) noexcept {
-    return out << mat.ToString();
+inline CompiledExpressionBuilder::Handle CompiledExpressionBuilder::Number(double value) noexcept {
+    expr.code.push_back({CompiledSymMat::OpCode::NUMBER, MathOperator::MATH_NULL, 0, value});
+    return static_cast<Handle>(expr.code.size() - 1);
 }
 
-} // namespace tomsolver
+inline CompiledExpressionBuilder::Handle CompiledExpressionBuilder::Variable(const char *name, std::size_t len) noexcept {
+    auto ret = varIds.emplace(std::string(name, len), static_cast<std::uint32_t>(expr.vars.size()));
+    if (ret.second) {
+        expr.vars.emplace_back(ret.first->first);
+    }
+    expr.code.push_back({CompiledSymMat::OpCode::VARIABLE, MathOperator::MATH_NULL, ret.first->second, 0});
+    return static_cast<Handle>(expr.code.size() - 1);
+}
 
-namespace tomsolver {
+inline CompiledExpressionBuilder::Handle CompiledExpressionBuilder::Unary(MathOperator op, Handle operand) noexcept {
+    double result;
+    if (IsNumber(operand) && FoldConstant(op, expr.code.back().value, 0, result)) {
+        expr.code.back().value = result;
+        return operand;
+    }
 
-namespace {
-template <typename T>
-inline const T &asConst(T &a) {
-    return a;
+    // 正号不产生任何指令
+    if (op != MathOperator::MATH_POSITIVE) {
+        expr.code.push_back({CompiledSymMat::OpCode::UNARY, op, 0, 0});
+    }
+    return operand;
 }
-} // namespace
 
-inline Vec SolveLinear(Mat A, Vec b) {
-    int rows = A.Rows(); // 行数
-    int cols = rows;     // 列数=未知数个数
+inline CompiledExpressionBuilder::Handle CompiledExpressionBuilder::Binary(MathOperator op, Handle left,
+                                                                    Handle right) noexcept {
+    auto &code = expr.code;
+    if (IsNumber(right)) {
+        auto exponent = code.back().value;
 
-    int RankA = rows, RankAb = rows; // 初始值
+        double result;
+        if (right == left + 1 && code[left].code == CompiledSymMat::OpCode::NUMBER &&
+            FoldConstant(op, code[left].value, exponent, result)) {
+            code.pop_back();
+            code.back().value = result;
+            return left;
+        }
 
-    assert(rows == b.Rows()); // A行数不等于b行数
+        // 与CompiledSymMat相同的乘方强度削减，指数本身不再压栈
+        if (op == MathOperator::MATH_POWER && CanReducePower(exponent)) {
+            code.pop_back();
+            if (exponent == 2) {
+                code.push_back({CompiledSymMat::OpCode::SQUARE, op, 0, 0});
+            } else if (exponent == -1) {
+                code.push_back({CompiledSymMat::OpCode::RECIPROCAL, op, 0, 0});
+            } else if (exponent == 0.5) {
+                code.push_back({CompiledSymMat::OpCode::UNARY, MathOperator::MATH_SQRT, 0, 0});
+            } else {
+                code.push_back({CompiledSymMat::OpCode::POWI, op, 0, exponent});
+            }
+            return left;
+        }
+    }
 
-    Vec ret(rows);
+    code.push_back({CompiledSymMat::OpCode::BINARY, op, 0, 0});
+    return left;
+}
 
-    if (rows > 0) {
-        cols = A.Cols();
-    }
-    if (cols != rows) // 不是方阵
-    {
-        if (rows > cols) {
-            // 过定义方程组
-            throw MathError(ErrorType::ERROR_OVER_DETERMINED_EQUATIONS);
-        } else {
-            // 不定方程组
-            ret.Resize(cols);
+inline CompiledExpression CompiledExpressionBuilder::Finish(Handle root) noexcept {
+    assert(root == 0);
+    (void)root;
+
+    // 统计求值栈的最大深度
+    std::size_t depth = 0;
+    for (auto &inst : expr.code) {
+        switch (inst.code) {
+        case CompiledSymMat::OpCode::NUMBER:
+        case CompiledSymMat::OpCode::VARIABLE:
+        case CompiledSymMat::OpCode::LOAD:
+            ++depth;
+            break;
+        case CompiledSymMat::OpCode::BINARY:
+            --depth;
+            break;
+        default:
+            break;
         }
+        expr.maxDepth = std::max(expr.maxDepth, depth);
     }
+    assert(depth == 1);
 
-    std::vector<int> TrueRowNumber(cols);
+    varIds.clear();
+    return std::move(expr);
+}
 
-    // 列主元消元法
-    for (auto y = 0, x = 0; y < rows && x < cols; y++, x++) {
-        // if (A[i].size() != rows)
+} // namespace internal
 
-        // 从当前行(y)到最后一行(rows-1)中，找出x列最大的一行与y行交换
-        int maxAbsRowIndex = GetMaxAbsRowIndex(A, y, rows - 1, x);
-        A.SwapRow(y, maxAbsRowIndex);
-        b.SwapRow(y, maxAbsRowIndex);
+} // namespace tomsolver
 
-        while (std::abs(A.Value(y, x)) < Config::Get().epsilon) // 如果当前值为0  x一直递增到非0
-        {
-            x++;
-            if (x == cols) {
-                break;
-            }
+namespace tomsolver {
 
-            // 交换本行与最大行
-            maxAbsRowIndex = GetMaxAbsRowIndex(A, y, rows - 1, x);
-            A.SwapRow(y, maxAbsRowIndex);
-            b.SwapRow(y, maxAbsRowIndex);
-        }
+/**
+ * 把compiled生成为一个独立的C++函数：
+ *      extern "C" void name(const double *x, double *output)
+ * x按compiled.Vars()的顺序存放变量的值，结果按行优先的顺序写入output。output不能为x，也不能与临时变量t0, t1, ...重名。
+ * 生成的代码只依赖<cmath>：
+ *   1. 每个中间结果对应一个const double临时变量，结构相同的子表达式（包括不同元素之间）只计算一次；
+ *   2. 沿用CompiledSymMat的强度削减，整数次幂展开为乘法，同参数的sin、cos相邻计算。
+ * 注意：生成的代码不检查浮点数无效值(inf, -inf, nan)。
+ */
+inline std::string GenerateFunction(const CompiledSymMat &compiled, const std::string &name,
+                             const std::string &output = "out");
 
-        if (x != cols && x > y) {
-            TrueRowNumber[y] = x; // 补齐方程时 当前行应换到x行
+/**
+ * 生成一个完整的C++源文件，包含方程组的残差函数与雅可比矩阵函数：
+ *      extern "C" void {prefix}residual(const double *x, double *f)
+ *      extern "C" void {prefix}jacobian(const double *x, double *J)
+ * x按vars的顺序存放；J按行优先的顺序存放，J[i*vars.size()+j]为第i个方程对第j个变量的偏导数。
+ * @exception runtime_error equations中出现了vars以外的变量
+ */
+inline std::string GenerateModel(const SymVec &equations, const std::vector<std::string> &vars,
+                          const std::string &prefix = "");
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+namespace internal {
+
+/**
+ * 把指令流翻译为C++语句。
+ * 模拟求值栈，栈中保存的是操作数的C++表达式（字面量、x[i]或者临时变量名）。
+ * 每个运算生成一个临时变量，以表达式文本去重，相同的表达式只生成一次。
+ */
+class CodeGenerator {
+public:
+    explicit CodeGenerator(std::ostream &out) : out(out) {}
+
+    void Generate(const CompiledSymMat &compiled, const std::string &name, const std::string &output) {
+        using OpCode = CompiledSymMat::OpCode;
+
+        auto &code = compiled.Code();
+        auto &offsets = compiled.Offsets();
+
+        out << "// " << compiled.Rows() << "x" << compiled.Cols() << " matrix of\n";
+        for (std::size_t i = 0; i < compiled.Vars().size(); ++i) {
+            out << "//   x[" << i << "] = " << compiled.Vars()[i] << "\n";
+        }
+        out << "extern \"C\" void " << name << "(const double *x, double *" << output << ") {\n";
+        if (compiled.Vars().empty()) {
+            out << "    (void)x;\n";
         }
 
-        if (x == cols) // 本行全为0
-        {
-            RankA = y;
-            if (std::abs(b[y]) < Config::Get().epsilon) {
-                RankAb = y;
-            }
+        std::vector<std::string> stk;
+        std::vector<std::string> slots;
+        auto popOperand = [&stk] {
+            auto operand = std::move(stk.back());
+            stk.pop_back();
+            return operand;
+        };
 
-            if (RankA != RankAb) {
-                // 奇异，且系数矩阵及增广矩阵秩不相等->无解
-                throw MathError(ErrorType::ERROR_SINGULAR_MATRIX);
-            } else {
-                // 跳出for，得到特解
-                break;
+        for (std::size_t i = 0; i + 1 < offsets.size(); ++i) {
+            for (auto j = offsets[i]; j < offsets[i + 1]; ++j) {
+                auto &inst = code[j];
+                switch (inst.code) {
+                case OpCode::NUMBER:
+                    stk.emplace_back(Literal(inst.value));
+                    break;
+                case OpCode::VARIABLE:
+                    stk.emplace_back("x[" + std::to_string(inst.index) + "]");
+                    break;
+                case OpCode::UNARY:
+                    stk.back() = Unary(inst.op, stk.back());
+                    break;
+                case OpCode::BINARY: {
+                    auto r = popOperand();
+                    stk.back() = Binary(inst.op, stk.back(), r);
+                    break;
+                }
+                case OpCode::SQUARE:
+                    stk.back() = Temp(stk.back() + " * " + stk.back());
+                    break;
+                case OpCode::POWI:
+                    stk.back() = IntegerPower(stk.back(), static_cast<int>(inst.value));
+                    break;
+                case OpCode::RECIPROCAL:
+                    stk.back() = Temp("1.0 / " + stk.back());
+                    break;
+                case OpCode::SINCOS: {
+                    // 两个结果都生成临时变量，另一个留给后面的LOAD
+                    auto s = Temp("std::sin(" + stk.back() + ")");
+                    auto c = Temp("std::cos(" + stk.back() + ")");
+                    if (slots.size() <= inst.index) {
+                        slots.resize(inst.index + 1);
+                    }
+                    stk.back() = inst.op == MathOperator::MATH_SIN ? s : c;
+                    slots[inst.index] = inst.op == MathOperator::MATH_SIN ? c : s;
+                    break;
+                }
+                case OpCode::LOAD:
+                    stk.emplace_back(slots[inst.index]);
+                    break;
+                }
             }
+            out << "    " << output << "[" << i << "] = " << popOperand() << ";\n";
         }
+        out << "}\n";
+    }
 
-        // 主对角线化为1
-        auto ratioY = A.Value(y, x);
-        // y行第j个->第cols个
-        std::valarray<double> rowY = asConst(A).Row(y, x) / ratioY;
-        A.Row(y, x) = rowY;
-        b[y] /= ratioY;
+private:
+    std::ostream &out;
+    std::unordered_map<std::string, std::string> temps; // 表达式 -> 临时变量名
+
+    // 为表达式expr生成一个临时变量，返回变量名。相同的表达式复用已有的临时变量
+    std::string Temp(const std::string &expr) {
+        auto itor = temps.find(expr);
+        if (itor != temps.end()) {
+            return itor->second;
+        }
+        auto name = "t" + std::to_string(temps.size());
+        temps.emplace(expr, name);
+        out << "    const double " << name << " = " << expr << ";\n";
+        return name;
+    }
 
-        // 每行化为0
-        for (auto row = y + 1; row < rows; row++) // 下1行->最后1行
-        {
-            auto ratioRow = A.Value(row, x);
-            if (std::abs(ratioRow) >= Config::Get().epsilon) {
-                A.Row(row, x) -= rowY * ratioRow;
-                b[row] -= b[y] * ratioRow;
-            }
+    // 可以原样还原的双精度浮点数字面量
+    static std::string Literal(double value) {
+        if (std::isnan(value)) {
+            return "NAN";
+        }
+        if (std::isinf(value)) {
+            return value > 0 ? "HUGE_VAL" : "(-HUGE_VAL)";
         }
+        std::ostringstream ss;
+        ss << std::setprecision(std::numeric_limits<double>::max_digits10) << value;
+        auto ret = ss.str();
+        if (ret.find_first_of(".e") == std::string::npos) {
+            ret += ".0";
+        }
+        return value < 0 ? "(" + ret + ")" : ret;
     }
 
-    bool bIndeterminateEquation = false; // 设置此变量是因为后面rows将=cols，标记以判断是否为不定方程组
+    std::string Unary(MathOperator op, const std::string &operand) {
+        switch (op) {
+        case MathOperator::MATH_POSITIVE:
+            return operand;
+        case MathOperator::MATH_NEGATIVE:
+            // 字面量直接取负，不生成临时变量
+            return std::isdigit(static_cast<unsigned char>(operand[0])) ? "(-" + operand + ")" : Temp("-" + operand);
+        case MathOperator::MATH_SIN:
+            return Temp("std::sin(" + operand + ")");
+        case MathOperator::MATH_COS:
+            return Temp("std::cos(" + operand + ")");
+        case MathOperator::MATH_TAN:
+            return Temp("std::tan(" + operand + ")");
+        case MathOperator::MATH_ARCSIN:
+            return Temp("std::asin(" + operand + ")");
+        case MathOperator::MATH_ARCCOS:
+            return Temp("std::acos(" + operand + ")");
+        case MathOperator::MATH_ARCTAN:
+            return Temp("std::atan(" + operand + ")");
+        case MathOperator::MATH_SQRT:
+            return Temp("std::sqrt(" + operand + ")");
+        case MathOperator::MATH_LOG:
+            return Temp("std::log(" + operand + ")");
+        case MathOperator::MATH_LOG2:
+            return Temp("std::log2(" + operand + ")");
+        case MathOperator::MATH_LOG10:
+            return Temp("std::log10(" + operand + ")");
+        case MathOperator::MATH_EXP:
+            return Temp("std::exp(" + operand + ")");
+        default:
+            throw std::runtime_error("GenerateFunction: unsupported operator " + MathOperatorToStr(op));
+        }
+    }
 
-    // 若为不定方程组，空缺行全填0继续运算
-    if (rows != cols) {
-        A.Resize(cols, cols);
-        b.Resize(cols);
-        rows = cols;
-        bIndeterminateEquation = true;
+    std::string Binary(MathOperator op, const std::string &l, const std::string &r) {
+        switch (op) {
+        case MathOperator::MATH_ADD:
+            return Temp(l + " + " + r);
+        case MathOperator::MATH_SUB:
+            return Temp(l + " - " + r);
+        case MathOperator::MATH_MULTIPLY:
+            return Temp(l + " * " + r);
+        case MathOperator::MATH_DIVIDE:
+            return Temp(l + " / " + r);
+        case MathOperator::MATH_POWER:
+            return Temp("std::pow(" + l + ", " + r + ")");
+        case MathOperator::MATH_MOD:
+            return Temp("(double)((int)" + l + " % (int)" + r + ")");
+        case MathOperator::MATH_AND:
+            return Temp("(double)((int)" + l + " & (int)" + r + ")");
+        case MathOperator::MATH_OR:
+            return Temp("(double)((int)" + l + " | (int)" + r + ")");
+        default:
+            throw std::runtime_error("GenerateFunction: unsupported operator " + MathOperatorToStr(op));
+        }
+    }
 
-        // 调整顺序
-        for (int i = rows - 1; i >= 0; i--) {
-            if (TrueRowNumber[i] != 0) {
-                A.SwapRow(i, TrueRowNumber[i]);
-                b.SwapRow(i, TrueRowNumber[i]);
+    // 以平方求幂的方式展开为乘法，与CompiledSymMat的求值过程一致
+    std::string IntegerPower(std::string base, int exponent) {
+        std::string ret;
+        for (auto n = std::abs(exponent); n; n >>= 1) {
+            if (n & 1) {
+                ret = ret.empty() ? base : Temp(ret + " * " + base);
+            }
+            if (n > 1) {
+                base = Temp(base + " * " + base);
             }
         }
+        if (ret.empty()) {
+            return "1.0";
+        }
+        return exponent < 0 ? Temp("1.0 / " + ret) : ret;
     }
+};
 
-    // 后置换得到x
-    for (int i = rows - 1; i >= 0; i--) // 最后1行->第1行
-    {
-        auto vec = asConst(A).Row(i, i + 1) * asConst(ret).Col(0, i + 1);
-        ret[i] = b[i] - (vec.size() ? vec.sum() : 0);
+} // namespace internal
+
+inline std::string GenerateFunction(const CompiledSymMat &compiled, const std::string &name, const std::string &output) {
+    std::ostringstream out;
+    internal::CodeGenerator(out).Generate(compiled, name, output);
+    return out.str();
+}
+
+inline std::string GenerateModel(const SymVec &equations, const std::vector<std::string> &vars, const std::string &prefix) {
+    std::ostringstream out;
+    out << "// Generated by TomSolver. Do not edit.\n";
+    out << "#include <cmath>\n\n";
+    out << GenerateFunction(CompiledSymMat(equations, vars), prefix + "residual", "f") << "\n";
+    out << GenerateFunction(CompiledSymMat(Jacobian(equations, vars), vars), prefix + "jacobian", "J");
+    return out.str();
+}
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+using DataType = std::valarray<Node>;
+
+namespace internal {
+
+/**
+ * 数值元素不必计算，但与计算表达式一样，Config::Get().throwOnInvalidValue为true时检查是否为无效值。
+ * @exception MathError 数值为无效值(inf, -inf, nan)
+ */
+inline double CheckedNumberEntry(double value) {
+    if (Config::Get().throwOnInvalidValue && !std::isfinite(value)) {
+        throw MathError(ErrorType::ERROR_INVALID_NUMBER, "matrix entry: " + ToString(value));
     }
+    return value;
+}
 
-    if (RankA < cols && RankA == RankAb) {
-        if (bIndeterminateEquation) {
-            if (!Config::Get().allowIndeterminateEquation) {
-                throw MathError(ErrorType::ERROR_INDETERMINATE_EQUATION,
-                                "A = " + A.ToString() + "\nb = " + b.ToString());
-            }
-        } else {
-            throw MathError(ErrorType::ERROR_INFINITY_SOLUTIONS);
+} // namespace internal
+
+inline SymMat::SymMat(int rows, int cols) noexcept : rows(rows), cols(cols) {
+    assert(rows > 0 && cols > 0);
+    data.reset(new DataType(rows * cols));
+}
+
+inline SymMat::SymMat(std::initializer_list<std::initializer_list<Node>> init) noexcept {
+    rows = static_cast<int>(init.size());
+    cols = static_cast<int>(std::max(init, [](auto lhs, auto rhs) {
+                                return lhs.size() < rhs.size();
+                            }).size());
+    data.reset(new DataType(rows * cols));
+
+    auto i = 0;
+    for (auto val : init) {
+        auto j = 0;
+        for (auto &node : val) {
+            (*data)[i * cols + j++] = std::move(const_cast<Node &>(node));
         }
+        i++;
     }
-
-    return ret;
 }
 
-} // namespace tomsolver
-
-namespace tomsolver {
-
-template <typename T>
-inline Node sin(T &&n) noexcept {
-    return internal::UnaryOperator(MathOperator::MATH_SIN, std::forward<T>(n));
+inline SymMat::SymMat(const Mat &rhs) noexcept : SymMat(rhs.Rows(), rhs.Cols()) {
+    std::generate(std::begin(*data), std::end(*data), [p = std::addressof(rhs.Value(0, 0))]() mutable {
+        return Num(*p++);
+    });
 }
 
-template <typename T>
-inline Node cos(T &&n) noexcept {
-    return internal::UnaryOperator(MathOperator::MATH_COS, std::forward<T>(n));
+inline SymMat SymMat::Clone() const noexcept {
+    SymMat ret(Rows(), Cols());
+    std::generate(std::begin(*ret.data), std::end(*ret.data), [iter = std::begin(*data)]() mutable {
+        return tomsolver::Clone(*iter++);
+    });
+    return ret;
 }
 
-template <typename T>
-inline Node tan(T &&n) noexcept {
-    return internal::UnaryOperator(MathOperator::MATH_TAN, std::forward<T>(n));
+inline bool SymMat::Empty() const noexcept {
+    return data->size() == 0;
 }
 
-template <typename T>
-inline Node asin(T &&n) noexcept {
-    return internal::UnaryOperator(MathOperator::MATH_ARCSIN, std::forward<T>(n));
+inline int SymMat::Rows() const noexcept {
+    return rows;
 }
 
-template <typename T>
-inline Node acos(T &&n) noexcept {
-    return internal::UnaryOperator(MathOperator::MATH_ARCCOS, std::forward<T>(n));
+inline int SymMat::Cols() const noexcept {
+    return cols;
 }
 
-template <typename T>
-inline Node atan(T &&n) noexcept {
-    return internal::UnaryOperator(MathOperator::MATH_ARCTAN, std::forward<T>(n));
+inline SymVec SymMat::ToSymVec() const {
+    assert(rows > 0);
+    if (cols != 1) {
+        throw std::runtime_error("SymMat::ToSymVec fail. rows is not one");
+    }
+    return ToSymVecOneByOne();
 }
 
-template <typename T>
-inline Node sqrt(T &&n) noexcept {
-    return internal::UnaryOperator(MathOperator::MATH_SQRT, std::forward<T>(n));
+inline SymVec SymMat::ToSymVecOneByOne() const noexcept {
+    SymVec v(rows * cols);
+    std::generate(std::begin(*v.data), std::end(*v.data), [iter = std::begin(*data)]() mutable {
+        return tomsolver::Clone(*iter++);
+    });
+    return v;
 }
 
-template <typename T>
-inline Node log(T &&n) noexcept {
-    return internal::UnaryOperator(MathOperator::MATH_LOG, std::forward<T>(n));
+inline Mat SymMat::ToMat() const {
+    std::valarray<double> newData(data->size());
+    std::generate(std::begin(newData), std::end(newData), [iter = std::begin(*data)]() mutable {
+        if ((**iter).type != NodeType::NUMBER) {
+            throw std::runtime_error("ToMat error: node is not number");
+        }
+        return (**iter++).value;
+    });
+    return {rows, cols, newData};
 }
 
-template <typename T>
-inline Node log2(T &&n) noexcept {
-    return internal::UnaryOperator(MathOperator::MATH_LOG2, std::forward<T>(n));
+inline SymMat &SymMat::Calc() {
+    for (auto &node : *data) {
+        // 数值节点（包括Jacobian中结构性为0的元素）无需计算，只检查是否为无效值
+        if (node->type == NodeType::NUMBER) {
+            internal::CheckedNumberEntry(node->value);
+        } else {
+            node->Calc();
+        }
+    }
+    return *this;
 }
 
-template <typename T>
-inline Node log10(T &&n) noexcept {
-    return internal::UnaryOperator(MathOperator::MATH_LOG10, std::forward<T>(n));
+inline Mat SymMat::Vpa(const VarsTable &varsTable) const {
+    std::valarray<double> newData(data->size());
+    std::transform(std::begin(*data), std::end(*data), std::begin(newData), [&varsTable](const Node &node) {
+        return node->type == NodeType::NUMBER ? internal::CheckedNumberEntry(node->value) : node->Vpa(varsTable);
+    });
+    return {rows, cols, newData};
 }
 
-template <typename T>
-inline Node exp(T &&n) noexcept {
-    return internal::UnaryOperator(MathOperator::MATH_EXP, std::forward<T>(n));
+inline SymMat &SymMat::Subs(const std::map<std::string, double> &varValues) noexcept {
+    std::map<std::string, Node> dict;
+    for (auto &item : varValues) {
+        dict.insert({item.first, Num(item.second)});
+    }
+    return SubsInner(dict);
 }
 
-} // namespace tomsolver
-
-namespace tomsolver {
-
-/**
- * node对varname求导。在node包含多个变量时，是对varname求偏导。
- * @exception runtime_error 如果表达式内包含AND(&) OR(|) MOD(%)这类不能求导的运算符，则抛出异常
- */
-inline Node Diff(const Node &node, const std::string &varname, int i = 1);
-
-/**
- * node对varname求导。在node包含多个变量时，是对varname求偏导。
- * @exception runtime_error 如果表达式内包含AND(&) OR(|) MOD(%)这类不能求导的运算符，则抛出异常
- */
-inline Node Diff(Node &&node, const std::string &varname, int i = 1);
-
-} // namespace tomsolver
-
-namespace tomsolver {
-
-class SymVec;
-class SymMat {
-public:
-    /**
-     *
-     */
-    SymMat(int rows, int cols) noexcept;
-
-    /**
-     * 使用初始化列表构造。注意列表内的对象将被强行移动至Vec内部。
-     */
-    SymMat(std::initializer_list<std::initializer_list<Node>> init) noexcept;
-
-    /**
-     * 从数值矩阵构造符号矩阵
-     */
-    SymMat(const Mat &rhs) noexcept;
-
-    SymMat Clone() const noexcept;
-
-    bool Empty() const noexcept;
+inline SymMat &SymMat::Subs(const VarsTable &varsTable) noexcept {
+    std::map<std::string, Node> dict;
+    for (auto &item : varsTable) {
+        dict.insert({item.first, Num(item.second)});
+    }
+    return SubsInner(dict);
+}
 
-    int Rows() const noexcept;
+inline SymMat &SymMat::SubsInner(const std::map<std::string, Node> &dict) noexcept {
+    for (auto &node : *data) {
+        // 数值节点不含变量，跳过
+        if (node->type != NodeType::NUMBER) {
+            node = tomsolver::Subs(std::move(node), dict);
+        }
+    }
+    return *this;
+}
 
-    int Cols() const noexcept;
+inline std::set<std::string> SymMat::GetAllVarNames() const noexcept {
+    std::set<std::string> ret;
+    for (auto &node : *data) {
+        auto names = node->GetAllVarNames();
+        ret.insert(names.begin(), names.end());
+    }
+    return ret;
+}
 
-    /**
-     * 输出Vec。如果列数不为1，抛出异常。
-     * @exception runtime_error 列数不为1
-     */
-    SymVec ToSymVec() const;
+inline std::uint64_t SymMat::Hash() const noexcept {
+    auto seed = internal::HashCombine(static_cast<std::uint64_t>(rows), static_cast<std::uint64_t>(cols));
+    for (auto &node : *data) {
+        seed = internal::HashCombine(seed, node->Hash());
+    }
+    return seed;
+}
 
-    /**
-     * 逐个元素转换为符号向量（列向量）。
-     */
-    SymVec ToSymVecOneByOne() const noexcept;
+inline SymMat SymMat::operator-(const SymMat &rhs) const noexcept {
+    assert(rhs.rows == rows && rhs.cols == cols);
+    SymMat ret(rows, cols);
+    std::generate(std::begin(*ret.data), std::end(*ret.data),
+                  [lhsIter = std::begin(*data), rhsIter = std::begin(*rhs.data)]() mutable {
+                      return *lhsIter++ - *rhsIter++;
+                  });
+    return ret;
+}
 
-    /**
-     * 得到数值矩阵。前提条件是矩阵内的元素均为数值节点，否则抛出异常。
-     * @exception runtime_error 存在非数值节点
-     */
-    Mat ToMat() const;
+inline SymMat SymMat::operator*(const SymMat &rhs) const {
+    if (cols != rhs.rows) {
+        throw MathError(ErrorType::SIZE_NOT_MATCH);
+    }
 
-    /**
-     * 把矩阵的内的元素均计算为数值节点。
-     * @exception runtime_error 如果有变量存在，则无法计算
-     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
-     */
-    SymMat &Calc();
+    SymMat ans(rows, rhs.cols);
+    for (int i = 0; i < Rows(); ++i) {
+        for (int j = 0; j < rhs.cols; ++j) {
+            auto sum = Value(i, 0) * rhs.Value(0, j);
+            for (int k = 1; k < cols; ++k) {
+                sum += Value(i, k) * rhs.Value(k, j);
+            }
+            ans.Value(i, j) = Move(sum);
+        }
+    }
+    return ans;
+}
 
-    SymMat &Subs(const std::map<std::string, double> &varValues) noexcept;
+inline bool SymMat::operator==(const SymMat &rhs) const noexcept {
+    if (rhs.rows != rows || rhs.cols != cols) {
+        return false;
+    }
+    return std::equal(std::begin(*data), std::end(*data), std::begin(*rhs.data), [](auto &node1, auto &node2) {
+        return node1->Equal(node2);
+    });
+}
 
-    SymMat &Subs(const VarsTable &varsTable) noexcept;
+inline Node &SymMat::Value(int i, int j) noexcept {
+    return (*data)[i * cols + j];
+}
 
-    /**
-     * 返回符号矩阵内出现的所有变量名。
-     */
-    std::set<std::string> GetAllVarNames() const noexcept;
+inline const Node &SymMat::Value(int i, int j) const noexcept {
+    return (*data)[i * cols + j];
+}
 
-    /**
-     * 如果rhs和自己的维数不匹配会触发assert。
-     */
-    SymMat operator-(const SymMat &rhs) const noexcept;
+inline std::string SymMat::ToString() const noexcept {
+    if (data->size() == 0) {
+        return "[]";
+    }
 
-    /**
-     *
-     * @exception MathError 维数不匹配
-     */
-    SymMat operator*(const SymMat &rhs) const;
+    std::stringstream ss;
+    ss << "[";
 
-    /**
-     * 返回是否相等。
-     * 目前只能判断表达式树完全一致的情况。
-     * TODO 改为可以判断等价表达式
-     */
-    bool operator==(const SymMat &rhs) const noexcept;
+    size_t i = 0;
+    for (auto &node : *data) {
+        ss << (i == 0 ? "" : " ") << node->ToString();
+        i++;
+        ss << (i % cols == 0 ? (i == data->size() ? "]" : "\n") : ", ");
+    }
 
-    Node &Value(int i, int j) noexcept;
-    const Node &Value(int i, int j) const noexcept;
+    return ss.str();
+}
 
-    std::string ToString() const noexcept;
+inline SymVec::SymVec(int rows) noexcept : SymMat(rows, 1) {}
 
-protected:
-    int rows, cols;
-    std::unique_ptr<std::valarray<Node>> data;
+inline SymVec::SymVec(std::initializer_list<Node> init) noexcept : SymMat(static_cast<int>(init.size()), 1) {
+    auto i = 0;
+    for (auto &node : init) {
+        (*data)[i++] = std::move(const_cast<Node &>(node));
+    }
+}
 
-    friend SymMat Jacobian(const SymMat &equations, const std::vector<std::string> &vars) noexcept;
-};
+inline SymVec SymVec::operator-(const SymVec &rhs) const noexcept {
+    return SymMat::operator-(rhs).ToSymVec();
+}
 
-class SymVec : public SymMat {
-public:
-    /**
-     *
-     */
-    SymVec(int rows) noexcept;
+inline Node &SymVec::operator[](std::size_t index) noexcept {
+    return (*data)[index];
+}
 
-    /**
-     * 使用初始化列表构造。注意列表内的对象将被强行移动至Vec内部。
-     */
-    SymVec(std::initializer_list<Node> init) noexcept;
+inline const Node &SymVec::operator[](std::size_t index) const noexcept {
+    return (*data)[index];
+}
 
-    /**
-     * 如果rhs和自己的维数不匹配会触发assert。
-     */
-    SymVec operator-(const SymVec &rhs) const noexcept;
+inline SymMat Jacobian(const SymMat &equations, const std::vector<std::string> &vars) {
+    int rows = equations.rows;
+    int cols = static_cast<int>(vars.size());
+    SymMat ja(rows, cols);
 
-    Node &operator[](std::size_t index) noexcept;
+    // 按行并行。每个单元格只由一个线程写入，结果与串行计算完全一致
+    internal::ParallelFor(rows, [&equations, &vars, &ja, cols](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            auto &equation = (*equations.data)[i];
 
-    const Node &operator[](std::size_t index) const noexcept;
-};
+            // 方程中不含的变量，偏导数必然为0，不必再求导
+            auto varNames = equation->GetAllVarNames();
+            for (int j = 0; j < cols; ++j) {
+                ja.Value(i, j) = varNames.count(vars[j]) ? Diff(equation, vars[j]) : Num(0);
+            }
+        }
+    });
 
-inline SymMat Jacobian(const SymMat &equations, const std::vector<std::string> &vars) noexcept;
+    return ja;
+}
 
-inline std::ostream &operator<<(std::ostream &out, const SymMat &symMat) noexcept;
+inline std::ostream &operator<<(std::ostream &out, const SymMat &symMat) noexcept {
+    return out << symMat.ToString();
+}
 
 } // namespace tomsolver
 
 namespace tomsolver {
 
-/**
- * 用newNode节点替换oldVar指定的变量。
- */
-inline Node Subs(const Node &node, const std::string &oldVar, const Node &newNode) noexcept;
-
-/**
- * 用newNode节点替换oldVar指定的变量。
- */
-inline Node Subs(Node &&node, const std::string &oldVar, const Node &newNode) noexcept;
+namespace internal {
 
 /**
- * 用newNodes节点替换oldVars指定的变量。
+ * 序列化格式的版本号。格式有任何变化时加1。
  */
-inline Node Subs(const Node &node, const std::vector<std::string> &oldVars, const SymVec &newNodes) noexcept;
+constexpr std::uint16_t SerializeVersion = 1;
 
-/**
- * 用newNodes节点替换oldVars指定的变量。
- */
-inline Node Subs(Node &&node, const std::vector<std::string> &oldVars, const SymVec &newNodes) noexcept;
+} // namespace internal
 
 /**
- * 用newNodes节点替换oldVars指定的变量。
+ * 二进制序列化。与ToString()、Parse()相比，数值原样保存IEEE 754的8个字节，不需要格式化与解析，也不会损失精度。
+ * 格式如下，所有整数与浮点数按本机字节序写入：
+ *
+ *     头部（16字节）：magic "TSBN"，u16 版本号，u16 内容类型，u32 字节序标记0x01020304，u32 保留
+ *     变量表：       u32 变量数，之后每个变量为 u32 长度 + 变量名
+ *     表达式：       u32 节点数，之后按后序逐个排列节点：
+ *                        u8 0xFF + f64    数值
+ *                        u8 0xFE + u32    变量，值为变量表中的下标
+ *                        u8 op            运算符，值为MathOperator
+ *     矩阵：         i32 行数，i32 列数，之后按行优先排列每个元素的表达式
+ *
+ * 内容类型为1时，变量表之后是一个表达式；为2时是一个矩阵；为3时是PreparedSystem：
+ * u32 变量数 + 每个变量在变量表中的下标，之后依次是equations与jacobian两个矩阵。
+ *
+ * 反序列化直接从传入的内存中读取，不复制到中间缓冲区。与MappedFile配合即是零拷贝的加载方式：
+ *     MappedFile file(filename);
+ *     auto system = DeserializePreparedSystem(file.Data(), file.Size());
+ *
+ * 版本号、内容类型或者字节序不符，以及数据不完整、不合法时，反序列化抛出runtime_error。
  */
-inline Node Subs(const Node &node, const std::map<std::string, Node> &dict) noexcept;
+inline std::string Serialize(const Node &node);
 
-/**
- * 用newNodes节点替换oldVars指定的变量。
- */
-inline Node Subs(Node &&node, const std::map<std::string, Node> &dict) noexcept;
+inline std::string Serialize(const SymMat &mat);
 
-/**
- * 用newNodes节点替换oldVars指定的变量。
- */
-inline Node Subs(const Node &node, const std::map<std::string, double> &varValues) noexcept;
+inline std::string Serialize(const PreparedSystem &system);
 
 /**
- * 用newNodes节点替换oldVars指定的变量。
+ * @exception runtime_error 数据不合法
  */
-inline Node Subs(Node &&node, const std::map<std::string, double> &varValues) noexcept;
+inline Node DeserializeNode(const char *data, std::size_t size);
 
 /**
- * 用newNodes节点替换oldVars指定的变量。
+ * @exception runtime_error 数据不合法
  */
-inline Node Subs(const Node &node, const VarsTable &varsTable) noexcept;
+inline SymMat DeserializeSymMat(const char *data, std::size_t size);
 
 /**
- * 用newNodes节点替换oldVars指定的变量。
+ * @exception runtime_error 数据不合法
  */
-inline Node Subs(Node &&node, const VarsTable &varsTable) noexcept;
+inline PreparedSystem DeserializePreparedSystem(const char *data, std::size_t size);
 
 } // namespace tomsolver
 
@@ -2844,287 +8500,570 @@ namespace tomsolver {
 
 namespace internal {
 
-class SubsFunctions {
+enum class SerializedKind : std::uint16_t {
+    NODE = 1,
+    SYMMAT = 2,
+    PREPARED_SYSTEM = 3,
+};
+
+constexpr char SerializeMagic[4] = {'T', 'S', 'B', 'N'};
+constexpr std::uint32_t ByteOrderMark = 0x01020304;
+constexpr std::uint8_t NumberCode = 0xFF;
+constexpr std::uint8_t VariableCode = 0xFE;
+
+/**
+ * 先把表达式写入body，同时登记变量；Finish()时再把头部和变量表放在最前面。
+ */
+class Encoder {
 public:
-    // 前序遍历。非递归实现。
-    static Node SubsInner(Node node, const std::map<std::string, Node> &dict) noexcept {
+    explicit Encoder(SerializedKind kind) noexcept : kind(kind) {}
 
-        std::stack<std::reference_wrapper<NodeImpl>> stk;
+    template <typename T>
+    void Put(T value) noexcept {
+        body.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
 
-        auto Replace = [&dict](Node &cur) {
-            if (cur->type != NodeType::VARIABLE) {
-                return false;
+    std::uint32_t VarId(const std::string &name) noexcept {
+        auto ret = varIds.emplace(name, static_cast<std::uint32_t>(vars.size()));
+        if (ret.second) {
+            vars.emplace_back(name);
+        }
+        return ret.first->second;
+    }
+
+    void PutExpression(const Node &node) noexcept {
+        FlatNode flat(node);
+        std::vector<std::uint32_t> ids;
+        for (auto &name : flat.VarNames()) {
+            ids.emplace_back(VarId(name));
+        }
+
+        Put(static_cast<std::uint32_t>(flat.Size()));
+        for (auto &item : flat.Items()) {
+            switch (item.type) {
+            case NodeType::NUMBER:
+                Put(NumberCode);
+                Put(item.value);
+                break;
+            case NodeType::VARIABLE:
+                Put(VariableCode);
+                Put(ids[item.varId]);
+                break;
+            case NodeType::OPERATOR:
+                Put(static_cast<std::uint8_t>(item.op));
+                break;
             }
+        }
+    }
 
-            auto itor = dict.find(cur->varname);
-            if (itor == dict.end()) {
-                return false;
+    void PutMatrix(const SymMat &mat) noexcept {
+        Put(static_cast<std::int32_t>(mat.Rows()));
+        Put(static_cast<std::int32_t>(mat.Cols()));
+        for (int i = 0; i < mat.Rows(); ++i) {
+            for (int j = 0; j < mat.Cols(); ++j) {
+                PutExpression(mat.Value(i, j));
             }
+        }
+    }
 
-            auto parent = cur->parent;
-            cur = Clone(itor->second);
-            cur->parent = parent;
+    std::string Finish() noexcept {
+        std::string head;
+        std::swap(head, body);
 
-            return true;
+        body.append(SerializeMagic, sizeof(SerializeMagic));
+        Put(SerializeVersion);
+        Put(static_cast<std::uint16_t>(kind));
+        Put(ByteOrderMark);
+        Put(static_cast<std::uint32_t>(0));
+
+        Put(static_cast<std::uint32_t>(vars.size()));
+        for (auto &name : vars) {
+            Put(static_cast<std::uint32_t>(name.size()));
+            body.append(name);
+        }
+
+        body.append(head);
+        return std::move(body);
+    }
+
+private:
+    SerializedKind kind;
+    std::string body;
+    std::vector<std::string> vars;
+    std::unordered_map<std::string, std::uint32_t> varIds;
+};
+
+/**
+ * 顺序读取序列化数据。构造时检查头部并读入变量表。任何越界或者不合法的内容都抛出runtime_error。
+ */
+class Decoder {
+public:
+    Decoder(const char *data, std::size_t size, SerializedKind kind) : cur(data), end(data + size) {
+        if (size < sizeof(SerializeMagic) || !std::equal(SerializeMagic, SerializeMagic + 4, data)) {
+            Fail("bad magic");
+        }
+        cur += sizeof(SerializeMagic);
+        if (Get<std::uint16_t>() != SerializeVersion) {
+            Fail("unsupported version");
+        }
+        if (Get<std::uint16_t>() != static_cast<std::uint16_t>(kind)) {
+            Fail("unexpected content kind");
+        }
+        if (Get<std::uint32_t>() != ByteOrderMark) {
+            Fail("byte order mismatch");
+        }
+        Get<std::uint32_t>();
+
+        auto n = Get<std::uint32_t>();
+        vars.reserve(std::min<std::size_t>(n, Remaining()));
+        for (std::uint32_t i = 0; i < n; ++i) {
+            auto len = Get<std::uint32_t>();
+            if (len > Remaining()) {
+                Fail("truncated data");
+            }
+            vars.emplace_back(cur, len);
+            if (!VarNameIsLegal(vars.back())) {
+                Fail("illegal variable name");
+            }
+            cur += len;
+        }
+    }
+
+    template <typename T>
+    T Get() {
+        if (sizeof(T) > Remaining()) {
+            Fail("truncated data");
+        }
+        T value;
+        std::memcpy(&value, cur, sizeof(T));
+        cur += sizeof(T);
+        return value;
+    }
+
+    const std::vector<std::string> &Vars() const noexcept {
+        return vars;
+    }
+
+    std::uint32_t GetVarId() {
+        auto id = Get<std::uint32_t>();
+        if (id >= vars.size()) {
+            Fail("variable id out of range");
+        }
+        return id;
+    }
+
+    // 后序序列逐个入栈构造，非递归实现
+    Node GetExpression() {
+        auto n = Get<std::uint32_t>();
+        std::vector<Node> stk;
+        stk.reserve(std::min<std::size_t>(n, Remaining()));
+        auto popNode = [&stk] {
+            auto node = std::move(stk.back());
+            stk.pop_back();
+            return node;
         };
 
-        if (!Replace(node)) {
-            auto TryReplace = [&stk, &Replace](Node &cur) {
-                if (cur && !Replace(cur)) {
-                    stk.emplace(*cur);
-                }
-            };
+        for (std::uint32_t i = 0; i < n; ++i) {
+            auto code = Get<std::uint8_t>();
+            if (code == NumberCode) {
+                stk.emplace_back(Num(Get<double>()));
+                continue;
+            }
+            if (code == VariableCode) {
+                stk.emplace_back(Var(vars[GetVarId()]));
+                continue;
+            }
 
-            TryReplace(node->right);
-            TryReplace(node->left);
+            if (code < static_cast<std::uint8_t>(MathOperator::MATH_POSITIVE) ||
+                code > static_cast<std::uint8_t>(MathOperator::MATH_MOD)) {
+                Fail("unknown operator");
+            }
+            auto op = static_cast<MathOperator>(code);
+            auto operandNum = static_cast<std::size_t>(GetOperatorNum(op));
+            if (stk.size() < operandNum) {
+                Fail("missing operand");
+            }
+            if (operandNum == 2) {
+                auto right = popNode();
+                auto left = popNode();
+                stk.emplace_back(Operator(op, std::move(left), std::move(right)));
+            } else {
+                stk.emplace_back(Operator(op, popNode()));
+            }
+        }
 
-            while (!stk.empty()) {
-                auto &f = stk.top().get();
-                stk.pop();
-                TryReplace(f.right);
-                TryReplace(f.left);
+        if (stk.size() != 1) {
+            Fail("malformed expression");
+        }
+        return popNode();
+    }
+
+    SymMat GetMatrix() {
+        auto rows = Get<std::int32_t>();
+        auto cols = Get<std::int32_t>();
+        // 每个元素至少占5个字节，以此拒绝明显不合法的维数
+        if (rows <= 0 || cols <= 0 || static_cast<std::uint64_t>(rows) * static_cast<std::uint64_t>(cols) * 5 >
+                                          static_cast<std::uint64_t>(Remaining())) {
+            Fail("bad matrix size");
+        }
+        SymMat mat(rows, cols);
+        for (int i = 0; i < rows; ++i) {
+            for (int j = 0; j < cols; ++j) {
+                mat.Value(i, j) = GetExpression();
             }
         }
+        return mat;
+    }
 
-#ifndef NDEBUG
-        node->CheckParent();
-#endif
-        return node;
+    void Finish() const {
+        if (cur != end) {
+            Fail("trailing data");
+        }
+    }
+
+private:
+    const char *cur;
+    const char *end;
+    std::vector<std::string> vars;
+
+    std::size_t Remaining() const noexcept {
+        return static_cast<std::size_t>(end - cur);
+    }
+
+    [[noreturn]] void Fail(const char *reason) const {
+        throw std::runtime_error(std::string("invalid serialized data: ") + reason);
     }
 };
 
 } // namespace internal
 
-inline Node Subs(const Node &node, const std::string &oldVar, const Node &newNode) noexcept {
-    return Subs(Clone(node), oldVar, newNode);
-}
-
-inline Node Subs(Node &&node, const std::string &oldVar, const Node &newNode) noexcept {
-    std::map<std::string, Node> dict;
-    dict.insert({oldVar, Clone(newNode)});
-    return internal::SubsFunctions::SubsInner(Move(node), dict);
+inline std::string Serialize(const Node &node) {
+    internal::Encoder encoder(internal::SerializedKind::NODE);
+    encoder.PutExpression(node);
+    return encoder.Finish();
 }
 
-inline Node Subs(const Node &node, const std::vector<std::string> &oldVars, const SymVec &newNodes) noexcept {
-    return Subs(Clone(node), oldVars, newNodes);
+inline std::string Serialize(const SymMat &mat) {
+    internal::Encoder encoder(internal::SerializedKind::SYMMAT);
+    encoder.PutMatrix(mat);
+    return encoder.Finish();
 }
 
-inline Node Subs(Node &&node, const std::vector<std::string> &oldVars, const SymVec &newNodes) noexcept {
-    assert(static_cast<int>(oldVars.size()) == newNodes.Rows());
-    std::map<std::string, Node> dict;
-    for (size_t i = 0; i < oldVars.size(); ++i) {
-        dict.insert({oldVars[i], Clone(newNodes[i])});
+inline std::string Serialize(const PreparedSystem &system) {
+    internal::Encoder encoder(internal::SerializedKind::PREPARED_SYSTEM);
+    encoder.Put(static_cast<std::uint32_t>(system.vars.size()));
+    for (auto &var : system.vars) {
+        encoder.Put(encoder.VarId(var));
     }
-    return internal::SubsFunctions::SubsInner(Move(node), dict);
+    encoder.PutMatrix(system.equations);
+    encoder.PutMatrix(system.jacobian);
+    return encoder.Finish();
 }
 
-inline Node Subs(const Node &node, const std::map<std::string, Node> &dict) noexcept {
-    return Subs(Clone(node), dict);
+inline Node DeserializeNode(const char *data, std::size_t size) {
+    internal::Decoder decoder(data, size, internal::SerializedKind::NODE);
+    auto node = decoder.GetExpression();
+    decoder.Finish();
+    return node;
 }
 
-inline Node Subs(Node &&node, const std::map<std::string, Node> &dict) noexcept {
-    return internal::SubsFunctions::SubsInner(Move(node), dict);
+inline SymMat DeserializeSymMat(const char *data, std::size_t size) {
+    internal::Decoder decoder(data, size, internal::SerializedKind::SYMMAT);
+    auto mat = decoder.GetMatrix();
+    decoder.Finish();
+    return mat;
 }
 
-inline Node Subs(const Node &node, const std::map<std::string, double> &varValues) noexcept {
-    return Subs(Clone(node), varValues);
-}
+inline PreparedSystem DeserializePreparedSystem(const char *data, std::size_t size) {
+    internal::Decoder decoder(data, size, internal::SerializedKind::PREPARED_SYSTEM);
+    auto n = decoder.Get<std::uint32_t>();
+    std::vector<std::string> vars;
+    for (std::uint32_t i = 0; i < n; ++i) {
+        vars.emplace_back(decoder.Vars()[decoder.GetVarId()]);
+    }
+    auto equations = decoder.GetMatrix();
+    auto jacobian = decoder.GetMatrix();
+    decoder.Finish();
 
-inline Node Subs(Node &&node, const std::map<std::string, double> &varValues) noexcept {
-    std::map<std::string, Node> dict;
-    for (auto &item : varValues) {
-        dict.insert({item.first, Num(item.second)});
+    if (equations.Cols() != 1 || jacobian.Rows() != equations.Rows() ||
+        jacobian.Cols() != static_cast<int>(vars.size())) {
+        throw std::runtime_error("invalid serialized data: dimension mismatch");
     }
-    return internal::SubsFunctions::SubsInner(Move(node), dict);
+    return {equations.ToSymVec(), std::move(vars), std::move(jacobian)};
 }
 
-inline Node Subs(const Node &node, const VarsTable &varsTable) noexcept {
-    return Subs(Clone(node), varsTable);
-}
+} // namespace tomsolver
+
+namespace tomsolver {
+
+/**
+ * 预处理结果（PreparedSystem）的磁盘缓存。Config::Get().preparedCacheDir不为空时，Prepare()先从这里查找。
+ * 每个模型保存为目录下的一个文件，文件名由方程组的结构哈希与变量名计算得到，内容为Serialize()的结果。
+ * 写入时先写临时文件再原子地改名，多个进程、线程可以同时读写同一个目录；读到损坏的文件或者哈希冲突时视为未命中。
+ * 写入后，若目录内缓存文件的总大小超过Config::Get().preparedCacheMaxBytes，按最近使用时间（修改时间，命中时更新）
+ * 从旧到新删除，即LRU淘汰。
+ * 仅支持POSIX平台，其他平台上Find()总是返回nullptr，Insert()什么也不做。
+ */
+class PreparedCache {
+public:
+    static PreparedCache &Get();
+
+    /**
+     * 当前平台是否支持磁盘缓存。
+     */
+    static bool IsSupported() noexcept;
+
+    /**
+     * 查找equations对vars的预处理结果。未找到时返回nullptr。
+     * 不抛出异常，读取失败视为未命中。
+     */
+    std::unique_ptr<PreparedSystem> Find(const SymVec &equations, const std::vector<std::string> &vars) noexcept;
+
+    /**
+     * 保存预处理结果，然后按Config::Get().preparedCacheMaxBytes淘汰旧的缓存文件。
+     * 不抛出异常，写入失败时只打印警告。
+     */
+    void Insert(const PreparedSystem &system) noexcept;
+
+    /**
+     * 删除目录内所有的缓存文件，并清零命中计数。
+     */
+    void Clear() noexcept;
+
+    /**
+     * 目录内缓存文件的总字节数。
+     */
+    std::size_t DiskUsage() const noexcept;
+
+    /**
+     * 本进程的命中次数。
+     */
+    std::size_t Hits() const noexcept;
+
+    /**
+     * 本进程的未命中次数。
+     */
+    std::size_t Misses() const noexcept;
 
-inline Node Subs(Node &&node, const VarsTable &varsTable) noexcept {
-    std::map<std::string, Node> dict;
-    for (auto &item : varsTable) {
-        dict.insert({item.first, Num(item.second)});
-    }
-    return internal::SubsFunctions::SubsInner(Move(node), dict);
-}
+    /**
+     * equations对vars的预处理结果对应的缓存文件路径。
+     */
+    static std::string Path(const SymVec &equations, const std::vector<std::string> &vars) noexcept;
 
-} // namespace tomsolver
+private:
+    std::atomic<std::size_t> hits{0};
+    std::atomic<std::size_t> misses{0};
 
-namespace tomsolver {
+    PreparedCache() = default;
 
-inline void Simplify(Node &node) noexcept;
+    static std::uint64_t MakeKey(const SymVec &equations, const std::vector<std::string> &vars) noexcept;
+
+    void Evict() noexcept;
+};
 
 } // namespace tomsolver
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace tomsolver {
 
 namespace internal {
 
-class SimplifyFunctions {
-public:
-    struct SimplifyNode {
-        NodeImpl &node;
-        bool isLeftChild;
-
-        SimplifyNode(NodeImpl &node) : node(node), isLeftChild(!node.parent || node.parent->left.get() == &node) {}
-    };
+/**
+ * 缓存目录内的一个缓存文件。
+ */
+struct PreparedCacheFile {
+    std::string path;
+    std::size_t size;
+    std::int64_t mtime; // 纳秒
+};
 
-    // 对单节点n进行化简。
-    static void SimplifySingleNode(std::unique_ptr<NodeImpl> &n) noexcept {
-        auto parent = n->parent;
-        switch (GetOperatorNum(n->op)) {
-        // 对于1元运算符，且儿子是数字的，直接计算出来
-        case 1:
-            if (n->left->type == NodeType::NUMBER) {
-                n->type = NodeType::NUMBER;
-                n->value = tomsolver::Calc(n->op, n->left->value, 0);
-                n->op = MathOperator::MATH_NULL;
-                n->left = nullptr;
-            }
-            break;
+const char PreparedCachePrefix[] = "tomsolver_prepared_";
+const char PreparedCacheSuffix[] = ".tsbn";
 
-        // 对于2元运算符
-        case 2:
-            // 儿子是数字的，直接计算出来
-            if (n->left->type == NodeType::NUMBER && n->right->type == NodeType::NUMBER) {
-                n->type = NodeType::NUMBER;
-                n->value = tomsolver::Calc(n->op, n->left->value, n->right->value);
-                n->op = MathOperator::MATH_NULL;
-                n->left = nullptr;
-                n->right = nullptr;
-                return;
-            }
+/**
+ * 列出目录内的缓存文件，只认文件名形如tomsolver_prepared_*.tsbn的普通文件，其他文件（包括写了一半的临时文件）不计入。
+ */
+inline std::vector<PreparedCacheFile> ListPreparedCacheFiles(const std::string &dir) noexcept {
+    std::vector<PreparedCacheFile> files;
+#if defined(__unix__) || defined(__APPLE__)
+    auto d = opendir(dir.c_str());
+    if (!d) {
+        return files;
+    }
+    const std::string prefix(PreparedCachePrefix), suffix(PreparedCacheSuffix);
+    while (auto entry = readdir(d)) {
+        std::string name(entry->d_name);
+        if (name.size() < prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            continue;
+        }
+        auto path = dir + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            // 可能已经被其他进程删除
+            continue;
+        }
+#if defined(__APPLE__)
+        auto &ts = st.st_mtimespec;
+#else
+        auto &ts = st.st_mtim;
+#endif
+        files.push_back({std::move(path), static_cast<std::size_t>(st.st_size),
+                         static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec});
+    }
+    closedir(d);
+#else
+    (void)dir;
+#endif
+    return files;
+}
 
-            assert(n->left && n->right);
-            bool lChildIs0 = n->left->type == NodeType::NUMBER && n->left->value == 0.0;
-            bool rChildIs0 = n->right->type == NodeType::NUMBER && n->right->value == 0.0;
-            bool lChildIs1 = n->left->type == NodeType::NUMBER && n->left->value == 1.0;
-            bool rChildIs1 = n->right->type == NodeType::NUMBER && n->right->value == 1.0;
+} // namespace internal
 
-            // 任何数乘或被乘0、被0除、0的除0外的任何次方，等于0
-            if ((n->op == MathOperator::MATH_MULTIPLY && (lChildIs0 || rChildIs0)) ||
-                (n->op == MathOperator::MATH_DIVIDE && lChildIs0) || (n->op == MathOperator::MATH_POWER && lChildIs0)) {
-                n = Num(0);
-                n->parent = parent;
-                return;
-            }
+inline PreparedCache &PreparedCache::Get() {
+    static PreparedCache cache;
+    return cache;
+}
 
-            // 任何数加或被加0、被减0、乘或被乘1、被1除、开1次方，等于自身
-            if ((n->op == MathOperator::MATH_ADD && (lChildIs0 || rChildIs0)) ||
-                (n->op == MathOperator::MATH_SUB && rChildIs0) ||
-                (n->op == MathOperator::MATH_MULTIPLY && (lChildIs1 || rChildIs1)) ||
-                (n->op == MathOperator::MATH_DIVIDE && rChildIs1) || (n->op == MathOperator::MATH_POWER && rChildIs1)) {
+inline bool PreparedCache::IsSupported() noexcept {
+#if defined(__unix__) || defined(__APPLE__)
+    return true;
+#else
+    return false;
+#endif
+}
 
-                if (lChildIs1 || lChildIs0) {
-                    n->left = nullptr;
-                    n = Move(n->right);
-                    n->parent = parent;
-                } else if (rChildIs1 || rChildIs0) {
-                    n->right = nullptr;
-                    n = Move(n->left);
-                    n->parent = parent;
-                }
-                return;
-            }
+inline std::unique_ptr<PreparedSystem> PreparedCache::Find(const SymVec &equations,
+                                                    const std::vector<std::string> &vars) noexcept {
+#if defined(__unix__) || defined(__APPLE__)
+    auto path = Path(equations, vars);
+    try {
+        MappedFile file(path);
+        auto system = std::make_unique<PreparedSystem>(DeserializePreparedSystem(file.Data(), file.Size()));
+        // 文件名只是哈希，还要确认内容就是要找的模型
+        if (system->vars == vars && system->equations == equations) {
+            // 更新修改时间，作为LRU的最近使用时间
+            utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+            ++hits;
+            return system;
         }
+    } catch (const std::exception &) {
+        // 文件不存在、已经损坏或者内存不足，视为未命中，之后Insert()会覆盖它
     }
+#else
+    (void)equations;
+    (void)vars;
+#endif
+    ++misses;
+    return nullptr;
+}
 
-    // 后序遍历。非递归实现。
-    static void SimplifyWholeNode(Node &node) {
-
-        // 借助一个栈，得到反向的后序遍历序列，结果保存在revertedPostOrder。除了root节点，root节点不保存在revertedPostOrder里，最后单独化简。
-        std::stack<SimplifyNode> stk;
-        std::deque<SimplifyNode> revertedPostOrder;
-
-        auto popNode = [&stk] {
-            auto node = std::move(stk.top());
-            stk.pop();
-            return node;
-        };
+inline void PreparedCache::Insert(const PreparedSystem &system) noexcept {
+#if defined(__unix__) || defined(__APPLE__)
+    auto &dir = Config::Get().preparedCacheDir;
+    if (dir.empty()) {
+        return;
+    }
+    mkdir(dir.c_str(), 0777);
 
-        // ==== Part I ====
+    auto path = Path(system.equations, system.vars);
+    auto data = Serialize(system);
 
-        if (node->type != NodeType::OPERATOR) {
-            return;
+    // 先写临时文件，再改名为最终的文件名。改名是原子的，其他进程、线程不会读到写了一半的文件
+    static std::atomic<int> counter{0};
+    auto tmp = path + "." + std::to_string(getpid()) + "." + std::to_string(counter++);
+    bool ok;
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        ok = static_cast<bool>(out);
+    }
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        if (Config::Get().logLevel >= LogLevel::WARN) {
+            std::cout << "[WARN] PreparedCache: can not write " << path << std::endl;
         }
+        return;
+    }
 
-        stk.push(SimplifyNode(*node.get()));
-
-        while (!stk.empty()) {
-            auto f = popNode();
+    Evict();
+#else
+    (void)system;
+#endif
+}
 
-            if (f.node.left && f.node.left->type == NodeType::OPERATOR) {
-                stk.push(SimplifyNode(*f.node.left.get()));
-            }
+inline void PreparedCache::Evict() noexcept {
+    auto maxBytes = Config::Get().preparedCacheMaxBytes;
+    if (maxBytes == 0) {
+        return;
+    }
 
-            if (f.node.right && f.node.right->type == NodeType::OPERATOR) {
-                stk.push(SimplifyNode(*f.node.right.get()));
-            }
+    auto files = internal::ListPreparedCacheFiles(Config::Get().preparedCacheDir);
+    std::size_t total = 0;
+    for (auto &file : files) {
+        total += file.size;
+    }
+    if (total <= maxBytes) {
+        return;
+    }
 
-            revertedPostOrder.emplace_back(std::move(f));
+    std::sort(files.begin(), files.end(), [](const internal::PreparedCacheFile &a, const internal::PreparedCacheFile &b) {
+        return a.mtime < b.mtime;
+    });
+    for (auto &file : files) {
+        if (total <= maxBytes) {
+            break;
         }
+        // 其他进程可能同时在淘汰，删除失败也照样扣除
+        std::remove(file.path.c_str());
+        total -= file.size;
+    }
+}
 
-        // pop掉root，root最后单独处理
-        revertedPostOrder.pop_front();
-
-        // ==== Part II ====
-        std::for_each(revertedPostOrder.rbegin(), revertedPostOrder.rend(), [](SimplifyNode &snode) {
-            SimplifySingleNode(snode.isLeftChild ? snode.node.parent->left : snode.node.parent->right);
-        });
+inline void PreparedCache::Clear() noexcept {
+    for (auto &file : internal::ListPreparedCacheFiles(Config::Get().preparedCacheDir)) {
+        std::remove(file.path.c_str());
+    }
+    hits = 0;
+    misses = 0;
+}
 
-        SimplifyFunctions::SimplifySingleNode(node);
+inline std::size_t PreparedCache::DiskUsage() const noexcept {
+    std::size_t total = 0;
+    for (auto &file : internal::ListPreparedCacheFiles(Config::Get().preparedCacheDir)) {
+        total += file.size;
+    }
+    return total;
+}
 
-        return;
+inline std::size_t PreparedCache::Hits() const noexcept {
+    return hits;
+}
 
-        // if (GetOperateNum(now->eOperator) == 2) {
-
-        //    //任何节点的0次方均等于1，除了0的0次方已在前面报错
-        //    if (now->eOperator == MATH_POWER && RChildIs0) {
-        //        //替换掉当前运算符，这个1节点将在回溯时处理
-        //        //新建一个1节点
-        //        TNode *temp;
-        //        temp = new TNode;
-        //        temp->eType = NODE_NUMBER;
-        //        temp->value = 1;
-
-        //        // 0节点连接到上面
-        //        if (now != head) {
-        //            if (now->parent->left == now) {
-        //                now->parent->left = temp;
-        //                temp->parent = now->parent;
-        //            }
-        //            if (now->parent->right == now) {
-        //                now->parent->right = temp;
-        //                temp->parent = now->parent;
-        //            }
-        //        } else
-        //            head = temp;
-
-        //        DeleteNode(now);
-        //    }
-
-        //    // 0-x=-x
-        //    if (now->eOperator == MATH_SUB && LChildIs0) {
-        //        TNode *LChild = now->left;
-        //        TNode *RChild = now->right;
-        //        now->eOperator = MATH_NEGATIVE;
-        //        now->left = RChild;
-        //        now->right = NULL;
-
-        //        delete LChild;
-        //    }
-
-        //}
-    }
-};
+inline std::size_t PreparedCache::Misses() const noexcept {
+    return misses;
+}
 
-} // namespace internal
+inline std::string PreparedCache::Path(const SymVec &equations, const std::vector<std::string> &vars) noexcept {
+    std::stringstream name;
+    name << Config::Get().preparedCacheDir << "/" << internal::PreparedCachePrefix << std::hex << std::setw(16)
+         << std::setfill('0') << MakeKey(equations, vars) << internal::PreparedCacheSuffix;
+    return name.str();
+}
 
-inline void Simplify(Node &node) noexcept {
-    internal::SimplifyFunctions::SimplifyWholeNode(node);
-    return;
+inline std::uint64_t PreparedCache::MakeKey(const SymVec &equations, const std::vector<std::string> &vars) noexcept {
+    // 格式版本也参与哈希，升级后不会读到旧格式的文件
+    auto seed = internal::HashCombine(equations.Hash(), internal::SerializeVersion);
+    for (auto &var : vars) {
+        seed = internal::HashCombine(seed, internal::HashSingleNode(NodeType::VARIABLE, MathOperator::MATH_NULL, 0, var));
+    }
+    return seed;
 }
 
 } // namespace tomsolver
@@ -3267,10 +9206,51 @@ public:
 
 /**
  * 把字符串解析为表达式。
+ * 单遍解析：词法分析与按优先级归约同时进行，直接构造节点，不生成中间的记号序列。非递归实现，括号嵌套再深也不会栈溢出。
+ * 语法与ParseFunctions的三步解析一致。
  * @exception ParseError
  */
 inline Node Parse(internal::StringView expression);
 
+/**
+ * 把字符串直接解析为FlatNode，所有节点连续存放在一个数组内，不为每个节点单独分配内存。
+ * 语法与Parse()相同。
+ * @exception ParseError
+ */
+inline FlatNode ParseFlat(internal::StringView expression);
+
+/**
+ * 把字符串直接编译为CompiledExpression，不经过Node。生成指令时做常量折叠。
+ * 语法与Parse()相同。
+ * @exception ParseError
+ */
+inline CompiledExpression ParseCompiled(internal::StringView expression);
+
+/**
+ * 方程组的解析结果。
+ */
+struct ParsedSystem {
+    SymVec equations;              // 每行一个方程，lhs = rhs化为lhs - rhs
+    std::vector<std::string> vars; // 所有方程中出现的变量名，按字典序排列
+};
+
+/**
+ * 把多行文本解析为方程组。
+ * 每行一个方程，可以写作表达式（即表达式 = 0）或者lhs = rhs的形式；#及之后到行尾为注释；空行与只有注释的行被跳过。
+ * 各行分块并行解析，线程数由Config::Get().threadNum决定。
+ * 出错时SingleParseError::GetLine()为出错的行号（从0开始），GetPos()为该行内的位置。
+ * 多行出错时抛出MultiParseError，包含所有出错的行。
+ * @exception ParseError
+ */
+inline ParsedSystem ParseSystem(internal::StringView text);
+
+/**
+ * 读取文件并解析为方程组，格式同ParseSystem()。文件通过MappedFile读取。
+ * @exception runtime_error 无法打开文件
+ * @exception ParseError
+ */
+inline ParsedSystem ParseSystemFile(const std::string &filename);
+
 inline Node operator""_f(const char *exp, size_t);
 
 } // namespace tomsolver
@@ -3372,6 +9352,42 @@ inline MathOperator Str2Function(internal::StringView s) noexcept {
     return MathOperator::MATH_NULL;
 }
 
+/* 变量名需以下划线或字母开头，其余为下划线、字母或数字。与VarNameIsLegal()一致，但不使用正则表达式 */
+inline bool IsLegalVarName(internal::StringView s) noexcept {
+    auto isAlpha = [](char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+    };
+    if (s.empty() || !isAlpha(*s.begin())) {
+        return false;
+    }
+    return std::all_of(s.begin() + 1, s.end(), [&isAlpha](char c) {
+        return isAlpha(c) || (c >= '0' && c <= '9');
+    });
+}
+
+/* 整个字符串是一个浮点数时返回true。与std::stod的判定一致 */
+inline bool StrToNumber(internal::StringView s, double &d) noexcept {
+    char buf[64];
+    std::string longStr;
+    auto len = static_cast<std::size_t>(std::distance(s.begin(), s.end()));
+    const char *str = buf;
+    if (len < sizeof(buf)) {
+        std::copy(s.begin(), s.end(), buf);
+        buf[len] = '\0';
+    } else {
+        longStr = s.toString();
+        str = longStr.c_str();
+    }
+
+    char *end;
+    auto savedErrno = errno;
+    errno = 0;
+    d = std::strtod(str, &end);
+    auto ok = end != str && end == str + len && errno != ERANGE;
+    errno = savedErrno;
+    return ok;
+}
+
 } // namespace
 
 inline const char *SingleParseError::what() const noexcept {
@@ -3505,6 +9521,7 @@ inline std::vector<Token> ParseFunctions::InOrderToPostOrder(std::deque<Token> &
             if (parenthesisBalance == 0) {
                 throw SingleParseError(f.line, f.pos, f.content, "Parenthesis not match: \"", f.s, "\"");
             }
+            parenthesisBalance--;
             for (auto token = popToken(); token.node->op != MathOperator::MATH_LEFT_PARENTHESIS; token = popToken()) {
                 postOrder.emplace_back(std::move(token));
             }
@@ -3519,21 +9536,15 @@ inline std::vector<Token> ParseFunctions::InOrderToPostOrder(std::deque<Token> &
 
         default:
             // 不是括号也不是正负号
-            if (!tokenStack.empty()) {
-                auto compare =
-                    IsLeft2Right(tokenStack.top().node->op)
-                        ? std::function<bool(const Token &)>{[cmp = std::less_equal<>{}, rank = Rank(f.node->op)](
-                                                                 const Token
-                                                                     &token) { // 左结合，则挤出高优先级及同优先级符号
-                              return cmp(rank, Rank(token.node->op));
-                          }}
-                        : std::function<bool(const Token &)>{
-                              [cmp = std::less<>{}, rank = Rank(f.node->op)](
-                                  const Token &token) { // 右结合，则挤出高优先级，但不挤出同优先级符号
-                                  return cmp(rank, Rank(token.node->op));
-                              }};
-
-                while (!tokenStack.empty() && compare(tokenStack.top())) {
+            // 栈顶为左结合，则挤出高优先级及同优先级符号；为右结合，则挤出高优先级，但不挤出同优先级符号。
+            // 每挤出一个符号都要按新的栈顶重新判断，否则a/-b/c会被解析为a/(-b/c)
+            {
+                auto rank = Rank(f.node->op);
+                while (!tokenStack.empty()) {
+                    auto top = tokenStack.top().node->op;
+                    if (!(rank < Rank(top) || (rank == Rank(top) && IsLeft2Right(top)))) {
+                        break;
+                    }
                     postOrder.push_back(std::move(tokenStack.top())); // 符号进入post队列
                     tokenStack.pop();
                 }
@@ -3614,938 +9625,1288 @@ inline Node ParseFunctions::BuildExpressionTree(std::vector<Token> &postOrder) {
 
     // 如果现在临时栈里面有超过1个元素，那么除了栈顶，其他的都代表出错
     if (tokenStack.size() > 1) {
-        // 扔掉最顶上的，构造到一半的表达式
-        tokenStack.pop();
-
-        std::vector<SingleParseError> errors;
-        while (!tokenStack.empty()) {
-            Token &token = tokenStack.top();
-            errors.emplace_back(token.line, token.pos, token.content, "Parse Error at: \"", token.s, "\"");
-            tokenStack.pop();
-        }
-        throw MultiParseError(errors);
-    }
-
-    return popNode();
-}
-
-} // namespace internal
-
-inline Node Parse(internal::StringView expression) {
-    auto tokens = internal::ParseFunctions::ParseToTokens(expression);
-    auto postOrder = internal::ParseFunctions::InOrderToPostOrder(tokens);
-    auto node = internal::ParseFunctions::BuildExpressionTree(postOrder);
-    return node;
-}
-
-inline Node operator""_f(const char *exp, size_t) {
-    return Parse(exp);
-}
-
-} // namespace tomsolver
-
-namespace tomsolver {
-
-/**
- * Armijo方法一维搜索，寻找alpha
- */
-inline double Armijo(const Vec &x, const Vec &d, std::function<Vec(Vec)> f, std::function<Mat(Vec)> df);
-
-/**
- * 割线法 进行一维搜索，寻找alpha
- */
-inline double FindAlpha(const Vec &x, const Vec &d, std::function<Vec(Vec)> f, double uncert = 1.0e-5);
-
-/**
- * 解非线性方程组equations。
- * 初值及变量名通过varsTable传入。
- * @exception runtime_error 迭代次数超出限制
- */
-inline VarsTable SolveByNewtonRaphson(const VarsTable &varsTable, const SymVec &equations);
-
-/**
- * 解非线性方程组equations。
- * 初值及变量名通过varsTable传入。
- * @exception runtime_error 迭代次数超出限制
- */
-inline VarsTable SolveByLM(const VarsTable &varsTable, const SymVec &equations);
+        // 扔掉最顶上的，构造到一半的表达式
+        tokenStack.pop();
 
-/**
- * 解非线性方程组equations。
- * 初值及变量名通过varsTable传入。
- * @exception runtime_error 迭代次数超出限制
- */
-inline VarsTable Solve(const VarsTable &varsTable, const SymVec &equations);
+        std::vector<SingleParseError> errors;
+        while (!tokenStack.empty()) {
+            Token &token = tokenStack.top();
+            errors.emplace_back(token.line, token.pos, token.content, "Parse Error at: \"", token.s, "\"");
+            tokenStack.pop();
+        }
+        throw MultiParseError(errors);
+    }
+
+    return popNode();
+}
 
 /**
- * 解非线性方程组equations。
- * 变量名通过分析equations得到。初值通过Config::Get()得到。
- * @exception runtime_error 迭代次数超出限制
+ * 以Node的形式输出解析结果。
  */
-inline VarsTable Solve(const SymVec &equations);
+class NodeBuilder {
+public:
+    using Handle = Node;
 
-} // namespace tomsolver
+    Handle Number(double value) noexcept {
+        return Num(value);
+    }
 
-using std::cout;
-using std::endl;
-using std::runtime_error;
+    Handle Variable(const char *name, std::size_t len) noexcept {
+        return std::make_unique<NodeImpl>(NodeType::VARIABLE, MathOperator::MATH_NULL, 0, std::string(name, len));
+    }
 
-namespace tomsolver {
+    Handle Unary(MathOperator op, Handle operand) noexcept {
+        return Operator(op, std::move(operand));
+    }
 
-inline double Armijo(const Vec &x, const Vec &d, std::function<Vec(Vec)> f, std::function<Mat(Vec)> df) {
-    double alpha = 1;   // a > 0
-    double gamma = 0.4; // 取值范围(0, 0.5)越大越快
-    double sigma = 0.5; // 取值范围(0, 1)越大越慢
-    Vec x_new(x);
-    while (1) {
-        x_new = x + alpha * d;
+    Handle Binary(MathOperator op, Handle left, Handle right) noexcept {
+        return Operator(op, std::move(left), std::move(right));
+    }
 
-        auto l = f(x_new).Norm2();
-        auto r = (f(x).AsMat() + gamma * alpha * df(x).Transpose() * d).Norm2();
-        if (l <= r) // 检验条件
-        {
-            break;
-        } else
-            alpha = alpha * sigma; // 缩小alpha，进入下一次循环
+    Node Finish(Handle root) noexcept {
+        return root;
     }
-    return alpha;
-}
+};
 
-inline double FindAlpha(const Vec &x, const Vec &d, std::function<Vec(Vec)> f, double uncert) {
-    double alpha_cur = 0;
+/**
+ * 单遍解析。一边做词法分析，一边按优先级归约（即以显式栈实现的precedence climbing），归约的同时由builder构造节点。
+ * 语法与ParseFunctions的三步解析一致：
+ *      函数与正负号是前缀运算符，优先级高于所有二元运算符，函数后面的括号可以省略；
+ *      二元运算符的优先级与结合性由Rank()、IsLeft2Right()决定。
+ * 由于前缀运算符的优先级最高，它们在操作数完整出现后（数值、变量或者右括号之后）立即归约。
+ * 节点按后序被追加，因此FlatNodeBuilder可以直接得到后序序列。
+ * @exception ParseError
+ */
+template <typename Builder>
+inline auto ParseWith(StringView expression, Builder &builder, int line, StringView content) {
+    using Handle = typename Builder::Handle;
 
-    double alpha_new = 1;
+    auto posOf = [&content](const char *p) {
+        return static_cast<int>(std::distance(content.begin(), p));
+    };
 
-    int it = 0;
-    int maxIter = 100;
+    if (expression.empty()) {
+        throw SingleParseError(line, posOf(expression.begin()), content, "empty input");
+    }
 
-    Vec g_cur = f(x + alpha_cur * d);
+    struct PendingOperator {
+        MathOperator op;
+        int pos;
+    };
+    std::vector<PendingOperator> operators;
+    std::vector<Handle> operands;
+
+    auto reduceTop = [&] {
+        auto op = operators.back().op;
+        operators.pop_back();
+        if (GetOperatorNum(op) == 2) {
+            auto right = std::move(operands.back());
+            operands.pop_back();
+            operands.back() = builder.Binary(op, std::move(operands.back()), std::move(right));
+        } else {
+            operands.back() = builder.Unary(op, std::move(operands.back()));
+        }
+    };
 
-    while (std::abs(alpha_new - alpha_cur) > alpha_cur * uncert) {
-        double alpha_old = alpha_cur;
-        alpha_cur = alpha_new;
-        Vec g_old = g_cur;
-        g_cur = f(x + alpha_cur * d);
+    // 操作数完整出现后，归约紧挨着它的前缀运算符
+    auto reducePrefix = [&] {
+        while (!operators.empty() && operators.back().op != MathOperator::MATH_LEFT_PARENTHESIS &&
+               GetOperatorNum(operators.back().op) == 1) {
+            reduceTop();
+        }
+    };
 
-        if (g_cur < g_old) {
-            break;
+    bool expectOperand = true;
+    auto iter = expression.begin();
+    while (iter != expression.end()) {
+        auto c = *iter;
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            ++iter;
+            continue;
         }
 
-        // FIXME: nan occurred
-        alpha_new = EachDivide((g_cur * alpha_old - g_old * alpha_cur), (g_cur - g_old)).NormNegInfinity();
+        if (IsBasicOperator(c)) {
+            auto pos = posOf(iter);
+            ++iter;
 
-        // cout << it<<"\t"<<alpha_new << endl;
-        if (it++ > maxIter) {
-            cout << "FindAlpha: over iterator" << endl;
-            break;
-        }
-    }
-    return alpha_new;
-}
+            if (expectOperand) {
+                if (c == '(') {
+                    operators.push_back({MathOperator::MATH_LEFT_PARENTHESIS, pos});
+                } else if (c == '+' || c == '-') {
+                    operators.push_back({BaseOperatorCharToEnum(c, true), pos});
+                } else {
+                    throw SingleParseError(line, pos, content, "Missing operand before: \"", StringView{iter - 1, 1},
+                                           "\"");
+                }
+                continue;
+            }
 
-inline VarsTable SolveByNewtonRaphson(const VarsTable &varsTable, const SymVec &equations) {
-    int it = 0; // 迭代计数
-    VarsTable table = varsTable;
-    int n = table.VarNums(); // 未知量数量
-    Vec q(n);                // x向量
+            if (c == '(') {
+                throw SingleParseError(line, pos, content, "Parse Error at: \"", StringView{iter - 1, 1}, "\"");
+            }
 
-    SymMat jaEqs = Jacobian(equations, table.Vars());
+            if (c == ')') {
+                while (!operators.empty() && operators.back().op != MathOperator::MATH_LEFT_PARENTHESIS) {
+                    reduceTop();
+                }
+                if (operators.empty()) {
+                    throw SingleParseError(line, pos, content, "Parenthesis not match: \"", StringView{iter - 1, 1},
+                                           "\"");
+                }
+                operators.pop_back();
+                reducePrefix();
+                continue;
+            }
 
-    if (Config::Get().logLevel >= LogLevel::TRACE) {
-        cout << "Jacobian = " << jaEqs.ToString() << endl;
-    }
+            // 二元运算符：左结合则挤出高优先级及同优先级运算符，右结合则只挤出高优先级运算符
+            auto op = BaseOperatorCharToEnum(c, false);
+            auto rank = Rank(op);
+            while (!operators.empty() && operators.back().op != MathOperator::MATH_LEFT_PARENTHESIS) {
+                auto top = operators.back().op;
+                if (rank < Rank(top) || (rank == Rank(top) && IsLeft2Right(top))) {
+                    reduceTop();
+                } else {
+                    break;
+                }
+            }
+            operators.push_back({op, pos});
+            expectOperand = true;
+            continue;
+        }
 
-    while (1) {
-        Vec phi = equations.Clone().Subs(table).Calc().ToMat().ToVec();
-        if (Config::Get().logLevel >= LogLevel::TRACE) {
-            cout << "iteration = " << it << endl;
-            cout << "phi = " << phi << endl;
+        // 数值、函数名或者变量名
+        auto nameIter = iter;
+        while (iter != expression.end() && !IsBasicOperator(*iter) &&
+               !std::isspace(static_cast<unsigned char>(*iter))) {
+            ++iter;
         }
+        auto name = StringView{nameIter, static_cast<std::size_t>(std::distance(nameIter, iter))};
+        auto pos = posOf(nameIter);
 
-        if (phi == 0) {
-            break;
+        if (!expectOperand) {
+            throw SingleParseError(line, pos, content, "Parse Error at: \"", name, "\"");
         }
 
-        if (it > Config::Get().maxIterations) {
-            throw runtime_error("迭代次数超出限制");
+        double d;
+        if (StrToNumber(name, d)) {
+            operands.emplace_back(builder.Number(d));
+            expectOperand = false;
+            reducePrefix();
+            continue;
         }
 
-        Mat ja = jaEqs.Clone().Subs(table).Calc().ToMat();
+        auto op = Str2Function(name);
+        if (op != MathOperator::MATH_NULL) {
+            operators.push_back({op, pos});
+            continue;
+        }
 
-        Vec deltaq = SolveLinear(ja, -phi);
+        if (!IsLegalVarName(name)) {
+            throw SingleParseError(line, pos, content, "Invalid variable name: \"", name, "\"");
+        }
+        operands.emplace_back(
+            builder.Variable(name.begin(), static_cast<std::size_t>(std::distance(name.begin(), name.end()))));
+        expectOperand = false;
+        reducePrefix();
+    }
 
-        q += deltaq;
+    if (expectOperand) {
+        throw SingleParseError(line, posOf(expression.end()), content, "Missing operand at the end");
+    }
 
-        if (Config::Get().logLevel >= LogLevel::TRACE) {
-            cout << "ja = " << ja << endl;
-            cout << "deltaq = " << deltaq << endl;
-            cout << "q = " << q << endl;
+    while (!operators.empty()) {
+        // 退栈时出现左括号，说明没有找到与之匹配的右括号
+        if (operators.back().op == MathOperator::MATH_LEFT_PARENTHESIS) {
+            throw SingleParseError(line, operators.back().pos, content, "Parenthesis not match: \"(\"");
         }
+        reduceTop();
+    }
 
-        table.SetValues(q);
+    assert(operands.size() == 1);
+    return builder.Finish(std::move(operands.back()));
+}
 
-        ++it;
-    }
-    return table;
+} // namespace internal
+
+inline Node Parse(internal::StringView expression) {
+    internal::NodeBuilder builder;
+    return internal::ParseWith(expression, builder, 0, expression);
 }
 
-inline VarsTable SolveByLM(const VarsTable &varsTable, const SymVec &equations) {
-    int it = 0; // 迭代计数
-    VarsTable table = varsTable;
-    int n = table.VarNums(); // 未知量数量
-    Vec q = table.Values();  // x向量
+inline FlatNode ParseFlat(internal::StringView expression) {
+    internal::FlatNodeBuilder builder;
+    return internal::ParseWith(expression, builder, 0, expression);
+}
 
-    SymMat JaEqs = Jacobian(equations, table.Vars());
+inline CompiledExpression ParseCompiled(internal::StringView expression) {
+    internal::CompiledExpressionBuilder builder;
+    return internal::ParseWith(expression, builder, 0, expression);
+}
 
-    if (Config::Get().logLevel >= LogLevel::TRACE) {
-        cout << "Jacobi = " << JaEqs << endl;
-    }
+namespace internal {
 
-    while (1) {
-        if (Config::Get().logLevel >= LogLevel::TRACE) {
-            cout << "iteration = " << it << endl;
-        }
+// 解析方程组中的一行。lhs = rhs化为lhs - rhs，rhs为0时直接返回lhs
+inline Node ParseEquation(StringView content, int line) {
+    NodeBuilder builder;
+    auto eq = std::find(content.begin(), content.end(), '=');
+    if (eq == content.end()) {
+        return ParseWith(content, builder, line, content);
+    }
 
-        double mu = 1e-5; // LM方法的λ值
+    auto eq2 = std::find(eq + 1, content.end(), '=');
+    if (eq2 != content.end()) {
+        throw SingleParseError(line, static_cast<int>(std::distance(content.begin(), eq2)), content,
+                               "Unexpected \"=\"");
+    }
 
-        Vec F = equations.Clone().Subs(table).Calc().ToMat().ToVec(); // 计算F
+    auto lhs = ParseWith(StringView{content.begin(), static_cast<std::size_t>(std::distance(content.begin(), eq))},
+                         builder, line, content);
+    auto rhs = ParseWith(StringView{eq + 1, static_cast<std::size_t>(std::distance(eq + 1, content.end()))}, builder,
+                         line, content);
+    if (rhs->Equal(Num(0))) {
+        return lhs;
+    }
+    return Operator(MathOperator::MATH_SUB, std::move(lhs), std::move(rhs));
+}
 
-        if (Config::Get().logLevel >= LogLevel::TRACE) {
-            cout << "F = " << F << endl;
-        }
+} // namespace internal
 
-        if (F == 0) { // F值为0，满足方程组求根条件
-            break;
+inline ParsedSystem ParseSystem(internal::StringView text) {
+    // 先顺序切分出所有行，去掉注释，跳过空行
+    struct Line {
+        internal::StringView content;
+        int line;
+    };
+    std::vector<Line> lines;
+    auto iter = text.begin();
+    for (int line = 0; iter != text.end(); ++line) {
+        auto lineEnd = std::find(iter, text.end(), '\n');
+        auto contentEnd = std::find(iter, lineEnd, '#');
+        if (!std::all_of(iter, contentEnd, [](char c) {
+                return std::isspace(static_cast<unsigned char>(c));
+            })) {
+            lines.push_back({{iter, static_cast<std::size_t>(std::distance(iter, contentEnd))}, line});
         }
+        iter = lineEnd == text.end() ? lineEnd : lineEnd + 1;
+    }
 
-        Vec FNew(n);   // 下一轮F
-        Vec deltaq(n); // Δq
-        while (1) {
-
-            Mat J = JaEqs.Clone().Subs(table).Calc().ToMat(); // 计算雅可比矩阵
+    if (lines.empty()) {
+        throw SingleParseError(0, 0, {}, "no equation");
+    }
 
-            if (Config::Get().logLevel >= LogLevel::TRACE) {
-                cout << "J = " << J << endl;
+    // 各行互不依赖，分块并行解析。收集所有行的错误，而不是遇到第一个错误就停止
+    int n = static_cast<int>(lines.size());
+    std::vector<Node> nodes(n);
+    std::vector<SingleParseError> errors;
+    std::mutex mutex;
+    internal::ParallelFor(n, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            try {
+                nodes[i] = internal::ParseEquation(lines[i].content, lines[i].line);
+            } catch (const SingleParseError &err) {
+                std::lock_guard<std::mutex> lock(mutex);
+                errors.emplace_back(err);
             }
+        }
+    });
 
-            // 说明：
-            // 标准的LM方法中，d=-(J'*J+λI)^(-1)*J'F，其中J'*J是为了确保矩阵对称正定。有时d会过大，很难收敛。
-            // 牛顿法的 d=-(J+λI)^(-1)*F
-
-            // 方向向量
-            Vec d = SolveLinear(J.Transpose() * J + mu * Mat(J.Rows(), J.Cols()).Ones(),
-                                -(J.Transpose() * F).ToVec()); // 得到d
-
-            if (Config::Get().logLevel >= LogLevel::TRACE) {
-                cout << "d = " << d << endl;
-            }
+    if (!errors.empty()) {
+        std::sort(errors.begin(), errors.end(), [](const SingleParseError &lhs, const SingleParseError &rhs) {
+            return lhs.GetLine() < rhs.GetLine();
+        });
+        if (errors.size() == 1) {
+            throw errors.front();
+        }
+        // MultiParseError按逆序输出
+        std::reverse(errors.begin(), errors.end());
+        throw MultiParseError(errors);
+    }
 
-            double alpha = Armijo(
-                q, d,
-                [&](Vec v) -> Vec {
-                    table.SetValues(v);
-                    return equations.Clone().Subs(table).Calc().ToMat().ToVec();
-                },
-                [&](Vec v) -> Mat {
-                    table.SetValues(v);
-                    return JaEqs.Clone().Subs(table).Calc().ToMat();
-                }); // 进行1维搜索得到alpha
+    SymVec equations(n);
+    for (int i = 0; i < n; ++i) {
+        equations[i] = std::move(nodes[i]);
+    }
+    auto varSet = equations.GetAllVarNames();
+    return {std::move(equations), {varSet.begin(), varSet.end()}};
+}
 
-            // double alpha = FindAlpha(q, d, std::bind(SixBarAngPosition, std::placeholders::_1, thetaCDKL, Hhit));
+inline ParsedSystem ParseSystemFile(const std::string &filename) {
+    MappedFile file(filename);
+    return ParseSystem({file.Data(), file.Size()});
+}
 
-            // for (size_t i = 0; i < alpha.rows; ++i)
-            //{
-            //	if (alpha[i] != alpha[i])
-            //		alpha[i] = 1.0;
-            //}
+inline Node operator""_f(const char *exp, size_t) {
+    return Parse(exp);
+}
 
-            deltaq = alpha * d; // 计算Δq
+} // namespace tomsolver
 
-            Vec qTemp = q + deltaq;
-            table.SetValues(qTemp);
+using std::cout;
+using std::endl;
+using std::runtime_error;
 
-            FNew = equations.Clone().Subs(table).Calc().ToMat().ToVec(); // 计算新的F
+namespace tomsolver {
 
-            if (Config::Get().logLevel >= LogLevel::TRACE) {
-                cout << "it=" << it << endl;
-                cout << "\talpha=" << alpha << endl;
-                cout << "mu=" << mu << endl;
-                cout << "F.Norm2()=" << F.Norm2() << endl;
-                cout << "FNew.Norm2()=" << FNew.Norm2() << endl;
-                cout << "\tF(x k+1).Norm2()\t" << ((FNew.Norm2() < F.Norm2()) ? "<" : ">=") << "\tF(x k).Norm2()\t"
-                     << endl;
-            }
+namespace internal {
 
-            if (FNew.Norm2() < F.Norm2()) // 满足下降条件，跳出内层循环
-            {
-                break;
-            } else {
-                mu *= 10.0; // 扩大λ，使模型倾向梯度下降方向
-            }
+/**
+ * 本线程正在进行（或者最近一次）的求解的统计信息。
+ */
+inline SolveStats &CurrentSolveStats() noexcept {
+    thread_local SolveStats stats;
+    return stats;
+}
 
-            if (it++ == Config::Get().maxIterations) {
-                throw runtime_error("迭代次数超出限制");
+/**
+ * 方程组与雅可比矩阵的求值器。
+ * Config::Get().nativeCompile为true时使用NativeModel，编译失败则退回CompiledSymMat。
+ * 最近求值过的Config::Get().evaluationCacheSize个点的F(x)、J(x)保存在缓存中，x按位相同时直接返回缓存的结果。
+ * 线搜索会在同一个点上反复求值，缓存可以省去这些重复计算。求值次数与命中次数记录在CurrentSolveStats()中。
+ * 缓存条目的缓冲区重复使用，预热之后以指针接口求值不再分配内存。
+ */
+class SystemEvaluator : public LineSearchProblem {
+public:
+    SystemEvaluator(const SymVec &equations, const SymMat &jaEqs, const std::vector<std::string> &vars)
+        : rows(equations.Rows()), cols(static_cast<int>(vars.size())), capacity(Config::Get().evaluationCacheSize) {
+        if (Config::Get().nativeCompile) {
+            try {
+                native = std::make_unique<NativeModel>(equations, jaEqs, vars);
+                return;
+            } catch (const std::runtime_error &e) {
+                if (Config::Get().logLevel >= LogLevel::WARN) {
+                    cout << "[WARN] " << e.what() << ", fall back to CompiledSymMat" << endl;
+                }
             }
         }
+        compiledEqs = std::make_unique<CompiledSymMat>(equations, vars);
+        compiledJaEqs = std::make_unique<CompiledSymMat>(jaEqs, vars);
+    }
 
-        q += deltaq; // 应用Δq，更新q值
-
-        table.SetValues(q);
+    int Rows() const noexcept override {
+        return rows;
+    }
 
-        F = FNew; // 更新F
+    int Cols() const noexcept override {
+        return cols;
+    }
 
-        if (it++ == Config::Get().maxIterations) {
-            throw runtime_error("迭代次数超出限制");
+    void Residual(const double *x, double *f) override {
+        auto size = static_cast<std::size_t>(rows);
+        auto entry = Lookup(x);
+        if (entry && entry->hasF) {
+            ++CurrentSolveStats().cacheHits;
+            std::copy(entry->f.begin(), entry->f.end(), f);
+            return;
         }
-
-        if (Config::Get().logLevel >= LogLevel::TRACE) {
-            cout << std::string(20, '=') << endl;
+        ++CurrentSolveStats().cacheMisses;
+        ++CurrentSolveStats().residualEvaluations;
+        if (native) {
+            native->EvalResidual(x, f);
+            CheckFinite(f, size, "residual");
+        } else {
+            compiledEqs->Eval(x, f, ws);
+        }
+        if (capacity > 0) {
+            entry = entry ? entry : Insert(x);
+            entry->f.assign(f, f + size);
+            entry->hasF = true;
         }
     }
 
-    if (Config::Get().logLevel >= LogLevel::TRACE) {
-        cout << "success" << endl;
+    void Jacobian(const double *x, double *J) override {
+        auto size = static_cast<std::size_t>(rows) * static_cast<std::size_t>(cols);
+        auto entry = Lookup(x);
+        if (entry && entry->hasJ) {
+            ++CurrentSolveStats().cacheHits;
+            std::copy(entry->J.begin(), entry->J.end(), J);
+            return;
+        }
+        ++CurrentSolveStats().cacheMisses;
+        ++CurrentSolveStats().jacobianEvaluations;
+        if (native) {
+            native->EvalJacobian(x, J);
+            CheckFinite(J, size, "jacobian");
+        } else {
+            compiledJaEqs->Eval(x, J, ws);
+        }
+        if (capacity > 0) {
+            entry = entry ? entry : Insert(x);
+            entry->J.assign(J, J + size);
+            entry->hasJ = true;
+        }
     }
 
-    return table;
-}
-
-inline VarsTable Solve(const VarsTable &varsTable, const SymVec &equations) {
-    switch (Config::Get().nonlinearMethod) {
-    case NonlinearMethod::NEWTON_RAPHSON:
-        return SolveByNewtonRaphson(varsTable, equations);
-    case NonlinearMethod::LM:
-        return SolveByLM(varsTable, equations);
+    Vec F(const Vec &x) {
+        Vec ret(rows);
+        Residual(&x.Value(0, 0), &ret[0]);
+        return ret;
     }
-    throw runtime_error("invalid config.NonlinearMethod value: " +
-                        std::to_string(static_cast<int>(Config::Get().nonlinearMethod)));
-}
-
-inline VarsTable Solve(const SymVec &equations) {
-    auto varNames = equations.GetAllVarNames();
-    std::vector<std::string> vecVarNames(varNames.begin(), varNames.end());
-    VarsTable varsTable(std::move(vecVarNames), Config::Get().initialValue);
-    return Solve(varsTable, equations);
-}
 
-} // namespace tomsolver
+    Mat J(const Vec &x) {
+        Mat ret(rows, cols);
+        Jacobian(&x.Value(0, 0), &ret.Value(0, 0));
+        return ret;
+    }
 
-namespace tomsolver {
+private:
+    struct CacheEntry {
+        std::vector<double> x;
+        std::vector<double> f;
+        std::vector<double> J;
+        bool hasF = false;
+        bool hasJ = false;
+    };
 
-namespace internal {
+    int rows, cols;
+    std::unique_ptr<NativeModel> native;
+    std::unique_ptr<CompiledSymMat> compiledEqs;
+    std::unique_ptr<CompiledSymMat> compiledJaEqs;
+    CompiledSymMat::Workspace ws;
 
-class DiffFunctions {
-public:
-    struct DiffNode {
-        NodeImpl &node;
-        const bool isLeftChild;
+    std::size_t capacity;
+    std::vector<CacheEntry> cache; // 按最近使用排序，最近使用的在最前面
 
-        DiffNode(NodeImpl &node) : node(node), isLeftChild(node.parent && node.parent->left.get() == &node) {}
-    };
+    // NativeModel的指针接口不检查无效值，这里按Config::Get().throwOnInvalidValue补上
+    static void CheckFinite(const double *v, std::size_t n, const char *what) {
+        if (!Config::Get().throwOnInvalidValue) {
+            return;
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            if (!std::isfinite(v[i])) {
+                throw MathError(ErrorType::ERROR_INVALID_NUMBER,
+                                std::string("NativeModel: ") + what + "[" + std::to_string(i) + "] = " + ToString(v[i]));
+            }
+        }
+    }
 
-    static void DiffOnce(Node &root, const std::string &varname) {
-        std::queue<DiffNode> q;
+    // 按位比较，-0.0与0.0、不同的nan视为不同的点
+    CacheEntry *Lookup(const double *x) noexcept {
+        auto bytes = static_cast<std::size_t>(cols) * sizeof(double);
+        for (auto it = cache.begin(); it != cache.end(); ++it) {
+            if (std::memcmp(it->x.data(), x, bytes) == 0) {
+                std::rotate(cache.begin(), it, it + 1);
+                return &cache.front();
+            }
+        }
+        return nullptr;
+    }
 
-        if (root->type == NodeType::OPERATOR) {
-            DiffOnceOperator(root, q);
-        } else {
-            q.emplace(*root);
+    CacheEntry *Insert(const double *x) {
+        if (cache.size() < capacity) {
+            cache.emplace_back();
         }
+        // 最久未使用的条目移到最前面，重新使用
+        std::rotate(cache.begin(), cache.end() - 1, cache.end());
+        auto &entry = cache.front();
+        entry.x.assign(x, x + cols);
+        entry.hasF = false;
+        entry.hasJ = false;
+        return &entry;
+    }
+};
 
-        while (!q.empty()) {
-            auto &node = q.front().node;
-            auto isLeftChild = q.front().isLeftChild;
-            q.pop();
+/**
+ * 以标量类型T做Newton-Raphson迭代。x传入初值，返回时为迭代结果。
+ * 所有方程的绝对值都小于tolerance、残差的范数不再下降（T的精度已经用尽）、雅可比矩阵奇异、出现无效值，
+ * 或者迭代次数达到maxIterations时结束。x只保留残差下降的迭代结果。返回迭代次数。
+ */
+template <typename T>
+inline int NewtonIterate(const CompiledSymMat &eqs, const CompiledSymMat &ja, std::vector<T> &x, T tolerance,
+                  int maxIterations) {
+    auto m = eqs.Rows();
+    auto n = static_cast<int>(x.size());
+    if (m != n) {
+        return 0;
+    }
 
-            switch (node.type) {
-            case NodeType::VARIABLE:
-                node.type = NodeType::NUMBER;
-                node.value = node.varname == varname ? 1 : 0;
-                node.varname = "";
-                break;
+    CompiledSymMat::BasicWorkspace<T> ws;
+    std::vector<T> f(n), J(n * n), xNew(n);
+    std::vector<int> perm(n);
+    auto norm = [&f] {
+        T ret = 0;
+        for (auto v : f) {
+            ret = std::max(ret, std::abs(v));
+        }
+        return ret;
+    };
 
-            case NodeType::NUMBER:
-                node.value = 0;
+    int it = 0;
+    try {
+        eqs.EvalAs(x.data(), f.data(), ws);
+        auto fNorm = norm();
+        while (fNorm >= tolerance && it < maxIterations) {
+            ja.EvalAs(x.data(), J.data(), ws);
+            if (!LuDecompose(n, J.data(), perm.data(), std::numeric_limits<T>::min())) {
                 break;
+            }
+            LuSolve(n, J.data(), perm.data(), f.data());
+            for (int i = 0; i < n; ++i) {
+                xNew[i] = x[i] - f[i];
+            }
+            ++it;
 
-            case NodeType::OPERATOR: {
-                auto &child = isLeftChild ? node.parent->left : node.parent->right;
-                DiffOnceOperator(child, q);
+            eqs.EvalAs(xNew.data(), f.data(), ws);
+            auto fNewNorm = norm();
+            if (!(fNewNorm < fNorm)) {
                 break;
             }
-            default:
-                assert(0 && "inner bug");
-            }
+            x.swap(xNew);
+            fNorm = fNewNorm;
         }
+    } catch (const MathError &) {
+        // 交给后续的double迭代处理
     }
+    return it;
+}
 
-    static void DiffOnceOperator(Node &node, std::queue<DiffNode> &q) {
-        auto parent = node->parent;
+/**
+ * 以标量类型T预先迭代，见Config::nonlinearScalarType。迭代结果写入table与q，返回迭代次数。
+ */
+template <typename T>
+inline int PresolveAs(const SymVec &equations, const SymMat &jaEqs, VarsTable &table, Vec &q) {
+    CompiledSymMat eqs(equations, table.Vars());
+    CompiledSymMat ja(jaEqs, table.Vars());
+    std::vector<T> x(table.VarNums());
+    for (int i = 0; i < table.VarNums(); ++i) {
+        x[i] = static_cast<T>(table.Values()[i]);
+    }
 
-        // 调用前提：node是1元操作符
-        // 如果node的成员是数字，那么整个node变为数字节点，value=0，且返回true
-        // 例如： sin(1)' = 0
-        auto CullNumberMember = [&node]() -> bool {
-            assert(GetOperatorNum(node->op) == 1);
-            assert(node->left);
-            if (node->left->type == NodeType::NUMBER) {
-                node->left = nullptr;
-                node->type = NodeType::NUMBER;
-                node->op = MathOperator::MATH_NULL;
-                node->value = 0.0;
-                return true;
-            }
-            return false;
-        };
+    auto it = NewtonIterate(eqs, ja, x, static_cast<T>(Config::Get().epsilon), Config::Get().maxIterations);
+    if (it > 0) {
+        for (int i = 0; i < table.VarNums(); ++i) {
+            q[i] = static_cast<double>(x[i]);
+        }
+        table.SetValues(q);
+    }
+    return it;
+}
 
-        // 调用前提：node是2元操作符
-        // 如果node的成员是数字，那么整个node变为数字节点，value=0，且返回true
-        // 例如： (2*3)' = 0
-        auto CullNumberMemberBinary = [&node]() -> bool {
-            assert(GetOperatorNum(node->op) == 2);
-            assert(node->left && node->right);
-            if (node->left->type == NodeType::NUMBER && node->right->type == NodeType::NUMBER) {
-                node->left = nullptr;
-                node->right = nullptr;
-                node->type = NodeType::NUMBER;
-                node->op = MathOperator::MATH_NULL;
-                node->value = 0.0;
-                return true;
-            }
-            return false;
-        };
+} // namespace internal
 
-        switch (node->op) {
-        case MathOperator::MATH_NULL: {
-            assert(0 && "inner bug");
+inline double Armijo(const Vec &x, const Vec &d, const std::function<Vec(Vec)> &f, const std::function<Mat(Vec)> &df) {
+    double alpha = 1;   // a > 0
+    double gamma = 0.4; // 取值范围(0, 0.5)越大越快
+    double sigma = 0.5; // 取值范围(0, 1)越大越慢
+    // x不变，f(x)与df(x)只需要计算一次
+    Mat fx = f(x).AsMat();
+    Mat dfxd = df(x).Transpose() * d;
+    Vec x_new(x);
+    while (1) {
+        x_new = x + alpha * d;
+
+        auto l = f(x_new).Norm2();
+        auto r = (fx + gamma * alpha * dfxd).Norm2();
+        if (l <= r) // 检验条件
+        {
             break;
-        }
-        case MathOperator::MATH_POSITIVE:
-        case MathOperator::MATH_NEGATIVE: {
-            q.emplace(*node->left);
-            return;
-        }
+        } else
+            alpha = alpha * sigma; // 缩小alpha，进入下一次循环
+    }
+    return alpha;
+}
 
-        // 函数
-        case MathOperator::MATH_SIN: {
-            if (CullNumberMember()) {
-                return;
-            }
+inline double FindAlpha(const Vec &x, const Vec &d, const std::function<Vec(Vec)> &f, double uncert) {
+    double alpha_cur = 0;
 
-            // sin(u)' = cos(u) * u'
-            node->op = MathOperator::MATH_COS;
-            auto u2 = Clone(node->left);
-            q.emplace(*u2);
-            node = Move(node) * Move(u2);
-            node->parent = parent;
+    double alpha_new = 1;
+
+    int it = 0;
+    int maxIter = 100;
+
+    Vec g_cur = f(x + alpha_cur * d);
+
+    while (std::abs(alpha_new - alpha_cur) > alpha_cur * uncert) {
+        double alpha_old = alpha_cur;
+        alpha_cur = alpha_new;
+        Vec g_old = g_cur;
+        g_cur = f(x + alpha_cur * d);
+
+        if (g_cur < g_old) {
             break;
         }
-        case MathOperator::MATH_COS: {
-            if (CullNumberMember()) {
-                return;
-            }
 
-            // cos(u)' = -sin(u) * u'
-            node->op = MathOperator::MATH_SIN;
-            auto u2 = Clone(node->left);
-            q.emplace(*u2);
-            node = -Move(node) * Move(u2);
-            node->parent = parent;
+        // FIXME: nan occurred
+        alpha_new = EachDivide((g_cur * alpha_old - g_old * alpha_cur), (g_cur - g_old)).NormNegInfinity();
+
+        // cout << it<<"\t"<<alpha_new << endl;
+        if (it++ > maxIter) {
+            if (Config::Get().logLevel >= LogLevel::DEBUG) {
+                cout << "[DEBUG] FindAlpha: over iterator" << endl;
+            }
             break;
         }
-        case MathOperator::MATH_TAN: {
-            if (CullNumberMember()) {
-                return;
-            }
+    }
+    return alpha_new;
+}
 
-            // tan'u = 1/(cos(u)^2) * u'
-            node->op = MathOperator::MATH_COS;
-            auto &u = node->left;
-            auto u2 = Clone(u);
-            q.emplace(*u2);
-            node = Num(1) / (Move(node) ^ Num(2)) * Move(u2);
-            node->parent = parent;
-            return;
-        }
-        case MathOperator::MATH_ARCSIN: {
-            if (CullNumberMember()) {
-                return;
-            }
+namespace internal {
 
-            // asin'u = 1/sqrt(1-u^2) * u'
-            auto &u = node->left;
-            auto u2 = Clone(u);
-            q.emplace(*u2);
-            node = (Num(1) / sqrt(Num(1) - (Move(u) ^ Num(2)))) * Move(u2);
-            node->parent = parent;
-            return;
-        }
-        case MathOperator::MATH_ARCCOS: {
-            if (CullNumberMember()) {
-                return;
-            }
+inline void CheckPreparedVars(const VarsTable &varsTable, const PreparedSystem &system) {
+    if (varsTable.Vars() != system.vars) {
+        throw runtime_error("the variables of varsTable do not match the prepared system");
+    }
+}
 
-            // acos'u = -1/sqrt(1-u^2) * u'
-            auto &u = node->left;
-            auto u2 = Clone(u);
-            q.emplace(*u2);
-            node = (Num(-1) / sqrt(Num(1) - (Move(u) ^ Num(2)))) * Move(u2);
-            node->parent = parent;
-            return;
-        }
-        case MathOperator::MATH_ARCTAN: {
-            if (CullNumberMember()) {
-                return;
-            }
+inline VarsTable NewtonRaphson(const VarsTable &varsTable, const SymVec &equations, const SymMat &jaEqs) {
+    auto &stats = CurrentSolveStats();
+    stats = {};
 
-            // atan'u = 1/(1+u^2) * u'
-            auto &u = node->left;
-            auto u2 = Clone(u);
-            q.emplace(*u2);
-            node = (Num(1) / (Num(1) + (Move(u) ^ Num(2)))) * Move(u2);
-            node->parent = parent;
-            return;
-        }
-        case MathOperator::MATH_SQRT: {
-            if (CullNumberMember()) {
-                return;
-            }
+    int it = 0; // 迭代计数
+    VarsTable table = varsTable;
+    Vec q = table.Values();  // x向量
 
-            // sqrt(u)' = 1/(2*sqrt(u)) * u'
-            auto &u = node->left;
-            auto u2 = Clone(u);
-            q.emplace(*u2);
-            node = Num(1) / (Num(2) * Move(node)) * Move(u2);
-            node->parent = parent;
-            return;
-        }
-        case MathOperator::MATH_LOG: {
-            if (CullNumberMember()) {
-                return;
-            }
+    if (Config::Get().logLevel >= LogLevel::TRACE) {
+        cout << "Jacobian = " << jaEqs.ToString() << endl;
+    }
+
+    internal::SystemEvaluator evaluator(equations, jaEqs, table.Vars());
+
+    switch (Config::Get().nonlinearScalarType) {
+    case ScalarType::FLOAT:
+        it += internal::PresolveAs<float>(equations, jaEqs, table, q);
+        break;
+    case ScalarType::LONG_DOUBLE:
+        it += internal::PresolveAs<long double>(equations, jaEqs, table, q);
+        break;
+    case ScalarType::DOUBLE:
+        break;
+    }
+
+    while (1) {
+        Vec phi = evaluator.F(table.Values());
+        if (Config::Get().logLevel >= LogLevel::TRACE) {
+            cout << "iteration = " << it << endl;
+            cout << "phi = " << phi << endl;
+        }
 
-            // ln(u)' = 1/u * u'
-            auto &u = node->left;
-            auto u2 = Clone(u);
-            q.emplace(*u2);
-            node = (Num(1) / Move(u)) * Move(u2);
-            node->parent = parent;
-            return;
+        stats.iterations = it;
+        if (phi == 0) {
+            break;
         }
-        case MathOperator::MATH_LOG2: {
-            if (CullNumberMember()) {
-                return;
-            }
 
-            // loga(u)' = 1/(u * ln(a)) * u'
-            auto a = 2.0;
-            auto &u = node->left;
-            auto u2 = Clone(u);
-            q.emplace(*u2);
-            node = (Num(1) / (Move(u) * Num(std::log(a)))) * Move(u2);
-            node->parent = parent;
-            return;
+        if (it > Config::Get().maxIterations) {
+            throw runtime_error("迭代次数超出限制");
         }
-        case MathOperator::MATH_LOG10: {
-            if (CullNumberMember()) {
-                return;
-            }
 
-            // loga(u)' = 1/(u * ln(a)) * u'
-            auto a = 10.0;
-            auto &u = node->left;
-            auto u2 = Clone(u);
-            q.emplace(*u2);
-            node = (Num(1) / (Move(u) * Num(std::log(a)))) * Move(u2);
-            node->parent = parent;
-            return;
+        Mat ja = evaluator.J(table.Values());
+
+        Vec deltaq = Config::Get().mixedPrecisionLinearSolve ? SolveLinearMixedPrecision(ja, -phi)
+                                                             : SolveLinear(ja, -phi);
+
+        q += deltaq;
+
+        if (Config::Get().logLevel >= LogLevel::TRACE) {
+            cout << "ja = " << ja << endl;
+            cout << "deltaq = " << deltaq << endl;
+            cout << "q = " << q << endl;
         }
-        case MathOperator::MATH_EXP: {
-            if (CullNumberMember()) {
-                return;
-            }
 
-            // e^x=e^x
-            if (node->left->type == NodeType::VARIABLE)
-                return;
+        table.SetValues(q);
 
-            // (e^u)' = e^u * u'
-            auto u2 = Clone(node->left);
-            q.emplace(*u2);
-            node = Move(node) * Move(u2);
-            node->parent = parent;
+        ++it;
+    }
+    return table;
+}
+
+inline VarsTable LM(const VarsTable &varsTable, const SymVec &equations, const SymMat &JaEqs) {
+    auto &stats = CurrentSolveStats();
+    stats = {};
+
+    int it = 0; // 迭代计数
+    VarsTable table = varsTable;
+    int n = table.VarNums(); // 未知量数量
+    Vec q = table.Values();  // x向量
+
+    if (Config::Get().logLevel >= LogLevel::TRACE) {
+        cout << "Jacobi = " << JaEqs << endl;
+    }
+
+    internal::SystemEvaluator evaluator(equations, JaEqs, table.Vars());
+    auto lineSearch = MakeLineSearch(Config::Get().lineSearchMethod);
+    LineSearchWorkspace lineSearchWs;
+
+    Vec F = evaluator.F(q); // 计算F
+    while (1) {
+        stats.iterations = it;
+        if (Config::Get().logLevel >= LogLevel::TRACE) {
+            cout << "iteration = " << it << endl;
+            cout << "F = " << F << endl;
+        }
+
+        if (F == 0) { // F值为0，满足方程组求根条件
             break;
         }
 
-        // 二元
-        case MathOperator::MATH_ADD:
-        case MathOperator::MATH_SUB:
-            if (CullNumberMemberBinary()) {
-                return;
-            }
-            // (u + v)' = u' + v'
-            if (node->left) {
-                q.emplace(*node->left);
-            }
-            if (node->right) {
-                q.emplace(*node->right);
-            }
-            return;
-        case MathOperator::MATH_MULTIPLY: {
-            // 两个操作数中有一个是数字
-            if (node->left->type == NodeType::NUMBER) {
-                q.emplace(*node->right);
-                return;
-            }
-            if (node->right->type == NodeType::NUMBER) {
-                q.emplace(*node->left);
-                return;
-            }
+        double mu = 1e-5; // LM方法的λ值
 
-            if (CullNumberMemberBinary()) {
-                return;
-            }
+        Vec deltaq(n); // Δq
+        while (1) {
+            stats.iterations = it;
 
-            // (u*v)' = u' * v + u * v'
-            auto &u = node->left;
-            auto &v = node->right;
-            q.emplace(*u);
-            auto u2 = Clone(u);
-            auto v2 = Clone(v);
-            q.emplace(*v2);
-            node = Move(node) + Move(u2) * Move(v2);
-            node->parent = parent;
-            return;
-        }
-        case MathOperator::MATH_DIVIDE: {
-            // auto leftIsNumber = node->left->type == NodeType::NUMBER;
-            auto rightIsNumber = node->right->type == NodeType::NUMBER;
+            Mat J = evaluator.J(q); // 计算雅可比矩阵
 
-            // f(x)/number = f'(x)/number
-            if (rightIsNumber) {
-                q.emplace(*node->left);
-                return;
+            if (Config::Get().logLevel >= LogLevel::TRACE) {
+                cout << "J = " << J << endl;
             }
 
-            if (CullNumberMemberBinary()) {
-                return;
-            }
+            // 说明：
+            // 标准的LM方法中，d=-(J'*J+λI)^(-1)*J'F，其中J'*J是为了确保矩阵对称正定。有时d会过大，很难收敛。
+            // 牛顿法的 d=-(J+λI)^(-1)*F
 
-            // (u/v)' = (u'v - uv')/(v^2)
-            auto &u = node->left;
-            auto &v = node->right;
-            auto u2 = Clone(u);
-            auto v2 = Clone(v);
-            auto v3 = Clone(v);
-            q.emplace(*u);
-            q.emplace(*v2);
-            node = (Move(u) * Move(v) - Move(u2) * Move(v2)) / (Move(v3) ^ Num(2));
-            node->parent = parent;
-            return;
-        }
-        case MathOperator::MATH_POWER: {
-            // 如果两个操作数都是数字
-            if (CullNumberMemberBinary()) {
-                return;
+            // 价值函数0.5*||F||^2的梯度
+            Vec g = (J.Transpose() * F).ToVec();
+
+            // 方向向量
+            Vec d = SolveLinear(J.Transpose() * J + mu * Mat(n, n).Ones(), -g); // 得到d
+
+            if (Config::Get().logLevel >= LogLevel::TRACE) {
+                cout << "d = " << d << endl;
             }
 
-            auto lChildIsNumber = node->left->type == NodeType::NUMBER;
-            auto rChildIsNumber = node->right->type == NodeType::NUMBER;
+            // 进行1维搜索得到alpha。F、J已经算过，phi(0)与phi'(0)直接传入
+            double alpha = lineSearch->Search(evaluator, &q[0], &d[0], 0.5 * F.Norm2(), Dot(g, d), lineSearchWs);
 
-            // (u^a)' = a*u^(a-1) * u'
-            if (rChildIsNumber) {
-                auto &a = node->right;
-                auto aValue = a->value;
-                auto &u = node->left;
-                auto u2 = Clone(u);
-                q.emplace(*u2);
-                node = std::move(a) * (std::move(u) ^ Num(aValue - 1)) * std::move(u2);
-                node->parent = parent;
-                return;
+            if (Config::Get().logLevel >= LogLevel::TRACE) {
+                cout << "it=" << it << endl;
+                cout << "\talpha=" << alpha << endl;
+                cout << "mu=" << mu << endl;
             }
 
-            // (a^x)' = a^x * ln(a)  when a>0 and a!=1
-            if (lChildIsNumber) {
-                auto &a = node->left;
-                auto aValue = a->value;
-                auto &u = node->right;
-                auto u2 = Clone(u);
-                q.emplace(*u2);
-                node = (std::move(a) ^ std::move(u)) * log(Num(aValue)) * std::move(u2);
-                node->parent = parent;
-                return;
+            if (alpha > 0) // 找到满足条件的步长，跳出内层循环
+            {
+                deltaq = alpha * d; // 计算Δq
+                break;
+            } else {
+                mu *= 10.0; // 扩大λ，使模型倾向梯度下降方向
             }
 
-            // (u^v)' = ( e^(v*ln(u)) )' = e^(v*ln(u)) * (v*ln(u))' = u^v * (v*ln(u))'
-            // 左右都不是数字
-            auto &u = node->left;
-            auto &v = node->right;
-            auto vln_u = Clone(v) * log(Clone(u));
-            q.emplace(*vln_u);
-            node = Move(node) * std::move(vln_u);
-            node->parent = parent;
-            return;
+            if (it++ == Config::Get().maxIterations) {
+                throw runtime_error("迭代次数超出限制");
+            }
         }
 
-        case MathOperator::MATH_AND: {
-            throw std::runtime_error("can not apply diff for AND(&) operator");
-            return;
-        }
-        case MathOperator::MATH_OR: {
-            throw std::runtime_error("can not apply diff for OR(|) operator");
-            return;
-        }
-        case MathOperator::MATH_MOD: {
-            throw std::runtime_error("can not apply diff for MOD(%) operator");
-            return;
+        q += deltaq; // 应用Δq，更新q值
+
+        F = evaluator.F(q); // 更新F。一维搜索刚刚在这一点上求过值，通常直接命中缓存
+
+        if (it++ == Config::Get().maxIterations) {
+            throw runtime_error("迭代次数超出限制");
         }
-        case MathOperator::MATH_LEFT_PARENTHESIS:
-        case MathOperator::MATH_RIGHT_PARENTHESIS:
-            assert(0 && "inner bug");
-            return;
-        default:
-            assert(0 && "inner bug");
-            return;
+
+        if (Config::Get().logLevel >= LogLevel::TRACE) {
+            cout << std::string(20, '=') << endl;
         }
     }
-};
 
-} // namespace internal
+    if (Config::Get().logLevel >= LogLevel::TRACE) {
+        cout << "success" << endl;
+    }
 
-inline Node Diff(const Node &node, const std::string &varname, int i) {
-    auto node2 = Clone(node);
-    return Diff(std::move(node2), varname, i);
+    table.SetValues(q);
+    return table;
 }
 
-inline Node Diff(Node &&node, const std::string &varname, int i) {
-    assert(i > 0);
-    auto n = std::move(node);
-    while (i--) {
-        internal::DiffFunctions::DiffOnce(n, varname);
+inline VarsTable Homotopy(const VarsTable &varsTable, const SymVec &equations, const SymMat &jaEqs) {
+    auto &stats = CurrentSolveStats();
+    stats = {};
+
+    int n = varsTable.VarNums();
+    if (equations.Rows() != n) {
+        throw runtime_error("homotopy requires as many equations as variables");
     }
-#ifndef NDEBUG
-    auto s = n->ToString();
-    n->CheckParent();
-#endif
-    Simplify(n);
-#ifndef NDEBUG
-    n->CheckParent();
-#endif
-    return n;
-}
 
-} // namespace tomsolver
+    internal::SystemEvaluator evaluator(equations, jaEqs, varsTable.Vars());
+    auto &config = Config::Get();
 
-namespace tomsolver {
+    // H(x, t) = t*F(x) + (1-t)*(x - x0)
+    // Hx = t*J(x) + (1-t)*I，Ht = F(x) - (x - x0)
+    const Vec x0 = varsTable.Values();
+    auto Hx = [&](const Vec &x, double t) {
+        return t * evaluator.J(x) + (1 - t) * Mat(n, n).Ones();
+    };
+
+    // 在t处从x出发做Newton校正。收敛时返回校正的次数，不收敛返回-1
+    const int maxCorrections = 5;
+    auto correct = [&](Vec &x, double t) {
+        for (int k = 1; k <= maxCorrections; ++k) {
+            Vec H = t * evaluator.F(x) + (1 - t) * (x - x0);
+            Vec dx = SolveLinear(Hx(x, t), -H);
+            x += dx;
+            if (dx.NormInfinity() <= 1.0e-8 * (1 + x.NormInfinity())) {
+                return k;
+            }
+        }
+        return -1;
+    };
 
-using DataType = std::valarray<Node>;
+    Vec x = x0;
+    double t = 0;
+    double h = config.homotopyInitialStep;
+    int it = 0;
+    while (t < 1) {
+        stats.iterations = it;
+        if (it++ == config.maxIterations) {
+            throw runtime_error("迭代次数超出限制");
+        }
+        h = std::min(h, 1 - t);
+
+        // 预测：沿切线方向dx/dt = -Hx^(-1) * Ht前进h
+        Vec Ht = evaluator.F(x) - (x - x0);
+        Vec tangent = SolveLinear(Hx(x, t), -Ht);
+
+        Vec xNew = x + h * tangent;
+        double tNew = t + h;
+        int corrections;
+        try {
+            corrections = correct(xNew, tNew);
+        } catch (const MathError &) {
+            // 校正时雅可比矩阵奇异或者出现无效值，按不收敛处理
+            corrections = -1;
+        }
 
-inline SymMat::SymMat(int rows, int cols) noexcept : rows(rows), cols(cols) {
-    assert(rows > 0 && cols > 0);
-    data.reset(new DataType(rows * cols));
-}
+        if (Config::Get().logLevel >= LogLevel::TRACE) {
+            cout << "t = " << t << ", h = " << h << ", corrections = " << corrections << endl;
+        }
 
-inline SymMat::SymMat(std::initializer_list<std::initializer_list<Node>> init) noexcept {
-    rows = static_cast<int>(init.size());
-    cols = static_cast<int>(std::max(init, [](auto lhs, auto rhs) {
-                                return lhs.size() < rhs.size();
-                            }).size());
-    data.reset(new DataType(rows * cols));
+        if (corrections < 0) {
+            h /= 2;
+            if (h < config.homotopyMinStep) {
+                throw runtime_error("homotopy step size is too small at t = " + ToString(t));
+            }
+            continue;
+        }
 
-    auto i = 0;
-    for (auto val : init) {
-        auto j = 0;
-        for (auto &node : val) {
-            (*data)[i * cols + j++] = std::move(const_cast<Node &>(node));
+        x = xNew;
+        t = tNew;
+        // 校正很快收敛说明路径平缓，可以加大步长
+        if (corrections <= 2) {
+            h = std::min(2 * h, config.homotopyMaxStep);
         }
-        i++;
     }
+
+    // t = 1时H即F，路径跟踪的容差较宽，最后以Newton-Raphson迭代到Config::Get().epsilon
+    auto tracked = stats;
+    VarsTable table = varsTable;
+    table.SetValues(x);
+    table = NewtonRaphson(table, equations, jaEqs);
+
+    stats.iterations += it;
+    stats.residualEvaluations += tracked.residualEvaluations;
+    stats.jacobianEvaluations += tracked.jacobianEvaluations;
+    stats.cacheHits += tracked.cacheHits;
+    stats.cacheMisses += tracked.cacheMisses;
+    return table;
 }
 
-inline SymMat::SymMat(const Mat &rhs) noexcept : SymMat(rhs.Rows(), rhs.Cols()) {
-    std::generate(std::begin(*data), std::end(*data), [p = std::addressof(rhs.Value(0, 0))]() mutable {
-        return Num(*p++);
-    });
+} // namespace internal
+
+inline const SolveStats &LastSolveStats() noexcept {
+    return internal::CurrentSolveStats();
 }
 
-inline SymMat SymMat::Clone() const noexcept {
-    SymMat ret(Rows(), Cols());
-    std::generate(std::begin(*ret.data), std::end(*ret.data), [iter = std::begin(*data)]() mutable {
-        return tomsolver::Clone(*iter++);
-    });
-    return ret;
+inline PreparedSystem Prepare(const SymVec &equations, const std::vector<std::string> &vars) {
+    if (Config::Get().preparedCacheDir.empty()) {
+        return {equations.Clone().ToSymVec(), vars, Jacobian(equations, vars)};
+    }
+
+    if (auto cached = PreparedCache::Get().Find(equations, vars)) {
+        return std::move(*cached);
+    }
+    PreparedSystem system{equations.Clone().ToSymVec(), vars, Jacobian(equations, vars)};
+    PreparedCache::Get().Insert(system);
+    return system;
 }
 
-inline bool SymMat::Empty() const noexcept {
-    return data->size() == 0;
+inline PreparedSystem Prepare(const SymVec &equations) {
+    auto varNames = equations.GetAllVarNames();
+    return Prepare(equations, {varNames.begin(), varNames.end()});
 }
 
-inline int SymMat::Rows() const noexcept {
-    return rows;
+inline VarsTable SolveByNewtonRaphson(const VarsTable &varsTable, const SymVec &equations) {
+    return internal::NewtonRaphson(varsTable, equations, Jacobian(equations, varsTable.Vars()));
 }
 
-inline int SymMat::Cols() const noexcept {
-    return cols;
+inline VarsTable SolveByNewtonRaphson(const VarsTable &varsTable, const PreparedSystem &system) {
+    internal::CheckPreparedVars(varsTable, system);
+    return internal::NewtonRaphson(varsTable, system.equations, system.jacobian);
 }
 
-inline SymVec SymMat::ToSymVec() const {
-    assert(rows > 0);
-    if (cols != 1) {
-        throw std::runtime_error("SymMat::ToSymVec fail. rows is not one");
-    }
-    return ToSymVecOneByOne();
+inline VarsTable SolveByHomotopy(const VarsTable &varsTable, const SymVec &equations) {
+    return internal::Homotopy(varsTable, equations, Jacobian(equations, varsTable.Vars()));
 }
 
-inline SymVec SymMat::ToSymVecOneByOne() const noexcept {
-    SymVec v(rows * cols);
-    std::generate(std::begin(*v.data), std::end(*v.data), [iter = std::begin(*data)]() mutable {
-        return tomsolver::Clone(*iter++);
-    });
-    return v;
+inline VarsTable SolveByHomotopy(const VarsTable &varsTable, const PreparedSystem &system) {
+    internal::CheckPreparedVars(varsTable, system);
+    return internal::Homotopy(varsTable, system.equations, system.jacobian);
 }
 
-inline Mat SymMat::ToMat() const {
-    std::valarray<double> newData(data->size());
-    std::generate(std::begin(newData), std::end(newData), [iter = std::begin(*data)]() mutable {
-        if ((**iter).type != NodeType::NUMBER) {
-            throw std::runtime_error("ToMat error: node is not number");
-        }
-        return (**iter++).value;
-    });
-    return {rows, cols, newData};
+inline VarsTable SolveByLM(const VarsTable &varsTable, const SymVec &equations) {
+    return internal::LM(varsTable, equations, Jacobian(equations, varsTable.Vars()));
 }
 
-inline SymMat &SymMat::Calc() {
-    for (auto &node : *data) {
-        node->Calc();
-    }
-    return *this;
+inline VarsTable SolveByLM(const VarsTable &varsTable, const PreparedSystem &system) {
+    internal::CheckPreparedVars(varsTable, system);
+    return internal::LM(varsTable, system.equations, system.jacobian);
 }
 
-inline SymMat &SymMat::Subs(const std::map<std::string, double> &varValues) noexcept {
-    for (auto &node : *data) {
-        node = tomsolver::Subs(std::move(node), varValues);
+inline VarsTable Solve(const VarsTable &varsTable, const SymVec &equations) {
+    switch (Config::Get().nonlinearMethod) {
+    case NonlinearMethod::NEWTON_RAPHSON:
+        return SolveByNewtonRaphson(varsTable, equations);
+    case NonlinearMethod::LM:
+        return SolveByLM(varsTable, equations);
+    case NonlinearMethod::HOMOTOPY:
+        return SolveByHomotopy(varsTable, equations);
     }
-    return *this;
+    throw runtime_error("invalid config.NonlinearMethod value: " +
+                        std::to_string(static_cast<int>(Config::Get().nonlinearMethod)));
 }
 
-inline SymMat &SymMat::Subs(const VarsTable &varsTable) noexcept {
-    for (auto &node : *data) {
-        node = tomsolver::Subs(std::move(node), varsTable);
-    }
-    return *this;
+inline VarsTable Solve(const SymVec &equations) {
+    auto varNames = equations.GetAllVarNames();
+    std::vector<std::string> vecVarNames(varNames.begin(), varNames.end());
+    VarsTable varsTable(std::move(vecVarNames), Config::Get().initialValue);
+    return Solve(varsTable, equations);
 }
 
-inline std::set<std::string> SymMat::GetAllVarNames() const noexcept {
-    std::set<std::string> ret;
-    for (auto &node : *data) {
-        auto names = node->GetAllVarNames();
-        ret.insert(names.begin(), names.end());
+inline VarsTable Solve(const VarsTable &varsTable, const PreparedSystem &system) {
+    switch (Config::Get().nonlinearMethod) {
+    case NonlinearMethod::NEWTON_RAPHSON:
+        return SolveByNewtonRaphson(varsTable, system);
+    case NonlinearMethod::LM:
+        return SolveByLM(varsTable, system);
+    case NonlinearMethod::HOMOTOPY:
+        return SolveByHomotopy(varsTable, system);
     }
-    return ret;
+    throw runtime_error("invalid config.NonlinearMethod value: " +
+                        std::to_string(static_cast<int>(Config::Get().nonlinearMethod)));
 }
 
-inline SymMat SymMat::operator-(const SymMat &rhs) const noexcept {
-    assert(rhs.rows == rows && rhs.cols == cols);
-    SymMat ret(rows, cols);
-    std::generate(std::begin(*ret.data), std::end(*ret.data),
-                  [lhsIter = std::begin(*data), rhsIter = std::begin(*rhs.data)]() mutable {
-                      return *lhsIter++ - *rhsIter++;
-                  });
-    return ret;
+inline VarsTable Solve(const PreparedSystem &system) {
+    return Solve(VarsTable(system.vars, Config::Get().initialValue), system);
 }
 
-inline SymMat SymMat::operator*(const SymMat &rhs) const {
-    if (cols != rhs.rows) {
-        throw MathError(ErrorType::SIZE_NOT_MATCH);
-    }
+} // namespace tomsolver
 
-    SymMat ans(rows, rhs.cols);
-    for (int i = 0; i < Rows(); ++i) {
-        for (int j = 0; j < rhs.cols; ++j) {
-            auto sum = Value(i, 0) * rhs.Value(0, j);
-            for (int k = 1; k < cols; ++k) {
-                sum += Value(i, k) * rhs.Value(k, j);
-            }
-            ans.Value(i, j) = Move(sum);
-        }
+#if defined(__unix__) || defined(__APPLE__)
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+namespace tomsolver {
+
+namespace {
+
+// FNV-1a。共享库的文件名要在不同进程、不同编译器之间保持稳定，不能使用std::hash
+inline std::uint64_t HashSource(const std::string &str) noexcept {
+    std::uint64_t hash = 14695981039346656037ull;
+    for (auto c : str) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
     }
-    return ans;
+    return hash;
 }
 
-inline bool SymMat::operator==(const SymMat &rhs) const noexcept {
-    if (rhs.rows != rows || rhs.cols != cols) {
-        return false;
+inline std::string NativeCacheDir() {
+    if (!Config::Get().nativeCacheDir.empty()) {
+        return Config::Get().nativeCacheDir;
     }
-    return std::equal(std::begin(*data), std::end(*data), std::begin(*rhs.data), [](auto &node1, auto &node2) {
-        return node1->Equal(node2);
-    });
+    auto tmpdir = std::getenv("TMPDIR");
+    return tmpdir && *tmpdir ? tmpdir : "/tmp";
 }
 
-inline Node &SymMat::Value(int i, int j) noexcept {
-    return (*data)[i * cols + j];
+inline bool FileExists(const std::string &path) {
+    return std::ifstream(path).good();
 }
 
-inline const Node &SymMat::Value(int i, int j) const noexcept {
-    return (*data)[i * cols + j];
+// 检查求值结果，出现无效值时按Config::Get().throwOnInvalidValue抛出异常
+inline void CheckNativeResult(const Mat &m, const char *what) {
+    if (!Config::Get().throwOnInvalidValue) {
+        return;
+    }
+    for (int i = 0; i < m.Rows(); ++i) {
+        for (int j = 0; j < m.Cols(); ++j) {
+            if (!std::isfinite(m.Value(i, j))) {
+                std::stringstream ss;
+                ss << "NativeModel: " << what << "(" << i << ", " << j << ") = " << m.Value(i, j);
+                throw MathError(ErrorType::ERROR_INVALID_NUMBER, ss.str());
+            }
+        }
+    }
 }
 
-inline std::string SymMat::ToString() const noexcept {
-    if (data->size() == 0) {
-        return "[]";
+} // namespace
+
+inline NativeModel::NativeModel(const SymVec &equations, const std::vector<std::string> &vars)
+    : NativeModel(equations, Jacobian(equations, vars), vars) {}
+
+inline NativeModel::NativeModel(const SymVec &equations, const SymMat &jaEqs, const std::vector<std::string> &vars)
+    : rows(equations.Rows()), vars(vars) {
+#if defined(__unix__) || defined(__APPLE__)
+    std::string source = "// Generated by TomSolver. Do not edit.\n#include <cmath>\n\n";
+    source += GenerateFunction(CompiledSymMat(equations, vars), "tomsolver_residual", "f") + "\n";
+    source += GenerateFunction(CompiledSymMat(jaEqs, vars), "tomsolver_jacobian", "J");
+
+    // 编译选项也参与哈希，更换编译器后不会误用旧的共享库
+    const std::string flags = " -O2 -shared -fPIC";
+    auto &compiler = Config::Get().nativeCompiler;
+    std::stringstream name;
+    name << NativeCacheDir() << "/tomsolver_" << std::hex << std::setw(16) << std::setfill('0')
+         << HashSource(compiler + flags + "\n" + source);
+    path = name.str() + ".so";
+
+    auto load = [this] {
+        auto lib = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!lib) {
+            return false;
+        }
+        handle.reset(lib, [](void *lib) {
+            dlclose(lib);
+        });
+        residual = reinterpret_cast<Function>(dlsym(lib, "tomsolver_residual"));
+        jacobian = reinterpret_cast<Function>(dlsym(lib, "tomsolver_jacobian"));
+        return residual && jacobian;
+    };
+
+    if (FileExists(path) && load()) {
+        return;
     }
 
-    std::stringstream ss;
-    ss << "[";
+    // 先编译到临时文件，再改名为最终的文件名。改名是原子的，其他进程、线程不会加载到写了一半的共享库
+    static std::atomic<int> counter{0};
+    auto tmp = name.str() + "." + std::to_string(getpid()) + "." + std::to_string(counter++);
+    {
+        std::ofstream out(tmp + ".cpp");
+        out << source;
+        if (!out) {
+            throw std::runtime_error("NativeModel: can not write " + tmp + ".cpp");
+        }
+    }
+    auto command = compiler + flags + " -o '" + tmp + ".so' '" + tmp + ".cpp'";
+    auto ret = std::system(command.c_str());
+    std::remove((tmp + ".cpp").c_str());
+    if (ret != 0) {
+        std::remove((tmp + ".so").c_str());
+        throw std::runtime_error("NativeModel: compile failed: " + command);
+    }
+    if (std::rename((tmp + ".so").c_str(), path.c_str()) != 0) {
+        std::remove((tmp + ".so").c_str());
+        throw std::runtime_error("NativeModel: can not create " + path);
+    }
 
-    size_t i = 0;
-    for (auto &node : *data) {
-        ss << (i == 0 ? "" : " ") << node->ToString();
-        i++;
-        ss << (i % cols == 0 ? (i == data->size() ? "]" : "\n") : ", ");
+    if (!load()) {
+        throw std::runtime_error("NativeModel: can not load " + path);
     }
+#else
+    (void)jaEqs;
+    throw std::runtime_error("NativeModel: not supported on this platform");
+#endif
+}
 
-    return ss.str();
+inline bool NativeModel::IsSupported() noexcept {
+#if defined(__unix__) || defined(__APPLE__)
+    return true;
+#else
+    return false;
+#endif
 }
 
-inline SymVec::SymVec(int rows) noexcept : SymMat(rows, 1) {}
+inline int NativeModel::Rows() const noexcept {
+    return rows;
+}
 
-inline SymVec::SymVec(std::initializer_list<Node> init) noexcept : SymMat(static_cast<int>(init.size()), 1) {
-    auto i = 0;
-    for (auto &node : init) {
-        (*data)[i++] = std::move(const_cast<Node &>(node));
-    }
+inline const std::vector<std::string> &NativeModel::Vars() const noexcept {
+    return vars;
 }
 
-inline SymVec SymVec::operator-(const SymVec &rhs) const noexcept {
-    return SymMat::operator-(rhs).ToSymVec();
+inline const std::string &NativeModel::Path() const noexcept {
+    return path;
 }
 
-inline Node &SymVec::operator[](std::size_t index) noexcept {
-    return (*data)[index];
+inline void NativeModel::EvalResidual(const double *x, double *f) const noexcept {
+    residual(x, f);
 }
 
-inline const Node &SymVec::operator[](std::size_t index) const noexcept {
-    return (*data)[index];
+inline void NativeModel::EvalJacobian(const double *x, double *J) const noexcept {
+    jacobian(x, J);
 }
 
-inline SymMat Jacobian(const SymMat &equations, const std::vector<std::string> &vars) noexcept {
-    int rows = equations.rows;
-    int cols = static_cast<int>(vars.size());
-    SymMat ja(rows, cols);
-    std::generate(std::begin(*ja.data), std::end(*ja.data),
-                  [iter = std::begin(*equations.data), &vars, i = size_t{0}]() mutable {
-                      if (i == vars.size()) {
-                          i = 0;
-                          iter++;
-                      }
-                      return Diff(*iter, vars[i++]);
-                  });
-    return ja;
+inline Mat NativeModel::EvalResidual(const Vec &x) const {
+    assert(x.Rows() == static_cast<int>(vars.size()));
+    Mat ret(rows, 1);
+    residual(vars.empty() ? nullptr : &x.Value(0, 0), &ret.Value(0, 0));
+    CheckNativeResult(ret, "residual");
+    return ret;
 }
 
-inline std::ostream &operator<<(std::ostream &out, const SymMat &symMat) noexcept {
-    return out << symMat.ToString();
+inline Mat NativeModel::EvalJacobian(const Vec &x) const {
+    assert(x.Rows() == static_cast<int>(vars.size()));
+    Mat ret(rows, static_cast<int>(vars.size()));
+    jacobian(vars.empty() ? nullptr : &x.Value(0, 0), &ret.Value(0, 0));
+    CheckNativeResult(ret, "jacobian");
+    return ret;
+}
+
+} // namespace tomsolver
+
+namespace tomsolver {
+
+inline SweepResult SolveSweep(const PreparedSystem &system, const std::string &parameter, double begin, double end,
+                       const VarsTable &varsTable) {
+    auto vars = varsTable.Vars();
+    vars.push_back(parameter);
+    if (varsTable.Has(parameter) || system.vars != vars) {
+        throw std::runtime_error("SolveSweep: the variables of the prepared system must be those of varsTable "
+                                 "followed by the parameter " +
+                                 parameter);
+    }
+    int n = varsTable.VarNums();
+    if (system.equations.Rows() != n) {
+        throw std::runtime_error("SolveSweep: requires as many equations as variables");
+    }
+
+    auto &config = Config::Get();
+    CompiledSymMat equations(system.equations, vars);
+    CompiledSymMat jacobian(system.jacobian, vars);
+    CompiledSymMat::Workspace ws;
+
+    // z = [x, p]。J为n行n+1列，前n列是Jx，最后一列是Jp
+    std::vector<double> z(n + 1), f(n), J(n * (n + 1)), Jx(n * n);
+    std::vector<int> perm(n);
+
+    // 在z处分解Jx，返回行列式的符号；Jx奇异时返回0
+    auto factor = [&](const std::vector<double> &point) {
+        jacobian.Eval(point.data(), J.data(), ws);
+        for (int i = 0; i < n; ++i) {
+            std::copy_n(J.begin() + i * (n + 1), n, Jx.begin() + i * n);
+        }
+        if (!internal::LuDecompose(n, Jx.data(), perm.data(), std::numeric_limits<double>::min())) {
+            return 0;
+        }
+        int sign = 1;
+        for (int i = 0; i < n; ++i) {
+            if (Jx[i * n + i] < 0) {
+                sign = -sign;
+            }
+        }
+        // 置换的奇偶性：每个长度为L的轮换贡献L - 1次对换
+        std::vector<bool> visited(n, false);
+        for (int i = 0; i < n; ++i) {
+            if (visited[i]) {
+                continue;
+            }
+            for (int j = i; !visited[j]; j = perm[j]) {
+                visited[j] = true;
+                if (j != i) {
+                    sign = -sign;
+                }
+            }
+        }
+        return sign;
+    };
+
+    // 固定参数，从z出发做Newton校正。收敛时返回校正的次数，不收敛返回-1
+    auto correct = [&](std::vector<double> &point, int maxCorrections) {
+        try {
+            for (int k = 0;; ++k) {
+                equations.Eval(point.data(), f.data(), ws);
+                if (std::all_of(f.begin(), f.end(), [&](double v) {
+                        return std::abs(v) < config.epsilon;
+                    })) {
+                    return k;
+                }
+                if (k == maxCorrections || factor(point) == 0) {
+                    return -1;
+                }
+                internal::LuSolve(n, Jx.data(), perm.data(), f.data());
+                for (int i = 0; i < n; ++i) {
+                    point[i] -= f[i];
+                }
+            }
+        } catch (const MathError &) {
+            // 出现无效值，按不收敛处理
+            return -1;
+        }
+    };
+
+    auto makePoint = [&](int iterations, bool turningPoint) {
+        VarsTable table = varsTable;
+        table.SetValues(Vec(std::valarray<double>(z.data(), n)));
+        return SweepPoint{z[n], std::move(table), iterations, turningPoint};
+    };
+
+    SweepResult result;
+    std::copy_n(&varsTable.Values().Value(0, 0), n, z.begin());
+    z[n] = begin;
+    int iterations = correct(z, config.maxIterations);
+    if (iterations < 0) {
+        throw std::runtime_error("SolveSweep: failed to solve at " + parameter + " = " + ToString(begin));
+    }
+    result.points.push_back(makePoint(iterations, false));
+
+    double span = std::abs(end - begin);
+    double direction = end > begin ? 1 : -1;
+    double h = config.sweepInitialStep * span;
+    double minStep = config.sweepMinStep * span;
+    double maxStep = config.sweepMaxStep * span;
+    int sign = factor(z);
+    std::vector<double> tangent(n), zNew(n + 1);
+    while (z[n] != end) {
+        // 切线dx/dp = -Jx^(-1) * Jp。Jx奇异说明到达了折点
+        if (sign == 0) {
+            result.points.back().turningPoint = true;
+            return result;
+        }
+        for (int i = 0; i < n; ++i) {
+            tangent[i] = -J[i * (n + 1) + n];
+        }
+        internal::LuSolve(n, Jx.data(), perm.data(), tangent.data());
+
+        int corrections;
+        for (;;) {
+            // 最后一步恰好落在end上
+            bool last = h >= std::abs(end - z[n]);
+            double dp = last ? end - z[n] : direction * h;
+            for (int i = 0; i < n; ++i) {
+                zNew[i] = z[i] + dp * tangent[i];
+            }
+            zNew[n] = last ? end : z[n] + dp;
+            corrections = correct(zNew, 5);
+
+            if (config.logLevel >= LogLevel::TRACE) {
+                std::cout << parameter << " = " << zNew[n] << ", h = " << h << ", corrections = " << corrections
+                          << std::endl;
+            }
+
+            if (corrections >= 0) {
+                break;
+            }
+            h /= 2;
+            if (h < minStep) {
+                // 自然参数延拓无法越过折点，曲线在此折回
+                result.points.back().turningPoint = true;
+                return result;
+            }
+        }
+
+        z.swap(zNew);
+        int newSign = factor(z);
+        result.points.push_back(makePoint(corrections, newSign != 0 && newSign != sign));
+        sign = newSign;
+        // 校正很快收敛说明曲线平缓，可以加大步长
+        if (corrections <= 2) {
+            h = std::min(2 * h, maxStep);
+        }
+    }
+    result.completed = true;
+    return result;
+}
+
+inline SweepResult SolveSweep(const SymVec &equations, const std::string &parameter, double begin, double end,
+                       const VarsTable &varsTable) {
+    auto vars = varsTable.Vars();
+    vars.push_back(parameter);
+    return SolveSweep(Prepare(equations, vars), parameter, begin, end, varsTable);
 }
 
 } // namespace tomsolver
@@ -0,0 +1,503 @@
+#include "batch_math.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
+namespace tomsolver {
+
+namespace {
+
+// 加上1.5*2^52之后，低位就是四舍五入得到的整数
+constexpr double BATCH_SHIFTER = 6755399441055744.0;
+
+constexpr double BATCH_LOG2E = 1.4426950408889634;
+constexpr double BATCH_LN2_HI = 6.93147180369123816490e-01; // ln2的高32位，与不超过2^20的整数相乘没有舍入误差
+constexpr double BATCH_LN2_LO = 1.90821492927058770002e-10;
+constexpr double BATCH_INV_LN2 = 1.4426950408889634;
+constexpr double BATCH_INV_LN10 = 0.43429448190325182765;
+constexpr double BATCH_SQRT2 = 1.4142135623730951;
+
+constexpr double BATCH_TWO_OVER_PI = 0.63661977236758134308;
+constexpr double BATCH_PIO2_1 = 1.57079632673412561417e+00; // pi/2的前33位
+constexpr double BATCH_PIO2_2 = 6.07710050630396597660e-11; // pi/2的第二个33位
+constexpr double BATCH_PIO2_3 = 2.02226624871116645580e-21; // pi/2的第三个33位
+constexpr double BATCH_PIO2_3T = 8.47842766036889956997e-32; // pi/2的剩余部分
+
+// 快速路径的输入范围
+constexpr double BATCH_EXP_MAX = 708.0;
+constexpr double BATCH_TRIG_MAX = 1.0e5;
+
+// exp: e^r = 1 + (r + r^2*E(r))，E(r) = 1/2! + r/3! + ... + r^11/13!，|r| <= ln2/2
+constexpr double BATCH_EXP_C[] = {
+    1.0 / 6227020800.0, 1.0 / 479001600.0, 1.0 / 39916800.0, 1.0 / 3628800.0,
+    1.0 / 362880.0,     1.0 / 40320.0,     1.0 / 5040.0,     1.0 / 720.0,
+    1.0 / 120.0,        1.0 / 24.0,        1.0 / 6.0,        1.0 / 2.0,
+};
+
+// log: log(1+f) = 2s + s*R，s = f/(2+f)，R = sum(2/(2k+1) * s^2k)，|s| <= 0.172
+constexpr double BATCH_LOG_C[] = {
+    2.0 / 23.0, 2.0 / 21.0, 2.0 / 19.0, 2.0 / 17.0, 2.0 / 15.0, 2.0 / 13.0,
+    2.0 / 11.0, 2.0 / 9.0,  2.0 / 7.0,  2.0 / 5.0,  2.0 / 3.0,
+};
+
+// sin: r + r^3*S(r^2)，|r| <= pi/4
+constexpr double BATCH_SIN_C[] = {
+    -1.0 / 121645100408832000.0, 1.0 / 355687428096000.0, -1.0 / 1307674368000.0,
+    1.0 / 6227020800.0,          -1.0 / 39916800.0,       1.0 / 362880.0,
+    -1.0 / 5040.0,               1.0 / 120.0,             -1.0 / 6.0,
+};
+
+// cos: 1 - r^2/2 + r^4*C(r^2)，|r| <= pi/4
+constexpr double BATCH_COS_C[] = {
+    -1.0 / 6402373705728000.0, 1.0 / 20922789888000.0, -1.0 / 87178291200.0, 1.0 / 479001600.0,
+    -1.0 / 3628800.0,          1.0 / 40320.0,          -1.0 / 720.0,         1.0 / 24.0,
+};
+
+std::uint64_t BatchAsBits(double value) noexcept {
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+double BatchFromBits(std::uint64_t bits) noexcept {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+template <std::size_t N>
+double BatchHorner(const double (&c)[N], double x) noexcept {
+    double p = c[0];
+    for (std::size_t i = 1; i < N; ++i) {
+        p = p * x + c[i];
+    }
+    return p;
+}
+
+// 逐个计算，也是快速路径以外的输入的后备实现
+double BatchStdCalc(MathOperator op, double v) noexcept {
+    switch (op) {
+    case MathOperator::MATH_POSITIVE:
+        return v;
+    case MathOperator::MATH_NEGATIVE:
+        return -v;
+    case MathOperator::MATH_SIN:
+        return std::sin(v);
+    case MathOperator::MATH_COS:
+        return std::cos(v);
+    case MathOperator::MATH_TAN:
+        return std::tan(v);
+    case MathOperator::MATH_ARCSIN:
+        return std::asin(v);
+    case MathOperator::MATH_ARCCOS:
+        return std::acos(v);
+    case MathOperator::MATH_ARCTAN:
+        return std::atan(v);
+    case MathOperator::MATH_SQRT:
+        return std::sqrt(v);
+    case MathOperator::MATH_LOG:
+        return std::log(v);
+    case MathOperator::MATH_LOG2:
+        return std::log2(v);
+    case MathOperator::MATH_LOG10:
+        return std::log10(v);
+    case MathOperator::MATH_EXP:
+        return std::exp(v);
+    default:
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+}
+
+bool BatchInRange(MathOperator op, double v) noexcept {
+    switch (op) {
+    case MathOperator::MATH_SIN:
+    case MathOperator::MATH_COS:
+    case MathOperator::MATH_TAN:
+        return std::abs(v) <= BATCH_TRIG_MAX;
+    case MathOperator::MATH_LOG:
+    case MathOperator::MATH_LOG2:
+    case MathOperator::MATH_LOG10:
+        return v >= std::numeric_limits<double>::min() && v <= std::numeric_limits<double>::max();
+    case MathOperator::MATH_EXP:
+        return std::abs(v) <= BATCH_EXP_MAX;
+    default:
+        return false;
+    }
+}
+
+// 以下为通用版本，要求输入在快速路径的范围内
+
+double BatchExp(double x) noexcept {
+    auto t = x * BATCH_LOG2E + BATCH_SHIFTER;
+    auto n = t - BATCH_SHIFTER;
+    auto r = (x - n * BATCH_LN2_HI) - n * BATCH_LN2_LO;
+    auto k = static_cast<std::int64_t>(BatchAsBits(t) - BatchAsBits(BATCH_SHIFTER));
+    auto scale = BatchFromBits(static_cast<std::uint64_t>(k + 1023) << 52);
+    return (1 + (r + (r * r) * BatchHorner(BATCH_EXP_C, r))) * scale;
+}
+
+// x = 2^k * (1+f)，1+f∈[sqrt(2)/2, sqrt(2))。log(1+f) = f - hfsq + sR
+void BatchLogReduce(double x, double &k, double &f, double &hfsq, double &sR) noexcept {
+    auto bits = BatchAsBits(x);
+    auto e = static_cast<std::int64_t>(bits >> 52) - 1023;
+    auto m = BatchFromBits((bits & 0x000fffffffffffffull) | 0x3ff0000000000000ull);
+    if (m > BATCH_SQRT2) {
+        m *= 0.5;
+        ++e;
+    }
+    k = static_cast<double>(e);
+    f = m - 1;
+    auto s = f / (2 + f);
+    auto z = s * s;
+    hfsq = 0.5 * f * f;
+    sR = s * (hfsq + z * BatchHorner(BATCH_LOG_C, z));
+}
+
+double BatchLog(double x) noexcept {
+    double k, f, hfsq, sR;
+    BatchLogReduce(x, k, f, hfsq, sR);
+    return k * BATCH_LN2_HI - ((hfsq - (sR + k * BATCH_LN2_LO)) - f);
+}
+
+double BatchLog2(double x) noexcept {
+    double k, f, hfsq, sR;
+    BatchLogReduce(x, k, f, hfsq, sR);
+    return k + (f - (hfsq - sR)) * BATCH_INV_LN2;
+}
+
+// sin(x)与cos(x)。x = n*pi/2 + r，r以r + rlo两个数表示，x接近pi/2的整数倍时也不损失精度
+void BatchSinCosKernel(double x, double &s, double &c) noexcept {
+    auto t = x * BATCH_TWO_OVER_PI + BATCH_SHIFTER;
+    auto n = t - BATCH_SHIFTER;
+    auto q = BatchAsBits(t) - BatchAsBits(BATCH_SHIFTER);
+
+    // a、p2都没有舍入误差，a - p2的舍入误差由TwoSum求出
+    auto a = x - n * BATCH_PIO2_1;
+    auto p2 = n * BATCH_PIO2_2;
+    auto b = a - p2;
+    auto bb = b - a;
+    auto err = (a - (b - bb)) - (p2 + bb);
+    auto lo = (err - n * BATCH_PIO2_3) - n * BATCH_PIO2_3T;
+    auto r = b + lo;
+    auto rlo = (b - r) + lo;
+
+    // sin(r + rlo) = sin(r) + rlo*cos(r)，cos(r + rlo) = cos(r) - rlo*sin(r)
+    auto z = r * r;
+    auto hz = 0.5 * z;
+    auto sinR = r + (r * z * BatchHorner(BATCH_SIN_C, z) + rlo * (1 - hz));
+    auto w = 1 - hz;
+    auto cosR = w + (((1 - w) - hz) + (z * z * BatchHorner(BATCH_COS_C, z) - r * rlo));
+
+    // 按象限换成±sin(r)或±cos(r)
+    s = (q & 1) ? cosR : sinR;
+    c = (q & 1) ? sinR : cosR;
+    s = (q & 2) ? -s : s;
+    c = ((q + 1) & 2) ? -c : c;
+}
+
+double BatchKernel(MathOperator op, double v) noexcept {
+    double s, c;
+    switch (op) {
+    case MathOperator::MATH_SIN:
+        BatchSinCosKernel(v, s, c);
+        return s;
+    case MathOperator::MATH_COS:
+        BatchSinCosKernel(v, s, c);
+        return c;
+    case MathOperator::MATH_TAN:
+        BatchSinCosKernel(v, s, c);
+        return s / c;
+    case MathOperator::MATH_LOG:
+        return BatchLog(v);
+    case MathOperator::MATH_LOG2:
+        return BatchLog2(v);
+    case MathOperator::MATH_LOG10:
+        return BatchLog(v) * BATCH_INV_LN10;
+    case MathOperator::MATH_EXP:
+        return BatchExp(v);
+    default:
+        return BatchStdCalc(op, v);
+    }
+}
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+
+// 以下为AVX2+FMA版本，算法与通用版本一致，每次计算4个
+
+bool BatchHasAvx2() noexcept {
+    static const bool ret = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }();
+    return ret;
+}
+
+template <std::size_t N>
+__attribute__((target("avx2,fma"), always_inline)) inline __m256d BatchHorner4(const double (&c)[N],
+                                                                              __m256d x) noexcept {
+    auto p = _mm256_set1_pd(c[0]);
+    for (std::size_t i = 1; i < N; ++i) {
+        p = _mm256_fmadd_pd(p, x, _mm256_set1_pd(c[i]));
+    }
+    return p;
+}
+
+__attribute__((target("avx2,fma"))) __m256d BatchExp4(__m256d x) noexcept {
+    auto shifter = _mm256_set1_pd(BATCH_SHIFTER);
+    auto t = _mm256_fmadd_pd(x, _mm256_set1_pd(BATCH_LOG2E), shifter);
+    auto n = _mm256_sub_pd(t, shifter);
+    auto r = _mm256_fnmadd_pd(n, _mm256_set1_pd(BATCH_LN2_HI), x);
+    r = _mm256_fnmadd_pd(n, _mm256_set1_pd(BATCH_LN2_LO), r);
+    auto k = _mm256_sub_epi64(_mm256_castpd_si256(t), _mm256_castpd_si256(shifter));
+    auto scale = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(k, _mm256_set1_epi64x(1023)), 52));
+    auto p = _mm256_fmadd_pd(_mm256_mul_pd(r, r), BatchHorner4(BATCH_EXP_C, r), r);
+    return _mm256_mul_pd(_mm256_add_pd(_mm256_set1_pd(1), p), scale);
+}
+
+__attribute__((target("avx2,fma"))) void BatchLogReduce4(__m256d x, __m256d &k, __m256d &f, __m256d &hfsq,
+                                                         __m256d &sR) noexcept {
+    auto bits = _mm256_castpd_si256(x);
+    auto e = _mm256_sub_epi64(_mm256_srli_epi64(bits, 52), _mm256_set1_epi64x(1023));
+    auto m = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi64x(0x000fffffffffffffll)),
+                                                 _mm256_set1_epi64x(0x3ff0000000000000ll)));
+    auto big = _mm256_cmp_pd(m, _mm256_set1_pd(BATCH_SQRT2), _CMP_GT_OQ);
+    m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), big);
+    e = _mm256_sub_epi64(e, _mm256_castpd_si256(big)); // big的每一位都是1，即-1
+
+    // 小整数转double：拼到1.5*2^52的低位上，再减去1.5*2^52
+    auto shifter = _mm256_set1_pd(BATCH_SHIFTER);
+    k = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(e, _mm256_castpd_si256(shifter))), shifter);
+
+    auto one = _mm256_set1_pd(1);
+    f = _mm256_sub_pd(m, one);
+    auto s = _mm256_div_pd(f, _mm256_add_pd(_mm256_set1_pd(2), f));
+    auto z = _mm256_mul_pd(s, s);
+    hfsq = _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(0.5), f), f);
+    sR = _mm256_mul_pd(s, _mm256_fmadd_pd(z, BatchHorner4(BATCH_LOG_C, z), hfsq));
+}
+
+__attribute__((target("avx2,fma"))) __m256d BatchLog4(__m256d x) noexcept {
+    __m256d k, f, hfsq, sR;
+    BatchLogReduce4(x, k, f, hfsq, sR);
+    auto lo = _mm256_fmadd_pd(k, _mm256_set1_pd(BATCH_LN2_LO), sR);
+    return _mm256_sub_pd(_mm256_mul_pd(k, _mm256_set1_pd(BATCH_LN2_HI)), _mm256_sub_pd(_mm256_sub_pd(hfsq, lo), f));
+}
+
+__attribute__((target("avx2,fma"))) __m256d BatchLog2_4(__m256d x) noexcept {
+    __m256d k, f, hfsq, sR;
+    BatchLogReduce4(x, k, f, hfsq, sR);
+    return _mm256_fmadd_pd(_mm256_sub_pd(f, _mm256_sub_pd(hfsq, sR)), _mm256_set1_pd(BATCH_INV_LN2), k);
+}
+
+__attribute__((target("avx2,fma"))) void BatchSinCos4(__m256d x, __m256d &s, __m256d &c) noexcept {
+    auto shifter = _mm256_set1_pd(BATCH_SHIFTER);
+    auto t = _mm256_fmadd_pd(x, _mm256_set1_pd(BATCH_TWO_OVER_PI), shifter);
+    auto n = _mm256_sub_pd(t, shifter);
+    auto q = _mm256_sub_epi64(_mm256_castpd_si256(t), _mm256_castpd_si256(shifter));
+
+    auto a = _mm256_fnmadd_pd(n, _mm256_set1_pd(BATCH_PIO2_1), x);
+    auto p2 = _mm256_mul_pd(n, _mm256_set1_pd(BATCH_PIO2_2));
+    auto b = _mm256_sub_pd(a, p2);
+    auto bb = _mm256_sub_pd(b, a);
+    auto err = _mm256_sub_pd(_mm256_sub_pd(a, _mm256_sub_pd(b, bb)), _mm256_add_pd(p2, bb));
+    auto lo = _mm256_fnmadd_pd(n, _mm256_set1_pd(BATCH_PIO2_3), err);
+    lo = _mm256_fnmadd_pd(n, _mm256_set1_pd(BATCH_PIO2_3T), lo);
+    auto r = _mm256_add_pd(b, lo);
+    auto rlo = _mm256_add_pd(_mm256_sub_pd(b, r), lo);
+
+    auto one = _mm256_set1_pd(1);
+    auto z = _mm256_mul_pd(r, r);
+    auto hz = _mm256_mul_pd(_mm256_set1_pd(0.5), z);
+    auto w = _mm256_sub_pd(one, hz);
+    auto sinR = _mm256_add_pd(r, _mm256_fmadd_pd(_mm256_mul_pd(r, z), BatchHorner4(BATCH_SIN_C, z),
+                                                 _mm256_mul_pd(rlo, w)));
+    auto cosR = _mm256_add_pd(
+        w, _mm256_add_pd(_mm256_sub_pd(_mm256_sub_pd(one, w), hz),
+                         _mm256_fnmadd_pd(r, rlo, _mm256_mul_pd(_mm256_mul_pd(z, z), BatchHorner4(BATCH_COS_C, z)))));
+
+    // 按象限换成±sin(r)或±cos(r)，符号位直接异或
+    auto swap = _mm256_castsi256_pd(
+        _mm256_cmpeq_epi64(_mm256_and_si256(q, _mm256_set1_epi64x(1)), _mm256_set1_epi64x(1)));
+    auto signS = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_and_si256(q, _mm256_set1_epi64x(2)), 62));
+    auto signC = _mm256_castsi256_pd(
+        _mm256_slli_epi64(_mm256_and_si256(_mm256_add_epi64(q, _mm256_set1_epi64x(1)), _mm256_set1_epi64x(2)), 62));
+    s = _mm256_xor_pd(_mm256_blendv_pd(sinR, cosR, swap), signS);
+    c = _mm256_xor_pd(_mm256_blendv_pd(cosR, sinR, swap), signC);
+}
+
+__attribute__((target("avx2,fma"))) __m256d BatchKernel4(MathOperator op, __m256d v) noexcept {
+    __m256d s, c;
+    switch (op) {
+    case MathOperator::MATH_SIN:
+        BatchSinCos4(v, s, c);
+        return s;
+    case MathOperator::MATH_COS:
+        BatchSinCos4(v, s, c);
+        return c;
+    case MathOperator::MATH_TAN:
+        BatchSinCos4(v, s, c);
+        return _mm256_div_pd(s, c);
+    case MathOperator::MATH_LOG:
+        return BatchLog4(v);
+    case MathOperator::MATH_LOG2:
+        return BatchLog2_4(v);
+    case MathOperator::MATH_LOG10:
+        return _mm256_mul_pd(BatchLog4(v), _mm256_set1_pd(BATCH_INV_LN10));
+    default:
+        return BatchExp4(v);
+    }
+}
+
+// 4个输入是否都在快速路径的范围内
+__attribute__((target("avx2,fma"))) bool BatchInRange4(MathOperator op, __m256d v) noexcept {
+    auto abs = _mm256_andnot_pd(_mm256_set1_pd(-0.0), v);
+    __m256d ok;
+    switch (op) {
+    case MathOperator::MATH_LOG:
+    case MathOperator::MATH_LOG2:
+    case MathOperator::MATH_LOG10:
+        ok = _mm256_and_pd(_mm256_cmp_pd(v, _mm256_set1_pd(std::numeric_limits<double>::min()), _CMP_GE_OQ),
+                           _mm256_cmp_pd(v, _mm256_set1_pd(std::numeric_limits<double>::max()), _CMP_LE_OQ));
+        break;
+    case MathOperator::MATH_EXP:
+        ok = _mm256_cmp_pd(abs, _mm256_set1_pd(BATCH_EXP_MAX), _CMP_LE_OQ);
+        break;
+    default:
+        ok = _mm256_cmp_pd(abs, _mm256_set1_pd(BATCH_TRIG_MAX), _CMP_LE_OQ);
+        break;
+    }
+    return _mm256_movemask_pd(ok) == 0xf;
+}
+
+// y可以与x是同一个数组：每次先读入4个再写回
+__attribute__((target("avx2,fma"))) void BatchCalcAvx2(MathOperator op, const double *x, double *y,
+                                                       std::size_t n) noexcept {
+    alignas(32) double in[4], out[4];
+    for (std::size_t i = 0; i < n; i += 4) {
+        auto m = std::min<std::size_t>(4, n - i);
+        if (m == 4) {
+            auto v = _mm256_loadu_pd(x + i);
+            if (BatchInRange4(op, v)) {
+                _mm256_storeu_pd(y + i, BatchKernel4(op, v));
+                continue;
+            }
+        }
+
+        // 末尾不足4个（补0），或者有超出范围的输入
+        std::fill(in, in + 4, 0.0);
+        std::copy(x + i, x + i + m, in);
+        _mm256_store_pd(out, BatchKernel4(op, _mm256_load_pd(in)));
+        for (std::size_t j = 0; j < m; ++j) {
+            if (!BatchInRange(op, in[j])) {
+                out[j] = BatchStdCalc(op, in[j]);
+            }
+        }
+        std::copy(out, out + m, y + i);
+    }
+}
+
+__attribute__((target("avx2,fma"))) void BatchSinCosAvx2(const double *x, double *s, double *c,
+                                                         std::size_t n) noexcept {
+    alignas(32) double in[4], outS[4], outC[4];
+    for (std::size_t i = 0; i < n; i += 4) {
+        auto m = std::min<std::size_t>(4, n - i);
+        std::fill(in, in + 4, 0.0);
+        std::copy(x + i, x + i + m, in);
+        __m256d vs, vc;
+        BatchSinCos4(_mm256_load_pd(in), vs, vc);
+        _mm256_store_pd(outS, vs);
+        _mm256_store_pd(outC, vc);
+        for (std::size_t j = 0; j < m; ++j) {
+            if (!(std::abs(in[j]) <= BATCH_TRIG_MAX)) {
+                outS[j] = std::sin(in[j]);
+                outC[j] = std::cos(in[j]);
+            }
+        }
+        std::copy(outS, outS + m, s + i);
+        std::copy(outC, outC + m, c + i);
+    }
+}
+
+#else
+
+bool BatchHasAvx2() noexcept {
+    return false;
+}
+
+void BatchCalcAvx2(MathOperator op, const double *x, double *y, std::size_t n) noexcept {
+    internal::BatchCalcGeneric(op, x, y, n);
+}
+
+void BatchSinCosAvx2(const double *x, double *s, double *c, std::size_t n) noexcept {
+    internal::BatchSinCosGeneric(x, s, c, n);
+}
+
+#endif
+
+bool IsBatchKernelOperator(MathOperator op) noexcept {
+    return op >= MathOperator::MATH_SIN && op <= MathOperator::MATH_EXP && op != MathOperator::MATH_ARCSIN &&
+           op != MathOperator::MATH_ARCCOS && op != MathOperator::MATH_ARCTAN && op != MathOperator::MATH_SQRT;
+}
+
+} // namespace
+
+void BatchCalc(MathOperator op, const double *x, double *y, std::size_t n) noexcept {
+    if (IsBatchKernelOperator(op) && BatchHasAvx2()) {
+        BatchCalcAvx2(op, x, y, n);
+    } else {
+        internal::BatchCalcGeneric(op, x, y, n);
+    }
+}
+
+void BatchSinCos(const double *x, double *s, double *c, std::size_t n) noexcept {
+    if (BatchHasAvx2()) {
+        BatchSinCosAvx2(x, s, c, n);
+    } else {
+        internal::BatchSinCosGeneric(x, s, c, n);
+    }
+}
+
+const char *BatchCalcKernel() noexcept {
+    return BatchHasAvx2() ? "avx2" : "generic";
+}
+
+namespace internal {
+
+void BatchCalcGeneric(MathOperator op, const double *x, double *y, std::size_t n) noexcept {
+    if (!IsBatchKernelOperator(op)) {
+        for (std::size_t i = 0; i < n; ++i) {
+            y[i] = BatchStdCalc(op, x[i]);
+        }
+        return;
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        auto v = x[i];
+        y[i] = BatchInRange(op, v) ? BatchKernel(op, v) : BatchStdCalc(op, v);
+    }
+}
+
+void BatchSinCosGeneric(const double *x, double *s, double *c, std::size_t n) noexcept {
+    for (std::size_t i = 0; i < n; ++i) {
+        auto v = x[i];
+        if (std::abs(v) <= BATCH_TRIG_MAX) {
+            BatchSinCosKernel(v, s[i], c[i]);
+        } else {
+            // 先算好两个结果再写入，s、c可能与x是同一个数组
+            auto sinV = std::sin(v);
+            auto cosV = std::cos(v);
+            s[i] = sinV;
+            c[i] = cosV;
+        }
+    }
+}
+
+} // namespace internal
+
+} // namespace tomsolver
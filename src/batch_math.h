@@ -0,0 +1,43 @@
+#pragma once
+
+#include "math_operator.h"
+
+#include <cstddef>
+
+namespace tomsolver {
+
+/**
+ * 批量计算一元运算：y[i] = op(x[i])，i∈[0, n)。y可以与x是同一个数组。
+ * MATH_SIN、MATH_COS、MATH_TAN、MATH_LOG、MATH_LOG2、MATH_LOG10、MATH_EXP使用可向量化的多项式实现，
+ * 运行时根据CPU特性选择AVX2+FMA版本（每次计算4个）或者通用版本（逐个计算），两者的误差上界相同：
+ *      exp: 1 ULP   log: 1 ULP   log2, log10: 2 ULP
+ *      sin, cos: 1 ULP（|x| <= 1e5）   tan: 3 ULP（|x| <= 1e5）
+ * 超出快速路径的输入（exp的|x| > 708，log的非正数与非正规数，sin、cos、tan的|x| > 1e5，以及inf、nan等）逐个交给std::的同名函数。
+ * 其余运算符逐个调用std::的同名函数。
+ * 与tomsolver::Calc不同，这里不检查浮点数无效值，定义域以外的输入按std::函数的约定返回nan或者inf。
+ */
+void BatchCalc(MathOperator op, const double *x, double *y, std::size_t n) noexcept;
+
+/**
+ * 批量同时计算sin与cos：s[i] = sin(x[i])，c[i] = cos(x[i])。s或者c可以与x是同一个数组。
+ * 误差上界与BatchCalc相同，两者共用一次区间约简。
+ */
+void BatchSinCos(const double *x, double *s, double *c, std::size_t n) noexcept;
+
+/**
+ * 返回BatchCalc当前使用的实现："avx2"或者"generic"。
+ */
+const char *BatchCalcKernel() noexcept;
+
+namespace internal {
+
+/**
+ * 强制使用通用版本的BatchCalc、BatchSinCos。用于测试两种实现的一致性。
+ */
+void BatchCalcGeneric(MathOperator op, const double *x, double *y, std::size_t n) noexcept;
+
+void BatchSinCosGeneric(const double *x, double *s, double *c, std::size_t n) noexcept;
+
+} // namespace internal
+
+} // namespace tomsolver
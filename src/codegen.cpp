@@ -0,0 +1,223 @@
+#include "codegen.h"
+
+#include "math_operator.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace tomsolver {
+
+namespace internal {
+
+/**
+ * 把指令流翻译为C++语句。
+ * 模拟求值栈，栈中保存的是操作数的C++表达式（字面量、x[i]或者临时变量名）。
+ * 每个运算生成一个临时变量，以表达式文本去重，相同的表达式只生成一次。
+ */
+class CodeGenerator {
+public:
+    explicit CodeGenerator(std::ostream &out) : out(out) {}
+
+    void Generate(const CompiledSymMat &compiled, const std::string &name, const std::string &output) {
+        using OpCode = CompiledSymMat::OpCode;
+
+        auto &code = compiled.Code();
+        auto &offsets = compiled.Offsets();
+
+        out << "// " << compiled.Rows() << "x" << compiled.Cols() << " matrix of\n";
+        for (std::size_t i = 0; i < compiled.Vars().size(); ++i) {
+            out << "//   x[" << i << "] = " << compiled.Vars()[i] << "\n";
+        }
+        out << "extern \"C\" void " << name << "(const double *x, double *" << output << ") {\n";
+        if (compiled.Vars().empty()) {
+            out << "    (void)x;\n";
+        }
+
+        std::vector<std::string> stk;
+        std::vector<std::string> slots;
+        auto popOperand = [&stk] {
+            auto operand = std::move(stk.back());
+            stk.pop_back();
+            return operand;
+        };
+
+        for (std::size_t i = 0; i + 1 < offsets.size(); ++i) {
+            for (auto j = offsets[i]; j < offsets[i + 1]; ++j) {
+                auto &inst = code[j];
+                switch (inst.code) {
+                case OpCode::NUMBER:
+                    stk.emplace_back(Literal(inst.value));
+                    break;
+                case OpCode::VARIABLE:
+                    stk.emplace_back("x[" + std::to_string(inst.index) + "]");
+                    break;
+                case OpCode::UNARY:
+                    stk.back() = Unary(inst.op, stk.back());
+                    break;
+                case OpCode::BINARY: {
+                    auto r = popOperand();
+                    stk.back() = Binary(inst.op, stk.back(), r);
+                    break;
+                }
+                case OpCode::SQUARE:
+                    stk.back() = Temp(stk.back() + " * " + stk.back());
+                    break;
+                case OpCode::POWI:
+                    stk.back() = IntegerPower(stk.back(), static_cast<int>(inst.value));
+                    break;
+                case OpCode::RECIPROCAL:
+                    stk.back() = Temp("1.0 / " + stk.back());
+                    break;
+                case OpCode::SINCOS: {
+                    // 两个结果都生成临时变量，另一个留给后面的LOAD
+                    auto s = Temp("std::sin(" + stk.back() + ")");
+                    auto c = Temp("std::cos(" + stk.back() + ")");
+                    if (slots.size() <= inst.index) {
+                        slots.resize(inst.index + 1);
+                    }
+                    stk.back() = inst.op == MathOperator::MATH_SIN ? s : c;
+                    slots[inst.index] = inst.op == MathOperator::MATH_SIN ? c : s;
+                    break;
+                }
+                case OpCode::LOAD:
+                    stk.emplace_back(slots[inst.index]);
+                    break;
+                }
+            }
+            out << "    " << output << "[" << i << "] = " << popOperand() << ";\n";
+        }
+        out << "}\n";
+    }
+
+private:
+    std::ostream &out;
+    std::unordered_map<std::string, std::string> temps; // 表达式 -> 临时变量名
+
+    // 为表达式expr生成一个临时变量，返回变量名。相同的表达式复用已有的临时变量
+    std::string Temp(const std::string &expr) {
+        auto itor = temps.find(expr);
+        if (itor != temps.end()) {
+            return itor->second;
+        }
+        auto name = "t" + std::to_string(temps.size());
+        temps.emplace(expr, name);
+        out << "    const double " << name << " = " << expr << ";\n";
+        return name;
+    }
+
+    // 可以原样还原的双精度浮点数字面量
+    static std::string Literal(double value) {
+        if (std::isnan(value)) {
+            return "NAN";
+        }
+        if (std::isinf(value)) {
+            return value > 0 ? "HUGE_VAL" : "(-HUGE_VAL)";
+        }
+        std::ostringstream ss;
+        ss << std::setprecision(std::numeric_limits<double>::max_digits10) << value;
+        auto ret = ss.str();
+        if (ret.find_first_of(".e") == std::string::npos) {
+            ret += ".0";
+        }
+        return value < 0 ? "(" + ret + ")" : ret;
+    }
+
+    std::string Unary(MathOperator op, const std::string &operand) {
+        switch (op) {
+        case MathOperator::MATH_POSITIVE:
+            return operand;
+        case MathOperator::MATH_NEGATIVE:
+            // 字面量直接取负，不生成临时变量
+            return std::isdigit(static_cast<unsigned char>(operand[0])) ? "(-" + operand + ")" : Temp("-" + operand);
+        case MathOperator::MATH_SIN:
+            return Temp("std::sin(" + operand + ")");
+        case MathOperator::MATH_COS:
+            return Temp("std::cos(" + operand + ")");
+        case MathOperator::MATH_TAN:
+            return Temp("std::tan(" + operand + ")");
+        case MathOperator::MATH_ARCSIN:
+            return Temp("std::asin(" + operand + ")");
+        case MathOperator::MATH_ARCCOS:
+            return Temp("std::acos(" + operand + ")");
+        case MathOperator::MATH_ARCTAN:
+            return Temp("std::atan(" + operand + ")");
+        case MathOperator::MATH_SQRT:
+            return Temp("std::sqrt(" + operand + ")");
+        case MathOperator::MATH_LOG:
+            return Temp("std::log(" + operand + ")");
+        case MathOperator::MATH_LOG2:
+            return Temp("std::log2(" + operand + ")");
+        case MathOperator::MATH_LOG10:
+            return Temp("std::log10(" + operand + ")");
+        case MathOperator::MATH_EXP:
+            return Temp("std::exp(" + operand + ")");
+        default:
+            throw std::runtime_error("GenerateFunction: unsupported operator " + MathOperatorToStr(op));
+        }
+    }
+
+    std::string Binary(MathOperator op, const std::string &l, const std::string &r) {
+        switch (op) {
+        case MathOperator::MATH_ADD:
+            return Temp(l + " + " + r);
+        case MathOperator::MATH_SUB:
+            return Temp(l + " - " + r);
+        case MathOperator::MATH_MULTIPLY:
+            return Temp(l + " * " + r);
+        case MathOperator::MATH_DIVIDE:
+            return Temp(l + " / " + r);
+        case MathOperator::MATH_POWER:
+            return Temp("std::pow(" + l + ", " + r + ")");
+        case MathOperator::MATH_MOD:
+            return Temp("(double)((int)" + l + " % (int)" + r + ")");
+        case MathOperator::MATH_AND:
+            return Temp("(double)((int)" + l + " & (int)" + r + ")");
+        case MathOperator::MATH_OR:
+            return Temp("(double)((int)" + l + " | (int)" + r + ")");
+        default:
+            throw std::runtime_error("GenerateFunction: unsupported operator " + MathOperatorToStr(op));
+        }
+    }
+
+    // 以平方求幂的方式展开为乘法，与CompiledSymMat的求值过程一致
+    std::string IntegerPower(std::string base, int exponent) {
+        std::string ret;
+        for (auto n = std::abs(exponent); n; n >>= 1) {
+            if (n & 1) {
+                ret = ret.empty() ? base : Temp(ret + " * " + base);
+            }
+            if (n > 1) {
+                base = Temp(base + " * " + base);
+            }
+        }
+        if (ret.empty()) {
+            return "1.0";
+        }
+        return exponent < 0 ? Temp("1.0 / " + ret) : ret;
+    }
+};
+
+} // namespace internal
+
+std::string GenerateFunction(const CompiledSymMat &compiled, const std::string &name, const std::string &output) {
+    std::ostringstream out;
+    internal::CodeGenerator(out).Generate(compiled, name, output);
+    return out.str();
+}
+
+std::string GenerateModel(const SymVec &equations, const std::vector<std::string> &vars, const std::string &prefix) {
+    std::ostringstream out;
+    out << "// Generated by TomSolver. Do not edit.\n";
+    out << "#include <cmath>\n\n";
+    out << GenerateFunction(CompiledSymMat(equations, vars), prefix + "residual", "f") << "\n";
+    out << GenerateFunction(CompiledSymMat(Jacobian(equations, vars), vars), prefix + "jacobian", "J");
+    return out.str();
+}
+
+} // namespace tomsolver
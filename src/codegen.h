@@ -0,0 +1,33 @@
+#pragma once
+
+#include "compiled.h"
+#include "symmat.h"
+
+#include <string>
+#include <vector>
+
+namespace tomsolver {
+
+/**
+ * 把compiled生成为一个独立的C++函数：
+ *      extern "C" void name(const double *x, double *output)
+ * x按compiled.Vars()的顺序存放变量的值，结果按行优先的顺序写入output。output不能为x，也不能与临时变量t0, t1, ...重名。
+ * 生成的代码只依赖<cmath>：
+ *   1. 每个中间结果对应一个const double临时变量，结构相同的子表达式（包括不同元素之间）只计算一次；
+ *   2. 沿用CompiledSymMat的强度削减，整数次幂展开为乘法，同参数的sin、cos相邻计算。
+ * 注意：生成的代码不检查浮点数无效值(inf, -inf, nan)。
+ */
+std::string GenerateFunction(const CompiledSymMat &compiled, const std::string &name,
+                             const std::string &output = "out");
+
+/**
+ * 生成一个完整的C++源文件，包含方程组的残差函数与雅可比矩阵函数：
+ *      extern "C" void {prefix}residual(const double *x, double *f)
+ *      extern "C" void {prefix}jacobian(const double *x, double *J)
+ * x按vars的顺序存放；J按行优先的顺序存放，J[i*vars.size()+j]为第i个方程对第j个变量的偏导数。
+ * @exception runtime_error equations中出现了vars以外的变量
+ */
+std::string GenerateModel(const SymVec &equations, const std::vector<std::string> &vars,
+                          const std::string &prefix = "");
+
+} // namespace tomsolver
@@ -0,0 +1,519 @@
+#include "compiled.h"
+
+#include "batch_math.h"
+#include "config.h"
+#include "egraph.h"
+#include "error_type.h"
+#include "math_operator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <stack>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace tomsolver {
+
+namespace {
+
+// 乘方x^exponent是否可以改写为乘除或者开方
+bool CanReducePower(double exponent) noexcept {
+    return exponent == 0.5 || (std::trunc(exponent) == exponent && std::abs(exponent) <= 64);
+}
+
+// 常量折叠：计算结果不是有限值时不折叠，留到求值时再按Config处理无效值
+bool FoldConstant(MathOperator op, double v1, double v2, double &result) noexcept {
+    try {
+        result = Calc(op, v1, v2);
+    } catch (const MathError &) {
+        return false;
+    }
+    return std::isfinite(result);
+}
+
+} // namespace
+
+CompiledSymMat::CompiledSymMat(const SymMat &mat, const std::vector<std::string> &vars)
+    : rows(mat.Rows()), cols(mat.Cols()), vars(vars) {
+    std::map<std::string, std::uint32_t> varIds;
+    for (std::uint32_t i = 0; i < vars.size(); ++i) {
+        varIds.emplace(vars[i], i);
+    }
+
+    offsets.reserve(rows * cols + 1);
+    offsets.emplace_back(0);
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < cols; ++j) {
+            if (Config::Get().optimizeBeforeCompile) {
+                CompileElement(*Optimize(mat.Value(i, j)), varIds);
+            } else {
+                CompileElement(*mat.Value(i, j), varIds);
+            }
+            offsets.emplace_back(static_cast<std::uint32_t>(code.size()));
+        }
+    }
+}
+
+// 后序遍历。非递归实现。
+void CompiledSymMat::CompileElement(const internal::NodeImpl &root,
+                                    const std::map<std::string, std::uint32_t> &varIds) {
+    // ==== Part I ====
+    // 借助一个栈，得到后序遍历序列items
+    std::vector<const internal::NodeImpl *> items;
+    std::stack<const internal::NodeImpl *> stk;
+    stk.emplace(&root);
+    while (!stk.empty()) {
+        auto cur = stk.top();
+        stk.pop();
+        items.emplace_back(cur);
+        if (cur->left) {
+            stk.emplace(cur->left.get());
+        }
+        if (cur->right) {
+            stk.emplace(cur->right.get());
+        }
+    }
+    std::reverse(items.begin(), items.end());
+
+    // 记下每个节点的左子节点、子树的起始位置和子树的哈希值。右子节点总是紧挨在父节点前面
+    auto n = items.size();
+    std::vector<std::size_t> lefts(n), firsts(n);
+    std::vector<std::uint64_t> hashes(n);
+    std::vector<std::size_t> operands;
+    for (std::size_t i = 0; i < n; ++i) {
+        auto &cur = *items[i];
+        auto hash = internal::HashSingleNode(cur.type, cur.op, cur.value, cur.varname);
+        firsts[i] = i;
+        if (cur.type == NodeType::OPERATOR) {
+            if (GetOperatorNum(cur.op) == 2) {
+                hash = internal::HashCombine(hash, hashes[operands.back()]);
+                operands.pop_back();
+            }
+            lefts[i] = operands.back();
+            operands.pop_back();
+            hash = internal::HashCombine(hash, hashes[lefts[i]]);
+            firsts[i] = firsts[lefts[i]];
+        }
+        hashes[i] = hash;
+        operands.emplace_back(i);
+    }
+
+    // ==== Part II ====
+    // 强度削减。skipMarks是差分数组，累加后大于0的节点不生成指令
+    std::vector<int> skipMarks(n + 1, 0);
+    auto skip = [&skipMarks](std::size_t begin, std::size_t end) {
+        skipMarks[begin] += 1;
+        skipMarks[end] -= 1;
+    };
+
+    // 把参数相同的sin、cos配对：先出现的一个用SINCOS同时算出两个结果，后出现的一个直接LOAD，不再计算参数
+    std::vector<std::uint32_t> storeSlots(n, 0), loadSlots(n, 0);
+    std::vector<bool> isStore(n, false), isLoad(n, false);
+    std::unordered_multimap<std::uint64_t, std::size_t> pending; // 尚未配对的sin、cos，以参数的哈希值为键
+    std::uint32_t slots = 0;
+    for (std::size_t j = 0; j < n; ++j) {
+        auto &cur = *items[j];
+        if (cur.type != NodeType::OPERATOR || (cur.op != MathOperator::MATH_SIN && cur.op != MathOperator::MATH_COS)) {
+            continue;
+        }
+
+        auto partner = cur.op == MathOperator::MATH_SIN ? MathOperator::MATH_COS : MathOperator::MATH_SIN;
+        auto range = pending.equal_range(hashes[lefts[j]]);
+        auto itor = std::find_if(range.first, range.second, [&](const std::pair<const std::uint64_t, std::size_t> &pr) {
+            return items[pr.second]->op == partner && items[pr.second]->left->Equal(cur.left);
+        });
+        if (itor == range.second) {
+            pending.emplace(hashes[lefts[j]], j);
+            continue;
+        }
+
+        auto i = itor->second;
+        pending.erase(itor);
+        isStore[i] = isLoad[j] = true;
+        storeSlots[i] = loadSlots[j] = slots++;
+
+        // j的参数不再计算，其中尚未配对的sin、cos也不能再参与配对
+        skip(firsts[j], j);
+        for (auto p = pending.begin(); p != pending.end();) {
+            p = p->second >= firsts[j] && p->second < j ? pending.erase(p) : std::next(p);
+        }
+    }
+    slotNum = std::max<std::size_t>(slotNum, slots);
+
+    // 指数为数值的乘方，指数本身不再压栈
+    for (std::size_t i = 0; i < n; ++i) {
+        auto &cur = *items[i];
+        if (cur.type == NodeType::OPERATOR && cur.op == MathOperator::MATH_POWER &&
+            items[i - 1]->type == NodeType::NUMBER && CanReducePower(items[i - 1]->value)) {
+            skip(i - 1, i);
+        }
+    }
+
+    // ==== Part III ====
+    // 生成指令，同时统计求值栈的深度
+    int skipping = 0;
+    std::size_t depth = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        skipping += skipMarks[i];
+        if (skipping > 0) {
+            continue;
+        }
+
+        auto &cur = *items[i];
+        Instruction inst{OpCode::NUMBER, cur.op, 0, 0};
+        switch (cur.type) {
+        case NodeType::NUMBER:
+            inst.value = cur.value;
+            ++depth;
+            break;
+        case NodeType::VARIABLE: {
+            auto itor = varIds.find(cur.varname);
+            if (itor == varIds.end()) {
+                throw std::runtime_error("CompiledSymMat: unbound variable: " + cur.varname);
+            }
+            inst.code = OpCode::VARIABLE;
+            inst.index = itor->second;
+            ++depth;
+            break;
+        }
+        case NodeType::OPERATOR:
+            if (isLoad[i]) {
+                inst.code = OpCode::LOAD;
+                inst.index = loadSlots[i];
+                ++depth;
+            } else if (isStore[i]) {
+                inst.code = OpCode::SINCOS;
+                inst.index = storeSlots[i];
+            } else if (cur.op == MathOperator::MATH_POWER && items[i - 1]->type == NodeType::NUMBER &&
+                       CanReducePower(items[i - 1]->value)) {
+                auto exponent = items[i - 1]->value;
+                if (exponent == 2) {
+                    inst.code = OpCode::SQUARE;
+                } else if (exponent == -1) {
+                    inst.code = OpCode::RECIPROCAL;
+                } else if (exponent == 0.5) {
+                    inst.code = OpCode::UNARY;
+                    inst.op = MathOperator::MATH_SQRT;
+                } else {
+                    inst.code = OpCode::POWI;
+                    inst.value = exponent;
+                }
+            } else if (GetOperatorNum(cur.op) == 2) {
+                inst.code = OpCode::BINARY;
+                --depth;
+            } else {
+                inst.code = OpCode::UNARY;
+            }
+            break;
+        }
+        maxDepth = std::max(maxDepth, depth);
+        code.emplace_back(inst);
+    }
+    assert(depth == 1);
+}
+
+int CompiledSymMat::Rows() const noexcept {
+    return rows;
+}
+
+int CompiledSymMat::Cols() const noexcept {
+    return cols;
+}
+
+const std::vector<std::string> &CompiledSymMat::Vars() const noexcept {
+    return vars;
+}
+
+std::size_t CompiledSymMat::Size() const noexcept {
+    return code.size();
+}
+
+const std::vector<CompiledSymMat::Instruction> &CompiledSymMat::Code() const noexcept {
+    return code;
+}
+
+const std::vector<std::uint32_t> &CompiledSymMat::Offsets() const noexcept {
+    return offsets;
+}
+
+void CompiledSymMat::Eval(const double *x, double *out, Workspace &ws) const {
+    EvalAs<double>(x, out, ws);
+}
+
+Mat CompiledSymMat::Eval(const Vec &x, Workspace &ws) const {
+    assert(x.Rows() == static_cast<int>(vars.size()));
+    Mat ret(rows, cols);
+    Eval(vars.empty() ? nullptr : &x.Value(0, 0), &ret.Value(0, 0), ws);
+    return ret;
+}
+
+Mat CompiledSymMat::Eval(const Vec &x) const {
+    Workspace ws;
+    return Eval(x, ws);
+}
+
+void CompiledSymMat::EvalBatch(const double *x, std::size_t n, double *out, Workspace &ws) const {
+    // 每次处理block个点，求值栈的每一层是连续的block个值。第0层空着不用，栈顶的下一层总是有效的位置
+    constexpr std::size_t block = 256;
+    ws.batch.resize((maxDepth + 1 + slotNum) * block);
+    auto stk = ws.batch.data() + block;
+    auto slots = stk + maxDepth * block;
+
+    std::vector<double> point(vars.size()), result(offsets.size() - 1);
+    auto begin = code.data();
+    for (std::size_t p0 = 0; p0 < n; p0 += block) {
+        auto m = std::min(block, n - p0);
+        for (std::size_t i = 0; i + 1 < offsets.size(); ++i) {
+            // top指向栈顶的下一层
+            auto top = stk;
+            for (auto inst = begin + offsets[i], end = begin + offsets[i + 1]; inst != end; ++inst) {
+                auto v = top - block; // 栈顶
+                switch (inst->code) {
+                case OpCode::NUMBER:
+                    std::fill(top, top + m, inst->value);
+                    top += block;
+                    break;
+                case OpCode::VARIABLE:
+                    std::copy(x + inst->index * n + p0, x + inst->index * n + p0 + m, top);
+                    top += block;
+                    break;
+                case OpCode::UNARY:
+                    BatchCalc(inst->op, v, v, m);
+                    break;
+                case OpCode::BINARY: {
+                    top -= block;
+                    auto l = top - block, r = top;
+                    switch (inst->op) {
+                    case MathOperator::MATH_ADD:
+                        for (std::size_t k = 0; k < m; ++k) {
+                            l[k] += r[k];
+                        }
+                        break;
+                    case MathOperator::MATH_SUB:
+                        for (std::size_t k = 0; k < m; ++k) {
+                            l[k] -= r[k];
+                        }
+                        break;
+                    case MathOperator::MATH_MULTIPLY:
+                        for (std::size_t k = 0; k < m; ++k) {
+                            l[k] *= r[k];
+                        }
+                        break;
+                    case MathOperator::MATH_DIVIDE:
+                        for (std::size_t k = 0; k < m; ++k) {
+                            l[k] /= r[k];
+                        }
+                        break;
+                    case MathOperator::MATH_POWER:
+                        for (std::size_t k = 0; k < m; ++k) {
+                            l[k] = std::pow(l[k], r[k]);
+                        }
+                        break;
+                    default:
+                        for (std::size_t k = 0; k < m; ++k) {
+                            l[k] = tomsolver::Calc(inst->op, l[k], r[k]);
+                        }
+                        break;
+                    }
+                    break;
+                }
+                case OpCode::SQUARE:
+                    for (std::size_t k = 0; k < m; ++k) {
+                        v[k] *= v[k];
+                    }
+                    break;
+                case OpCode::POWI:
+                    for (std::size_t k = 0; k < m; ++k) {
+                        v[k] = internal::IntegerPower(v[k], static_cast<int>(inst->value));
+                    }
+                    break;
+                case OpCode::RECIPROCAL:
+                    for (std::size_t k = 0; k < m; ++k) {
+                        v[k] = 1 / v[k];
+                    }
+                    break;
+                case OpCode::SINCOS: {
+                    auto slot = slots + inst->index * block;
+                    if (inst->op == MathOperator::MATH_SIN) {
+                        BatchSinCos(v, v, slot, m);
+                    } else {
+                        BatchSinCos(v, slot, v, m);
+                    }
+                    break;
+                }
+                case OpCode::LOAD: {
+                    auto slot = slots + inst->index * block;
+                    std::copy(slot, slot + m, top);
+                    top += block;
+                    break;
+                }
+                }
+            }
+            assert(top == stk + block);
+            std::copy(stk, stk + m, out + i * n + p0);
+        }
+
+        if (!Config::Get().throwOnInvalidValue) {
+            continue;
+        }
+
+        // 出现无效值的点交给Eval()，与逐点求值的行为保持一致
+        for (std::size_t p = p0; p < p0 + m; ++p) {
+            bool valid = true;
+            for (std::size_t i = 0; i < result.size(); ++i) {
+                valid = valid && std::isfinite(out[i * n + p]);
+            }
+            if (valid) {
+                continue;
+            }
+            for (std::size_t j = 0; j < vars.size(); ++j) {
+                point[j] = x[j * n + p];
+            }
+            Eval(point.data(), result.data(), ws);
+            for (std::size_t i = 0; i < result.size(); ++i) {
+                out[i * n + p] = result[i];
+            }
+        }
+    }
+}
+
+Mat CompiledSymMat::EvalBatch(const Mat &points, Workspace &ws) const {
+    assert(points.Rows() == static_cast<int>(vars.size()));
+    auto n = static_cast<std::size_t>(points.Cols());
+    Mat ret(rows * cols, points.Cols());
+    EvalBatch(vars.empty() ? nullptr : &points.Value(0, 0), n, &ret.Value(0, 0), ws);
+    return ret;
+}
+
+Mat CompiledSymMat::EvalBatch(const Mat &points) const {
+    Workspace ws;
+    return EvalBatch(points, ws);
+}
+
+const std::vector<std::string> &CompiledExpression::Vars() const noexcept {
+    return vars;
+}
+
+std::size_t CompiledExpression::Size() const noexcept {
+    return code.size();
+}
+
+const std::vector<CompiledSymMat::Instruction> &CompiledExpression::Code() const noexcept {
+    return code;
+}
+
+double CompiledExpression::Eval(const double *x) const {
+    if (maxDepth <= StackSize) {
+        double stk[StackSize];
+        return internal::Interpret(code.data(), code.data() + code.size(), x, stk, static_cast<double *>(nullptr));
+    }
+    std::vector<double> stk(maxDepth);
+    return internal::Interpret(code.data(), code.data() + code.size(), x, stk.data(), static_cast<double *>(nullptr));
+}
+
+double CompiledExpression::Eval(const Vec &x) const {
+    assert(static_cast<std::size_t>(x.Rows()) == vars.size());
+    return Eval(vars.empty() ? nullptr : &x.Value(0, 0));
+}
+
+namespace internal {
+
+bool CompiledExpressionBuilder::IsNumber(Handle h) const noexcept {
+    return h + 1 == expr.code.size() && expr.code.back().code == CompiledSymMat::OpCode::NUMBER;
+}
+
+CompiledExpressionBuilder::Handle CompiledExpressionBuilder::Number(double value) noexcept {
+    expr.code.push_back({CompiledSymMat::OpCode::NUMBER, MathOperator::MATH_NULL, 0, value});
+    return static_cast<Handle>(expr.code.size() - 1);
+}
+
+CompiledExpressionBuilder::Handle CompiledExpressionBuilder::Variable(const char *name, std::size_t len) noexcept {
+    auto ret = varIds.emplace(std::string(name, len), static_cast<std::uint32_t>(expr.vars.size()));
+    if (ret.second) {
+        expr.vars.emplace_back(ret.first->first);
+    }
+    expr.code.push_back({CompiledSymMat::OpCode::VARIABLE, MathOperator::MATH_NULL, ret.first->second, 0});
+    return static_cast<Handle>(expr.code.size() - 1);
+}
+
+CompiledExpressionBuilder::Handle CompiledExpressionBuilder::Unary(MathOperator op, Handle operand) noexcept {
+    double result;
+    if (IsNumber(operand) && FoldConstant(op, expr.code.back().value, 0, result)) {
+        expr.code.back().value = result;
+        return operand;
+    }
+
+    // 正号不产生任何指令
+    if (op != MathOperator::MATH_POSITIVE) {
+        expr.code.push_back({CompiledSymMat::OpCode::UNARY, op, 0, 0});
+    }
+    return operand;
+}
+
+CompiledExpressionBuilder::Handle CompiledExpressionBuilder::Binary(MathOperator op, Handle left,
+                                                                    Handle right) noexcept {
+    auto &code = expr.code;
+    if (IsNumber(right)) {
+        auto exponent = code.back().value;
+
+        double result;
+        if (right == left + 1 && code[left].code == CompiledSymMat::OpCode::NUMBER &&
+            FoldConstant(op, code[left].value, exponent, result)) {
+            code.pop_back();
+            code.back().value = result;
+            return left;
+        }
+
+        // 与CompiledSymMat相同的乘方强度削减，指数本身不再压栈
+        if (op == MathOperator::MATH_POWER && CanReducePower(exponent)) {
+            code.pop_back();
+            if (exponent == 2) {
+                code.push_back({CompiledSymMat::OpCode::SQUARE, op, 0, 0});
+            } else if (exponent == -1) {
+                code.push_back({CompiledSymMat::OpCode::RECIPROCAL, op, 0, 0});
+            } else if (exponent == 0.5) {
+                code.push_back({CompiledSymMat::OpCode::UNARY, MathOperator::MATH_SQRT, 0, 0});
+            } else {
+                code.push_back({CompiledSymMat::OpCode::POWI, op, 0, exponent});
+            }
+            return left;
+        }
+    }
+
+    code.push_back({CompiledSymMat::OpCode::BINARY, op, 0, 0});
+    return left;
+}
+
+CompiledExpression CompiledExpressionBuilder::Finish(Handle root) noexcept {
+    assert(root == 0);
+    (void)root;
+
+    // 统计求值栈的最大深度
+    std::size_t depth = 0;
+    for (auto &inst : expr.code) {
+        switch (inst.code) {
+        case CompiledSymMat::OpCode::NUMBER:
+        case CompiledSymMat::OpCode::VARIABLE:
+        case CompiledSymMat::OpCode::LOAD:
+            ++depth;
+            break;
+        case CompiledSymMat::OpCode::BINARY:
+            --depth;
+            break;
+        default:
+            break;
+        }
+        expr.maxDepth = std::max(expr.maxDepth, depth);
+    }
+    assert(depth == 1);
+
+    varIds.clear();
+    return std::move(expr);
+}
+
+} // namespace internal
+
+} // namespace tomsolver
@@ -0,0 +1,343 @@
+#pragma once
+
+#include "mat.h"
+#include "node.h"
+#include "symmat.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tomsolver {
+
+/**
+ * 编译后的符号矩阵。
+ * 所有元素按后序遍历的顺序编译为一段连续的逆波兰指令流，变量在编译时绑定为vars中的下标。
+ * 构造完成后不可修改，所有求值函数都是const的，不修改任何共享状态。
+ * 因此多个线程可以同时对同一个CompiledSymMat求值，只需要各自持有一个Workspace，不必再为每个线程Clone一份SymMat。
+ */
+class CompiledSymMat {
+public:
+    /**
+     * 指令的类型。除了与Node一一对应的指令外，编译时还会做以下强度削减：
+     *   x^2 -> SQUARE，x^n（n为绝对值不超过64的整数）-> POWI，以连乘代替std::pow；
+     *   x^-1 -> RECIPROCAL，x^0.5 -> sqrt(x)；
+     *   同一个元素内参数相同的sin(u)与cos(u) -> SINCOS + LOAD，只计算一次u，并同时得到两个结果。
+     */
+    enum class OpCode : std::uint8_t {
+        NUMBER,     // 压入value
+        VARIABLE,   // 压入x[index]
+        UNARY,      // 栈顶 = op(栈顶)
+        BINARY,     // 弹出右操作数，栈顶 = op(栈顶, 右操作数)
+        SQUARE,     // 栈顶 = 栈顶*栈顶
+        POWI,       // 栈顶 = 栈顶^value，value为整数
+        RECIPROCAL, // 栈顶 = 1/栈顶
+        SINCOS,     // 同时计算栈顶的sin与cos，op指定的结果留在栈顶，另一个存入slots[index]
+        LOAD,       // 压入slots[index]
+    };
+
+    /**
+     * 单条指令。
+     */
+    struct Instruction {
+        OpCode code;
+        MathOperator op;
+        std::uint32_t index; // 变量在vars中的下标，或者slots的下标
+        double value;        // 数值，或者POWI的指数
+    };
+
+    /**
+     * 求值时使用的临时空间。每个线程各自持有一个，可以在多次求值之间复用，避免重复分配内存。
+     * T为求值使用的标量类型。
+     */
+    template <typename T>
+    class BasicWorkspace {
+    private:
+        std::vector<T> stk;
+        std::vector<T> slots;
+        std::vector<T> batch; // EvalBatch的求值栈与slots，每一项是一组点的值
+
+        friend class CompiledSymMat;
+    };
+
+    using Workspace = BasicWorkspace<double>;
+
+    /**
+     * 编译符号矩阵mat，并把变量绑定为vars中的下标。非递归实现。
+     * Config::Get().optimizeBeforeCompile为true时，先对每个元素调用Optimize()。
+     * @exception runtime_error mat中出现了vars以外的变量
+     */
+    CompiledSymMat(const SymMat &mat, const std::vector<std::string> &vars);
+
+    int Rows() const noexcept;
+
+    int Cols() const noexcept;
+
+    /**
+     * 编译时绑定的变量名。求值时传入的数值按此顺序排列。
+     */
+    const std::vector<std::string> &Vars() const noexcept;
+
+    /**
+     * 指令总数。
+     */
+    std::size_t Size() const noexcept;
+
+    /**
+     * 所有元素的指令流。
+     */
+    const std::vector<Instruction> &Code() const noexcept;
+
+    /**
+     * 第i个元素（行优先）的指令为Code()中的[Offsets()[i], Offsets()[i+1])。
+     */
+    const std::vector<std::uint32_t> &Offsets() const noexcept;
+
+    /**
+     * 求值。x按Vars()的顺序存放变量的值，结果按行优先的顺序写入out，out的长度至少为Rows()*Cols()。
+     * 不修改自身，可以在多个线程中以各自的ws同时调用。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    void Eval(const double *x, double *out, Workspace &ws) const;
+
+    /**
+     * 以标量类型T（float、double、long double）求值，中间结果全程保持T的精度。表达式中的数值保存为double，求值时转换为T。
+     * 其余同Eval()。Eval(x, out, ws)即EvalAs<double>(x, out, ws)。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    template <typename T>
+    void EvalAs(const T *x, T *out, BasicWorkspace<T> &ws) const;
+
+    /**
+     * 求值。x的长度必须等于Vars().size()。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    Mat Eval(const Vec &x, Workspace &ws) const;
+
+    /**
+     * 求值。每次调用都会新建一个Workspace。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    Mat Eval(const Vec &x) const;
+
+    /**
+     * 对n个点批量求值。x按变量存放，第j个变量在第p个点的值为x[j*n+p]；结果按元素存放，第i个元素（行优先）在第p个点的值写入out[i*n+p]。
+     * 每条指令一次处理一组点，超越函数使用BatchCalc()的向量化实现，因此结果与Eval()可能有若干ULP的差别。
+     * 只检查每个元素的最终结果：出现浮点数无效值时，对该点重新调用Eval()，由Eval()决定是否抛出异常。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    void EvalBatch(const double *x, std::size_t n, double *out, Workspace &ws) const;
+
+    /**
+     * 批量求值。points为Vars().size()行n列的矩阵，每一列是一个点。
+     * 返回Rows()*Cols()行n列的矩阵，第i行是第i个元素（行优先）在每个点的值。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    Mat EvalBatch(const Mat &points, Workspace &ws) const;
+
+    /**
+     * 批量求值。每次调用都会新建一个Workspace。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    Mat EvalBatch(const Mat &points) const;
+
+private:
+    int rows, cols;
+    std::vector<std::string> vars;
+    std::vector<Instruction> code;
+    std::vector<std::uint32_t> offsets; // 第i个元素的指令为code[offsets[i], offsets[i+1])
+    std::size_t maxDepth = 0;           // 求值栈的最大深度
+    std::size_t slotNum = 0;            // SINCOS暂存结果所需的空间
+
+    /**
+     * 编译单个元素，指令追加到code末尾。
+     */
+    void CompileElement(const internal::NodeImpl &root, const std::map<std::string, std::uint32_t> &varIds);
+};
+
+namespace internal {
+class CompiledExpressionBuilder;
+} // namespace internal
+
+/**
+ * 编译后的单个表达式，由ParseCompiled()直接从字符串生成，不经过Node。适合只需要求值的场合。
+ * 生成指令时做常量折叠（只由数值组成的子表达式直接算出结果）以及与CompiledSymMat相同的乘方强度削减。
+ * 变量按在表达式中首次出现的顺序编号。
+ * 求值栈的大小固定：最大深度不超过StackSize时，栈直接开在调用者的栈帧上，求值过程不分配内存。
+ * 构造完成后不可修改，多个线程可以同时求值。
+ */
+class CompiledExpression {
+public:
+    static constexpr std::size_t StackSize = 32;
+
+    /**
+     * 变量名。求值时传入的数值按此顺序排列。
+     */
+    const std::vector<std::string> &Vars() const noexcept;
+
+    /**
+     * 指令总数。
+     */
+    std::size_t Size() const noexcept;
+
+    const std::vector<CompiledSymMat::Instruction> &Code() const noexcept;
+
+    /**
+     * 求值。x按Vars()的顺序存放变量的值。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    double Eval(const double *x) const;
+
+    /**
+     * 求值。x的长度必须等于Vars().size()。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    double Eval(const Vec &x) const;
+
+private:
+    std::vector<std::string> vars;
+    std::vector<CompiledSymMat::Instruction> code;
+    std::size_t maxDepth = 0;
+
+    friend class internal::CompiledExpressionBuilder;
+};
+
+namespace internal {
+
+/**
+ * 按后序逐个追加节点，生成CompiledExpression的指令。供解析器使用，接口与FlatNodeBuilder相同。
+ * 每个Handle是子表达式第一条指令的下标。
+ */
+class CompiledExpressionBuilder {
+public:
+    using Handle = std::uint32_t;
+
+    Handle Number(double value) noexcept;
+
+    Handle Variable(const char *name, std::size_t len) noexcept;
+
+    Handle Unary(MathOperator op, Handle operand) noexcept;
+
+    Handle Binary(MathOperator op, Handle left, Handle right) noexcept;
+
+    CompiledExpression Finish(Handle root) noexcept;
+
+private:
+    CompiledExpression expr;
+    std::unordered_map<std::string, std::uint32_t> varIds;
+
+    /**
+     * 子表达式是否只有一条NUMBER指令。h必须是最后一个子表达式。
+     */
+    bool IsNumber(Handle h) const noexcept;
+};
+
+/**
+ * 以平方求幂的方式计算base^exponent，只用到乘法（负指数时多一次除法）。
+ */
+template <typename T>
+T IntegerPower(T base, int exponent) noexcept {
+    T ret = 1;
+    for (auto n = std::abs(exponent); n; n >>= 1) {
+        if (n & 1) {
+            ret *= base;
+        }
+        base *= base;
+    }
+    return exponent < 0 ? 1 / ret : ret;
+}
+
+/**
+ * 逆波兰指令流[inst, end)的解释器，返回指令流的结果。CompiledSymMat与CompiledExpression共用。
+ * stk至少要容纳指令流的最大栈深度，slots至少要容纳SINCOS用到的下标。
+ * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+ */
+template <typename T>
+T Interpret(const CompiledSymMat::Instruction *inst, const CompiledSymMat::Instruction *end, const T *x, T *stk,
+            T *slots) {
+    using OpCode = CompiledSymMat::OpCode;
+    constexpr auto nan = std::numeric_limits<T>::quiet_NaN();
+
+    // 削减后的指令不经过CalcAs。结果不是有限值时，再交给CalcAs按原运算计算一次，
+    // 以保持与Node::Vpa()相同的无效值处理（抛出MathError或者原样返回）
+    // top指向栈顶的下一个位置
+    auto top = stk;
+    for (; inst != end; ++inst) {
+        switch (inst->code) {
+        case OpCode::NUMBER:
+            *top++ = static_cast<T>(inst->value);
+            break;
+        case OpCode::VARIABLE:
+            *top++ = x[inst->index];
+            break;
+        case OpCode::UNARY:
+            top[-1] = CalcAs<T>(inst->op, top[-1], nan);
+            break;
+        case OpCode::BINARY:
+            --top;
+            top[-1] = CalcAs<T>(inst->op, top[-1], top[0]);
+            break;
+        case OpCode::SQUARE: {
+            auto v = top[-1];
+            auto r = v * v;
+            top[-1] = std::isfinite(r) ? r : CalcAs<T>(MathOperator::MATH_POWER, v, 2);
+            break;
+        }
+        case OpCode::POWI: {
+            auto v = top[-1];
+            auto r = IntegerPower(v, static_cast<int>(inst->value));
+            top[-1] = std::isfinite(r) ? r : CalcAs<T>(MathOperator::MATH_POWER, v, static_cast<T>(inst->value));
+            break;
+        }
+        case OpCode::RECIPROCAL: {
+            auto v = top[-1];
+            auto r = 1 / v;
+            top[-1] = std::isfinite(r) ? r : CalcAs<T>(MathOperator::MATH_DIVIDE, 1, v);
+            break;
+        }
+        case OpCode::SINCOS: {
+            auto v = top[-1];
+            if (!std::isfinite(v)) {
+                v = CalcAs<T>(inst->op, v, nan);
+            }
+            // 参数相同的sin与cos相邻计算，编译器可以合并为一次sincos调用
+            auto s = std::sin(v);
+            auto c = std::cos(v);
+            top[-1] = inst->op == MathOperator::MATH_SIN ? s : c;
+            slots[inst->index] = inst->op == MathOperator::MATH_SIN ? c : s;
+            break;
+        }
+        case OpCode::LOAD:
+            *top++ = slots[inst->index];
+            break;
+        }
+    }
+    assert(top == stk + 1);
+    return stk[0];
+}
+
+} // namespace internal
+
+template <typename T>
+void CompiledSymMat::EvalAs(const T *x, T *out, BasicWorkspace<T> &ws) const {
+    if (ws.stk.size() < maxDepth) {
+        ws.stk.resize(maxDepth);
+    }
+    if (ws.slots.size() < slotNum) {
+        ws.slots.resize(slotNum);
+    }
+
+    auto begin = code.data();
+    for (std::size_t i = 0; i + 1 < offsets.size(); ++i) {
+        out[i] = internal::Interpret(begin + offsets[i], begin + offsets[i + 1], x, ws.stk.data(), ws.slots.data());
+    }
+}
+
+} // namespace tomsolver
@@ -1,11 +1,18 @@
 #pragma once
+#include <cstddef>
 #include <string>
 
 namespace tomsolver {
 
 enum class LogLevel { OFF, FATAL, ERROR, WARN, INFO, DEBUG, TRACE, ALL };
 
-enum class NonlinearMethod { NEWTON_RAPHSON, LM };
+enum class NonlinearMethod { NEWTON_RAPHSON, LM, HOMOTOPY };
+
+enum class LineSearchMethod { ARMIJO, STRONG_WOLFE, NON_MONOTONE };
+
+enum class SamplingMethod { LATIN_HYPERCUBE, SOBOL };
+
+enum class ScalarType { FLOAT, DOUBLE, LONG_DOUBLE };
 
 struct Config {
     /**
@@ -27,11 +34,84 @@ struct Config {
      */
     NonlinearMethod nonlinearMethod = NonlinearMethod::NEWTON_RAPHSON;
 
+    /**
+     * 同伦延拓法（HOMOTOPY）的初始步长、最小步长与最大步长，以参数t∈[0, 1]计。默认为0.1、1e-6、0.25。
+     */
+    double homotopyInitialStep = 0.1;
+    double homotopyMinStep = 1.0e-6;
+    double homotopyMaxStep = 0.25;
+
+    /**
+     * LM方法使用的一维搜索策略，见line_search.h。默认为ARMIJO。
+     * ARMIJO：回溯搜索，每个试探点只计算方程组；
+     * STRONG_WOLFE：满足强Wolfe条件，每个试探点还要计算雅可比矩阵，步长更好，适合病态的方程组；
+     * NON_MONOTONE：Grippo-Lampariello-Lucidi非单调回溯搜索，允许残差暂时上升。
+     */
+    LineSearchMethod lineSearchMethod = LineSearchMethod::ARMIJO;
+
+    /**
+     * NON_MONOTONE一维搜索参与比较的历史记录数量。默认为10。
+     */
+    int nonMonotoneMemory = 10;
+
+    /**
+     * 一维搜索每次最多尝试的步长数量。默认为50。
+     */
+    int maxLineSearchSteps = 50;
+
+    /**
+     * Newton-Raphson方法迭代时使用的标量类型。默认为DOUBLE。
+     * FLOAT：先以float迭代，直到残差不再下降，再以double迭代至收敛。float的求值与线性求解更快，适合做粗略的预求解；
+     * LONG_DOUBLE：先以long double迭代，直到残差不再下降，再以double迭代至收敛。适合病态的方程组。
+     */
+    ScalarType nonlinearScalarType = ScalarType::DOUBLE;
+
+    /**
+     * Newton-Raphson方法求解每一步的线性方程组时，是否使用SolveLinearMixedPrecision()：
+     * 以float分解雅可比矩阵，再以double迭代改进，改进停滞时自动退回SolveLinear()。适合规模较大的稠密方程组。默认为false。
+     */
+    bool mixedPrecisionLinearSolve = false;
+
+    /**
+     * 非线性方程求解时，缓存最近求值过的点的个数。线搜索在同一个点上重复计算F(x)、J(x)时直接使用缓存的结果。
+     * 为0时不使用缓存。默认为4。
+     */
+    std::size_t evaluationCacheSize = 4;
+
     /**
      * 非线性方程求解时，当没有为VarsTable传初值时，设定的初值
      */
     double initialValue = 1.0;
 
+    /**
+     * SolveMultiStart()生成初值的方法。默认为LATIN_HYPERCUBE。
+     * LATIN_HYPERCUBE：拉丁超立方采样，随机数种子为multiStartSeed；
+     * SOBOL：Sobol低差异序列，结果确定，最多支持21个变量。
+     */
+    SamplingMethod multiStartSampling = SamplingMethod::LATIN_HYPERCUBE;
+
+    /**
+     * SolveMultiStart()的起点数量。默认为64。
+     */
+    int multiStartCount = 64;
+
+    /**
+     * SolveMultiStart()使用LATIN_HYPERCUBE时的随机数种子。默认为0。
+     */
+    unsigned multiStartSeed = 0;
+
+    /**
+     * SolveMultiStart()判断两个根相同的相对容差：各分量之差都不超过rootTolerance * max(1, |x|)。默认为1e-6。
+     */
+    double rootTolerance = 1.0e-6;
+
+    /**
+     * SolveSweep()的初始步长、最小步长与最大步长，以参数区间的长度|end - begin|为单位。默认为0.05、1e-6、0.1。
+     */
+    double sweepInitialStep = 0.05;
+    double sweepMinStep = 1.0e-6;
+    double sweepMaxStep = 0.1;
+
     /**
      * 是否允许不定方程存在。
      * 例如，当等式数量大于未知数数量时，方程组成为不定方程；
@@ -39,6 +119,49 @@ struct Config {
      */
     bool allowIndeterminateEquation = false;
 
+    /**
+     * 求导结果缓存（DiffCache）最多保存的节点总数。为0时不使用缓存。默认为0。
+     */
+    std::size_t diffCacheCapacity = 0;
+
+    /**
+     * 可并行的计算（例如Jacobian）使用的线程数。为0时使用std::thread::hardware_concurrency()。默认为1，即不开启并行。
+     */
+    int threadNum = 1;
+
+    /**
+     * CompiledSymMat编译前，是否先用Optimize()对每个元素做等式饱和优化。
+     * 优化本身开销较大，适合编译一次、求值很多次的场合。默认为false。
+     */
+    bool optimizeBeforeCompile = false;
+
+    /**
+     * 非线性方程求解时，是否把方程组与雅可比矩阵编译为本地代码（NativeModel）再求值。
+     * 首次编译需要调用系统编译器，耗时较长，结果按模型缓存在磁盘上；仅支持POSIX平台。
+     * 编译失败时退回CompiledSymMat。默认为false。
+     */
+    bool nativeCompile = false;
+
+    /**
+     * NativeModel使用的编译器命令。默认为"c++"。
+     */
+    std::string nativeCompiler = "c++";
+
+    /**
+     * NativeModel存放共享库的目录。为空时使用环境变量TMPDIR，TMPDIR也为空时使用/tmp。
+     */
+    std::string nativeCacheDir;
+
+    /**
+     * Prepare()的磁盘缓存（PreparedCache）所在的目录，不存在时自动创建。为空时不使用缓存。默认为空。
+     */
+    std::string preparedCacheDir;
+
+    /**
+     * PreparedCache目录内缓存文件的总字节数上限，超过时按LRU策略删除最久未使用的文件。为0时不限制。默认为256MB。
+     */
+    std::size_t preparedCacheMaxBytes = 256 * 1024 * 1024;
+
     void Reset() noexcept;
 
     static Config &Get();
@@ -0,0 +1,175 @@
+#include "continuation.h"
+
+#include "compiled.h"
+#include "config.h"
+#include "error_type.h"
+#include "linear.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <valarray>
+
+namespace tomsolver {
+
+SweepResult SolveSweep(const PreparedSystem &system, const std::string &parameter, double begin, double end,
+                       const VarsTable &varsTable) {
+    auto vars = varsTable.Vars();
+    vars.push_back(parameter);
+    if (varsTable.Has(parameter) || system.vars != vars) {
+        throw std::runtime_error("SolveSweep: the variables of the prepared system must be those of varsTable "
+                                 "followed by the parameter " +
+                                 parameter);
+    }
+    int n = varsTable.VarNums();
+    if (system.equations.Rows() != n) {
+        throw std::runtime_error("SolveSweep: requires as many equations as variables");
+    }
+
+    auto &config = Config::Get();
+    CompiledSymMat equations(system.equations, vars);
+    CompiledSymMat jacobian(system.jacobian, vars);
+    CompiledSymMat::Workspace ws;
+
+    // z = [x, p]。J为n行n+1列，前n列是Jx，最后一列是Jp
+    std::vector<double> z(n + 1), f(n), J(n * (n + 1)), Jx(n * n);
+    std::vector<int> perm(n);
+
+    // 在z处分解Jx，返回行列式的符号；Jx奇异时返回0
+    auto factor = [&](const std::vector<double> &point) {
+        jacobian.Eval(point.data(), J.data(), ws);
+        for (int i = 0; i < n; ++i) {
+            std::copy_n(J.begin() + i * (n + 1), n, Jx.begin() + i * n);
+        }
+        if (!internal::LuDecompose(n, Jx.data(), perm.data(), std::numeric_limits<double>::min())) {
+            return 0;
+        }
+        int sign = 1;
+        for (int i = 0; i < n; ++i) {
+            if (Jx[i * n + i] < 0) {
+                sign = -sign;
+            }
+        }
+        // 置换的奇偶性：每个长度为L的轮换贡献L - 1次对换
+        std::vector<bool> visited(n, false);
+        for (int i = 0; i < n; ++i) {
+            if (visited[i]) {
+                continue;
+            }
+            for (int j = i; !visited[j]; j = perm[j]) {
+                visited[j] = true;
+                if (j != i) {
+                    sign = -sign;
+                }
+            }
+        }
+        return sign;
+    };
+
+    // 固定参数，从z出发做Newton校正。收敛时返回校正的次数，不收敛返回-1
+    auto correct = [&](std::vector<double> &point, int maxCorrections) {
+        try {
+            for (int k = 0;; ++k) {
+                equations.Eval(point.data(), f.data(), ws);
+                if (std::all_of(f.begin(), f.end(), [&](double v) {
+                        return std::abs(v) < config.epsilon;
+                    })) {
+                    return k;
+                }
+                if (k == maxCorrections || factor(point) == 0) {
+                    return -1;
+                }
+                internal::LuSolve(n, Jx.data(), perm.data(), f.data());
+                for (int i = 0; i < n; ++i) {
+                    point[i] -= f[i];
+                }
+            }
+        } catch (const MathError &) {
+            // 出现无效值，按不收敛处理
+            return -1;
+        }
+    };
+
+    auto makePoint = [&](int iterations, bool turningPoint) {
+        VarsTable table = varsTable;
+        table.SetValues(Vec(std::valarray<double>(z.data(), n)));
+        return SweepPoint{z[n], std::move(table), iterations, turningPoint};
+    };
+
+    SweepResult result;
+    std::copy_n(&varsTable.Values().Value(0, 0), n, z.begin());
+    z[n] = begin;
+    int iterations = correct(z, config.maxIterations);
+    if (iterations < 0) {
+        throw std::runtime_error("SolveSweep: failed to solve at " + parameter + " = " + ToString(begin));
+    }
+    result.points.push_back(makePoint(iterations, false));
+
+    double span = std::abs(end - begin);
+    double direction = end > begin ? 1 : -1;
+    double h = config.sweepInitialStep * span;
+    double minStep = config.sweepMinStep * span;
+    double maxStep = config.sweepMaxStep * span;
+    int sign = factor(z);
+    std::vector<double> tangent(n), zNew(n + 1);
+    while (z[n] != end) {
+        // 切线dx/dp = -Jx^(-1) * Jp。Jx奇异说明到达了折点
+        if (sign == 0) {
+            result.points.back().turningPoint = true;
+            return result;
+        }
+        for (int i = 0; i < n; ++i) {
+            tangent[i] = -J[i * (n + 1) + n];
+        }
+        internal::LuSolve(n, Jx.data(), perm.data(), tangent.data());
+
+        int corrections;
+        for (;;) {
+            // 最后一步恰好落在end上
+            bool last = h >= std::abs(end - z[n]);
+            double dp = last ? end - z[n] : direction * h;
+            for (int i = 0; i < n; ++i) {
+                zNew[i] = z[i] + dp * tangent[i];
+            }
+            zNew[n] = last ? end : z[n] + dp;
+            corrections = correct(zNew, 5);
+
+            if (config.logLevel >= LogLevel::TRACE) {
+                std::cout << parameter << " = " << zNew[n] << ", h = " << h << ", corrections = " << corrections
+                          << std::endl;
+            }
+
+            if (corrections >= 0) {
+                break;
+            }
+            h /= 2;
+            if (h < minStep) {
+                // 自然参数延拓无法越过折点，曲线在此折回
+                result.points.back().turningPoint = true;
+                return result;
+            }
+        }
+
+        z.swap(zNew);
+        int newSign = factor(z);
+        result.points.push_back(makePoint(corrections, newSign != 0 && newSign != sign));
+        sign = newSign;
+        // 校正很快收敛说明曲线平缓，可以加大步长
+        if (corrections <= 2) {
+            h = std::min(2 * h, maxStep);
+        }
+    }
+    result.completed = true;
+    return result;
+}
+
+SweepResult SolveSweep(const SymVec &equations, const std::string &parameter, double begin, double end,
+                       const VarsTable &varsTable) {
+    auto vars = varsTable.Vars();
+    vars.push_back(parameter);
+    return SolveSweep(Prepare(equations, vars), parameter, begin, end, varsTable);
+}
+
+} // namespace tomsolver
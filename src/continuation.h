@@ -0,0 +1,47 @@
+#pragma once
+
+#include "nonlinear.h"
+#include "symmat.h"
+#include "vars_table.h"
+
+#include <string>
+#include <vector>
+
+namespace tomsolver {
+
+/**
+ * 参数扫描得到的解曲线上的一个点。
+ */
+struct SweepPoint {
+    double parameter;   // 参数的值
+    VarsTable solution; // 该参数下的解
+    int iterations;     // 从预测值出发的Newton校正次数，起点为冷启动的迭代次数
+    bool turningPoint;  // 在上一个点与此点之间雅可比矩阵的行列式变号，或者曲线在此点之后折回
+};
+
+/**
+ * 参数扫描的结果。
+ */
+struct SweepResult {
+    std::vector<SweepPoint> points; // 解曲线，按参数从begin到end的顺序排列，第一个点的参数为begin
+    bool completed = false;         // 是否到达了end。遇到转向点（折点）时停在折点附近
+};
+
+/**
+ * 以自然参数延拓法沿参数parameter从begin扫描到end，依次求解方程组system。
+ * system.vars必须是varsTable的变量再加上parameter（放在最后），即system.jacobian的最后一列为对参数的偏导数。
+ * 先以varsTable为初值在begin处求解，之后每一步以上一个解沿切线dx/dp = -Jx^(-1) * Jp外推的值为初值做Newton校正，
+ * 校正很快收敛时加大步长，不收敛时减半步长。步长见Config::Get().sweepInitialStep等，以|end - begin|为单位。
+ * 步长小于Config::Get().sweepMinStep仍不收敛，或者雅可比矩阵奇异时，认为到达了转向点，在此结束扫描。
+ * @exception runtime_error 变量不一致，方程数量与未知量数量不同，或者在begin处求解失败
+ */
+SweepResult SolveSweep(const PreparedSystem &system, const std::string &parameter, double begin, double end,
+                       const VarsTable &varsTable);
+
+/**
+ * 扫描方程组equations。先以Prepare()预处理（变量为varsTable的变量再加上parameter），其余同上。
+ */
+SweepResult SolveSweep(const SymVec &equations, const std::string &parameter, double begin, double end,
+                       const VarsTable &varsTable);
+
+} // namespace tomsolver
@@ -1,9 +1,12 @@
 #include "diff.h"
 
+#include "config.h"
 #include "functions.h"
 #include "simplify.h"
 
+#include <iterator>
 #include <queue>
+#include <utility>
 
 namespace tomsolver {
 
@@ -387,12 +390,9 @@ public:
 
 } // namespace internal
 
-Node Diff(const Node &node, const std::string &varname, int i) {
-    auto node2 = Clone(node);
-    return Diff(std::move(node2), varname, i);
-}
+namespace {
 
-Node Diff(Node &&node, const std::string &varname, int i) {
+Node DiffWithoutCache(Node &&node, const std::string &varname, int i) {
     assert(i > 0);
     auto n = std::move(node);
     while (i--) {
@@ -409,4 +409,130 @@ Node Diff(Node &&node, const std::string &varname, int i) {
     return n;
 }
 
+template <typename F>
+Node DiffWithCache(const Node &node, const std::string &varname, int i, F &&getNode) {
+    FlatNode flat(node);
+    Node ret;
+    if (DiffCache::Get().Find(flat, varname, i, ret)) {
+        return ret;
+    }
+
+    ret = DiffWithoutCache(getNode(), varname, i);
+    DiffCache::Get().Insert(std::move(flat), varname, i, ret);
+    return ret;
+}
+
+} // namespace
+
+Node Diff(const Node &node, const std::string &varname, int i) {
+    if (Config::Get().diffCacheCapacity > 0) {
+        return DiffWithCache(node, varname, i, [&node] {
+            return Clone(node);
+        });
+    }
+    return DiffWithoutCache(Clone(node), varname, i);
+}
+
+Node Diff(Node &&node, const std::string &varname, int i) {
+    if (Config::Get().diffCacheCapacity > 0) {
+        return DiffWithCache(node, varname, i, [&node] {
+            return Move(node);
+        });
+    }
+    return DiffWithoutCache(std::move(node), varname, i);
+}
+
+DiffCache &DiffCache::Get() {
+    static DiffCache cache;
+    return cache;
+}
+
+bool DiffCache::Find(const FlatNode &node, const std::string &varname, int i, Node &result) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto range = index.equal_range(MakeKey(node, varname, i));
+    for (auto it = range.first; it != range.second; ++it) {
+        auto &entry = *it->second;
+        if (entry.i == i && entry.varname == varname && entry.node == node) {
+            // 移到最前面
+            entries.splice(entries.begin(), entries, it->second);
+            result = entry.result.ToNode();
+            ++hits;
+            return true;
+        }
+    }
+    ++misses;
+    return false;
+}
+
+void DiffCache::Insert(FlatNode node, const std::string &varname, int i, const Node &result) {
+    auto capacity = Config::Get().diffCacheCapacity;
+    FlatNode flatResult(result);
+    auto count = node.Size() + flatResult.Size();
+    if (count > capacity) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto key = MakeKey(node, varname, i);
+    auto range = index.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        auto &entry = *it->second;
+        if (entry.i == i && entry.varname == varname && entry.node == node) {
+            // 其他线程已经插入过了
+            return;
+        }
+    }
+
+    while (!entries.empty() && nodeCount + count > capacity) {
+        Erase(std::prev(entries.end()));
+    }
+
+    entries.push_front({std::move(node), varname, i, std::move(flatResult)});
+    index.emplace(key, entries.begin());
+    nodeCount += count;
+}
+
+void DiffCache::Clear() noexcept {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    index.clear();
+    nodeCount = 0;
+    hits = 0;
+    misses = 0;
+}
+
+std::size_t DiffCache::Size() const noexcept {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+std::size_t DiffCache::Hits() const noexcept {
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
+}
+
+std::size_t DiffCache::Misses() const noexcept {
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
+}
+
+std::uint64_t DiffCache::MakeKey(const FlatNode &node, const std::string &varname, int i) noexcept {
+    auto seed = internal::HashCombine(node.Hash(), static_cast<std::uint64_t>(i));
+    auto varnameHash = internal::HashSingleNode(NodeType::VARIABLE, MathOperator::MATH_NULL, 0, varname);
+    return internal::HashCombine(seed, varnameHash);
+}
+
+void DiffCache::Erase(std::list<Entry>::iterator it) noexcept {
+    auto range = index.equal_range(MakeKey(it->node, it->varname, it->i));
+    for (auto indexIt = range.first; indexIt != range.second; ++indexIt) {
+        if (indexIt->second == it) {
+            index.erase(indexIt);
+            break;
+        }
+    }
+    nodeCount -= it->node.Size() + it->result.Size();
+    entries.erase(it);
+}
+
 } // namespace tomsolver
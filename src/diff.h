@@ -1,19 +1,85 @@
 #pragma once
 
+#include "flat_node.h"
 #include "node.h"
 
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
 namespace tomsolver {
 
 /**
  * node对varname求导。在node包含多个变量时，是对varname求偏导。
+ * 如果Config::Get().diffCacheCapacity大于0，会先从DiffCache中查找结果。
  * @exception runtime_error 如果表达式内包含AND(&) OR(|) MOD(%)这类不能求导的运算符，则抛出异常
  */
 Node Diff(const Node &node, const std::string &varname, int i = 1);
 
 /**
  * node对varname求导。在node包含多个变量时，是对varname求偏导。
+ * 如果Config::Get().diffCacheCapacity大于0，会先从DiffCache中查找结果。
  * @exception runtime_error 如果表达式内包含AND(&) OR(|) MOD(%)这类不能求导的运算符，则抛出异常
  */
 Node Diff(Node &&node, const std::string &varname, int i = 1);
 
+/**
+ * 求导结果的缓存。以(表达式结构, 变量名, 求导阶数)为键，保存化简后的求导结果。
+ * 保存的节点总数超过Config::Get().diffCacheCapacity时，按LRU策略淘汰最久未使用的条目。
+ * 线程安全。
+ */
+class DiffCache {
+public:
+    static DiffCache &Get();
+
+    /**
+     * 查找node对varname求i阶导数的结果。找到时返回true，并把结果保存到result。
+     */
+    bool Find(const FlatNode &node, const std::string &varname, int i, Node &result);
+
+    /**
+     * 保存node对varname求i阶导数的结果。
+     */
+    void Insert(FlatNode node, const std::string &varname, int i, const Node &result);
+
+    void Clear() noexcept;
+
+    /**
+     * 条目数量。
+     */
+    std::size_t Size() const noexcept;
+
+    /**
+     * 命中次数。
+     */
+    std::size_t Hits() const noexcept;
+
+    /**
+     * 未命中次数。
+     */
+    std::size_t Misses() const noexcept;
+
+private:
+    struct Entry {
+        FlatNode node;
+        std::string varname;
+        int i;
+        FlatNode result;
+    };
+
+    std::list<Entry> entries; // 越靠前越新
+    std::unordered_multimap<std::uint64_t, std::list<Entry>::iterator> index;
+    std::size_t nodeCount = 0;
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    mutable std::mutex mutex;
+
+    DiffCache() = default;
+
+    static std::uint64_t MakeKey(const FlatNode &node, const std::string &varname, int i) noexcept;
+
+    void Erase(std::list<Entry>::iterator it) noexcept;
+};
+
 } // namespace tomsolver
@@ -0,0 +1,582 @@
+#include "egraph.h"
+
+#include "error_type.h"
+#include "math_operator.h"
+#include "simplify.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <map>
+#include <stack>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace tomsolver {
+
+namespace internal {
+
+class EGraph {
+public:
+    using Id = std::uint32_t;
+
+    /**
+     * e-graph中的节点。运算符节点的子节点是e-class的编号，而不是具体的节点。
+     */
+    struct ENode {
+        NodeType type;
+        MathOperator op;
+        double value;
+        std::uint32_t varId;
+        Id children[2];
+    };
+
+    struct ENodeHash {
+        std::size_t operator()(const ENode &n) const noexcept {
+            auto value = n.value == 0.0 ? 0.0 : n.value;
+            std::uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            auto seed = HashCombine(static_cast<std::uint64_t>(n.type), static_cast<std::uint64_t>(n.op));
+            seed = HashCombine(seed, bits);
+            seed = HashCombine(seed, n.varId);
+            seed = HashCombine(seed, n.children[0]);
+            return static_cast<std::size_t>(HashCombine(seed, n.children[1]));
+        }
+    };
+
+    struct ENodeEqual {
+        bool operator()(const ENode &lhs, const ENode &rhs) const noexcept {
+            return lhs.type == rhs.type && lhs.op == rhs.op && lhs.value == rhs.value && lhs.varId == rhs.varId &&
+                   lhs.children[0] == rhs.children[0] && lhs.children[1] == rhs.children[1];
+        }
+    };
+
+    /**
+     * 把整个表达式加入e-graph，返回根节点所在的e-class。后序遍历。非递归实现。
+     */
+    Id AddNode(const Node &node) noexcept {
+        std::vector<const NodeImpl *> revertedPostOrder;
+        std::stack<const NodeImpl *> stk;
+        stk.emplace(node.get());
+        while (!stk.empty()) {
+            auto cur = stk.top();
+            stk.pop();
+            revertedPostOrder.emplace_back(cur);
+            if (cur->left) {
+                stk.emplace(cur->left.get());
+            }
+            if (cur->right) {
+                stk.emplace(cur->right.get());
+            }
+        }
+
+        std::vector<Id> ids;
+        for (auto it = revertedPostOrder.rbegin(); it != revertedPostOrder.rend(); ++it) {
+            auto &cur = **it;
+            switch (cur.type) {
+            case NodeType::NUMBER:
+                ids.emplace_back(AddNumber(cur.value));
+                break;
+            case NodeType::VARIABLE: {
+                auto ret = varIds.emplace(cur.varname, static_cast<std::uint32_t>(varnames.size()));
+                if (ret.second) {
+                    varnames.emplace_back(cur.varname);
+                }
+                ids.emplace_back(Add({NodeType::VARIABLE, MathOperator::MATH_NULL, 0, ret.first->second, {0, 0}}));
+                break;
+            }
+            case NodeType::OPERATOR:
+                if (GetOperatorNum(cur.op) == 2) {
+                    auto right = ids.back();
+                    ids.pop_back();
+                    ids.back() = AddOperator(cur.op, ids.back(), right);
+                } else {
+                    ids.back() = AddOperator(cur.op, ids.back());
+                }
+                break;
+            }
+        }
+        assert(ids.size() == 1);
+        return ids.back();
+    }
+
+    /**
+     * 每轮对所有e-class应用一遍重写规则，然后重建。返回是否产生了新的节点或等价关系。
+     * 每处理完一个节点检查一次节点总数，超过maxNodes时不再处理本轮剩下的节点。
+     */
+    bool ApplyRules(std::size_t maxNodes) noexcept {
+        changed = false;
+        auto count = static_cast<Id>(classes.size());
+        for (Id id = 0; id < count && NodeCount() <= maxNodes; ++id) {
+            if (Find(id) != id) {
+                continue;
+            }
+            // Add()可能使classes扩容，这里必须复制一份
+            auto nodes = classes[id];
+            for (auto &n : nodes) {
+                if (NodeCount() > maxNodes) {
+                    break;
+                }
+                ApplyRules(id, n);
+            }
+        }
+        Rebuild();
+        return changed;
+    }
+
+    /**
+     * e-graph中的节点总数。
+     */
+    std::size_t NodeCount() const noexcept {
+        return memo.size();
+    }
+
+    /**
+     * 按OperatorCost()提取root所在e-class中总代价最低的表达式。非递归实现。
+     */
+    Node Extract(Id root) noexcept {
+        root = Find(root);
+
+        // 反复松弛，直到每个e-class的最低代价不再变化
+        std::vector<double> costs(classes.size(), std::numeric_limits<double>::infinity());
+        std::vector<ENode> best(classes.size());
+        for (bool updated = true; updated;) {
+            updated = false;
+            for (Id id = 0; id < classes.size(); ++id) {
+                for (auto &n : classes[id]) {
+                    auto cost = NodeCost(n, costs);
+                    if (cost < costs[id]) {
+                        costs[id] = cost;
+                        best[id] = n;
+                        updated = true;
+                    }
+                }
+            }
+        }
+
+        // 运算符的代价严格大于其子节点，因此best不会成环
+        std::stack<std::pair<Id, bool>> stk;
+        std::stack<Node> results;
+        auto popNode = [&results] {
+            auto node = std::move(results.top());
+            results.pop();
+            return node;
+        };
+        stk.emplace(root, false);
+        while (!stk.empty()) {
+            auto id = stk.top().first;
+            auto visited = stk.top().second;
+            stk.pop();
+
+            auto &n = best[id];
+            switch (n.type) {
+            case NodeType::NUMBER:
+                results.emplace(Num(n.value));
+                break;
+            case NodeType::VARIABLE:
+                results.emplace(
+                    std::make_unique<NodeImpl>(NodeType::VARIABLE, MathOperator::MATH_NULL, 0, varnames[n.varId]));
+                break;
+            case NodeType::OPERATOR:
+                if (!visited) {
+                    stk.emplace(id, true);
+                    if (GetOperatorNum(n.op) == 2) {
+                        stk.emplace(Find(n.children[1]), false);
+                    }
+                    stk.emplace(Find(n.children[0]), false);
+                } else if (GetOperatorNum(n.op) == 2) {
+                    auto right = popNode();
+                    auto left = popNode();
+                    results.emplace(Operator(n.op, std::move(left), std::move(right)));
+                } else {
+                    results.emplace(Operator(n.op, popNode()));
+                }
+                break;
+            }
+        }
+        assert(results.size() == 1);
+        return popNode();
+    }
+
+private:
+    std::vector<Id> parents;                // 并查集
+    std::vector<std::vector<ENode>> classes; // 只有代表元的位置保存节点
+    std::vector<bool> hasConstant;           // e-class是否等于某个常数
+    std::vector<double> constants;
+    std::unordered_map<ENode, Id, ENodeHash, ENodeEqual> memo;
+    std::vector<std::string> varnames;
+    std::map<std::string, std::uint32_t> varIds;
+    bool changed = false;
+
+    Id Find(Id id) noexcept {
+        while (parents[id] != id) {
+            parents[id] = parents[parents[id]];
+            id = parents[id];
+        }
+        return id;
+    }
+
+    ENode Canonicalize(ENode n) noexcept {
+        if (n.type == NodeType::OPERATOR) {
+            n.children[0] = Find(n.children[0]);
+            if (GetOperatorNum(n.op) == 2) {
+                n.children[1] = Find(n.children[1]);
+            }
+        }
+        return n;
+    }
+
+    Id Add(ENode n) noexcept {
+        n = Canonicalize(n);
+        auto itor = memo.find(n);
+        if (itor != memo.end()) {
+            return Find(itor->second);
+        }
+
+        auto id = static_cast<Id>(classes.size());
+        parents.emplace_back(id);
+        classes.emplace_back(std::vector<ENode>{n});
+        hasConstant.emplace_back(n.type == NodeType::NUMBER);
+        constants.emplace_back(n.value);
+        memo.emplace(n, id);
+        changed = true;
+        return id;
+    }
+
+    Id AddNumber(double value) noexcept {
+        return Add({NodeType::NUMBER, MathOperator::MATH_NULL, value, 0, {0, 0}});
+    }
+
+    Id AddOperator(MathOperator op, Id left, Id right = 0) noexcept {
+        return Add({NodeType::OPERATOR, op, 0, 0, {left, right}});
+    }
+
+    void Union(Id a, Id b) noexcept {
+        a = Find(a);
+        b = Find(b);
+        if (a == b) {
+            return;
+        }
+        if (classes[a].size() < classes[b].size()) {
+            std::swap(a, b);
+        }
+        parents[b] = a;
+        classes[a].insert(classes[a].end(), classes[b].begin(), classes[b].end());
+        classes[b].clear();
+        classes[b].shrink_to_fit();
+        if (!hasConstant[a] && hasConstant[b]) {
+            hasConstant[a] = true;
+            constants[a] = constants[b];
+        }
+        changed = true;
+    }
+
+    // 合并后，原本不同的节点可能变得相同，需要重新建立哈希表并合并对应的e-class，直到不再变化
+    void Rebuild() noexcept {
+        for (bool merged = true; merged;) {
+            memo.clear();
+            std::vector<std::pair<Id, Id>> pending;
+            for (Id id = 0; id < classes.size(); ++id) {
+                if (Find(id) != id) {
+                    continue;
+                }
+                for (auto &n : classes[id]) {
+                    n = Canonicalize(n);
+                    auto ret = memo.emplace(n, id);
+                    if (!ret.second && ret.first->second != id) {
+                        pending.emplace_back(ret.first->second, id);
+                    }
+                }
+            }
+            for (auto &pr : pending) {
+                Union(pr.first, pr.second);
+            }
+            merged = !pending.empty();
+        }
+
+        // 去掉e-class内重复的节点
+        for (Id id = 0; id < classes.size(); ++id) {
+            auto &nodes = classes[id];
+            std::vector<ENode> unique;
+            for (auto &n : nodes) {
+                auto c = Canonicalize(n);
+                if (std::none_of(unique.begin(), unique.end(), [&c](const ENode &u) {
+                        return ENodeEqual()(u, c);
+                    })) {
+                    unique.emplace_back(c);
+                }
+            }
+            nodes = std::move(unique);
+        }
+    }
+
+    bool IsConstant(Id id, double value) noexcept {
+        id = Find(id);
+        return hasConstant[id] && constants[id] == value;
+    }
+
+    // 对e-class id中所有运算符为op的节点调用f
+    template <typename F>
+    void ForEach(Id id, MathOperator op, F &&f) noexcept {
+        auto nodes = classes[Find(id)];
+        for (auto &n : nodes) {
+            if (n.type == NodeType::OPERATOR && n.op == op) {
+                f(n);
+            }
+        }
+    }
+
+    // 对节点n应用所有重写规则，n属于e-class id
+    void ApplyRules(Id id, const ENode &n) noexcept {
+        if (n.type != NodeType::OPERATOR) {
+            return;
+        }
+
+        auto a = Find(n.children[0]);
+        auto b = GetOperatorNum(n.op) == 2 ? Find(n.children[1]) : a;
+
+        // 常数折叠
+        if (hasConstant[a] && hasConstant[b]) {
+            try {
+                auto value = tomsolver::Calc(n.op, constants[a], constants[b]);
+                if (std::isfinite(value)) {
+                    Union(id, AddNumber(value));
+                }
+            } catch (const MathError &) {
+            }
+        }
+
+        switch (n.op) {
+        case MathOperator::MATH_ADD:
+            Union(id, AddOperator(MathOperator::MATH_ADD, b, a));
+            // (x+y)+z = x+(y+z)
+            ForEach(a, MathOperator::MATH_ADD, [&](const ENode &sum) {
+                auto yz = AddOperator(MathOperator::MATH_ADD, sum.children[1], b);
+                Union(id, AddOperator(MathOperator::MATH_ADD, sum.children[0], yz));
+            });
+            if (IsConstant(b, 0)) {
+                Union(id, a);
+            }
+            // a*b+a*c = a*(b+c)
+            ForEach(a, MathOperator::MATH_MULTIPLY, [&](const ENode &m1) {
+                ForEach(b, MathOperator::MATH_MULTIPLY, [&](const ENode &m2) {
+                    if (Find(m1.children[0]) == Find(m2.children[0])) {
+                        auto sum = AddOperator(MathOperator::MATH_ADD, m1.children[1], m2.children[1]);
+                        Union(id, AddOperator(MathOperator::MATH_MULTIPLY, m1.children[0], sum));
+                    }
+                });
+            });
+            // sin(x)^2+cos(x)^2 = 1
+            ForEach(a, MathOperator::MATH_POWER, [&](const ENode &p1) {
+                ForEach(b, MathOperator::MATH_POWER, [&](const ENode &p2) {
+                    if (!IsConstant(p1.children[1], 2) || !IsConstant(p2.children[1], 2)) {
+                        return;
+                    }
+                    ForEach(p1.children[0], MathOperator::MATH_SIN, [&](const ENode &s) {
+                        ForEach(p2.children[0], MathOperator::MATH_COS, [&](const ENode &c) {
+                            if (Find(s.children[0]) == Find(c.children[0])) {
+                                Union(id, AddNumber(1));
+                            }
+                        });
+                    });
+                });
+            });
+            break;
+
+        case MathOperator::MATH_SUB:
+            if (a == b) {
+                Union(id, AddNumber(0));
+            }
+            if (IsConstant(b, 0)) {
+                Union(id, a);
+            }
+            // a*b-a*c = a*(b-c)
+            ForEach(a, MathOperator::MATH_MULTIPLY, [&](const ENode &m1) {
+                ForEach(b, MathOperator::MATH_MULTIPLY, [&](const ENode &m2) {
+                    if (Find(m1.children[0]) == Find(m2.children[0])) {
+                        auto difference = AddOperator(MathOperator::MATH_SUB, m1.children[1], m2.children[1]);
+                        Union(id, AddOperator(MathOperator::MATH_MULTIPLY, m1.children[0], difference));
+                    }
+                });
+            });
+            break;
+
+        case MathOperator::MATH_MULTIPLY:
+            Union(id, AddOperator(MathOperator::MATH_MULTIPLY, b, a));
+            // (x*y)*z = x*(y*z)
+            ForEach(a, MathOperator::MATH_MULTIPLY, [&](const ENode &product) {
+                auto yz = AddOperator(MathOperator::MATH_MULTIPLY, product.children[1], b);
+                Union(id, AddOperator(MathOperator::MATH_MULTIPLY, product.children[0], yz));
+            });
+            if (IsConstant(b, 1)) {
+                Union(id, a);
+            }
+            if (IsConstant(b, 0)) {
+                Union(id, AddNumber(0));
+            }
+            // x*x = x^2
+            if (a == b) {
+                Union(id, AddOperator(MathOperator::MATH_POWER, a, AddNumber(2)));
+            }
+            // x^p*x = x^(p+1)，x^p*x^q = x^(p+q)，只合并不扩大定义域的整数次幂，见CanMergeExponents()
+            ForEach(a, MathOperator::MATH_POWER, [&](const ENode &p1) {
+                auto base = Find(p1.children[0]);
+                auto e1 = Find(p1.children[1]);
+                if (!hasConstant[e1]) {
+                    return;
+                }
+                if (base == b && CanMergeExponents(constants[e1], 1)) {
+                    Union(id, AddOperator(MathOperator::MATH_POWER, base, AddNumber(constants[e1] + 1)));
+                }
+                ForEach(b, MathOperator::MATH_POWER, [&](const ENode &p2) {
+                    auto e2 = Find(p2.children[1]);
+                    if (Find(p2.children[0]) == base && hasConstant[e2] &&
+                        CanMergeExponents(constants[e1], constants[e2])) {
+                        Union(id, AddOperator(MathOperator::MATH_POWER, base, AddNumber(constants[e1] + constants[e2])));
+                    }
+                });
+            });
+            // exp(a)*exp(b) = exp(a+b)
+            ForEach(a, MathOperator::MATH_EXP, [&](const ENode &e1) {
+                ForEach(b, MathOperator::MATH_EXP, [&](const ENode &e2) {
+                    auto sum = AddOperator(MathOperator::MATH_ADD, e1.children[0], e2.children[0]);
+                    Union(id, AddOperator(MathOperator::MATH_EXP, sum));
+                });
+            });
+            break;
+
+        case MathOperator::MATH_DIVIDE:
+            if (IsConstant(b, 1)) {
+                Union(id, a);
+            }
+            // Simplify的规范形式是(n1*n2*...)/(d1*d2*...)，拆开乘除链，使分子、分母中的因子可以两两配对
+            // (x*y)/z = x*(y/z)
+            ForEach(a, MathOperator::MATH_MULTIPLY, [&](const ENode &product) {
+                auto quotient = AddOperator(MathOperator::MATH_DIVIDE, product.children[1], b);
+                Union(id, AddOperator(MathOperator::MATH_MULTIPLY, product.children[0], quotient));
+            });
+            // x/(y*z) = (x/y)/z
+            ForEach(b, MathOperator::MATH_MULTIPLY, [&](const ENode &product) {
+                auto quotient = AddOperator(MathOperator::MATH_DIVIDE, a, product.children[0]);
+                Union(id, AddOperator(MathOperator::MATH_DIVIDE, quotient, product.children[1]));
+            });
+            // sin(x)/cos(x) = tan(x)
+            ForEach(a, MathOperator::MATH_SIN, [&](const ENode &s) {
+                ForEach(b, MathOperator::MATH_COS, [&](const ENode &c) {
+                    if (Find(s.children[0]) == Find(c.children[0])) {
+                        Union(id, AddOperator(MathOperator::MATH_TAN, s.children[0]));
+                    }
+                });
+            });
+            break;
+
+        case MathOperator::MATH_POWER: {
+            if (!hasConstant[b]) {
+                break;
+            }
+            auto exponent = constants[b];
+            if (exponent == 1) {
+                Union(id, a);
+            } else if (exponent == 0) {
+                Union(id, AddNumber(1));
+            } else if (exponent == 0.5) {
+                Union(id, AddOperator(MathOperator::MATH_SQRT, a));
+            } else if (exponent >= 2 && exponent <= 4 && std::trunc(exponent) == exponent) {
+                // x^n = x^(n-1)*x，由代价模型决定是否展开为乘法
+                Union(id, AddOperator(MathOperator::MATH_MULTIPLY, AddOperator(MathOperator::MATH_POWER, a,
+                                                                               AddNumber(exponent - 1)),
+                                      a));
+            }
+            break;
+        }
+
+        case MathOperator::MATH_LOG:
+            ForEach(a, MathOperator::MATH_EXP, [&](const ENode &e) {
+                Union(id, e.children[0]);
+            });
+            break;
+
+        case MathOperator::MATH_EXP:
+            ForEach(a, MathOperator::MATH_LOG, [&](const ENode &l) {
+                Union(id, l.children[0]);
+            });
+            break;
+
+        case MathOperator::MATH_NEGATIVE:
+            ForEach(a, MathOperator::MATH_NEGATIVE, [&](const ENode &neg) {
+                Union(id, neg.children[0]);
+            });
+            break;
+
+        case MathOperator::MATH_POSITIVE:
+            Union(id, a);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    // x^p*x^q = x^(p+q)是否不扩大定义域：p、q都是整数（非整数次幂在x < 0时无定义），
+    // 并且都不是负数，或者合并后仍为负数（负数次幂在x = 0时无定义）。与Simplify合并同底数幂的规则一致
+    static bool CanMergeExponents(double p, double q) noexcept {
+        auto isInteger = [](double value) {
+            return std::trunc(value) == value;
+        };
+        return isInteger(p) && isInteger(q) && ((p >= 0 && q >= 0) || p + q < 0);
+    }
+
+    static double NodeCost(const ENode &n, const std::vector<double> &costs) noexcept {
+        if (n.type != NodeType::OPERATOR) {
+            return 0;
+        }
+        auto cost = OperatorCost(n.op) + costs[n.children[0]];
+        if (GetOperatorNum(n.op) == 2) {
+            cost += costs[n.children[1]];
+        }
+        return cost;
+    }
+};
+
+} // namespace internal
+
+Node Optimize(const Node &node, int maxIterations, std::size_t maxNodes) noexcept {
+    Node simplified = Clone(node);
+    Simplify(simplified);
+
+    internal::EGraph egraph;
+    auto root = egraph.AddNode(simplified);
+    for (int i = 0; i < maxIterations && egraph.NodeCount() <= maxNodes; ++i) {
+        if (!egraph.ApplyRules(maxNodes)) {
+            break;
+        }
+    }
+    return egraph.Extract(root);
+}
+
+double OperatorCost(MathOperator op) noexcept {
+    switch (op) {
+    case MathOperator::MATH_POSITIVE:
+    case MathOperator::MATH_NEGATIVE:
+    case MathOperator::MATH_ADD:
+    case MathOperator::MATH_SUB:
+    case MathOperator::MATH_MULTIPLY:
+        return 1;
+    case MathOperator::MATH_DIVIDE:
+        return 4;
+    case MathOperator::MATH_SQRT:
+        return 8;
+    case MathOperator::MATH_POWER:
+        return 30;
+    default:
+        return 20;
+    }
+}
+
+} // namespace tomsolver
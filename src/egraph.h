@@ -0,0 +1,30 @@
+#pragma once
+
+#include "node.h"
+
+#include <cstddef>
+
+namespace tomsolver {
+
+/**
+ * 以等式饱和（equality saturation）的方式优化表达式，返回求值代价最低的等价表达式。不改变node。
+ * 先用Simplify规范化，再把表达式放入e-graph，反复应用以下重写规则，直到不再产生新的等价关系，
+ * 或者达到maxIterations轮、e-graph的节点数超过maxNodes（每处理完一个节点检查一次）：
+ *   1. 加法、乘法交换律与结合律，乘除结合(x*y)/z=x*(y/z)、x/(y*z)=(x/y)/z，常数折叠，x+0、x*1、x*0、x-x等单位元；
+ *   2. 三角恒等式：sin(x)^2+cos(x)^2=1，sin(x)/cos(x)=tan(x)；
+ *   3. 提取公因式：a*b+a*c=a*(b+c)，a*b-a*c=a*(b-c)；
+ *   4. exp、log相消：log(exp(x))=x，exp(log(x))=x，exp(a)*exp(b)=exp(a+b)；
+ *   5. 幂的合并与展开：x*x=x^2，x^a*x^b=x^(a+b)，x^n=x^(n-1)*x，x^0.5=sqrt(x)。
+ *      与Simplify一样，x^a*x^b只在a、b都是整数，并且都不是负数或者a+b仍为负数时合并，不扩大定义域。
+ * 最后按OperatorCost()给出的代价提取总代价最低的表达式。
+ * 注意：exp(log(x))=x等规则会扩大定义域，原本因定义域抛出异常的表达式优化后可能可以正常求值。
+ */
+Node Optimize(const Node &node, int maxIterations = 8, std::size_t maxNodes = 10000) noexcept;
+
+/**
+ * Optimize使用的代价模型：单个运算符的求值代价。数值和变量的代价为0。
+ * 以加减乘为1，除法、开方稍高，乘方、三角函数、指数对数远高于四则运算。
+ */
+double OperatorCost(MathOperator op) noexcept;
+
+} // namespace tomsolver
@@ -0,0 +1,359 @@
+#include "flat_node.h"
+
+#include "config.h"
+#include "math_operator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stack>
+#include <stdexcept>
+
+namespace tomsolver {
+
+// 后序遍历。非递归实现。
+FlatNode::FlatNode(const Node &node) noexcept {
+    // 借助一个栈，得到反向的后序遍历序列
+    std::vector<const internal::NodeImpl *> revertedPostOrder;
+    std::stack<const internal::NodeImpl *> stk;
+    stk.emplace(node.get());
+    while (!stk.empty()) {
+        auto cur = stk.top();
+        stk.pop();
+        revertedPostOrder.emplace_back(cur);
+        if (cur->left) {
+            stk.emplace(cur->left.get());
+        }
+        if (cur->right) {
+            stk.emplace(cur->right.get());
+        }
+    }
+
+    // 正向逐个填入items，operands是尚未被父节点认领的节点下标
+    std::map<std::string, std::uint32_t> varIds;
+    std::vector<std::uint32_t> operands;
+    items.reserve(revertedPostOrder.size());
+    for (auto it = revertedPostOrder.rbegin(); it != revertedPostOrder.rend(); ++it) {
+        auto &cur = **it;
+        Item item{cur.type, cur.op, 0, {0}};
+        switch (cur.type) {
+        case NodeType::NUMBER:
+            item.value = cur.value;
+            break;
+        case NodeType::VARIABLE: {
+            auto ret = varIds.emplace(cur.varname, static_cast<std::uint32_t>(varnames.size()));
+            if (ret.second) {
+                varnames.emplace_back(cur.varname);
+            }
+            item.varId = ret.first->second;
+            break;
+        }
+        case NodeType::OPERATOR:
+            if (GetOperatorNum(cur.op) == 2) {
+                operands.pop_back();
+            }
+            item.left = operands.back();
+            operands.pop_back();
+            break;
+        }
+        operands.emplace_back(static_cast<std::uint32_t>(items.size()));
+        items.emplace_back(item);
+    }
+    assert(operands.size() == 1);
+
+    ComputeHash();
+}
+
+void FlatNode::ComputeHash() noexcept {
+    const std::string emptyName;
+    hash = 0;
+
+    // 反向扫描，与NodeImpl::Hash()的遍历顺序一致
+    for (auto it = items.rbegin(); it != items.rend(); ++it) {
+        auto &item = *it;
+        auto value = item.type == NodeType::NUMBER ? item.value : 0.0;
+        auto &varname = item.type == NodeType::VARIABLE ? varnames[item.varId] : emptyName;
+        hash = internal::HashCombine(hash, internal::HashSingleNode(item.type, item.op, value, varname));
+    }
+}
+
+Node FlatNode::ToNode() const noexcept {
+    std::stack<Node> stk;
+    auto popNode = [&stk] {
+        auto node = std::move(stk.top());
+        stk.pop();
+        return node;
+    };
+
+    for (auto &item : items) {
+        switch (item.type) {
+        case NodeType::NUMBER:
+            stk.emplace(Num(item.value));
+            break;
+        case NodeType::VARIABLE:
+            stk.emplace(std::make_unique<internal::NodeImpl>(NodeType::VARIABLE, MathOperator::MATH_NULL, 0,
+                                                             varnames[item.varId]));
+            break;
+        case NodeType::OPERATOR:
+            if (GetOperatorNum(item.op) == 2) {
+                auto right = popNode();
+                auto left = popNode();
+                stk.emplace(internal::Operator(item.op, std::move(left), std::move(right)));
+            } else {
+                stk.emplace(internal::Operator(item.op, popNode()));
+            }
+            break;
+        }
+    }
+
+    assert(stk.size() == 1);
+    return popNode();
+}
+
+std::size_t FlatNode::Size() const noexcept {
+    return items.size();
+}
+
+const std::vector<FlatNode::Item> &FlatNode::Items() const noexcept {
+    return items;
+}
+
+const std::vector<std::string> &FlatNode::VarNames() const noexcept {
+    return varnames;
+}
+
+bool FlatNode::Equal(const FlatNode &rhs) const noexcept {
+    if (this == &rhs) {
+        return true;
+    }
+
+    if (hash != rhs.hash || items.size() != rhs.items.size() || varnames != rhs.varnames) {
+        return false;
+    }
+
+    // 后序序列相同，树的形状和内容就相同
+    return std::equal(items.begin(), items.end(), rhs.items.begin(), [](const Item &lhs, const Item &rhs) {
+        if (lhs.type != rhs.type) {
+            return false;
+        }
+        switch (lhs.type) {
+        case NodeType::NUMBER:
+            return lhs.value == rhs.value;
+        case NodeType::VARIABLE:
+            return lhs.varId == rhs.varId;
+        case NodeType::OPERATOR:
+            return lhs.op == rhs.op && lhs.left == rhs.left;
+        }
+        return false;
+    });
+}
+
+bool FlatNode::operator==(const FlatNode &rhs) const noexcept {
+    return Equal(rhs);
+}
+
+bool FlatNode::operator!=(const FlatNode &rhs) const noexcept {
+    return !Equal(rhs);
+}
+
+std::uint64_t FlatNode::Hash() const noexcept {
+    return hash;
+}
+
+std::string FlatNode::ItemToStr(const Item &item) const noexcept {
+    switch (item.type) {
+    case NodeType::NUMBER:
+        return tomsolver::ToString(item.value);
+    case NodeType::VARIABLE:
+        return varnames[item.varId];
+    case NodeType::OPERATOR:
+        return MathOperatorToStr(item.op);
+    }
+    assert(0 && "unexpected NodeType. maybe this is a bug.");
+    return "";
+}
+
+// 中序遍历。非递归实现。逻辑与NodeImpl::ToStringNonRecursively一致。
+std::string FlatNode::ToString() const noexcept {
+    constexpr auto npos = std::numeric_limits<std::uint32_t>::max();
+
+    // 先线性扫描一遍，记下每个节点的父节点
+    std::vector<std::uint32_t> parents(items.size(), npos);
+    for (std::uint32_t i = 0; i < items.size(); ++i) {
+        if (items[i].type == NodeType::OPERATOR) {
+            parents[items[i].left] = i;
+            if (GetOperatorNum(items[i].op) == 2) {
+                parents[i - 1] = i;
+            }
+        }
+    }
+
+    auto isOperator = [this](std::uint32_t i) {
+        return i != npos && items[i].type == NodeType::OPERATOR;
+    };
+    auto isRightChild = [this, &parents](std::uint32_t i) {
+        auto parent = parents[i];
+        return parent != npos && GetOperatorNum(items[parent].op) == 2 && parent - 1 == i;
+    };
+
+    std::stringstream output;
+
+    // npos代表右括号
+    std::stack<std::uint32_t> stk;
+
+    auto AddLeftLine = [&](std::uint32_t cur) {
+        while (cur != npos) {
+            auto &item = items[cur];
+            if (item.type != NodeType::OPERATOR) {
+                stk.emplace(cur);
+                break;
+            }
+
+            // 一元运算符的特殊处理，见NodeImpl::ToStringNonRecursively
+            if (GetOperatorNum(item.op) == 1) {
+                if ((item.op == MathOperator::MATH_POSITIVE || item.op == MathOperator::MATH_NEGATIVE) &&
+                    !isOperator(item.left)) {
+                    output << ItemToStr(item);
+                    cur = item.left;
+                    continue;
+                }
+                output << ItemToStr(item) << "(";
+                stk.emplace(npos);
+                cur = item.left;
+                continue;
+            }
+
+            // 二元运算符的特殊处理：
+            auto parent = parents[cur];
+            if (parent != npos) {
+                auto parentOp = items[parent].op;
+                if (GetOperatorNum(parentOp) == 2 && // 父运算符存在，为二元，
+                    (Rank(parentOp) > Rank(item.op)  // 父级优先级高于本级->加括号
+                     || (                            // 两级优先级相等
+                            Rank(parentOp) == Rank(item.op) &&
+                            (
+                                // 本级为父级的右子树 且父级不满足结合律->加括号
+                                (InAssociativeLaws(parentOp) == false && isRightChild(cur)) ||
+                                // 两级都是右结合
+                                (InAssociativeLaws(parentOp) == false && IsLeft2Right(item.op) == false))))) {
+                    output << "(";
+                    stk.emplace(npos);
+                }
+            }
+
+            stk.emplace(cur);
+            cur = item.left;
+        }
+    };
+
+    AddLeftLine(static_cast<std::uint32_t>(items.size() - 1));
+
+    while (!stk.empty()) {
+        auto cur = stk.top();
+        stk.pop();
+
+        if (cur == npos) {
+            output << ")";
+            continue;
+        }
+
+        auto &item = items[cur];
+
+        // 负数的特殊处理
+        // 如果当前节点是数值且小于0，且前面是-运算符，那么加括号
+        if (item.type == NodeType::NUMBER && item.value < 0 && isRightChild(cur) &&
+            items[parents[cur]].op == MathOperator::MATH_SUB) {
+            output << "(" << ItemToStr(item) << ")";
+        } else {
+            output << ItemToStr(item);
+        }
+
+        if (item.type == NodeType::OPERATOR && GetOperatorNum(item.op) == 2) {
+            AddLeftLine(cur - 1);
+        }
+    }
+
+    return output.str();
+}
+
+// 后序遍历。items本身就是逆波兰表达式，顺序扫描即可计算出表达式的值。
+double FlatNode::Vpa() const {
+    std::vector<double> calcStk;
+    calcStk.reserve(items.size());
+    for (auto &item : items) {
+        switch (item.type) {
+        case NodeType::NUMBER:
+            calcStk.emplace_back(item.value);
+            break;
+
+        case NodeType::VARIABLE:
+            throw std::runtime_error("has variable. can not calculate to be a number");
+
+        case NodeType::OPERATOR: {
+            auto r = std::numeric_limits<double>::quiet_NaN();
+            if (GetOperatorNum(item.op) == 2) {
+                r = calcStk.back();
+                calcStk.pop_back();
+            }
+            auto &l = calcStk.back();
+            l = tomsolver::Calc(item.op, l, r);
+            break;
+        }
+        }
+    }
+
+    assert(calcStk.size() == 1);
+    return calcStk.back();
+}
+
+std::set<std::string> FlatNode::GetAllVarNames() const noexcept {
+    return {varnames.begin(), varnames.end()};
+}
+
+namespace internal {
+
+FlatNodeBuilder::Handle FlatNodeBuilder::Append(const FlatNode::Item &item) noexcept {
+    flat.items.emplace_back(item);
+    return static_cast<Handle>(flat.items.size() - 1);
+}
+
+FlatNodeBuilder::Handle FlatNodeBuilder::Number(double value) noexcept {
+    FlatNode::Item item{NodeType::NUMBER, MathOperator::MATH_NULL, 0, {0}};
+    item.value = value;
+    return Append(item);
+}
+
+FlatNodeBuilder::Handle FlatNodeBuilder::Variable(const char *name, std::size_t len) noexcept {
+    auto ret = varIds.emplace(std::string(name, len), static_cast<std::uint32_t>(flat.varnames.size()));
+    if (ret.second) {
+        flat.varnames.emplace_back(ret.first->first);
+    }
+    FlatNode::Item item{NodeType::VARIABLE, MathOperator::MATH_NULL, 0, {0}};
+    item.varId = ret.first->second;
+    return Append(item);
+}
+
+FlatNodeBuilder::Handle FlatNodeBuilder::Unary(MathOperator op, Handle operand) noexcept {
+    assert(GetOperatorNum(op) == 1 && operand + 1 == flat.items.size());
+    return Append({NodeType::OPERATOR, op, operand, {0}});
+}
+
+FlatNodeBuilder::Handle FlatNodeBuilder::Binary(MathOperator op, Handle left, Handle right) noexcept {
+    assert(GetOperatorNum(op) == 2 && left < right && right + 1 == flat.items.size());
+    (void)right;
+    return Append({NodeType::OPERATOR, op, left, {0}});
+}
+
+FlatNode FlatNodeBuilder::Finish(Handle root) noexcept {
+    assert(root + 1 == flat.items.size());
+    (void)root;
+    flat.ComputeHash();
+    varIds.clear();
+    return std::move(flat);
+}
+
+} // namespace internal
+
+} // namespace tomsolver
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "node.h"
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tomsolver {
+
+namespace internal {
+class FlatNodeBuilder;
+} // namespace internal
+
+/**
+ * 扁平化的只读表达式。
+ * 所有节点按后序遍历的顺序连续存放在一个数组内，子节点以32位下标引用，数值与变量编号共用一个union。
+ * 相比以std::unique_ptr串起来的Node，内存占用约为其1/4，遍历时也只需要线性扫描数组。
+ * 构造完成后不可修改。
+ */
+class FlatNode {
+public:
+    /**
+     * 单个节点。
+     * 由于是后序排列，运算符的最后一个操作数（二元运算符的右操作数、一元运算符的唯一操作数）总是紧挨在它的前面。
+     */
+    struct Item {
+        NodeType type;
+        MathOperator op;
+        std::uint32_t left; // 运算符的第一个操作数的下标
+        union {
+            double value;        // 数值节点的值
+            std::uint32_t varId; // 变量节点的变量编号，即varnames的下标
+        };
+    };
+
+    static_assert(sizeof(Item) == 16, "FlatNode::Item should be compact");
+
+    /**
+     * 由Node构造。非递归实现。
+     */
+    explicit FlatNode(const Node &node) noexcept;
+
+    /**
+     * 还原为Node。
+     */
+    Node ToNode() const noexcept;
+
+    /**
+     * 节点数量。
+     */
+    std::size_t Size() const noexcept;
+
+    /**
+     * 按后序排列的所有节点。
+     */
+    const std::vector<Item> &Items() const noexcept;
+
+    /**
+     * 变量名，下标即Item::varId。
+     */
+    const std::vector<std::string> &VarNames() const noexcept;
+
+    /**
+     * 返回两个表达式是否完全一致。
+     * 哈希值不同时直接返回false，不需要逐个节点比较。
+     */
+    bool Equal(const FlatNode &rhs) const noexcept;
+
+    bool operator==(const FlatNode &rhs) const noexcept;
+
+    bool operator!=(const FlatNode &rhs) const noexcept;
+
+    /**
+     * 返回结构哈希值。构造时计算好，与Node的Hash()结果一致。
+     */
+    std::uint64_t Hash() const noexcept;
+
+    /**
+     * 把整个表达式以中序遍历的顺序输出为字符串。结果与Node的ToString()一致。
+     */
+    std::string ToString() const noexcept;
+
+    /**
+     * 计算出整个表达式的数值。
+     * @exception runtime_error 如果有变量存在，则无法计算
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    double Vpa() const;
+
+    /**
+     * 返回表达式内出现的所有变量名。
+     */
+    std::set<std::string> GetAllVarNames() const noexcept;
+
+private:
+    std::vector<Item> items;
+    std::vector<std::string> varnames; // 按在后序序列中首次出现的顺序编号
+    std::uint64_t hash = 0;
+
+    FlatNode() noexcept = default;
+
+    /**
+     * 由items计算hash。
+     */
+    void ComputeHash() noexcept;
+
+    /**
+     * 节点转string。仅限本节点，不含子节点。
+     */
+    std::string ItemToStr(const Item &item) const noexcept;
+
+    friend class internal::FlatNodeBuilder;
+};
+
+namespace internal {
+
+/**
+ * 按后序逐个追加节点，直接构造出FlatNode，不经过Node。供解析器使用。
+ * 每个追加函数返回新节点的下标，作为之后运算符的操作数。调用者需保证追加顺序是合法的后序序列：
+ * 二元运算符的右操作数、一元运算符的操作数必须是紧挨着它前面追加的节点。
+ */
+class FlatNodeBuilder {
+public:
+    using Handle = std::uint32_t;
+
+    Handle Number(double value) noexcept;
+
+    Handle Variable(const char *name, std::size_t len) noexcept;
+
+    Handle Unary(MathOperator op, Handle operand) noexcept;
+
+    Handle Binary(MathOperator op, Handle left, Handle right) noexcept;
+
+    /**
+     * 结束构造。root必须是最后追加的节点。
+     */
+    FlatNode Finish(Handle root) noexcept;
+
+private:
+    FlatNode flat;
+    std::unordered_map<std::string, std::uint32_t> varIds;
+
+    Handle Append(const FlatNode::Item &item) noexcept;
+};
+
+} // namespace internal
+
+} // namespace tomsolver
+
+namespace std {
+
+template <>
+struct hash<tomsolver::FlatNode> {
+    std::size_t operator()(const tomsolver::FlatNode &node) const noexcept {
+        return static_cast<std::size_t>(node.Hash());
+    }
+};
+
+} // namespace std
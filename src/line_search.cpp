@@ -0,0 +1,191 @@
+#include "line_search.h"
+
+#include "error_type.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace tomsolver {
+
+namespace internal {
+
+void PrepareLineSearchWorkspace(LineSearchProblem &problem, LineSearchWorkspace &ws) {
+    auto m = static_cast<std::size_t>(problem.Rows());
+    auto n = static_cast<std::size_t>(problem.Cols());
+    ws.x.resize(n);
+    ws.f.resize(m);
+    ws.J.resize(m * n);
+}
+
+/**
+ * 计算phi(alpha)，试探点及其F保存在ws.x、ws.f中。出现浮点数无效值时返回inf。
+ */
+double LineSearchPhi(LineSearchProblem &problem, const double *x, const double *d, double alpha,
+                     LineSearchWorkspace &ws) {
+    for (std::size_t i = 0; i < ws.x.size(); ++i) {
+        ws.x[i] = x[i] + alpha * d[i];
+    }
+    try {
+        problem.Residual(ws.x.data(), ws.f.data());
+    } catch (const MathError &) {
+        return std::numeric_limits<double>::infinity();
+    }
+    double sum = 0;
+    for (auto v : ws.f) {
+        sum += v * v;
+    }
+    return 0.5 * sum;
+}
+
+/**
+ * 计算ws.x处的phi'(alpha) = F^T (J d)，不需要额外的缓冲区。须先调用LineSearchPhi()。出现浮点数无效值时返回nan。
+ */
+double LineSearchDphi(LineSearchProblem &problem, const double *d, LineSearchWorkspace &ws) {
+    try {
+        problem.Jacobian(ws.x.data(), ws.J.data());
+    } catch (const MathError &) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    auto n = ws.x.size();
+    double ret = 0;
+    for (std::size_t i = 0; i < ws.f.size(); ++i) {
+        double Jd = 0;
+        for (std::size_t j = 0; j < n; ++j) {
+            Jd += ws.J[i * n + j] * d[j];
+        }
+        ret += ws.f[i] * Jd;
+    }
+    return ret;
+}
+
+/**
+ * 回溯搜索。d是下降方向时要求 phi(alpha) <= reference + c1 * alpha * phi'(0)，否则只要求 phi(alpha) < phi(0)。
+ */
+double Backtrack(LineSearchProblem &problem, const double *x, const double *d, double phi0, double reference,
+                 double dphi0, double c1, double shrink, LineSearchWorkspace &ws) {
+    double alpha = 1;
+    for (int step = 0; step < Config::Get().maxLineSearchSteps; ++step) {
+        auto phi = LineSearchPhi(problem, x, d, alpha, ws);
+        if (dphi0 < 0 ? phi <= reference + c1 * alpha * dphi0 : phi < phi0) {
+            return alpha;
+        }
+        alpha *= shrink;
+    }
+    return 0;
+}
+
+} // namespace internal
+
+double ArmijoLineSearch::Search(LineSearchProblem &problem, const double *x, const double *d, double phi0,
+                                double dphi0, LineSearchWorkspace &ws) {
+    internal::PrepareLineSearchWorkspace(problem, ws);
+    return internal::Backtrack(problem, x, d, phi0, phi0, dphi0, c1, shrink, ws);
+}
+
+double StrongWolfeLineSearch::Search(LineSearchProblem &problem, const double *x, const double *d, double phi0,
+                                     double dphi0, LineSearchWorkspace &ws) {
+    internal::PrepareLineSearchWorkspace(problem, ws);
+    if (!(dphi0 < 0)) {
+        return internal::Backtrack(problem, x, d, phi0, phi0, dphi0, c1, 0.5, ws);
+    }
+
+    auto maxSteps = Config::Get().maxLineSearchSteps;
+    int steps = 0;
+    auto sufficientDecrease = [&](double alpha, double phi) {
+        return phi <= phi0 + c1 * alpha * dphi0;
+    };
+    auto curvature = [&](double dphi) {
+        return std::abs(dphi) <= -c2 * dphi0;
+    };
+
+    // 区间[lo, hi]（lo可能大于hi）内包含满足强Wolfe条件的步长，且lo满足充分下降条件
+    auto zoom = [&](double lo, double phiLo, double dphiLo, double hi, double phiHi) {
+        while (steps++ < maxSteps) {
+            // 二次插值：过(lo, phiLo)、(hi, phiHi)，在lo处的导数为dphiLo。结果太靠近端点时取中点
+            double w = hi - lo;
+            double denom = 2 * (phiHi - phiLo - dphiLo * w);
+            double alpha = denom > 0 ? lo - dphiLo * w * w / denom : lo + w / 2;
+            if (!(alpha >= std::min(lo, hi) + 0.1 * std::abs(w) && alpha <= std::max(lo, hi) - 0.1 * std::abs(w))) {
+                alpha = lo + w / 2;
+            }
+
+            auto phi = internal::LineSearchPhi(problem, x, d, alpha, ws);
+            if (!sufficientDecrease(alpha, phi) || phi >= phiLo) {
+                hi = alpha;
+                phiHi = phi;
+                continue;
+            }
+            auto dphi = internal::LineSearchDphi(problem, d, ws);
+            if (std::isnan(dphi) || curvature(dphi)) {
+                return alpha;
+            }
+            if (dphi * (hi - lo) >= 0) {
+                hi = lo;
+                phiHi = phiLo;
+            }
+            lo = alpha;
+            phiLo = phi;
+            dphiLo = dphi;
+        }
+        // 次数用尽时退而接受满足充分下降条件的lo。lo为0表示失败
+        return lo;
+    };
+
+    double alphaPrev = 0, phiPrev = phi0, dphiPrev = dphi0;
+    double alpha = 1;
+    while (steps++ < maxSteps) {
+        auto phi = internal::LineSearchPhi(problem, x, d, alpha, ws);
+        if (!sufficientDecrease(alpha, phi) || (alphaPrev > 0 && phi >= phiPrev)) {
+            return zoom(alphaPrev, phiPrev, dphiPrev, alpha, phi);
+        }
+        auto dphi = internal::LineSearchDphi(problem, d, ws);
+        if (std::isnan(dphi) || curvature(dphi)) {
+            return alpha;
+        }
+        if (dphi >= 0) {
+            return zoom(alpha, phi, dphi, alphaPrev, phiPrev);
+        }
+        if (alpha >= maxAlpha) {
+            return alpha;
+        }
+        alphaPrev = alpha;
+        phiPrev = phi;
+        dphiPrev = dphi;
+        alpha = std::min(2 * alpha, maxAlpha);
+    }
+    return alphaPrev;
+}
+
+NonMonotoneLineSearch::NonMonotoneLineSearch(int memory) : history(static_cast<std::size_t>(std::max(memory, 1))) {}
+
+double NonMonotoneLineSearch::Search(LineSearchProblem &problem, const double *x, const double *d, double phi0,
+                                     double dphi0, LineSearchWorkspace &ws) {
+    internal::PrepareLineSearchWorkspace(problem, ws);
+    history[count % history.size()] = phi0;
+    ++count;
+    auto end = history.begin() + static_cast<std::ptrdiff_t>(std::min(count, history.size()));
+    auto reference = *std::max_element(history.begin(), end);
+    return internal::Backtrack(problem, x, d, phi0, reference, dphi0, c1, shrink, ws);
+}
+
+void NonMonotoneLineSearch::Reset() noexcept {
+    count = 0;
+}
+
+std::unique_ptr<LineSearch> MakeLineSearch(LineSearchMethod method) {
+    switch (method) {
+    case LineSearchMethod::ARMIJO:
+        return std::make_unique<ArmijoLineSearch>();
+    case LineSearchMethod::STRONG_WOLFE:
+        return std::make_unique<StrongWolfeLineSearch>();
+    case LineSearchMethod::NON_MONOTONE:
+        return std::make_unique<NonMonotoneLineSearch>(Config::Get().nonMonotoneMemory);
+    }
+    throw std::runtime_error("invalid LineSearchMethod value: " + std::to_string(static_cast<int>(method)));
+}
+
+} // namespace tomsolver
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "config.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace tomsolver {
+
+/**
+ * 一维搜索的目标：方程组F: R^n -> R^m及其雅可比矩阵。
+ * 一维搜索沿方向d最小化价值函数 phi(alpha) = 0.5 * ||F(x + alpha * d)||^2。
+ * 所有缓冲区都由调用者提供，实现不应在求值时分配内存。
+ */
+class LineSearchProblem {
+public:
+    virtual ~LineSearchProblem() = default;
+
+    /**
+     * 方程数量m。
+     */
+    virtual int Rows() const noexcept = 0;
+
+    /**
+     * 未知量数量n。
+     */
+    virtual int Cols() const noexcept = 0;
+
+    /**
+     * 计算F(x)，写入f。x的长度为Cols()，f的长度为Rows()。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    virtual void Residual(const double *x, double *f) = 0;
+
+    /**
+     * 计算雅可比矩阵，按行优先的顺序写入J，J的长度为Rows()*Cols()。
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    virtual void Jacobian(const double *x, double *J) = 0;
+};
+
+/**
+ * 一维搜索的工作区。第一次使用时按问题的规模分配，之后重复使用同一个工作区不再分配内存。
+ */
+struct LineSearchWorkspace {
+    std::vector<double> x; // 试探点
+    std::vector<double> f; // 试探点的F
+    std::vector<double> J; // 试探点的雅可比矩阵
+};
+
+/**
+ * 一维搜索策略。通过MakeLineSearch()按Config::Get().lineSearchMethod创建。
+ */
+class LineSearch {
+public:
+    virtual ~LineSearch() = default;
+
+    /**
+     * 从x出发沿方向d搜索步长alpha。x与d的长度为problem.Cols()。
+     * phi0为0.5 * ||F(x)||^2，dphi0为phi'(0) = (J(x)^T F(x))·d，由调用者传入，不再重复求值。
+     * d不是下降方向（dphi0 >= 0）时，只要求价值函数严格下降。
+     * 返回满足条件的步长；尝试Config::Get().maxLineSearchSteps次仍找不到时返回0，由调用者决定如何处理（例如增大阻尼）。
+     * 求值时出现浮点数无效值的试探点视为不满足条件。
+     */
+    virtual double Search(LineSearchProblem &problem, const double *x, const double *d, double phi0, double dphi0,
+                          LineSearchWorkspace &ws) = 0;
+
+    /**
+     * 开始新的求解时调用，清除保存的历史（例如非单调搜索的价值函数记录）。
+     */
+    virtual void Reset() noexcept {}
+};
+
+/**
+ * 回溯Armijo搜索：alpha从1开始按比例缩小，直到 phi(alpha) <= phi(0) + c1 * alpha * phi'(0)。
+ */
+class ArmijoLineSearch : public LineSearch {
+public:
+    double c1 = 1.0e-4;
+    double shrink = 0.5; // 每次回溯alpha缩小的比例，取值范围(0, 1)
+
+    double Search(LineSearchProblem &problem, const double *x, const double *d, double phi0, double dphi0,
+                  LineSearchWorkspace &ws) override;
+};
+
+/**
+ * 强Wolfe条件搜索（Nocedal & Wright算法3.5、3.6）：
+ *      phi(alpha) <= phi(0) + c1 * alpha * phi'(0)，且 |phi'(alpha)| <= c2 * |phi'(0)|。
+ * alpha从1开始，需要时外推，再在区间内以二次插值缩小。每个试探点都要计算雅可比矩阵，
+ * 但得到的步长更接近一维极小点，适合病态、迭代次数多的方程组。
+ */
+class StrongWolfeLineSearch : public LineSearch {
+public:
+    double c1 = 1.0e-4;
+    double c2 = 0.9;
+    double maxAlpha = 16; // 外推的上限
+
+    double Search(LineSearchProblem &problem, const double *x, const double *d, double phi0, double dphi0,
+                  LineSearchWorkspace &ws) override;
+};
+
+/**
+ * 非单调回溯搜索（Grippo-Lampariello-Lucidi）：与最近memory次搜索起点的价值函数的最大值比较，
+ *      phi(alpha) <= max(phi_k, phi_k-1, ..., phi_k-memory+1) + c1 * alpha * phi'(0)。
+ * 允许价值函数暂时上升，可以穿过狭长的弯曲谷底，避免步长被压得过小。
+ */
+class NonMonotoneLineSearch : public LineSearch {
+public:
+    double c1 = 1.0e-4;
+    double shrink = 0.5;
+
+    /**
+     * @param memory 参与比较的历史记录数量，至少为1。为1时即ArmijoLineSearch。
+     */
+    explicit NonMonotoneLineSearch(int memory = 10);
+
+    double Search(LineSearchProblem &problem, const double *x, const double *d, double phi0, double dphi0,
+                  LineSearchWorkspace &ws) override;
+
+    void Reset() noexcept override;
+
+private:
+    std::vector<double> history; // 环形缓冲区
+    std::size_t count = 0;       // 已经记录的数量
+};
+
+/**
+ * 按method创建一维搜索策略。NON_MONOTONE使用Config::Get().nonMonotoneMemory。
+ */
+std::unique_ptr<LineSearch> MakeLineSearch(LineSearchMethod method);
+
+} // namespace tomsolver
@@ -3,7 +3,10 @@
 #include "config.h"
 #include "error_type.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <limits>
 #include <vector>
 
 namespace tomsolver {
@@ -140,4 +143,81 @@ Vec SolveLinear(Mat A, Vec b) {
     return ret;
 }
 
+Vec SolveLinearMixedPrecision(const Mat &A, const Vec &b) {
+    int n = A.Rows();
+    assert(n == b.Rows());
+    if (A.Cols() != n) {
+        return SolveLinear(A, b);
+    }
+
+    // float的LU分解
+    std::vector<float> LU(n * n);
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            LU[i * n + j] = static_cast<float>(A.Value(i, j));
+        }
+    }
+    std::vector<int> perm(n);
+    if (!std::all_of(LU.begin(), LU.end(),
+                     [](float v) {
+                         return std::isfinite(v);
+                     }) ||
+        !internal::LuDecompose(n, LU.data(), perm.data(), static_cast<float>(Config::Get().epsilon))) {
+        return SolveLinear(A, b);
+    }
+
+    // 以double迭代改进：r = b - Ax，解LU*d = r，x += d。
+    // 收敛条件与LAPACK的dsgesv一致：|r| <= |x|*|A|*eps*sqrt(n)，均为无穷范数
+    double normA = 0;
+    for (int i = 0; i < n; ++i) {
+        double sum = 0;
+        for (int j = 0; j < n; ++j) {
+            sum += std::abs(A.Value(i, j));
+        }
+        normA = std::max(normA, sum);
+    }
+    auto threshold = normA * std::numeric_limits<double>::epsilon() * std::sqrt(static_cast<double>(n));
+
+    constexpr int maxRefinements = 30;
+    std::vector<double> x(n), r(n);
+    for (int i = 0; i < n; ++i) {
+        x[i] = b[i];
+    }
+    internal::LuSolve(n, LU.data(), perm.data(), x.data());
+    auto prevNormR = std::numeric_limits<double>::infinity();
+    for (int it = 0; it < maxRefinements; ++it) {
+        double normR = 0, normX = 0;
+        for (int i = 0; i < n; ++i) {
+            double sum = b[i];
+            for (int j = 0; j < n; ++j) {
+                sum -= A.Value(i, j) * x[j];
+            }
+            r[i] = sum;
+            normR = std::max(normR, std::abs(sum));
+            normX = std::max(normX, std::abs(x[i]));
+        }
+
+        if (normR <= normX * threshold) {
+            Vec ret(n);
+            for (int i = 0; i < n; ++i) {
+                ret[i] = x[i];
+            }
+            return ret;
+        }
+
+        // 残差不再下降：A的条件数对于float过大，改进不会收敛
+        if (!(normR < prevNormR)) {
+            break;
+        }
+        prevNormR = normR;
+
+        internal::LuSolve(n, LU.data(), perm.data(), r.data());
+        for (int i = 0; i < n; ++i) {
+            x[i] += r[i];
+        }
+    }
+
+    return SolveLinear(A, b);
+}
+
 } // namespace tomsolver
\ No newline at end of file
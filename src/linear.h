@@ -2,6 +2,10 @@
 
 #include "mat.h"
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 namespace tomsolver {
 
 /**
@@ -13,4 +17,74 @@ namespace tomsolver {
  */
 Vec SolveLinear(Mat A, Vec b);
 
+/**
+ * 混合精度求解线性方程组Ax = b：以float做LU分解，再以double迭代改进（iterative refinement）。
+ * 分解的开销与访存量约为double的一半，A的条件数不太大时结果与SolveLinear()同样精确。
+ * A不是方阵、float分解失败（主元过小或超出float的范围），或者改进过程停滞（残差不再下降）时，退回SolveLinear()。
+ * @exception MathError 同SolveLinear()
+ */
+Vec SolveLinearMixedPrecision(const Mat &A, const Vec &b);
+
+namespace internal {
+
+/**
+ * 以标量类型T对n阶方阵A做列主元LU分解。A按行优先存放，结果原地写回：
+ * 严格下三角部分为L（对角线为1，不存储），上三角部分为U。perm记录行交换，第i行分解前是原来的第perm[i]行。
+ * 主元的绝对值不大于tiny时返回false，此时A的内容无意义。
+ */
+template <typename T>
+bool LuDecompose(int n, T *A, int *perm, T tiny) noexcept {
+    for (int i = 0; i < n; ++i) {
+        perm[i] = i;
+    }
+    for (int k = 0; k < n; ++k) {
+        int p = k;
+        for (int i = k + 1; i < n; ++i) {
+            if (std::abs(A[i * n + k]) > std::abs(A[p * n + k])) {
+                p = i;
+            }
+        }
+        if (!(std::abs(A[p * n + k]) > tiny)) {
+            return false;
+        }
+        if (p != k) {
+            std::swap_ranges(A + p * n, A + p * n + n, A + k * n);
+            std::swap(perm[p], perm[k]);
+        }
+        for (int i = k + 1; i < n; ++i) {
+            auto ratio = A[i * n + k] / A[k * n + k];
+            A[i * n + k] = ratio;
+            for (int j = k + 1; j < n; ++j) {
+                A[i * n + j] -= ratio * A[k * n + j];
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * 用LuDecompose()的结果求解Ax = b。b原地替换为x。
+ * LU与b的标量类型可以不同，例如用float的分解求解double的方程。
+ */
+template <typename T, typename U>
+void LuSolve(int n, const T *LU, const int *perm, U *b) {
+    std::vector<U> y(b, b + n);
+    for (int i = 0; i < n; ++i) {
+        auto sum = y[perm[i]];
+        for (int j = 0; j < i; ++j) {
+            sum -= static_cast<U>(LU[i * n + j]) * b[j];
+        }
+        b[i] = sum;
+    }
+    for (int i = n - 1; i >= 0; --i) {
+        auto sum = b[i];
+        for (int j = i + 1; j < n; ++j) {
+            sum -= static_cast<U>(LU[i * n + j]) * b[j];
+        }
+        b[i] = sum / static_cast<U>(LU[i * n + i]);
+    }
+}
+
+} // namespace internal
+
 } // namespace tomsolver
@@ -0,0 +1,68 @@
+#include "mapped_file.h"
+
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace tomsolver {
+
+MappedFile::MappedFile(const std::string &filename) {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("can not open file: " + filename);
+    }
+    std::shared_ptr<void> closeFile(nullptr, [fd](...) {
+        close(fd);
+    });
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        throw std::runtime_error("can not stat file: " + filename);
+    }
+    size = static_cast<std::size_t>(st.st_size);
+    if (size == 0) {
+        return;
+    }
+
+    auto addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error("can not map file: " + filename);
+    }
+    data = static_cast<const char *>(addr);
+#else
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("can not open file: " + filename);
+    }
+    buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    size = buffer.size();
+    data = size ? buffer.data() : nullptr;
+#endif
+}
+
+MappedFile::~MappedFile() {
+#if defined(__unix__) || defined(__APPLE__)
+    if (data) {
+        munmap(const_cast<char *>(data), size);
+    }
+#endif
+}
+
+const char *MappedFile::Data() const noexcept {
+    return data;
+}
+
+std::size_t MappedFile::Size() const noexcept {
+    return size;
+}
+
+} // namespace tomsolver
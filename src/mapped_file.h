@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace tomsolver {
+
+/**
+ * 只读地映射整个文件。在unix与macOS上使用mmap，数据直接来自页缓存，不复制；其他平台上读入内存。
+ * 析构时解除映射。不可复制。
+ */
+class MappedFile {
+public:
+    /**
+     * @exception runtime_error 无法打开或者映射文件
+     */
+    explicit MappedFile(const std::string &filename);
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile();
+
+    /**
+     * 文件内容。空文件时为nullptr。
+     */
+    const char *Data() const noexcept;
+
+    std::size_t Size() const noexcept;
+
+private:
+    const char *data = nullptr;
+    std::size_t size = 0;
+    std::string buffer; // 不支持mmap的平台上保存文件内容
+};
+
+} // namespace tomsolver
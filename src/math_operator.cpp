@@ -271,104 +271,28 @@ bool IsFunction(MathOperator op) noexcept {
 }
 
 double Calc(MathOperator op, double v1, double v2) {
-    double ret = std::numeric_limits<double>::quiet_NaN();
-    switch (op) {
-    case MathOperator::MATH_SIN:
-        ret = std::sin(v1);
-        break;
-    case MathOperator::MATH_COS:
-        ret = std::cos(v1);
-        break;
-    case MathOperator::MATH_TAN:
-        ret = std::tan(v1);
-        break;
-    case MathOperator::MATH_ARCSIN:
-        ret = std::asin(v1);
-        break;
-    case MathOperator::MATH_ARCCOS:
-        ret = std::acos(v1);
-        break;
-    case MathOperator::MATH_ARCTAN:
-        ret = std::atan(v1);
-        break;
-    case MathOperator::MATH_SQRT:
-        ret = std::sqrt(v1);
-        break;
-    case MathOperator::MATH_LOG:
-        ret = std::log(v1);
-        break;
-    case MathOperator::MATH_LOG2:
-        ret = std::log2(v1);
-        break;
-    case MathOperator::MATH_LOG10:
-        ret = std::log10(v1);
-        break;
-    case MathOperator::MATH_EXP:
-        ret = std::exp(v1);
-        break;
-    case MathOperator::MATH_POSITIVE:
-        ret = v1;
-        break;
-    case MathOperator::MATH_NEGATIVE:
-        ret = -v1;
-        break;
-
-    case MathOperator::MATH_MOD: //%
-        ret = (int)v1 % (int)v2;
-        break;
-    case MathOperator::MATH_AND: //&
-        ret = (int)v1 & (int)v2;
-        break;
-    case MathOperator::MATH_OR: //|
-        ret = (int)v1 | (int)v2;
-        break;
+    return CalcAs<double>(op, v1, v2);
+}
 
-    case MathOperator::MATH_POWER: //^
-        ret = std::pow(v1, v2);
-        break;
+namespace internal {
 
-    case MathOperator::MATH_ADD:
-        ret = v1 + v2;
+void ThrowInvalidValue(MathOperator op, double v1, double v2) {
+    std::stringstream info;
+    info << "expression: \"";
+    switch (GetOperatorNum(op)) {
+    case 1:
+        info << MathOperatorToStr(op) << " " << ToString(v1);
         break;
-    case MathOperator::MATH_SUB:
-        ret = v1 - v2;
-        break;
-    case MathOperator::MATH_MULTIPLY:
-        ret = v1 * v2;
-        break;
-    case MathOperator::MATH_DIVIDE:
-        ret = v1 / v2;
+    case 2:
+        info << ToString(v1) << " " << MathOperatorToStr(op) << " " << ToString(v2);
         break;
     default:
-        assert(0 && "[Calc] bug.");
-        break;
-    }
-
-    if (Config::Get().throwOnInvalidValue == false) {
-        return ret;
-    }
-
-    bool isInvalid = (ret == std::numeric_limits<double>::infinity()) ||
-                     (ret == -std::numeric_limits<double>::infinity()) || (ret != ret);
-    if (isInvalid) {
-        // std::string info;
-        std::stringstream info;
-        info << "expression: \"";
-        switch (GetOperatorNum(op)) {
-        case 1:
-            info << MathOperatorToStr(op) << " " << ToString(v1);
-            break;
-        case 2:
-            info << ToString(v1) << " " << MathOperatorToStr(op) << " " << ToString(v2);
-            break;
-        default:
-            assert(0);
-        }
-        info << "\"";
-        throw MathError(ErrorType::ERROR_INVALID_NUMBER, info.str());
+        assert(0);
     }
-
-    return ret;
+    info << "\"";
+    throw MathError(ErrorType::ERROR_INVALID_NUMBER, info.str());
 }
 
+} // namespace internal
+
 } // namespace tomsolver
\ No newline at end of file
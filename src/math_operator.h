@@ -1,5 +1,11 @@
 #pragma once
 
+#include "config.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 #include <string>
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -18,7 +24,7 @@ T degrees(T &&t) noexcept {
     return std::forward<T>(t) * 180.0 / PI;
 }
 
-enum class MathOperator {
+enum class MathOperator : std::uint8_t {
     MATH_NULL,
     // 一元
     MATH_POSITIVE,
@@ -90,4 +96,100 @@ bool IsIntAndEven(double n) noexcept;
 
 double Calc(MathOperator op, double v1, double v2);
 
+namespace internal {
+
+/**
+ * 抛出表示op(v1, v2)出现浮点数无效值的MathError。
+ */
+[[noreturn]] void ThrowInvalidValue(MathOperator op, double v1, double v2);
+
+} // namespace internal
+
+/**
+ * 以标量类型T（float、double、long double）计算op(v1, v2)，一元运算时忽略v2。
+ * 数学函数调用std::中T对应的重载，计算全程保持T的精度。Calc()即CalcAs<double>()。
+ * @exception MathError Config::Get().throwOnInvalidValue为true时，出现浮点数无效值(inf, -inf, nan)
+ */
+template <typename T>
+T CalcAs(MathOperator op, T v1, T v2) {
+    T ret = std::numeric_limits<T>::quiet_NaN();
+    switch (op) {
+    case MathOperator::MATH_SIN:
+        ret = std::sin(v1);
+        break;
+    case MathOperator::MATH_COS:
+        ret = std::cos(v1);
+        break;
+    case MathOperator::MATH_TAN:
+        ret = std::tan(v1);
+        break;
+    case MathOperator::MATH_ARCSIN:
+        ret = std::asin(v1);
+        break;
+    case MathOperator::MATH_ARCCOS:
+        ret = std::acos(v1);
+        break;
+    case MathOperator::MATH_ARCTAN:
+        ret = std::atan(v1);
+        break;
+    case MathOperator::MATH_SQRT:
+        ret = std::sqrt(v1);
+        break;
+    case MathOperator::MATH_LOG:
+        ret = std::log(v1);
+        break;
+    case MathOperator::MATH_LOG2:
+        ret = std::log2(v1);
+        break;
+    case MathOperator::MATH_LOG10:
+        ret = std::log10(v1);
+        break;
+    case MathOperator::MATH_EXP:
+        ret = std::exp(v1);
+        break;
+    case MathOperator::MATH_POSITIVE:
+        ret = v1;
+        break;
+    case MathOperator::MATH_NEGATIVE:
+        ret = -v1;
+        break;
+
+    case MathOperator::MATH_MOD: //%
+        ret = static_cast<T>(static_cast<int>(v1) % static_cast<int>(v2));
+        break;
+    case MathOperator::MATH_AND: //&
+        ret = static_cast<T>(static_cast<int>(v1) & static_cast<int>(v2));
+        break;
+    case MathOperator::MATH_OR: //|
+        ret = static_cast<T>(static_cast<int>(v1) | static_cast<int>(v2));
+        break;
+
+    case MathOperator::MATH_POWER: //^
+        ret = std::pow(v1, v2);
+        break;
+
+    case MathOperator::MATH_ADD:
+        ret = v1 + v2;
+        break;
+    case MathOperator::MATH_SUB:
+        ret = v1 - v2;
+        break;
+    case MathOperator::MATH_MULTIPLY:
+        ret = v1 * v2;
+        break;
+    case MathOperator::MATH_DIVIDE:
+        ret = v1 / v2;
+        break;
+    default:
+        assert(0 && "[Calc] bug.");
+        break;
+    }
+
+    if (Config::Get().throwOnInvalidValue && !std::isfinite(ret)) {
+        internal::ThrowInvalidValue(op, static_cast<double>(v1), static_cast<double>(v2));
+    }
+
+    return ret;
+}
+
 } // namespace tomsolver
\ No newline at end of file
@@ -0,0 +1,218 @@
+#include "multistart.h"
+
+#include "config.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+namespace tomsolver {
+
+namespace internal {
+
+/**
+ * Sobol序列一个维度的本原多项式与初始方向数，来自Joe & Kuo的new-joe-kuo-6.21201。
+ * s为多项式的次数，a为中间项的系数（按位），m为s个初始方向数。
+ */
+struct SobolDirection {
+    int s;
+    std::uint32_t a;
+    std::uint32_t m[7];
+};
+
+// 第一维是van der Corput序列，不需要方向数，从第二维开始
+const SobolDirection SobolDirections[SobolMaxDim - 1] = {
+    {1, 0, {1}},
+    {2, 1, {1, 3}},
+    {3, 1, {1, 3, 1}},
+    {3, 2, {1, 1, 1}},
+    {4, 1, {1, 1, 3, 3}},
+    {4, 4, {1, 3, 5, 13}},
+    {5, 2, {1, 1, 5, 5, 17}},
+    {5, 4, {1, 1, 5, 5, 5}},
+    {5, 7, {1, 1, 7, 11, 19}},
+    {5, 11, {1, 1, 5, 1, 1}},
+    {5, 13, {1, 1, 1, 3, 11}},
+    {5, 14, {1, 3, 5, 5, 31}},
+    {6, 1, {1, 3, 3, 9, 7, 49}},
+    {6, 13, {1, 1, 1, 15, 21, 21}},
+    {6, 16, {1, 3, 1, 13, 27, 49}},
+    {6, 19, {1, 1, 1, 15, 7, 5}},
+    {6, 22, {1, 3, 1, 15, 13, 25}},
+    {6, 25, {1, 1, 5, 5, 19, 61}},
+    {7, 1, {1, 3, 7, 11, 23, 15, 103}},
+    {7, 4, {1, 3, 7, 13, 13, 15, 69}},
+};
+
+Mat LatinHypercube(int n, int dim, std::uint32_t seed) {
+    std::mt19937 engine(seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::vector<int> perm(n);
+    Mat ret(n, dim);
+    for (int j = 0; j < dim; ++j) {
+        std::iota(perm.begin(), perm.end(), 0);
+        std::shuffle(perm.begin(), perm.end(), engine);
+        for (int i = 0; i < n; ++i) {
+            // 防止舍入后等于1
+            ret.Value(i, j) = std::min((perm[i] + uniform(engine)) / n, std::nextafter(1.0, 0.0));
+        }
+    }
+    return ret;
+}
+
+Mat SobolSequence(int n, int dim) {
+    if (dim > SobolMaxDim) {
+        throw std::runtime_error("SobolSequence: at most " + std::to_string(SobolMaxDim) + " dimensions, got " +
+                                 std::to_string(dim));
+    }
+
+    // 每一维32个方向数，V[k]的最高位对应2^-(k+1)
+    std::vector<std::uint32_t> V(static_cast<std::size_t>(dim) * 32);
+    for (int j = 0; j < dim; ++j) {
+        auto v = V.begin() + j * 32;
+        if (j == 0) {
+            for (int k = 0; k < 32; ++k) {
+                v[k] = 1u << (31 - k);
+            }
+            continue;
+        }
+        auto &dir = SobolDirections[j - 1];
+        for (int k = 0; k < 32; ++k) {
+            if (k < dir.s) {
+                v[k] = dir.m[k] << (31 - k);
+                continue;
+            }
+            v[k] = v[k - dir.s] ^ (v[k - dir.s] >> dir.s);
+            for (int i = 1; i < dir.s; ++i) {
+                if ((dir.a >> (dir.s - 1 - i)) & 1) {
+                    v[k] ^= v[k - i];
+                }
+            }
+        }
+    }
+
+    // Gray码顺序：第i个点由第i-1个点异或上i-1最低的0位对应的方向数得到
+    Mat ret(n, dim);
+    std::vector<std::uint32_t> x(dim, 0);
+    for (int i = 0; i < n; ++i) {
+        if (i > 0) {
+            int c = 0;
+            for (auto value = static_cast<std::uint32_t>(i - 1); value & 1; value >>= 1) {
+                ++c;
+            }
+            for (int j = 0; j < dim; ++j) {
+                x[j] ^= V[j * 32 + c];
+            }
+        }
+        for (int j = 0; j < dim; ++j) {
+            ret.Value(i, j) = std::ldexp(static_cast<double>(x[j]), -32);
+        }
+    }
+    return ret;
+}
+
+} // namespace internal
+
+MultiStartResult SolveMultiStart(const PreparedSystem &system, const VarsTable &lower, const VarsTable &upper,
+                                 int maxRoots) {
+    if (lower.Vars() != system.vars || upper.Vars() != system.vars) {
+        throw std::runtime_error("SolveMultiStart: the variables of bounds do not match the prepared system");
+    }
+    int dim = lower.VarNums();
+    for (int j = 0; j < dim; ++j) {
+        if (!(lower.Values()[j] <= upper.Values()[j])) {
+            throw std::runtime_error("SolveMultiStart: lower bound of " + system.vars[j] +
+                                     " is greater than upper bound");
+        }
+    }
+
+    auto &config = Config::Get();
+    int count = std::max(config.multiStartCount, 1);
+    Mat samples = config.multiStartSampling == SamplingMethod::SOBOL
+                      ? internal::SobolSequence(count, dim)
+                      : internal::LatinHypercube(count, dim, config.multiStartSeed);
+    auto tolerance = config.rootTolerance;
+
+    struct Root {
+        int start; // 最早找到它的起点的序号
+        VarsTable table;
+    };
+    std::vector<Root> roots;
+    int starts = 0, converged = 0;
+    std::mutex mutex;
+    std::atomic<bool> stop{false};
+
+    auto sameRoot = [dim, tolerance](const Vec &a, const Vec &b) {
+        for (int j = 0; j < dim; ++j) {
+            if (!(std::abs(a[j] - b[j]) <= tolerance * std::max(1.0, std::abs(b[j])))) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    internal::ParallelFor(count, [&](int begin, int end) {
+        for (int i = begin; i < end && !stop; ++i) {
+            Vec x(dim);
+            for (int j = 0; j < dim; ++j) {
+                auto lo = lower.Values()[j], hi = upper.Values()[j];
+                x[j] = lo + samples.Value(i, j) * (hi - lo);
+            }
+            VarsTable init(system.vars, 0);
+            init.SetValues(x);
+
+            bool ok = true;
+            VarsTable table = init;
+            try {
+                table = Solve(init, system);
+            } catch (const std::exception &) {
+                // 不收敛、雅可比矩阵奇异或者出现无效值，跳过这个起点
+                ok = false;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            ++starts;
+            if (!ok) {
+                continue;
+            }
+            ++converged;
+            auto it = std::find_if(roots.begin(), roots.end(), [&](const Root &root) {
+                return sameRoot(table.Values(), root.table.Values());
+            });
+            if (it == roots.end()) {
+                roots.push_back({i, std::move(table)});
+            } else if (i < it->start) {
+                it->start = i;
+                it->table = std::move(table);
+            }
+            if (maxRoots > 0 && static_cast<int>(roots.size()) >= maxRoots) {
+                stop = true;
+            }
+        }
+    });
+
+    std::sort(roots.begin(), roots.end(), [](const Root &a, const Root &b) {
+        return a.start < b.start;
+    });
+    MultiStartResult result;
+    for (auto &root : roots) {
+        result.roots.emplace_back(std::move(root.table));
+    }
+    result.starts = starts;
+    result.converged = converged;
+    return result;
+}
+
+MultiStartResult SolveMultiStart(const SymVec &equations, const VarsTable &lower, const VarsTable &upper,
+                                 int maxRoots) {
+    return SolveMultiStart(Prepare(equations, lower.Vars()), lower, upper, maxRoots);
+}
+
+} // namespace tomsolver
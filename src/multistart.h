@@ -0,0 +1,59 @@
+#pragma once
+
+#include "mat.h"
+#include "nonlinear.h"
+#include "symmat.h"
+#include "vars_table.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace tomsolver {
+
+/**
+ * 多起点求解的结果。
+ */
+struct MultiStartResult {
+    std::vector<VarsTable> roots; // 去重后的根，按找到它的起点的序号排列
+    int starts = 0;               // 实际求解的起点数量（提前结束时小于起点总数）
+    int converged = 0;            // 收敛的起点数量
+};
+
+/**
+ * 多起点求解预处理好的方程组system。
+ * 在lower、upper给出的区间内按Config::Get().multiStartSampling生成Config::Get().multiStartCount个初值，
+ * 以最多Config::Get().threadNum个线程分别求解（方法与Solve()相同），不收敛或者出现异常的起点直接跳过。
+ * 各分量之差都不超过Config::Get().rootTolerance * max(1, |x|)的根视为同一个根。
+ * maxRoots大于0时，找到maxRoots个不同的根后不再开始新的起点；多线程时已经开始的起点仍会完成，结果可能多于maxRoots个。
+ * @param lower 每个变量的下界，变量的顺序必须与system.vars一致
+ * @param upper 每个变量的上界，变量的顺序必须与system.vars一致
+ * @exception runtime_error 变量不一致，下界大于上界，或者SOBOL序列的维数超出支持的范围
+ */
+MultiStartResult SolveMultiStart(const PreparedSystem &system, const VarsTable &lower, const VarsTable &upper,
+                                 int maxRoots = 0);
+
+/**
+ * 多起点求解方程组equations，变量及其顺序由lower给出。先以Prepare()预处理，其余同上。
+ */
+MultiStartResult SolveMultiStart(const SymVec &equations, const VarsTable &lower, const VarsTable &upper,
+                                 int maxRoots = 0);
+
+namespace internal {
+
+/**
+ * 在单位超立方体[0, 1)^dim中生成n个拉丁超立方采样点，返回n行dim列的矩阵。
+ * 每一列的n个值恰好分别落在n个等分区间内。
+ */
+Mat LatinHypercube(int n, int dim, std::uint32_t seed);
+
+/**
+ * Sobol低差异序列（Joe-Kuo方向数）的前n个点，第一个点为原点。返回n行dim列的矩阵，dim最大为SobolMaxDim。
+ * @exception runtime_error dim超出范围
+ */
+Mat SobolSequence(int n, int dim);
+
+constexpr int SobolMaxDim = 21;
+
+} // namespace internal
+
+} // namespace tomsolver
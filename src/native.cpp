@@ -0,0 +1,178 @@
+#include "native.h"
+
+#include "codegen.h"
+#include "compiled.h"
+#include "config.h"
+#include "error_type.h"
+
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+namespace tomsolver {
+
+namespace {
+
+// FNV-1a。共享库的文件名要在不同进程、不同编译器之间保持稳定，不能使用std::hash
+std::uint64_t HashSource(const std::string &str) noexcept {
+    std::uint64_t hash = 14695981039346656037ull;
+    for (auto c : str) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string NativeCacheDir() {
+    if (!Config::Get().nativeCacheDir.empty()) {
+        return Config::Get().nativeCacheDir;
+    }
+    auto tmpdir = std::getenv("TMPDIR");
+    return tmpdir && *tmpdir ? tmpdir : "/tmp";
+}
+
+bool FileExists(const std::string &path) {
+    return std::ifstream(path).good();
+}
+
+// 检查求值结果，出现无效值时按Config::Get().throwOnInvalidValue抛出异常
+void CheckNativeResult(const Mat &m, const char *what) {
+    if (!Config::Get().throwOnInvalidValue) {
+        return;
+    }
+    for (int i = 0; i < m.Rows(); ++i) {
+        for (int j = 0; j < m.Cols(); ++j) {
+            if (!std::isfinite(m.Value(i, j))) {
+                std::stringstream ss;
+                ss << "NativeModel: " << what << "(" << i << ", " << j << ") = " << m.Value(i, j);
+                throw MathError(ErrorType::ERROR_INVALID_NUMBER, ss.str());
+            }
+        }
+    }
+}
+
+} // namespace
+
+NativeModel::NativeModel(const SymVec &equations, const std::vector<std::string> &vars)
+    : NativeModel(equations, Jacobian(equations, vars), vars) {}
+
+NativeModel::NativeModel(const SymVec &equations, const SymMat &jaEqs, const std::vector<std::string> &vars)
+    : rows(equations.Rows()), vars(vars) {
+#if defined(__unix__) || defined(__APPLE__)
+    std::string source = "// Generated by TomSolver. Do not edit.\n#include <cmath>\n\n";
+    source += GenerateFunction(CompiledSymMat(equations, vars), "tomsolver_residual", "f") + "\n";
+    source += GenerateFunction(CompiledSymMat(jaEqs, vars), "tomsolver_jacobian", "J");
+
+    // 编译选项也参与哈希，更换编译器后不会误用旧的共享库
+    const std::string flags = " -O2 -shared -fPIC";
+    auto &compiler = Config::Get().nativeCompiler;
+    std::stringstream name;
+    name << NativeCacheDir() << "/tomsolver_" << std::hex << std::setw(16) << std::setfill('0')
+         << HashSource(compiler + flags + "\n" + source);
+    path = name.str() + ".so";
+
+    auto load = [this] {
+        auto lib = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!lib) {
+            return false;
+        }
+        handle.reset(lib, [](void *lib) {
+            dlclose(lib);
+        });
+        residual = reinterpret_cast<Function>(dlsym(lib, "tomsolver_residual"));
+        jacobian = reinterpret_cast<Function>(dlsym(lib, "tomsolver_jacobian"));
+        return residual && jacobian;
+    };
+
+    if (FileExists(path) && load()) {
+        return;
+    }
+
+    // 先编译到临时文件，再改名为最终的文件名。改名是原子的，其他进程、线程不会加载到写了一半的共享库
+    static std::atomic<int> counter{0};
+    auto tmp = name.str() + "." + std::to_string(getpid()) + "." + std::to_string(counter++);
+    {
+        std::ofstream out(tmp + ".cpp");
+        out << source;
+        if (!out) {
+            throw std::runtime_error("NativeModel: can not write " + tmp + ".cpp");
+        }
+    }
+    auto command = compiler + flags + " -o '" + tmp + ".so' '" + tmp + ".cpp'";
+    auto ret = std::system(command.c_str());
+    std::remove((tmp + ".cpp").c_str());
+    if (ret != 0) {
+        std::remove((tmp + ".so").c_str());
+        throw std::runtime_error("NativeModel: compile failed: " + command);
+    }
+    if (std::rename((tmp + ".so").c_str(), path.c_str()) != 0) {
+        std::remove((tmp + ".so").c_str());
+        throw std::runtime_error("NativeModel: can not create " + path);
+    }
+
+    if (!load()) {
+        throw std::runtime_error("NativeModel: can not load " + path);
+    }
+#else
+    (void)jaEqs;
+    throw std::runtime_error("NativeModel: not supported on this platform");
+#endif
+}
+
+bool NativeModel::IsSupported() noexcept {
+#if defined(__unix__) || defined(__APPLE__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+int NativeModel::Rows() const noexcept {
+    return rows;
+}
+
+const std::vector<std::string> &NativeModel::Vars() const noexcept {
+    return vars;
+}
+
+const std::string &NativeModel::Path() const noexcept {
+    return path;
+}
+
+void NativeModel::EvalResidual(const double *x, double *f) const noexcept {
+    residual(x, f);
+}
+
+void NativeModel::EvalJacobian(const double *x, double *J) const noexcept {
+    jacobian(x, J);
+}
+
+Mat NativeModel::EvalResidual(const Vec &x) const {
+    assert(x.Rows() == static_cast<int>(vars.size()));
+    Mat ret(rows, 1);
+    residual(vars.empty() ? nullptr : &x.Value(0, 0), &ret.Value(0, 0));
+    CheckNativeResult(ret, "residual");
+    return ret;
+}
+
+Mat NativeModel::EvalJacobian(const Vec &x) const {
+    assert(x.Rows() == static_cast<int>(vars.size()));
+    Mat ret(rows, static_cast<int>(vars.size()));
+    jacobian(vars.empty() ? nullptr : &x.Value(0, 0), &ret.Value(0, 0));
+    CheckNativeResult(ret, "jacobian");
+    return ret;
+}
+
+} // namespace tomsolver
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "mat.h"
+#include "symmat.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tomsolver {
+
+/**
+ * 编译为本地代码的方程组模型。
+ * 构造时用GenerateFunction()生成方程组与雅可比矩阵的C++源码，调用系统编译器（Config::Get().nativeCompiler）
+ * 编译为共享库，再用dlopen加载，求值时直接调用函数指针。
+ * 共享库以源码与编译命令的哈希值命名，存放在Config::Get().nativeCacheDir中，相同的模型只编译一次，之后的进程直接加载。
+ * 仅支持POSIX平台。构造完成后不可修改，求值函数可以在多个线程中同时调用。
+ */
+class NativeModel {
+public:
+    /**
+     * 编译方程组equations，变量按vars的顺序传入。
+     * @exception runtime_error 平台不支持，equations中出现了vars以外的变量，编译失败或者加载失败
+     */
+    NativeModel(const SymVec &equations, const std::vector<std::string> &vars);
+
+    /**
+     * 同上，使用已经求好的雅可比矩阵jaEqs，不再重复求导。
+     */
+    NativeModel(const SymVec &equations, const SymMat &jaEqs, const std::vector<std::string> &vars);
+
+    /**
+     * 当前平台是否支持编译为本地代码。
+     */
+    static bool IsSupported() noexcept;
+
+    /**
+     * 方程数量。
+     */
+    int Rows() const noexcept;
+
+    const std::vector<std::string> &Vars() const noexcept;
+
+    /**
+     * 共享库的路径。
+     */
+    const std::string &Path() const noexcept;
+
+    /**
+     * 计算方程组的值，写入f，f的长度至少为Rows()。不检查浮点数无效值。
+     */
+    void EvalResidual(const double *x, double *f) const noexcept;
+
+    /**
+     * 计算雅可比矩阵，按行优先的顺序写入J，J的长度至少为Rows()*Vars().size()。不检查浮点数无效值。
+     */
+    void EvalJacobian(const double *x, double *J) const noexcept;
+
+    /**
+     * 计算方程组的值，返回Rows()行1列的矩阵。
+     * @exception MathError Config::Get().throwOnInvalidValue为true时，结果中出现浮点数无效值(inf, -inf, nan)
+     */
+    Mat EvalResidual(const Vec &x) const;
+
+    /**
+     * 计算雅可比矩阵。
+     * @exception MathError Config::Get().throwOnInvalidValue为true时，结果中出现浮点数无效值(inf, -inf, nan)
+     */
+    Mat EvalJacobian(const Vec &x) const;
+
+private:
+    using Function = void (*)(const double *x, double *out);
+
+    int rows;
+    std::vector<std::string> vars;
+    std::string path;
+    std::shared_ptr<void> handle; // dlopen返回的句柄，最后一个副本析构时dlclose
+    Function residual = nullptr;
+    Function jacobian = nullptr;
+};
+
+} // namespace tomsolver
@@ -2,8 +2,10 @@
 
 #include "config.h"
 #include "math_operator.h"
+#include "vars_table.h"
 
 #include <cassert>
+#include <cstring>
 #include <forward_list>
 #include <functional>
 #include <iostream>
@@ -142,6 +144,53 @@ double NodeImpl::Vpa() const {
     return VpaNonRecursively();
 }
 
+// 后序遍历。非递归实现。
+double NodeImpl::Vpa(const VarsTable &varsTable) const {
+    // 第二项表示该节点的子节点是否已经入栈
+    std::vector<std::pair<const NodeImpl *, bool>> stk;
+    std::vector<double> calcStk;
+
+    stk.emplace_back(this, false);
+    while (!stk.empty()) {
+        auto &top = stk.back();
+        const auto &node = *top.first;
+
+        if (node.type == NodeType::OPERATOR && !top.second) {
+            top.second = true;
+            if (node.right) {
+                stk.emplace_back(node.right.get(), false);
+            }
+            stk.emplace_back(node.left.get(), false);
+            continue;
+        }
+        stk.pop_back();
+
+        switch (node.type) {
+        case NodeType::NUMBER:
+            calcStk.emplace_back(node.value);
+            break;
+
+        case NodeType::VARIABLE:
+            calcStk.emplace_back(varsTable[node.varname]);
+            break;
+
+        case NodeType::OPERATOR: {
+            auto r = std::numeric_limits<double>::quiet_NaN();
+            if (GetOperatorNum(node.op) == 2) {
+                r = calcStk.back();
+                calcStk.pop_back();
+            }
+            auto &l = calcStk.back();
+            l = tomsolver::Calc(node.op, l, r);
+            break;
+        }
+        }
+    }
+
+    assert(calcStk.size() == 1);
+    return calcStk.back();
+}
+
 NodeImpl &NodeImpl::Calc() {
     auto d = Vpa();
     *this = {};
@@ -622,8 +671,70 @@ std::set<std::string> NodeImpl::GetAllVarNames() const noexcept {
     return ret;
 }
 
+// 反向后序遍历（先右后左的前序遍历）。非递归实现。
+std::uint64_t NodeImpl::Hash() const noexcept {
+    std::uint64_t seed = 0;
+
+    std::stack<std::reference_wrapper<const NodeImpl>> stk;
+    stk.emplace(*this);
+
+    while (!stk.empty()) {
+        const auto &node = stk.top().get();
+        stk.pop();
+
+        seed = HashCombine(seed, HashSingleNode(node.type, node.op, node.value, node.varname));
+
+        if (node.left) {
+            stk.emplace(*node.left);
+        }
+        if (node.right) {
+            stk.emplace(*node.right);
+        }
+    }
+
+    return seed;
+}
+
+std::uint64_t HashCombine(std::uint64_t seed, std::uint64_t value) noexcept {
+    // boost::hash_combine的64位版本
+    return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
+
+std::uint64_t HashSingleNode(NodeType type, MathOperator op, double value, const std::string &varname) noexcept {
+    auto seed = HashCombine(static_cast<std::uint64_t>(type), static_cast<std::uint64_t>(op));
+    switch (type) {
+    case NodeType::NUMBER: {
+        // Equal()认为0.0 == -0.0，这里要保持一致
+        value = value == 0.0 ? 0.0 : value;
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return HashCombine(seed, bits);
+    }
+    case NodeType::VARIABLE: {
+        // FNV-1a
+        std::uint64_t hash = 14695981039346656037ull;
+        for (auto c : varname) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+        return HashCombine(seed, hash);
+    }
+    case NodeType::OPERATOR:
+        return seed;
+    }
+    assert(0 && "unexpected NodeType. maybe this is a bug.");
+    return seed;
+}
+
 } // namespace internal
 
+std::size_t NodeHash::operator()(const Node &node) const noexcept {
+    return static_cast<std::size_t>(node->Hash());
+}
+
+bool NodeEqual::operator()(const Node &lhs, const Node &rhs) const noexcept {
+    return lhs->Equal(rhs);
+}
+
 Node Clone(const Node &rhs) noexcept {
     return internal::CloneNonRecursively(rhs);
 }
@@ -2,6 +2,7 @@
 #include "math_operator.h"
 
 #include <cassert>
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <set>
@@ -14,13 +15,16 @@
 
 namespace tomsolver {
 
-enum class NodeType { NUMBER, OPERATOR, VARIABLE };
+enum class NodeType : std::uint8_t { NUMBER, OPERATOR, VARIABLE };
 
 // 前置声明
 namespace internal {
 struct NodeImpl;
 }
 class SymMat;
+class FlatNode;
+class CompiledSymMat;
+class VarsTable;
 
 /**
  * 表达式节点。
@@ -63,6 +67,14 @@ struct NodeImpl {
      */
     double Vpa() const;
 
+    /**
+     * 以varsTable中的值代入变量，计算出整个表达式的数值。非递归实现。
+     * 不改变自身，也不复制表达式树，因此多个线程可以同时对同一个表达式求值。
+     * @exception out_of_range 如果varsTable中没有某个变量
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    double Vpa(const VarsTable &varsTable) const;
+
     /**
      * 计算出整个表达式的数值。不改变自身。
      * @exception runtime_error 如果有变量存在，则无法计算
@@ -75,6 +87,12 @@ struct NodeImpl {
      */
     std::set<std::string> GetAllVarNames() const noexcept;
 
+    /**
+     * 计算表达式的结构哈希值。结构完全一致（Equal为true）的表达式哈希值相同。
+     * 结果与FlatNode::Hash()一致，且不依赖平台与进程，可以持久化保存。
+     */
+    std::uint64_t Hash() const noexcept;
+
     /**
      * 检查整个节点数的parent指针是否正确。
      */
@@ -143,7 +161,10 @@ private:
     friend Node BinaryOperator(MathOperator op, T1 &&n1, T2 &&n2) noexcept;
 
     friend class tomsolver::SymMat;
+    friend class tomsolver::FlatNode;
+    friend class tomsolver::CompiledSymMat;
     friend class SimplifyFunctions;
+    friend class EGraph;
     friend class DiffFunctions;
     friend class SubsFunctions;
     friend class ParseFunctions;
@@ -190,8 +211,33 @@ Node BinaryOperator(MathOperator op, T1 &&n1, T2 &&n2) noexcept {
  */
 Node Operator(MathOperator op, Node left = nullptr, Node right = nullptr) noexcept;
 
+/**
+ * 把value混入哈希值seed。
+ */
+std::uint64_t HashCombine(std::uint64_t seed, std::uint64_t value) noexcept;
+
+/**
+ * 单个节点的哈希值。仅限本节点，不含子节点。
+ */
+std::uint64_t HashSingleNode(NodeType type, MathOperator op, double value, const std::string &varname) noexcept;
+
 } // namespace internal
 
+/**
+ * 以表达式的结构计算哈希值的仿函数。配合NodeEqual可以把Node作为哈希容器的键，例如：
+ *      std::unordered_map<Node, int, NodeHash, NodeEqual> m;
+ */
+struct NodeHash {
+    std::size_t operator()(const Node &node) const noexcept;
+};
+
+/**
+ * 判断两个表达式结构是否完全一致的仿函数。
+ */
+struct NodeEqual {
+    bool operator()(const Node &lhs, const Node &rhs) const noexcept;
+};
+
 Node Clone(const Node &rhs) noexcept;
 
 /**
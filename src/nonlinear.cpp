@@ -1,10 +1,21 @@
 #include "nonlinear.h"
 
+#include "compiled.h"
 #include "config.h"
+#include "error_type.h"
+#include "line_search.h"
 #include "linear.h"
+#include "native.h"
+#include "prepared_cache.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <vector>
 
 using std::cout;
 using std::endl;
@@ -12,16 +23,255 @@ using std::runtime_error;
 
 namespace tomsolver {
 
-double Armijo(const Vec &x, const Vec &d, std::function<Vec(Vec)> f, std::function<Mat(Vec)> df) {
+namespace internal {
+
+/**
+ * 本线程正在进行（或者最近一次）的求解的统计信息。
+ */
+SolveStats &CurrentSolveStats() noexcept {
+    thread_local SolveStats stats;
+    return stats;
+}
+
+/**
+ * 方程组与雅可比矩阵的求值器。
+ * Config::Get().nativeCompile为true时使用NativeModel，编译失败则退回CompiledSymMat。
+ * 最近求值过的Config::Get().evaluationCacheSize个点的F(x)、J(x)保存在缓存中，x按位相同时直接返回缓存的结果。
+ * 线搜索会在同一个点上反复求值，缓存可以省去这些重复计算。求值次数与命中次数记录在CurrentSolveStats()中。
+ * 缓存条目的缓冲区重复使用，预热之后以指针接口求值不再分配内存。
+ */
+class SystemEvaluator : public LineSearchProblem {
+public:
+    SystemEvaluator(const SymVec &equations, const SymMat &jaEqs, const std::vector<std::string> &vars)
+        : rows(equations.Rows()), cols(static_cast<int>(vars.size())), capacity(Config::Get().evaluationCacheSize) {
+        if (Config::Get().nativeCompile) {
+            try {
+                native = std::make_unique<NativeModel>(equations, jaEqs, vars);
+                return;
+            } catch (const std::runtime_error &e) {
+                if (Config::Get().logLevel >= LogLevel::WARN) {
+                    cout << "[WARN] " << e.what() << ", fall back to CompiledSymMat" << endl;
+                }
+            }
+        }
+        compiledEqs = std::make_unique<CompiledSymMat>(equations, vars);
+        compiledJaEqs = std::make_unique<CompiledSymMat>(jaEqs, vars);
+    }
+
+    int Rows() const noexcept override {
+        return rows;
+    }
+
+    int Cols() const noexcept override {
+        return cols;
+    }
+
+    void Residual(const double *x, double *f) override {
+        auto size = static_cast<std::size_t>(rows);
+        auto entry = Lookup(x);
+        if (entry && entry->hasF) {
+            ++CurrentSolveStats().cacheHits;
+            std::copy(entry->f.begin(), entry->f.end(), f);
+            return;
+        }
+        ++CurrentSolveStats().cacheMisses;
+        ++CurrentSolveStats().residualEvaluations;
+        if (native) {
+            native->EvalResidual(x, f);
+            CheckFinite(f, size, "residual");
+        } else {
+            compiledEqs->Eval(x, f, ws);
+        }
+        if (capacity > 0) {
+            entry = entry ? entry : Insert(x);
+            entry->f.assign(f, f + size);
+            entry->hasF = true;
+        }
+    }
+
+    void Jacobian(const double *x, double *J) override {
+        auto size = static_cast<std::size_t>(rows) * static_cast<std::size_t>(cols);
+        auto entry = Lookup(x);
+        if (entry && entry->hasJ) {
+            ++CurrentSolveStats().cacheHits;
+            std::copy(entry->J.begin(), entry->J.end(), J);
+            return;
+        }
+        ++CurrentSolveStats().cacheMisses;
+        ++CurrentSolveStats().jacobianEvaluations;
+        if (native) {
+            native->EvalJacobian(x, J);
+            CheckFinite(J, size, "jacobian");
+        } else {
+            compiledJaEqs->Eval(x, J, ws);
+        }
+        if (capacity > 0) {
+            entry = entry ? entry : Insert(x);
+            entry->J.assign(J, J + size);
+            entry->hasJ = true;
+        }
+    }
+
+    Vec F(const Vec &x) {
+        Vec ret(rows);
+        Residual(&x.Value(0, 0), &ret[0]);
+        return ret;
+    }
+
+    Mat J(const Vec &x) {
+        Mat ret(rows, cols);
+        Jacobian(&x.Value(0, 0), &ret.Value(0, 0));
+        return ret;
+    }
+
+private:
+    struct CacheEntry {
+        std::vector<double> x;
+        std::vector<double> f;
+        std::vector<double> J;
+        bool hasF = false;
+        bool hasJ = false;
+    };
+
+    int rows, cols;
+    std::unique_ptr<NativeModel> native;
+    std::unique_ptr<CompiledSymMat> compiledEqs;
+    std::unique_ptr<CompiledSymMat> compiledJaEqs;
+    CompiledSymMat::Workspace ws;
+
+    std::size_t capacity;
+    std::vector<CacheEntry> cache; // 按最近使用排序，最近使用的在最前面
+
+    // NativeModel的指针接口不检查无效值，这里按Config::Get().throwOnInvalidValue补上
+    static void CheckFinite(const double *v, std::size_t n, const char *what) {
+        if (!Config::Get().throwOnInvalidValue) {
+            return;
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            if (!std::isfinite(v[i])) {
+                throw MathError(ErrorType::ERROR_INVALID_NUMBER,
+                                std::string("NativeModel: ") + what + "[" + std::to_string(i) + "] = " + ToString(v[i]));
+            }
+        }
+    }
+
+    // 按位比较，-0.0与0.0、不同的nan视为不同的点
+    CacheEntry *Lookup(const double *x) noexcept {
+        auto bytes = static_cast<std::size_t>(cols) * sizeof(double);
+        for (auto it = cache.begin(); it != cache.end(); ++it) {
+            if (std::memcmp(it->x.data(), x, bytes) == 0) {
+                std::rotate(cache.begin(), it, it + 1);
+                return &cache.front();
+            }
+        }
+        return nullptr;
+    }
+
+    CacheEntry *Insert(const double *x) {
+        if (cache.size() < capacity) {
+            cache.emplace_back();
+        }
+        // 最久未使用的条目移到最前面，重新使用
+        std::rotate(cache.begin(), cache.end() - 1, cache.end());
+        auto &entry = cache.front();
+        entry.x.assign(x, x + cols);
+        entry.hasF = false;
+        entry.hasJ = false;
+        return &entry;
+    }
+};
+
+/**
+ * 以标量类型T做Newton-Raphson迭代。x传入初值，返回时为迭代结果。
+ * 所有方程的绝对值都小于tolerance、残差的范数不再下降（T的精度已经用尽）、雅可比矩阵奇异、出现无效值，
+ * 或者迭代次数达到maxIterations时结束。x只保留残差下降的迭代结果。返回迭代次数。
+ */
+template <typename T>
+int NewtonIterate(const CompiledSymMat &eqs, const CompiledSymMat &ja, std::vector<T> &x, T tolerance,
+                  int maxIterations) {
+    auto m = eqs.Rows();
+    auto n = static_cast<int>(x.size());
+    if (m != n) {
+        return 0;
+    }
+
+    CompiledSymMat::BasicWorkspace<T> ws;
+    std::vector<T> f(n), J(n * n), xNew(n);
+    std::vector<int> perm(n);
+    auto norm = [&f] {
+        T ret = 0;
+        for (auto v : f) {
+            ret = std::max(ret, std::abs(v));
+        }
+        return ret;
+    };
+
+    int it = 0;
+    try {
+        eqs.EvalAs(x.data(), f.data(), ws);
+        auto fNorm = norm();
+        while (fNorm >= tolerance && it < maxIterations) {
+            ja.EvalAs(x.data(), J.data(), ws);
+            if (!LuDecompose(n, J.data(), perm.data(), std::numeric_limits<T>::min())) {
+                break;
+            }
+            LuSolve(n, J.data(), perm.data(), f.data());
+            for (int i = 0; i < n; ++i) {
+                xNew[i] = x[i] - f[i];
+            }
+            ++it;
+
+            eqs.EvalAs(xNew.data(), f.data(), ws);
+            auto fNewNorm = norm();
+            if (!(fNewNorm < fNorm)) {
+                break;
+            }
+            x.swap(xNew);
+            fNorm = fNewNorm;
+        }
+    } catch (const MathError &) {
+        // 交给后续的double迭代处理
+    }
+    return it;
+}
+
+/**
+ * 以标量类型T预先迭代，见Config::nonlinearScalarType。迭代结果写入table与q，返回迭代次数。
+ */
+template <typename T>
+int PresolveAs(const SymVec &equations, const SymMat &jaEqs, VarsTable &table, Vec &q) {
+    CompiledSymMat eqs(equations, table.Vars());
+    CompiledSymMat ja(jaEqs, table.Vars());
+    std::vector<T> x(table.VarNums());
+    for (int i = 0; i < table.VarNums(); ++i) {
+        x[i] = static_cast<T>(table.Values()[i]);
+    }
+
+    auto it = NewtonIterate(eqs, ja, x, static_cast<T>(Config::Get().epsilon), Config::Get().maxIterations);
+    if (it > 0) {
+        for (int i = 0; i < table.VarNums(); ++i) {
+            q[i] = static_cast<double>(x[i]);
+        }
+        table.SetValues(q);
+    }
+    return it;
+}
+
+} // namespace internal
+
+double Armijo(const Vec &x, const Vec &d, const std::function<Vec(Vec)> &f, const std::function<Mat(Vec)> &df) {
     double alpha = 1;   // a > 0
     double gamma = 0.4; // 取值范围(0, 0.5)越大越快
     double sigma = 0.5; // 取值范围(0, 1)越大越慢
+    // x不变，f(x)与df(x)只需要计算一次
+    Mat fx = f(x).AsMat();
+    Mat dfxd = df(x).Transpose() * d;
     Vec x_new(x);
     while (1) {
         x_new = x + alpha * d;
 
         auto l = f(x_new).Norm2();
-        auto r = (f(x).AsMat() + gamma * alpha * df(x).Transpose() * d).Norm2();
+        auto r = (fx + gamma * alpha * dfxd).Norm2();
         if (l <= r) // 检验条件
         {
             break;
@@ -31,7 +281,7 @@ double Armijo(const Vec &x, const Vec &d, std::function<Vec(Vec)> f, std::functi
     return alpha;
 }
 
-double FindAlpha(const Vec &x, const Vec &d, std::function<Vec(Vec)> f, double uncert) {
+double FindAlpha(const Vec &x, const Vec &d, const std::function<Vec(Vec)> &f, double uncert) {
     double alpha_cur = 0;
 
     double alpha_new = 1;
@@ -56,32 +306,56 @@ double FindAlpha(const Vec &x, const Vec &d, std::function<Vec(Vec)> f, double u
 
         // cout << it<<"\t"<<alpha_new << endl;
         if (it++ > maxIter) {
-            cout << "FindAlpha: over iterator" << endl;
+            if (Config::Get().logLevel >= LogLevel::DEBUG) {
+                cout << "[DEBUG] FindAlpha: over iterator" << endl;
+            }
             break;
         }
     }
     return alpha_new;
 }
 
-VarsTable SolveByNewtonRaphson(const VarsTable &varsTable, const SymVec &equations) {
+namespace internal {
+
+void CheckPreparedVars(const VarsTable &varsTable, const PreparedSystem &system) {
+    if (varsTable.Vars() != system.vars) {
+        throw runtime_error("the variables of varsTable do not match the prepared system");
+    }
+}
+
+VarsTable NewtonRaphson(const VarsTable &varsTable, const SymVec &equations, const SymMat &jaEqs) {
+    auto &stats = CurrentSolveStats();
+    stats = {};
+
     int it = 0; // 迭代计数
     VarsTable table = varsTable;
-    int n = table.VarNums(); // 未知量数量
-    Vec q(n);                // x向量
-
-    SymMat jaEqs = Jacobian(equations, table.Vars());
+    Vec q = table.Values();  // x向量
 
     if (Config::Get().logLevel >= LogLevel::TRACE) {
         cout << "Jacobian = " << jaEqs.ToString() << endl;
     }
 
+    internal::SystemEvaluator evaluator(equations, jaEqs, table.Vars());
+
+    switch (Config::Get().nonlinearScalarType) {
+    case ScalarType::FLOAT:
+        it += internal::PresolveAs<float>(equations, jaEqs, table, q);
+        break;
+    case ScalarType::LONG_DOUBLE:
+        it += internal::PresolveAs<long double>(equations, jaEqs, table, q);
+        break;
+    case ScalarType::DOUBLE:
+        break;
+    }
+
     while (1) {
-        Vec phi = equations.Clone().Subs(table).Calc().ToMat().ToVec();
+        Vec phi = evaluator.F(table.Values());
         if (Config::Get().logLevel >= LogLevel::TRACE) {
             cout << "iteration = " << it << endl;
             cout << "phi = " << phi << endl;
         }
 
+        stats.iterations = it;
         if (phi == 0) {
             break;
         }
@@ -90,9 +364,10 @@ VarsTable SolveByNewtonRaphson(const VarsTable &varsTable, const SymVec &equatio
             throw runtime_error("迭代次数超出限制");
         }
 
-        Mat ja = jaEqs.Clone().Subs(table).Calc().ToMat();
+        Mat ja = evaluator.J(table.Values());
 
-        Vec deltaq = SolveLinear(ja, -phi);
+        Vec deltaq = Config::Get().mixedPrecisionLinearSolve ? SolveLinearMixedPrecision(ja, -phi)
+                                                             : SolveLinear(ja, -phi);
 
         q += deltaq;
 
@@ -109,28 +384,28 @@ VarsTable SolveByNewtonRaphson(const VarsTable &varsTable, const SymVec &equatio
     return table;
 }
 
-VarsTable SolveByLM(const VarsTable &varsTable, const SymVec &equations) {
+VarsTable LM(const VarsTable &varsTable, const SymVec &equations, const SymMat &JaEqs) {
+    auto &stats = CurrentSolveStats();
+    stats = {};
+
     int it = 0; // 迭代计数
     VarsTable table = varsTable;
     int n = table.VarNums(); // 未知量数量
     Vec q = table.Values();  // x向量
 
-    SymMat JaEqs = Jacobian(equations, table.Vars());
-
     if (Config::Get().logLevel >= LogLevel::TRACE) {
         cout << "Jacobi = " << JaEqs << endl;
     }
 
+    internal::SystemEvaluator evaluator(equations, JaEqs, table.Vars());
+    auto lineSearch = MakeLineSearch(Config::Get().lineSearchMethod);
+    LineSearchWorkspace lineSearchWs;
+
+    Vec F = evaluator.F(q); // 计算F
     while (1) {
+        stats.iterations = it;
         if (Config::Get().logLevel >= LogLevel::TRACE) {
             cout << "iteration = " << it << endl;
-        }
-
-        double mu = 1e-5; // LM方法的λ值
-
-        Vec F = equations.Clone().Subs(table).Calc().ToMat().ToVec(); // 计算F
-
-        if (Config::Get().logLevel >= LogLevel::TRACE) {
             cout << "F = " << F << endl;
         }
 
@@ -138,11 +413,13 @@ VarsTable SolveByLM(const VarsTable &varsTable, const SymVec &equations) {
             break;
         }
 
-        Vec FNew(n);   // 下一轮F
+        double mu = 1e-5; // LM方法的λ值
+
         Vec deltaq(n); // Δq
         while (1) {
+            stats.iterations = it;
 
-            Mat J = JaEqs.Clone().Subs(table).Calc().ToMat(); // 计算雅可比矩阵
+            Mat J = evaluator.J(q); // 计算雅可比矩阵
 
             if (Config::Get().logLevel >= LogLevel::TRACE) {
                 cout << "J = " << J << endl;
@@ -152,52 +429,28 @@ VarsTable SolveByLM(const VarsTable &varsTable, const SymVec &equations) {
             // 标准的LM方法中，d=-(J'*J+λI)^(-1)*J'F，其中J'*J是为了确保矩阵对称正定。有时d会过大，很难收敛。
             // 牛顿法的 d=-(J+λI)^(-1)*F
 
+            // 价值函数0.5*||F||^2的梯度
+            Vec g = (J.Transpose() * F).ToVec();
+
             // 方向向量
-            Vec d = SolveLinear(J.Transpose() * J + mu * Mat(J.Rows(), J.Cols()).Ones(),
-                                -(J.Transpose() * F).ToVec()); // 得到d
+            Vec d = SolveLinear(J.Transpose() * J + mu * Mat(n, n).Ones(), -g); // 得到d
 
             if (Config::Get().logLevel >= LogLevel::TRACE) {
                 cout << "d = " << d << endl;
             }
 
-            double alpha = Armijo(
-                q, d,
-                [&](Vec v) -> Vec {
-                    table.SetValues(v);
-                    return equations.Clone().Subs(table).Calc().ToMat().ToVec();
-                },
-                [&](Vec v) -> Mat {
-                    table.SetValues(v);
-                    return JaEqs.Clone().Subs(table).Calc().ToMat();
-                }); // 进行1维搜索得到alpha
-
-            // double alpha = FindAlpha(q, d, std::bind(SixBarAngPosition, std::placeholders::_1, thetaCDKL, Hhit));
-
-            // for (size_t i = 0; i < alpha.rows; ++i)
-            //{
-            //	if (alpha[i] != alpha[i])
-            //		alpha[i] = 1.0;
-            //}
-
-            deltaq = alpha * d; // 计算Δq
-
-            Vec qTemp = q + deltaq;
-            table.SetValues(qTemp);
-
-            FNew = equations.Clone().Subs(table).Calc().ToMat().ToVec(); // 计算新的F
+            // 进行1维搜索得到alpha。F、J已经算过，phi(0)与phi'(0)直接传入
+            double alpha = lineSearch->Search(evaluator, &q[0], &d[0], 0.5 * F.Norm2(), Dot(g, d), lineSearchWs);
 
             if (Config::Get().logLevel >= LogLevel::TRACE) {
                 cout << "it=" << it << endl;
                 cout << "\talpha=" << alpha << endl;
                 cout << "mu=" << mu << endl;
-                cout << "F.Norm2()=" << F.Norm2() << endl;
-                cout << "FNew.Norm2()=" << FNew.Norm2() << endl;
-                cout << "\tF(x k+1).Norm2()\t" << ((FNew.Norm2() < F.Norm2()) ? "<" : ">=") << "\tF(x k).Norm2()\t"
-                     << endl;
             }
 
-            if (FNew.Norm2() < F.Norm2()) // 满足下降条件，跳出内层循环
+            if (alpha > 0) // 找到满足条件的步长，跳出内层循环
             {
+                deltaq = alpha * d; // 计算Δq
                 break;
             } else {
                 mu *= 10.0; // 扩大λ，使模型倾向梯度下降方向
@@ -210,9 +463,7 @@ VarsTable SolveByLM(const VarsTable &varsTable, const SymVec &equations) {
 
         q += deltaq; // 应用Δq，更新q值
 
-        table.SetValues(q);
-
-        F = FNew; // 更新F
+        F = evaluator.F(q); // 更新F。一维搜索刚刚在这一点上求过值，通常直接命中缓存
 
         if (it++ == Config::Get().maxIterations) {
             throw runtime_error("迭代次数超出限制");
@@ -227,15 +478,161 @@ VarsTable SolveByLM(const VarsTable &varsTable, const SymVec &equations) {
         cout << "success" << endl;
     }
 
+    table.SetValues(q);
     return table;
 }
 
+VarsTable Homotopy(const VarsTable &varsTable, const SymVec &equations, const SymMat &jaEqs) {
+    auto &stats = CurrentSolveStats();
+    stats = {};
+
+    int n = varsTable.VarNums();
+    if (equations.Rows() != n) {
+        throw runtime_error("homotopy requires as many equations as variables");
+    }
+
+    internal::SystemEvaluator evaluator(equations, jaEqs, varsTable.Vars());
+    auto &config = Config::Get();
+
+    // H(x, t) = t*F(x) + (1-t)*(x - x0)
+    // Hx = t*J(x) + (1-t)*I，Ht = F(x) - (x - x0)
+    const Vec x0 = varsTable.Values();
+    auto Hx = [&](const Vec &x, double t) {
+        return t * evaluator.J(x) + (1 - t) * Mat(n, n).Ones();
+    };
+
+    // 在t处从x出发做Newton校正。收敛时返回校正的次数，不收敛返回-1
+    const int maxCorrections = 5;
+    auto correct = [&](Vec &x, double t) {
+        for (int k = 1; k <= maxCorrections; ++k) {
+            Vec H = t * evaluator.F(x) + (1 - t) * (x - x0);
+            Vec dx = SolveLinear(Hx(x, t), -H);
+            x += dx;
+            if (dx.NormInfinity() <= 1.0e-8 * (1 + x.NormInfinity())) {
+                return k;
+            }
+        }
+        return -1;
+    };
+
+    Vec x = x0;
+    double t = 0;
+    double h = config.homotopyInitialStep;
+    int it = 0;
+    while (t < 1) {
+        stats.iterations = it;
+        if (it++ == config.maxIterations) {
+            throw runtime_error("迭代次数超出限制");
+        }
+        h = std::min(h, 1 - t);
+
+        // 预测：沿切线方向dx/dt = -Hx^(-1) * Ht前进h
+        Vec Ht = evaluator.F(x) - (x - x0);
+        Vec tangent = SolveLinear(Hx(x, t), -Ht);
+
+        Vec xNew = x + h * tangent;
+        double tNew = t + h;
+        int corrections;
+        try {
+            corrections = correct(xNew, tNew);
+        } catch (const MathError &) {
+            // 校正时雅可比矩阵奇异或者出现无效值，按不收敛处理
+            corrections = -1;
+        }
+
+        if (Config::Get().logLevel >= LogLevel::TRACE) {
+            cout << "t = " << t << ", h = " << h << ", corrections = " << corrections << endl;
+        }
+
+        if (corrections < 0) {
+            h /= 2;
+            if (h < config.homotopyMinStep) {
+                throw runtime_error("homotopy step size is too small at t = " + ToString(t));
+            }
+            continue;
+        }
+
+        x = xNew;
+        t = tNew;
+        // 校正很快收敛说明路径平缓，可以加大步长
+        if (corrections <= 2) {
+            h = std::min(2 * h, config.homotopyMaxStep);
+        }
+    }
+
+    // t = 1时H即F，路径跟踪的容差较宽，最后以Newton-Raphson迭代到Config::Get().epsilon
+    auto tracked = stats;
+    VarsTable table = varsTable;
+    table.SetValues(x);
+    table = NewtonRaphson(table, equations, jaEqs);
+
+    stats.iterations += it;
+    stats.residualEvaluations += tracked.residualEvaluations;
+    stats.jacobianEvaluations += tracked.jacobianEvaluations;
+    stats.cacheHits += tracked.cacheHits;
+    stats.cacheMisses += tracked.cacheMisses;
+    return table;
+}
+
+} // namespace internal
+
+const SolveStats &LastSolveStats() noexcept {
+    return internal::CurrentSolveStats();
+}
+
+PreparedSystem Prepare(const SymVec &equations, const std::vector<std::string> &vars) {
+    if (Config::Get().preparedCacheDir.empty()) {
+        return {equations.Clone().ToSymVec(), vars, Jacobian(equations, vars)};
+    }
+
+    if (auto cached = PreparedCache::Get().Find(equations, vars)) {
+        return std::move(*cached);
+    }
+    PreparedSystem system{equations.Clone().ToSymVec(), vars, Jacobian(equations, vars)};
+    PreparedCache::Get().Insert(system);
+    return system;
+}
+
+PreparedSystem Prepare(const SymVec &equations) {
+    auto varNames = equations.GetAllVarNames();
+    return Prepare(equations, {varNames.begin(), varNames.end()});
+}
+
+VarsTable SolveByNewtonRaphson(const VarsTable &varsTable, const SymVec &equations) {
+    return internal::NewtonRaphson(varsTable, equations, Jacobian(equations, varsTable.Vars()));
+}
+
+VarsTable SolveByNewtonRaphson(const VarsTable &varsTable, const PreparedSystem &system) {
+    internal::CheckPreparedVars(varsTable, system);
+    return internal::NewtonRaphson(varsTable, system.equations, system.jacobian);
+}
+
+VarsTable SolveByHomotopy(const VarsTable &varsTable, const SymVec &equations) {
+    return internal::Homotopy(varsTable, equations, Jacobian(equations, varsTable.Vars()));
+}
+
+VarsTable SolveByHomotopy(const VarsTable &varsTable, const PreparedSystem &system) {
+    internal::CheckPreparedVars(varsTable, system);
+    return internal::Homotopy(varsTable, system.equations, system.jacobian);
+}
+
+VarsTable SolveByLM(const VarsTable &varsTable, const SymVec &equations) {
+    return internal::LM(varsTable, equations, Jacobian(equations, varsTable.Vars()));
+}
+
+VarsTable SolveByLM(const VarsTable &varsTable, const PreparedSystem &system) {
+    internal::CheckPreparedVars(varsTable, system);
+    return internal::LM(varsTable, system.equations, system.jacobian);
+}
+
 VarsTable Solve(const VarsTable &varsTable, const SymVec &equations) {
     switch (Config::Get().nonlinearMethod) {
     case NonlinearMethod::NEWTON_RAPHSON:
         return SolveByNewtonRaphson(varsTable, equations);
     case NonlinearMethod::LM:
         return SolveByLM(varsTable, equations);
+    case NonlinearMethod::HOMOTOPY:
+        return SolveByHomotopy(varsTable, equations);
     }
     throw runtime_error("invalid config.NonlinearMethod value: " +
                         std::to_string(static_cast<int>(Config::Get().nonlinearMethod)));
@@ -248,4 +645,21 @@ VarsTable Solve(const SymVec &equations) {
     return Solve(varsTable, equations);
 }
 
-} // namespace tomsolver
\ No newline at end of file
+VarsTable Solve(const VarsTable &varsTable, const PreparedSystem &system) {
+    switch (Config::Get().nonlinearMethod) {
+    case NonlinearMethod::NEWTON_RAPHSON:
+        return SolveByNewtonRaphson(varsTable, system);
+    case NonlinearMethod::LM:
+        return SolveByLM(varsTable, system);
+    case NonlinearMethod::HOMOTOPY:
+        return SolveByHomotopy(varsTable, system);
+    }
+    throw runtime_error("invalid config.NonlinearMethod value: " +
+                        std::to_string(static_cast<int>(Config::Get().nonlinearMethod)));
+}
+
+VarsTable Solve(const PreparedSystem &system) {
+    return Solve(VarsTable(system.vars, Config::Get().initialValue), system);
+}
+
+} // namespace tomsolver
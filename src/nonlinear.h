@@ -4,19 +4,62 @@
 #include "symmat.h"
 #include "vars_table.h"
 
+#include <cstddef>
 #include <functional>
+#include <string>
+#include <vector>
 
 namespace tomsolver {
 
 /**
- * Armijo方法一维搜索，寻找alpha
+ * 预处理好的方程组：方程、变量，以及方程对这些变量的雅可比矩阵。
+ * 可以序列化后保存（见serialize.h），之后直接求解，不必再求导。
  */
-double Armijo(const Vec &x, const Vec &d, std::function<Vec(Vec)> f, std::function<Mat(Vec)> df);
+struct PreparedSystem {
+    SymVec equations;
+    std::vector<std::string> vars;
+    SymMat jacobian; // equations对vars的雅可比矩阵
+};
+
+/**
+ * 一次求解的统计信息。
+ */
+struct SolveStats {
+    int iterations = 0;                  // 迭代次数
+    std::size_t residualEvaluations = 0; // 实际计算方程组F(x)的次数
+    std::size_t jacobianEvaluations = 0; // 实际计算雅可比矩阵J(x)的次数
+    std::size_t cacheHits = 0;           // 求值缓存命中的次数，见Config::evaluationCacheSize
+    std::size_t cacheMisses = 0;         // 求值缓存未命中的次数
+};
+
+/**
+ * 本线程最近一次调用SolveByNewtonRaphson()、SolveByLM()、SolveByHomotopy()（包括通过Solve()调用）的统计信息。求解失败抛出异常时也会更新。
+ */
+const SolveStats &LastSolveStats() noexcept;
+
+/**
+ * 预处理方程组：复制equations，并计算对vars的雅可比矩阵。
+ * Config::Get().preparedCacheDir不为空时，先从PreparedCache中查找，未命中时把结果写入缓存。
+ * @exception runtime_error 方程组中有不能求导的运算（例如%、&、|）
+ */
+PreparedSystem Prepare(const SymVec &equations, const std::vector<std::string> &vars);
+
+/**
+ * 预处理方程组。变量名通过分析equations得到，按字典序排列。
+ * @exception runtime_error 方程组中有不能求导的运算（例如%、&、|）
+ */
+PreparedSystem Prepare(const SymVec &equations);
+
+/**
+ * Armijo方法一维搜索，寻找alpha。
+ * 每个试探点都会构造新的Vec，求解器内部使用line_search.h中不分配内存的LineSearch。
+ */
+double Armijo(const Vec &x, const Vec &d, const std::function<Vec(Vec)> &f, const std::function<Mat(Vec)> &df);
 
 /**
  * 割线法 进行一维搜索，寻找alpha
  */
-double FindAlpha(const Vec &x, const Vec &d, std::function<Vec(Vec)> f, double uncert = 1.0e-5);
+double FindAlpha(const Vec &x, const Vec &d, const std::function<Vec(Vec)> &f, double uncert = 1.0e-5);
 
 /**
  * 解非线性方程组equations。
@@ -25,6 +68,13 @@ double FindAlpha(const Vec &x, const Vec &d, std::function<Vec(Vec)> f, double u
  */
 VarsTable SolveByNewtonRaphson(const VarsTable &varsTable, const SymVec &equations);
 
+/**
+ * 解预处理好的方程组system，不再求导。
+ * 初值通过varsTable传入，varsTable的变量必须与system.vars一致。
+ * @exception runtime_error 迭代次数超出限制，或者变量不一致
+ */
+VarsTable SolveByNewtonRaphson(const VarsTable &varsTable, const PreparedSystem &system);
+
 /**
  * 解非线性方程组equations。
  * 初值及变量名通过varsTable传入。
@@ -32,6 +82,32 @@ VarsTable SolveByNewtonRaphson(const VarsTable &varsTable, const SymVec &equatio
  */
 VarsTable SolveByLM(const VarsTable &varsTable, const SymVec &equations);
 
+/**
+ * 解预处理好的方程组system，不再求导。
+ * 初值通过varsTable传入，varsTable的变量必须与system.vars一致。
+ * @exception runtime_error 迭代次数超出限制，或者变量不一致
+ */
+VarsTable SolveByLM(const VarsTable &varsTable, const PreparedSystem &system);
+
+/**
+ * 以同伦延拓法解非线性方程组equations，方程数量必须等于未知量数量。
+ * 从容易求解的G(x) = x - x0（x0为varsTable给出的初值）出发，跟踪 H(x, t) = t*F(x) + (1-t)*G(x) = 0 的解曲线，
+ * t从0到1：每一步先沿切线预测，再以Newton法校正，按校正的收敛情况自适应地调整步长，
+ * 最后在t = 1处以Newton-Raphson迭代至Config::Get().epsilon。
+ * 比SolveByNewtonRaphson()、SolveByLM()更不依赖初值，适合刚性、Newton法容易发散的方程组，代价是更多的求值次数。
+ * 步长由Config::Get().homotopyInitialStep、homotopyMinStep、homotopyMaxStep控制。
+ * @exception runtime_error 方程数量与未知量数量不等，步数超出Config::Get().maxIterations，步长小于homotopyMinStep
+ * @exception MathError 预测时雅可比矩阵奇异（路径上出现转向点）
+ */
+VarsTable SolveByHomotopy(const VarsTable &varsTable, const SymVec &equations);
+
+/**
+ * 以同伦延拓法解预处理好的方程组system，不再求导。
+ * 初值通过varsTable传入，varsTable的变量必须与system.vars一致。
+ * @exception runtime_error 同上，或者变量不一致
+ */
+VarsTable SolveByHomotopy(const VarsTable &varsTable, const PreparedSystem &system);
+
 /**
  * 解非线性方程组equations。
  * 初值及变量名通过varsTable传入。
@@ -39,6 +115,19 @@ VarsTable SolveByLM(const VarsTable &varsTable, const SymVec &equations);
  */
 VarsTable Solve(const VarsTable &varsTable, const SymVec &equations);
 
+/**
+ * 解预处理好的方程组system，不再求导。
+ * 初值通过varsTable传入，varsTable的变量必须与system.vars一致。
+ * @exception runtime_error 迭代次数超出限制，或者变量不一致
+ */
+VarsTable Solve(const VarsTable &varsTable, const PreparedSystem &system);
+
+/**
+ * 解预处理好的方程组system，不再求导。初值通过Config::Get()得到。
+ * @exception runtime_error 迭代次数超出限制
+ */
+VarsTable Solve(const PreparedSystem &system);
+
 /**
  * 解非线性方程组equations。
  * 变量名通过分析equations得到。初值通过Config::Get()得到。
@@ -0,0 +1,69 @@
+#include "parallel.h"
+
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tomsolver {
+
+namespace internal {
+
+void ParallelFor(int n, const std::function<void(int, int)> &func) {
+    auto threadNum = Config::Get().threadNum;
+    if (threadNum <= 0) {
+        threadNum = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    threadNum = std::max(1, std::min(threadNum, n));
+
+    if (threadNum == 1) {
+        if (n > 0) {
+            func(0, n);
+        }
+        return;
+    }
+
+    // 每个线程平均领取4块，兼顾负载均衡与调度开销
+    auto chunkSize = std::max(1, n / (threadNum * 4));
+    std::atomic<int> next{0};
+
+    std::exception_ptr exception;
+    std::mutex mutex;
+
+    auto worker = [&] {
+        try {
+            for (auto begin = next.fetch_add(chunkSize); begin < n; begin = next.fetch_add(chunkSize)) {
+                func(begin, std::min(n, begin + chunkSize));
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!exception) {
+                exception = std::current_exception();
+            }
+            // 让其他线程尽快结束
+            next = n;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadNum; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
+
+} // namespace internal
+
+} // namespace tomsolver
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <functional>
+
+namespace tomsolver {
+
+namespace internal {
+
+/**
+ * 把[0, n)切分为若干块，交给最多Config::Get().threadNum个线程并行执行func(begin, end)。
+ * 每个线程执行完一块后再领取下一块。线程数为1或者n不超过1时，直接在当前线程执行。
+ * 如果func抛出异常，等所有线程结束后在当前线程重新抛出第一个异常。
+ */
+void ParallelFor(int n, const std::function<void(int, int)> &func);
+
+} // namespace internal
+
+} // namespace tomsolver
@@ -1,13 +1,19 @@
 #include "parse.h"
 
 #include "error_type.h"
+#include "mapped_file.h"
 #include "math_operator.h"
 #include "node.h"
+#include "parallel.h"
+
 #include <algorithm>
 #include <cassert>
 #include <cctype>
-#include <functional>
+#include <cerrno>
+#include <cstdlib>
 #include <iterator>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <utility>
@@ -110,6 +116,42 @@ MathOperator Str2Function(internal::StringView s) noexcept {
     return MathOperator::MATH_NULL;
 }
 
+/* 变量名需以下划线或字母开头，其余为下划线、字母或数字。与VarNameIsLegal()一致，但不使用正则表达式 */
+bool IsLegalVarName(internal::StringView s) noexcept {
+    auto isAlpha = [](char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+    };
+    if (s.empty() || !isAlpha(*s.begin())) {
+        return false;
+    }
+    return std::all_of(s.begin() + 1, s.end(), [&isAlpha](char c) {
+        return isAlpha(c) || (c >= '0' && c <= '9');
+    });
+}
+
+/* 整个字符串是一个浮点数时返回true。与std::stod的判定一致 */
+bool StrToNumber(internal::StringView s, double &d) noexcept {
+    char buf[64];
+    std::string longStr;
+    auto len = static_cast<std::size_t>(std::distance(s.begin(), s.end()));
+    const char *str = buf;
+    if (len < sizeof(buf)) {
+        std::copy(s.begin(), s.end(), buf);
+        buf[len] = '\0';
+    } else {
+        longStr = s.toString();
+        str = longStr.c_str();
+    }
+
+    char *end;
+    auto savedErrno = errno;
+    errno = 0;
+    d = std::strtod(str, &end);
+    auto ok = end != str && end == str + len && errno != ERANGE;
+    errno = savedErrno;
+    return ok;
+}
+
 } // namespace
 
 const char *SingleParseError::what() const noexcept {
@@ -243,6 +285,7 @@ std::vector<Token> ParseFunctions::InOrderToPostOrder(std::deque<Token> &inOrder
             if (parenthesisBalance == 0) {
                 throw SingleParseError(f.line, f.pos, f.content, "Parenthesis not match: \"", f.s, "\"");
             }
+            parenthesisBalance--;
             for (auto token = popToken(); token.node->op != MathOperator::MATH_LEFT_PARENTHESIS; token = popToken()) {
                 postOrder.emplace_back(std::move(token));
             }
@@ -257,21 +300,15 @@ std::vector<Token> ParseFunctions::InOrderToPostOrder(std::deque<Token> &inOrder
 
         default:
             // 不是括号也不是正负号
-            if (!tokenStack.empty()) {
-                auto compare =
-                    IsLeft2Right(tokenStack.top().node->op)
-                        ? std::function<bool(const Token &)>{[cmp = std::less_equal<>{}, rank = Rank(f.node->op)](
-                                                                 const Token
-                                                                     &token) { // 左结合，则挤出高优先级及同优先级符号
-                              return cmp(rank, Rank(token.node->op));
-                          }}
-                        : std::function<bool(const Token &)>{
-                              [cmp = std::less<>{}, rank = Rank(f.node->op)](
-                                  const Token &token) { // 右结合，则挤出高优先级，但不挤出同优先级符号
-                                  return cmp(rank, Rank(token.node->op));
-                              }};
-
-                while (!tokenStack.empty() && compare(tokenStack.top())) {
+            // 栈顶为左结合，则挤出高优先级及同优先级符号；为右结合，则挤出高优先级，但不挤出同优先级符号。
+            // 每挤出一个符号都要按新的栈顶重新判断，否则a/-b/c会被解析为a/(-b/c)
+            {
+                auto rank = Rank(f.node->op);
+                while (!tokenStack.empty()) {
+                    auto top = tokenStack.top().node->op;
+                    if (!(rank < Rank(top) || (rank == Rank(top) && IsLeft2Right(top)))) {
+                        break;
+                    }
                     postOrder.push_back(std::move(tokenStack.top())); // 符号进入post队列
                     tokenStack.pop();
                 }
@@ -367,13 +404,299 @@ Node ParseFunctions::BuildExpressionTree(std::vector<Token> &postOrder) {
     return popNode();
 }
 
+/**
+ * 以Node的形式输出解析结果。
+ */
+class NodeBuilder {
+public:
+    using Handle = Node;
+
+    Handle Number(double value) noexcept {
+        return Num(value);
+    }
+
+    Handle Variable(const char *name, std::size_t len) noexcept {
+        return std::make_unique<NodeImpl>(NodeType::VARIABLE, MathOperator::MATH_NULL, 0, std::string(name, len));
+    }
+
+    Handle Unary(MathOperator op, Handle operand) noexcept {
+        return Operator(op, std::move(operand));
+    }
+
+    Handle Binary(MathOperator op, Handle left, Handle right) noexcept {
+        return Operator(op, std::move(left), std::move(right));
+    }
+
+    Node Finish(Handle root) noexcept {
+        return root;
+    }
+};
+
+/**
+ * 单遍解析。一边做词法分析，一边按优先级归约（即以显式栈实现的precedence climbing），归约的同时由builder构造节点。
+ * 语法与ParseFunctions的三步解析一致：
+ *      函数与正负号是前缀运算符，优先级高于所有二元运算符，函数后面的括号可以省略；
+ *      二元运算符的优先级与结合性由Rank()、IsLeft2Right()决定。
+ * 由于前缀运算符的优先级最高，它们在操作数完整出现后（数值、变量或者右括号之后）立即归约。
+ * 节点按后序被追加，因此FlatNodeBuilder可以直接得到后序序列。
+ * @exception ParseError
+ */
+template <typename Builder>
+auto ParseWith(StringView expression, Builder &builder, int line, StringView content) {
+    using Handle = typename Builder::Handle;
+
+    auto posOf = [&content](const char *p) {
+        return static_cast<int>(std::distance(content.begin(), p));
+    };
+
+    if (expression.empty()) {
+        throw SingleParseError(line, posOf(expression.begin()), content, "empty input");
+    }
+
+    struct PendingOperator {
+        MathOperator op;
+        int pos;
+    };
+    std::vector<PendingOperator> operators;
+    std::vector<Handle> operands;
+
+    auto reduceTop = [&] {
+        auto op = operators.back().op;
+        operators.pop_back();
+        if (GetOperatorNum(op) == 2) {
+            auto right = std::move(operands.back());
+            operands.pop_back();
+            operands.back() = builder.Binary(op, std::move(operands.back()), std::move(right));
+        } else {
+            operands.back() = builder.Unary(op, std::move(operands.back()));
+        }
+    };
+
+    // 操作数完整出现后，归约紧挨着它的前缀运算符
+    auto reducePrefix = [&] {
+        while (!operators.empty() && operators.back().op != MathOperator::MATH_LEFT_PARENTHESIS &&
+               GetOperatorNum(operators.back().op) == 1) {
+            reduceTop();
+        }
+    };
+
+    bool expectOperand = true;
+    auto iter = expression.begin();
+    while (iter != expression.end()) {
+        auto c = *iter;
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            ++iter;
+            continue;
+        }
+
+        if (IsBasicOperator(c)) {
+            auto pos = posOf(iter);
+            ++iter;
+
+            if (expectOperand) {
+                if (c == '(') {
+                    operators.push_back({MathOperator::MATH_LEFT_PARENTHESIS, pos});
+                } else if (c == '+' || c == '-') {
+                    operators.push_back({BaseOperatorCharToEnum(c, true), pos});
+                } else {
+                    throw SingleParseError(line, pos, content, "Missing operand before: \"", StringView{iter - 1, 1},
+                                           "\"");
+                }
+                continue;
+            }
+
+            if (c == '(') {
+                throw SingleParseError(line, pos, content, "Parse Error at: \"", StringView{iter - 1, 1}, "\"");
+            }
+
+            if (c == ')') {
+                while (!operators.empty() && operators.back().op != MathOperator::MATH_LEFT_PARENTHESIS) {
+                    reduceTop();
+                }
+                if (operators.empty()) {
+                    throw SingleParseError(line, pos, content, "Parenthesis not match: \"", StringView{iter - 1, 1},
+                                           "\"");
+                }
+                operators.pop_back();
+                reducePrefix();
+                continue;
+            }
+
+            // 二元运算符：左结合则挤出高优先级及同优先级运算符，右结合则只挤出高优先级运算符
+            auto op = BaseOperatorCharToEnum(c, false);
+            auto rank = Rank(op);
+            while (!operators.empty() && operators.back().op != MathOperator::MATH_LEFT_PARENTHESIS) {
+                auto top = operators.back().op;
+                if (rank < Rank(top) || (rank == Rank(top) && IsLeft2Right(top))) {
+                    reduceTop();
+                } else {
+                    break;
+                }
+            }
+            operators.push_back({op, pos});
+            expectOperand = true;
+            continue;
+        }
+
+        // 数值、函数名或者变量名
+        auto nameIter = iter;
+        while (iter != expression.end() && !IsBasicOperator(*iter) &&
+               !std::isspace(static_cast<unsigned char>(*iter))) {
+            ++iter;
+        }
+        auto name = StringView{nameIter, static_cast<std::size_t>(std::distance(nameIter, iter))};
+        auto pos = posOf(nameIter);
+
+        if (!expectOperand) {
+            throw SingleParseError(line, pos, content, "Parse Error at: \"", name, "\"");
+        }
+
+        double d;
+        if (StrToNumber(name, d)) {
+            operands.emplace_back(builder.Number(d));
+            expectOperand = false;
+            reducePrefix();
+            continue;
+        }
+
+        auto op = Str2Function(name);
+        if (op != MathOperator::MATH_NULL) {
+            operators.push_back({op, pos});
+            continue;
+        }
+
+        if (!IsLegalVarName(name)) {
+            throw SingleParseError(line, pos, content, "Invalid variable name: \"", name, "\"");
+        }
+        operands.emplace_back(
+            builder.Variable(name.begin(), static_cast<std::size_t>(std::distance(name.begin(), name.end()))));
+        expectOperand = false;
+        reducePrefix();
+    }
+
+    if (expectOperand) {
+        throw SingleParseError(line, posOf(expression.end()), content, "Missing operand at the end");
+    }
+
+    while (!operators.empty()) {
+        // 退栈时出现左括号，说明没有找到与之匹配的右括号
+        if (operators.back().op == MathOperator::MATH_LEFT_PARENTHESIS) {
+            throw SingleParseError(line, operators.back().pos, content, "Parenthesis not match: \"(\"");
+        }
+        reduceTop();
+    }
+
+    assert(operands.size() == 1);
+    return builder.Finish(std::move(operands.back()));
+}
+
 } // namespace internal
 
 Node Parse(internal::StringView expression) {
-    auto tokens = internal::ParseFunctions::ParseToTokens(expression);
-    auto postOrder = internal::ParseFunctions::InOrderToPostOrder(tokens);
-    auto node = internal::ParseFunctions::BuildExpressionTree(postOrder);
-    return node;
+    internal::NodeBuilder builder;
+    return internal::ParseWith(expression, builder, 0, expression);
+}
+
+FlatNode ParseFlat(internal::StringView expression) {
+    internal::FlatNodeBuilder builder;
+    return internal::ParseWith(expression, builder, 0, expression);
+}
+
+CompiledExpression ParseCompiled(internal::StringView expression) {
+    internal::CompiledExpressionBuilder builder;
+    return internal::ParseWith(expression, builder, 0, expression);
+}
+
+namespace internal {
+
+// 解析方程组中的一行。lhs = rhs化为lhs - rhs，rhs为0时直接返回lhs
+Node ParseEquation(StringView content, int line) {
+    NodeBuilder builder;
+    auto eq = std::find(content.begin(), content.end(), '=');
+    if (eq == content.end()) {
+        return ParseWith(content, builder, line, content);
+    }
+
+    auto eq2 = std::find(eq + 1, content.end(), '=');
+    if (eq2 != content.end()) {
+        throw SingleParseError(line, static_cast<int>(std::distance(content.begin(), eq2)), content,
+                               "Unexpected \"=\"");
+    }
+
+    auto lhs = ParseWith(StringView{content.begin(), static_cast<std::size_t>(std::distance(content.begin(), eq))},
+                         builder, line, content);
+    auto rhs = ParseWith(StringView{eq + 1, static_cast<std::size_t>(std::distance(eq + 1, content.end()))}, builder,
+                         line, content);
+    if (rhs->Equal(Num(0))) {
+        return lhs;
+    }
+    return Operator(MathOperator::MATH_SUB, std::move(lhs), std::move(rhs));
+}
+
+} // namespace internal
+
+ParsedSystem ParseSystem(internal::StringView text) {
+    // 先顺序切分出所有行，去掉注释，跳过空行
+    struct Line {
+        internal::StringView content;
+        int line;
+    };
+    std::vector<Line> lines;
+    auto iter = text.begin();
+    for (int line = 0; iter != text.end(); ++line) {
+        auto lineEnd = std::find(iter, text.end(), '\n');
+        auto contentEnd = std::find(iter, lineEnd, '#');
+        if (!std::all_of(iter, contentEnd, [](char c) {
+                return std::isspace(static_cast<unsigned char>(c));
+            })) {
+            lines.push_back({{iter, static_cast<std::size_t>(std::distance(iter, contentEnd))}, line});
+        }
+        iter = lineEnd == text.end() ? lineEnd : lineEnd + 1;
+    }
+
+    if (lines.empty()) {
+        throw SingleParseError(0, 0, {}, "no equation");
+    }
+
+    // 各行互不依赖，分块并行解析。收集所有行的错误，而不是遇到第一个错误就停止
+    int n = static_cast<int>(lines.size());
+    std::vector<Node> nodes(n);
+    std::vector<SingleParseError> errors;
+    std::mutex mutex;
+    internal::ParallelFor(n, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            try {
+                nodes[i] = internal::ParseEquation(lines[i].content, lines[i].line);
+            } catch (const SingleParseError &err) {
+                std::lock_guard<std::mutex> lock(mutex);
+                errors.emplace_back(err);
+            }
+        }
+    });
+
+    if (!errors.empty()) {
+        std::sort(errors.begin(), errors.end(), [](const SingleParseError &lhs, const SingleParseError &rhs) {
+            return lhs.GetLine() < rhs.GetLine();
+        });
+        if (errors.size() == 1) {
+            throw errors.front();
+        }
+        // MultiParseError按逆序输出
+        std::reverse(errors.begin(), errors.end());
+        throw MultiParseError(errors);
+    }
+
+    SymVec equations(n);
+    for (int i = 0; i < n; ++i) {
+        equations[i] = std::move(nodes[i]);
+    }
+    auto varSet = equations.GetAllVarNames();
+    return {std::move(equations), {varSet.begin(), varSet.end()}};
+}
+
+ParsedSystem ParseSystemFile(const std::string &filename) {
+    MappedFile file(filename);
+    return ParseSystem({file.Data(), file.Size()});
 }
 
 Node operator""_f(const char *exp, size_t) {
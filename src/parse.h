@@ -1,11 +1,15 @@
 #pragma once
 
+#include "compiled.h"
+#include "flat_node.h"
 #include "node.h"
+#include "symmat.h"
 
 #include <cstring>
 #include <sstream>
 #include <stdexcept>
 #include <utility>
+#include <vector>
 
 namespace tomsolver {
 
@@ -145,10 +149,51 @@ public:
 
 /**
  * 把字符串解析为表达式。
+ * 单遍解析：词法分析与按优先级归约同时进行，直接构造节点，不生成中间的记号序列。非递归实现，括号嵌套再深也不会栈溢出。
+ * 语法与ParseFunctions的三步解析一致。
  * @exception ParseError
  */
 Node Parse(internal::StringView expression);
 
+/**
+ * 把字符串直接解析为FlatNode，所有节点连续存放在一个数组内，不为每个节点单独分配内存。
+ * 语法与Parse()相同。
+ * @exception ParseError
+ */
+FlatNode ParseFlat(internal::StringView expression);
+
+/**
+ * 把字符串直接编译为CompiledExpression，不经过Node。生成指令时做常量折叠。
+ * 语法与Parse()相同。
+ * @exception ParseError
+ */
+CompiledExpression ParseCompiled(internal::StringView expression);
+
+/**
+ * 方程组的解析结果。
+ */
+struct ParsedSystem {
+    SymVec equations;              // 每行一个方程，lhs = rhs化为lhs - rhs
+    std::vector<std::string> vars; // 所有方程中出现的变量名，按字典序排列
+};
+
+/**
+ * 把多行文本解析为方程组。
+ * 每行一个方程，可以写作表达式（即表达式 = 0）或者lhs = rhs的形式；#及之后到行尾为注释；空行与只有注释的行被跳过。
+ * 各行分块并行解析，线程数由Config::Get().threadNum决定。
+ * 出错时SingleParseError::GetLine()为出错的行号（从0开始），GetPos()为该行内的位置。
+ * 多行出错时抛出MultiParseError，包含所有出错的行。
+ * @exception ParseError
+ */
+ParsedSystem ParseSystem(internal::StringView text);
+
+/**
+ * 读取文件并解析为方程组，格式同ParseSystem()。文件通过MappedFile读取。
+ * @exception runtime_error 无法打开文件
+ * @exception ParseError
+ */
+ParsedSystem ParseSystemFile(const std::string &filename);
+
 Node operator""_f(const char *exp, size_t);
 
 } // namespace tomsolver
\ No newline at end of file
@@ -0,0 +1,218 @@
+#include "prepared_cache.h"
+
+#include "config.h"
+#include "mapped_file.h"
+#include "serialize.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace tomsolver {
+
+namespace internal {
+
+/**
+ * 缓存目录内的一个缓存文件。
+ */
+struct PreparedCacheFile {
+    std::string path;
+    std::size_t size;
+    std::int64_t mtime; // 纳秒
+};
+
+const char PreparedCachePrefix[] = "tomsolver_prepared_";
+const char PreparedCacheSuffix[] = ".tsbn";
+
+/**
+ * 列出目录内的缓存文件，只认文件名形如tomsolver_prepared_*.tsbn的普通文件，其他文件（包括写了一半的临时文件）不计入。
+ */
+std::vector<PreparedCacheFile> ListPreparedCacheFiles(const std::string &dir) noexcept {
+    std::vector<PreparedCacheFile> files;
+#if defined(__unix__) || defined(__APPLE__)
+    auto d = opendir(dir.c_str());
+    if (!d) {
+        return files;
+    }
+    const std::string prefix(PreparedCachePrefix), suffix(PreparedCacheSuffix);
+    while (auto entry = readdir(d)) {
+        std::string name(entry->d_name);
+        if (name.size() < prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            continue;
+        }
+        auto path = dir + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            // 可能已经被其他进程删除
+            continue;
+        }
+#if defined(__APPLE__)
+        auto &ts = st.st_mtimespec;
+#else
+        auto &ts = st.st_mtim;
+#endif
+        files.push_back({std::move(path), static_cast<std::size_t>(st.st_size),
+                         static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec});
+    }
+    closedir(d);
+#else
+    (void)dir;
+#endif
+    return files;
+}
+
+} // namespace internal
+
+PreparedCache &PreparedCache::Get() {
+    static PreparedCache cache;
+    return cache;
+}
+
+bool PreparedCache::IsSupported() noexcept {
+#if defined(__unix__) || defined(__APPLE__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::unique_ptr<PreparedSystem> PreparedCache::Find(const SymVec &equations,
+                                                    const std::vector<std::string> &vars) noexcept {
+#if defined(__unix__) || defined(__APPLE__)
+    auto path = Path(equations, vars);
+    try {
+        MappedFile file(path);
+        auto system = std::make_unique<PreparedSystem>(DeserializePreparedSystem(file.Data(), file.Size()));
+        // 文件名只是哈希，还要确认内容就是要找的模型
+        if (system->vars == vars && system->equations == equations) {
+            // 更新修改时间，作为LRU的最近使用时间
+            utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+            ++hits;
+            return system;
+        }
+    } catch (const std::exception &) {
+        // 文件不存在、已经损坏或者内存不足，视为未命中，之后Insert()会覆盖它
+    }
+#else
+    (void)equations;
+    (void)vars;
+#endif
+    ++misses;
+    return nullptr;
+}
+
+void PreparedCache::Insert(const PreparedSystem &system) noexcept {
+#if defined(__unix__) || defined(__APPLE__)
+    auto &dir = Config::Get().preparedCacheDir;
+    if (dir.empty()) {
+        return;
+    }
+    mkdir(dir.c_str(), 0777);
+
+    auto path = Path(system.equations, system.vars);
+    auto data = Serialize(system);
+
+    // 先写临时文件，再改名为最终的文件名。改名是原子的，其他进程、线程不会读到写了一半的文件
+    static std::atomic<int> counter{0};
+    auto tmp = path + "." + std::to_string(getpid()) + "." + std::to_string(counter++);
+    bool ok;
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        ok = static_cast<bool>(out);
+    }
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        if (Config::Get().logLevel >= LogLevel::WARN) {
+            std::cout << "[WARN] PreparedCache: can not write " << path << std::endl;
+        }
+        return;
+    }
+
+    Evict();
+#else
+    (void)system;
+#endif
+}
+
+void PreparedCache::Evict() noexcept {
+    auto maxBytes = Config::Get().preparedCacheMaxBytes;
+    if (maxBytes == 0) {
+        return;
+    }
+
+    auto files = internal::ListPreparedCacheFiles(Config::Get().preparedCacheDir);
+    std::size_t total = 0;
+    for (auto &file : files) {
+        total += file.size;
+    }
+    if (total <= maxBytes) {
+        return;
+    }
+
+    std::sort(files.begin(), files.end(), [](const internal::PreparedCacheFile &a, const internal::PreparedCacheFile &b) {
+        return a.mtime < b.mtime;
+    });
+    for (auto &file : files) {
+        if (total <= maxBytes) {
+            break;
+        }
+        // 其他进程可能同时在淘汰，删除失败也照样扣除
+        std::remove(file.path.c_str());
+        total -= file.size;
+    }
+}
+
+void PreparedCache::Clear() noexcept {
+    for (auto &file : internal::ListPreparedCacheFiles(Config::Get().preparedCacheDir)) {
+        std::remove(file.path.c_str());
+    }
+    hits = 0;
+    misses = 0;
+}
+
+std::size_t PreparedCache::DiskUsage() const noexcept {
+    std::size_t total = 0;
+    for (auto &file : internal::ListPreparedCacheFiles(Config::Get().preparedCacheDir)) {
+        total += file.size;
+    }
+    return total;
+}
+
+std::size_t PreparedCache::Hits() const noexcept {
+    return hits;
+}
+
+std::size_t PreparedCache::Misses() const noexcept {
+    return misses;
+}
+
+std::string PreparedCache::Path(const SymVec &equations, const std::vector<std::string> &vars) noexcept {
+    std::stringstream name;
+    name << Config::Get().preparedCacheDir << "/" << internal::PreparedCachePrefix << std::hex << std::setw(16)
+         << std::setfill('0') << MakeKey(equations, vars) << internal::PreparedCacheSuffix;
+    return name.str();
+}
+
+std::uint64_t PreparedCache::MakeKey(const SymVec &equations, const std::vector<std::string> &vars) noexcept {
+    // 格式版本也参与哈希，升级后不会读到旧格式的文件
+    auto seed = internal::HashCombine(equations.Hash(), internal::SerializeVersion);
+    for (auto &var : vars) {
+        seed = internal::HashCombine(seed, internal::HashSingleNode(NodeType::VARIABLE, MathOperator::MATH_NULL, 0, var));
+    }
+    return seed;
+}
+
+} // namespace tomsolver
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "nonlinear.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tomsolver {
+
+/**
+ * 预处理结果（PreparedSystem）的磁盘缓存。Config::Get().preparedCacheDir不为空时，Prepare()先从这里查找。
+ * 每个模型保存为目录下的一个文件，文件名由方程组的结构哈希与变量名计算得到，内容为Serialize()的结果。
+ * 写入时先写临时文件再原子地改名，多个进程、线程可以同时读写同一个目录；读到损坏的文件或者哈希冲突时视为未命中。
+ * 写入后，若目录内缓存文件的总大小超过Config::Get().preparedCacheMaxBytes，按最近使用时间（修改时间，命中时更新）
+ * 从旧到新删除，即LRU淘汰。
+ * 仅支持POSIX平台，其他平台上Find()总是返回nullptr，Insert()什么也不做。
+ */
+class PreparedCache {
+public:
+    static PreparedCache &Get();
+
+    /**
+     * 当前平台是否支持磁盘缓存。
+     */
+    static bool IsSupported() noexcept;
+
+    /**
+     * 查找equations对vars的预处理结果。未找到时返回nullptr。
+     * 不抛出异常，读取失败视为未命中。
+     */
+    std::unique_ptr<PreparedSystem> Find(const SymVec &equations, const std::vector<std::string> &vars) noexcept;
+
+    /**
+     * 保存预处理结果，然后按Config::Get().preparedCacheMaxBytes淘汰旧的缓存文件。
+     * 不抛出异常，写入失败时只打印警告。
+     */
+    void Insert(const PreparedSystem &system) noexcept;
+
+    /**
+     * 删除目录内所有的缓存文件，并清零命中计数。
+     */
+    void Clear() noexcept;
+
+    /**
+     * 目录内缓存文件的总字节数。
+     */
+    std::size_t DiskUsage() const noexcept;
+
+    /**
+     * 本进程的命中次数。
+     */
+    std::size_t Hits() const noexcept;
+
+    /**
+     * 本进程的未命中次数。
+     */
+    std::size_t Misses() const noexcept;
+
+    /**
+     * equations对vars的预处理结果对应的缓存文件路径。
+     */
+    static std::string Path(const SymVec &equations, const std::vector<std::string> &vars) noexcept;
+
+private:
+    std::atomic<std::size_t> hits{0};
+    std::atomic<std::size_t> misses{0};
+
+    PreparedCache() = default;
+
+    static std::uint64_t MakeKey(const SymVec &equations, const std::vector<std::string> &vars) noexcept;
+
+    void Evict() noexcept;
+};
+
+} // namespace tomsolver
@@ -0,0 +1,308 @@
+#include "serialize.h"
+
+#include "flat_node.h"
+#include "math_operator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace tomsolver {
+
+namespace internal {
+
+enum class SerializedKind : std::uint16_t {
+    NODE = 1,
+    SYMMAT = 2,
+    PREPARED_SYSTEM = 3,
+};
+
+constexpr char SerializeMagic[4] = {'T', 'S', 'B', 'N'};
+constexpr std::uint32_t ByteOrderMark = 0x01020304;
+constexpr std::uint8_t NumberCode = 0xFF;
+constexpr std::uint8_t VariableCode = 0xFE;
+
+/**
+ * 先把表达式写入body，同时登记变量；Finish()时再把头部和变量表放在最前面。
+ */
+class Encoder {
+public:
+    explicit Encoder(SerializedKind kind) noexcept : kind(kind) {}
+
+    template <typename T>
+    void Put(T value) noexcept {
+        body.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    std::uint32_t VarId(const std::string &name) noexcept {
+        auto ret = varIds.emplace(name, static_cast<std::uint32_t>(vars.size()));
+        if (ret.second) {
+            vars.emplace_back(name);
+        }
+        return ret.first->second;
+    }
+
+    void PutExpression(const Node &node) noexcept {
+        FlatNode flat(node);
+        std::vector<std::uint32_t> ids;
+        for (auto &name : flat.VarNames()) {
+            ids.emplace_back(VarId(name));
+        }
+
+        Put(static_cast<std::uint32_t>(flat.Size()));
+        for (auto &item : flat.Items()) {
+            switch (item.type) {
+            case NodeType::NUMBER:
+                Put(NumberCode);
+                Put(item.value);
+                break;
+            case NodeType::VARIABLE:
+                Put(VariableCode);
+                Put(ids[item.varId]);
+                break;
+            case NodeType::OPERATOR:
+                Put(static_cast<std::uint8_t>(item.op));
+                break;
+            }
+        }
+    }
+
+    void PutMatrix(const SymMat &mat) noexcept {
+        Put(static_cast<std::int32_t>(mat.Rows()));
+        Put(static_cast<std::int32_t>(mat.Cols()));
+        for (int i = 0; i < mat.Rows(); ++i) {
+            for (int j = 0; j < mat.Cols(); ++j) {
+                PutExpression(mat.Value(i, j));
+            }
+        }
+    }
+
+    std::string Finish() noexcept {
+        std::string head;
+        std::swap(head, body);
+
+        body.append(SerializeMagic, sizeof(SerializeMagic));
+        Put(SerializeVersion);
+        Put(static_cast<std::uint16_t>(kind));
+        Put(ByteOrderMark);
+        Put(static_cast<std::uint32_t>(0));
+
+        Put(static_cast<std::uint32_t>(vars.size()));
+        for (auto &name : vars) {
+            Put(static_cast<std::uint32_t>(name.size()));
+            body.append(name);
+        }
+
+        body.append(head);
+        return std::move(body);
+    }
+
+private:
+    SerializedKind kind;
+    std::string body;
+    std::vector<std::string> vars;
+    std::unordered_map<std::string, std::uint32_t> varIds;
+};
+
+/**
+ * 顺序读取序列化数据。构造时检查头部并读入变量表。任何越界或者不合法的内容都抛出runtime_error。
+ */
+class Decoder {
+public:
+    Decoder(const char *data, std::size_t size, SerializedKind kind) : cur(data), end(data + size) {
+        if (size < sizeof(SerializeMagic) || !std::equal(SerializeMagic, SerializeMagic + 4, data)) {
+            Fail("bad magic");
+        }
+        cur += sizeof(SerializeMagic);
+        if (Get<std::uint16_t>() != SerializeVersion) {
+            Fail("unsupported version");
+        }
+        if (Get<std::uint16_t>() != static_cast<std::uint16_t>(kind)) {
+            Fail("unexpected content kind");
+        }
+        if (Get<std::uint32_t>() != ByteOrderMark) {
+            Fail("byte order mismatch");
+        }
+        Get<std::uint32_t>();
+
+        auto n = Get<std::uint32_t>();
+        vars.reserve(std::min<std::size_t>(n, Remaining()));
+        for (std::uint32_t i = 0; i < n; ++i) {
+            auto len = Get<std::uint32_t>();
+            if (len > Remaining()) {
+                Fail("truncated data");
+            }
+            vars.emplace_back(cur, len);
+            if (!VarNameIsLegal(vars.back())) {
+                Fail("illegal variable name");
+            }
+            cur += len;
+        }
+    }
+
+    template <typename T>
+    T Get() {
+        if (sizeof(T) > Remaining()) {
+            Fail("truncated data");
+        }
+        T value;
+        std::memcpy(&value, cur, sizeof(T));
+        cur += sizeof(T);
+        return value;
+    }
+
+    const std::vector<std::string> &Vars() const noexcept {
+        return vars;
+    }
+
+    std::uint32_t GetVarId() {
+        auto id = Get<std::uint32_t>();
+        if (id >= vars.size()) {
+            Fail("variable id out of range");
+        }
+        return id;
+    }
+
+    // 后序序列逐个入栈构造，非递归实现
+    Node GetExpression() {
+        auto n = Get<std::uint32_t>();
+        std::vector<Node> stk;
+        stk.reserve(std::min<std::size_t>(n, Remaining()));
+        auto popNode = [&stk] {
+            auto node = std::move(stk.back());
+            stk.pop_back();
+            return node;
+        };
+
+        for (std::uint32_t i = 0; i < n; ++i) {
+            auto code = Get<std::uint8_t>();
+            if (code == NumberCode) {
+                stk.emplace_back(Num(Get<double>()));
+                continue;
+            }
+            if (code == VariableCode) {
+                stk.emplace_back(Var(vars[GetVarId()]));
+                continue;
+            }
+
+            if (code < static_cast<std::uint8_t>(MathOperator::MATH_POSITIVE) ||
+                code > static_cast<std::uint8_t>(MathOperator::MATH_MOD)) {
+                Fail("unknown operator");
+            }
+            auto op = static_cast<MathOperator>(code);
+            auto operandNum = static_cast<std::size_t>(GetOperatorNum(op));
+            if (stk.size() < operandNum) {
+                Fail("missing operand");
+            }
+            if (operandNum == 2) {
+                auto right = popNode();
+                auto left = popNode();
+                stk.emplace_back(Operator(op, std::move(left), std::move(right)));
+            } else {
+                stk.emplace_back(Operator(op, popNode()));
+            }
+        }
+
+        if (stk.size() != 1) {
+            Fail("malformed expression");
+        }
+        return popNode();
+    }
+
+    SymMat GetMatrix() {
+        auto rows = Get<std::int32_t>();
+        auto cols = Get<std::int32_t>();
+        // 每个元素至少占5个字节，以此拒绝明显不合法的维数
+        if (rows <= 0 || cols <= 0 || static_cast<std::uint64_t>(rows) * static_cast<std::uint64_t>(cols) * 5 >
+                                          static_cast<std::uint64_t>(Remaining())) {
+            Fail("bad matrix size");
+        }
+        SymMat mat(rows, cols);
+        for (int i = 0; i < rows; ++i) {
+            for (int j = 0; j < cols; ++j) {
+                mat.Value(i, j) = GetExpression();
+            }
+        }
+        return mat;
+    }
+
+    void Finish() const {
+        if (cur != end) {
+            Fail("trailing data");
+        }
+    }
+
+private:
+    const char *cur;
+    const char *end;
+    std::vector<std::string> vars;
+
+    std::size_t Remaining() const noexcept {
+        return static_cast<std::size_t>(end - cur);
+    }
+
+    [[noreturn]] void Fail(const char *reason) const {
+        throw std::runtime_error(std::string("invalid serialized data: ") + reason);
+    }
+};
+
+} // namespace internal
+
+std::string Serialize(const Node &node) {
+    internal::Encoder encoder(internal::SerializedKind::NODE);
+    encoder.PutExpression(node);
+    return encoder.Finish();
+}
+
+std::string Serialize(const SymMat &mat) {
+    internal::Encoder encoder(internal::SerializedKind::SYMMAT);
+    encoder.PutMatrix(mat);
+    return encoder.Finish();
+}
+
+std::string Serialize(const PreparedSystem &system) {
+    internal::Encoder encoder(internal::SerializedKind::PREPARED_SYSTEM);
+    encoder.Put(static_cast<std::uint32_t>(system.vars.size()));
+    for (auto &var : system.vars) {
+        encoder.Put(encoder.VarId(var));
+    }
+    encoder.PutMatrix(system.equations);
+    encoder.PutMatrix(system.jacobian);
+    return encoder.Finish();
+}
+
+Node DeserializeNode(const char *data, std::size_t size) {
+    internal::Decoder decoder(data, size, internal::SerializedKind::NODE);
+    auto node = decoder.GetExpression();
+    decoder.Finish();
+    return node;
+}
+
+SymMat DeserializeSymMat(const char *data, std::size_t size) {
+    internal::Decoder decoder(data, size, internal::SerializedKind::SYMMAT);
+    auto mat = decoder.GetMatrix();
+    decoder.Finish();
+    return mat;
+}
+
+PreparedSystem DeserializePreparedSystem(const char *data, std::size_t size) {
+    internal::Decoder decoder(data, size, internal::SerializedKind::PREPARED_SYSTEM);
+    auto n = decoder.Get<std::uint32_t>();
+    std::vector<std::string> vars;
+    for (std::uint32_t i = 0; i < n; ++i) {
+        vars.emplace_back(decoder.Vars()[decoder.GetVarId()]);
+    }
+    auto equations = decoder.GetMatrix();
+    auto jacobian = decoder.GetMatrix();
+    decoder.Finish();
+
+    if (equations.Cols() != 1 || jacobian.Rows() != equations.Rows() ||
+        jacobian.Cols() != static_cast<int>(vars.size())) {
+        throw std::runtime_error("invalid serialized data: dimension mismatch");
+    }
+    return {equations.ToSymVec(), std::move(vars), std::move(jacobian)};
+}
+
+} // namespace tomsolver
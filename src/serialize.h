@@ -0,0 +1,64 @@
+#pragma once
+
+#include "node.h"
+#include "nonlinear.h"
+#include "symmat.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace tomsolver {
+
+namespace internal {
+
+/**
+ * 序列化格式的版本号。格式有任何变化时加1。
+ */
+constexpr std::uint16_t SerializeVersion = 1;
+
+} // namespace internal
+
+/**
+ * 二进制序列化。与ToString()、Parse()相比，数值原样保存IEEE 754的8个字节，不需要格式化与解析，也不会损失精度。
+ * 格式如下，所有整数与浮点数按本机字节序写入：
+ *
+ *     头部（16字节）：magic "TSBN"，u16 版本号，u16 内容类型，u32 字节序标记0x01020304，u32 保留
+ *     变量表：       u32 变量数，之后每个变量为 u32 长度 + 变量名
+ *     表达式：       u32 节点数，之后按后序逐个排列节点：
+ *                        u8 0xFF + f64    数值
+ *                        u8 0xFE + u32    变量，值为变量表中的下标
+ *                        u8 op            运算符，值为MathOperator
+ *     矩阵：         i32 行数，i32 列数，之后按行优先排列每个元素的表达式
+ *
+ * 内容类型为1时，变量表之后是一个表达式；为2时是一个矩阵；为3时是PreparedSystem：
+ * u32 变量数 + 每个变量在变量表中的下标，之后依次是equations与jacobian两个矩阵。
+ *
+ * 反序列化直接从传入的内存中读取，不复制到中间缓冲区。与MappedFile配合即是零拷贝的加载方式：
+ *     MappedFile file(filename);
+ *     auto system = DeserializePreparedSystem(file.Data(), file.Size());
+ *
+ * 版本号、内容类型或者字节序不符，以及数据不完整、不合法时，反序列化抛出runtime_error。
+ */
+std::string Serialize(const Node &node);
+
+std::string Serialize(const SymMat &mat);
+
+std::string Serialize(const PreparedSystem &system);
+
+/**
+ * @exception runtime_error 数据不合法
+ */
+Node DeserializeNode(const char *data, std::size_t size);
+
+/**
+ * @exception runtime_error 数据不合法
+ */
+SymMat DeserializeSymMat(const char *data, std::size_t size);
+
+/**
+ * @exception runtime_error 数据不合法
+ */
+PreparedSystem DeserializePreparedSystem(const char *data, std::size_t size);
+
+} // namespace tomsolver
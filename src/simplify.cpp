@@ -4,8 +4,13 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <deque>
 #include <iostream>
 #include <stack>
+#include <utility>
+#include <vector>
 
 namespace tomsolver {
 
@@ -80,6 +85,346 @@ public:
         }
     }
 
+    // 幂次为数值的因子：base^exponent
+    struct Factor {
+        Node base;
+        double exponent;
+        std::uint64_t hash; // base的哈希值，用于排序和合并
+    };
+
+    // 和式中的一项：coef*factors[0]*factors[1]*...
+    struct Term {
+        double coef = 1;
+        std::vector<Factor> factors;
+    };
+
+    static bool IsSumOperator(MathOperator op) noexcept {
+        return op == MathOperator::MATH_ADD || op == MathOperator::MATH_SUB || op == MathOperator::MATH_POSITIVE ||
+               op == MathOperator::MATH_NEGATIVE;
+    }
+
+    static bool IsProductOperator(MathOperator op) noexcept {
+        return op == MathOperator::MATH_MULTIPLY || op == MathOperator::MATH_DIVIDE;
+    }
+
+    // 因子的排列顺序：变量在前（按变量名），运算符在后（按运算符、哈希值），同底数幂次高的在前
+    static bool FactorLess(const Factor &lhs, const Factor &rhs) noexcept {
+        auto rank = [](NodeType type) {
+            return type == NodeType::VARIABLE ? 0 : (type == NodeType::OPERATOR ? 1 : 2);
+        };
+        auto &l = *lhs.base;
+        auto &r = *rhs.base;
+        if (l.type != r.type) {
+            return rank(l.type) < rank(r.type);
+        }
+        if (l.type == NodeType::VARIABLE && l.varname != r.varname) {
+            return l.varname < r.varname;
+        }
+        if (l.type == NodeType::OPERATOR && l.op != r.op) {
+            return l.op < r.op;
+        }
+        if (lhs.hash != rhs.hash) {
+            return lhs.hash < rhs.hash;
+        }
+        return lhs.exponent > rhs.exponent;
+    }
+
+    static bool IsInteger(double value) noexcept {
+        return std::trunc(value) == value;
+    }
+
+    static bool SameBase(const Factor &lhs, const Factor &rhs) noexcept {
+        return lhs.hash == rhs.hash && lhs.base->Equal(rhs.base);
+    }
+
+    // 项的排列顺序：按因子逐个比较
+    static bool TermLess(const Term &lhs, const Term &rhs) noexcept {
+        return std::lexicographical_compare(lhs.factors.begin(), lhs.factors.end(), rhs.factors.begin(),
+                                            rhs.factors.end(), FactorLess);
+    }
+
+    // 两项除系数外是否相同
+    static bool SameFactors(const Term &lhs, const Term &rhs) noexcept {
+        return std::equal(lhs.factors.begin(), lhs.factors.end(), rhs.factors.begin(), rhs.factors.end(),
+                          [](const Factor &l, const Factor &r) {
+                              return l.exponent == r.exponent && SameBase(l, r);
+                          });
+    }
+
+    // 把积node展开到term中：数值乘入系数，其余的因子排序后合并同底数幂。
+    // 遇到乘、除、正负号时继续向下展开，因此node内部的乘除链不必事先化简。非递归实现。
+    static void CollectFactors(Node node, Term &term) noexcept {
+        std::stack<std::pair<Node, double>> stk;
+        stk.emplace(std::move(node), 1.0);
+        while (!stk.empty()) {
+            auto cur = std::move(stk.top().first);
+            auto exponent = stk.top().second;
+            stk.pop();
+
+            if (cur->type == NodeType::NUMBER && (exponent > 0 || cur->value != 0.0)) {
+                term.coef = exponent > 0 ? term.coef * cur->value : term.coef / cur->value;
+                continue;
+            }
+
+            if (cur->type == NodeType::OPERATOR) {
+                switch (cur->op) {
+                case MathOperator::MATH_MULTIPLY:
+                    stk.emplace(Move(cur->left), exponent);
+                    stk.emplace(Move(cur->right), exponent);
+                    continue;
+                case MathOperator::MATH_DIVIDE:
+                    stk.emplace(Move(cur->left), exponent);
+                    stk.emplace(Move(cur->right), -exponent);
+                    continue;
+                case MathOperator::MATH_NEGATIVE:
+                    term.coef = -term.coef;
+                    stk.emplace(Move(cur->left), exponent);
+                    continue;
+                case MathOperator::MATH_POSITIVE:
+                    stk.emplace(Move(cur->left), exponent);
+                    continue;
+                case MathOperator::MATH_POWER:
+                    if (cur->right->type == NodeType::NUMBER) {
+                        exponent *= cur->right->value;
+                        cur = Move(cur->left);
+                    }
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            cur->parent = nullptr;
+            auto hash = cur->Hash();
+            term.factors.emplace_back(Factor{std::move(cur), exponent, hash});
+        }
+
+        // 合并同底数的整数次幂，去掉0次幂。合并不能扩大定义域：
+        // 非整数次幂在底数小于0时无定义，不参与合并，例如x^0.5*x^0.5不能化为x；
+        // 负整数次幂在底数为0时无定义，正、负次幂合并后仍为负数次幂时才合并，例如x/x、x^2/x保持不变，x/x^3化为1/x^2
+        auto &factors = term.factors;
+        std::sort(factors.begin(), factors.end(), FactorLess);
+        std::vector<Factor> merged;
+        for (auto first = factors.begin(); first != factors.end();) {
+            // 同底数的因子排在一起
+            auto last = std::find_if(first, factors.end(), [&first](const Factor &factor) {
+                return !SameBase(*first, factor);
+            });
+            Factor *positive = nullptr;
+            Factor *negative = nullptr;
+            for (auto it = first; it != last; ++it) {
+                if (!IsInteger(it->exponent)) {
+                    merged.emplace_back(std::move(*it));
+                    continue;
+                }
+                auto &target = it->exponent > 0 ? positive : negative;
+                if (target) {
+                    target->exponent += it->exponent;
+                } else {
+                    target = &*it;
+                }
+            }
+            if (positive && negative && positive->exponent + negative->exponent < 0) {
+                negative->exponent += positive->exponent;
+                positive = nullptr;
+            }
+            for (auto factor : {positive, negative}) {
+                if (factor) {
+                    merged.emplace_back(std::move(*factor));
+                }
+            }
+            first = last;
+        }
+        std::sort(merged.begin(), merged.end(), FactorLess);
+        merged.erase(std::remove_if(merged.begin(), merged.end(),
+                                    [](const Factor &factor) {
+                                        return factor.exponent == 0;
+                                    }),
+                     merged.end());
+        factors = std::move(merged);
+    }
+
+    // 由系数和因子重新构造出积：coef*正次幂的因子/负次幂的因子。
+    static Node BuildProduct(double coef, std::vector<Factor> &factors) noexcept {
+        if (coef == 0) {
+            return Num(0);
+        }
+
+        auto multiply = [](Node &acc, Node node) {
+            acc = acc ? Operator(MathOperator::MATH_MULTIPLY, Move(acc), std::move(node)) : std::move(node);
+        };
+
+        Node numerator = std::abs(coef) == 1 ? nullptr : Num(std::abs(coef));
+        Node denominator;
+        for (auto &factor : factors) {
+            auto exponent = std::abs(factor.exponent);
+            auto node = exponent == 1 ? Move(factor.base)
+                                      : Operator(MathOperator::MATH_POWER, Move(factor.base), Num(exponent));
+            multiply(factor.exponent > 0 ? numerator : denominator, std::move(node));
+        }
+
+        if (!numerator) {
+            numerator = Num(1);
+        }
+        if (coef < 0) {
+            numerator = numerator->type == NodeType::NUMBER ? Num(-numerator->value)
+                                                            : Operator(MathOperator::MATH_NEGATIVE, Move(numerator));
+        }
+        return denominator ? Operator(MathOperator::MATH_DIVIDE, Move(numerator), Move(denominator)) : Move(numerator);
+    }
+
+    // 把乘除链化简为规范形式。
+    static Node CanonicalProduct(Node node) noexcept {
+        Term term;
+        CollectFactors(std::move(node), term);
+        return BuildProduct(term.coef, term.factors);
+    }
+
+    // 把加减链化简为规范形式：常数在前，其余各项排序后合并同类项。非递归实现。
+    static Node CanonicalSum(Node node) noexcept {
+        double constant = 0;
+        std::vector<Term> terms;
+
+        std::stack<std::pair<Node, double>> stk;
+        stk.emplace(std::move(node), 1.0);
+        while (!stk.empty()) {
+            auto cur = std::move(stk.top().first);
+            auto sign = stk.top().second;
+            stk.pop();
+
+            if (cur->type == NodeType::NUMBER) {
+                constant += sign * cur->value;
+                continue;
+            }
+
+            if (cur->type == NodeType::OPERATOR && IsSumOperator(cur->op)) {
+                switch (cur->op) {
+                case MathOperator::MATH_ADD:
+                    stk.emplace(Move(cur->right), sign);
+                    stk.emplace(Move(cur->left), sign);
+                    break;
+                case MathOperator::MATH_SUB:
+                    stk.emplace(Move(cur->right), -sign);
+                    stk.emplace(Move(cur->left), sign);
+                    break;
+                case MathOperator::MATH_NEGATIVE:
+                    stk.emplace(Move(cur->left), -sign);
+                    break;
+                default:
+                    stk.emplace(Move(cur->left), sign);
+                    break;
+                }
+                continue;
+            }
+
+            Term term;
+            CollectFactors(std::move(cur), term);
+            term.coef *= sign;
+            if (term.factors.empty()) {
+                constant += term.coef;
+            } else {
+                terms.emplace_back(std::move(term));
+            }
+        }
+
+        // 合并同类项
+        std::stable_sort(terms.begin(), terms.end(), TermLess);
+        std::vector<Term> merged;
+        for (auto &term : terms) {
+            if (!merged.empty() && SameFactors(merged.back(), term)) {
+                merged.back().coef += term.coef;
+            } else {
+                merged.emplace_back(std::move(term));
+            }
+        }
+
+        merged.erase(std::remove_if(merged.begin(), merged.end(),
+                                    [](const Term &term) {
+                                        return term.coef == 0;
+                                    }),
+                     merged.end());
+
+        // 没有常数项时，把第一个正项提到最前面，避免以负号开头，例如 -a+b -> b-a
+        if (constant == 0) {
+            auto firstPositive = std::find_if(merged.begin(), merged.end(), [](const Term &term) {
+                return term.coef > 0;
+            });
+            if (firstPositive != merged.end()) {
+                std::rotate(merged.begin(), firstPositive, firstPositive + 1);
+            }
+        }
+
+        Node ret = constant == 0 ? nullptr : Num(constant);
+        for (auto &term : merged) {
+            if (!ret) {
+                ret = BuildProduct(term.coef, term.factors);
+            } else if (term.coef > 0) {
+                ret = Operator(MathOperator::MATH_ADD, Move(ret), BuildProduct(term.coef, term.factors));
+            } else {
+                ret = Operator(MathOperator::MATH_SUB, Move(ret), BuildProduct(-term.coef, term.factors));
+            }
+        }
+        return ret ? Move(ret) : Num(0);
+    }
+
+    // 对单个乘方节点进行化简。
+    static void SimplifyPower(Node &n) noexcept {
+        SimplifySingleNode(n);
+        if (n->type != NodeType::OPERATOR || n->op != MathOperator::MATH_POWER) {
+            return;
+        }
+
+        auto parent = n->parent;
+        auto &base = n->left;
+        auto &exponent = n->right;
+
+        // 任何数的0次方、1的任何次方，等于1
+        if ((exponent->type == NodeType::NUMBER && exponent->value == 0.0) ||
+            (base->type == NodeType::NUMBER && base->value == 1.0)) {
+            n = Num(1);
+            n->parent = parent;
+            return;
+        }
+
+        // (x^a)^b = x^(a*b)，a、b都为整数时成立。a不是整数时x^a在x < 0处无定义，例如(x^0.5)^2不能化为x
+        if (exponent->type == NodeType::NUMBER && IsInteger(exponent->value) && base->type == NodeType::OPERATOR &&
+            base->op == MathOperator::MATH_POWER && base->right->type == NodeType::NUMBER &&
+            IsInteger(base->right->value)) {
+            auto value = base->right->value * exponent->value;
+            n = Operator(MathOperator::MATH_POWER, Move(base->left), Num(value));
+            n->parent = parent;
+            SimplifySingleNode(n);
+        }
+    }
+
+    // 对单节点n进行规范化化简。n的子节点都已经化简过。
+    // 加减链、乘除链只在链的顶端整体处理一次，链的中间节点跳过。
+    static void SimplifyNodeCanonically(Node &n) noexcept {
+        // 纯数值的子表达式按原有的运算顺序直接计算，避免重新结合带来的舍入误差
+        if (n->left->type == NodeType::NUMBER && (!n->right || n->right->type == NodeType::NUMBER)) {
+            SimplifySingleNode(n);
+            return;
+        }
+
+        auto parent = n->parent;
+        if (IsSumOperator(n->op)) {
+            if (parent && IsSumOperator(parent->op)) {
+                return;
+            }
+            n = CanonicalSum(Move(n));
+        } else if (IsProductOperator(n->op)) {
+            if (parent && IsProductOperator(parent->op)) {
+                return;
+            }
+            n = CanonicalProduct(Move(n));
+        } else if (n->op == MathOperator::MATH_POWER) {
+            SimplifyPower(n);
+        } else {
+            SimplifySingleNode(n);
+        }
+        n->parent = parent;
+    }
+
     // 后序遍历。非递归实现。
     static void SimplifyWholeNode(Node &node) {
 
@@ -120,52 +465,10 @@ public:
 
         // ==== Part II ====
         std::for_each(revertedPostOrder.rbegin(), revertedPostOrder.rend(), [](SimplifyNode &snode) {
-            SimplifySingleNode(snode.isLeftChild ? snode.node.parent->left : snode.node.parent->right);
+            SimplifyNodeCanonically(snode.isLeftChild ? snode.node.parent->left : snode.node.parent->right);
         });
 
-        SimplifyFunctions::SimplifySingleNode(node);
-
-        return;
-
-        // if (GetOperateNum(now->eOperator) == 2) {
-
-        //    //任何节点的0次方均等于1，除了0的0次方已在前面报错
-        //    if (now->eOperator == MATH_POWER && RChildIs0) {
-        //        //替换掉当前运算符，这个1节点将在回溯时处理
-        //        //新建一个1节点
-        //        TNode *temp;
-        //        temp = new TNode;
-        //        temp->eType = NODE_NUMBER;
-        //        temp->value = 1;
-
-        //        // 0节点连接到上面
-        //        if (now != head) {
-        //            if (now->parent->left == now) {
-        //                now->parent->left = temp;
-        //                temp->parent = now->parent;
-        //            }
-        //            if (now->parent->right == now) {
-        //                now->parent->right = temp;
-        //                temp->parent = now->parent;
-        //            }
-        //        } else
-        //            head = temp;
-
-        //        DeleteNode(now);
-        //    }
-
-        //    // 0-x=-x
-        //    if (now->eOperator == MATH_SUB && LChildIs0) {
-        //        TNode *LChild = now->left;
-        //        TNode *RChild = now->right;
-        //        now->eOperator = MATH_NEGATIVE;
-        //        now->left = RChild;
-        //        now->right = NULL;
-
-        //        delete LChild;
-        //    }
-
-        //}
+        SimplifyFunctions::SimplifyNodeCanonically(node);
     }
 };
 
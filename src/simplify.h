@@ -3,6 +3,16 @@
 
 namespace tomsolver {
 
+/**
+ * 化简表达式。非递归实现。
+ * 除了计算出纯数值的子表达式外，还会把加减链、乘除链整理为规范形式：
+ *   1. 展开嵌套的加减、乘除，例如 (a+b)-(c-d) 视为 a+b-c+d；
+ *   2. 合并数值系数与常数项，合并同类项与同底数幂，例如 2*x*3*x -> 6*x^2，x+2*x -> 3*x；
+ *   3. 对各项、各因子排序，因此 x*y 与 y*x 化简后结构一致；
+ *   4. 去掉0、1等单位元，例如 x^0 -> 1，0-x -> -x。
+ * 不会展开乘法分配律。化简不扩大定义域：非整数次幂不与其他幂合并，例如 x^0.5*x^0.5 保持不变；
+ * 正、负整数次幂只有合并后仍为负数次幂时才合并，例如 x/x、x*y/x、x^2/x 保持不变，x/x^3 -> 1/x^2。
+ */
 void Simplify(Node &node) noexcept;
 
 } // namespace tomsolver
@@ -1,9 +1,11 @@
 #include "symmat.h"
 
+#include "config.h"
 #include "diff.h"
 #include "error_type.h"
 #include "mat.h"
 #include "node.h"
+#include "parallel.h"
 #include "subs.h"
 #include <algorithm>
 #include <cmath>
@@ -15,6 +17,21 @@ namespace tomsolver {
 
 using DataType = std::valarray<Node>;
 
+namespace internal {
+
+/**
+ * 数值元素不必计算，但与计算表达式一样，Config::Get().throwOnInvalidValue为true时检查是否为无效值。
+ * @exception MathError 数值为无效值(inf, -inf, nan)
+ */
+double CheckedNumberEntry(double value) {
+    if (Config::Get().throwOnInvalidValue && !std::isfinite(value)) {
+        throw MathError(ErrorType::ERROR_INVALID_NUMBER, "matrix entry: " + ToString(value));
+    }
+    return value;
+}
+
+} // namespace internal
+
 SymMat::SymMat(int rows, int cols) noexcept : rows(rows), cols(cols) {
     assert(rows > 0 && cols > 0);
     data.reset(new DataType(rows * cols));
@@ -92,21 +109,46 @@ Mat SymMat::ToMat() const {
 
 SymMat &SymMat::Calc() {
     for (auto &node : *data) {
-        node->Calc();
+        // 数值节点（包括Jacobian中结构性为0的元素）无需计算，只检查是否为无效值
+        if (node->type == NodeType::NUMBER) {
+            internal::CheckedNumberEntry(node->value);
+        } else {
+            node->Calc();
+        }
     }
     return *this;
 }
 
+Mat SymMat::Vpa(const VarsTable &varsTable) const {
+    std::valarray<double> newData(data->size());
+    std::transform(std::begin(*data), std::end(*data), std::begin(newData), [&varsTable](const Node &node) {
+        return node->type == NodeType::NUMBER ? internal::CheckedNumberEntry(node->value) : node->Vpa(varsTable);
+    });
+    return {rows, cols, newData};
+}
+
 SymMat &SymMat::Subs(const std::map<std::string, double> &varValues) noexcept {
-    for (auto &node : *data) {
-        node = tomsolver::Subs(std::move(node), varValues);
+    std::map<std::string, Node> dict;
+    for (auto &item : varValues) {
+        dict.insert({item.first, Num(item.second)});
     }
-    return *this;
+    return SubsInner(dict);
 }
 
 SymMat &SymMat::Subs(const VarsTable &varsTable) noexcept {
+    std::map<std::string, Node> dict;
+    for (auto &item : varsTable) {
+        dict.insert({item.first, Num(item.second)});
+    }
+    return SubsInner(dict);
+}
+
+SymMat &SymMat::SubsInner(const std::map<std::string, Node> &dict) noexcept {
     for (auto &node : *data) {
-        node = tomsolver::Subs(std::move(node), varsTable);
+        // 数值节点不含变量，跳过
+        if (node->type != NodeType::NUMBER) {
+            node = tomsolver::Subs(std::move(node), dict);
+        }
     }
     return *this;
 }
@@ -120,6 +162,14 @@ std::set<std::string> SymMat::GetAllVarNames() const noexcept {
     return ret;
 }
 
+std::uint64_t SymMat::Hash() const noexcept {
+    auto seed = internal::HashCombine(static_cast<std::uint64_t>(rows), static_cast<std::uint64_t>(cols));
+    for (auto &node : *data) {
+        seed = internal::HashCombine(seed, node->Hash());
+    }
+    return seed;
+}
+
 SymMat SymMat::operator-(const SymMat &rhs) const noexcept {
     assert(rhs.rows == rows && rhs.cols == cols);
     SymMat ret(rows, cols);
@@ -204,18 +254,24 @@ const Node &SymVec::operator[](std::size_t index) const noexcept {
     return (*data)[index];
 }
 
-SymMat Jacobian(const SymMat &equations, const std::vector<std::string> &vars) noexcept {
+SymMat Jacobian(const SymMat &equations, const std::vector<std::string> &vars) {
     int rows = equations.rows;
     int cols = static_cast<int>(vars.size());
     SymMat ja(rows, cols);
-    std::generate(std::begin(*ja.data), std::end(*ja.data),
-                  [iter = std::begin(*equations.data), &vars, i = size_t{0}]() mutable {
-                      if (i == vars.size()) {
-                          i = 0;
-                          iter++;
-                      }
-                      return Diff(*iter, vars[i++]);
-                  });
+
+    // 按行并行。每个单元格只由一个线程写入，结果与串行计算完全一致
+    internal::ParallelFor(rows, [&equations, &vars, &ja, cols](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            auto &equation = (*equations.data)[i];
+
+            // 方程中不含的变量，偏导数必然为0，不必再求导
+            auto varNames = equation->GetAllVarNames();
+            for (int j = 0; j < cols; ++j) {
+                ja.Value(i, j) = varNames.count(vars[j]) ? Diff(equation, vars[j]) : Num(0);
+            }
+        }
+    });
+
     return ja;
 }
 
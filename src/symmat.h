@@ -61,8 +61,24 @@ public:
      */
     SymMat &Calc();
 
+    /**
+     * 以varsTable中的值代入变量，计算出每个元素的数值。
+     * 不改变自身，也不需要先Clone()，可以在多个线程中对同一个矩阵求值。
+     * @exception out_of_range 如果varsTable中没有某个变量
+     * @exception MathError 出现浮点数无效值(inf, -inf, nan)
+     */
+    Mat Vpa(const VarsTable &varsTable) const;
+
+    /**
+     * 把矩阵内的变量替换为数值。
+     * 替换表只构造一次。已经是数值节点的元素（例如Jacobian中结构性为0的元素）直接跳过。
+     */
     SymMat &Subs(const std::map<std::string, double> &varValues) noexcept;
 
+    /**
+     * 把矩阵内的变量替换为数值。
+     * 替换表只构造一次。已经是数值节点的元素（例如Jacobian中结构性为0的元素）直接跳过。
+     */
     SymMat &Subs(const VarsTable &varsTable) noexcept;
 
     /**
@@ -70,6 +86,11 @@ public:
      */
     std::set<std::string> GetAllVarNames() const noexcept;
 
+    /**
+     * 返回结构哈希值。由行数、列数以及每个元素的Hash()计算得到。
+     */
+    std::uint64_t Hash() const noexcept;
+
     /**
      * 如果rhs和自己的维数不匹配会触发assert。
      */
@@ -97,7 +118,10 @@ protected:
     int rows, cols;
     std::unique_ptr<std::valarray<Node>> data;
 
-    friend SymMat Jacobian(const SymMat &equations, const std::vector<std::string> &vars) noexcept;
+    friend SymMat Jacobian(const SymMat &equations, const std::vector<std::string> &vars);
+
+private:
+    SymMat &SubsInner(const std::map<std::string, Node> &dict) noexcept;
 };
 
 class SymVec : public SymMat {
@@ -122,7 +146,12 @@ public:
     const Node &operator[](std::size_t index) const noexcept;
 };
 
-SymMat Jacobian(const SymMat &equations, const std::vector<std::string> &vars) noexcept;
+/**
+ * 计算equations对vars的雅可比矩阵。
+ * 按行并行计算，线程数由Config::Get().threadNum指定。
+ * @exception runtime_error 方程组中有不能求导的运算（例如%、&、|）
+ */
+SymMat Jacobian(const SymMat &equations, const std::vector<std::string> &vars);
 
 std::ostream &operator<<(std::ostream &out, const SymMat &symMat) noexcept;
 
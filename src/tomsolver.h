@@ -2,11 +2,23 @@
 
 #include "config.h"
 #include "node.h" // error_type.h math_operator.h
+#include "flat_node.h"
 #include "functions.h"
 #include "simplify.h"
+#include "egraph.h"
 #include "diff.h"
 #include "subs.h"   // symmat.h vars_table.h
 #include "symmat.h" // mat.h vars_table.h
+#include "batch_math.h"
+#include "compiled.h"
+#include "codegen.h"
+#include "native.h"
+#include "mapped_file.h"
 #include "parse.h"
 #include "linear.h"
-#include "nonlinear.h"
\ No newline at end of file
+#include "line_search.h"
+#include "nonlinear.h"
+#include "serialize.h"
+#include "prepared_cache.h"
+#include "multistart.h"
+#include "continuation.h"
\ No newline at end of file
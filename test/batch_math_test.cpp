@@ -0,0 +1,147 @@
+#include "batch_math.h"
+
+#include "memory_leak_detection.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+using namespace tomsolver;
+
+using std::cout;
+using std::endl;
+
+TEST(BatchCalc, ErrorBound) {
+    MemoryLeakDetection mld;
+
+    cout << "kernel: " << BatchCalcKernel() << endl;
+
+    // 以long double的结果为参考，计算误差是多少个ULP
+    auto ulps = [](double got, long double expected) {
+        auto e = std::abs(static_cast<double>(expected));
+        auto ulp = std::nextafter(e, std::numeric_limits<double>::infinity()) - e;
+        return static_cast<double>(std::abs(got - expected) / ulp);
+    };
+
+    struct Case {
+        MathOperator op;
+        double low, high; // 输入的范围。log类的函数取10的low次方到10的high次方
+        double maxUlps;
+    };
+    std::vector<Case> cases{
+        {MathOperator::MATH_EXP, -708, 708, 1},    {MathOperator::MATH_EXP, -1, 1, 1},
+        {MathOperator::MATH_LOG, -300, 300, 1},    {MathOperator::MATH_LOG, -0.1, 0.1, 1},
+        {MathOperator::MATH_LOG2, -300, 300, 2},   {MathOperator::MATH_LOG10, -300, 300, 2},
+        {MathOperator::MATH_SIN, -1e5, 1e5, 1},    {MathOperator::MATH_SIN, -4, 4, 1},
+        {MathOperator::MATH_COS, -1e5, 1e5, 1},    {MathOperator::MATH_COS, -4, 4, 1},
+        {MathOperator::MATH_TAN, -1e5, 1e5, 3},
+    };
+
+    std::mt19937 eng(1234);
+    int n = 100003;
+    std::vector<double> x(n), y(n), generic(n);
+    for (auto &c : cases) {
+        bool isLog = c.op == MathOperator::MATH_LOG || c.op == MathOperator::MATH_LOG2 ||
+                     c.op == MathOperator::MATH_LOG10;
+        std::uniform_real_distribution<double> dist(c.low, c.high);
+        for (auto &v : x) {
+            v = isLog ? std::pow(10.0, dist(eng)) : dist(eng);
+        }
+
+        BatchCalc(c.op, x.data(), y.data(), n);
+        internal::BatchCalcGeneric(c.op, x.data(), generic.data(), n);
+
+        double maxErr = 0, maxGenericErr = 0;
+        for (int i = 0; i < n; ++i) {
+            long double v = x[i], expected = 0;
+            switch (c.op) {
+            case MathOperator::MATH_EXP:
+                expected = std::exp(v);
+                break;
+            case MathOperator::MATH_LOG:
+                expected = std::log(v);
+                break;
+            case MathOperator::MATH_LOG2:
+                expected = std::log2(v);
+                break;
+            case MathOperator::MATH_LOG10:
+                expected = std::log10(v);
+                break;
+            case MathOperator::MATH_SIN:
+                expected = std::sin(v);
+                break;
+            case MathOperator::MATH_COS:
+                expected = std::cos(v);
+                break;
+            default:
+                expected = std::tan(v);
+                break;
+            }
+            maxErr = std::max(maxErr, ulps(y[i], expected));
+            maxGenericErr = std::max(maxGenericErr, ulps(generic[i], expected));
+        }
+        cout << MathOperatorToStr(c.op) << " [" << c.low << ", " << c.high << "]: " << maxErr << " ulp, generic "
+             << maxGenericErr << " ulp" << endl;
+        ASSERT_LE(maxErr, c.maxUlps);
+        ASSERT_LE(maxGenericErr, c.maxUlps);
+    }
+}
+
+TEST(BatchCalc, SpecialValues) {
+    MemoryLeakDetection mld;
+
+    auto inf = std::numeric_limits<double>::infinity();
+    auto nan = std::numeric_limits<double>::quiet_NaN();
+
+    // 快速路径以外的输入交给std::的函数
+    std::vector<double> x{709.5, -745, 1e-310, 0, -1, 1e6, -inf, nan};
+    std::vector<double> y(x.size());
+    BatchCalc(MathOperator::MATH_EXP, x.data(), y.data(), 2);
+    ASSERT_EQ(y[0], std::exp(709.5));
+    ASSERT_EQ(y[1], std::exp(-745));
+    BatchCalc(MathOperator::MATH_LOG, x.data() + 2, y.data() + 2, 3);
+    ASSERT_EQ(y[2], std::log(1e-310));
+    ASSERT_EQ(y[3], -inf);
+    ASSERT_TRUE(std::isnan(y[4]));
+    BatchCalc(MathOperator::MATH_SIN, x.data() + 5, y.data() + 5, 3);
+    ASSERT_EQ(y[5], std::sin(1e6));
+    ASSERT_TRUE(std::isnan(y[6]));
+    ASSERT_TRUE(std::isnan(y[7]));
+
+    // 其余运算符
+    x = {0.25, -0.5, 1.5};
+    BatchCalc(MathOperator::MATH_ARCSIN, x.data(), y.data(), 3);
+    ASSERT_EQ(y[0], std::asin(0.25));
+    ASSERT_TRUE(std::isnan(y[2]));
+    BatchCalc(MathOperator::MATH_NEGATIVE, x.data(), y.data(), 3);
+    ASSERT_EQ(y[1], 0.5);
+}
+
+TEST(BatchCalc, InPlace) {
+    MemoryLeakDetection mld;
+
+    std::vector<double> x(37);
+    for (std::size_t i = 0; i < x.size(); ++i) {
+        x[i] = 0.37 * i - 3;
+    }
+
+    for (auto op : {MathOperator::MATH_SIN, MathOperator::MATH_EXP, MathOperator::MATH_SQRT}) {
+        std::vector<double> y(x.size()), z = x;
+        BatchCalc(op, x.data(), y.data(), x.size());
+        BatchCalc(op, z.data(), z.data(), z.size());
+        for (std::size_t i = 0; i < x.size(); ++i) {
+            ASSERT_TRUE(y[i] == z[i] || (std::isnan(y[i]) && std::isnan(z[i])));
+        }
+    }
+
+    // sin、cos共用一次区间约简，结果与分别计算一致
+    std::vector<double> s(x.size()), c = x, s2(x.size()), c2(x.size());
+    BatchSinCos(c.data(), s.data(), c.data(), c.size());
+    BatchCalc(MathOperator::MATH_SIN, x.data(), s2.data(), x.size());
+    BatchCalc(MathOperator::MATH_COS, x.data(), c2.data(), x.size());
+    ASSERT_EQ(s, s2);
+    ASSERT_EQ(c, c2);
+}
@@ -0,0 +1,63 @@
+#include "codegen.h"
+#include "compiled.h"
+#include "functions.h"
+#include "parse.h"
+
+#include "helper.h"
+#include "memory_leak_detection.h"
+
+#include <gtest/gtest.h>
+
+using namespace tomsolver;
+
+using std::cout;
+using std::endl;
+
+TEST(CodeGen, Function) {
+    MemoryLeakDetection mld;
+
+    SymMat mat = {{"sin(x)*y+x^2"_f}, {"cos(x)+sin(x)/y^3"_f}};
+    auto code = GenerateFunction(CompiledSymMat(mat, {"x", "y"}), "f");
+    cout << code << endl;
+
+    ASSERT_NE(code.find("extern \"C\" void f(const double *x, double *out)"), std::string::npos);
+    ASSERT_NE(code.find("x[0] = x"), std::string::npos);
+    ASSERT_NE(code.find("x[1] = y"), std::string::npos);
+    ASSERT_NE(code.find("out[0] = "), std::string::npos);
+    ASSERT_NE(code.find("out[1] = "), std::string::npos);
+
+    // 相同的子表达式只计算一次
+    auto pos = code.find("std::sin(x[0])");
+    ASSERT_NE(pos, std::string::npos);
+    ASSERT_EQ(code.find("std::sin(x[0])", pos + 1), std::string::npos);
+
+    // 整数次幂展开为乘法
+    ASSERT_EQ(code.find("std::pow"), std::string::npos);
+    ASSERT_NE(code.find("x[0] * x[0]"), std::string::npos);
+    ASSERT_NE(code.find("x[1] * x[1]"), std::string::npos);
+
+    // 指定输出参数的名字
+    code = GenerateFunction(CompiledSymMat(mat, {"x", "y"}), "g", "y");
+    ASSERT_NE(code.find("extern \"C\" void g(const double *x, double *y)"), std::string::npos);
+    ASSERT_NE(code.find("y[1] = "), std::string::npos);
+    ASSERT_EQ(code.find("out["), std::string::npos);
+}
+
+TEST(CodeGen, Model) {
+    MemoryLeakDetection mld;
+
+    SymVec f = {"exp(-exp(-(x1 + x2))) - x2 * (1 + x1 ^ 2)"_f, "x1 * cos(x2) + x2 * sin(x1) - 0.5"_f};
+    auto code = GenerateModel(f, {"x1", "x2"}, "model_");
+    cout << code << endl;
+
+    ASSERT_NE(code.find("#include <cmath>"), std::string::npos);
+    ASSERT_NE(code.find("extern \"C\" void model_residual(const double *x, double *f)"), std::string::npos);
+    ASSERT_NE(code.find("extern \"C\" void model_jacobian(const double *x, double *J)"), std::string::npos);
+    ASSERT_NE(code.find("f[1] = "), std::string::npos);
+    ASSERT_NE(code.find("J[3] = "), std::string::npos);
+    ASSERT_EQ(code.find("out["), std::string::npos);
+    ASSERT_NE(code.find("0.5"), std::string::npos);
+
+    // 变量未绑定
+    ASSERT_ANY_THROW(GenerateModel(f, {"x1"}));
+}
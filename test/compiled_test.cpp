@@ -0,0 +1,256 @@
+#include "compiled.h"
+#include "config.h"
+#include "diff.h"
+#include "error_type.h"
+#include "flat_node.h"
+#include "functions.h"
+#include "parallel.h"
+#include "parse.h"
+#include "simplify.h"
+#include "subs.h"
+
+#include "helper.h"
+#include "memory_leak_detection.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <regex>
+
+using namespace tomsolver;
+
+using std::cout;
+using std::endl;
+
+TEST(CompiledSymMat, Base) {
+    MemoryLeakDetection mld;
+
+    SymMat mat = {{"x*sin(y)+x^2/(1+exp(-y))-3"_f, Num(2)}, {"-(x-y)^3"_f, "log(x)*z"_f}};
+    CompiledSymMat compiled(mat, {"x", "y", "z"});
+
+    ASSERT_EQ(compiled.Rows(), 2);
+    ASSERT_EQ(compiled.Cols(), 2);
+
+    VarsTable table{{"x", 1.5}, {"y", -0.7}, {"z", 3}};
+    ASSERT_EQ(compiled.Eval(table.Values()), mat.Vpa(table));
+
+    // 变量未绑定
+    ASSERT_ANY_THROW(CompiledSymMat(mat, {"x", "y"}));
+}
+
+TEST(CompiledSymMat, Random) {
+    MemoryLeakDetection mld;
+
+    for (int i = 0; i < 10; ++i) {
+        auto pr = CreateRandomExpresionTree(100);
+        SymVec v{std::move(pr.first)};
+        CompiledSymMat compiled(v, {});
+
+        double out = 0;
+        CompiledSymMat::Workspace ws;
+        compiled.Eval(nullptr, &out, ws);
+        ASSERT_DOUBLE_EQ(out, pr.second);
+    }
+}
+
+TEST(CompiledSymMat, Concurrent) {
+    MemoryLeakDetection mld;
+
+    std::shared_ptr<void> defer(nullptr, [](...) {
+        Config::Get().Reset();
+    });
+
+    SymVec f{"x^2+y^2-4"_f, "x*y-1"_f, "sin(x)+cos(y)"_f};
+    std::vector<std::string> vars{"x", "y"};
+    CompiledSymMat compiled(Jacobian(f, vars), vars);
+
+    // 所有线程共享同一个compiled，每个线程各自持有Workspace
+    int n = 256;
+    std::vector<Mat> results(n, Mat(1, 1));
+    Config::Get().threadNum = 4;
+    internal::ParallelFor(n, [&](int begin, int end) {
+        CompiledSymMat::Workspace ws;
+        for (int i = begin; i < end; ++i) {
+            results[i] = compiled.Eval(Vec{0.01 * i, 1 + 0.02 * i}, ws);
+        }
+    });
+
+    SymMat ja = Jacobian(f, vars);
+    for (int i = 0; i < n; ++i) {
+        VarsTable table{{"x", 0.01 * i}, {"y", 1 + 0.02 * i}};
+        ASSERT_EQ(results[i], ja.Vpa(table));
+    }
+}
+
+TEST(CompiledSymMat, StrengthReduction) {
+    MemoryLeakDetection mld;
+
+    std::vector<std::string> vars{"x", "y"};
+    Vec x{0.7, -1.3};
+    VarsTable table(vars, 0);
+    table.SetValues(x);
+
+    // 指数为数值的乘方不再压入指数
+    for (auto &s : {"x^2", "x^3", "x^0.5", "(x+y)^7", "x^(2-4)", "x^(0-1)"}) {
+        SymVec f{Parse(s)};
+        Simplify(f[0]);
+        CompiledSymMat compiled(f, vars);
+        ASSERT_EQ(compiled.Size(), FlatNode(f[0]).Size() - 1) << s;
+        ASSERT_NEAR(compiled.Eval(x).Value(0, 0), f[0]->Vpa(table), 1e-12) << s;
+    }
+
+    // 参数相同的sin、cos只计算一次参数
+    {
+        SymVec f{"sin(x*y)+cos(x*y)*x"_f};
+        CompiledSymMat compiled(f, vars);
+        ASSERT_EQ(compiled.Size(), FlatNode(f[0]).Size() - 3);
+        ASSERT_NEAR(compiled.Eval(x).Value(0, 0), f[0]->Vpa(table), 1e-12);
+    }
+
+    // 嵌套的sin、cos
+    for (auto &s : {"cos(x)*sin(x)^2+cos(sin(x))*sin(sin(x))", "sin(cos(y)+sin(y))-cos(cos(y)+sin(y))*cos(y)",
+                    "sin(x)*sin(x)+cos(x)*cos(x)"}) {
+        SymVec f{Parse(s)};
+        CompiledSymMat compiled(f, vars);
+        ASSERT_LT(compiled.Size(), FlatNode(f[0]).Size()) << s;
+        ASSERT_NEAR(compiled.Eval(x).Value(0, 0), f[0]->Vpa(table), 1e-12) << s;
+    }
+
+    // 无效值与Vpa()一致，抛出MathError
+    {
+        SymVec f{"y^-1"_f, "x^-2"_f};
+        CompiledSymMat compiled(f, vars);
+        ASSERT_THROW(compiled.Eval(Vec{1, 0}), MathError);
+        ASSERT_THROW(compiled.Eval(Vec{0, 1}), MathError);
+    }
+}
+
+TEST(CompiledSymMat, EvalBatch) {
+    MemoryLeakDetection mld;
+
+    std::shared_ptr<void> defer(nullptr, [](...) {
+        Config::Get().Reset();
+    });
+
+    SymMat mat = {{"x*sin(y)+x^2/(1+exp(-y))-3"_f, "sin(x*y)+cos(x*y)*x"_f},
+                  {"log(x^2+1)*tan(y)-x^-3"_f, "2^x+log10(y^2+1)+log2(x^2+2)"_f}};
+    std::vector<std::string> vars{"x", "y"};
+    CompiledSymMat compiled(mat, vars);
+
+    // 点数不是分块大小的整数倍
+    int n = 1000;
+    std::mt19937 eng(42);
+    std::uniform_real_distribution<double> dist(0.1, 5);
+    Mat points(2, n);
+    for (int p = 0; p < n; ++p) {
+        points.Value(0, p) = dist(eng);
+        points.Value(1, p) = -dist(eng);
+    }
+
+    Mat got = compiled.EvalBatch(points);
+    ASSERT_EQ(got.Rows(), 4);
+    ASSERT_EQ(got.Cols(), n);
+    CompiledSymMat::Workspace ws;
+    for (int p = 0; p < n; ++p) {
+        Mat expected = compiled.Eval(Vec{points.Value(0, p), points.Value(1, p)}, ws);
+        for (int i = 0; i < 4; ++i) {
+            auto v = expected.Value(i / 2, i % 2);
+            ASSERT_NEAR(got.Value(i, p), v, 1e-13 * std::max(1.0, std::abs(v)));
+        }
+    }
+
+    // 无效值与Eval()一致
+    points.Value(0, 17) = 0;
+    ASSERT_THROW(compiled.EvalBatch(points), MathError);
+
+    Config::Get().throwOnInvalidValue = false;
+    got = compiled.EvalBatch(points);
+    ASSERT_FALSE(std::isfinite(got.Value(2, 17)));
+}
+
+TEST(CompiledSymMat, EvalAs) {
+    MemoryLeakDetection mld;
+
+    SymMat mat = {{"x*sin(y)+x^2/(1+exp(-y))-3"_f, "sin(x*y)+cos(x*y)*x"_f}, {"log(x^2+1)*tan(y)-x^-3"_f, Num(0.1)}};
+    std::vector<std::string> vars{"x", "y"};
+    CompiledSymMat compiled(mat, vars);
+
+    Mat expected = compiled.Eval(Vec{1.3, -0.4});
+
+    CompiledSymMat::BasicWorkspace<float> wsf;
+    float xf[] = {1.3f, -0.4f}, outf[4];
+    compiled.EvalAs(xf, outf, wsf);
+
+    CompiledSymMat::BasicWorkspace<long double> wsl;
+    long double xl[] = {1.3L, -0.4L}, outl[4];
+    compiled.EvalAs(xl, outl, wsl);
+
+    for (int i = 0; i < 4; ++i) {
+        auto v = expected.Value(i / 2, i % 2);
+        ASSERT_NEAR(outf[i], v, 1e-5);
+        ASSERT_NEAR(static_cast<double>(outl[i]), v, 1e-14);
+    }
+
+    // 无效值
+    float bad[] = {0, 1};
+    ASSERT_THROW(compiled.EvalAs(bad, outf, wsf), MathError);
+}
+
+TEST(CompiledExpression, Base) {
+    MemoryLeakDetection mld;
+
+    // 常量折叠：2*3、-(4)、2^10都在编译时算出
+    auto expr = ParseCompiled("x*(2*3) - y^2 + -(4) + sin(y)/x + 2^10");
+    ASSERT_EQ(expr.Vars(), (std::vector<std::string>{"x", "y"}));
+    Node node = Parse("x*(2*3) - y^2 + -(4) + sin(y)/x + 2^10");
+    ASSERT_LT(expr.Size(), FlatNode(node).Size());
+    ASSERT_EQ(std::count_if(expr.Code().begin(), expr.Code().end(),
+                            [](const CompiledSymMat::Instruction &inst) {
+                                return inst.code == CompiledSymMat::OpCode::NUMBER;
+                            }),
+              3);
+
+    double x[] = {1.5, -0.7};
+    ASSERT_DOUBLE_EQ(expr.Eval(x), Subs(node, {"x", "y"}, SymVec{Num(1.5), Num(-0.7)})->Vpa());
+    ASSERT_DOUBLE_EQ(expr.Eval(Vec{1.5, -0.7}), expr.Eval(x));
+
+    // 只有数值的表达式折叠为一条指令
+    auto constant = ParseCompiled("1+2*3-4/2");
+    ASSERT_EQ(constant.Size(), 1);
+    ASSERT_TRUE(constant.Vars().empty());
+    ASSERT_DOUBLE_EQ(constant.Eval(nullptr), 5);
+
+    // 无效值不折叠，求值时抛出异常
+    auto invalid = ParseCompiled("log(0-1)+x");
+    ASSERT_THROW(invalid.Eval(Vec{1}), MathError);
+
+    ASSERT_THROW(ParseCompiled("x+"), ParseError);
+}
+
+TEST(CompiledExpression, Random) {
+    MemoryLeakDetection mld;
+
+    // 随机的纯数值表达式，折叠后与Vpa()一致
+    for (int i = 0; i < 10; ++i) {
+        auto pr = CreateRandomExpresionTree(100);
+        auto s = std::regex_replace(pr.first->ToString(), std::regex("\\ba(sin|cos|tan)\\("), "arc$1(");
+        double expected = 0;
+        try {
+            expected = Parse(s)->Vpa();
+        } catch (const MathError &) {
+            continue;
+        }
+        ASSERT_DOUBLE_EQ(ParseCompiled(s).Eval(nullptr), expected) << s;
+    }
+
+    // 深度超过StackSize时改用堆上的栈
+    std::string s = "x";
+    for (int i = 0; i < 100; ++i) {
+        s = "x+(" + s + ")*0.5";
+    }
+    auto expr = ParseCompiled(s);
+    Node node = Parse(s);
+    ASSERT_DOUBLE_EQ(expr.Eval(Vec{2}), Subs(node, "x", Num(2))->Vpa());
+}
@@ -0,0 +1,101 @@
+#include "config.h"
+#include "continuation.h"
+#include "nonlinear.h"
+#include "parse.h"
+
+#include "memory_leak_detection.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <memory>
+#include <string>
+
+using namespace tomsolver;
+
+using std::cout;
+using std::endl;
+
+TEST(Continuation, Base) {
+    MemoryLeakDetection mld;
+
+    // x^3 - x - p = 0在x > 1/sqrt(3)的分支上没有折点
+    SymVec f = {"x^3 - x - p"_f};
+    auto result = SolveSweep(f, "p", 0, 5, VarsTable{{"x", 1}});
+    ASSERT_TRUE(result.completed);
+    ASSERT_EQ(result.points.front().parameter, 0);
+    ASSERT_EQ(result.points.back().parameter, 5);
+
+    int warm = 0, cold = 0;
+    for (std::size_t i = 0; i < result.points.size(); ++i) {
+        auto &point = result.points[i];
+        auto p = point.parameter, x = point.solution["x"];
+        ASSERT_LT(std::abs(x * x * x - x - p), 1.0e-9);
+        ASSERT_FALSE(point.turningPoint);
+        if (i > 0) {
+            ASSERT_GT(p, result.points[i - 1].parameter);
+            ASSERT_LE(p - result.points[i - 1].parameter, Config::Get().sweepMaxStep * 5 * (1 + 1.0e-12));
+            warm += point.iterations;
+
+            // 同一个参数从同一个初值冷启动。可能收敛到其他分支上的根
+            SolveByNewtonRaphson(VarsTable{{"x", 1}}, SymVec{Parse("x^3 - x - " + ToString(p))});
+            cold += LastSolveStats().iterations;
+        }
+    }
+    int steps = static_cast<int>(result.points.size()) - 1;
+    cout << "points = " << result.points.size() << ", warm iterations = " << warm << ", cold iterations = " << cold
+         << endl;
+    ASSERT_LE(warm, 3 * steps);
+    ASSERT_LT(warm, cold);
+
+    // 预处理好的方程组，参数必须是最后一个变量
+    auto prepared = SolveSweep(Prepare(f, {"x", "p"}), "p", 0, 5, VarsTable{{"x", 1}});
+    ASSERT_EQ(prepared.points.size(), result.points.size());
+    for (std::size_t i = 0; i < result.points.size(); ++i) {
+        ASSERT_EQ(prepared.points[i].parameter, result.points[i].parameter);
+        ASSERT_EQ(prepared.points[i].solution, result.points[i].solution);
+    }
+    ASSERT_THROW(SolveSweep(Prepare(f, {"p", "x"}), "p", 0, 5, VarsTable{{"x", 1}}), std::runtime_error);
+
+    // 反向扫描
+    auto backward = SolveSweep(f, "p", 5, 0, result.points.back().solution);
+    ASSERT_TRUE(backward.completed);
+    ASSERT_NEAR(backward.points.back().solution["x"], 1, 1.0e-9);
+
+    // 参数不合法
+    ASSERT_THROW(SolveSweep(f, "p", 0, 5, VarsTable{{"x", 1}, {"p", 0}}), std::runtime_error);
+    ASSERT_THROW(SolveSweep(SymVec{"x^3 - x - p"_f, "x - 1"_f}, "p", 0, 5, VarsTable{{"x", 1}}),
+                 std::runtime_error);
+    ASSERT_THROW(SolveSweep(SymVec{"x^2 + 1 + p"_f}, "p", 0, 5, VarsTable{{"x", 1}}), std::runtime_error);
+}
+
+TEST(Continuation, TurningPoint) {
+    MemoryLeakDetection mld;
+
+    // x^2 - p = 0的解曲线x = sqrt(p)在p = 0处折回，p < 0时无实数解
+    auto fold = SolveSweep(SymVec{"x^2 - p"_f}, "p", 1, -1, VarsTable{{"x", 1}});
+    ASSERT_FALSE(fold.completed);
+    auto &last = fold.points.back();
+    cout << "turning point at p = " << last.parameter << ", x = " << last.solution["x"] << endl;
+    ASSERT_TRUE(last.turningPoint);
+    ASSERT_LT(std::abs(last.parameter), 1.0e-3);
+    for (auto &point : fold.points) {
+        auto x = point.solution["x"];
+        ASSERT_GT(x, 0);
+        ASSERT_NEAR(x * x, point.parameter, 1.0e-9);
+    }
+
+    // x^3 - p*x = 0的平凡解x = 0在p = 0处与另一支相交（分岔），Jx的行列式变号但曲线可以继续
+    auto bifurcation = SolveSweep(SymVec{"x^3 - p*x"_f, "y - p"_f}, "p", -0.95, 1, VarsTable{{"x", 0}, {"y", 0}});
+    ASSERT_TRUE(bifurcation.completed);
+    int turningPoints = 0;
+    for (auto &point : bifurcation.points) {
+        ASSERT_EQ(point.solution["x"], 0);
+        ASSERT_NEAR(point.solution["y"], point.parameter, 1.0e-9);
+        if (point.turningPoint) {
+            ++turningPoints;
+            ASSERT_GT(point.parameter, 0);
+        }
+    }
+    ASSERT_EQ(turningPoints, 1);
+}
@@ -0,0 +1,123 @@
+#include "compiled.h"
+#include "config.h"
+#include "error_type.h"
+#include "egraph.h"
+#include "flat_node.h"
+#include "functions.h"
+#include "parse.h"
+
+#include "memory_leak_detection.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <random>
+#include <string>
+
+using namespace tomsolver;
+
+using std::cout;
+using std::endl;
+
+TEST(Optimize, Rules) {
+    MemoryLeakDetection mld;
+
+    auto optimized = [](const Node &n) {
+        auto ret = Optimize(n);
+        ret->CheckParent();
+        cout << n->ToString() << " -> " << ret->ToString() << endl;
+        return ret->ToString();
+    };
+
+    // 三角恒等式
+    ASSERT_EQ(optimized("sin(x)^2+cos(x)^2"_f), "1");
+    ASSERT_EQ(optimized("sin(x)/cos(x)"_f), "tan(x)");
+    auto tan = optimized("sin(x)/cos(x)*y"_f);
+    ASSERT_TRUE(tan == "y*tan(x)" || tan == "tan(x)*y");
+
+    // 结合律：在较长的加法、乘法链中也能找到可以配对的项
+    auto flattened = optimized("x+sin(x)^2+y+cos(x)^2"_f);
+    ASSERT_EQ(flattened.find("sin"), std::string::npos);
+    ASSERT_EQ(flattened.find("cos"), std::string::npos);
+    auto product = optimized("exp(x)*y*exp(z)"_f);
+    ASSERT_EQ(product.find("exp("), product.rfind("exp("));
+
+    // exp、log相消
+    ASSERT_EQ(optimized("log(exp(x))"_f), "x");
+    auto expSum = optimized("exp(x)*exp(y)"_f);
+    ASSERT_TRUE(expSum == "exp(x+y)" || expSum == "exp(y+x)");
+
+    // 提取公因式
+    ASSERT_EQ(optimized("sin(x)*y+sin(x)*z"_f), "sin(x)*(y+z)");
+    ASSERT_EQ(optimized("x*y-x*z"_f), "x*(y-z)");
+
+    // 乘方展开为乘法
+    ASSERT_EQ(optimized("x^2"_f), "x*x");
+    ASSERT_EQ(optimized("x^0.5"_f), "sqrt(x)");
+}
+
+TEST(Optimize, KeepValue) {
+    MemoryLeakDetection mld;
+
+    VarsTable table{{"x", 0.3}, {"y", -1.7}, {"z", 2.5}};
+    for (auto &s : {"x^3*y+x*x*z", "sin(x*y)^2+cos(y*x)^2+z", "exp(x)*exp(y)*z^2/z", "(x+y)^2-x^2",
+                    "sin(x)*cos(y)+cos(y)*x", "-(-(x))*y^4", "y*sin(x)/(z*cos(x))", "2*x*y-3*x*z"}) {
+        Node n = Parse(s);
+        auto optimized = Optimize(n);
+        optimized->CheckParent();
+        ASSERT_NEAR(optimized->Vpa(table), n->Vpa(table), 1e-12) << s << " -> " << optimized->ToString();
+
+        // 节点数的限制很小时，也只是少应用一些规则
+        auto limited = Optimize(n, 8, 16);
+        limited->CheckParent();
+        ASSERT_NEAR(limited->Vpa(table), n->Vpa(table), 1e-12) << s << " -> " << limited->ToString();
+    }
+}
+
+TEST(Optimize, KeepDomain) {
+    MemoryLeakDetection mld;
+
+    // x < 0时非整数次幂无定义，x = 0时负数次幂无定义，优化后仍然无定义
+    VarsTable negative{{"x", -2}, {"y", 3}};
+    VarsTable zero{{"x", 0}, {"y", 3}};
+    for (auto &s : {"x^0.5*x^0.5", "x^1.5*x^0.5*y", "x^0.5*x"}) {
+        Node n = Parse(s);
+        auto optimized = Optimize(n);
+        optimized->CheckParent();
+        ASSERT_THROW(n->Vpa(negative), MathError);
+        ASSERT_THROW(optimized->Vpa(negative), MathError) << s << " -> " << optimized->ToString();
+    }
+    for (auto &s : {"x^-1*x", "x^-1*x^2*y", "x^-2*x^3"}) {
+        Node n = Parse(s);
+        auto optimized = Optimize(n);
+        optimized->CheckParent();
+        ASSERT_THROW(n->Vpa(zero), MathError);
+        ASSERT_THROW(optimized->Vpa(zero), MathError) << s << " -> " << optimized->ToString();
+    }
+
+    // 整数次幂照常合并
+    ASSERT_EQ(Optimize("x^2*x^3"_f)->ToString(), Optimize("x^5"_f)->ToString());
+}
+
+TEST(Optimize, Compile) {
+    MemoryLeakDetection mld;
+
+    std::shared_ptr<void> defer(nullptr, [](...) {
+        Config::Get().Reset();
+    });
+
+    SymVec f{"sin(x)^2+cos(x)^2+x"_f, "exp(x)*exp(y)+log(exp(y))"_f};
+    std::vector<std::string> vars{"x", "y"};
+    Vec x{0.7, -0.2};
+
+    CompiledSymMat plain(f, vars);
+    Config::Get().optimizeBeforeCompile = true;
+    CompiledSymMat optimized(f, vars);
+
+    ASSERT_LT(optimized.Size(), plain.Size());
+    auto expected = plain.Eval(x);
+    auto actual = optimized.Eval(x);
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_NEAR(actual.Value(i, 0), expected.Value(i, 0), 1e-12);
+    }
+}
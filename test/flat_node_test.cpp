@@ -0,0 +1,93 @@
+#include "flat_node.h"
+#include "functions.h"
+#include "parse.h"
+
+#include "helper.h"
+#include "memory_leak_detection.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <unordered_set>
+
+using namespace tomsolver;
+
+using std::cout;
+using std::endl;
+
+TEST(FlatNode, Base) {
+    MemoryLeakDetection mld;
+
+    Node n = (Var("a") + Num(1)) * Var("b") - sin(Var("a")) / Num(-2);
+    FlatNode flat(n);
+
+    ASSERT_EQ(flat.Size(), 10);
+    ASSERT_EQ(flat.ToString(), n->ToString());
+    ASSERT_EQ(flat.GetAllVarNames(), n->GetAllVarNames());
+
+    Node n2 = flat.ToNode();
+    n2->CheckParent();
+    ASSERT_TRUE(n2->Equal(n));
+
+    ASSERT_TRUE(flat.Equal(FlatNode(n2)));
+    ASSERT_FALSE(flat.Equal(FlatNode(Var("a") * Var("b"))));
+
+    ASSERT_ANY_THROW(flat.Vpa());
+    ASSERT_DOUBLE_EQ(FlatNode(Num(1) + Num(2) * Num(3)).Vpa(), 7);
+}
+
+TEST(FlatNode, ToString) {
+    MemoryLeakDetection mld;
+
+    for (auto &s : {"-(a+b)", "a-(b-c)", "a^b^c", "(a^b)^c", "a-(-1)", "-a*sin(-b)", "a/(b*c)", "+(a+b)*c"}) {
+        Node n = Parse(s);
+        ASSERT_EQ(FlatNode(n).ToString(), n->ToString());
+    }
+}
+
+TEST(FlatNode, Random) {
+    MemoryLeakDetection mld;
+
+    for (int i = 0; i < 10; ++i) {
+        auto pr = CreateRandomExpresionTree(100);
+        Node &node = pr.first;
+
+        FlatNode flat(node);
+        ASSERT_EQ(flat.ToString(), node->ToString());
+        ASSERT_DOUBLE_EQ(flat.Vpa(), pr.second);
+        ASSERT_TRUE(flat.ToNode()->Equal(node));
+    }
+}
+
+TEST(FlatNode, DoNotStackOverFlow) {
+    MemoryLeakDetection mld;
+
+    // 构造一个随机的长表达式
+    auto pr = CreateRandomExpresionTree(100000);
+    Node &node = pr.first;
+
+    FlatNode flat(node);
+    ASSERT_DOUBLE_EQ(flat.Vpa(), node->Vpa());
+    ASSERT_EQ(flat.ToString(), node->ToString());
+    ASSERT_TRUE(flat.ToNode()->Equal(node));
+}
+
+TEST(FlatNode, Hash) {
+    MemoryLeakDetection mld;
+
+    Node n = "a*sin(b)+2*a-c"_f;
+    FlatNode flat(n);
+
+    ASSERT_EQ(flat.Hash(), n->Hash());
+    ASSERT_EQ(flat.Hash(), FlatNode("a*sin(b)+2*a-c"_f).Hash());
+    ASSERT_NE(flat.Hash(), FlatNode("a*sin(b)+2*a-d"_f).Hash());
+    ASSERT_NE(flat, FlatNode("a*sin(b)+2*a+c"_f));
+
+    // 可以作为哈希容器的键
+    std::unordered_set<FlatNode> set;
+    set.emplace("x^2+y"_f);
+    set.emplace("x^2+y"_f);
+    set.emplace("y+x^2"_f);
+    ASSERT_EQ(set.size(), 2);
+    ASSERT_EQ(set.count(FlatNode("x^2+y"_f)), 1);
+}
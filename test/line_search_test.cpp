@@ -0,0 +1,151 @@
+#include "config.h"
+#include "error_type.h"
+#include "line_search.h"
+
+#include "memory_leak_detection.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+using namespace tomsolver;
+
+using std::cout;
+using std::endl;
+
+TEST(LineSearch, Base) {
+    MemoryLeakDetection mld;
+
+    // Rosenbrock函数写成残差形式：F = [10(y - x^2), 1 - x]
+    struct Rosenbrock : LineSearchProblem {
+        int residuals = 0;
+        int jacobians = 0;
+
+        int Rows() const noexcept override {
+            return 2;
+        }
+        int Cols() const noexcept override {
+            return 2;
+        }
+        void Residual(const double *x, double *f) override {
+            ++residuals;
+            f[0] = 10 * (x[1] - x[0] * x[0]);
+            f[1] = 1 - x[0];
+        }
+        void Jacobian(const double *x, double *J) override {
+            ++jacobians;
+            J[0] = -20 * x[0];
+            J[1] = 10;
+            J[2] = -1;
+            J[3] = 0;
+        }
+    } problem;
+
+    auto phi = [&](const double *x, const double *d, double alpha) {
+        double xt[2] = {x[0] + alpha * d[0], x[1] + alpha * d[1]}, f[2];
+        problem.Residual(xt, f);
+        return 0.5 * (f[0] * f[0] + f[1] * f[1]);
+    };
+    auto dphi = [&](const double *x, const double *d, double alpha) {
+        double xt[2] = {x[0] + alpha * d[0], x[1] + alpha * d[1]}, f[2], J[4];
+        problem.Residual(xt, f);
+        problem.Jacobian(xt, J);
+        return f[0] * (J[0] * d[0] + J[1] * d[1]) + f[1] * (J[2] * d[0] + J[3] * d[1]);
+    };
+
+    // 最速下降方向
+    double x[2] = {-1.2, 1};
+    double g[2];
+    {
+        double f[2], J[4];
+        problem.Residual(x, f);
+        problem.Jacobian(x, J);
+        g[0] = J[0] * f[0] + J[2] * f[1];
+        g[1] = J[1] * f[0] + J[3] * f[1];
+    }
+    double d[2] = {-g[0], -g[1]};
+    double phi0 = phi(x, d, 0);
+    double dphi0 = -(g[0] * g[0] + g[1] * g[1]);
+    ASSERT_NEAR(dphi(x, d, 0), dphi0, 1e-9 * std::abs(dphi0));
+
+    LineSearchWorkspace ws;
+
+    // Armijo：充分下降，只计算方程组
+    ArmijoLineSearch armijo;
+    problem.jacobians = 0;
+    double alpha = armijo.Search(problem, x, d, phi0, dphi0, ws);
+    cout << "armijo alpha = " << alpha << endl;
+    ASSERT_GT(alpha, 0);
+    ASSERT_LE(phi(x, d, alpha), phi0 + armijo.c1 * alpha * dphi0);
+    ASSERT_EQ(problem.jacobians, 0);
+
+    // 工作区在第一次使用后不再重新分配
+    auto buffer = ws.x.data();
+    armijo.Search(problem, x, d, phi0, dphi0, ws);
+    ASSERT_EQ(ws.x.data(), buffer);
+
+    // 强Wolfe：充分下降，且导数的绝对值足够小
+    StrongWolfeLineSearch wolfe;
+    alpha = wolfe.Search(problem, x, d, phi0, dphi0, ws);
+    cout << "strong wolfe alpha = " << alpha << endl;
+    ASSERT_GT(alpha, 0);
+    ASSERT_LE(phi(x, d, alpha), phi0 + wolfe.c1 * alpha * dphi0);
+    ASSERT_LE(std::abs(dphi(x, d, alpha)), -wolfe.c2 * dphi0);
+
+    // 非单调：第一次与Armijo相同；历史中有更大的价值函数时，可以接受比phi0更大的值
+    NonMonotoneLineSearch nonMonotone(5);
+    ASSERT_EQ(nonMonotone.Search(problem, x, d, phi0, dphi0, ws), armijo.Search(problem, x, d, phi0, dphi0, ws));
+    double up[2] = {1e-3, 1e-3}; // phi先上升的方向
+    double x2[2] = {1, 1};       // 极小点处phi = 0
+    ASSERT_GT(phi(x2, up, 1), 0);
+    nonMonotone.Reset();
+    nonMonotone.Search(problem, x, d, 100, dphi0, ws);
+    ASSERT_EQ(nonMonotone.Search(problem, x2, up, 0, -1e-12, ws), 1);
+    ASSERT_EQ(armijo.Search(problem, x2, up, 0, -1e-12, ws), 0);
+
+    // 不是下降方向时只要求价值函数严格下降
+    double dUp[2] = {-d[0], -d[1]};
+    ASSERT_EQ(armijo.Search(problem, x, dUp, phi0, -dphi0, ws), 0);
+    ASSERT_EQ(wolfe.Search(problem, x, dUp, phi0, -dphi0, ws), 0);
+}
+
+TEST(LineSearch, InvalidValue) {
+    MemoryLeakDetection mld;
+
+    // F = log(x)，x <= 0时无效
+    struct Log : LineSearchProblem {
+        int Rows() const noexcept override {
+            return 1;
+        }
+        int Cols() const noexcept override {
+            return 1;
+        }
+        void Residual(const double *x, double *f) override {
+            if (x[0] <= 0) {
+                throw MathError(ErrorType::ERROR_OUTOF_DOMAIN);
+            }
+            f[0] = std::log(x[0]);
+        }
+        void Jacobian(const double *x, double *J) override {
+            J[0] = 1 / x[0];
+        }
+    } problem;
+
+    // 从x = 2出发，3倍牛顿步长的整步会越过定义域，需要回溯
+    double x[1] = {2};
+    double f0 = std::log(2);
+    double d[1] = {-3 * f0 * 2};
+    double dphi0 = f0 * (1 / x[0]) * d[0];
+    ASSERT_LT(x[0] + d[0], 0);
+    ASSERT_LT(dphi0, 0);
+
+    LineSearchWorkspace ws;
+    for (auto method : {LineSearchMethod::ARMIJO, LineSearchMethod::STRONG_WOLFE, LineSearchMethod::NON_MONOTONE}) {
+        auto search = MakeLineSearch(method);
+        double alpha = search->Search(problem, x, d, 0.5 * f0 * f0, dphi0, ws);
+        ASSERT_GT(alpha, 0);
+        ASSERT_LT(std::abs(std::log(x[0] + alpha * d[0])), std::abs(f0));
+    }
+}
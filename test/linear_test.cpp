@@ -1,9 +1,13 @@
+#include "error_type.h"
 #include "linear.h"
 
 #include "memory_leak_detection.h"
 
 #include <gtest/gtest.h>
 
+#include <random>
+#include <vector>
+
 using namespace tomsolver;
 
 TEST(Linear, Base) {
@@ -17,4 +21,69 @@ TEST(Linear, Base) {
     Vec expected = {-66.5555555555555429, 25.6666666666666643, -18.777777777777775, 26.55555555555555};
 
     ASSERT_EQ(x, expected);
-}
\ No newline at end of file
+}
+
+TEST(Linear, Lu) {
+    MemoryLeakDetection mld;
+
+    std::vector<double> A = {2, 1, -5, 1, 1, -5, 0, 7, 0, 2, 1, -1, 1, 6, -1, -4};
+    std::vector<double> expected = {-66.5555555555555429, 25.6666666666666643, -18.777777777777775,
+                                    26.55555555555555};
+    std::vector<int> perm(4);
+
+    // double
+    {
+        auto LU = A;
+        std::vector<double> b = {13, -9, 6, 0};
+        ASSERT_TRUE(internal::LuDecompose(4, LU.data(), perm.data(), 1e-300));
+        internal::LuSolve(4, LU.data(), perm.data(), b.data());
+        for (int i = 0; i < 4; ++i) {
+            ASSERT_NEAR(b[i], expected[i], 1e-12);
+        }
+    }
+
+    // float的分解，long double的右端项
+    {
+        std::vector<float> LU(A.begin(), A.end());
+        std::vector<long double> b = {13, -9, 6, 0};
+        ASSERT_TRUE(internal::LuDecompose(4, LU.data(), perm.data(), 1e-30f));
+        internal::LuSolve(4, LU.data(), perm.data(), b.data());
+        for (int i = 0; i < 4; ++i) {
+            ASSERT_NEAR(static_cast<double>(b[i]), expected[i], 1e-3);
+        }
+    }
+
+    // 奇异矩阵
+    std::vector<double> singular = {1, 2, 2, 4};
+    ASSERT_FALSE(internal::LuDecompose(2, singular.data(), perm.data(), 1e-12));
+}
+
+TEST(Linear, MixedPrecision) {
+    MemoryLeakDetection mld;
+
+    // 对角占优的随机矩阵：float分解+double改进，应与double的结果一致
+    std::default_random_engine eng(42);
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    int n = 50;
+    Mat A(n, n);
+    Vec b(n);
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            A.Value(i, j) = dist(eng) + (i == j ? n : 0);
+        }
+        b[i] = dist(eng);
+    }
+    auto expected = SolveLinear(A, b);
+    auto x = SolveLinearMixedPrecision(A, b);
+    for (int i = 0; i < n; ++i) {
+        ASSERT_NEAR(x[i], expected[i], 1e-14);
+    }
+
+    // 1 + 1e-8在float中舍入为1，float分解奇异，应退回SolveLinear()
+    Mat B = {{1, 1}, {1, 1 + 1e-8}};
+    Vec c = {2, 2 + 1e-8};
+    ASSERT_EQ(SolveLinearMixedPrecision(B, c), SolveLinear(B, c));
+
+    // 奇异且无解，与SolveLinear()一样抛出异常
+    ASSERT_THROW(SolveLinearMixedPrecision(Mat{{1, 2}, {2, 4}}, Vec{1, 3}), MathError);
+}
@@ -0,0 +1,145 @@
+#include "config.h"
+#include "multistart.h"
+#include "nonlinear.h"
+#include "parse.h"
+
+#include "memory_leak_detection.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+using namespace tomsolver;
+
+using std::cout;
+using std::endl;
+
+TEST(MultiStart, Sampling) {
+    MemoryLeakDetection mld;
+
+    // 每一列恰好在每个等分区间内有一个点
+    auto stratified = [](const Mat &samples, int n) {
+        for (int j = 0; j < samples.Cols(); ++j) {
+            std::vector<int> bins(n, 0);
+            for (int i = 0; i < n; ++i) {
+                auto u = samples.Value(i, j);
+                if (!(u >= 0 && u < 1)) {
+                    return false;
+                }
+                ++bins[static_cast<int>(u * n)];
+            }
+            if (std::count(bins.begin(), bins.end(), 1) != n) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    Mat lhs = internal::LatinHypercube(50, 7, 42);
+    ASSERT_EQ(lhs.Rows(), 50);
+    ASSERT_EQ(lhs.Cols(), 7);
+    ASSERT_TRUE(stratified(lhs, 50));
+    ASSERT_EQ(internal::LatinHypercube(50, 7, 42), lhs);
+    ASSERT_FALSE(internal::LatinHypercube(50, 7, 43) == lhs);
+
+    // Sobol序列的前2^m个点在每一维上都是分层的
+    Mat sobol = internal::SobolSequence(64, internal::SobolMaxDim);
+    for (int m = 1; m <= 6; ++m) {
+        ASSERT_TRUE(stratified(sobol, 1 << m)) << "m = " << m;
+    }
+    ASSERT_EQ(sobol.Value(0, 0), 0);
+    ASSERT_EQ(sobol.Value(1, 0), 0.5);
+    ASSERT_EQ(sobol.Value(2, 0), 0.75);
+    ASSERT_EQ(sobol.Value(2, 1), 0.25);
+
+    // 前两维是(0, 2)序列：前64个点在8x8的网格中每格一个
+    std::vector<int> cells(64, 0);
+    for (int i = 0; i < 64; ++i) {
+        ++cells[static_cast<int>(sobol.Value(i, 0) * 8) * 8 + static_cast<int>(sobol.Value(i, 1) * 8)];
+    }
+    ASSERT_EQ(std::count(cells.begin(), cells.end(), 1), 64);
+
+    ASSERT_THROW(internal::SobolSequence(8, internal::SobolMaxDim + 1), std::runtime_error);
+}
+
+TEST(MultiStart, Base) {
+    MemoryLeakDetection mld;
+
+    std::shared_ptr<void> defer(nullptr, [&](...) {
+        Config::Get().Reset();
+    });
+
+    // 圆与双曲线有4个交点
+    SymVec f = {"x^2 + y^2 - 4"_f, "x*y - 1"_f};
+    VarsTable lower{{"x", -3}, {"y", -3}};
+    VarsTable upper{{"x", 3}, {"y", 3}};
+
+    auto check = [&](const MultiStartResult &result) {
+        for (auto &root : result.roots) {
+            auto x = root["x"], y = root["y"];
+            if (std::abs(x * x + y * y - 4) > 1e-6 || std::abs(x * y - 1) > 1e-6) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    for (auto sampling : {SamplingMethod::LATIN_HYPERCUBE, SamplingMethod::SOBOL}) {
+        Config::Get().multiStartSampling = sampling;
+        auto result = SolveMultiStart(f, lower, upper);
+        cout << "starts = " << result.starts << ", converged = " << result.converged << endl;
+        ASSERT_EQ(result.roots.size(), 4);
+        ASSERT_EQ(result.starts, Config::Get().multiStartCount);
+        ASSERT_TRUE(check(result));
+
+        // 根两两不同
+        for (std::size_t i = 0; i < result.roots.size(); ++i) {
+            for (std::size_t j = i + 1; j < result.roots.size(); ++j) {
+                ASSERT_GT(std::abs(result.roots[i]["x"] - result.roots[j]["x"]) +
+                              std::abs(result.roots[i]["y"] - result.roots[j]["y"]),
+                          0.1);
+            }
+        }
+    }
+
+    // 找到足够的根后提前结束
+    auto result = SolveMultiStart(f, lower, upper, 2);
+    ASSERT_EQ(result.roots.size(), 2);
+    ASSERT_LT(result.starts, Config::Get().multiStartCount);
+    ASSERT_TRUE(check(result));
+
+    // 多线程的结果与单线程相同
+    auto single = SolveMultiStart(f, lower, upper);
+    Config::Get().threadNum = 4;
+    auto parallel = SolveMultiStart(f, lower, upper);
+    ASSERT_EQ(parallel.starts, single.starts);
+    ASSERT_EQ(parallel.converged, single.converged);
+    ASSERT_EQ(parallel.roots.size(), single.roots.size());
+    for (std::size_t i = 0; i < single.roots.size(); ++i) {
+        ASSERT_EQ(parallel.roots[i], single.roots[i]);
+    }
+
+    // 区间内只有一个根的吸引域，每个起点都要从采样的初值出发
+    for (auto method : {NonlinearMethod::NEWTON_RAPHSON, NonlinearMethod::LM}) {
+        Config::Get().nonlinearMethod = method;
+        auto one = SolveMultiStart(SymVec{"x^2 - 4"_f}, VarsTable{{"x", 3}}, VarsTable{{"x", 10}});
+        ASSERT_EQ(one.roots.size(), 1);
+        ASSERT_NEAR(one.roots[0]["x"], 2, 1.0e-9);
+
+        one = SolveMultiStart(SymVec{"x^2 - 4"_f, "y - 1"_f}, VarsTable{{"x", 3}, {"y", 0}},
+                              VarsTable{{"x", 10}, {"y", 1}});
+        ASSERT_EQ(one.roots.size(), 1);
+        ASSERT_NEAR(one.roots[0]["x"], 2, 1.0e-9);
+    }
+    Config::Get().nonlinearMethod = NonlinearMethod::NEWTON_RAPHSON;
+
+    // 无解
+    ASSERT_EQ(SolveMultiStart(SymVec{"x^2 + y^2 + 1"_f, "x - y"_f}, lower, upper).roots.size(), 0);
+
+    // 参数不合法
+    ASSERT_THROW(SolveMultiStart(f, VarsTable{{"x", -3}, {"z", -3}}, upper), std::runtime_error);
+    ASSERT_THROW(SolveMultiStart(f, upper, lower), std::runtime_error);
+}
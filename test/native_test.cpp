@@ -0,0 +1,82 @@
+#include "compiled.h"
+#include "config.h"
+#include "error_type.h"
+#include "functions.h"
+#include "native.h"
+#include "nonlinear.h"
+#include "parse.h"
+
+#include "memory_leak_detection.h"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <memory>
+
+using namespace tomsolver;
+
+using std::cout;
+using std::endl;
+
+TEST(NativeModel, Base) {
+    MemoryLeakDetection mld;
+
+    SymVec f = {"exp(-exp(-(x1 + x2))) - x2 * (1 + x1 ^ 2)"_f, "x1 * cos(x2) + x2 * sin(x1) - 0.5"_f};
+    std::vector<std::string> vars{"x1", "x2"};
+
+    if (!NativeModel::IsSupported()) {
+        ASSERT_ANY_THROW(NativeModel(f, vars));
+        return;
+    }
+
+    NativeModel model(f, vars);
+    cout << model.Path() << endl;
+    ASSERT_EQ(model.Rows(), 2);
+    ASSERT_EQ(model.Vars(), vars);
+    ASSERT_TRUE(std::ifstream(model.Path()).good());
+
+    // 与CompiledSymMat的结果一致
+    CompiledSymMat compiledEqs(f, vars);
+    CompiledSymMat compiledJaEqs(Jacobian(f, vars), vars);
+    for (auto &x : {Vec{0.3, -0.2}, Vec{1.5, 2.7}, Vec{-4, 0.01}}) {
+        ASSERT_EQ(model.EvalResidual(x), compiledEqs.Eval(x));
+        ASSERT_EQ(model.EvalJacobian(x), compiledJaEqs.Eval(x));
+    }
+
+    // 相同的模型直接加载已有的共享库
+    NativeModel model2(f, vars);
+    ASSERT_EQ(model2.Path(), model.Path());
+    ASSERT_EQ(model2.EvalResidual(Vec{0.3, -0.2}), model.EvalResidual(Vec{0.3, -0.2}));
+
+    // 无效值
+    NativeModel model3(SymVec{"log(x1)"_f}, {"x1"});
+    ASSERT_THROW(model3.EvalResidual(Vec{-1}), MathError);
+
+    // 变量未绑定
+    ASSERT_ANY_THROW(NativeModel(f, {"x1"}));
+}
+
+TEST(NativeModel, Solve) {
+    MemoryLeakDetection mld;
+
+    std::shared_ptr<void> defer(nullptr, [](...) {
+        Config::Get().Reset();
+    });
+
+    SymVec f = {"exp(-exp(-(x1 + x2))) - x2 * (1 + x1 ^ 2)"_f, "x1 * cos(x2) + x2 * sin(x1) - 0.5"_f};
+    auto expected = Solve(f);
+
+    Config::Get().nativeCompile = true;
+    ASSERT_EQ(Solve(f), expected);
+
+    Config::Get().nonlinearMethod = NonlinearMethod::LM;
+    auto got = Solve(f);
+    ASSERT_NEAR(got["x1"], expected["x1"], 1e-6);
+    ASSERT_NEAR(got["x2"], expected["x2"], 1e-6);
+
+    // 编译失败时退回CompiledSymMat
+    Config::Get().nativeCompiler = "/nonexistent/compiler";
+    Config::Get().logLevel = LogLevel::OFF;
+    Config::Get().nonlinearMethod = NonlinearMethod::NEWTON_RAPHSON;
+    ASSERT_EQ(Solve(f), expected);
+}
@@ -8,6 +8,7 @@
 #include <gtest/gtest.h>
 
 #include <random>
+#include <unordered_map>
 
 using namespace tomsolver;
 
@@ -310,4 +311,26 @@ TEST(Node, Equal) {
 
     ASSERT_TRUE(n->Equal(Var("a") + Var("b") * Var("c")));
     ASSERT_TRUE((Var("a") + Var("b") * Var("c"))->Equal(n));
-}
\ No newline at end of file
+}
+
+TEST(Node, Hash) {
+    MemoryLeakDetection mld;
+
+    Node n = Var("a") + Var("b") * Var("c");
+    Node n2 = Clone(n);
+
+    ASSERT_EQ(n->Hash(), n2->Hash());
+    ASSERT_EQ(Num(0)->Hash(), Num(-0.0)->Hash());
+    ASSERT_NE(n->Hash(), (Var("a") + Var("c") * Var("b"))->Hash());
+    ASSERT_NE((Var("a") - Var("b"))->Hash(), (Var("b") - Var("a"))->Hash());
+    ASSERT_NE(sin(Var("a"))->Hash(), cos(Var("a"))->Hash());
+
+    // 可以作为哈希容器的键
+    std::unordered_map<Node, int, NodeHash, NodeEqual> m;
+    m.emplace(Move(n), 1);
+    m.emplace(Var("a") * Var("b"), 2);
+    ASSERT_EQ(m.size(), 2);
+    ASSERT_EQ(m.at(n2), 1);
+    ASSERT_EQ(m.count(Var("a") * Var("b")), 1);
+    ASSERT_EQ(m.count(Var("b") * Var("a")), 0);
+}
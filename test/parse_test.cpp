@@ -1,12 +1,23 @@
 #include "parse.h"
 #include "config.h"
 #include "functions.h"
+#include "nonlinear.h"
 
+#include "helper.h"
 #include "memory_leak_detection.h"
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <memory>
 #include <random>
+#include <regex>
 
 using namespace tomsolver;
 
@@ -217,4 +228,229 @@ TEST(Parse, Mix) {
         auto node = internal::ParseFunctions::BuildExpressionTree(postOrder);
         FAIL();
     } catch (const ParseError &err) { cout << err.what() << endl; }
-}
\ No newline at end of file
+}
+
+TEST(Parse, SinglePass) {
+    MemoryLeakDetection mld;
+
+    auto legacyParse = [](const std::string &s) {
+        auto tokens = internal::ParseFunctions::ParseToTokens(s);
+        auto postOrder = internal::ParseFunctions::InOrderToPostOrder(tokens);
+        return internal::ParseFunctions::BuildExpressionTree(postOrder);
+    };
+
+    for (auto &s : {"1+2", "-1--2", "1/-2", "-a^2", "2^-x^2", "a^b^c", "-sin(x)^2", "sin x^2", "sin -x", "a%b&c|d^e*f",
+                    "a*cos(x1) + b*cos(x1-x2) + c*cos(x1-x2-x3)", "+(a+b)*-(c)", "x1^(-3)", "1e3*.5+inf"}) {
+        Node expected = legacyParse(s);
+        Node node = Parse(s);
+        node->CheckParent();
+        ASSERT_TRUE(node->Equal(expected)) << s;
+        ASSERT_EQ(ParseFlat(s), FlatNode(expected)) << s;
+    }
+
+    // 挤出负号后，按新的栈顶重新判断结合性
+    ASSERT_DOUBLE_EQ(legacyParse("1-2*-3-4")->Vpa(), 3);
+    ASSERT_DOUBLE_EQ(Parse("1-2*-3-4")->Vpa(), 3);
+    ASSERT_TRUE(Parse("a/-b/c")->Equal(Var("a") / -Var("b") / Var("c")));
+
+    // ToString()输出的反三角函数名为asin、acos、atan，解析时的函数名为arcsin、arccos、arctan
+    auto randomExpression = [](int len) {
+        return std::regex_replace(CreateRandomExpresionTree(len).first->ToString(),
+                                  std::regex("\\ba(sin|cos|tan)\\("), "arc$1(");
+    };
+
+    // 与三步解析的结果一致
+    for (int i = 0; i < 100; ++i) {
+        auto s = randomExpression(100);
+        Node node = Parse(s);
+        ASSERT_TRUE(node->Equal(legacyParse(s))) << s;
+        ASSERT_TRUE(ParseFlat(s).ToNode()->Equal(node)) << s;
+    }
+
+    // 随机记号序列：单遍解析成功时，结果必须与三步解析一致；三步解析失败时，单遍解析也必须失败
+    std::default_random_engine eng(42);
+    const std::vector<std::string> pieces = {"x", "y1",   "_z",  "2",  "0.5", "1e3", "sin(", "exp(", "+", "-", "*",
+                                             "/", "^",    "%",   "&",  "|",   "(",   ")",    " ",    "#", "1e"};
+    std::uniform_int_distribution<std::size_t> pick(0, pieces.size() - 1), len(1, 12);
+    int accepted = 0;
+    for (int i = 0; i < 500; ++i) {
+        std::string s;
+        for (auto n = len(eng); n > 0; --n) {
+            s += pieces[pick(eng)];
+        }
+        // 全是括号时三步解析的行为未定义，跳过
+        if (std::none_of(s.begin(), s.end(), [](char c) {
+                return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '#';
+            })) {
+            continue;
+        }
+
+        Node expected;
+        try {
+            expected = legacyParse(s);
+        } catch (const std::exception &) {}
+
+        try {
+            Node node = Parse(s);
+            ASSERT_TRUE(expected && node->Equal(expected)) << s;
+            ++accepted;
+        } catch (const ParseError &) {}
+    }
+    ASSERT_GT(accepted, 0);
+}
+
+TEST(Parse, SinglePassError) {
+    MemoryLeakDetection mld;
+
+    auto errorPos = [](const char *s) {
+        try {
+            Parse(s);
+        } catch (const SingleParseError &err) {
+            cout << err.what() << endl;
+            return err.GetPos();
+        }
+        return -1;
+    };
+
+    ASSERT_EQ(errorPos(""), 0);
+    ASSERT_EQ(errorPos("1#+2"), 0);
+    ASSERT_EQ(errorPos("a*cos(x1) + b*cos(x1-x2) + c*cos(?x1-x2-x3)"), 33);
+    ASSERT_EQ(errorPos("1*2-3)"), 5);
+    ASSERT_EQ(errorPos("(1*2-3"), 0);
+    ASSERT_EQ(errorPos("1+*2"), 2);
+    ASSERT_EQ(errorPos("1+"), 2);
+    ASSERT_EQ(errorPos("   "), 3);
+    ASSERT_EQ(errorPos("x(1)*cos(2)"), 1);
+    ASSERT_EQ(errorPos("x y"), 2);
+    ASSERT_EQ(errorPos("sin()"), 4);
+
+    ASSERT_THROW(ParseFlat("a+"), ParseError);
+}
+
+TEST(Parse, SinglePassDoNotStackOverFlow) {
+    MemoryLeakDetection mld;
+
+    int depth = 100000;
+    std::string s = std::string(depth, '(') + "x" + std::string(depth, ')');
+    ASSERT_TRUE(Parse(s)->Equal(Var("x")));
+
+    s = std::string(depth, '-') + "x";
+    ASSERT_EQ(ParseFlat(s).Size(), depth + 1);
+}
+
+// 性能测试，不参与单元测试。以--gtest_also_run_disabled_tests --gtest_filter=Parse.DISABLED_Throughput运行
+TEST(Parse, DISABLED_Throughput) {
+    MemoryLeakDetection mld;
+
+    // 随机生成一批表达式，分别以三步解析、Parse、ParseFlat解析，输出吞吐量（MB/s）
+    std::vector<std::string> inputs;
+    std::size_t bytes = 0;
+    for (int i = 0; i < 200; ++i) {
+        inputs.emplace_back(std::regex_replace(CreateRandomExpresionTree(500).first->ToString(),
+                                               std::regex("\\ba(sin|cos|tan)\\("), "arc$1("));
+        bytes += inputs.back().size();
+    }
+
+    auto measure = [&](const char *name, const std::function<void(const std::string &)> &parse) {
+        auto start = std::chrono::steady_clock::now();
+        for (auto &s : inputs) {
+            parse(s);
+        }
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+        cout << name << ": " << bytes / 1e6 / seconds.count() << " MB/s" << endl;
+    };
+
+    measure("ParseToTokens + InOrderToPostOrder + BuildExpressionTree", [](const std::string &s) {
+        auto tokens = internal::ParseFunctions::ParseToTokens(s);
+        auto postOrder = internal::ParseFunctions::InOrderToPostOrder(tokens);
+        internal::ParseFunctions::BuildExpressionTree(postOrder);
+    });
+    measure("Parse", [](const std::string &s) {
+        Parse(s);
+    });
+    measure("ParseFlat", [](const std::string &s) {
+        ParseFlat(s);
+    });
+    measure("ParseCompiled", [](const std::string &s) {
+        ParseCompiled(s);
+    });
+
+    for (auto &s : inputs) {
+        ASSERT_EQ(ParseFlat(s).Size(), FlatNode(Parse(s)).Size());
+    }
+}
+
+TEST(Parse, System) {
+    MemoryLeakDetection mld;
+
+    // 结束时恢复设置
+    std::shared_ptr<void> defer(nullptr, [&](...) {
+        Config::Get().Reset();
+    });
+
+    const char *text = "# 注释\n"
+                       "exp(-exp(-(x1 + x2))) = x2 * (1 + x1 ^ 2)\n"
+                       "\n"
+                       "   x1 * cos(x2) + x2 * sin(x1) - 0.5  # 行尾注释\r\n"
+                       "a = 0\n";
+    auto system = ParseSystem(text);
+    ASSERT_EQ(system.equations.Rows(), 3);
+    ASSERT_TRUE(system.equations[0]->Equal("exp(-exp(-(x1 + x2))) - x2 * (1 + x1 ^ 2)"_f));
+    ASSERT_TRUE(system.equations[1]->Equal("x1 * cos(x2) + x2 * sin(x1) - 0.5"_f));
+    ASSERT_TRUE(system.equations[2]->Equal(Var("a")));
+    ASSERT_EQ(system.vars, (std::vector<std::string>{"a", "x1", "x2"}));
+
+    // 多线程解析的结果与单线程一致
+    std::string big;
+    for (int i = 0; i < 1000; ++i) {
+        big += "x" + std::to_string(i) + " + sin(x" + std::to_string(i + 1) + ") = " + std::to_string(i) + "\n";
+    }
+    auto serial = ParseSystem(big);
+    Config::Get().threadNum = 4;
+    auto parallel = ParseSystem(big);
+    ASSERT_EQ(serial.equations.Rows(), 1000);
+    ASSERT_EQ(parallel.equations, serial.equations);
+    ASSERT_EQ(parallel.vars, serial.vars);
+    ASSERT_EQ(serial.vars.size(), 1001);
+
+    // 出错的行号与行内位置
+    try {
+        ParseSystem("x + y\n\ny = = 1\n");
+        FAIL();
+    } catch (const SingleParseError &err) {
+        cout << err.what() << endl;
+        ASSERT_EQ(err.GetLine(), 2);
+        ASSERT_EQ(err.GetPos(), 4);
+    }
+
+    try {
+        ParseSystem("x + y\n= 1\nx +\n");
+        FAIL();
+    } catch (const MultiParseError &err) { cout << err.what() << endl; }
+
+    ASSERT_THROW(ParseSystem("# 只有注释\n\n"), ParseError);
+}
+
+TEST(Parse, SystemFile) {
+    MemoryLeakDetection mld;
+
+    std::string filename = "parse_system_test.txt";
+    std::shared_ptr<void> defer(nullptr, [&](...) {
+        std::remove(filename.c_str());
+    });
+    {
+        std::ofstream out(filename, std::ios::binary);
+        out << "x^2 + y^2 = 1\nx = y # 对角线\n";
+    }
+
+    auto system = ParseSystemFile(filename);
+    ASSERT_EQ(system.equations.Rows(), 2);
+    ASSERT_TRUE(system.equations[1]->Equal("x - y"_f));
+    ASSERT_EQ(system.vars, (std::vector<std::string>{"x", "y"}));
+
+    auto solution = Solve(system.equations);
+    ASSERT_NEAR(std::abs(solution["x"]), std::sqrt(0.5), 1e-6);
+    ASSERT_NEAR(solution["x"], solution["y"], 1e-6);
+
+    ASSERT_THROW(ParseSystemFile("file_does_not_exist.txt"), std::runtime_error);
+}
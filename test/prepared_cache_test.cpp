@@ -0,0 +1,202 @@
+#include "config.h"
+#include "nonlinear.h"
+#include "parse.h"
+#include "prepared_cache.h"
+
+#include "memory_leak_detection.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+using namespace tomsolver;
+
+using std::cout;
+using std::endl;
+
+TEST(PreparedCache, Base) {
+    MemoryLeakDetection mld;
+
+    if (!PreparedCache::IsSupported()) {
+        return;
+    }
+
+    // 在临时目录下使用本进程专用的缓存目录，结束时删除
+    auto tmp = std::getenv("TMPDIR");
+    std::string dir = std::string(tmp && *tmp ? tmp : "/tmp") + "/tomsolver_prepared_cache_test_base_";
+#if defined(__unix__) || defined(__APPLE__)
+    dir += std::to_string(getpid());
+#endif
+    Config::Get().preparedCacheDir = dir;
+    std::shared_ptr<void> defer(nullptr, [](...) {
+        PreparedCache::Get().Clear();
+        std::remove(Config::Get().preparedCacheDir.c_str());
+        Config::Get().Reset();
+    });
+    PreparedCache::Get().Clear();
+
+    SymVec f = {"exp(-exp(-(x1 + x2))) - x2 * (1 + x1 ^ 2)"_f, "x1 * cos(x2) + x2 * sin(x1) - 0.5"_f};
+    std::vector<std::string> vars{"x1", "x2"};
+    auto path = PreparedCache::Path(f, vars);
+    cout << path << endl;
+
+    // 第一次未命中，写入缓存
+    auto system = Prepare(f, vars);
+    ASSERT_EQ(PreparedCache::Get().Misses(), 1);
+    ASSERT_EQ(PreparedCache::Get().Hits(), 0);
+    ASSERT_TRUE(std::ifstream(path).good());
+    ASSERT_GT(PreparedCache::Get().DiskUsage(), 0);
+
+    // 第二次命中，结果与直接计算的一致
+    auto cached = Prepare(f, vars);
+    ASSERT_EQ(PreparedCache::Get().Hits(), 1);
+    ASSERT_EQ(cached.vars, vars);
+    ASSERT_EQ(cached.equations, f);
+    ASSERT_EQ(cached.jacobian, Jacobian(f, vars));
+    ASSERT_EQ(Solve(cached), Solve(f));
+
+    // 变量顺序不同是另一个模型
+    ASSERT_NE(PreparedCache::Path(f, {"x2", "x1"}), path);
+    Prepare(f, {"x2", "x1"});
+    ASSERT_EQ(PreparedCache::Get().Misses(), 2);
+
+    // 损坏的文件视为未命中，并被覆盖
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << "TSBN garbage";
+    }
+    auto recovered = Prepare(f, vars);
+    ASSERT_EQ(PreparedCache::Get().Misses(), 3);
+    ASSERT_EQ(recovered.jacobian, system.jacobian);
+    Prepare(f, vars);
+    ASSERT_EQ(PreparedCache::Get().Hits(), 2);
+
+    PreparedCache::Get().Clear();
+    ASSERT_EQ(PreparedCache::Get().DiskUsage(), 0);
+    ASSERT_FALSE(std::ifstream(path).good());
+
+    // 不能求导的方程组抛出异常，不写入缓存
+    ASSERT_THROW(Prepare(SymVec{"x%2 - 1"_f}), std::runtime_error);
+    ASSERT_EQ(PreparedCache::Get().DiskUsage(), 0);
+    Config::Get().preparedCacheDir.clear();
+    ASSERT_THROW(Prepare(SymVec{"x%2 - 1"_f}), std::runtime_error);
+    Config::Get().preparedCacheDir = dir;
+}
+
+TEST(PreparedCache, Evict) {
+    MemoryLeakDetection mld;
+
+    if (!PreparedCache::IsSupported()) {
+        return;
+    }
+
+    // 在临时目录下使用本进程专用的缓存目录，结束时删除
+    auto tmp = std::getenv("TMPDIR");
+    std::string dir = std::string(tmp && *tmp ? tmp : "/tmp") + "/tomsolver_prepared_cache_test_evict_";
+#if defined(__unix__) || defined(__APPLE__)
+    dir += std::to_string(getpid());
+#endif
+    Config::Get().preparedCacheDir = dir;
+    std::shared_ptr<void> defer(nullptr, [](...) {
+        PreparedCache::Get().Clear();
+        std::remove(Config::Get().preparedCacheDir.c_str());
+        Config::Get().Reset();
+    });
+    PreparedCache::Get().Clear();
+
+    // 大小相同的几个模型
+    auto model = [](int i) {
+        return SymVec{Parse("x^2 + y - " + std::to_string(i)), "x - y"_f};
+    };
+    std::vector<std::string> vars{"x", "y"};
+    auto exists = [&](int i) {
+        return std::ifstream(PreparedCache::Path(model(i), vars)).good();
+    };
+    // 文件的修改时间精度可能只有几毫秒
+    auto wait = [] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    };
+
+    Prepare(model(0), vars);
+    auto fileSize = PreparedCache::Get().DiskUsage();
+    Config::Get().preparedCacheMaxBytes = fileSize * 2 + fileSize / 2;
+
+    wait();
+    Prepare(model(1), vars);
+    wait();
+    Prepare(model(2), vars);
+    ASSERT_EQ(PreparedCache::Get().DiskUsage(), fileSize * 2);
+    ASSERT_FALSE(exists(0));
+    ASSERT_TRUE(exists(1));
+    ASSERT_TRUE(exists(2));
+
+    // 命中后成为最近使用的，淘汰的是另一个
+    wait();
+    Prepare(model(1), vars);
+    ASSERT_EQ(PreparedCache::Get().Hits(), 1);
+    wait();
+    Prepare(model(3), vars);
+    ASSERT_TRUE(exists(1));
+    ASSERT_FALSE(exists(2));
+    ASSERT_TRUE(exists(3));
+}
+
+TEST(PreparedCache, Concurrent) {
+    MemoryLeakDetection mld;
+
+    if (!PreparedCache::IsSupported()) {
+        return;
+    }
+
+    // 在临时目录下使用本进程专用的缓存目录，结束时删除
+    auto tmp = std::getenv("TMPDIR");
+    std::string dir = std::string(tmp && *tmp ? tmp : "/tmp") + "/tomsolver_prepared_cache_test_concurrent_";
+#if defined(__unix__) || defined(__APPLE__)
+    dir += std::to_string(getpid());
+#endif
+    Config::Get().preparedCacheDir = dir;
+    std::shared_ptr<void> defer(nullptr, [](...) {
+        PreparedCache::Get().Clear();
+        std::remove(Config::Get().preparedCacheDir.c_str());
+        Config::Get().Reset();
+    });
+    PreparedCache::Get().Clear();
+
+    SymVec f = {"exp(-exp(-(x1 + x2))) - x2 * (1 + x1 ^ 2)"_f, "x1 * cos(x2) + x2 * sin(x1) - 0.5"_f};
+    std::vector<std::string> vars{"x1", "x2"};
+    auto expected = Jacobian(f, vars);
+
+    // 多个线程同时读写同一个缓存文件，不会读到写了一半的内容
+    std::vector<std::thread> threads;
+    std::vector<int> ok(8, 0);
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 20; ++i) {
+                auto system = Prepare(f, vars);
+                if (!(system.jacobian == expected)) {
+                    return;
+                }
+                if (i % 5 == 0) {
+                    // 迫使其他线程未命中后重写
+                    std::remove(PreparedCache::Path(f, vars).c_str());
+                }
+            }
+            ok[t] = 1;
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQ(ok, std::vector<int>(8, 1));
+    ASSERT_EQ(PreparedCache::Get().Hits() + PreparedCache::Get().Misses(), 160);
+}
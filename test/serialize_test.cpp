@@ -0,0 +1,155 @@
+#include "functions.h"
+#include "mapped_file.h"
+#include "nonlinear.h"
+#include "parse.h"
+#include "serialize.h"
+
+#include "helper.h"
+#include "memory_leak_detection.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+
+using namespace tomsolver;
+
+using std::cout;
+using std::endl;
+
+TEST(Serialize, Node) {
+    MemoryLeakDetection mld;
+
+    Node n = (Var("a") + Num(0.1)) * Var("b") - sin(Var("a")) / Num(-2) + Num(1e-300);
+    auto data = Serialize(n);
+    ASSERT_EQ(std::string(data, 0, 4), "TSBN");
+
+    Node n2 = DeserializeNode(data.data(), data.size());
+    n2->CheckParent();
+    ASSERT_TRUE(n2->Equal(n));
+
+    // 数值按位保存
+    for (double v : {0.1, -0.0, 1e-310, std::numeric_limits<double>::max(), 3.141592653589793}) {
+        auto data = Serialize(Num(v));
+        Node num = DeserializeNode(data.data(), data.size());
+        double got = num->Vpa();
+        ASSERT_EQ(std::memcmp(&got, &v, sizeof(double)), 0);
+    }
+
+    // 重复的变量只保存一次
+    ASSERT_LT(Serialize("x*x*x*x"_f).size(), Serialize("x*y*z*w"_f).size());
+}
+
+TEST(Serialize, Random) {
+    MemoryLeakDetection mld;
+
+    for (int i = 0; i < 10; ++i) {
+        auto pr = CreateRandomExpresionTree(100);
+        Node &node = pr.first;
+
+        auto data = Serialize(node);
+        Node n2 = DeserializeNode(data.data(), data.size());
+        ASSERT_TRUE(n2->Equal(node));
+        ASSERT_EQ(Serialize(n2), data);
+    }
+}
+
+TEST(Serialize, DoNotStackOverFlow) {
+    MemoryLeakDetection mld;
+
+    auto pr = CreateRandomExpresionTree(100000);
+    Node &node = pr.first;
+
+    auto data = Serialize(node);
+    Node n2 = DeserializeNode(data.data(), data.size());
+    ASSERT_TRUE(n2->Equal(node));
+}
+
+TEST(Serialize, SymMat) {
+    MemoryLeakDetection mld;
+
+    SymMat mat = {{"x^2+y"_f, Num(2)}, {Var("z"), "sin(x)*cos(y)"_f}};
+    auto data = Serialize(mat);
+    SymMat mat2 = DeserializeSymMat(data.data(), data.size());
+    ASSERT_EQ(mat2, mat);
+
+    SymVec vec = {"a+b"_f, "a-b"_f, Num(3)};
+    data = Serialize(vec);
+    SymVec vec2 = DeserializeSymMat(data.data(), data.size()).ToSymVec();
+    ASSERT_EQ(vec2, vec);
+}
+
+TEST(Serialize, PreparedSystem) {
+    MemoryLeakDetection mld;
+
+    SymVec f = {"exp(-exp(-(x1 + x2))) - x2 * (1 + x1 ^ 2)"_f, "x1 * cos(x2) + x2 * sin(x1) - 0.5"_f};
+    auto system = Prepare(f, {"x2", "x1"});
+    auto data = Serialize(system);
+
+    auto system2 = DeserializePreparedSystem(data.data(), data.size());
+    ASSERT_EQ(system2.vars, system.vars);
+    ASSERT_EQ(system2.equations, system.equations);
+    ASSERT_EQ(system2.jacobian, system.jacobian);
+
+    auto ans = Solve(system);
+    ASSERT_EQ(Solve(system2), ans);
+    ASSERT_EQ(Solve(f), ans);
+
+    // 从内存映射的文件中直接加载
+    std::string filename = "serialize_test.bin";
+    std::shared_ptr<void> defer(nullptr, [&](...) {
+        std::remove(filename.c_str());
+    });
+    {
+        std::ofstream out(filename, std::ios::binary);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+    MappedFile file(filename);
+    ASSERT_EQ(file.Size(), data.size());
+    auto system3 = DeserializePreparedSystem(file.Data(), file.Size());
+    ASSERT_EQ(Solve(system3), ans);
+
+    // 变量表与方程不一致
+    ASSERT_THROW(Solve(VarsTable{{"x1", 0}, {"x3", 0}}, system3), std::runtime_error);
+}
+
+TEST(Serialize, InvalidData) {
+    MemoryLeakDetection mld;
+
+    auto data = Serialize(SymVec{"x^2+y"_f, "sin(x)"_f});
+
+    // 截断在任何位置都要报错
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        ASSERT_THROW(DeserializeSymMat(data.data(), i), std::runtime_error);
+    }
+    ASSERT_THROW(DeserializeSymMat((data + '\0').data(), data.size() + 1), std::runtime_error);
+
+    // 类型不符
+    ASSERT_THROW(DeserializeNode(data.data(), data.size()), std::runtime_error);
+    ASSERT_THROW(DeserializePreparedSystem(data.data(), data.size()), std::runtime_error);
+
+    // 版本号、字节序标记不符
+    auto bad = data;
+    bad[4] = 99;
+    ASSERT_THROW(DeserializeSymMat(bad.data(), bad.size()), std::runtime_error);
+    bad = data;
+    bad[8] ^= 0x7F;
+    ASSERT_THROW(DeserializeSymMat(bad.data(), bad.size()), std::runtime_error);
+
+    // 随机篡改字节，要么抛出runtime_error，要么得到一个合法的矩阵
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        for (int v : {0x00, 0x01, 0x7F, 0xFE, 0xFF}) {
+            bad = data;
+            bad[i] = static_cast<char>(v);
+            try {
+                auto mat = DeserializeSymMat(bad.data(), bad.size());
+                ASSERT_GT(mat.Rows(), 0);
+            } catch (const std::runtime_error &) {
+            }
+        }
+    }
+}
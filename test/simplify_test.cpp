@@ -1,5 +1,8 @@
 #include "simplify.h"
+#include "error_type.h"
 #include "functions.h"
+#include "parse.h"
+#include "vars_table.h"
 
 #include "helper.h"
 #include "memory_leak_detection.h"
@@ -80,4 +83,75 @@ TEST(Simplify, DoNotStackOverFlow) {
     Node &node = pr.first;
 
     Simplify(node);
-}
\ No newline at end of file
+}
+
+TEST(Simplify, Canonical) {
+    MemoryLeakDetection mld;
+
+    auto simplified = [](Node n) {
+        Simplify(n);
+        n->CheckParent();
+        return n->ToString();
+    };
+
+    // 合并系数与同类项
+    ASSERT_EQ(simplified(Num(2) * (Var("x") ^ Num(1)) * Num(1)), "2*x");
+    ASSERT_EQ(simplified(Num(2) * Var("x") * Num(3) * Var("x")), "6*x^2");
+    ASSERT_EQ(simplified(Var("x") + Num(2) * Var("x") - Var("y") * Num(3) + Var("y")), "3*x-2*y");
+    ASSERT_EQ(simplified(Var("x") * Var("y") / (Var("x") ^ Num(3))), "y/x^2");
+    ASSERT_EQ(simplified(Var("x") - Var("x")), "0");
+
+    // 展开嵌套的加减
+    ASSERT_EQ(simplified((Var("a") + Num(1)) - (Var("b") - Num(2)) + Num(1)), "4+a-b");
+
+    // 去掉单位元
+    ASSERT_EQ(simplified(Var("x") ^ Num(0)), "1");
+    ASSERT_EQ(simplified(Num(0) - Var("x")), "-x");
+    ASSERT_EQ(simplified((Var("x") ^ Num(2)) ^ Num(3)), "x^6");
+
+    // 交换律：化简后结构一致
+    Node n1 = Var("x") * sin(Var("y")) + Var("z");
+    Node n2 = Var("z") + sin(Var("y")) * Var("x");
+    Simplify(n1);
+    Simplify(n2);
+    ASSERT_TRUE(n1->Equal(n2));
+}
+
+TEST(Simplify, KeepValue) {
+    MemoryLeakDetection mld;
+
+    VarsTable table{{"x", 0.3}, {"y", -1.7}, {"z", 2.5}};
+    for (auto &s : {"x*(y+z)-2*y*x/z+x^2*x", "-(x-y)*(z-x)/(x*y)", "sin(x)*cos(y)/sin(x)+3*x-x*3", "(x+y)^2-x^2"}) {
+        Node n = Parse(s);
+        auto expected = n->Vpa(table);
+        Simplify(n);
+        n->CheckParent();
+        ASSERT_NEAR(n->Vpa(table), expected, 1e-12) << s << " -> " << n->ToString();
+    }
+
+    // x = 0时负整数次幂无定义，正、负次幂相消后仍然无定义
+    VarsTable zero{{"x", 0}, {"y", 2}};
+    for (auto &s : {"x/x", "x*y/x", "x^2/x", "x^3*y/x^2", "x/x^3"}) {
+        Node n = Parse(s);
+        ASSERT_THROW(n->Vpa(zero), MathError);
+        Simplify(n);
+        n->CheckParent();
+        ASSERT_THROW(n->Vpa(zero), MathError) << s << " -> " << n->ToString();
+    }
+
+    // x < 0时非整数次幂无定义，化简后仍然无定义；整数次幂照常合并
+    VarsTable negative{{"x", -2}};
+    for (auto &s : {"(x^0.5)^2", "x^0.5*x^0.5", "x^1.5/x^0.5", "x*x^0.5*x^2*x^0.5"}) {
+        Node n = Parse(s);
+        ASSERT_THROW(n->Vpa(negative), MathError);
+        Simplify(n);
+        n->CheckParent();
+        ASSERT_THROW(n->Vpa(negative), MathError) << s << " -> " << n->ToString();
+    }
+    for (auto &s : {"(x^3)^2/x", "x^2*x^-3*x^4"}) {
+        Node n = Parse(s);
+        auto expected = n->Vpa(negative);
+        Simplify(n);
+        ASSERT_NEAR(n->Vpa(negative), expected, 1e-12) << s << " -> " << n->ToString();
+    }
+}
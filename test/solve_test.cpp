@@ -177,4 +177,160 @@ TEST(Solve, Case2) {
         {"a", -0.129148906397607}, {"b", 0.8602157139938529}, {"c", 1.2903235709907794}, {"d", 1.1611746645931726}};
 
     ASSERT_EQ(ans, expected);
-}
\ No newline at end of file
+}
+
+TEST(Solve, ScalarType) {
+    MemoryLeakDetection mld;
+
+    // 结束时恢复设置
+    std::shared_ptr<void> defer(nullptr, [&](...) {
+        Config::Get().Reset();
+    });
+
+    SymVec f = {
+        "exp(-exp(-(x1 + x2))) - x2 * (1 + x1 ^ 2)"_f,
+        "x1 * cos(x2) + x2 * sin(x1) - 0.5"_f,
+    };
+    Config::Get().initialValue = 0.0;
+    Config::Get().epsilon = 1.0e-12;
+    VarsTable expected = Solve(f);
+
+    // 先以float迭代，再以double迭代至收敛
+    Config::Get().nonlinearScalarType = ScalarType::FLOAT;
+    VarsTable got = Solve(f);
+    ASSERT_NEAR(got["x1"], expected["x1"], 1e-12);
+    ASSERT_NEAR(got["x2"], expected["x2"], 1e-12);
+
+    Config::Get().nonlinearScalarType = ScalarType::LONG_DOUBLE;
+    got = Solve(f);
+    ASSERT_NEAR(got["x1"], expected["x1"], 1e-12);
+    ASSERT_NEAR(got["x2"], expected["x2"], 1e-12);
+}
+
+TEST(Solve, MixedPrecisionLinearSolve) {
+    MemoryLeakDetection mld;
+
+    // 结束时恢复设置
+    std::shared_ptr<void> defer(nullptr, [&](...) {
+        Config::Get().Reset();
+    });
+
+    SymVec f = {
+        "exp(-exp(-(x1 + x2))) - x2 * (1 + x1 ^ 2)"_f,
+        "x1 * cos(x2) + x2 * sin(x1) - 0.5"_f,
+    };
+    Config::Get().initialValue = 0.0;
+    Config::Get().epsilon = 1.0e-12;
+    VarsTable expected = Solve(f);
+
+    Config::Get().mixedPrecisionLinearSolve = true;
+    VarsTable got = Solve(f);
+    ASSERT_NEAR(got["x1"], expected["x1"], 1e-12);
+    ASSERT_NEAR(got["x2"], expected["x2"], 1e-12);
+}
+
+TEST(Solve, EvaluationCache) {
+    MemoryLeakDetection mld;
+
+    // 结束时恢复设置
+    std::shared_ptr<void> defer(nullptr, [&](...) {
+        Config::Get().Reset();
+    });
+
+    SymVec f = {
+        "exp(-exp(-(x1 + x2))) - x2 * (1 + x1 ^ 2)"_f,
+        "x1 * cos(x2) + x2 * sin(x1) - 0.5"_f,
+    };
+    Config::Get().nonlinearMethod = NonlinearMethod::LM;
+
+    Config::Get().evaluationCacheSize = 0;
+    VarsTable expected = Solve(f);
+    SolveStats uncached = LastSolveStats();
+    ASSERT_EQ(uncached.cacheHits, 0);
+    ASSERT_GT(uncached.iterations, 0);
+
+    // 结果完全相同，但实际求值的次数更少
+    Config::Get().Reset();
+    Config::Get().nonlinearMethod = NonlinearMethod::LM;
+    VarsTable got = Solve(f);
+    const SolveStats &stats = LastSolveStats();
+    cout << "iterations = " << stats.iterations << ", F: " << uncached.residualEvaluations << " -> "
+         << stats.residualEvaluations << ", J: " << uncached.jacobianEvaluations << " -> " << stats.jacobianEvaluations
+         << ", hits = " << stats.cacheHits << endl;
+    ASSERT_EQ(got, expected);
+    ASSERT_EQ(stats.iterations, uncached.iterations);
+    ASSERT_GT(stats.cacheHits, 0);
+    ASSERT_EQ(stats.cacheHits + stats.cacheMisses, uncached.cacheMisses);
+    ASSERT_EQ(stats.residualEvaluations + stats.jacobianEvaluations, stats.cacheMisses);
+    ASSERT_LT(stats.residualEvaluations, uncached.residualEvaluations);
+    ASSERT_LE(stats.jacobianEvaluations, uncached.jacobianEvaluations);
+
+    // Newton-Raphson方法每个点只计算一次F与J
+    Config::Get().nonlinearMethod = NonlinearMethod::NEWTON_RAPHSON;
+    Solve(f);
+    ASSERT_EQ(LastSolveStats().residualEvaluations, static_cast<std::size_t>(LastSolveStats().iterations) + 1);
+    ASSERT_EQ(LastSolveStats().jacobianEvaluations, static_cast<std::size_t>(LastSolveStats().iterations));
+}
+
+TEST(Solve, LineSearchMethod) {
+    MemoryLeakDetection mld;
+
+    // 结束时恢复设置
+    std::shared_ptr<void> defer(nullptr, [&](...) {
+        Config::Get().Reset();
+    });
+
+    SymVec f = {
+        "a*cos(x1) + b*cos(x1-x2) + c*cos(x1-x2-x3) - 0.5"_f,
+        "a*sin(x1) + b*sin(x1-x2) + c*sin(x1-x2-x3) - 0.4"_f,
+        "x1-x2-x3"_f,
+    };
+    f.Subs(VarsTable{{"a", 0.425}, {"b", 0.39243}, {"c", 0.109}});
+    VarsTable expected{{"x1", 1.5722855035930956}, {"x2", 1.6360330989069252}, {"x3", -0.0637475947386077}};
+
+    Config::Get().nonlinearMethod = NonlinearMethod::LM;
+    for (auto method : {LineSearchMethod::ARMIJO, LineSearchMethod::STRONG_WOLFE, LineSearchMethod::NON_MONOTONE}) {
+        Config::Get().lineSearchMethod = method;
+        VarsTable got = Solve(f);
+        cout << "method = " << static_cast<int>(method) << ", iterations = " << LastSolveStats().iterations
+             << ", F: " << LastSolveStats().residualEvaluations << ", J: " << LastSolveStats().jacobianEvaluations
+             << endl;
+        ASSERT_EQ(got, expected);
+    }
+}
+
+TEST(Solve, Homotopy) {
+    MemoryLeakDetection mld;
+
+    // 结束时恢复设置
+    std::shared_ptr<void> defer(nullptr, [&](...) {
+        Config::Get().Reset();
+    });
+    Config::Get().logLevel = LogLevel::OFF;
+
+    // 从x = 2出发，Newton法在arctan上发散
+    SymVec f = {"arctan(x)"_f};
+    VarsTable init{{"x", 2}};
+    ASSERT_ANY_THROW(SolveByNewtonRaphson(init, f));
+
+    VarsTable got = SolveByHomotopy(init, f);
+    ASSERT_NEAR(got["x"], 0, 1e-9);
+    cout << "iterations = " << LastSolveStats().iterations << endl;
+    ASSERT_GT(LastSolveStats().iterations, 1);
+
+    // 同样发散的二维方程组，通过Solve()调用
+    SymVec g = {"arctan(x - 1) + 0.1*y"_f, "arctan(y + 1) - 0.1*x"_f};
+    Config::Get().initialValue = 3;
+    ASSERT_ANY_THROW(Solve(g));
+    Config::Get().nonlinearMethod = NonlinearMethod::HOMOTOPY;
+    got = Solve(g);
+    auto check = Mat(g.Vpa(got));
+    ASSERT_LT(check.NormInfinity(), 1e-9);
+
+    // 预处理好的方程组
+    auto system = Prepare(g);
+    ASSERT_EQ(Solve(VarsTable(system.vars, 3), system), got);
+
+    // 方程数量与未知量数量不等
+    ASSERT_THROW(SolveByHomotopy(VarsTable{{"x", 1}, {"y", 1}}, SymVec{"x + y"_f}), std::runtime_error);
+}
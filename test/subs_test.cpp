@@ -1,11 +1,16 @@
 #include "subs.h"
+#include "config.h"
 #include "functions.h"
+#include "parallel.h"
+#include "parse.h"
 
 #include "memory_leak_detection.h"
 
 #include <gtest/gtest.h>
 
+#include <memory>
 #include <random>
+#include <stdexcept>
 
 using namespace tomsolver;
 
@@ -61,4 +66,41 @@ TEST(Subs, Multiple) {
         n = Subs(std::move(n), {"x"}, {cos(Var("y"))});
         ASSERT_EQ(n->ToString(), "y*cos(y)+sin(y)");
     }
-}
\ No newline at end of file
+}
+
+TEST(Subs, VpaWithVarsTable) {
+    MemoryLeakDetection mld;
+
+    std::shared_ptr<void> defer(nullptr, [](...) {
+        Config::Get().Reset();
+    });
+
+    Node n = "x*sin(y)+x^2/(1+exp(-y))-3"_f;
+    VarsTable table{{"x", 1.5}, {"y", -0.7}};
+
+    auto expected = Subs(n, table)->Vpa();
+    ASSERT_DOUBLE_EQ(n->Vpa(table), expected);
+
+    // 自身不被修改
+    ASSERT_EQ(n->ToString(), "x*sin(y)+x^2/(1+exp(-y))-3");
+
+    // 变量不在表中
+    ASSERT_THROW(n->Vpa(VarsTable{{"x", 1}}), std::out_of_range);
+
+    // 对同一个矩阵并发求值
+    SymVec f{Clone(n), "x*y"_f, Num(2)};
+    Config::Get().threadNum = 4;
+    std::vector<double> results(64);
+    internal::ParallelFor(static_cast<int>(results.size()), [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            results[i] = f.Vpa(table).Norm2();
+        }
+    });
+    Vec v = f.Vpa(table).ToVec();
+    ASSERT_DOUBLE_EQ(v[0], expected);
+    ASSERT_DOUBLE_EQ(v[1], 1.5 * -0.7);
+    ASSERT_DOUBLE_EQ(v[2], 2);
+    for (auto r : results) {
+        ASSERT_DOUBLE_EQ(r, v.Norm2());
+    }
+}
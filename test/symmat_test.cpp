@@ -1,10 +1,15 @@
 #include "symmat.h"
+#include "config.h"
+#include "error_type.h"
 #include "functions.h"
+#include "parse.h"
 
 #include "memory_leak_detection.h"
 
 #include <gtest/gtest.h>
 
+#include <limits>
+#include <memory>
 #include <random>
 
 using namespace tomsolver;
@@ -42,4 +47,89 @@ TEST(SymMat, Multiply) {
     cout << ret << endl;
 
     ASSERT_EQ(ret, expected);
-}
\ No newline at end of file
+}
+
+TEST(SymMat, Jacobian) {
+    MemoryLeakDetection mld;
+
+    std::shared_ptr<void> defer(nullptr, [](...) {
+        Config::Get().Reset();
+    });
+
+    SymVec f{"x^2+y"_f, "sin(x)*z"_f, "exp(y)-z^3"_f, "x*y*z"_f, "a+1"_f};
+    std::vector<std::string> vars{"x", "y", "z"};
+
+    Config::Get().threadNum = 1;
+    SymMat serial = Jacobian(f, vars);
+
+    // 方程中不含的变量，偏导数为0
+    ASSERT_TRUE(serial.Value(0, 2)->Equal(Num(0)));
+    ASSERT_TRUE(serial.Value(1, 1)->Equal(Num(0)));
+    ASSERT_TRUE(serial.Value(4, 0)->Equal(Num(0)));
+
+    // 多线程的结果与单线程完全一致
+    for (int threadNum : {0, 2, 4}) {
+        Config::Get().threadNum = threadNum;
+        ASSERT_EQ(Jacobian(f, vars), serial);
+    }
+}
+
+TEST(SymMat, SparseJacobian) {
+    MemoryLeakDetection mld;
+
+    // 三对角的方程组，大部分元素为0
+    int n = 20;
+    SymVec f(n);
+    std::vector<std::string> vars;
+    for (int i = 0; i < n; ++i) {
+        vars.emplace_back("x" + std::to_string(i));
+    }
+    for (int i = 0; i < n; ++i) {
+        Node eq = Var(vars[i]) ^ Num(2);
+        if (i > 0) {
+            eq = std::move(eq) + Var(vars[i - 1]);
+        }
+        if (i + 1 < n) {
+            eq = std::move(eq) - Num(2) * Var(vars[i + 1]);
+        }
+        f[i] = std::move(eq);
+    }
+
+    SymMat ja = Jacobian(f, vars);
+
+    VarsTable table(vars, 3);
+    Mat m = ja.Clone().Subs(table).Calc().ToMat();
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            double expected = j == i ? 6 : (j == i - 1 ? 1 : (j == i + 1 ? -2 : 0));
+            ASSERT_DOUBLE_EQ(m.Value(i, j), expected);
+        }
+    }
+
+    // 以std::map替换，结果一致
+    std::map<std::string, double> dict;
+    for (auto &var : vars) {
+        dict[var] = 3;
+    }
+    ASSERT_EQ(ja.Clone().Subs(dict).Calc().ToMat(), m);
+}
+
+TEST(SymMat, InvalidValue) {
+    MemoryLeakDetection mld;
+
+    std::shared_ptr<void> defer(nullptr, [](...) {
+        Config::Get().Reset();
+    });
+
+    auto inf = std::numeric_limits<double>::infinity();
+    SymMat m = {{Var("x"), Num(inf)}};
+    VarsTable table{{"x", 1}};
+
+    // 数值元素不必计算，但与表达式一样检查无效值
+    ASSERT_THROW(m.Vpa(table), MathError);
+    ASSERT_THROW(m.Clone().Subs(table).Calc(), MathError);
+
+    Config::Get().throwOnInvalidValue = false;
+    ASSERT_EQ(m.Vpa(table).Value(0, 1), inf);
+    ASSERT_EQ(m.Clone().Subs(table).Calc().ToMat().Value(0, 1), inf);
+}